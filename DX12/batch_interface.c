@@ -0,0 +1,226 @@
+#include "batch_interface.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+// Batch keys hold the PSO handle, mesh, level of detail and material from
+// the most significant bit down, with the index of the draw below them
+#define BATCH_KEY_DRAW_BITS 16
+#define BATCH_KEY_DRAW_MASK ((1u << BATCH_KEY_DRAW_BITS) - 1)
+#define BATCH_KEY_MATERIAL_SHIFT BATCH_KEY_DRAW_BITS
+#define BATCH_KEY_LOD_SHIFT 32
+#define BATCH_KEY_MESH_SHIFT 36
+#define BATCH_KEY_PSO_SHIFT 48
+
+void create_batch(struct gpu_device_info *device_info,
+        struct batch_info *batch_info)
+{
+        assert(batch_info->frame_count <= MAX_BATCH_FRAMES);
+        assert(batch_info->max_instances <= 1u << BATCH_KEY_DRAW_BITS);
+
+        batch_info->mesh_count = 0;
+        batch_info->draw_count = 0;
+        batch_info->group_count = 0;
+        batch_info->frame_index = 0;
+        memset(&batch_info->stats, 0, sizeof (struct batch_stats));
+
+        batch_info->draws = malloc(batch_info->max_instances *
+                sizeof (UINT64));
+        batch_info->sort_scratch = malloc(batch_info->max_instances *
+                sizeof (UINT64));
+        batch_info->transforms = malloc(batch_info->max_instances *
+                sizeof (mat4x4));
+        batch_info->groups = malloc(batch_info->max_instances *
+                sizeof (struct batch_group));
+
+        // Create a persistently mapped instance buffer per frame
+        for (UINT i = 0; i < batch_info->frame_count; ++i) {
+                struct gpu_resource_info *instance_buffer =
+                        &batch_info->instance_buffers[i];
+                create_wstring(instance_buffer->name,
+                        L"Batch instance buffer %d", i);
+                instance_buffer->type = D3D12_HEAP_TYPE_UPLOAD;
+                instance_buffer->dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+                instance_buffer->width = batch_info->max_instances *
+                        sizeof (mat4x4);
+                instance_buffer->height = 1;
+                instance_buffer->mip_levels = 1;
+                instance_buffer->format = DXGI_FORMAT_UNKNOWN;
+                instance_buffer->layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+                instance_buffer->flags = D3D12_RESOURCE_FLAG_NONE;
+                instance_buffer->current_state =
+                        D3D12_RESOURCE_STATE_GENERIC_READ;
+                create_resource(device_info, instance_buffer);
+
+                batch_info->instance_data[i] = map_resource(instance_buffer);
+        }
+}
+
+void release_batch(struct batch_info *batch_info)
+{
+        for (UINT i = 0; i < batch_info->frame_count; ++i) {
+                unmap_resource(&batch_info->instance_buffers[i]);
+                release_resource(&batch_info->instance_buffers[i]);
+        }
+
+        free(batch_info->groups);
+        free(batch_info->transforms);
+        free(batch_info->sort_scratch);
+        free(batch_info->draws);
+}
+
+UINT add_batch_mesh(struct batch_info *batch_info,
+        struct gpu_resource_info *vert_buffer, UINT vert_stride,
+        struct gpu_resource_info *index_buffer, UINT index_count,
+        UINT start_index, INT base_vertex)
+{
+        assert(batch_info->mesh_count < MAX_BATCH_MESHES);
+
+        struct batch_mesh_info *mesh_info =
+                &batch_info->meshes[batch_info->mesh_count];
+        mesh_info->vert_buffer = vert_buffer;
+        mesh_info->vert_stride = vert_stride;
+        mesh_info->index_buffer = index_buffer;
+        mesh_info->base_vertex = base_vertex;
+        mesh_info->lod_count = 1;
+        mesh_info->lods[0].index_count = index_count;
+        mesh_info->lods[0].start_index = start_index;
+
+        return batch_info->mesh_count++;
+}
+
+UINT add_batch_mesh_lod(struct batch_info *batch_info, UINT mesh_index,
+        UINT index_count, UINT start_index)
+{
+        assert(mesh_index < batch_info->mesh_count);
+
+        struct batch_mesh_info *mesh_info = &batch_info->meshes[mesh_index];
+        assert(mesh_info->lod_count < MAX_BATCH_LODS);
+
+        struct batch_mesh_lod *lod = &mesh_info->lods[mesh_info->lod_count];
+        lod->index_count = index_count;
+        lod->start_index = start_index;
+
+        return mesh_info->lod_count++;
+}
+
+void begin_batch(struct batch_info *batch_info, UINT frame_index)
+{
+        assert(frame_index < batch_info->frame_count);
+
+        batch_info->frame_index = frame_index;
+        batch_info->draw_count = 0;
+        batch_info->group_count = 0;
+        memset(&batch_info->stats, 0, sizeof (struct batch_stats));
+}
+
+void add_batch_draw(struct batch_info *batch_info, UINT mesh_index,
+        UINT lod_index, UINT pso_handle, UINT material_index,
+        mat4x4 transform)
+{
+        assert(mesh_index < batch_info->mesh_count);
+        assert(lod_index < batch_info->meshes[mesh_index].lod_count);
+
+        if (batch_info->draw_count == batch_info->max_instances) {
+                ++batch_info->stats.dropped_draw_count;
+                return;
+        }
+
+        UINT draw_index = batch_info->draw_count++;
+
+        assert(pso_handle < 0x10000);
+        assert(material_index < 0x10000);
+
+        // The sort is stable so draws keep their submission order in a group
+        batch_info->draws[draw_index] =
+                ((UINT64) pso_handle << BATCH_KEY_PSO_SHIFT) |
+                ((UINT64) mesh_index << BATCH_KEY_MESH_SHIFT) |
+                ((UINT64) lod_index << BATCH_KEY_LOD_SHIFT) |
+                ((UINT64) material_index << BATCH_KEY_MATERIAL_SHIFT) |
+                draw_index;
+
+        memcpy(batch_info->transforms[draw_index], transform, sizeof (mat4x4));
+}
+
+void build_batch(struct batch_info *batch_info)
+{
+        radix_sort_keys(batch_info->job_system, batch_info->draws,
+                batch_info->sort_scratch, batch_info->draw_count,
+                BATCH_KEY_DRAW_BITS);
+
+        mat4x4 *instance_data = batch_info->instance_data[
+                batch_info->frame_index];
+
+        struct batch_group *group = NULL;
+        UINT64 group_key = 0;
+        batch_info->group_count = 0;
+
+        for (UINT i = 0; i < batch_info->draw_count; ++i) {
+                UINT64 key = batch_info->draws[i] &
+                        ~(UINT64) BATCH_KEY_DRAW_MASK;
+                UINT draw_index = (UINT) (batch_info->draws[i] &
+                        BATCH_KEY_DRAW_MASK);
+
+                // Start a new group whenever the PSO, mesh, level of detail
+                // or material changes
+                if (group == NULL || key != group_key) {
+                        group_key = key;
+                        group = &batch_info->groups[batch_info->group_count++];
+                        group->pso_handle = (UINT) (key >>
+                                BATCH_KEY_PSO_SHIFT);
+                        group->mesh_index = (UINT) (key >>
+                                BATCH_KEY_MESH_SHIFT) & 0xfff;
+                        group->lod_index = (UINT) (key >>
+                                BATCH_KEY_LOD_SHIFT) & 0xf;
+                        group->material_index = (UINT) (key >>
+                                BATCH_KEY_MATERIAL_SHIFT) & 0xffff;
+                        group->first_instance = i;
+                        group->instance_count = 0;
+                }
+
+                ++group->instance_count;
+
+                memcpy(instance_data[i], batch_info->transforms[draw_index],
+                        sizeof (mat4x4));
+        }
+
+        batch_info->stats.draw_count = batch_info->draw_count;
+        batch_info->stats.group_count = batch_info->group_count;
+}
+
+void queue_batch_draws(struct batch_info *batch_info,
+        struct draw_queue_info *queue_info, UINT layer, float depth,
+        UINT object_index)
+{
+        for (UINT i = 0; i < batch_info->group_count; ++i) {
+                struct batch_group *group = &batch_info->groups[i];
+                struct batch_mesh_info *mesh_info =
+                        &batch_info->meshes[group->mesh_index];
+                struct batch_mesh_lod *lod =
+                        &mesh_info->lods[group->lod_index];
+
+                // Groups pick their transforms through the start instance
+                struct draw_queue_cmd cmd;
+                cmd.pso_handle = group->pso_handle;
+                cmd.vert_buffer = mesh_info->vert_buffer;
+                cmd.vert_stride = mesh_info->vert_stride;
+                cmd.index_buffer = mesh_info->index_buffer;
+                cmd.instance_buffer =
+                        &batch_info->instance_buffers[batch_info->frame_index];
+                cmd.instance_stride = sizeof (mat4x4);
+                cmd.draw_constants.object_index = object_index;
+                cmd.draw_constants.material_index = group->material_index;
+                cmd.index_count = lod->index_count;
+                cmd.instance_count = group->instance_count;
+                cmd.start_index = lod->start_index;
+                cmd.base_vertex = mesh_info->base_vertex;
+                cmd.start_instance = group->first_instance;
+
+                push_draw_packet(queue_info, make_draw_key(layer,
+                        group->pso_handle, group->material_index, depth),
+                        &cmd);
+        }
+}
@@ -0,0 +1,93 @@
+#ifndef BATCH_INTERFACE_H
+#define BATCH_INTERFACE_H
+
+#include "gpu_interface.h"
+#include "draw_queue_interface.h"
+#include "radix_sort_interface.h"
+#include "job_interface.h"
+#include "linmath.h"
+
+
+// Draws added during a frame are grouped by PSO, mesh and material. The
+// transforms of each group are written next to each other into the instance
+// buffer of the frame, which is bound as the second vertex stream, and each
+// group is pushed to the draw queue as a single instanced draw. Levels of
+// detail of a mesh are index ranges of the same buffers, and the instances
+// at the same level of a mesh stay one draw.
+#define MAX_BATCH_MESHES 64
+#define MAX_BATCH_LODS 8
+#define MAX_BATCH_FRAMES 4
+
+struct batch_mesh_lod {
+        UINT index_count;
+        UINT start_index;
+};
+
+struct batch_mesh_info {
+        struct gpu_resource_info *vert_buffer;
+        UINT vert_stride;
+        struct gpu_resource_info *index_buffer;
+        INT base_vertex;
+        UINT lod_count;
+        struct batch_mesh_lod lods[MAX_BATCH_LODS];
+};
+
+struct batch_group {
+        UINT pso_handle;
+        UINT mesh_index;
+        UINT lod_index;
+        UINT material_index;
+        UINT first_instance;
+        UINT instance_count;
+};
+
+struct batch_stats {
+        UINT draw_count;
+        UINT group_count;
+        UINT dropped_draw_count;
+};
+
+struct batch_info {
+        struct job_system_info *job_system;
+        UINT frame_count;
+        UINT max_instances;
+        UINT mesh_count;
+        struct batch_mesh_info meshes[MAX_BATCH_MESHES];
+        UINT draw_count;
+        // Sorted by PSO, mesh and material, with the index of the draw
+        // transform in the low bits
+        UINT64 *draws;
+        UINT64 *sort_scratch;
+        mat4x4 *transforms;
+        UINT group_count;
+        struct batch_group *groups;
+        UINT frame_index;
+        struct gpu_resource_info instance_buffers[MAX_BATCH_FRAMES];
+        mat4x4 *instance_data[MAX_BATCH_FRAMES];
+        struct batch_stats stats;
+};
+
+void create_batch(struct gpu_device_info *device_info,
+        struct batch_info *batch_info);
+void release_batch(struct batch_info *batch_info);
+UINT add_batch_mesh(struct batch_info *batch_info,
+        struct gpu_resource_info *vert_buffer, UINT vert_stride,
+        struct gpu_resource_info *index_buffer, UINT index_count,
+        UINT start_index, INT base_vertex);
+// Adds the next level of detail of a mesh, level 0 being the index range
+// given to add_batch_mesh
+UINT add_batch_mesh_lod(struct batch_info *batch_info, UINT mesh_index,
+        UINT index_count, UINT start_index);
+// The instance buffer of frame_index must no longer be in use by the GPU
+void begin_batch(struct batch_info *batch_info, UINT frame_index);
+void add_batch_draw(struct batch_info *batch_info, UINT mesh_index,
+        UINT lod_index, UINT pso_handle, UINT material_index,
+        mat4x4 transform);
+// Groups the draws and writes their transforms to the instance buffer
+void build_batch(struct batch_info *batch_info);
+// Pushes an instanced draw per group, all at the given layer and depth
+void queue_batch_draws(struct batch_info *batch_info,
+        struct draw_queue_info *queue_info, UINT layer, float depth,
+        UINT object_index);
+
+#endif
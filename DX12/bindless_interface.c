@@ -0,0 +1,200 @@
+#include "bindless_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define BINDLESS_STRING(count) #count
+#define BINDLESS_COUNT_STRING(count) BINDLESS_STRING(count)
+
+static const D3D_SHADER_MACRO bounded_shader_defines[] = {
+        { "BINDLESS_CBV_COUNT",
+                BINDLESS_COUNT_STRING(BINDLESS_BOUNDED_CBV_COUNT) },
+        { "BINDLESS_SRV_COUNT",
+                BINDLESS_COUNT_STRING(BINDLESS_BOUNDED_SRV_COUNT) },
+        { "BINDLESS_UAV_COUNT",
+                BINDLESS_COUNT_STRING(BINDLESS_BOUNDED_UAV_COUNT) },
+        { NULL, NULL }
+};
+
+int check_bindless_support(struct gpu_device_info *device_info)
+{
+        D3D12_FEATURE_DATA_D3D12_OPTIONS options;
+        memset(&options, 0, sizeof options);
+        HRESULT hr = ID3D12Device_CheckFeatureSupport(device_info->device,
+                D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof options);
+        if (FAILED(hr))
+                return 1;
+
+        return options.ResourceBindingTier < D3D12_RESOURCE_BINDING_TIER_3;
+}
+
+UINT get_bindless_range_size(D3D12_DESCRIPTOR_RANGE_TYPE range_type,
+        BOOL is_bounded)
+{
+        if (!is_bounded)
+                return UINT_MAX;
+
+        switch (range_type) {
+        case D3D12_DESCRIPTOR_RANGE_TYPE_CBV:
+                return BINDLESS_BOUNDED_CBV_COUNT;
+        case D3D12_DESCRIPTOR_RANGE_TYPE_SRV:
+                return BINDLESS_BOUNDED_SRV_COUNT;
+        case D3D12_DESCRIPTOR_RANGE_TYPE_UAV:
+                return BINDLESS_BOUNDED_UAV_COUNT;
+        default:
+                assert(0);
+                return 0;
+        }
+}
+
+const D3D_SHADER_MACRO *get_bindless_shader_defines(BOOL is_bounded)
+{
+        return is_bounded ? bounded_shader_defines : NULL;
+}
+
+void create_bindless_heap(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info)
+{
+        bindless_info->descriptor_info.type =
+                D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+        bindless_info->descriptor_info.flags =
+                D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+        create_descriptor(device_info, &bindless_info->descriptor_info);
+
+        UINT num_descriptors = bindless_info->descriptor_info.num_descriptors;
+
+        bindless_info->frame = 0;
+        bindless_info->next_index = 0;
+        bindless_info->free_count = 0;
+        bindless_info->free_indices = malloc(num_descriptors * sizeof (UINT));
+        bindless_info->retired_count = 0;
+        bindless_info->retired_indices = malloc(num_descriptors *
+                sizeof (UINT));
+        bindless_info->retired_frames = malloc(num_descriptors *
+                sizeof (UINT64));
+}
+
+void release_bindless_heap(struct bindless_heap_info *bindless_info)
+{
+        free(bindless_info->retired_frames);
+        free(bindless_info->retired_indices);
+        free(bindless_info->free_indices);
+
+        release_descriptor(&bindless_info->descriptor_info);
+}
+
+UINT alloc_bindless_index(struct bindless_heap_info *bindless_info)
+{
+        // Reuse released slots first so the heap stays densely packed
+        if (bindless_info->free_count > 0)
+                return bindless_info->free_indices[--bindless_info->free_count];
+
+        if (bindless_info->next_index ==
+                bindless_info->descriptor_info.num_descriptors)
+                return BINDLESS_INVALID_INDEX;
+
+        return bindless_info->next_index++;
+}
+
+void free_bindless_index(struct bindless_heap_info *bindless_info, UINT index)
+{
+        // Only indices handed out can come back, and each only once, so
+        // the retired list never holds more than the heap
+        assert(index < bindless_info->next_index);
+        if (index >= bindless_info->next_index ||
+                bindless_info->retired_count + bindless_info->free_count ==
+                bindless_info->next_index)
+                return;
+
+        // Frames still in flight may reference the index, so hold on to it
+        // until they have retired
+        UINT retired = bindless_info->retired_count++;
+        bindless_info->retired_indices[retired] = index;
+        bindless_info->retired_frames[retired] = bindless_info->frame;
+}
+
+void advance_bindless_frame(struct bindless_heap_info *bindless_info)
+{
+        ++bindless_info->frame;
+
+        UINT kept = 0;
+        for (UINT i = 0; i < bindless_info->retired_count; ++i) {
+                if (bindless_info->retired_frames[i] +
+                        bindless_info->frame_latency <= bindless_info->frame) {
+                        bindless_info->free_indices[bindless_info->free_count++] =
+                                bindless_info->retired_indices[i];
+                } else {
+                        bindless_info->retired_indices[kept] =
+                                bindless_info->retired_indices[i];
+                        bindless_info->retired_frames[kept] =
+                                bindless_info->retired_frames[i];
+                        ++kept;
+                }
+        }
+
+        bindless_info->retired_count = kept;
+}
+
+UINT create_bindless_cbv(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info)
+{
+        UINT index = alloc_bindless_index(bindless_info);
+        if (index == BINDLESS_INVALID_INDEX)
+                return index;
+        if (index >= get_bindless_range_size(D3D12_DESCRIPTOR_RANGE_TYPE_CBV,
+                bindless_info->is_bounded)) {
+                free_bindless_index(bindless_info, index);
+                return BINDLESS_INVALID_INDEX;
+        }
+
+        update_cpu_handle(&bindless_info->descriptor_info, index);
+
+        create_constant_buffer_view(device_info,
+                &bindless_info->descriptor_info, resource_info);
+
+        return index;
+}
+
+UINT create_bindless_srv(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info)
+{
+        UINT index = alloc_bindless_index(bindless_info);
+        if (index == BINDLESS_INVALID_INDEX)
+                return index;
+        if (index >= get_bindless_range_size(D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+                bindless_info->is_bounded)) {
+                free_bindless_index(bindless_info, index);
+                return BINDLESS_INVALID_INDEX;
+        }
+
+        update_cpu_handle(&bindless_info->descriptor_info, index);
+
+        create_shader_resource_view(device_info,
+                &bindless_info->descriptor_info, resource_info);
+
+        return index;
+}
+
+UINT create_bindless_uav(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info)
+{
+        UINT index = alloc_bindless_index(bindless_info);
+        if (index == BINDLESS_INVALID_INDEX)
+                return index;
+        if (index >= get_bindless_range_size(D3D12_DESCRIPTOR_RANGE_TYPE_UAV,
+                bindless_info->is_bounded)) {
+                free_bindless_index(bindless_info, index);
+                return BINDLESS_INVALID_INDEX;
+        }
+
+        update_cpu_handle(&bindless_info->descriptor_info, index);
+
+        create_unorderd_access_view(device_info,
+                &bindless_info->descriptor_info, resource_info);
+
+        return index;
+}
@@ -0,0 +1,70 @@
+#ifndef BINDLESS_INTERFACE_H
+#define BINDLESS_INTERFACE_H
+
+#include "gpu_interface.h"
+
+
+// Register spaces of the unbounded ranges in the bindless root signature
+#define BINDLESS_CBV_SPACE 1
+#define BINDLESS_SRV_SPACE 2
+#define BINDLESS_UAV_SPACE 3
+
+// Returned instead of an index when the heap is full, or when a view would
+// land past the bounded range of its type
+#define BINDLESS_INVALID_INDEX 0xffffffff
+
+// Devices below resource binding tier 3 get ranges bounded to what tier 1
+// allows rather than unbounded ones, and the shaders are compiled to match
+#define BINDLESS_BOUNDED_CBV_COUNT 14
+#define BINDLESS_BOUNDED_SRV_COUNT 128
+#define BINDLESS_BOUNDED_UAV_COUNT 8
+
+// Root constants every bindless draw receives in register b0, space0
+struct bindless_draw_constants {
+        UINT object_index;
+        UINT material_index;
+};
+
+struct bindless_heap_info {
+        struct gpu_descriptor_info descriptor_info;
+        UINT frame_latency;
+        // Set before creating the heap when the ranges are bounded
+        BOOL is_bounded;
+        UINT64 frame;
+        UINT next_index;
+        UINT free_count;
+        UINT *free_indices;
+        UINT retired_count;
+        UINT *retired_indices;
+        UINT64 *retired_frames;
+};
+
+// Unbounded CBV and UAV ranges need resource binding tier 3, so devices
+// below it get bounded ranges. Returns 0 when they can have unbounded ones.
+int check_bindless_support(struct gpu_device_info *device_info);
+// Descriptors in the range of the type, UINT_MAX when unbounded
+UINT get_bindless_range_size(D3D12_DESCRIPTOR_RANGE_TYPE range_type,
+        BOOL is_bounded);
+// Defines that size the shaders' arrays to the bounded ranges, NULL when the
+// ranges are unbounded
+const D3D_SHADER_MACRO *get_bindless_shader_defines(BOOL is_bounded);
+void create_bindless_heap(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info);
+void release_bindless_heap(struct bindless_heap_info *bindless_info);
+// BINDLESS_INVALID_INDEX when the heap is full
+UINT alloc_bindless_index(struct bindless_heap_info *bindless_info);
+void free_bindless_index(struct bindless_heap_info *bindless_info, UINT index);
+void advance_bindless_frame(struct bindless_heap_info *bindless_info);
+// The views return BINDLESS_INVALID_INDEX without creating anything when
+// they have no index
+UINT create_bindless_cbv(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info);
+UINT create_bindless_srv(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info);
+UINT create_bindless_uav(struct gpu_device_info *device_info,
+        struct bindless_heap_info *bindless_info,
+        struct gpu_resource_info *resource_info);
+
+#endif
@@ -0,0 +1,1003 @@
+#include "bvh_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+// The four children of a node are tested in one register
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#define BVH_NODE_DIRTY 0x1
+#define BVH_NODE_FREE 0x2
+
+struct bvh_range {
+        unsigned int first;
+        unsigned int count;
+};
+
+struct bvh_bin_job {
+        struct bvh_info *bvh_info;
+        unsigned int first;
+        unsigned int count;
+        unsigned int chunk_count;
+        int bin_count;
+        vec3 centroid_min;
+        vec3 bin_scale;
+        vec3 chunk_centroid_mins[MAX_BVH_CHUNKS];
+        vec3 chunk_centroid_maxs[MAX_BVH_CHUNKS];
+};
+
+struct bvh_stack_entry {
+        unsigned int node;
+        float t;
+};
+
+static void reset_bounds(vec3 min, vec3 max)
+{
+        for (int k = 0; k < 3; ++k) {
+                min[k] = INFINITY;
+                max[k] = -INFINITY;
+        }
+}
+
+static void grow_bounds(vec3 min, vec3 max, vec3 other_min, vec3 other_max)
+{
+        for (int k = 0; k < 3; ++k) {
+                min[k] = other_min[k] < min[k] ? other_min[k] : min[k];
+                max[k] = other_max[k] > max[k] ? other_max[k] : max[k];
+        }
+}
+
+static float get_area(vec3 min, vec3 max)
+{
+        if (min[0] > max[0])
+                return 0.0f;
+
+        float dx = max[0] - min[0];
+        float dy = max[1] - min[1];
+        float dz = max[2] - min[2];
+
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static void get_item_bounds(struct bvh_info *bvh_info, unsigned int first,
+        unsigned int count, vec3 min, vec3 max)
+{
+        reset_bounds(min, max);
+        for (unsigned int i = first; i < first + count; ++i) {
+                unsigned int item = bvh_info->item_order[i];
+                grow_bounds(min, max, bvh_info->item_mins[item],
+                        bvh_info->item_maxs[item]);
+        }
+}
+
+static void set_slot_bounds(struct bvh_node *node, unsigned int slot,
+        vec3 min, vec3 max)
+{
+        node->min_x[slot] = min[0];
+        node->min_y[slot] = min[1];
+        node->min_z[slot] = min[2];
+        node->max_x[slot] = max[0];
+        node->max_y[slot] = max[1];
+        node->max_z[slot] = max[2];
+}
+
+static void get_node_bounds(struct bvh_node *node, vec3 min, vec3 max)
+{
+        reset_bounds(min, max);
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 slot_min = {
+                        node->min_x[k], node->min_y[k], node->min_z[k]
+                };
+                vec3 slot_max = {
+                        node->max_x[k], node->max_y[k], node->max_z[k]
+                };
+                grow_bounds(min, max, slot_min, slot_max);
+        }
+}
+
+void create_bvh(struct bvh_info *bvh_info)
+{
+        unsigned int max_items = bvh_info->max_items;
+        assert(max_items > 0);
+
+        bvh_info->item_count = 0;
+        bvh_info->item_mins = malloc(max_items * sizeof (vec3));
+        bvh_info->item_maxs = malloc(max_items * sizeof (vec3));
+        bvh_info->item_order = malloc(max_items * sizeof (unsigned int));
+        bvh_info->item_nodes = malloc(max_items * sizeof (unsigned int));
+        bvh_info->order_mins = malloc(max_items * sizeof (vec4));
+        bvh_info->order_maxs = malloc(max_items * sizeof (vec4));
+
+        // Every node but a lone root leaf splits its items at least in two,
+        // so there are never more nodes than items
+        bvh_info->root = BVH_NO_NODE;
+        bvh_info->max_nodes = max_items;
+        bvh_info->node_count = 0;
+        bvh_info->nodes = malloc(bvh_info->max_nodes *
+                sizeof (struct bvh_node));
+        bvh_info->free_node_count = 0;
+        bvh_info->free_nodes = malloc(bvh_info->max_nodes *
+                sizeof (unsigned int));
+        bvh_info->rebuild_nodes = malloc(bvh_info->max_nodes *
+                sizeof (unsigned int));
+        bvh_info->chunk_bins = malloc(MAX_BVH_CHUNKS *
+                sizeof (struct bvh_bin [3][BVH_BIN_COUNT]));
+
+        memset(&bvh_info->stats, 0, sizeof (struct bvh_stats));
+}
+
+void release_bvh(struct bvh_info *bvh_info)
+{
+        free(bvh_info->chunk_bins);
+        free(bvh_info->rebuild_nodes);
+        free(bvh_info->free_nodes);
+        free(bvh_info->nodes);
+        free(bvh_info->order_maxs);
+        free(bvh_info->order_mins);
+        free(bvh_info->item_nodes);
+        free(bvh_info->item_order);
+        free(bvh_info->item_maxs);
+        free(bvh_info->item_mins);
+}
+
+unsigned int add_bvh_item(struct bvh_info *bvh_info, vec3 min, vec3 max)
+{
+        assert(bvh_info->item_count < bvh_info->max_items);
+
+        unsigned int item = bvh_info->item_count++;
+        vec3_scale(bvh_info->item_mins[item], min, 1.0f);
+        vec3_scale(bvh_info->item_maxs[item], max, 1.0f);
+        bvh_info->item_nodes[item] = BVH_NO_NODE;
+
+        return item;
+}
+
+void update_bvh_item(struct bvh_info *bvh_info, unsigned int item, vec3 min,
+        vec3 max)
+{
+        assert(item < bvh_info->item_count);
+
+        vec3_scale(bvh_info->item_mins[item], min, 1.0f);
+        vec3_scale(bvh_info->item_maxs[item], max, 1.0f);
+
+        // Mark the path up to the root, stopping where an earlier update
+        // already did
+        unsigned int node = bvh_info->item_nodes[item];
+        while (node != BVH_NO_NODE &&
+                !(bvh_info->nodes[node].flags & BVH_NODE_DIRTY)) {
+                bvh_info->nodes[node].flags |= BVH_NODE_DIRTY;
+                node = bvh_info->nodes[node].parent;
+        }
+}
+
+static unsigned int alloc_node(struct bvh_info *bvh_info)
+{
+        if (bvh_info->free_node_count > 0)
+                return bvh_info->free_nodes[--bvh_info->free_node_count];
+
+        assert(bvh_info->node_count < bvh_info->max_nodes);
+
+        return bvh_info->node_count++;
+}
+
+static void free_subtree(struct bvh_info *bvh_info, unsigned int node_index)
+{
+        struct bvh_node *node = &bvh_info->nodes[node_index];
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                if (node->leaf_counts[k] == 0 &&
+                        node->children[k] != BVH_NO_NODE)
+                        free_subtree(bvh_info, node->children[k]);
+        }
+
+        node->flags = BVH_NODE_FREE;
+        bvh_info->free_nodes[bvh_info->free_node_count++] = node_index;
+}
+
+static void find_centroid_bounds(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct bvh_bin_job *job = job_data;
+        struct bvh_info *bvh_info = job->bvh_info;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = job->first + (unsigned int)
+                        (((unsigned long long) job->count * c) /
+                        job->chunk_count);
+                unsigned int last = job->first + (unsigned int)
+                        (((unsigned long long) job->count * (c + 1)) /
+                        job->chunk_count);
+
+                // Centroids are kept doubled, as min plus max
+                reset_bounds(job->chunk_centroid_mins[c],
+                        job->chunk_centroid_maxs[c]);
+                for (unsigned int i = first; i < last; ++i) {
+                        vec3 centroid;
+                        vec3_add(centroid, bvh_info->order_mins[i],
+                                bvh_info->order_maxs[i]);
+                        grow_bounds(job->chunk_centroid_mins[c],
+                                job->chunk_centroid_maxs[c], centroid,
+                                centroid);
+                }
+        }
+}
+
+static unsigned int get_bin_index(struct bvh_bin_job *job,
+        unsigned int i, int axis)
+{
+        struct bvh_info *bvh_info = job->bvh_info;
+        float centroid = bvh_info->order_mins[i][axis] +
+                bvh_info->order_maxs[i][axis];
+        float bin = (centroid - job->centroid_min[axis]) *
+                job->bin_scale[axis];
+
+        if (bin < 0.0f)
+                return 0;
+        if (bin > (float) (job->bin_count - 1))
+                return job->bin_count - 1;
+
+        return (unsigned int) bin;
+}
+
+static void bin_items(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct bvh_bin_job *job = job_data;
+        struct bvh_info *bvh_info = job->bvh_info;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                struct bvh_bin (*bins)[BVH_BIN_COUNT] = bvh_info->chunk_bins[c];
+                for (int axis = 0; axis < 3; ++axis) {
+                        for (int b = 0; b < job->bin_count; ++b) {
+                                struct bvh_bin *bin = &bins[axis][b];
+                                vec4 inf = {
+                                        INFINITY, INFINITY, INFINITY, INFINITY
+                                };
+                                vec4_scale(bin->min, inf, 1.0f);
+                                vec4_scale(bin->max, inf, -1.0f);
+                                bin->count = 0;
+                        }
+                }
+
+                unsigned int first = job->first + (unsigned int)
+                        (((unsigned long long) job->count * c) /
+                        job->chunk_count);
+                unsigned int last = job->first + (unsigned int)
+                        (((unsigned long long) job->count * (c + 1)) /
+                        job->chunk_count);
+
+#if defined(BVH_USE_SSE)
+                // The bins of all three axes are worked out at once, clamped
+                // the same way get_bin_index does
+                __m128 centroid_min = _mm_setr_ps(job->centroid_min[0],
+                        job->centroid_min[1], job->centroid_min[2], 0.0f);
+                __m128 bin_scale = _mm_setr_ps(job->bin_scale[0],
+                        job->bin_scale[1], job->bin_scale[2], 0.0f);
+                __m128 max_bin = _mm_set1_ps((float) (job->bin_count - 1));
+
+                for (unsigned int i = first; i < last; ++i) {
+                        __m128 min = _mm_loadu_ps(bvh_info->order_mins[i]);
+                        __m128 max = _mm_loadu_ps(bvh_info->order_maxs[i]);
+                        __m128 bin_f = _mm_mul_ps(_mm_sub_ps(
+                                _mm_add_ps(min, max), centroid_min),
+                                bin_scale);
+                        bin_f = _mm_min_ps(_mm_max_ps(bin_f,
+                                _mm_setzero_ps()), max_bin);
+
+                        int bin_indices[4];
+                        _mm_storeu_si128((__m128i *) bin_indices,
+                                _mm_cvttps_epi32(bin_f));
+
+                        for (int axis = 0; axis < 3; ++axis) {
+                                struct bvh_bin *bin =
+                                        &bins[axis][bin_indices[axis]];
+                                _mm_storeu_ps(bin->min, _mm_min_ps(
+                                        _mm_loadu_ps(bin->min), min));
+                                _mm_storeu_ps(bin->max, _mm_max_ps(
+                                        _mm_loadu_ps(bin->max), max));
+                                ++bin->count;
+                        }
+                }
+#else
+                for (unsigned int i = first; i < last; ++i) {
+                        for (int axis = 0; axis < 3; ++axis) {
+                                struct bvh_bin *bin = &bins[axis][
+                                        get_bin_index(job, i, axis)];
+                                grow_bounds(bin->min, bin->max,
+                                        bvh_info->order_mins[i],
+                                        bvh_info->order_maxs[i]);
+                                ++bin->count;
+                        }
+                }
+#endif
+        }
+}
+
+static void swap_order(struct bvh_info *bvh_info, unsigned int i,
+        unsigned int j)
+{
+        unsigned int item = bvh_info->item_order[i];
+        bvh_info->item_order[i] = bvh_info->item_order[j];
+        bvh_info->item_order[j] = item;
+
+        vec4 bound;
+        vec4_scale(bound, bvh_info->order_mins[i], 1.0f);
+        vec4_scale(bvh_info->order_mins[i], bvh_info->order_mins[j], 1.0f);
+        vec4_scale(bvh_info->order_mins[j], bound, 1.0f);
+        vec4_scale(bound, bvh_info->order_maxs[i], 1.0f);
+        vec4_scale(bvh_info->order_maxs[i], bvh_info->order_maxs[j], 1.0f);
+        vec4_scale(bvh_info->order_maxs[j], bound, 1.0f);
+}
+
+static void copy_order_bounds(struct bvh_info *bvh_info, unsigned int first,
+        unsigned int count)
+{
+        for (unsigned int i = first; i < first + count; ++i) {
+                unsigned int item = bvh_info->item_order[i];
+                vec3_scale(bvh_info->order_mins[i], bvh_info->item_mins[item],
+                        1.0f);
+                vec3_scale(bvh_info->order_maxs[i], bvh_info->item_maxs[item],
+                        1.0f);
+                bvh_info->order_mins[i][3] = 0.0f;
+                bvh_info->order_maxs[i][3] = 0.0f;
+        }
+}
+
+// Splits a range of items in two where the binned surface area heuristic is
+// lowest, or in the middle when the centroids can not be told apart
+static void split_range(struct bvh_info *bvh_info, struct bvh_range *range,
+        struct bvh_range *left, struct bvh_range *right)
+{
+        struct bvh_bin_job job;
+        job.bvh_info = bvh_info;
+        job.first = range->first;
+        job.count = range->count;
+        job.chunk_count = 1;
+        // Small ranges near the leaves get a bin per item at most
+        job.bin_count = range->count < BVH_BIN_COUNT ? (int) range->count :
+                BVH_BIN_COUNT;
+
+        // Only the ranges near the root are worth binning in parallel
+        struct job_system_info *job_system = bvh_info->job_system;
+        if (job_system != NULL && range->count >= BVH_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_BVH_CHUNKS)
+                        job.chunk_count = MAX_BVH_CHUNKS;
+        }
+
+        struct job_system_info *chunk_job_system = job.chunk_count > 1 ?
+                job_system : NULL;
+
+        parallel_for(chunk_job_system, job.chunk_count, 1,
+                find_centroid_bounds, &job);
+
+        vec3 centroid_max;
+        reset_bounds(job.centroid_min, centroid_max);
+        for (unsigned int c = 0; c < job.chunk_count; ++c) {
+                grow_bounds(job.centroid_min, centroid_max,
+                        job.chunk_centroid_mins[c], job.chunk_centroid_maxs[c]);
+        }
+
+        int is_splittable = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+                float extent = centroid_max[axis] - job.centroid_min[axis];
+                job.bin_scale[axis] = 0.0f;
+                if (extent > 0.0f) {
+                        job.bin_scale[axis] = job.bin_count * 0.9999f / extent;
+                        is_splittable = 1;
+                }
+        }
+
+        int best_axis = -1;
+        unsigned int best_split = 0;
+
+        if (is_splittable) {
+                parallel_for(chunk_job_system, job.chunk_count, 1, bin_items,
+                        &job);
+
+                struct bvh_bin (*bins)[BVH_BIN_COUNT] =
+                        bvh_info->chunk_bins[0];
+                for (unsigned int c = 1; c < job.chunk_count; ++c) {
+                        struct bvh_bin (*chunk_bins)[BVH_BIN_COUNT] =
+                                bvh_info->chunk_bins[c];
+                        for (int axis = 0; axis < 3; ++axis) {
+                                for (int b = 0; b < job.bin_count; ++b) {
+                                        struct bvh_bin *bin = &bins[axis][b];
+                                        struct bvh_bin *chunk_bin =
+                                                &chunk_bins[axis][b];
+                                        grow_bounds(bin->min, bin->max,
+                                                chunk_bin->min,
+                                                chunk_bin->max);
+                                        bin->count += chunk_bin->count;
+                                }
+                        }
+                }
+
+                // Sweep the bins from the left and then from the right, the
+                // split after bin b costs the area times the item count of
+                // each side
+                float best_cost = INFINITY;
+                for (int axis = 0; axis < 3; ++axis) {
+                        if (job.bin_scale[axis] == 0.0f)
+                                continue;
+
+                        float left_costs[BVH_BIN_COUNT];
+                        vec3 min;
+                        vec3 max;
+                        unsigned int count = 0;
+                        reset_bounds(min, max);
+                        for (int b = 0; b < job.bin_count - 1; ++b) {
+                                grow_bounds(min, max, bins[axis][b].min,
+                                        bins[axis][b].max);
+                                count += bins[axis][b].count;
+                                left_costs[b] = get_area(min, max) * count;
+                        }
+
+                        count = 0;
+                        reset_bounds(min, max);
+                        for (int b = job.bin_count - 1; b > 0; --b) {
+                                grow_bounds(min, max, bins[axis][b].min,
+                                        bins[axis][b].max);
+                                count += bins[axis][b].count;
+
+                                float cost = left_costs[b - 1] +
+                                        get_area(min, max) * count;
+                                if (cost < best_cost) {
+                                        best_cost = cost;
+                                        best_axis = axis;
+                                        best_split = b - 1;
+                                }
+                        }
+                }
+        }
+
+        unsigned int middle = range->first + range->count / 2;
+
+        if (best_axis >= 0) {
+                unsigned int i = range->first;
+                unsigned int j = range->first + range->count;
+                while (i < j) {
+                        if (get_bin_index(&job, i, best_axis) <= best_split)
+                                ++i;
+                        else
+                                swap_order(bvh_info, i, --j);
+                }
+
+                if (i != range->first && i != range->first + range->count)
+                        middle = i;
+        }
+
+        left->first = range->first;
+        left->count = middle - range->first;
+        right->first = middle;
+        right->count = range->first + range->count - middle;
+}
+
+static unsigned int build_subtree(struct bvh_info *bvh_info,
+        unsigned int first, unsigned int count, unsigned int parent,
+        unsigned int parent_slot)
+{
+        unsigned int node_index = alloc_node(bvh_info);
+        struct bvh_node *node = &bvh_info->nodes[node_index];
+        node->parent = parent;
+        node->parent_slot = parent_slot;
+        node->item_first = first;
+        node->item_count = count;
+        node->flags = 0;
+
+        // Keep splitting the biggest range until there is one per child
+        struct bvh_range ranges[BVH_WIDTH];
+        unsigned int range_count = 1;
+        ranges[0].first = first;
+        ranges[0].count = count;
+
+        while (range_count < BVH_WIDTH) {
+                unsigned int biggest = 0;
+                for (unsigned int r = 1; r < range_count; ++r) {
+                        if (ranges[r].count > ranges[biggest].count)
+                                biggest = r;
+                }
+
+                if (ranges[biggest].count <= BVH_MAX_LEAF_ITEMS)
+                        break;
+
+                struct bvh_range range = ranges[biggest];
+                split_range(bvh_info, &range, &ranges[biggest],
+                        &ranges[range_count++]);
+        }
+
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 min;
+                vec3 max;
+                reset_bounds(min, max);
+
+                node->children[k] = BVH_NO_NODE;
+                node->leaf_counts[k] = 0;
+
+                if (k >= range_count) {
+                        set_slot_bounds(node, k, min, max);
+                        continue;
+                }
+
+                if (ranges[k].count <= BVH_MAX_LEAF_ITEMS) {
+                        node->children[k] = ranges[k].first;
+                        node->leaf_counts[k] = ranges[k].count;
+                        get_item_bounds(bvh_info, ranges[k].first,
+                                ranges[k].count, min, max);
+
+                        for (unsigned int i = ranges[k].first;
+                                i < ranges[k].first + ranges[k].count; ++i)
+                                bvh_info->item_nodes[
+                                        bvh_info->item_order[i]] = node_index;
+                } else {
+                        node->children[k] = build_subtree(bvh_info,
+                                ranges[k].first, ranges[k].count,
+                                node_index, k);
+                        get_node_bounds(&bvh_info->nodes[node->children[k]],
+                                min, max);
+                }
+
+                set_slot_bounds(node, k, min, max);
+        }
+
+        vec3 min;
+        vec3 max;
+        get_node_bounds(node, min, max);
+        node->build_area = get_area(min, max);
+
+        return node_index;
+}
+
+void build_bvh(struct bvh_info *bvh_info)
+{
+        double start_time = get_time_in_secs();
+
+        bvh_info->root = BVH_NO_NODE;
+        bvh_info->node_count = 0;
+        bvh_info->free_node_count = 0;
+
+        for (unsigned int i = 0; i < bvh_info->item_count; ++i)
+                bvh_info->item_order[i] = i;
+        copy_order_bounds(bvh_info, 0, bvh_info->item_count);
+
+        if (bvh_info->item_count > 0) {
+                bvh_info->root = build_subtree(bvh_info, 0,
+                        bvh_info->item_count, BVH_NO_NODE, 0);
+        }
+
+        bvh_info->stats.node_count = bvh_info->node_count;
+        bvh_info->stats.build_time = get_time_in_secs() - start_time;
+}
+
+static void refit_node(struct bvh_info *bvh_info, unsigned int node_index,
+        unsigned int *rebuild_count)
+{
+        struct bvh_node *node = &bvh_info->nodes[node_index];
+
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 min;
+                vec3 max;
+
+                if (node->leaf_counts[k] > 0) {
+                        get_item_bounds(bvh_info, node->children[k],
+                                node->leaf_counts[k], min, max);
+                        set_slot_bounds(node, k, min, max);
+                } else if (node->children[k] != BVH_NO_NODE) {
+                        struct bvh_node *child =
+                                &bvh_info->nodes[node->children[k]];
+                        if (!(child->flags & BVH_NODE_DIRTY))
+                                continue;
+
+                        refit_node(bvh_info, node->children[k],
+                                rebuild_count);
+                        get_node_bounds(child, min, max);
+                        set_slot_bounds(node, k, min, max);
+                }
+        }
+
+        node->flags &= ~BVH_NODE_DIRTY;
+        ++bvh_info->stats.refit_node_count;
+
+        // Children are listed before their parents
+        vec3 min;
+        vec3 max;
+        get_node_bounds(node, min, max);
+        if (get_area(min, max) > node->build_area * BVH_REBUILD_AREA_RATIO)
+                bvh_info->rebuild_nodes[(*rebuild_count)++] = node_index;
+}
+
+static void rebuild_subtree(struct bvh_info *bvh_info, unsigned int node_index)
+{
+        struct bvh_node *node = &bvh_info->nodes[node_index];
+        unsigned int parent = node->parent;
+        unsigned int parent_slot = node->parent_slot;
+        unsigned int first = node->item_first;
+        unsigned int count = node->item_count;
+
+        // The same items end up under the new subtree, so the bounds the
+        // parent holds for it stay right
+        free_subtree(bvh_info, node_index);
+        copy_order_bounds(bvh_info, first, count);
+        unsigned int new_index = build_subtree(bvh_info, first, count, parent,
+                parent_slot);
+
+        if (parent == BVH_NO_NODE)
+                bvh_info->root = new_index;
+        else
+                bvh_info->nodes[parent].children[parent_slot] = new_index;
+}
+
+void refit_bvh(struct bvh_info *bvh_info)
+{
+        double start_time = get_time_in_secs();
+
+        bvh_info->stats.refit_node_count = 0;
+        bvh_info->stats.rebuild_count = 0;
+
+        if (bvh_info->root == BVH_NO_NODE ||
+                !(bvh_info->nodes[bvh_info->root].flags & BVH_NODE_DIRTY)) {
+                bvh_info->stats.refit_time = get_time_in_secs() - start_time;
+                return;
+        }
+
+        unsigned int rebuild_count = 0;
+        refit_node(bvh_info, bvh_info->root, &rebuild_count);
+
+        // Rebuild the topmost subtrees first, the nodes under them are gone
+        // afterwards or were handed out again to the new subtree
+        for (unsigned int i = rebuild_count; i > 0; --i) {
+                if (bvh_info->stats.rebuild_count >= MAX_BVH_REBUILDS)
+                        break;
+
+                unsigned int node_index = bvh_info->rebuild_nodes[i - 1];
+                struct bvh_node *node = &bvh_info->nodes[node_index];
+                if (node->flags & BVH_NODE_FREE)
+                        continue;
+
+                vec3 min;
+                vec3 max;
+                get_node_bounds(node, min, max);
+                if (get_area(min, max) <=
+                        node->build_area * BVH_REBUILD_AREA_RATIO)
+                        continue;
+
+                rebuild_subtree(bvh_info, node_index);
+                ++bvh_info->stats.rebuild_count;
+        }
+
+        bvh_info->stats.node_count = bvh_info->node_count -
+                bvh_info->free_node_count;
+        bvh_info->stats.refit_time = get_time_in_secs() - start_time;
+}
+
+static unsigned int get_slot_mask(struct bvh_node *node)
+{
+        unsigned int mask = 0;
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                if (node->children[k] != BVH_NO_NODE)
+                        mask |= 1 << k;
+        }
+
+        return mask;
+}
+
+static int is_box_in_frustum(struct frustum_planes *planes, vec3 min,
+        vec3 max)
+{
+        // The corner furthest along the plane normal has to be inside
+        for (int p = 0; p < 6; ++p) {
+                float dist = planes->a[p] * (planes->a[p] >= 0.0f ?
+                        max[0] : min[0]) + planes->b[p] * (planes->b[p] >=
+                        0.0f ? max[1] : min[1]) + planes->c[p] *
+                        (planes->c[p] >= 0.0f ? max[2] : min[2]) +
+                        planes->d[p];
+                if (dist <= 0.0f)
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int is_box_overlapping(vec3 min, vec3 max, vec3 other_min,
+        vec3 other_max)
+{
+        return min[0] <= other_max[0] && max[0] >= other_min[0] &&
+                min[1] <= other_max[1] && max[1] >= other_min[1] &&
+                min[2] <= other_max[2] && max[2] >= other_min[2];
+}
+
+static int get_ray_box_t(vec3 min, vec3 max, vec3 origin, vec3 inv_dir,
+        float max_t, float *t)
+{
+        float t_near = 0.0f;
+        float t_far = max_t;
+        for (int k = 0; k < 3; ++k) {
+                float t0 = (min[k] - origin[k]) * inv_dir[k];
+                float t1 = (max[k] - origin[k]) * inv_dir[k];
+                t_near = fmaxf(t_near, fminf(t0, t1));
+                t_far = fminf(t_far, fmaxf(t0, t1));
+        }
+
+        *t = t_near;
+
+        return t_near <= t_far;
+}
+
+static unsigned int test_node_frustum(struct bvh_node *node,
+        struct frustum_planes *planes)
+{
+#if defined(BVH_USE_SSE)
+        __m128 min_x = _mm_loadu_ps(node->min_x);
+        __m128 min_y = _mm_loadu_ps(node->min_y);
+        __m128 min_z = _mm_loadu_ps(node->min_z);
+        __m128 max_x = _mm_loadu_ps(node->max_x);
+        __m128 max_y = _mm_loadu_ps(node->max_y);
+        __m128 max_z = _mm_loadu_ps(node->max_z);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+                __m128 x = planes->a[p] >= 0.0f ? max_x : min_x;
+                __m128 y = planes->b[p] >= 0.0f ? max_y : min_y;
+                __m128 z = planes->c[p] >= 0.0f ? max_z : min_z;
+                __m128 dist = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(_mm_set1_ps(planes->a[p]), x),
+                        _mm_mul_ps(_mm_set1_ps(planes->b[p]), y)), _mm_add_ps(
+                        _mm_mul_ps(_mm_set1_ps(planes->c[p]), z),
+                        _mm_set1_ps(planes->d[p])));
+                inside = _mm_and_ps(inside,
+                        _mm_cmpgt_ps(dist, _mm_setzero_ps()));
+        }
+
+        return (unsigned int) _mm_movemask_ps(inside) & get_slot_mask(node);
+#else
+        unsigned int mask = 0;
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 min = { node->min_x[k], node->min_y[k], node->min_z[k] };
+                vec3 max = { node->max_x[k], node->max_y[k], node->max_z[k] };
+                if (is_box_in_frustum(planes, min, max))
+                        mask |= 1 << k;
+        }
+
+        return mask & get_slot_mask(node);
+#endif
+}
+
+static unsigned int test_node_aabb(struct bvh_node *node, vec3 min, vec3 max)
+{
+#if defined(BVH_USE_SSE)
+        __m128 overlap = _mm_and_ps(_mm_and_ps(
+                _mm_cmple_ps(_mm_loadu_ps(node->min_x), _mm_set1_ps(max[0])),
+                _mm_cmpge_ps(_mm_loadu_ps(node->max_x), _mm_set1_ps(min[0]))),
+                _mm_and_ps(
+                _mm_cmple_ps(_mm_loadu_ps(node->min_y), _mm_set1_ps(max[1])),
+                _mm_cmpge_ps(_mm_loadu_ps(node->max_y), _mm_set1_ps(min[1]))));
+        overlap = _mm_and_ps(overlap, _mm_and_ps(
+                _mm_cmple_ps(_mm_loadu_ps(node->min_z), _mm_set1_ps(max[2])),
+                _mm_cmpge_ps(_mm_loadu_ps(node->max_z), _mm_set1_ps(min[2]))));
+
+        return (unsigned int) _mm_movemask_ps(overlap) & get_slot_mask(node);
+#else
+        unsigned int mask = 0;
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 slot_min = {
+                        node->min_x[k], node->min_y[k], node->min_z[k]
+                };
+                vec3 slot_max = {
+                        node->max_x[k], node->max_y[k], node->max_z[k]
+                };
+                if (is_box_overlapping(slot_min, slot_max, min, max))
+                        mask |= 1 << k;
+        }
+
+        return mask & get_slot_mask(node);
+#endif
+}
+
+static unsigned int test_node_ray(struct bvh_node *node, vec3 origin,
+        vec3 inv_dir, float max_t, float *t)
+{
+#if defined(BVH_USE_SSE)
+        const float *mins[3] = { node->min_x, node->min_y, node->min_z };
+        const float *maxs[3] = { node->max_x, node->max_y, node->max_z };
+
+        __m128 t_near = _mm_setzero_ps();
+        __m128 t_far = _mm_set1_ps(max_t);
+        for (int k = 0; k < 3; ++k) {
+                __m128 o = _mm_set1_ps(origin[k]);
+                __m128 inv = _mm_set1_ps(inv_dir[k]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(mins[k]), o),
+                        inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxs[k]), o),
+                        inv);
+                t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+                t_far = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+        }
+
+        _mm_storeu_ps(t, t_near);
+
+        return (unsigned int) _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) &
+                get_slot_mask(node);
+#else
+        unsigned int mask = 0;
+        for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                vec3 min = { node->min_x[k], node->min_y[k], node->min_z[k] };
+                vec3 max = { node->max_x[k], node->max_y[k], node->max_z[k] };
+                if (get_ray_box_t(min, max, origin, inv_dir, max_t, &t[k]))
+                        mask |= 1 << k;
+        }
+
+        return mask & get_slot_mask(node);
+#endif
+}
+
+unsigned int query_bvh_frustum(struct bvh_info *bvh_info,
+        struct frustum_planes *planes, unsigned int *items,
+        unsigned int max_items)
+{
+        if (bvh_info->root == BVH_NO_NODE)
+                return 0;
+
+        unsigned int item_count = 0;
+        unsigned int stack[MAX_BVH_STACK];
+        unsigned int stack_size = 0;
+        stack[stack_size++] = bvh_info->root;
+
+        while (stack_size > 0) {
+                struct bvh_node *node = &bvh_info->nodes[stack[--stack_size]];
+                unsigned int mask = test_node_frustum(node, planes);
+
+                for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                        if (!(mask & (1 << k)))
+                                continue;
+
+                        if (node->leaf_counts[k] == 0) {
+                                assert(stack_size < MAX_BVH_STACK);
+                                stack[stack_size++] = node->children[k];
+                                continue;
+                        }
+
+                        for (unsigned int i = node->children[k];
+                                i < node->children[k] + node->leaf_counts[k];
+                                ++i) {
+                                unsigned int item = bvh_info->item_order[i];
+                                if (!is_box_in_frustum(planes,
+                                        bvh_info->item_mins[item],
+                                        bvh_info->item_maxs[item]))
+                                        continue;
+
+                                if (item_count == max_items)
+                                        return item_count;
+                                items[item_count++] = item;
+                        }
+                }
+        }
+
+        return item_count;
+}
+
+unsigned int query_bvh_aabb(struct bvh_info *bvh_info, vec3 min, vec3 max,
+        unsigned int *items, unsigned int max_items)
+{
+        if (bvh_info->root == BVH_NO_NODE)
+                return 0;
+
+        unsigned int item_count = 0;
+        unsigned int stack[MAX_BVH_STACK];
+        unsigned int stack_size = 0;
+        stack[stack_size++] = bvh_info->root;
+
+        while (stack_size > 0) {
+                struct bvh_node *node = &bvh_info->nodes[stack[--stack_size]];
+                unsigned int mask = test_node_aabb(node, min, max);
+
+                for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                        if (!(mask & (1 << k)))
+                                continue;
+
+                        if (node->leaf_counts[k] == 0) {
+                                assert(stack_size < MAX_BVH_STACK);
+                                stack[stack_size++] = node->children[k];
+                                continue;
+                        }
+
+                        for (unsigned int i = node->children[k];
+                                i < node->children[k] + node->leaf_counts[k];
+                                ++i) {
+                                unsigned int item = bvh_info->item_order[i];
+                                if (!is_box_overlapping(
+                                        bvh_info->item_mins[item],
+                                        bvh_info->item_maxs[item], min, max))
+                                        continue;
+
+                                if (item_count == max_items)
+                                        return item_count;
+                                items[item_count++] = item;
+                        }
+                }
+        }
+
+        return item_count;
+}
+
+unsigned int query_bvh_ray(struct bvh_info *bvh_info, vec3 origin, vec3 dir,
+        float max_t, float *hit_t)
+{
+        unsigned int hit_item = BVH_NO_ITEM;
+        float best_t = max_t;
+
+        if (bvh_info->root == BVH_NO_NODE)
+                return hit_item;
+
+        vec3 inv_dir = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+
+        struct bvh_stack_entry stack[MAX_BVH_STACK];
+        unsigned int stack_size = 0;
+        stack[stack_size].node = bvh_info->root;
+        stack[stack_size++].t = 0.0f;
+
+        while (stack_size > 0) {
+                struct bvh_stack_entry entry = stack[--stack_size];
+                if (entry.t > best_t)
+                        continue;
+
+                struct bvh_node *node = &bvh_info->nodes[entry.node];
+                float t[BVH_WIDTH];
+                unsigned int mask = test_node_ray(node, origin, inv_dir,
+                        best_t, t);
+
+                // Push the hit children furthest first so the nearest is
+                // looked at next
+                unsigned int order[BVH_WIDTH];
+                unsigned int order_count = 0;
+                for (unsigned int k = 0; k < BVH_WIDTH; ++k) {
+                        if (!(mask & (1 << k)))
+                                continue;
+
+                        unsigned int j = order_count++;
+                        while (j > 0 && t[order[j - 1]] < t[k]) {
+                                order[j] = order[j - 1];
+                                --j;
+                        }
+                        order[j] = k;
+                }
+
+                for (unsigned int o = 0; o < order_count; ++o) {
+                        unsigned int k = order[o];
+
+                        if (node->leaf_counts[k] == 0) {
+                                assert(stack_size < MAX_BVH_STACK);
+                                stack[stack_size].node = node->children[k];
+                                stack[stack_size++].t = t[k];
+                                continue;
+                        }
+
+                        for (unsigned int i = node->children[k];
+                                i < node->children[k] + node->leaf_counts[k];
+                                ++i) {
+                                unsigned int item = bvh_info->item_order[i];
+                                float item_t;
+                                if (get_ray_box_t(bvh_info->item_mins[item],
+                                        bvh_info->item_maxs[item], origin,
+                                        inv_dir, best_t, &item_t) &&
+                                        (item_t < best_t ||
+                                        hit_item == BVH_NO_ITEM)) {
+                                        best_t = item_t;
+                                        hit_item = item;
+                                }
+                        }
+                }
+        }
+
+        if (hit_item != BVH_NO_ITEM && hit_t != NULL)
+                *hit_t = best_t;
+
+        return hit_item;
+}
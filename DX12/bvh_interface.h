@@ -0,0 +1,103 @@
+#ifndef BVH_INTERFACE_H
+#define BVH_INTERFACE_H
+
+#include "linmath.h"
+#include "cull_interface.h"
+#include "job_interface.h"
+
+// Bounding volume hierarchy over item bounding boxes. Nodes have four
+// children with their bounds stored side by side, so a query tests all of
+// them at once. Built top down with binned SAH, the binning of large ranges
+// split across the job system. Moved items are refitted along their path to
+// the root, and subtrees whose bounds grew too far past their size at build
+// time are rebuilt in place. Kept free of D3D types so it can run headless.
+#define BVH_WIDTH 4
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_BIN_COUNT 16
+#define BVH_NO_NODE 0xffffffff
+#define BVH_NO_ITEM 0xffffffff
+#define BVH_PARALLEL_MIN_COUNT 65536
+#define MAX_BVH_CHUNKS 64
+#define MAX_BVH_STACK 256
+// Subtrees are rebuilt once their surface area reaches this many times its
+// area at build time, at most MAX_BVH_REBUILDS of them per refit
+#define BVH_REBUILD_AREA_RATIO 2.0f
+#define MAX_BVH_REBUILDS 4
+
+// Slots with a leaf count hold items from item_order, the others point at
+// a child node or are empty
+struct bvh_node {
+        float min_x[BVH_WIDTH];
+        float min_y[BVH_WIDTH];
+        float min_z[BVH_WIDTH];
+        float max_x[BVH_WIDTH];
+        float max_y[BVH_WIDTH];
+        float max_z[BVH_WIDTH];
+        unsigned int children[BVH_WIDTH];
+        unsigned int leaf_counts[BVH_WIDTH];
+        unsigned int parent;
+        unsigned int parent_slot;
+        // The items under a node are a range of item_order
+        unsigned int item_first;
+        unsigned int item_count;
+        float build_area;
+        unsigned int flags;
+};
+
+// Bounds are padded to four floats to be grown in one register
+struct bvh_bin {
+        vec4 min;
+        vec4 max;
+        unsigned int count;
+};
+
+struct bvh_stats {
+        unsigned int node_count;
+        unsigned int refit_node_count;
+        unsigned int rebuild_count;
+        double build_time;
+        double refit_time;
+};
+
+struct bvh_info {
+        struct job_system_info *job_system;
+        unsigned int max_items;
+        unsigned int item_count;
+        vec3 *item_mins;
+        vec3 *item_maxs;
+        unsigned int *item_order;
+        // Copies of the item bounds in item_order, so building walks them
+        // in memory order
+        vec4 *order_mins;
+        vec4 *order_maxs;
+        unsigned int *item_nodes;
+        unsigned int root;
+        unsigned int max_nodes;
+        unsigned int node_count;
+        struct bvh_node *nodes;
+        unsigned int free_node_count;
+        unsigned int *free_nodes;
+        unsigned int *rebuild_nodes;
+        struct bvh_bin (*chunk_bins)[3][BVH_BIN_COUNT];
+        struct bvh_stats stats;
+};
+
+void create_bvh(struct bvh_info *bvh_info);
+void release_bvh(struct bvh_info *bvh_info);
+// Items added after a build are only found after the next one
+unsigned int add_bvh_item(struct bvh_info *bvh_info, vec3 min, vec3 max);
+void update_bvh_item(struct bvh_info *bvh_info, unsigned int item, vec3 min,
+        vec3 max);
+void build_bvh(struct bvh_info *bvh_info);
+void refit_bvh(struct bvh_info *bvh_info);
+// Queries return how many items they wrote, and stop at max_items
+unsigned int query_bvh_frustum(struct bvh_info *bvh_info,
+        struct frustum_planes *planes, unsigned int *items,
+        unsigned int max_items);
+unsigned int query_bvh_aabb(struct bvh_info *bvh_info, vec3 min, vec3 max,
+        unsigned int *items, unsigned int max_items);
+// Returns the item whose box the ray enters first, or BVH_NO_ITEM
+unsigned int query_bvh_ray(struct bvh_info *bvh_info, vec3 origin, vec3 dir,
+        float max_t, float *hit_t);
+
+#endif
@@ -1,24 +1,172 @@
 #include "camera_interface.h"
+#include "timer_interface.h"
+
+#include <string.h>
+#include <math.h>
+#include <assert.h>
 
 void calc_pv_mat(struct camera_info *ci)
 {
-        ci->pv_mat[0][0] = 1.0f;
-        ci->pv_mat[0][1] = 0.0f;
-        ci->pv_mat[0][2] = 0.0f;
-        ci->pv_mat[0][3] = 0.0f;
-
-        ci->pv_mat[1][0] = 0.0f;
-        ci->pv_mat[1][1] = 1.0f;
-        ci->pv_mat[1][2] = 0.0f;
-        ci->pv_mat[1][3] = 0.0f;
-
-        ci->pv_mat[2][0] = 0.0f;
-        ci->pv_mat[2][1] = 0.0f;
-        ci->pv_mat[2][2] = 1.0f;
-        ci->pv_mat[2][3] = 0.0f;
-
-        ci->pv_mat[3][0] = 0.0f;
-        ci->pv_mat[3][1] = 0.0f;
-        ci->pv_mat[3][2] = 0.0f;
-        ci->pv_mat[3][3] = 1.0f;
-}
\ No newline at end of file
+        mat4x4_mul(ci->pv_mat, ci->projection_mat, ci->view_mat);
+}
+
+static void calc_perspective_mat(mat4x4 m, float fov_y, float aspect,
+        float near_z, float far_z)
+{
+        // Depth goes from 0 at the near plane to 1 at the far one
+        float f = 1.0f / tanf(fov_y * 0.5f);
+
+        memset(m, 0, sizeof (mat4x4));
+        m[0][0] = f / aspect;
+        m[1][1] = f;
+        m[2][2] = far_z / (near_z - far_z);
+        m[2][3] = -1.0f;
+        m[3][2] = near_z * far_z / (near_z - far_z);
+}
+
+static void calc_orthographic_mat(mat4x4 m, float width, float height,
+        float near_z, float far_z)
+{
+        memset(m, 0, sizeof (mat4x4));
+        m[0][0] = 2.0f / width;
+        m[1][1] = 2.0f / height;
+        m[2][2] = 1.0f / (near_z - far_z);
+        m[3][2] = near_z / (near_z - far_z);
+        m[3][3] = 1.0f;
+}
+
+void create_camera_views(struct camera_views_info *views_info)
+{
+        views_info->view_count = 0;
+        memset(&views_info->stats, 0, sizeof (struct camera_stats));
+}
+
+static unsigned int add_view(struct camera_views_info *views_info,
+        enum CAMERA_PROJECTION_TYPE projection_type, vec3 eye, vec3 target,
+        vec3 up)
+{
+        assert(views_info->view_count < MAX_CAMERA_VIEWS);
+
+        unsigned int view_index = views_info->view_count++;
+        struct camera_view *view = &views_info->views[view_index];
+        memset(view, 0, sizeof (struct camera_view));
+        view->projection_type = projection_type;
+        set_view_look_at(views_info, view_index, eye, target, up);
+
+        return view_index;
+}
+
+unsigned int add_perspective_view(struct camera_views_info *views_info,
+        vec3 eye, vec3 target, vec3 up, float fov_y, float aspect,
+        float near_z, float far_z)
+{
+        unsigned int view_index = add_view(views_info,
+                CAMERA_PROJECTION_TYPE_PERSPECTIVE, eye, target, up);
+        set_view_perspective(views_info, view_index, fov_y, aspect, near_z,
+                far_z);
+
+        return view_index;
+}
+
+unsigned int add_orthographic_view(struct camera_views_info *views_info,
+        vec3 eye, vec3 target, vec3 up, float width, float height,
+        float near_z, float far_z)
+{
+        unsigned int view_index = add_view(views_info,
+                CAMERA_PROJECTION_TYPE_ORTHOGRAPHIC, eye, target, up);
+        set_view_orthographic(views_info, view_index, width, height, near_z,
+                far_z);
+
+        return view_index;
+}
+
+void set_view_look_at(struct camera_views_info *views_info,
+        unsigned int view_index, vec3 eye, vec3 target, vec3 up)
+{
+        assert(view_index < views_info->view_count);
+
+        struct camera_view *view = &views_info->views[view_index];
+        vec3_scale(view->eye, eye, 1.0f);
+        vec3_scale(view->target, target, 1.0f);
+        vec3_scale(view->up, up, 1.0f);
+        view->is_dirty = 1;
+}
+
+void set_view_perspective(struct camera_views_info *views_info,
+        unsigned int view_index, float fov_y, float aspect, float near_z,
+        float far_z)
+{
+        assert(view_index < views_info->view_count);
+
+        struct camera_view *view = &views_info->views[view_index];
+        assert(view->projection_type == CAMERA_PROJECTION_TYPE_PERSPECTIVE);
+
+        view->fov_y = fov_y;
+        view->aspect = aspect;
+        view->near_z = near_z;
+        view->far_z = far_z;
+        view->is_dirty = 1;
+}
+
+void set_view_orthographic(struct camera_views_info *views_info,
+        unsigned int view_index, float width, float height, float near_z,
+        float far_z)
+{
+        assert(view_index < views_info->view_count);
+
+        struct camera_view *view = &views_info->views[view_index];
+        assert(view->projection_type == CAMERA_PROJECTION_TYPE_ORTHOGRAPHIC);
+
+        view->width = width;
+        view->height = height;
+        view->near_z = near_z;
+        view->far_z = far_z;
+        view->is_dirty = 1;
+}
+
+void update_camera_views(struct camera_views_info *views_info)
+{
+        views_info->stats.updated_count = 0;
+
+        for (unsigned int v = 0; v < views_info->view_count; ++v) {
+                struct camera_view *view = &views_info->views[v];
+                if (!view->is_dirty)
+                        continue;
+
+                struct camera_info *camera_info = &view->camera_info;
+                mat4x4_look_at(camera_info->view_mat, view->eye,
+                        view->target, view->up);
+
+                if (view->projection_type ==
+                        CAMERA_PROJECTION_TYPE_PERSPECTIVE) {
+                        calc_perspective_mat(camera_info->projection_mat,
+                                view->fov_y, view->aspect, view->near_z,
+                                view->far_z);
+                } else {
+                        calc_orthographic_mat(camera_info->projection_mat,
+                                view->width, view->height, view->near_z,
+                                view->far_z);
+                }
+
+                calc_pv_mat(camera_info);
+                extract_frustum_planes(camera_info->pv_mat,
+                        &views_info->planes[v]);
+
+                view->is_dirty = 0;
+                ++views_info->stats.updated_count;
+        }
+}
+
+void cull_camera_views(struct camera_views_info *views_info,
+        struct cull_volume_info *volume_info, unsigned int *view_masks)
+{
+        double start_time = get_time_in_secs();
+
+        update_camera_views(views_info);
+
+        cull_volumes_multi_view(views_info->job_system, views_info->planes,
+                views_info->view_count, volume_info, view_masks);
+
+        views_info->stats.volume_count = volume_info->count;
+        views_info->stats.cull_time = get_time_in_secs() - start_time;
+}
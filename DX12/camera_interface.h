@@ -2,6 +2,21 @@
 #define CAMERA_INTERFACE_H
 
 #include "linmath.h"
+#include "cull_interface.h"
+#include "job_interface.h"
+
+// Any number of views seen at once, such as the main camera, shadow
+// cascades and reflection probes. The matrices and frustum planes of a view
+// are only worked out again after its parameters change, and all views are
+// culled in a single pass over the volumes. Projections are D3D style and
+// right handed, clip space z from 0 to w. Kept free of D3D types so it can
+// run headless.
+#define MAX_CAMERA_VIEWS MAX_CULL_VIEWS
+
+enum CAMERA_PROJECTION_TYPE {
+        CAMERA_PROJECTION_TYPE_PERSPECTIVE,
+        CAMERA_PROJECTION_TYPE_ORTHOGRAPHIC
+};
 
 struct camera_info {
         mat4x4 view_mat;
@@ -9,6 +24,59 @@ struct camera_info {
         mat4x4 pv_mat;
 };
 
+// Perspective views use the vertical field of view in radians, orthographic
+// ones the width and height of the view volume
+struct camera_view {
+        enum CAMERA_PROJECTION_TYPE projection_type;
+        vec3 eye;
+        vec3 target;
+        vec3 up;
+        float fov_y;
+        float aspect;
+        float width;
+        float height;
+        float near_z;
+        float far_z;
+        int is_dirty;
+        struct camera_info camera_info;
+};
+
+struct camera_stats {
+        unsigned int updated_count;
+        unsigned int volume_count;
+        double cull_time;
+};
+
+struct camera_views_info {
+        struct job_system_info *job_system;
+        unsigned int view_count;
+        struct camera_view views[MAX_CAMERA_VIEWS];
+        // Kept side by side to be handed to the culling in one go
+        struct frustum_planes planes[MAX_CAMERA_VIEWS];
+        struct camera_stats stats;
+};
+
 void calc_pv_mat(struct camera_info *ci);
+void create_camera_views(struct camera_views_info *views_info);
+unsigned int add_perspective_view(struct camera_views_info *views_info,
+        vec3 eye, vec3 target, vec3 up, float fov_y, float aspect,
+        float near_z, float far_z);
+unsigned int add_orthographic_view(struct camera_views_info *views_info,
+        vec3 eye, vec3 target, vec3 up, float width, float height,
+        float near_z, float far_z);
+void set_view_look_at(struct camera_views_info *views_info,
+        unsigned int view_index, vec3 eye, vec3 target, vec3 up);
+void set_view_perspective(struct camera_views_info *views_info,
+        unsigned int view_index, float fov_y, float aspect, float near_z,
+        float far_z);
+void set_view_orthographic(struct camera_views_info *views_info,
+        unsigned int view_index, float width, float height, float near_z,
+        float far_z);
+// Works out the matrices and planes of the views changed since last time
+void update_camera_views(struct camera_views_info *views_info);
+// Updates the views, then sets bit v of view_masks[i] when volume i is seen
+// by view v
+void cull_camera_views(struct camera_views_info *views_info,
+        struct cull_volume_info *volume_info, unsigned int *view_masks);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,88 @@
+#include "cmd_state_interface.h"
+
+#include <string.h>
+#include <assert.h>
+
+
+void init_cmd_state(struct cmd_state_info *state_info)
+{
+        invalidate_cmd_state(state_info);
+        memset(&state_info->stats, 0, sizeof (struct cmd_state_stats));
+}
+
+void invalidate_cmd_state(struct cmd_state_info *state_info)
+{
+        invalidate_cmd_states(state_info, 0, CMD_STATE_COUNT);
+}
+
+void invalidate_cmd_states(struct cmd_state_info *state_info,
+        unsigned int first_state, unsigned int state_count)
+{
+        assert(first_state + state_count <= CMD_STATE_COUNT);
+
+        memset(&state_info->sizes[first_state], 0,
+                state_count * sizeof (unsigned int));
+}
+
+int filter_cmd_state(struct cmd_state_info *state_info, unsigned int state,
+        const void *value, unsigned int size)
+{
+        assert(state < CMD_STATE_COUNT);
+        assert(size > 0);
+
+        if (state_info->sizes[state] == size &&
+                memcmp(state_info->values[state], value, size) == 0) {
+                ++state_info->stats.elided_count;
+                return 0;
+        }
+
+        // Values too big to shadow are always issued
+        if (size <= MAX_CMD_STATE_SIZE) {
+                memcpy(state_info->values[state], value, size);
+                state_info->sizes[state] = size;
+        } else {
+                state_info->sizes[state] = 0;
+        }
+
+        // Root arguments do not survive a root signature change, and
+        // descriptor tables point into the heaps that were bound
+        switch (state) {
+                case CMD_STATE_COMPUTE_ROOT_SIG :
+                        invalidate_cmd_states(state_info,
+                                CMD_STATE_COMPUTE_ROOT_PARAM,
+                                MAX_CMD_STATE_ROOT_PARAMS);
+                        break;
+
+                case CMD_STATE_GRAPHICS_ROOT_SIG :
+                        invalidate_cmd_states(state_info,
+                                CMD_STATE_GRAPHICS_ROOT_PARAM,
+                                MAX_CMD_STATE_ROOT_PARAMS);
+                        break;
+
+                case CMD_STATE_DESCRIPTOR_HEAPS :
+                        invalidate_cmd_states(state_info,
+                                CMD_STATE_COMPUTE_ROOT_PARAM,
+                                2 * MAX_CMD_STATE_ROOT_PARAMS);
+                        break;
+
+                default : break;
+        }
+
+        ++state_info->stats.issued_count;
+
+        return 1;
+}
+
+int filter_root_param_state(struct cmd_state_info *state_info,
+        int is_compute, unsigned int root_param_index, const void *value,
+        unsigned int size)
+{
+        if (root_param_index >= MAX_CMD_STATE_ROOT_PARAMS) {
+                ++state_info->stats.issued_count;
+                return 1;
+        }
+
+        return filter_cmd_state(state_info, (is_compute ?
+                CMD_STATE_COMPUTE_ROOT_PARAM : CMD_STATE_GRAPHICS_ROOT_PARAM) +
+                root_param_index, value, size);
+}
@@ -0,0 +1,55 @@
+#ifndef CMD_STATE_INTERFACE_H
+#define CMD_STATE_INTERFACE_H
+
+// Shadow copy of the state bound on a command list. Every rec_set_* call
+// hands its arguments to filter_cmd_state first and is dropped when they
+// match what is already bound. Kept free of D3D types so the filtering can
+// be checked headless.
+#define MAX_CMD_STATE_ROOT_PARAMS 16
+#define MAX_CMD_STATE_SIZE 64
+
+enum CMD_STATE {
+        CMD_STATE_PIPELINE,
+        CMD_STATE_RENDER_TARGET,
+        CMD_STATE_VIEWPORT,
+        CMD_STATE_SCISSOR_RECT,
+        CMD_STATE_PRIMITIVE,
+        CMD_STATE_COMPUTE_ROOT_SIG,
+        CMD_STATE_GRAPHICS_ROOT_SIG,
+        CMD_STATE_DESCRIPTOR_HEAPS,
+        CMD_STATE_VERTEX_BUFFER,
+        CMD_STATE_INSTANCE_BUFFER,
+        CMD_STATE_INDEX_BUFFER,
+        // One state per root parameter index
+        CMD_STATE_COMPUTE_ROOT_PARAM,
+        CMD_STATE_GRAPHICS_ROOT_PARAM = CMD_STATE_COMPUTE_ROOT_PARAM +
+                MAX_CMD_STATE_ROOT_PARAMS,
+        CMD_STATE_COUNT = CMD_STATE_GRAPHICS_ROOT_PARAM +
+                MAX_CMD_STATE_ROOT_PARAMS
+};
+
+struct cmd_state_stats {
+        unsigned int issued_count;
+        unsigned int elided_count;
+};
+
+struct cmd_state_info {
+        // A size of 0 means the state is unknown and the next set is issued
+        unsigned int sizes[CMD_STATE_COUNT];
+        unsigned char values[CMD_STATE_COUNT][MAX_CMD_STATE_SIZE];
+        struct cmd_state_stats stats;
+};
+
+void init_cmd_state(struct cmd_state_info *state_info);
+// Forgets all bound state, for when the command list is reset
+void invalidate_cmd_state(struct cmd_state_info *state_info);
+void invalidate_cmd_states(struct cmd_state_info *state_info,
+        unsigned int first_state, unsigned int state_count);
+// Returns 1 when the set has to be issued and records value as bound
+int filter_cmd_state(struct cmd_state_info *state_info, unsigned int state,
+        const void *value, unsigned int size);
+int filter_root_param_state(struct cmd_state_info *state_info,
+        int is_compute, unsigned int root_param_index, const void *value,
+        unsigned int size);
+
+#endif
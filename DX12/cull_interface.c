@@ -0,0 +1,648 @@
+#include "cull_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+// Eight volumes go through each iteration, in a single AVX register when the
+// build targets AVX2 and as two SSE halves otherwise
+#if defined(__AVX2__)
+#define CULL_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULL_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#define CULL_BATCH_SIZE 8
+#define CULL_VIEW_BLOCK_SIZE 1024
+
+struct cull_job {
+        struct frustum_planes *planes;
+        struct cull_volume_info *volume_info;
+        unsigned int *visible_indices;
+        unsigned int chunk_count;
+        unsigned int chunk_visible_counts[MAX_CULL_CHUNKS];
+};
+
+struct cull_views_job {
+        struct frustum_planes *planes;
+        unsigned int view_count;
+        struct cull_volume_info *volume_info;
+        unsigned int *view_masks;
+        unsigned int chunk_count;
+};
+
+void create_cull_volumes(struct cull_volume_info *volume_info)
+{
+        assert(volume_info->capacity > 0);
+
+        size_t size = volume_info->capacity * sizeof (float);
+
+        volume_info->count = 0;
+        volume_info->x = malloc(size);
+        volume_info->y = malloc(size);
+        volume_info->z = malloc(size);
+        volume_info->radius = NULL;
+        volume_info->extent_x = NULL;
+        volume_info->extent_y = NULL;
+        volume_info->extent_z = NULL;
+
+        if (volume_info->type == CULL_VOLUME_TYPE_SPHERE) {
+                volume_info->radius = malloc(size);
+        } else {
+                volume_info->extent_x = malloc(size);
+                volume_info->extent_y = malloc(size);
+                volume_info->extent_z = malloc(size);
+        }
+}
+
+void release_cull_volumes(struct cull_volume_info *volume_info)
+{
+        free(volume_info->extent_z);
+        free(volume_info->extent_y);
+        free(volume_info->extent_x);
+        free(volume_info->radius);
+        free(volume_info->z);
+        free(volume_info->y);
+        free(volume_info->x);
+}
+
+unsigned int add_cull_sphere(struct cull_volume_info *volume_info,
+        vec3 centre, float radius)
+{
+        assert(volume_info->type == CULL_VOLUME_TYPE_SPHERE);
+        assert(volume_info->count < volume_info->capacity);
+
+        unsigned int index = volume_info->count++;
+        volume_info->x[index] = centre[0];
+        volume_info->y[index] = centre[1];
+        volume_info->z[index] = centre[2];
+        volume_info->radius[index] = radius;
+
+        return index;
+}
+
+unsigned int add_cull_aabb(struct cull_volume_info *volume_info,
+        vec3 centre, vec3 extents)
+{
+        assert(volume_info->type == CULL_VOLUME_TYPE_AABB);
+        assert(volume_info->count < volume_info->capacity);
+
+        unsigned int index = volume_info->count++;
+        volume_info->x[index] = centre[0];
+        volume_info->y[index] = centre[1];
+        volume_info->z[index] = centre[2];
+        volume_info->extent_x[index] = extents[0];
+        volume_info->extent_y[index] = extents[1];
+        volume_info->extent_z[index] = extents[2];
+
+        return index;
+}
+
+void extract_frustum_planes(mat4x4 pv_mat, struct frustum_planes *planes)
+{
+        // Rows of the matrix as it is applied to a column vector, the
+        // matrices are stored column by column
+        vec4 rows[4];
+        for (int i = 0; i < 4; ++i) {
+                for (int j = 0; j < 4; ++j)
+                        rows[i][j] = pv_mat[j][i];
+        }
+
+        vec4 plane_list[6];
+        vec4_add(plane_list[0], rows[3], rows[0]); // Left
+        vec4_sub(plane_list[1], rows[3], rows[0]); // Right
+        vec4_add(plane_list[2], rows[3], rows[1]); // Bottom
+        vec4_sub(plane_list[3], rows[3], rows[1]); // Top
+        vec4_scale(plane_list[4], rows[2], 1.0f);  // Near
+        vec4_sub(plane_list[5], rows[3], rows[2]); // Far
+
+        // Normalised so distances are in world units and compare against
+        // radii and extents
+        for (int i = 0; i < 6; ++i) {
+                float len = sqrtf(plane_list[i][0] * plane_list[i][0] +
+                        plane_list[i][1] * plane_list[i][1] +
+                        plane_list[i][2] * plane_list[i][2]);
+                float inv_len = len > 0.0f ? 1.0f / len : 0.0f;
+
+                planes->a[i] = plane_list[i][0] * inv_len;
+                planes->b[i] = plane_list[i][1] * inv_len;
+                planes->c[i] = plane_list[i][2] * inv_len;
+                planes->d[i] = plane_list[i][3] * inv_len;
+        }
+}
+
+static int is_sphere_visible(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        for (int p = 0; p < 6; ++p) {
+                float dist = planes->a[p] * volume_info->x[i] +
+                        planes->b[p] * volume_info->y[i] +
+                        planes->c[p] * volume_info->z[i] + planes->d[p];
+                if (dist <= -volume_info->radius[i])
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int is_aabb_visible(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        // Distance of the box corner furthest along the plane normal
+        for (int p = 0; p < 6; ++p) {
+                float dist = planes->a[p] * volume_info->x[i] +
+                        planes->b[p] * volume_info->y[i] +
+                        planes->c[p] * volume_info->z[i] + planes->d[p] +
+                        fabsf(planes->a[p]) * volume_info->extent_x[i] +
+                        fabsf(planes->b[p]) * volume_info->extent_y[i] +
+                        fabsf(planes->c[p]) * volume_info->extent_z[i];
+                if (dist <= 0.0f)
+                        return 0;
+        }
+
+        return 1;
+}
+
+#if defined(CULL_USE_AVX) || defined(CULL_USE_SSE)
+
+// Lanes of the visible volumes in a group of four, packed to the front
+static const unsigned int visible_lanes[16][4] = {
+        { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+        { 2, 0, 0, 0 }, { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 1, 2, 0 },
+        { 3, 0, 0, 0 }, { 0, 3, 0, 0 }, { 1, 3, 0, 0 }, { 0, 1, 3, 0 },
+        { 2, 3, 0, 0 }, { 0, 2, 3, 0 }, { 1, 2, 3, 0 }, { 0, 1, 2, 3 }
+};
+
+static const unsigned int visible_lane_counts[16] = {
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+// All four indices are stored and only the visible ones advance the count,
+// which never runs past the volumes looked at so far
+static unsigned int compact_batch(unsigned int mask, unsigned int first,
+        unsigned int *visible_indices, unsigned int visible_count)
+{
+        for (unsigned int half = 0; half < 2; ++half) {
+                unsigned int half_mask = (mask >> (half * 4)) & 0xf;
+                __m128i indices = _mm_add_epi32(_mm_set1_epi32(
+                        (int) (first + half * 4)), _mm_loadu_si128(
+                        (const __m128i *) visible_lanes[half_mask]));
+                _mm_storeu_si128((__m128i *) &visible_indices[visible_count],
+                        indices);
+                visible_count += visible_lane_counts[half_mask];
+        }
+
+        return visible_count;
+}
+
+#endif
+
+#if defined(CULL_USE_AVX)
+
+static unsigned int get_sphere_batch_mask(__m256 (*planes)[4],
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        __m256 x = _mm256_loadu_ps(&volume_info->x[i]);
+        __m256 y = _mm256_loadu_ps(&volume_info->y[i]);
+        __m256 z = _mm256_loadu_ps(&volume_info->z[i]);
+        __m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(),
+                _mm256_loadu_ps(&volume_info->radius[i]));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+                __m256 dist = _mm256_add_ps(_mm256_add_ps(
+                        _mm256_mul_ps(planes[p][0], x),
+                        _mm256_mul_ps(planes[p][1], y)), _mm256_add_ps(
+                        _mm256_mul_ps(planes[p][2], z), planes[p][3]));
+                inside = _mm256_and_ps(inside,
+                        _mm256_cmp_ps(dist, neg_radius, _CMP_GT_OQ));
+        }
+
+        return (unsigned int) _mm256_movemask_ps(inside);
+}
+
+static unsigned int get_aabb_batch_mask(__m256 (*planes)[4],
+        __m256 (*abs_planes)[3], struct cull_volume_info *volume_info,
+        unsigned int i)
+{
+        __m256 x = _mm256_loadu_ps(&volume_info->x[i]);
+        __m256 y = _mm256_loadu_ps(&volume_info->y[i]);
+        __m256 z = _mm256_loadu_ps(&volume_info->z[i]);
+        __m256 ex = _mm256_loadu_ps(&volume_info->extent_x[i]);
+        __m256 ey = _mm256_loadu_ps(&volume_info->extent_y[i]);
+        __m256 ez = _mm256_loadu_ps(&volume_info->extent_z[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+                __m256 dist = _mm256_add_ps(_mm256_add_ps(
+                        _mm256_mul_ps(planes[p][0], x),
+                        _mm256_mul_ps(planes[p][1], y)), _mm256_add_ps(
+                        _mm256_mul_ps(planes[p][2], z), planes[p][3]));
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(
+                        _mm256_mul_ps(abs_planes[p][0], ex),
+                        _mm256_mul_ps(abs_planes[p][1], ey)),
+                        _mm256_mul_ps(abs_planes[p][2], ez));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(
+                        _mm256_add_ps(dist, reach), _mm256_setzero_ps(),
+                        _CMP_GT_OQ));
+        }
+
+        return (unsigned int) _mm256_movemask_ps(inside);
+}
+
+static void load_batch_planes(struct frustum_planes *frustum_planes,
+        __m256 (*planes)[4], __m256 (*abs_planes)[3])
+{
+        for (int p = 0; p < 6; ++p) {
+                planes[p][0] = _mm256_set1_ps(frustum_planes->a[p]);
+                planes[p][1] = _mm256_set1_ps(frustum_planes->b[p]);
+                planes[p][2] = _mm256_set1_ps(frustum_planes->c[p]);
+                planes[p][3] = _mm256_set1_ps(frustum_planes->d[p]);
+                abs_planes[p][0] = _mm256_set1_ps(fabsf(frustum_planes->a[p]));
+                abs_planes[p][1] = _mm256_set1_ps(fabsf(frustum_planes->b[p]));
+                abs_planes[p][2] = _mm256_set1_ps(fabsf(frustum_planes->c[p]));
+        }
+}
+
+static unsigned int cull_batches(struct frustum_planes *frustum_planes,
+        struct cull_volume_info *volume_info, unsigned int first,
+        unsigned int count, unsigned int *visible_indices)
+{
+        __m256 planes[6][4];
+        __m256 abs_planes[6][3];
+        load_batch_planes(frustum_planes, planes, abs_planes);
+
+        unsigned int visible_count = 0;
+        for (unsigned int i = first; i < first + count;
+                i += CULL_BATCH_SIZE) {
+                unsigned int mask = volume_info->type ==
+                        CULL_VOLUME_TYPE_SPHERE ?
+                        get_sphere_batch_mask(planes, volume_info, i) :
+                        get_aabb_batch_mask(planes, abs_planes, volume_info,
+                        i);
+                visible_count = compact_batch(mask, i, visible_indices,
+                        visible_count);
+        }
+
+        return visible_count;
+}
+
+#elif defined(CULL_USE_SSE)
+
+static unsigned int get_sphere_half_mask(__m128 (*planes)[4],
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        __m128 x = _mm_loadu_ps(&volume_info->x[i]);
+        __m128 y = _mm_loadu_ps(&volume_info->y[i]);
+        __m128 z = _mm_loadu_ps(&volume_info->z[i]);
+        __m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(),
+                _mm_loadu_ps(&volume_info->radius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+                __m128 dist = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(planes[p][0], x),
+                        _mm_mul_ps(planes[p][1], y)), _mm_add_ps(
+                        _mm_mul_ps(planes[p][2], z), planes[p][3]));
+                inside = _mm_and_ps(inside, _mm_cmpgt_ps(dist, neg_radius));
+        }
+
+        return (unsigned int) _mm_movemask_ps(inside);
+}
+
+static unsigned int get_aabb_half_mask(__m128 (*planes)[4],
+        __m128 (*abs_planes)[3], struct cull_volume_info *volume_info,
+        unsigned int i)
+{
+        __m128 x = _mm_loadu_ps(&volume_info->x[i]);
+        __m128 y = _mm_loadu_ps(&volume_info->y[i]);
+        __m128 z = _mm_loadu_ps(&volume_info->z[i]);
+        __m128 ex = _mm_loadu_ps(&volume_info->extent_x[i]);
+        __m128 ey = _mm_loadu_ps(&volume_info->extent_y[i]);
+        __m128 ez = _mm_loadu_ps(&volume_info->extent_z[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+                __m128 dist = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(planes[p][0], x),
+                        _mm_mul_ps(planes[p][1], y)), _mm_add_ps(
+                        _mm_mul_ps(planes[p][2], z), planes[p][3]));
+                __m128 reach = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(abs_planes[p][0], ex),
+                        _mm_mul_ps(abs_planes[p][1], ey)),
+                        _mm_mul_ps(abs_planes[p][2], ez));
+                inside = _mm_and_ps(inside, _mm_cmpgt_ps(
+                        _mm_add_ps(dist, reach), _mm_setzero_ps()));
+        }
+
+        return (unsigned int) _mm_movemask_ps(inside);
+}
+
+static unsigned int get_sphere_batch_mask(__m128 (*planes)[4],
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        return get_sphere_half_mask(planes, volume_info, i) |
+                (get_sphere_half_mask(planes, volume_info, i + 4) << 4);
+}
+
+static unsigned int get_aabb_batch_mask(__m128 (*planes)[4],
+        __m128 (*abs_planes)[3], struct cull_volume_info *volume_info,
+        unsigned int i)
+{
+        return get_aabb_half_mask(planes, abs_planes, volume_info, i) |
+                (get_aabb_half_mask(planes, abs_planes, volume_info, i + 4) <<
+                4);
+}
+
+static void load_batch_planes(struct frustum_planes *frustum_planes,
+        __m128 (*planes)[4], __m128 (*abs_planes)[3])
+{
+        for (int p = 0; p < 6; ++p) {
+                planes[p][0] = _mm_set1_ps(frustum_planes->a[p]);
+                planes[p][1] = _mm_set1_ps(frustum_planes->b[p]);
+                planes[p][2] = _mm_set1_ps(frustum_planes->c[p]);
+                planes[p][3] = _mm_set1_ps(frustum_planes->d[p]);
+                abs_planes[p][0] = _mm_set1_ps(fabsf(frustum_planes->a[p]));
+                abs_planes[p][1] = _mm_set1_ps(fabsf(frustum_planes->b[p]));
+                abs_planes[p][2] = _mm_set1_ps(fabsf(frustum_planes->c[p]));
+        }
+}
+
+static unsigned int cull_batches(struct frustum_planes *frustum_planes,
+        struct cull_volume_info *volume_info, unsigned int first,
+        unsigned int count, unsigned int *visible_indices)
+{
+        __m128 planes[6][4];
+        __m128 abs_planes[6][3];
+        load_batch_planes(frustum_planes, planes, abs_planes);
+
+        unsigned int visible_count = 0;
+        for (unsigned int i = first; i < first + count;
+                i += CULL_BATCH_SIZE) {
+                unsigned int mask = volume_info->type ==
+                        CULL_VOLUME_TYPE_SPHERE ?
+                        get_sphere_batch_mask(planes, volume_info, i) :
+                        get_aabb_batch_mask(planes, abs_planes, volume_info,
+                        i);
+                visible_count = compact_batch(mask, i, visible_indices,
+                        visible_count);
+        }
+
+        return visible_count;
+}
+
+#endif
+
+static unsigned int cull_range(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int first,
+        unsigned int count, unsigned int *visible_indices)
+{
+        unsigned int visible_count = 0;
+        unsigned int batched_count = 0;
+
+#if defined(CULL_USE_AVX) || defined(CULL_USE_SSE)
+        batched_count = count - count % CULL_BATCH_SIZE;
+        visible_count = cull_batches(planes, volume_info, first,
+                batched_count, visible_indices);
+#endif
+
+        // The volumes left over from the last batch
+        for (unsigned int i = first + batched_count; i < first + count; ++i) {
+                int is_visible = volume_info->type == CULL_VOLUME_TYPE_SPHERE ?
+                        is_sphere_visible(planes, volume_info, i) :
+                        is_aabb_visible(planes, volume_info, i);
+                if (is_visible)
+                        visible_indices[visible_count++] = i;
+        }
+
+        return visible_count;
+}
+
+static unsigned int get_chunk_first(unsigned int count,
+        unsigned int chunk_count, unsigned int chunk)
+{
+        // Chunks start on a batch so only the last one has a scalar tail
+        unsigned int batch_count = (count + CULL_BATCH_SIZE - 1) /
+                CULL_BATCH_SIZE;
+        unsigned int first = (unsigned int) (((unsigned long long)
+                batch_count * chunk) / chunk_count) * CULL_BATCH_SIZE;
+
+        return first < count ? first : count;
+}
+
+static void cull_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct cull_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = get_chunk_first(job->volume_info->count,
+                        job->chunk_count, c);
+                unsigned int last = get_chunk_first(job->volume_info->count,
+                        job->chunk_count, c + 1);
+
+                // Each chunk compacts into its own part of the output
+                job->chunk_visible_counts[c] = cull_range(job->planes,
+                        job->volume_info, first, last - first,
+                        job->visible_indices + first);
+        }
+}
+
+unsigned int cull_volumes(struct job_system_info *job_system,
+        struct frustum_planes *planes, struct cull_volume_info *volume_info,
+        unsigned int *visible_indices)
+{
+        if (volume_info->count == 0)
+                return 0;
+
+        struct cull_job job;
+        job.planes = planes;
+        job.volume_info = volume_info;
+        job.visible_indices = visible_indices;
+        job.chunk_count = 1;
+
+        // Small counts are culled on the calling thread
+        if (job_system != NULL && volume_info->count >=
+                CULL_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_CULL_CHUNKS)
+                        job.chunk_count = MAX_CULL_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, cull_chunks, &job);
+
+        // Close the gaps between the chunks, each moves down to right after
+        // the visible indices of the ones before it
+        unsigned int visible_count = job.chunk_visible_counts[0];
+        for (unsigned int c = 1; c < job.chunk_count; ++c) {
+                memmove(visible_indices + visible_count,
+                        visible_indices + get_chunk_first(volume_info->count,
+                        job.chunk_count, c),
+                        job.chunk_visible_counts[c] * sizeof (unsigned int));
+                visible_count += job.chunk_visible_counts[c];
+        }
+
+        return visible_count;
+}
+
+#if defined(CULL_USE_AVX) || defined(CULL_USE_SSE)
+
+// Lane masks of every four bit visibility mask
+static const unsigned int lane_masks[16][4] = {
+        { 0, 0, 0, 0 }, { ~0u, 0, 0, 0 }, { 0, ~0u, 0, 0 },
+        { ~0u, ~0u, 0, 0 }, { 0, 0, ~0u, 0 }, { ~0u, 0, ~0u, 0 },
+        { 0, ~0u, ~0u, 0 }, { ~0u, ~0u, ~0u, 0 }, { 0, 0, 0, ~0u },
+        { ~0u, 0, 0, ~0u }, { 0, ~0u, 0, ~0u }, { ~0u, ~0u, 0, ~0u },
+        { 0, 0, ~0u, ~0u }, { ~0u, 0, ~0u, ~0u }, { 0, ~0u, ~0u, ~0u },
+        { ~0u, ~0u, ~0u, ~0u }
+};
+
+static void mark_batch_view(unsigned int mask, __m128i view_bit,
+        unsigned int i, unsigned int *view_masks)
+{
+        for (int half = 0; half < 2; ++half) {
+                __m128i *dst = (__m128i *) &view_masks[i + half * 4];
+                __m128i lanes = _mm_loadu_si128(
+                        (const __m128i *) lane_masks[(mask >> half * 4) & 0xf]);
+                _mm_storeu_si128(dst, _mm_or_si128(_mm_loadu_si128(dst),
+                        _mm_and_si128(lanes, view_bit)));
+        }
+}
+
+// Views go through a block of volumes small enough to stay in the cache, so
+// the volumes are read from memory once and the planes of a view are set up
+// once per block rather than once per batch
+static void mark_block_views(struct frustum_planes *frustum_planes,
+        unsigned int view_count, struct cull_volume_info *volume_info,
+        unsigned int first, unsigned int count, unsigned int *view_masks)
+{
+#if defined(CULL_USE_AVX)
+        __m256 planes[6][4];
+        __m256 abs_planes[6][3];
+#else
+        __m128 planes[6][4];
+        __m128 abs_planes[6][3];
+#endif
+
+        memset(view_masks + first, 0, count * sizeof (unsigned int));
+
+        for (unsigned int v = 0; v < view_count; ++v) {
+                load_batch_planes(&frustum_planes[v], planes, abs_planes);
+                __m128i view_bit = _mm_set1_epi32((int) (1u << v));
+
+                if (volume_info->type == CULL_VOLUME_TYPE_SPHERE) {
+                        for (unsigned int i = first; i < first + count;
+                                i += CULL_BATCH_SIZE) {
+                                mark_batch_view(get_sphere_batch_mask(planes,
+                                        volume_info, i), view_bit, i,
+                                        view_masks);
+                        }
+                } else {
+                        for (unsigned int i = first; i < first + count;
+                                i += CULL_BATCH_SIZE) {
+                                mark_batch_view(get_aabb_batch_mask(planes,
+                                        abs_planes, volume_info, i), view_bit,
+                                        i, view_masks);
+                        }
+                }
+        }
+}
+
+#endif
+
+static void cull_view_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct cull_views_job *job = job_data;
+        struct cull_volume_info *volume_info = job->volume_info;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = get_chunk_first(volume_info->count,
+                        job->chunk_count, c);
+                unsigned int last = get_chunk_first(volume_info->count,
+                        job->chunk_count, c + 1);
+                unsigned int i = first;
+
+#if defined(CULL_USE_AVX) || defined(CULL_USE_SSE)
+                while (i + CULL_BATCH_SIZE <= last) {
+                        unsigned int count = (last - i) / CULL_BATCH_SIZE *
+                                CULL_BATCH_SIZE;
+                        if (count > CULL_VIEW_BLOCK_SIZE)
+                                count = CULL_VIEW_BLOCK_SIZE;
+
+                        mark_block_views(job->planes, job->view_count,
+                                volume_info, i, count, job->view_masks);
+                        i += count;
+                }
+#endif
+
+                for (; i < last; ++i) {
+                        unsigned int mask = 0;
+                        for (unsigned int v = 0; v < job->view_count; ++v) {
+                                int is_visible = volume_info->type ==
+                                        CULL_VOLUME_TYPE_SPHERE ?
+                                        is_sphere_visible(&job->planes[v],
+                                        volume_info, i) :
+                                        is_aabb_visible(&job->planes[v],
+                                        volume_info, i);
+                                mask |= (unsigned int) is_visible << v;
+                        }
+
+                        job->view_masks[i] = mask;
+                }
+        }
+}
+
+void cull_volumes_multi_view(struct job_system_info *job_system,
+        struct frustum_planes *planes, unsigned int view_count,
+        struct cull_volume_info *volume_info, unsigned int *view_masks)
+{
+        assert(view_count <= MAX_CULL_VIEWS);
+
+        if (volume_info->count == 0)
+                return;
+
+        struct cull_views_job job;
+        job.planes = planes;
+        job.view_count = view_count;
+        job.volume_info = volume_info;
+        job.view_masks = view_masks;
+        job.chunk_count = 1;
+
+        // Every view makes a volume cost more, so fewer of them are worth
+        // splitting up
+        if (job_system != NULL && volume_info->count * view_count >=
+                CULL_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_CULL_CHUNKS)
+                        job.chunk_count = MAX_CULL_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, cull_view_chunks, &job);
+}
+
+unsigned int get_view_visible_indices(unsigned int *view_masks,
+        unsigned int count, unsigned int view_index,
+        unsigned int *visible_indices)
+{
+        assert(view_index < MAX_CULL_VIEWS);
+
+        // Every index is stored and only the visible ones are kept
+        unsigned int visible_count = 0;
+        for (unsigned int i = 0; i < count; ++i) {
+                visible_indices[visible_count] = i;
+                visible_count += (view_masks[i] >> view_index) & 1;
+        }
+
+        return visible_count;
+}
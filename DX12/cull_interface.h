@@ -0,0 +1,69 @@
+#ifndef CULL_INTERFACE_H
+#define CULL_INTERFACE_H
+
+#include "linmath.h"
+#include "job_interface.h"
+
+// Frustum culling of bounding spheres or boxes kept as structure of arrays.
+// Volumes are tested eight per iteration, with AVX2 when the build targets
+// it and two SSE halves otherwise, and large sets are split into chunks on
+// the job system. Several views can be culled in the same pass, marking
+// every volume with a bit per view that sees it. Kept free of D3D types so
+// it can run headless.
+#define CULL_PARALLEL_MIN_COUNT 16384
+#define MAX_CULL_CHUNKS 64
+#define MAX_CULL_VIEWS 32
+
+enum CULL_VOLUME_TYPE {
+        CULL_VOLUME_TYPE_SPHERE,
+        CULL_VOLUME_TYPE_AABB
+};
+
+// Spheres use x, y, z and radius, boxes use x, y, z as the centre and the
+// extents as half sizes
+struct cull_volume_info {
+        enum CULL_VOLUME_TYPE type;
+        unsigned int count;
+        unsigned int capacity;
+        float *x;
+        float *y;
+        float *z;
+        float *radius;
+        float *extent_x;
+        float *extent_y;
+        float *extent_z;
+};
+
+// Planes point inwards, stored as a plane per row of a, b, c and d
+struct frustum_planes {
+        float a[6];
+        float b[6];
+        float c[6];
+        float d[6];
+};
+
+void create_cull_volumes(struct cull_volume_info *volume_info);
+void release_cull_volumes(struct cull_volume_info *volume_info);
+unsigned int add_cull_sphere(struct cull_volume_info *volume_info,
+        vec3 centre, float radius);
+unsigned int add_cull_aabb(struct cull_volume_info *volume_info,
+        vec3 centre, vec3 extents);
+// Planes of a D3D style projection, clip space z from 0 to w
+void extract_frustum_planes(mat4x4 pv_mat, struct frustum_planes *planes);
+// Writes the indices of the visible volumes in increasing order, returns
+// how many there are
+unsigned int cull_volumes(struct job_system_info *job_system,
+        struct frustum_planes *planes, struct cull_volume_info *volume_info,
+        unsigned int *visible_indices);
+// Sets bit v of view_masks[i] when volume i is visible from view v, and
+// clears the others
+void cull_volumes_multi_view(struct job_system_info *job_system,
+        struct frustum_planes *planes, unsigned int view_count,
+        struct cull_volume_info *volume_info, unsigned int *view_masks);
+// Writes the indices of the volumes a view sees in increasing order, returns
+// how many there are
+unsigned int get_view_visible_indices(unsigned int *view_masks,
+        unsigned int count, unsigned int view_index,
+        unsigned int *visible_indices);
+
+#endif
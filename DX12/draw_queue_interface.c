@@ -0,0 +1,356 @@
+#include "draw_queue_interface.h"
+#include "timer_interface.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+UINT64 make_draw_key(UINT layer, UINT pso_handle, UINT material_index,
+        float depth)
+{
+        assert(layer < (1u << DRAW_KEY_LAYER_BITS));
+        assert(pso_handle < (1u << DRAW_KEY_PSO_BITS));
+        assert(material_index < (1u << DRAW_KEY_MATERIAL_BITS));
+
+        if (depth < 0.0f)
+                depth = 0.0f;
+        if (depth > 1.0f)
+                depth = 1.0f;
+
+        UINT64 depth_bits = (UINT64) ((double) depth *
+                ((1u << DRAW_KEY_DEPTH_BITS) - 1));
+
+        UINT64 key = layer;
+        key = (key << DRAW_KEY_PSO_BITS) | pso_handle;
+        key = (key << DRAW_KEY_MATERIAL_BITS) | material_index;
+        key = (key << DRAW_KEY_DEPTH_BITS) | depth_bits;
+
+        return key << DRAW_KEY_OFFSET_BITS;
+}
+
+// Indirect records set the draw constants, the vertex and instance buffers
+// and the index buffer, then draw
+enum DRAW_QUEUE_INDIRECT_ARG {
+        DRAW_QUEUE_INDIRECT_ARG_CONSTANTS,
+        DRAW_QUEUE_INDIRECT_ARG_VERTEX_BUFFER,
+        DRAW_QUEUE_INDIRECT_ARG_INSTANCE_BUFFER,
+        DRAW_QUEUE_INDIRECT_ARG_INDEX_BUFFER,
+        DRAW_QUEUE_INDIRECT_ARG_DRAW,
+        DRAW_QUEUE_INDIRECT_ARG_COUNT
+};
+
+static void create_upload_buffer(struct gpu_device_info *device_info,
+        struct gpu_resource_info *resource_info, UINT64 width)
+{
+        resource_info->type = D3D12_HEAP_TYPE_UPLOAD;
+        resource_info->dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+        resource_info->width = width;
+        resource_info->height = 1;
+        resource_info->mip_levels = 1;
+        resource_info->format = DXGI_FORMAT_UNKNOWN;
+        resource_info->layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        resource_info->flags = D3D12_RESOURCE_FLAG_NONE;
+        resource_info->current_state = D3D12_RESOURCE_STATE_GENERIC_READ;
+        create_resource(device_info, resource_info);
+}
+
+static void setup_indirect_layout(struct draw_queue_info *queue_info)
+{
+        struct indirect_layout_info *layout_info =
+                &queue_info->cmd_signature_info.layout_info;
+        memset(layout_info, 0, sizeof (struct indirect_layout_info));
+        layout_info->arg_count = DRAW_QUEUE_INDIRECT_ARG_COUNT;
+
+        struct indirect_arg_desc *arg_descs = layout_info->args;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_CONSTANTS].type =
+                INDIRECT_ARG_TYPE_ROOT_CONSTANTS;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_CONSTANTS].root_param_index =
+                queue_info->draw_constants_param;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_CONSTANTS].num_constants =
+                sizeof (struct bindless_draw_constants) / sizeof (UINT);
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_VERTEX_BUFFER].type =
+                INDIRECT_ARG_TYPE_VERTEX_BUFFER;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_VERTEX_BUFFER].slot = 0;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_INSTANCE_BUFFER].type =
+                INDIRECT_ARG_TYPE_VERTEX_BUFFER;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_INSTANCE_BUFFER].slot = 1;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_INDEX_BUFFER].type =
+                INDIRECT_ARG_TYPE_INDEX_BUFFER;
+        arg_descs[DRAW_QUEUE_INDIRECT_ARG_DRAW].type =
+                INDIRECT_ARG_TYPE_DRAW_INDEXED;
+}
+
+static void pack_indirect_draw(struct draw_queue_info *queue_info,
+        void *record, struct draw_queue_cmd *cmd)
+{
+        struct indirect_layout_info *layout_info =
+                &queue_info->cmd_signature_info.layout_info;
+
+        pack_indirect_arg(layout_info, record,
+                DRAW_QUEUE_INDIRECT_ARG_CONSTANTS, &cmd->draw_constants);
+
+        struct indirect_buffer_view_args vert_buffer_args;
+        vert_buffer_args.address = cmd->vert_buffer->gpu_address;
+        vert_buffer_args.size = (UINT) cmd->vert_buffer->width;
+        vert_buffer_args.stride_or_format = cmd->vert_stride;
+        pack_indirect_arg(layout_info, record,
+                DRAW_QUEUE_INDIRECT_ARG_VERTEX_BUFFER, &vert_buffer_args);
+
+        // A zeroed view leaves the instance stream unbound
+        struct indirect_buffer_view_args instance_buffer_args;
+        memset(&instance_buffer_args, 0, sizeof (instance_buffer_args));
+        if (cmd->instance_buffer != NULL) {
+                instance_buffer_args.address =
+                        cmd->instance_buffer->gpu_address;
+                instance_buffer_args.size = (UINT) cmd->instance_buffer->width;
+                instance_buffer_args.stride_or_format = cmd->instance_stride;
+        }
+        pack_indirect_arg(layout_info, record,
+                DRAW_QUEUE_INDIRECT_ARG_INSTANCE_BUFFER,
+                &instance_buffer_args);
+
+        struct indirect_buffer_view_args index_buffer_args;
+        index_buffer_args.address = cmd->index_buffer->gpu_address;
+        index_buffer_args.size = (UINT) cmd->index_buffer->width;
+        index_buffer_args.stride_or_format =
+                cmd->index_buffer->index_format;
+        pack_indirect_arg(layout_info, record,
+                DRAW_QUEUE_INDIRECT_ARG_INDEX_BUFFER, &index_buffer_args);
+
+        struct indirect_draw_indexed_args draw_args;
+        draw_args.index_count = cmd->index_count;
+        draw_args.instance_count = cmd->instance_count;
+        draw_args.start_index = cmd->start_index;
+        draw_args.base_vertex = cmd->base_vertex;
+        draw_args.start_instance = cmd->start_instance;
+        pack_indirect_arg(layout_info, record, DRAW_QUEUE_INDIRECT_ARG_DRAW,
+                &draw_args);
+}
+
+void create_draw_queue(struct gpu_device_info *device_info,
+        struct draw_queue_info *queue_info)
+{
+        assert(queue_info->max_packets <= 1u << DRAW_KEY_OFFSET_BITS);
+
+        queue_info->packet_count = 0;
+        queue_info->frame_index = 0;
+        queue_info->packets = malloc(queue_info->max_packets *
+                sizeof (UINT64));
+        queue_info->sort_scratch = malloc(queue_info->max_packets *
+                sizeof (UINT64));
+        queue_info->cmds = malloc(queue_info->max_packets *
+                sizeof (struct draw_queue_cmd));
+        memset(&queue_info->stats, 0, sizeof (struct draw_queue_stats));
+
+        if (!queue_info->is_indirect)
+                return;
+
+        assert(queue_info->frame_count <= MAX_DRAW_QUEUE_FRAMES);
+
+        // Create the command signature matching the records
+        setup_indirect_layout(queue_info);
+        create_wstring(queue_info->cmd_signature_info.name,
+                L"Draw queue command signature");
+        create_cmd_signature(device_info, queue_info->root_sig_info,
+                &queue_info->cmd_signature_info);
+
+        // Create persistently mapped argument and count buffers per frame,
+        // there are never more runs than draws
+        UINT stride = queue_info->cmd_signature_info.layout_info.stride;
+        for (UINT i = 0; i < queue_info->frame_count; ++i) {
+                create_wstring(queue_info->args_buffers[i].name,
+                        L"Draw queue argument buffer %d", i);
+                create_upload_buffer(device_info, &queue_info->args_buffers[i],
+                        (UINT64) queue_info->max_packets * stride);
+                queue_info->args_data[i] =
+                        map_resource(&queue_info->args_buffers[i]);
+
+                create_wstring(queue_info->count_buffers[i].name,
+                        L"Draw queue count buffer %d", i);
+                create_upload_buffer(device_info,
+                        &queue_info->count_buffers[i],
+                        queue_info->max_packets * sizeof (UINT));
+                queue_info->count_data[i] =
+                        map_resource(&queue_info->count_buffers[i]);
+        }
+}
+
+void release_draw_queue(struct draw_queue_info *queue_info)
+{
+        if (queue_info->is_indirect) {
+                for (UINT i = 0; i < queue_info->frame_count; ++i) {
+                        unmap_resource(&queue_info->count_buffers[i]);
+                        release_resource(&queue_info->count_buffers[i]);
+                        unmap_resource(&queue_info->args_buffers[i]);
+                        release_resource(&queue_info->args_buffers[i]);
+                }
+
+                release_cmd_signature(&queue_info->cmd_signature_info);
+        }
+
+        free(queue_info->cmds);
+        free(queue_info->sort_scratch);
+        free(queue_info->packets);
+}
+
+void reset_draw_queue(struct draw_queue_info *queue_info, UINT frame_index)
+{
+        assert(!queue_info->is_indirect ||
+                frame_index < queue_info->frame_count);
+
+        queue_info->frame_index = frame_index;
+        queue_info->packet_count = 0;
+        memset(&queue_info->stats, 0, sizeof (struct draw_queue_stats));
+}
+
+void push_draw_packet(struct draw_queue_info *queue_info, UINT64 key,
+        struct draw_queue_cmd *cmd)
+{
+        if (queue_info->packet_count == queue_info->max_packets) {
+                ++queue_info->stats.dropped_packet_count;
+                return;
+        }
+
+        UINT cmd_offset = queue_info->packet_count++;
+        queue_info->cmds[cmd_offset] = *cmd;
+        queue_info->packets[cmd_offset] = key | cmd_offset;
+}
+
+static UINT get_packet_offset(UINT64 packet)
+{
+        return (UINT) (packet & ((1u << DRAW_KEY_OFFSET_BITS) - 1));
+}
+
+void sort_draw_queue(struct draw_queue_info *queue_info)
+{
+        double start_time = get_time_in_secs();
+
+        radix_sort_keys(queue_info->job_system, queue_info->packets,
+                queue_info->sort_scratch, queue_info->packet_count,
+                DRAW_KEY_OFFSET_BITS);
+
+        queue_info->stats.packet_count = queue_info->packet_count;
+        queue_info->stats.sort_time = get_time_in_secs() - start_time;
+}
+
+static void rec_direct_draws(struct gpu_cmd_list_info *cmd_list_info,
+        struct draw_queue_info *queue_info)
+{
+        struct gpu_pso_info *cur_pso_info = NULL;
+
+        for (UINT i = 0; i < queue_info->packet_count; ++i) {
+                struct draw_queue_cmd *cmd =
+                        &queue_info->cmds[get_packet_offset(
+                        queue_info->packets[i])];
+
+                // NULL means the PSO is still being built and has no fallback
+                struct gpu_pso_info *pso_info = get_pso_for_draw(
+                        queue_info->pso_cache_info, cmd->pso_handle);
+                if (pso_info == NULL) {
+                        ++queue_info->stats.skipped_packet_count;
+                        continue;
+                }
+
+                if (pso_info != cur_pso_info) {
+                        rec_set_pipeline_state_cmd(cmd_list_info, pso_info);
+                        cur_pso_info = pso_info;
+                        ++queue_info->stats.pso_change_count;
+                }
+
+                // The command list drops sets of what is already bound
+                rec_set_vertex_buffer_cmd(cmd_list_info, cmd->vert_buffer,
+                        cmd->vert_stride);
+                rec_set_index_buffer_cmd(cmd_list_info, cmd->index_buffer);
+
+                if (cmd->instance_buffer != NULL)
+                        rec_set_instance_buffer_cmd(cmd_list_info,
+                                cmd->instance_buffer, 0,
+                                cmd->instance_stride);
+
+                rec_set_graphics_root_constants_cmd(cmd_list_info,
+                        queue_info->draw_constants_param,
+                        sizeof (struct bindless_draw_constants) / sizeof (UINT),
+                        &cmd->draw_constants);
+
+                rec_draw_indexed_instance_cmd(cmd_list_info, cmd->index_count,
+                        cmd->instance_count, cmd->start_index,
+                        cmd->base_vertex, cmd->start_instance);
+                ++queue_info->stats.draw_call_count;
+        }
+}
+
+static void rec_indirect_run(struct gpu_cmd_list_info *cmd_list_info,
+        struct draw_queue_info *queue_info, struct gpu_pso_info *pso_info,
+        UINT first_record, UINT record_count, UINT run_index)
+{
+        UINT frame_index = queue_info->frame_index;
+        queue_info->count_data[frame_index][run_index] = record_count;
+
+        rec_set_pipeline_state_cmd(cmd_list_info, pso_info);
+        ++queue_info->stats.pso_change_count;
+
+        rec_execute_indirect_cmd(cmd_list_info,
+                &queue_info->cmd_signature_info, record_count,
+                &queue_info->args_buffers[frame_index], (UINT64) first_record *
+                queue_info->cmd_signature_info.layout_info.stride,
+                &queue_info->count_buffers[frame_index],
+                run_index * sizeof (UINT));
+        ++queue_info->stats.draw_call_count;
+}
+
+static void rec_indirect_draws(struct gpu_cmd_list_info *cmd_list_info,
+        struct draw_queue_info *queue_info)
+{
+        struct indirect_layout_info *layout_info =
+                &queue_info->cmd_signature_info.layout_info;
+        void *args_data = queue_info->args_data[queue_info->frame_index];
+
+        struct gpu_pso_info *run_pso_info = NULL;
+        UINT run_first_record = 0;
+        UINT run_count = 0;
+        UINT record_count = 0;
+
+        for (UINT i = 0; i < queue_info->packet_count; ++i) {
+                struct draw_queue_cmd *cmd =
+                        &queue_info->cmds[get_packet_offset(
+                        queue_info->packets[i])];
+
+                struct gpu_pso_info *pso_info = get_pso_for_draw(
+                        queue_info->pso_cache_info, cmd->pso_handle);
+                if (pso_info == NULL) {
+                        ++queue_info->stats.skipped_packet_count;
+                        continue;
+                }
+
+                // A PSO change ends the run
+                if (pso_info != run_pso_info) {
+                        if (run_pso_info != NULL)
+                                rec_indirect_run(cmd_list_info, queue_info,
+                                        run_pso_info, run_first_record,
+                                        record_count - run_first_record,
+                                        run_count++);
+
+                        run_pso_info = pso_info;
+                        run_first_record = record_count;
+                }
+
+                pack_indirect_draw(queue_info, get_indirect_record(layout_info,
+                        args_data, record_count++), cmd);
+        }
+
+        if (run_pso_info != NULL)
+                rec_indirect_run(cmd_list_info, queue_info, run_pso_info,
+                        run_first_record, record_count - run_first_record,
+                        run_count);
+}
+
+void rec_draw_queue_cmds(struct gpu_cmd_list_info *cmd_list_info,
+        struct draw_queue_info *queue_info)
+{
+        if (queue_info->is_indirect)
+                rec_indirect_draws(cmd_list_info, queue_info);
+        else
+                rec_direct_draws(cmd_list_info, queue_info);
+}
@@ -0,0 +1,92 @@
+#ifndef DRAW_QUEUE_INTERFACE_H
+#define DRAW_QUEUE_INTERFACE_H
+
+#include "gpu_interface.h"
+#include "bindless_interface.h"
+#include "pso_cache_interface.h"
+#include "radix_sort_interface.h"
+#include "job_interface.h"
+
+
+// Draws are pushed as packets of a 64-bit sort key with the offset of their
+// draw command in its low bits, sorted once per frame and then recorded in
+// key order so draws sharing a PSO and material end up next to each other.
+//
+// In indirect mode the draws of each run sharing a PSO are packed into the
+// indirect argument buffer of the frame instead, with their root constants,
+// buffers and draw arguments, and go out in a single ExecuteIndirect.
+//
+// Keys hold, from the most significant bit down, the layer, the PSO handle,
+// the material index and the depth, with the command offset below them. A
+// queue holds no more than 1 << DRAW_KEY_OFFSET_BITS packets.
+#define DRAW_KEY_LAYER_BITS 4
+#define DRAW_KEY_PSO_BITS 16
+#define DRAW_KEY_MATERIAL_BITS 16
+#define DRAW_KEY_DEPTH_BITS 12
+#define DRAW_KEY_OFFSET_BITS 16
+#define MAX_DRAW_QUEUE_FRAMES 4
+
+struct draw_queue_cmd {
+        UINT pso_handle;
+        struct gpu_resource_info *vert_buffer;
+        UINT vert_stride;
+        struct gpu_resource_info *index_buffer;
+        struct gpu_resource_info *instance_buffer;
+        UINT instance_stride;
+        struct bindless_draw_constants draw_constants;
+        UINT index_count;
+        UINT instance_count;
+        UINT start_index;
+        INT base_vertex;
+        UINT start_instance;
+};
+
+struct draw_queue_stats {
+        UINT packet_count;
+        UINT dropped_packet_count;
+        UINT skipped_packet_count;
+        UINT pso_change_count;
+        UINT draw_call_count;
+        double sort_time;
+};
+
+struct draw_queue_info {
+        struct pso_cache_info *pso_cache_info;
+        struct job_system_info *job_system;
+        struct gpu_root_sig_info *root_sig_info;
+        UINT draw_constants_param;
+        UINT max_packets;
+        BOOL is_indirect;
+        UINT frame_count; // Indirect mode only
+        UINT frame_index;
+        UINT packet_count;
+        UINT64 *packets;
+        UINT64 *sort_scratch;
+        struct draw_queue_cmd *cmds;
+        struct draw_queue_stats stats;
+        struct gpu_cmd_signature_info cmd_signature_info;
+        struct gpu_resource_info args_buffers[MAX_DRAW_QUEUE_FRAMES];
+        void *args_data[MAX_DRAW_QUEUE_FRAMES];
+        // A draw count per run of draws sharing a PSO
+        struct gpu_resource_info count_buffers[MAX_DRAW_QUEUE_FRAMES];
+        UINT *count_data[MAX_DRAW_QUEUE_FRAMES];
+};
+
+// Depth is expected in [0, 1], flip it for layers drawn back to front. The
+// offset bits are left clear for push_draw_packet.
+UINT64 make_draw_key(UINT layer, UINT pso_handle, UINT material_index,
+        float depth);
+void create_draw_queue(struct gpu_device_info *device_info,
+        struct draw_queue_info *queue_info);
+void release_draw_queue(struct draw_queue_info *queue_info);
+// The argument buffers of frame_index must no longer be in use by the GPU
+void reset_draw_queue(struct draw_queue_info *queue_info, UINT frame_index);
+void push_draw_packet(struct draw_queue_info *queue_info, UINT64 key,
+        struct draw_queue_cmd *cmd);
+void sort_draw_queue(struct draw_queue_info *queue_info);
+// Records the sorted draws, the root signature and everything that is not
+// part of a draw command has to be set already
+void rec_draw_queue_cmds(struct gpu_cmd_list_info *cmd_list_info,
+        struct draw_queue_info *queue_info);
+
+#endif
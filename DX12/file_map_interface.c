@@ -0,0 +1,118 @@
+#include "file_map_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+#if defined(_WIN32)
+struct file_map {
+        HANDLE file;
+        HANDLE file_mapping;
+};
+
+int map_file(const char *path, struct file_map_info *map_info)
+{
+        memset(map_info, 0, sizeof (struct file_map_info));
+
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+                return 0;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+                CloseHandle(file);
+                return 0;
+        }
+
+        HANDLE file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0,
+                0, NULL);
+        if (file_mapping == NULL) {
+                CloseHandle(file);
+                return 0;
+        }
+
+        void *data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == NULL) {
+                CloseHandle(file_mapping);
+                CloseHandle(file);
+                return 0;
+        }
+
+        struct file_map *map = malloc(sizeof (struct file_map));
+        map->file = file;
+        map->file_mapping = file_mapping;
+
+        map_info->data = data;
+        map_info->size = size.QuadPart;
+        map_info->map = map;
+
+        return 1;
+}
+
+void unmap_file(struct file_map_info *map_info)
+{
+        struct file_map *map = map_info->map;
+        if (map == NULL)
+                return;
+
+        UnmapViewOfFile(map_info->data);
+        CloseHandle(map->file_mapping);
+        CloseHandle(map->file);
+
+        free(map);
+        memset(map_info, 0, sizeof (struct file_map_info));
+}
+#else
+int map_file(const char *path, struct file_map_info *map_info)
+{
+        memset(map_info, 0, sizeof (struct file_map_info));
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return 0;
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+                close(fd);
+                return 0;
+        }
+
+        // The mapping keeps its own reference to the file
+        void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd,
+                0);
+        close(fd);
+        if (data == MAP_FAILED)
+                return 0;
+
+        // Start reading the whole file ahead of its first use
+        madvise(data, file_stat.st_size, MADV_WILLNEED);
+
+        map_info->data = data;
+        map_info->size = file_stat.st_size;
+        // Only marks the file as mapped, munmap needs nothing else
+        map_info->map = data;
+
+        return 1;
+}
+
+void unmap_file(struct file_map_info *map_info)
+{
+        if (map_info->map == NULL)
+                return;
+
+        munmap((void *) map_info->data, map_info->size);
+
+        memset(map_info, 0, sizeof (struct file_map_info));
+}
+#endif
@@ -0,0 +1,18 @@
+#ifndef FILE_MAP_INTERFACE_H
+#define FILE_MAP_INTERFACE_H
+
+// Read only view of a whole file, so its contents can be used in place
+// rather than read into memory. Uses MapViewOfFile on Windows and mmap
+// elsewhere.
+
+struct file_map_info {
+        const void *data;
+        unsigned long long size;
+        void *map;
+};
+
+// Returns 0 when the file is missing or empty
+int map_file(const char *path, struct file_map_info *map_info);
+void unmap_file(struct file_map_info *map_info);
+
+#endif
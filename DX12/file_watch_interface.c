@@ -0,0 +1,325 @@
+#include "file_watch_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#endif
+
+
+#if defined(_WIN32)
+struct file_watch {
+        HANDLE directory;
+        OVERLAPPED overlapped;
+        DWORD notify_buffer[4096];
+};
+#else
+// inotify does not recurse, so every directory below the root gets its own
+// watch, with its path relative to the root
+#define MAX_WATCH_DIRECTORIES 64
+
+struct watch_directory {
+        int watch_fd;
+        char path[MAX_WATCH_PATH];
+};
+
+struct file_watch {
+        int notify_fd;
+        unsigned int directory_count;
+        struct watch_directory directories[MAX_WATCH_DIRECTORIES];
+};
+#endif
+
+static unsigned int add_changed_path(struct file_watch_info *watch_info,
+        char (*changed_paths)[MAX_WATCH_PATH], unsigned int change_count,
+        unsigned int max_changes, const char *name)
+{
+        char path[MAX_WATCH_PATH];
+        int length = snprintf(path, MAX_WATCH_PATH, "%s/%s",
+                watch_info->directory, name);
+
+        // A truncated path names some other file, so drop it
+        if (length < 0 || length >= MAX_WATCH_PATH)
+                return change_count;
+
+        // Editors tend to touch a file several times per save
+        for (unsigned int i = 0; i < change_count; ++i) {
+                if (strcmp(changed_paths[i], path) == 0)
+                        return change_count;
+        }
+
+        if (change_count == max_changes)
+                return change_count;
+
+        strcpy(changed_paths[change_count], path);
+
+        return change_count + 1;
+}
+
+#if defined(_WIN32)
+static void read_directory_changes(struct file_watch *watch)
+{
+        BOOL result = ReadDirectoryChangesW(watch->directory,
+                watch->notify_buffer, sizeof (watch->notify_buffer), TRUE,
+                FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME,
+                NULL, &watch->overlapped, NULL);
+        assert(result);
+}
+
+void create_file_watch(struct file_watch_info *watch_info)
+{
+        struct file_watch *watch = malloc(sizeof (struct file_watch));
+
+        watch->directory = CreateFileA(watch_info->directory,
+                FILE_LIST_DIRECTORY,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                OPEN_EXISTING,
+                FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        assert(watch->directory != INVALID_HANDLE_VALUE);
+
+        memset(&watch->overlapped, 0, sizeof (OVERLAPPED));
+        watch->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        assert(watch->overlapped.hEvent);
+
+        read_directory_changes(watch);
+
+        watch_info->watch = watch;
+}
+
+void release_file_watch(struct file_watch_info *watch_info)
+{
+        struct file_watch *watch = watch_info->watch;
+
+        CancelIo(watch->directory);
+        CloseHandle(watch->overlapped.hEvent);
+        CloseHandle(watch->directory);
+
+        free(watch);
+}
+
+unsigned int poll_file_watch(struct file_watch_info *watch_info,
+        char (*changed_paths)[MAX_WATCH_PATH], unsigned int max_changes)
+{
+        struct file_watch *watch = watch_info->watch;
+
+        DWORD bytes_read;
+        if (!GetOverlappedResult(watch->directory, &watch->overlapped,
+                &bytes_read, FALSE))
+                return 0;
+
+        unsigned int change_count = 0;
+
+        // Zero bytes means the notification buffer overflowed
+        BYTE *entry = (BYTE *) watch->notify_buffer;
+        while (bytes_read > 0) {
+                FILE_NOTIFY_INFORMATION *notify_info =
+                        (FILE_NOTIFY_INFORMATION *) entry;
+
+                if (notify_info->Action != FILE_ACTION_REMOVED &&
+                        notify_info->Action != FILE_ACTION_RENAMED_OLD_NAME) {
+                        char name[MAX_WATCH_PATH];
+                        int length = WideCharToMultiByte(CP_ACP, 0,
+                                notify_info->FileName,
+                                notify_info->FileNameLength / sizeof (WCHAR),
+                                name, MAX_WATCH_PATH - 1, NULL, NULL);
+                        name[length] = '\0';
+
+                        change_count = add_changed_path(watch_info,
+                                changed_paths, change_count, max_changes,
+                                name);
+                }
+
+                if (notify_info->NextEntryOffset == 0)
+                        break;
+
+                entry += notify_info->NextEntryOffset;
+        }
+
+        ResetEvent(watch->overlapped.hEvent);
+        read_directory_changes(watch);
+
+        return change_count;
+}
+#else
+static int join_watch_path(char *path, const char *directory,
+        const char *name)
+{
+        int length = directory[0] != '\0' ?
+                snprintf(path, MAX_WATCH_PATH, "%s/%s", directory, name) :
+                snprintf(path, MAX_WATCH_PATH, "%s", name);
+
+        return length >= 0 && length < MAX_WATCH_PATH;
+}
+
+static void add_watch_directory(struct file_watch_info *watch_info,
+        struct file_watch *watch, const char *directory)
+{
+        if (watch->directory_count == MAX_WATCH_DIRECTORIES)
+                return;
+
+        char path[MAX_WATCH_PATH];
+        if (!join_watch_path(path, watch_info->directory, directory))
+                return;
+
+        // Saves show up either as a finished write or a rename into place,
+        // and new directories have to be watched as they are created
+        int watch_fd = inotify_add_watch(watch->notify_fd, path,
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if (watch_fd < 0)
+                return;
+
+        // Watching a directory twice hands back the same descriptor
+        for (unsigned int i = 0; i < watch->directory_count; ++i) {
+                if (watch->directories[i].watch_fd == watch_fd)
+                        return;
+        }
+
+        struct watch_directory *watch_directory =
+                &watch->directories[watch->directory_count++];
+        watch_directory->watch_fd = watch_fd;
+        strcpy(watch_directory->path, directory);
+
+        DIR *dir = opendir(path);
+        if (dir == NULL)
+                return;
+
+        struct dirent *dir_entry;
+        while ((dir_entry = readdir(dir)) != NULL) {
+                if (strcmp(dir_entry->d_name, ".") == 0 ||
+                        strcmp(dir_entry->d_name, "..") == 0)
+                        continue;
+
+                char sub_directory[MAX_WATCH_PATH];
+                if (!join_watch_path(sub_directory, directory,
+                        dir_entry->d_name))
+                        continue;
+
+                int is_directory = dir_entry->d_type == DT_DIR;
+                if (dir_entry->d_type == DT_UNKNOWN) {
+                        char sub_path[MAX_WATCH_PATH];
+                        struct stat sub_stat;
+                        is_directory = join_watch_path(sub_path,
+                                watch_info->directory, sub_directory) &&
+                                stat(sub_path, &sub_stat) == 0 &&
+                                S_ISDIR(sub_stat.st_mode);
+                }
+
+                if (is_directory)
+                        add_watch_directory(watch_info, watch, sub_directory);
+        }
+
+        closedir(dir);
+}
+
+static void remove_watch_directory(struct file_watch *watch,
+        unsigned int index)
+{
+        watch->directories[index] =
+                watch->directories[--watch->directory_count];
+}
+
+static struct watch_directory *find_watch_directory(struct file_watch *watch,
+        int watch_fd, unsigned int *index)
+{
+        for (unsigned int i = 0; i < watch->directory_count; ++i) {
+                if (watch->directories[i].watch_fd == watch_fd) {
+                        *index = i;
+                        return &watch->directories[i];
+                }
+        }
+
+        return NULL;
+}
+
+void create_file_watch(struct file_watch_info *watch_info)
+{
+        struct file_watch *watch = malloc(sizeof (struct file_watch));
+
+        watch->notify_fd = inotify_init1(IN_NONBLOCK);
+        assert(watch->notify_fd >= 0);
+
+        watch->directory_count = 0;
+        add_watch_directory(watch_info, watch, "");
+        assert(watch->directory_count > 0);
+
+        watch_info->watch = watch;
+}
+
+void release_file_watch(struct file_watch_info *watch_info)
+{
+        struct file_watch *watch = watch_info->watch;
+
+        for (unsigned int i = 0; i < watch->directory_count; ++i)
+                inotify_rm_watch(watch->notify_fd,
+                        watch->directories[i].watch_fd);
+        close(watch->notify_fd);
+
+        free(watch);
+}
+
+unsigned int poll_file_watch(struct file_watch_info *watch_info,
+        char (*changed_paths)[MAX_WATCH_PATH], unsigned int max_changes)
+{
+        struct file_watch *watch = watch_info->watch;
+
+        unsigned int change_count = 0;
+
+        char notify_buffer[4096]
+                __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        for (;;) {
+                ssize_t bytes_read = read(watch->notify_fd, notify_buffer,
+                        sizeof (notify_buffer));
+                if (bytes_read <= 0)
+                        break;
+
+                char *entry = notify_buffer;
+                while (entry < notify_buffer + bytes_read) {
+                        struct inotify_event *event =
+                                (struct inotify_event *) entry;
+                        entry += sizeof (struct inotify_event) + event->len;
+
+                        unsigned int index;
+                        struct watch_directory *watch_directory =
+                                find_watch_directory(watch, event->wd,
+                                &index);
+                        if (watch_directory == NULL)
+                                continue;
+
+                        // The kernel drops the watch of a removed directory
+                        if (event->mask & IN_IGNORED) {
+                                remove_watch_directory(watch, index);
+                                continue;
+                        }
+
+                        char name[MAX_WATCH_PATH];
+                        if (event->len == 0 || !join_watch_path(name,
+                                watch_directory->path, event->name))
+                                continue;
+
+                        if (event->mask & IN_ISDIR) {
+                                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                                        add_watch_directory(watch_info,
+                                                watch, name);
+                                continue;
+                        }
+
+                        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                                change_count = add_changed_path(watch_info,
+                                        changed_paths, change_count,
+                                        max_changes, name);
+                        }
+                }
+        }
+
+        return change_count;
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef FILE_WATCH_INTERFACE_H
+#define FILE_WATCH_INTERFACE_H
+
+// Non-blocking directory watch. Uses ReadDirectoryChangesW on Windows and
+// inotify elsewhere.
+
+#define MAX_WATCH_PATH 260
+
+struct file_watch_info {
+        char directory[MAX_WATCH_PATH];
+        void *watch;
+};
+
+void create_file_watch(struct file_watch_info *watch_info);
+void release_file_watch(struct file_watch_info *watch_info);
+unsigned int poll_file_watch(struct file_watch_info *watch_info,
+        char (*changed_paths)[MAX_WATCH_PATH], unsigned int max_changes);
+
+#endif
@@ -0,0 +1,1305 @@
+#include "gltf_interface.h"
+#include "timer_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define GLB_MAGIC 0x46546c67 // "glTF"
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
+#define GLB_HEADER_SIZE 12
+#define GLB_CHUNK_HEADER_SIZE 8
+
+#define GLTF_BYTE 5120
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_SHORT 5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+#define GLTF_TRIANGLES 4
+
+enum JSON_TYPE {
+        JSON_TYPE_OBJECT,
+        JSON_TYPE_ARRAY,
+        JSON_TYPE_STRING,
+        JSON_TYPE_PRIMITIVE
+};
+
+// Tokens are stored in document order. size is the number of elements of an
+// array or of key/value pairs of an object, and next is the token after the
+// last one inside this one. first_element is where the elements of an array
+// start in the parser's element list.
+struct json_token {
+        enum JSON_TYPE type;
+        unsigned int start;
+        unsigned int end;
+        unsigned int size;
+        unsigned int next;
+        unsigned int first_element;
+};
+
+struct json_parser {
+        const char *text;
+        unsigned int length;
+        unsigned int pos;
+        unsigned int token_count;
+        unsigned int token_capacity;
+        struct json_token *tokens;
+        // The token of every array element, so elements are found directly
+        unsigned int *elements;
+};
+
+struct gltf_buffer {
+        const unsigned char *data;
+        unsigned long long size;
+};
+
+struct gltf_buffer_view {
+        const unsigned char *data;
+        unsigned long long size;
+        unsigned int stride;
+};
+
+struct gltf_accessor {
+        const unsigned char *data;
+        unsigned int component_type;
+        unsigned int component_count;
+        int is_normalized;
+        unsigned int count;
+        // Bytes from one element to the next
+        unsigned int stride;
+};
+
+struct gltf_convert_job {
+        struct gltf_accessor *positions;
+        struct gltf_accessor *colours;
+        struct gltf_accessor *uvs;
+        struct vertex *vertices;
+        unsigned int vertex_count;
+        unsigned int chunk_count;
+};
+
+struct gltf_loader {
+        struct gltf_info *gltf_info;
+        struct json_parser parser;
+        const unsigned char *bin_data;
+        unsigned long long bin_size;
+        unsigned int buffer_count;
+        struct gltf_buffer *buffers;
+        unsigned int view_count;
+        struct gltf_buffer_view *views;
+};
+
+static void skip_whitespace(struct json_parser *parser)
+{
+        while (parser->pos < parser->length &&
+                (parser->text[parser->pos] == ' ' ||
+                parser->text[parser->pos] == '\t' ||
+                parser->text[parser->pos] == '\n' ||
+                parser->text[parser->pos] == '\r'))
+                ++parser->pos;
+}
+
+static unsigned int add_token(struct json_parser *parser,
+        enum JSON_TYPE type, unsigned int start)
+{
+        if (parser->token_count == parser->token_capacity) {
+                parser->token_capacity = parser->token_capacity * 2 + 256;
+                parser->tokens = realloc(parser->tokens,
+                        parser->token_capacity * sizeof (struct json_token));
+        }
+
+        struct json_token *token = &parser->tokens[parser->token_count];
+        token->type = type;
+        token->start = start;
+        token->end = start;
+        token->size = 0;
+        token->next = 0;
+        token->first_element = 0;
+
+        return parser->token_count++;
+}
+
+static int parse_json_string(struct json_parser *parser)
+{
+        unsigned int index = add_token(parser, JSON_TYPE_STRING,
+                ++parser->pos);
+
+        while (parser->pos < parser->length &&
+                parser->text[parser->pos] != '"') {
+                parser->pos += parser->text[parser->pos] == '\\' ? 2 : 1;
+        }
+
+        if (parser->pos >= parser->length)
+                return 0;
+
+        parser->tokens[index].end = parser->pos++;
+        parser->tokens[index].next = parser->token_count;
+
+        return 1;
+}
+
+static int parse_json_value(struct json_parser *parser, unsigned int depth)
+{
+        skip_whitespace(parser);
+        if (parser->pos >= parser->length || depth > MAX_GLTF_JSON_DEPTH)
+                return 0;
+
+        char c = parser->text[parser->pos];
+        if (c == '"')
+                return parse_json_string(parser);
+
+        if (c != '{' && c != '[') {
+                unsigned int index = add_token(parser, JSON_TYPE_PRIMITIVE,
+                        parser->pos);
+                while (parser->pos < parser->length &&
+                        strchr(",]} \t\r\n", parser->text[parser->pos]) ==
+                        NULL)
+                        ++parser->pos;
+
+                parser->tokens[index].end = parser->pos;
+                parser->tokens[index].next = parser->token_count;
+
+                return parser->pos > parser->tokens[index].start;
+        }
+
+        int is_object = c == '{';
+        char close = is_object ? '}' : ']';
+        unsigned int index = add_token(parser, is_object ? JSON_TYPE_OBJECT :
+                JSON_TYPE_ARRAY, parser->pos++);
+        unsigned int size = 0;
+
+        skip_whitespace(parser);
+        if (parser->pos < parser->length && parser->text[parser->pos] ==
+                close) {
+                ++parser->pos;
+        } else {
+                for (;;) {
+                        if (is_object) {
+                                skip_whitespace(parser);
+                                if (parser->pos >= parser->length ||
+                                        parser->text[parser->pos] != '"' ||
+                                        !parse_json_string(parser))
+                                        return 0;
+
+                                skip_whitespace(parser);
+                                if (parser->pos >= parser->length ||
+                                        parser->text[parser->pos] != ':')
+                                        return 0;
+                                ++parser->pos;
+                        }
+
+                        if (!parse_json_value(parser, depth + 1))
+                                return 0;
+                        ++size;
+
+                        skip_whitespace(parser);
+                        if (parser->pos >= parser->length)
+                                return 0;
+
+                        c = parser->text[parser->pos++];
+                        if (c == close)
+                                break;
+                        if (c != ',')
+                                return 0;
+                }
+        }
+
+        // Tokens may have moved while the children were added
+        parser->tokens[index].size = size;
+        parser->tokens[index].end = parser->pos;
+        parser->tokens[index].next = parser->token_count;
+
+        return 1;
+}
+
+// Lists the elements of every array once, as nodes, accessors and children
+// are looked up by index all through the load
+static void index_json_arrays(struct json_parser *parser)
+{
+        parser->elements = malloc((parser->token_count + 1) *
+                sizeof (unsigned int));
+
+        unsigned int element_count = 0;
+        for (unsigned int t = 0; t < parser->token_count; ++t) {
+                struct json_token *array = &parser->tokens[t];
+                if (array->type != JSON_TYPE_ARRAY)
+                        continue;
+
+                array->first_element = element_count;
+                unsigned int token = t + 1;
+                for (unsigned int i = 0; i < array->size; ++i) {
+                        parser->elements[element_count++] = token;
+                        token = parser->tokens[token].next;
+                }
+        }
+}
+
+static int is_json_string(struct json_parser *parser, unsigned int token,
+        const char *string)
+{
+        struct json_token *t = &parser->tokens[token];
+        size_t length = strlen(string);
+
+        return t->type == JSON_TYPE_STRING && t->end - t->start == length &&
+                memcmp(parser->text + t->start, string, length) == 0;
+}
+
+// Returns the value of key in an object, GLTF_NONE when it has none
+static unsigned int find_json_key(struct json_parser *parser,
+        unsigned int object, const char *key)
+{
+        if (object == GLTF_NONE ||
+                parser->tokens[object].type != JSON_TYPE_OBJECT)
+                return GLTF_NONE;
+
+        unsigned int token = object + 1;
+        for (unsigned int i = 0; i < parser->tokens[object].size; ++i) {
+                if (is_json_string(parser, token, key))
+                        return token + 1;
+
+                token = parser->tokens[token + 1].next;
+        }
+
+        return GLTF_NONE;
+}
+
+static unsigned int get_json_element(struct json_parser *parser,
+        unsigned int array, unsigned int element)
+{
+        if (array == GLTF_NONE ||
+                parser->tokens[array].type != JSON_TYPE_ARRAY ||
+                element >= parser->tokens[array].size)
+                return GLTF_NONE;
+
+        return parser->elements[parser->tokens[array].first_element +
+                element];
+}
+
+static unsigned int get_json_size(struct json_parser *parser,
+        unsigned int token)
+{
+        return token == GLTF_NONE ? 0 : parser->tokens[token].size;
+}
+
+static double get_json_number(struct json_parser *parser, unsigned int token,
+        double default_value)
+{
+        if (token == GLTF_NONE ||
+                parser->tokens[token].type != JSON_TYPE_PRIMITIVE)
+                return default_value;
+
+        // The text is not terminated, so the number is copied out first
+        char number[64];
+        struct json_token *t = &parser->tokens[token];
+        unsigned int length = t->end - t->start;
+        if (length >= sizeof (number))
+                return default_value;
+
+        memcpy(number, parser->text + t->start, length);
+        number[length] = '\0';
+
+        if (strcmp(number, "true") == 0)
+                return 1.0;
+        if (strcmp(number, "false") == 0 || strcmp(number, "null") == 0)
+                return default_value;
+
+        return strtod(number, NULL);
+}
+
+static double get_json_key_number(struct json_parser *parser,
+        unsigned int object, const char *key, double default_value)
+{
+        return get_json_number(parser, find_json_key(parser, object, key),
+                default_value);
+}
+
+// Indices that are missing or not a whole number come back as GLTF_NONE
+static unsigned int get_json_key_index(struct json_parser *parser,
+        unsigned int object, const char *key)
+{
+        double value = get_json_key_number(parser, object, key, -1.0);
+
+        return value >= 0.0 && value < GLTF_NONE && value == floor(value) ?
+                (unsigned int) value : GLTF_NONE;
+}
+
+static void copy_json_string(struct json_parser *parser, unsigned int token,
+        char *string, unsigned int max_length)
+{
+        string[0] = '\0';
+        if (token == GLTF_NONE ||
+                parser->tokens[token].type != JSON_TYPE_STRING)
+                return;
+
+        struct json_token *t = &parser->tokens[token];
+        unsigned int length = t->end - t->start;
+        length = length < max_length - 1 ? length : max_length - 1;
+        memcpy(string, parser->text + t->start, length);
+        string[length] = '\0';
+}
+
+static unsigned int read_u32(const unsigned char *data)
+{
+        return data[0] | data[1] << 8 | data[2] << 16 |
+                (unsigned int) data[3] << 24;
+}
+
+// Finds the JSON and binary chunks of a .glb, or takes the whole file as
+// JSON for a .gltf
+static int find_chunks(struct gltf_loader *loader)
+{
+        struct file_map_info *file_map = &loader->gltf_info->file_map;
+        const unsigned char *data = file_map->data;
+
+        if (file_map->size < GLB_HEADER_SIZE || read_u32(data) != GLB_MAGIC) {
+                loader->parser.text = (const char *) data;
+                loader->parser.length = (unsigned int) file_map->size;
+                return file_map->size < 0xffffffff;
+        }
+
+        unsigned long long length = read_u32(data + 8);
+        if (read_u32(data + 4) != 2 || length > file_map->size ||
+                length < GLB_HEADER_SIZE + GLB_CHUNK_HEADER_SIZE)
+                return 0;
+
+        unsigned long long offset = GLB_HEADER_SIZE;
+        while (offset + GLB_CHUNK_HEADER_SIZE <= length) {
+                unsigned long long chunk_length = read_u32(data + offset);
+                unsigned int chunk_type = read_u32(data + offset + 4);
+                offset += GLB_CHUNK_HEADER_SIZE;
+                if (chunk_length > length - offset)
+                        return 0;
+
+                if (chunk_type == GLB_CHUNK_JSON && loader->parser.text ==
+                        NULL) {
+                        loader->parser.text = (const char *) data + offset;
+                        loader->parser.length = (unsigned int) chunk_length;
+                } else if (chunk_type == GLB_CHUNK_BIN &&
+                        loader->bin_data == NULL) {
+                        loader->bin_data = data + offset;
+                        loader->bin_size = chunk_length;
+                }
+
+                // Chunks are padded to four bytes
+                offset += (chunk_length + 3) & ~3ull;
+        }
+
+        return loader->parser.text != NULL;
+}
+
+static int load_buffers(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_info *gltf_info = loader->gltf_info;
+        unsigned int buffers = find_json_key(parser, 0, "buffers");
+
+        loader->buffer_count = get_json_size(parser, buffers);
+        loader->buffers = calloc(loader->buffer_count + 1,
+                sizeof (struct gltf_buffer));
+        gltf_info->buffer_maps = calloc(loader->buffer_count + 1,
+                sizeof (struct file_map_info));
+        gltf_info->buffer_count = loader->buffer_count;
+
+        // External buffers are found next to the file
+        char directory[MAX_GLTF_PATH];
+        strcpy(directory, gltf_info->path);
+        char *slash = strrchr(directory, '/');
+        char *back_slash = strrchr(directory, '\\');
+        slash = back_slash > slash ? back_slash : slash;
+        if (slash != NULL)
+                slash[1] = '\0';
+        else
+                directory[0] = '\0';
+
+        for (unsigned int b = 0; b < loader->buffer_count; ++b) {
+                unsigned int buffer = get_json_element(parser, buffers, b);
+                double size = get_json_key_number(parser, buffer,
+                        "byteLength", -1.0);
+                if (size < 0.0)
+                        return 0;
+
+                unsigned int uri = find_json_key(parser, buffer, "uri");
+                if (uri == GLTF_NONE) {
+                        // Only the first buffer of a .glb can be its binary
+                        // chunk
+                        if (b != 0 || loader->bin_data == NULL)
+                                return 0;
+
+                        loader->buffers[b].data = loader->bin_data;
+                        loader->buffers[b].size = loader->bin_size;
+                } else {
+                        char name[MAX_GLTF_PATH];
+                        char path[MAX_GLTF_PATH * 2];
+                        copy_json_string(parser, uri, name, MAX_GLTF_PATH);
+                        if (strncmp(name, "data:", 5) == 0)
+                                return 0;
+
+                        snprintf(path, sizeof (path), "%s%s", directory,
+                                name);
+                        struct file_map_info *buffer_map =
+                                &gltf_info->buffer_maps[b];
+                        if (!map_file(path, buffer_map))
+                                return 0;
+
+                        loader->buffers[b].data = buffer_map->data;
+                        loader->buffers[b].size = buffer_map->size;
+                }
+
+                if (size > loader->buffers[b].size)
+                        return 0;
+                loader->buffers[b].size = (unsigned long long) size;
+        }
+
+        return 1;
+}
+
+static int load_buffer_views(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        unsigned int views = find_json_key(parser, 0, "bufferViews");
+
+        loader->view_count = get_json_size(parser, views);
+        loader->views = calloc(loader->view_count + 1,
+                sizeof (struct gltf_buffer_view));
+
+        for (unsigned int v = 0; v < loader->view_count; ++v) {
+                unsigned int view = get_json_element(parser, views, v);
+                unsigned int buffer = get_json_key_index(parser, view,
+                        "buffer");
+                double offset = get_json_key_number(parser, view,
+                        "byteOffset", 0.0);
+                double size = get_json_key_number(parser, view,
+                        "byteLength", -1.0);
+                if (buffer >= loader->buffer_count || offset < 0.0 ||
+                        size < 0.0 || offset + size >
+                        loader->buffers[buffer].size)
+                        return 0;
+
+                loader->views[v].data = loader->buffers[buffer].data +
+                        (unsigned long long) offset;
+                loader->views[v].size = (unsigned long long) size;
+                loader->views[v].stride = (unsigned int) get_json_key_number(
+                        parser, view, "byteStride", 0.0);
+        }
+
+        return 1;
+}
+
+static unsigned int get_component_size(unsigned int component_type)
+{
+        switch (component_type)
+        {
+                case GLTF_BYTE :
+                case GLTF_UNSIGNED_BYTE :
+                        return 1;
+
+                case GLTF_SHORT :
+                case GLTF_UNSIGNED_SHORT :
+                        return 2;
+
+                case GLTF_UNSIGNED_INT :
+                case GLTF_FLOAT :
+                        return 4;
+
+                default :
+                        return 0;
+        }
+}
+
+static unsigned int get_component_count(struct json_parser *parser,
+        unsigned int type)
+{
+        static const char *types[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+
+        for (unsigned int t = 0; t < 4; ++t) {
+                if (is_json_string(parser, type, types[t]))
+                        return t + 1;
+        }
+
+        return is_json_string(parser, type, "MAT4") ? 16 : 0;
+}
+
+static int get_accessor(struct gltf_loader *loader, unsigned int index,
+        struct gltf_accessor *accessor)
+{
+        struct json_parser *parser = &loader->parser;
+        unsigned int object = get_json_element(parser, find_json_key(parser,
+                0, "accessors"), index);
+        if (object == GLTF_NONE ||
+                find_json_key(parser, object, "sparse") != GLTF_NONE)
+                return 0;
+
+        unsigned int view = get_json_key_index(parser, object, "bufferView");
+        double offset = get_json_key_number(parser, object, "byteOffset",
+                0.0);
+        double count = get_json_key_number(parser, object, "count", -1.0);
+        accessor->component_type = (unsigned int) get_json_key_number(parser,
+                object, "componentType", 0.0);
+        accessor->component_count = get_component_count(parser,
+                find_json_key(parser, object, "type"));
+        accessor->is_normalized = get_json_key_number(parser, object,
+                "normalized", 0.0) != 0.0;
+
+        unsigned int element_size = get_component_size(
+                accessor->component_type) * accessor->component_count;
+        if (view >= loader->view_count || element_size == 0 || offset < 0.0 ||
+                count < 0.0 || count >= GLTF_NONE)
+                return 0;
+
+        struct gltf_buffer_view *buffer_view = &loader->views[view];
+        accessor->count = (unsigned int) count;
+        accessor->stride = buffer_view->stride != 0 ? buffer_view->stride :
+                element_size;
+        accessor->data = buffer_view->data + (unsigned long long) offset;
+
+        // The last element has to end inside the view
+        unsigned long long end = (unsigned long long) offset + element_size +
+                (accessor->count > 0 ? (unsigned long long) accessor->stride *
+                (accessor->count - 1) : 0);
+
+        return accessor->count == 0 || end <= buffer_view->size;
+}
+
+static float read_component(const unsigned char *data,
+        unsigned int component_type, int is_normalized)
+{
+        float value;
+
+        switch (component_type)
+        {
+                case GLTF_FLOAT :
+                        memcpy(&value, data, sizeof (float));
+                        return value;
+
+                case GLTF_UNSIGNED_BYTE :
+                        return is_normalized ? data[0] / 255.0f : data[0];
+
+                case GLTF_BYTE : {
+                        float byte = (float) (signed char) data[0];
+                        return is_normalized ? (byte / 127.0f < -1.0f ?
+                                -1.0f : byte / 127.0f) : byte;
+                }
+
+                case GLTF_UNSIGNED_SHORT : {
+                        unsigned short u16;
+                        memcpy(&u16, data, sizeof (u16));
+                        return is_normalized ? u16 / 65535.0f : u16;
+                }
+
+                case GLTF_SHORT : {
+                        short s16;
+                        memcpy(&s16, data, sizeof (s16));
+                        return is_normalized ? (s16 / 32767.0f < -1.0f ?
+                                -1.0f : s16 / 32767.0f) : s16;
+                }
+
+                case GLTF_UNSIGNED_INT : {
+                        unsigned int u32;
+                        memcpy(&u32, data, sizeof (u32));
+                        return (float) u32;
+                }
+
+                default :
+                        return 0.0f;
+        }
+}
+
+// Reads up to max_count components of an element into values, leaving the
+// ones past the accessor's component count as they are
+static void read_element(struct gltf_accessor *accessor, unsigned int i,
+        float *values, unsigned int max_count)
+{
+        const unsigned char *element = accessor->data +
+                (unsigned long long) accessor->stride * i;
+        unsigned int component_size = get_component_size(
+                accessor->component_type);
+        unsigned int count = accessor->component_count < max_count ?
+                accessor->component_count : max_count;
+
+        for (unsigned int c = 0; c < count; ++c) {
+                values[c] = read_component(element + c * component_size,
+                        accessor->component_type, accessor->is_normalized);
+        }
+}
+
+static int is_float_accessor(struct gltf_accessor *accessor,
+        unsigned int component_count)
+{
+        return accessor != NULL && accessor->component_type == GLTF_FLOAT &&
+                accessor->component_count == component_count;
+}
+
+static void convert_positions(struct gltf_accessor *accessor,
+        struct vertex *vertices, unsigned int first, unsigned int last)
+{
+        if (is_float_accessor(accessor, 3)) {
+                for (unsigned int i = first; i < last; ++i) {
+                        memcpy(vertices[i].position, accessor->data +
+                                (unsigned long long) accessor->stride * i,
+                                sizeof (float) * 3);
+                        vertices[i].position[3] = 1.0f;
+                }
+
+                return;
+        }
+
+        for (unsigned int i = first; i < last; ++i) {
+                float *position = vertices[i].position;
+                position[0] = 0.0f;
+                position[1] = 0.0f;
+                position[2] = 0.0f;
+                read_element(accessor, i, position, 3);
+                position[3] = 1.0f;
+        }
+}
+
+static void convert_colours(struct gltf_accessor *accessor,
+        struct vertex *vertices, unsigned int first, unsigned int last)
+{
+        if (accessor != NULL && accessor->component_type ==
+                GLTF_UNSIGNED_BYTE && accessor->component_count == 4) {
+                for (unsigned int i = first; i < last; ++i) {
+                        const unsigned char *rgba = accessor->data +
+                                (unsigned long long) accessor->stride * i;
+                        for (int k = 0; k < 4; ++k)
+                                vertices[i].colour[k] = rgba[k] / 255.0f;
+                }
+
+                return;
+        }
+
+        // Colours default to white and opaque
+        for (unsigned int i = first; i < last; ++i) {
+                float *colour = vertices[i].colour;
+                colour[0] = 1.0f;
+                colour[1] = 1.0f;
+                colour[2] = 1.0f;
+                colour[3] = 1.0f;
+                if (accessor != NULL)
+                        read_element(accessor, i, colour, 4);
+        }
+}
+
+static void convert_uvs(struct gltf_accessor *accessor,
+        struct vertex *vertices, unsigned int first, unsigned int last)
+{
+        if (is_float_accessor(accessor, 2)) {
+                for (unsigned int i = first; i < last; ++i) {
+                        memcpy(vertices[i].uv, accessor->data +
+                                (unsigned long long) accessor->stride * i,
+                                sizeof (float) * 2);
+                }
+
+                return;
+        }
+
+        for (unsigned int i = first; i < last; ++i) {
+                vertices[i].uv[0] = 0.0f;
+                vertices[i].uv[1] = 0.0f;
+                if (accessor != NULL)
+                        read_element(accessor, i, vertices[i].uv, 2);
+        }
+}
+
+static void convert_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct gltf_convert_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = (unsigned int) ((unsigned long long)
+                        job->vertex_count * c / job->chunk_count);
+                unsigned int last = (unsigned int) ((unsigned long long)
+                        job->vertex_count * (c + 1) / job->chunk_count);
+
+                // A chunk at a time, so its vertices stay in the cache
+                // between the attributes
+                convert_positions(job->positions, job->vertices, first, last);
+                convert_colours(job->colours, job->vertices, first, last);
+                convert_uvs(job->uvs, job->vertices, first, last);
+        }
+}
+
+static void convert_vertices(struct gltf_loader *loader,
+        struct gltf_convert_job *job)
+{
+        struct job_system_info *job_system = loader->gltf_info->job_system;
+
+        job->chunk_count = 1;
+        if (job_system != NULL && job->vertex_count >=
+                GLTF_PARALLEL_MIN_COUNT) {
+                job->chunk_count = job_system->worker_count * 4;
+                if (job->chunk_count < 1)
+                        job->chunk_count = 1;
+                if (job->chunk_count > MAX_GLTF_CHUNKS)
+                        job->chunk_count = MAX_GLTF_CHUNKS;
+        }
+
+        parallel_for(job->chunk_count > 1 ? job_system : NULL,
+                job->chunk_count, 1, convert_chunks, job);
+}
+
+// 32 bit indices are used in place, narrower ones widened. Either way they
+// must stay within the vertices.
+static int load_indices(struct gltf_loader *loader, unsigned int index,
+        struct gltf_primitive *primitive)
+{
+        struct gltf_stats *stats = &loader->gltf_info->stats;
+        struct mesh_info *mi = &primitive->mesh;
+
+        if (index == GLTF_NONE) {
+                mi->index_count = mi->vertex_count;
+                mi->indices = malloc((mi->index_count + 1) *
+                        sizeof (unsigned int));
+                for (unsigned int i = 0; i < mi->index_count; ++i)
+                        mi->indices[i] = i;
+
+                primitive->owns_indices = 1;
+                return 1;
+        }
+
+        struct gltf_accessor accessor;
+        if (!get_accessor(loader, index, &accessor) ||
+                accessor.component_count != 1 ||
+                accessor.component_type == GLTF_FLOAT ||
+                accessor.component_type == GLTF_BYTE ||
+                accessor.component_type == GLTF_SHORT)
+                return 0;
+
+        mi->index_count = accessor.count;
+        if (accessor.component_type == GLTF_UNSIGNED_INT &&
+                accessor.stride == sizeof (unsigned int) &&
+                (size_t) accessor.data % sizeof (unsigned int) == 0) {
+                mi->indices = (unsigned int *) accessor.data;
+                primitive->owns_indices = 0;
+                ++stats->in_place_accessor_count;
+        } else {
+                mi->indices = malloc((mi->index_count + 1) *
+                        sizeof (unsigned int));
+                primitive->owns_indices = 1;
+                for (unsigned int i = 0; i < mi->index_count; ++i) {
+                        mi->indices[i] = (unsigned int) read_component(
+                                accessor.data + (unsigned long long)
+                                accessor.stride * i, accessor.component_type,
+                                0);
+                }
+
+                ++stats->converted_accessor_count;
+                stats->converted_size += (unsigned long long)
+                        mi->index_count * sizeof (unsigned int);
+        }
+
+        unsigned int max_index = 0;
+        for (unsigned int i = 0; i < mi->index_count; ++i)
+                max_index = mi->indices[i] > max_index ? mi->indices[i] :
+                        max_index;
+
+        return mi->index_count % 3 == 0 && (mi->index_count == 0 ||
+                max_index < mi->vertex_count);
+}
+
+static int load_primitive(struct gltf_loader *loader, unsigned int object,
+        struct gltf_primitive *primitive)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_stats *stats = &loader->gltf_info->stats;
+        unsigned int attributes = find_json_key(parser, object,
+                "attributes");
+
+        struct gltf_accessor positions;
+        struct gltf_accessor colours;
+        struct gltf_accessor uvs;
+        unsigned int position = get_json_key_index(parser, attributes,
+                "POSITION");
+        unsigned int colour = get_json_key_index(parser, attributes,
+                "COLOR_0");
+        unsigned int uv = get_json_key_index(parser, attributes,
+                "TEXCOORD_0");
+        if (!get_accessor(loader, position, &positions) ||
+                (colour != GLTF_NONE && !get_accessor(loader, colour,
+                &colours)) ||
+                (uv != GLTF_NONE && !get_accessor(loader, uv, &uvs)))
+                return 0;
+
+        // Every attribute of a primitive has the same count
+        if ((colour != GLTF_NONE && colours.count < positions.count) ||
+                (uv != GLTF_NONE && uvs.count < positions.count))
+                return 0;
+
+        struct mesh_info *mi = &primitive->mesh;
+        memset(mi, 0, sizeof (struct mesh_info));
+        mi->vertex_count = positions.count;
+        mi->verticies = malloc((mi->vertex_count + 1) *
+                sizeof (struct vertex));
+
+        struct gltf_convert_job job;
+        job.positions = &positions;
+        job.colours = colour != GLTF_NONE ? &colours : NULL;
+        job.uvs = uv != GLTF_NONE ? &uvs : NULL;
+        job.vertices = mi->verticies;
+        job.vertex_count = mi->vertex_count;
+        convert_vertices(loader, &job);
+
+        stats->converted_accessor_count += 1 + (colour != GLTF_NONE) +
+                (uv != GLTF_NONE);
+        stats->converted_size += (unsigned long long) mi->vertex_count *
+                sizeof (struct vertex);
+
+        if (!load_indices(loader, get_json_key_index(parser, object,
+                "indices"), primitive))
+                return 0;
+
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+        mi->lods[0].error = 0.0f;
+
+        primitive->material = get_json_key_index(parser, object, "material");
+        stats->vertex_count += mi->vertex_count;
+        stats->index_count += mi->index_count;
+
+        return 1;
+}
+
+static int load_meshes(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_info *gltf_info = loader->gltf_info;
+        unsigned int meshes = find_json_key(parser, 0, "meshes");
+
+        unsigned int primitive_capacity = 0;
+        gltf_info->mesh_count = get_json_size(parser, meshes);
+        for (unsigned int m = 0; m < gltf_info->mesh_count; ++m) {
+                primitive_capacity += get_json_size(parser, find_json_key(
+                        parser, get_json_element(parser, meshes, m),
+                        "primitives"));
+        }
+
+        gltf_info->meshes = calloc(gltf_info->mesh_count + 1,
+                sizeof (struct gltf_mesh));
+        gltf_info->primitives = calloc(primitive_capacity + 1,
+                sizeof (struct gltf_primitive));
+
+        for (unsigned int m = 0; m < gltf_info->mesh_count; ++m) {
+                unsigned int primitives = find_json_key(parser,
+                        get_json_element(parser, meshes, m), "primitives");
+                struct gltf_mesh *mesh = &gltf_info->meshes[m];
+                mesh->first_primitive = gltf_info->primitive_count;
+
+                for (unsigned int p = 0; p < get_json_size(parser, primitives);
+                        ++p) {
+                        unsigned int object = get_json_element(parser,
+                                primitives, p);
+
+                        // Points, lines and strips are left out
+                        if (get_json_key_number(parser, object, "mode",
+                                GLTF_TRIANGLES) != GLTF_TRIANGLES) {
+                                ++gltf_info->stats.skipped_primitive_count;
+                                continue;
+                        }
+
+                        struct gltf_primitive *primitive =
+                                &gltf_info->primitives[
+                                gltf_info->primitive_count++];
+                        if (!load_primitive(loader, object, primitive))
+                                return 0;
+
+                        ++mesh->primitive_count;
+                }
+        }
+
+        return 1;
+}
+
+static unsigned int get_texture_image(struct gltf_loader *loader,
+        unsigned int texture_info)
+{
+        struct json_parser *parser = &loader->parser;
+        unsigned int texture = get_json_element(parser, find_json_key(parser,
+                0, "textures"), get_json_key_index(parser, texture_info,
+                "index"));
+        unsigned int image = get_json_key_index(parser, texture, "source");
+
+        return image < loader->gltf_info->image_count ? image : GLTF_NONE;
+}
+
+static void load_materials(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_info *gltf_info = loader->gltf_info;
+        unsigned int materials = find_json_key(parser, 0, "materials");
+
+        gltf_info->material_count = get_json_size(parser, materials);
+        gltf_info->materials = calloc(gltf_info->material_count + 1,
+                sizeof (struct gltf_material));
+
+        for (unsigned int m = 0; m < gltf_info->material_count; ++m) {
+                unsigned int object = get_json_element(parser, materials, m);
+                unsigned int pbr = find_json_key(parser, object,
+                        "pbrMetallicRoughness");
+                unsigned int base_colour = find_json_key(parser, pbr,
+                        "baseColorFactor");
+                unsigned int emissive = find_json_key(parser, object,
+                        "emissiveFactor");
+                struct gltf_material *material = &gltf_info->materials[m];
+
+                for (unsigned int k = 0; k < 4; ++k) {
+                        material->base_colour[k] = (float) get_json_number(
+                                parser, get_json_element(parser,
+                                base_colour, k), 1.0);
+                }
+
+                for (unsigned int k = 0; k < 3; ++k) {
+                        material->emissive[k] = (float) get_json_number(
+                                parser, get_json_element(parser, emissive,
+                                k), 0.0);
+                }
+
+                material->metallic = (float) get_json_key_number(parser, pbr,
+                        "metallicFactor", 1.0);
+                material->roughness = (float) get_json_key_number(parser, pbr,
+                        "roughnessFactor", 1.0);
+                material->alpha_cutoff = (float) get_json_key_number(parser,
+                        object, "alphaCutoff", 0.5);
+                material->is_double_sided = get_json_key_number(parser,
+                        object, "doubleSided", 0.0) != 0.0;
+                material->base_colour_image = get_texture_image(loader,
+                        find_json_key(parser, pbr, "baseColorTexture"));
+                material->normal_image = get_texture_image(loader,
+                        find_json_key(parser, object, "normalTexture"));
+        }
+}
+
+static void load_images(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_info *gltf_info = loader->gltf_info;
+        unsigned int images = find_json_key(parser, 0, "images");
+
+        gltf_info->image_count = get_json_size(parser, images);
+        gltf_info->images = calloc(gltf_info->image_count + 1,
+                sizeof (struct gltf_image));
+
+        for (unsigned int i = 0; i < gltf_info->image_count; ++i) {
+                unsigned int object = get_json_element(parser, images, i);
+                struct gltf_image *image = &gltf_info->images[i];
+                copy_json_string(parser, find_json_key(parser, object, "uri"),
+                        image->uri, MAX_GLTF_PATH);
+                copy_json_string(parser, find_json_key(parser, object,
+                        "mimeType"), image->mime_type,
+                        sizeof (image->mime_type));
+
+                unsigned int view = get_json_key_index(parser, object,
+                        "bufferView");
+                if (view < loader->view_count) {
+                        image->data = loader->views[view].data;
+                        image->size = loader->views[view].size;
+                }
+        }
+}
+
+static void quat_from_rotation_mat(quat q, mat4x4 m)
+{
+        // Picks the largest of w, x, y and z to divide by
+        float trace = m[0][0] + m[1][1] + m[2][2];
+        if (trace > 0.0f) {
+                float s = sqrtf(trace + 1.0f) * 2.0f;
+                q[3] = 0.25f * s;
+                q[0] = (m[1][2] - m[2][1]) / s;
+                q[1] = (m[2][0] - m[0][2]) / s;
+                q[2] = (m[0][1] - m[1][0]) / s;
+        } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+                float s = sqrtf(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+                q[3] = (m[1][2] - m[2][1]) / s;
+                q[0] = 0.25f * s;
+                q[1] = (m[1][0] + m[0][1]) / s;
+                q[2] = (m[2][0] + m[0][2]) / s;
+        } else if (m[1][1] > m[2][2]) {
+                float s = sqrtf(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+                q[3] = (m[2][0] - m[0][2]) / s;
+                q[0] = (m[1][0] + m[0][1]) / s;
+                q[1] = 0.25f * s;
+                q[2] = (m[2][1] + m[1][2]) / s;
+        } else {
+                float s = sqrtf(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+                q[3] = (m[0][1] - m[1][0]) / s;
+                q[0] = (m[2][0] + m[0][2]) / s;
+                q[1] = (m[2][1] + m[1][2]) / s;
+                q[2] = 0.25f * s;
+        }
+}
+
+// Matrices are split into translation, rotation and scale, which loses any
+// shear
+static void set_node_transform(struct gltf_loader *loader,
+        unsigned int object, unsigned int transform)
+{
+        struct json_parser *parser = &loader->parser;
+        struct transform_info *transform_info =
+                loader->gltf_info->transform_info;
+        vec3 position = { 0.0f, 0.0f, 0.0f };
+        quat rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+        vec3 scale = { 1.0f, 1.0f, 1.0f };
+
+        unsigned int matrix = find_json_key(parser, object, "matrix");
+        if (get_json_size(parser, matrix) == 16) {
+                mat4x4 m;
+                for (unsigned int k = 0; k < 16; ++k) {
+                        m[k / 4][k % 4] = (float) get_json_number(parser,
+                                get_json_element(parser, matrix, k),
+                                k % 5 == 0 ? 1.0 : 0.0);
+                }
+
+                for (int k = 0; k < 3; ++k) {
+                        position[k] = m[3][k];
+                        scale[k] = vec3_len(m[k]);
+                        if (scale[k] > 0.0f)
+                                vec4_scale(m[k], m[k], 1.0f / scale[k]);
+                }
+
+                quat_from_rotation_mat(rotation, m);
+        } else {
+                unsigned int translation = find_json_key(parser, object,
+                        "translation");
+                unsigned int rotation_key = find_json_key(parser, object,
+                        "rotation");
+                unsigned int scale_key = find_json_key(parser, object,
+                        "scale");
+                for (unsigned int k = 0; k < 4; ++k) {
+                        rotation[k] = (float) get_json_number(parser,
+                                get_json_element(parser, rotation_key, k),
+                                rotation[k]);
+                }
+
+                for (unsigned int k = 0; k < 3; ++k) {
+                        position[k] = (float) get_json_number(parser,
+                                get_json_element(parser, translation, k),
+                                0.0);
+                        scale[k] = (float) get_json_number(parser,
+                                get_json_element(parser, scale_key, k), 1.0);
+                }
+        }
+
+        set_transform_position(transform_info, transform, position);
+        set_transform_rotation(transform_info, transform, rotation);
+        set_transform_scale(transform_info, transform, scale);
+}
+
+// Walks the scene from its roots so parents are always added before their
+// children
+static int load_nodes(struct gltf_loader *loader)
+{
+        struct json_parser *parser = &loader->parser;
+        struct gltf_info *gltf_info = loader->gltf_info;
+        struct transform_info *transform_info = gltf_info->transform_info;
+        unsigned int nodes = find_json_key(parser, 0, "nodes");
+
+        gltf_info->node_count = get_json_size(parser, nodes);
+        gltf_info->node_transforms = malloc((gltf_info->node_count + 1) *
+                sizeof (unsigned int));
+        gltf_info->instances = malloc((gltf_info->node_count + 1) *
+                sizeof (struct gltf_instance));
+        if (transform_info != NULL && transform_info->count +
+                gltf_info->node_count > transform_info->capacity)
+                return 0;
+
+        // Without a scene every node that is nobody's child is a root
+        unsigned char *is_root = malloc(gltf_info->node_count + 1);
+        unsigned int scene = get_json_element(parser, find_json_key(parser, 0,
+                "scenes"), get_json_key_index(parser, 0, "scene") !=
+                GLTF_NONE ? get_json_key_index(parser, 0, "scene") : 0);
+        unsigned int scene_nodes = find_json_key(parser, scene, "nodes");
+        memset(is_root, scene_nodes == GLTF_NONE, gltf_info->node_count);
+        for (unsigned int n = 0; n < gltf_info->node_count; ++n) {
+                gltf_info->node_transforms[n] = GLTF_NONE;
+
+                unsigned int children = find_json_key(parser,
+                        get_json_element(parser, nodes, n), "children");
+                for (unsigned int c = 0; c < get_json_size(parser, children);
+                        ++c) {
+                        unsigned int child = (unsigned int) get_json_number(
+                                parser, get_json_element(parser, children, c),
+                                -1.0);
+                        if (scene_nodes == GLTF_NONE &&
+                                child < gltf_info->node_count)
+                                is_root[child] = 0;
+                }
+        }
+
+        for (unsigned int r = 0; r < get_json_size(parser, scene_nodes); ++r) {
+                unsigned int root = (unsigned int) get_json_number(parser,
+                        get_json_element(parser, scene_nodes, r), -1.0);
+                if (root < gltf_info->node_count)
+                        is_root[root] = 1;
+        }
+
+        // A node and its parent's transform share a slot of the stack
+        unsigned int *stack = malloc((gltf_info->node_count + 1) * 2 *
+                sizeof (unsigned int));
+        unsigned int *reached = calloc(gltf_info->node_count + 1,
+                sizeof (unsigned int));
+        unsigned int stack_count = 0;
+        for (unsigned int n = 0; n < gltf_info->node_count; ++n) {
+                if (!is_root[n])
+                        continue;
+
+                stack[stack_count * 2] = n;
+                stack[stack_count * 2 + 1] = TRANSFORM_NO_PARENT;
+                ++stack_count;
+                reached[n] = 1;
+        }
+
+        gltf_info->instance_count = 0;
+        while (stack_count > 0) {
+                --stack_count;
+                unsigned int n = stack[stack_count * 2];
+                unsigned int parent = stack[stack_count * 2 + 1];
+                unsigned int object = get_json_element(parser, nodes, n);
+
+                unsigned int transform = GLTF_NONE;
+                if (transform_info != NULL) {
+                        transform = add_transform(transform_info, parent);
+                        set_node_transform(loader, object, transform);
+                }
+
+                gltf_info->node_transforms[n] = transform;
+
+                unsigned int mesh = get_json_key_index(parser, object,
+                        "mesh");
+                if (mesh < gltf_info->mesh_count) {
+                        struct gltf_instance *instance =
+                                &gltf_info->instances[
+                                gltf_info->instance_count++];
+                        instance->mesh = mesh;
+                        instance->transform = transform;
+                }
+
+                // Nodes are only reached once, which also stops cycles
+                unsigned int children = find_json_key(parser, object,
+                        "children");
+                for (unsigned int c = 0; c < get_json_size(parser, children);
+                        ++c) {
+                        unsigned int child = (unsigned int) get_json_number(
+                                parser, get_json_element(parser, children, c),
+                                -1.0);
+                        if (child >= gltf_info->node_count || reached[child])
+                                continue;
+
+                        reached[child] = 1;
+                        stack[stack_count * 2] = child;
+                        stack[stack_count * 2 + 1] = transform_info != NULL ?
+                                transform : TRANSFORM_NO_PARENT;
+                        ++stack_count;
+                }
+        }
+
+        free(reached);
+        free(stack);
+        free(is_root);
+
+        return 1;
+}
+
+int load_gltf(struct gltf_info *gltf_info)
+{
+        double start_time = get_time_in_secs();
+
+        memset(&gltf_info->stats, 0, sizeof (struct gltf_stats));
+        gltf_info->mesh_count = 0;
+        gltf_info->meshes = NULL;
+        gltf_info->primitive_count = 0;
+        gltf_info->primitives = NULL;
+        gltf_info->material_count = 0;
+        gltf_info->materials = NULL;
+        gltf_info->image_count = 0;
+        gltf_info->images = NULL;
+        gltf_info->instance_count = 0;
+        gltf_info->instances = NULL;
+        gltf_info->node_count = 0;
+        gltf_info->node_transforms = NULL;
+        gltf_info->buffer_count = 0;
+        gltf_info->buffer_maps = NULL;
+
+        if (!map_file(gltf_info->path, &gltf_info->file_map))
+                return 0;
+
+        struct gltf_loader loader;
+        memset(&loader, 0, sizeof (struct gltf_loader));
+        loader.gltf_info = gltf_info;
+        gltf_info->stats.file_size = gltf_info->file_map.size;
+
+        int is_loaded = find_chunks(&loader) &&
+                parse_json_value(&loader.parser, 0) &&
+                loader.parser.tokens[0].type == JSON_TYPE_OBJECT;
+        if (is_loaded)
+                index_json_arrays(&loader.parser);
+
+        double parse_end_time = get_time_in_secs();
+
+        is_loaded = is_loaded && load_buffers(&loader) &&
+                load_buffer_views(&loader);
+        if (is_loaded) {
+                load_images(&loader);
+                load_materials(&loader);
+        }
+
+        is_loaded = is_loaded && load_meshes(&loader) && load_nodes(&loader);
+
+        free(loader.parser.elements);
+        free(loader.parser.tokens);
+        free(loader.buffers);
+        free(loader.views);
+
+        if (!is_loaded) {
+                release_gltf(gltf_info);
+                return 0;
+        }
+
+        double end_time = get_time_in_secs();
+        gltf_info->stats.parse_time = parse_end_time - start_time;
+        gltf_info->stats.convert_time = end_time - parse_end_time;
+        gltf_info->stats.total_time = end_time - start_time;
+
+        return 1;
+}
+
+void release_gltf(struct gltf_info *gltf_info)
+{
+        for (unsigned int p = 0; p < gltf_info->primitive_count; ++p) {
+                struct gltf_primitive *primitive = &gltf_info->primitives[p];
+                free(primitive->mesh.verticies);
+                if (primitive->owns_indices)
+                        free(primitive->mesh.indices);
+        }
+
+        for (unsigned int b = 0; b < gltf_info->buffer_count; ++b)
+                unmap_file(&gltf_info->buffer_maps[b]);
+
+        free(gltf_info->buffer_maps);
+        free(gltf_info->node_transforms);
+        free(gltf_info->instances);
+        free(gltf_info->images);
+        free(gltf_info->materials);
+        free(gltf_info->primitives);
+        free(gltf_info->meshes);
+        unmap_file(&gltf_info->file_map);
+
+        gltf_info->mesh_count = 0;
+        gltf_info->meshes = NULL;
+        gltf_info->primitive_count = 0;
+        gltf_info->primitives = NULL;
+        gltf_info->material_count = 0;
+        gltf_info->materials = NULL;
+        gltf_info->image_count = 0;
+        gltf_info->images = NULL;
+        gltf_info->instance_count = 0;
+        gltf_info->instances = NULL;
+        gltf_info->node_count = 0;
+        gltf_info->node_transforms = NULL;
+        gltf_info->buffer_count = 0;
+        gltf_info->buffer_maps = NULL;
+}
@@ -0,0 +1,105 @@
+#ifndef GLTF_INTERFACE_H
+#define GLTF_INTERFACE_H
+
+#include "mesh_interface.h"
+#include "transform_interface.h"
+#include "job_interface.h"
+#include "file_map_interface.h"
+
+// glTF 2.0 loader for .glb files and .gltf files with external buffers.
+// Files and buffers are mapped rather than read, and accessors whose layout
+// already matches what the renderer uses, such as 32 bit indices, are
+// pointed at in place. Only accessors that don't match are converted, large
+// ones split across the job system, so the only copies made are the
+// converted ones. Every triangle primitive becomes a mesh_info, and the
+// nodes of the scene become transforms, parents first. Kept free of D3D
+// types so it can run headless.
+#define MAX_GLTF_PATH 260
+#define GLTF_PARALLEL_MIN_COUNT 65536
+#define MAX_GLTF_CHUNKS 64
+#define MAX_GLTF_JSON_DEPTH 64
+#define GLTF_NONE 0xffffffff
+
+// The base colour and normal images are GLTF_NONE when unused
+struct gltf_material {
+        float base_colour[4];
+        float metallic;
+        float roughness;
+        float emissive[3];
+        float alpha_cutoff;
+        int is_double_sided;
+        unsigned int base_colour_image;
+        unsigned int normal_image;
+};
+
+// Images inside a buffer point into it, others only have a uri relative to
+// the file
+struct gltf_image {
+        const void *data;
+        unsigned long long size;
+        char uri[MAX_GLTF_PATH];
+        char mime_type[32];
+};
+
+struct gltf_primitive {
+        struct mesh_info mesh;
+        unsigned int material;
+        // Zero when the indices point into a mapped buffer
+        int owns_indices;
+};
+
+struct gltf_mesh {
+        unsigned int first_primitive;
+        unsigned int primitive_count;
+};
+
+// A mesh placed by a node, transform is GLTF_NONE without a transform_info
+struct gltf_instance {
+        unsigned int mesh;
+        unsigned int transform;
+};
+
+struct gltf_stats {
+        unsigned long long file_size;
+        unsigned int vertex_count;
+        unsigned int index_count;
+        unsigned int skipped_primitive_count;
+        unsigned int in_place_accessor_count;
+        unsigned int converted_accessor_count;
+        unsigned long long converted_size;
+        double parse_time;
+        double convert_time;
+        double total_time;
+};
+
+struct gltf_info {
+        char path[MAX_GLTF_PATH];
+        struct job_system_info *job_system;
+        // Needs room for every node of the scene, may be NULL
+        struct transform_info *transform_info;
+        unsigned int mesh_count;
+        struct gltf_mesh *meshes;
+        unsigned int primitive_count;
+        struct gltf_primitive *primitives;
+        unsigned int material_count;
+        struct gltf_material *materials;
+        unsigned int image_count;
+        struct gltf_image *images;
+        unsigned int instance_count;
+        struct gltf_instance *instances;
+        // Transform of every node, GLTF_NONE when not in the scene
+        unsigned int node_count;
+        unsigned int *node_transforms;
+        // Stay mapped while meshes and images point into them
+        struct file_map_info file_map;
+        unsigned int buffer_count;
+        struct file_map_info *buffer_maps;
+        struct gltf_stats stats;
+};
+
+// Returns 0 when the file is missing or not valid glTF 2.0, uses data URIs,
+// sparse accessors, or indices past the end of their vertices
+int load_gltf(struct gltf_info *gltf_info);
+void release_gltf(struct gltf_info *gltf_info);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #pragma comment (lib, "dxgi.lib")
 #pragma comment (lib, "d3d12.lib")
@@ -193,6 +194,24 @@ void upload_resources(struct gpu_resource_info *resource_info, void *src_data)
         ID3D12Resource_Unmap(resource_info->resource, 0, NULL);
 }
 
+void *map_resource(struct gpu_resource_info *resource_info)
+{
+        void *data;
+
+        HRESULT result;
+
+        result = ID3D12Resource_Map(resource_info->resource, 0, NULL, &data);
+
+        show_error_if_failed(result);
+
+        return data;
+}
+
+void unmap_resource(struct gpu_resource_info *resource_info)
+{
+        ID3D12Resource_Unmap(resource_info->resource, 0, NULL);
+}
+
 
 void create_descriptor(struct gpu_device_info *device_info,
         struct gpu_descriptor_info *descriptor_info)
@@ -310,7 +329,9 @@ void create_unorderd_access_view(struct gpu_device_info *device_info,
 {
          D3D12_UNORDERED_ACCESS_VIEW_DESC uav_desc;
          uav_desc.Format = resource_info->format;
-         uav_desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+         uav_desc.ViewDimension =
+                resource_info->dimension == D3D12_RESOURCE_DIMENSION_BUFFER ?
+                D3D12_UAV_DIMENSION_BUFFER : D3D12_UAV_DIMENSION_TEXTURE2D;
          switch (uav_desc.ViewDimension)
          {
                 case D3D12_UAV_DIMENSION_TEXTURE2D :
@@ -318,6 +339,17 @@ void create_unorderd_access_view(struct gpu_device_info *device_info,
                         uav_desc.Texture2D.PlaneSlice = 0;
                         break;
 
+                // Buffers are exposed as raw byte address buffers
+                case D3D12_UAV_DIMENSION_BUFFER :
+                        uav_desc.Format = DXGI_FORMAT_R32_TYPELESS;
+                        uav_desc.Buffer.FirstElement = 0;
+                        uav_desc.Buffer.NumElements =
+                                (UINT) (resource_info->width / sizeof (UINT));
+                        uav_desc.Buffer.StructureByteStride = 0;
+                        uav_desc.Buffer.CounterOffsetInBytes = 0;
+                        uav_desc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+                        break;
+
                 default :
                         break;
          };
@@ -333,7 +365,9 @@ void create_shader_resource_view(struct gpu_device_info *device_info,
 {
         D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc;
         srv_desc.Format = resource_info->format;
-        srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+        srv_desc.ViewDimension =
+                resource_info->dimension == D3D12_RESOURCE_DIMENSION_BUFFER ?
+                D3D12_SRV_DIMENSION_BUFFER : D3D12_SRV_DIMENSION_TEXTURE2D;
         srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
 
         switch (srv_desc.ViewDimension)
@@ -345,6 +379,16 @@ void create_shader_resource_view(struct gpu_device_info *device_info,
                         srv_desc.Texture2D.ResourceMinLODClamp = 0.0f;
                         break;
 
+                // Buffers are exposed as raw byte address buffers
+                case D3D12_SRV_DIMENSION_BUFFER :
+                        srv_desc.Format = DXGI_FORMAT_R32_TYPELESS;
+                        srv_desc.Buffer.FirstElement = 0;
+                        srv_desc.Buffer.NumElements =
+                                (UINT) (resource_info->width / sizeof (UINT));
+                        srv_desc.Buffer.StructureByteStride = 0;
+                        srv_desc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
+                        break;
+
                 default :
                         break;
         }
@@ -452,6 +496,8 @@ void create_cmd_list(struct gpu_device_info *device_info,
         result = ID3D12Object_SetName(
                 cmd_list_info->cmd_list, cmd_list_info->name);
         show_error_if_failed(result);
+
+        init_cmd_state(&cmd_list_info->state_info);
 }
 
 void release_cmd_list(struct gpu_cmd_list_info *cmd_list_info)
@@ -478,6 +524,9 @@ void reset_cmd_list(struct gpu_cmd_allocator_info *cmd_allocator_info,
 {
         ID3D12GraphicsCommandList_Reset(cmd_list_info->cmd_list,
                 cmd_allocator_info->cmd_allocators[index], NULL);
+
+        // A reset list starts out with default state
+        invalidate_cmd_state(&cmd_list_info->state_info);
 }
 
 void rec_copy_buffer_region_cmd(struct gpu_cmd_list_info *cmd_list_info,
@@ -545,6 +594,10 @@ void rec_clear_dsv_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_pipeline_state_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_pso_info *pso_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info, CMD_STATE_PIPELINE,
+                &pso_info->pso, sizeof (ID3D12PipelineState *)))
+                return;
+
         ID3D12GraphicsCommandList_SetPipelineState(
                 cmd_list_info->cmd_list, pso_info->pso);
 }
@@ -553,6 +606,15 @@ void rec_set_render_target_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_descriptor_info *rtv_desc_info,
         struct gpu_descriptor_info *dsv_desc_info)
 {
+        D3D12_CPU_DESCRIPTOR_HANDLE target_handles[2];
+        target_handles[0] = rtv_desc_info->cpu_handle;
+        target_handles[1] = dsv_desc_info->cpu_handle;
+
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_RENDER_TARGET, target_handles,
+                sizeof (target_handles)))
+                return;
+
         ID3D12GraphicsCommandList_OMSetRenderTargets(
                 cmd_list_info->cmd_list, 1, &rtv_desc_info->cpu_handle, TRUE,
                 &dsv_desc_info->cpu_handle);
@@ -561,6 +623,10 @@ void rec_set_render_target_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_viewport_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_viewport_info *viewport_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info, CMD_STATE_VIEWPORT,
+                &viewport_info->viewport, sizeof (D3D12_VIEWPORT)))
+                return;
+
         ID3D12GraphicsCommandList_RSSetViewports(
                 cmd_list_info->cmd_list, 1, &viewport_info->viewport);
 }
@@ -568,6 +634,11 @@ void rec_set_viewport_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_scissor_rect_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_scissor_rect_info *scissor_rect_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_SCISSOR_RECT, &scissor_rect_info->scissor_rect,
+                sizeof (D3D12_RECT)))
+                return;
+
         ID3D12GraphicsCommandList_RSSetScissorRects(
                 cmd_list_info->cmd_list, 1, &scissor_rect_info->scissor_rect);
 }
@@ -575,6 +646,10 @@ void rec_set_scissor_rect_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_primitive_cmd(struct gpu_cmd_list_info *cmd_list_info,
         D3D_PRIMITIVE_TOPOLOGY prim_type)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info, CMD_STATE_PRIMITIVE,
+                &prim_type, sizeof (D3D_PRIMITIVE_TOPOLOGY)))
+                return;
+
         ID3D12GraphicsCommandList_IASetPrimitiveTopology(
                 cmd_list_info->cmd_list, prim_type);
 }
@@ -582,6 +657,11 @@ void rec_set_primitive_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_compute_root_sig_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_root_sig_info *root_sig_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_COMPUTE_ROOT_SIG, &root_sig_info->root_sig,
+                sizeof (ID3D12RootSignature *)))
+                return;
+
         ID3D12GraphicsCommandList_SetComputeRootSignature(
                 cmd_list_info->cmd_list, root_sig_info->root_sig);
 }
@@ -589,6 +669,11 @@ void rec_set_compute_root_sig_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_graphics_root_sig_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_root_sig_info *root_sig_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_GRAPHICS_ROOT_SIG, &root_sig_info->root_sig,
+                sizeof (ID3D12RootSignature *)))
+                return;
+
         ID3D12GraphicsCommandList_SetGraphicsRootSignature(
                 cmd_list_info->cmd_list, root_sig_info->root_sig);
 }
@@ -596,14 +681,46 @@ void rec_set_graphics_root_sig_cmd(struct gpu_cmd_list_info *cmd_list_info,
 void rec_set_descriptor_heap_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_descriptor_info *descriptor_info)
 {
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_DESCRIPTOR_HEAPS, &descriptor_info->descriptor_heap,
+                sizeof (ID3D12DescriptorHeap *)))
+                return;
+
         ID3D12GraphicsCommandList_SetDescriptorHeaps(
                 cmd_list_info->cmd_list, 1, &descriptor_info->descriptor_heap);
 }
 
+void rec_set_descriptor_heaps_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_descriptor_info **descriptor_info_list,
+        UINT descriptor_count)
+{
+        // One CBV/SRV/UAV heap and one sampler heap at most
+        #define MAX_DESCRIPTOR_HEAPS 2
+        assert(descriptor_count <= MAX_DESCRIPTOR_HEAPS);
+
+        ID3D12DescriptorHeap *descriptor_heaps[MAX_DESCRIPTOR_HEAPS];
+        for (UINT i = 0; i < descriptor_count; ++i) {
+                descriptor_heaps[i] = descriptor_info_list[i]->descriptor_heap;
+        }
+
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_DESCRIPTOR_HEAPS, descriptor_heaps,
+                descriptor_count * sizeof (ID3D12DescriptorHeap *)))
+                return;
+
+        ID3D12GraphicsCommandList_SetDescriptorHeaps(
+                cmd_list_info->cmd_list, descriptor_count, descriptor_heaps);
+}
+
 void rec_set_compute_root_descriptor_table_cmd(
         struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
         struct gpu_descriptor_info *descriptor_info)
 {
+        if (!filter_root_param_state(&cmd_list_info->state_info, TRUE,
+                root_param_index, &descriptor_info->gpu_handle,
+                sizeof (D3D12_GPU_DESCRIPTOR_HANDLE)))
+                return;
+
         ID3D12GraphicsCommandList_SetComputeRootDescriptorTable(
                 cmd_list_info->cmd_list, root_param_index, 
                 descriptor_info->gpu_handle);
@@ -613,11 +730,41 @@ void rec_set_graphics_root_descriptor_table_cmd(
         struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
         struct gpu_descriptor_info *descriptor_info)
 {
+        if (!filter_root_param_state(&cmd_list_info->state_info, FALSE,
+                root_param_index, &descriptor_info->gpu_handle,
+                sizeof (D3D12_GPU_DESCRIPTOR_HANDLE)))
+                return;
+
         ID3D12GraphicsCommandList_SetGraphicsRootDescriptorTable(
                 cmd_list_info->cmd_list, root_param_index,
                 descriptor_info->gpu_handle);
 }
 
+void rec_set_compute_root_constants_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        UINT root_param_index, UINT num_constants, const void *constants)
+{
+        if (!filter_root_param_state(&cmd_list_info->state_info, TRUE,
+                root_param_index, constants, num_constants * sizeof (UINT)))
+                return;
+
+        ID3D12GraphicsCommandList_SetComputeRoot32BitConstants(
+                cmd_list_info->cmd_list, root_param_index, num_constants,
+                constants, 0);
+}
+
+void rec_set_graphics_root_constants_cmd(
+        struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
+        UINT num_constants, const void *constants)
+{
+        if (!filter_root_param_state(&cmd_list_info->state_info, FALSE,
+                root_param_index, constants, num_constants * sizeof (UINT)))
+                return;
+
+        ID3D12GraphicsCommandList_SetGraphicsRoot32BitConstants(
+                cmd_list_info->cmd_list, root_param_index, num_constants,
+                constants, 0);
+}
+
 void rec_set_vertex_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_resource_info *vert_buffer_info, UINT stride)
 {
@@ -626,17 +773,47 @@ void rec_set_vertex_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
         vert_buffer_view.SizeInBytes = (UINT) vert_buffer_info->width;
         vert_buffer_view.StrideInBytes = stride;
 
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_VERTEX_BUFFER, &vert_buffer_view,
+                sizeof (D3D12_VERTEX_BUFFER_VIEW)))
+                return;
+
         ID3D12GraphicsCommandList_IASetVertexBuffers(
                 cmd_list_info->cmd_list, 0, 1, &vert_buffer_view);
 }
 
+void rec_set_instance_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_resource_info *instance_buffer_info, UINT64 offset,
+        UINT stride)
+{
+        D3D12_VERTEX_BUFFER_VIEW instance_buffer_view;
+        instance_buffer_view.BufferLocation =
+                instance_buffer_info->gpu_address + offset;
+        instance_buffer_view.SizeInBytes =
+                (UINT) (instance_buffer_info->width - offset);
+        instance_buffer_view.StrideInBytes = stride;
+
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_INSTANCE_BUFFER, &instance_buffer_view,
+                sizeof (D3D12_VERTEX_BUFFER_VIEW)))
+                return;
+
+        ID3D12GraphicsCommandList_IASetVertexBuffers(
+                cmd_list_info->cmd_list, 1, 1, &instance_buffer_view);
+}
+
 void rec_set_index_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_resource_info *index_buffer)
 {
         D3D12_INDEX_BUFFER_VIEW index_buffer_view;
         index_buffer_view.BufferLocation = index_buffer->gpu_address;
         index_buffer_view.SizeInBytes = (UINT) index_buffer->width;
-        index_buffer_view.Format = DXGI_FORMAT_R32_UINT;
+        index_buffer_view.Format = index_buffer->index_format;
+
+        if (!filter_cmd_state(&cmd_list_info->state_info,
+                CMD_STATE_INDEX_BUFFER, &index_buffer_view,
+                sizeof (D3D12_INDEX_BUFFER_VIEW)))
+                return;
 
         ID3D12GraphicsCommandList_IASetIndexBuffer(
                 cmd_list_info->cmd_list, &index_buffer_view);
@@ -651,10 +828,12 @@ void rec_dispatch_cmd(struct gpu_cmd_list_info *cmd_list_info,
 }
 
 void rec_draw_indexed_instance_cmd(struct gpu_cmd_list_info *cmd_list_info,
-        UINT index_count, UINT instance_count)
+        UINT index_count, UINT instance_count, UINT start_index,
+        INT base_vertex, UINT start_instance)
 {
         ID3D12GraphicsCommandList_DrawIndexedInstanced(
-                cmd_list_info->cmd_list, index_count, instance_count, 0, 0, 0);
+                cmd_list_info->cmd_list, index_count, instance_count,
+                start_index, base_vertex, start_instance);
 }
 
 void transition_resources(struct gpu_cmd_list_info *cmd_list_info,
@@ -768,7 +947,7 @@ void wait_for_gpu(struct gpu_fence_info *fence_info, UINT index)
 }
 
 
-void compile_shader(struct gpu_shader_info *shader_info)
+BOOL try_compile_shader(struct gpu_shader_info *shader_info)
 {
         #if defined(_DEBUG)
         shader_info->flags = D3DCOMPILE_DEBUG | 
@@ -783,17 +962,39 @@ void compile_shader(struct gpu_shader_info *shader_info)
         ID3DBlob *shader_error_blob = NULL;
         shader_info->shader_blob = NULL;
 
-        result = D3DCompileFromFile(shader_info->shader_file, NULL, NULL,
+        result = D3DCompileFromFile(shader_info->shader_file,
+                shader_info->defines, D3D_COMPILE_STANDARD_FILE_INCLUDE,
                 "main", shader_info->shader_target, shader_info->flags, 0,
                 &shader_info->shader_blob, &shader_error_blob);
-        show_error_if_failed(result);
-        assert(shader_error_blob == NULL);
+
+        // Report the errors and leave it to the caller to keep the old shader
+        if (shader_error_blob != NULL) {
+                OutputDebugStringA(ID3D10Blob_GetBufferPointer(
+                        shader_error_blob));
+                ID3D10Blob_Release(shader_error_blob);
+        }
+
+        if (FAILED(result)) {
+                shader_info->shader_blob = NULL;
+                return FALSE;
+        }
 
         shader_info->shader_byte_code = ID3D10Blob_GetBufferPointer(
                 shader_info->shader_blob);
 
         shader_info->shader_byte_code_len = ID3D10Blob_GetBufferSize(
                 shader_info->shader_blob);
+
+        return TRUE;
+}
+
+void compile_shader(struct gpu_shader_info *shader_info)
+{
+        // Shaders compiled at startup have no older version to fall back on
+        if (!try_compile_shader(shader_info)) {
+                MessageBox(NULL, "Failed to compile shader", "Error", MB_OK);
+                exit(EXIT_FAILURE);
+        }
 }
 
 void release_shader(struct gpu_shader_info *shader_info)
@@ -805,20 +1006,127 @@ void release_shader(struct gpu_shader_info *shader_info)
 void setup_vertex_input(LPCSTR *attribute_names, DXGI_FORMAT *attribute_formats, 
                        struct gpu_vert_input_info *input_info)
 {
+        UINT first_instance_attribute = input_info->attribute_count -
+                input_info->instance_attribute_count;
+
         input_info->input_element_descs = malloc(input_info->attribute_count *
                 sizeof (D3D12_INPUT_ELEMENT_DESC));
         for (UINT i = 0; i < input_info->attribute_count; ++i) {
+                // Repeated names, like the rows of a matrix, are numbered
+                UINT semantic_index = 0;
+                for (UINT j = 0; j < i; ++j) {
+                        if (strcmp(attribute_names[j], attribute_names[i]) == 0)
+                                ++semantic_index;
+                }
+
+                BOOL is_instance_attribute = i >= first_instance_attribute;
+
                 input_info->input_element_descs[i].SemanticName =
                         attribute_names[i];
-                input_info->input_element_descs[i].SemanticIndex = 0;
+                input_info->input_element_descs[i].SemanticIndex =
+                        semantic_index;
                 input_info->input_element_descs[i].Format =
                         attribute_formats[i];
-                input_info->input_element_descs[i].InputSlot = 0;
+                input_info->input_element_descs[i].InputSlot =
+                        is_instance_attribute ? 1 : 0;
                 input_info->input_element_descs[i].AlignedByteOffset =
                         D3D12_APPEND_ALIGNED_ELEMENT;
                 input_info->input_element_descs[i].InputSlotClass =
+                        is_instance_attribute ?
+                        D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA :
                         D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA;
-                input_info->input_element_descs[i].InstanceDataStepRate = 0;
+                input_info->input_element_descs[i].InstanceDataStepRate =
+                        is_instance_attribute ? 1 : 0;
+        }
+}
+
+static DXGI_FORMAT get_attribute_dxgi_format(unsigned int format)
+{
+        switch (format)
+        {
+                case MESH_ATTRIBUTE_FORMAT_FLOAT2 :
+                        return DXGI_FORMAT_R32G32_FLOAT;
+
+                case MESH_ATTRIBUTE_FORMAT_FLOAT3 :
+                        return DXGI_FORMAT_R32G32B32_FLOAT;
+
+                case MESH_ATTRIBUTE_FORMAT_FLOAT4 :
+                        return DXGI_FORMAT_R32G32B32A32_FLOAT;
+
+                case MESH_ATTRIBUTE_FORMAT_SNORM16X2 :
+                        return DXGI_FORMAT_R16G16_SNORM;
+
+                case MESH_ATTRIBUTE_FORMAT_SNORM16X4 :
+                        return DXGI_FORMAT_R16G16B16A16_SNORM;
+
+                case MESH_ATTRIBUTE_FORMAT_HALF2 :
+                        return DXGI_FORMAT_R16G16_FLOAT;
+
+                case MESH_ATTRIBUTE_FORMAT_HALF4 :
+                        return DXGI_FORMAT_R16G16B16A16_FLOAT;
+
+                case MESH_ATTRIBUTE_FORMAT_UNORM8X4 :
+                        return DXGI_FORMAT_R8G8B8A8_UNORM;
+
+                default :
+                        return DXGI_FORMAT_UNKNOWN;
+        }
+}
+
+static LPCSTR get_attribute_semantic_name(unsigned int semantic)
+{
+        switch (semantic)
+        {
+                case MESH_ATTRIBUTE_SEMANTIC_POSITION :
+                        return "POSITION";
+
+                case MESH_ATTRIBUTE_SEMANTIC_COLOUR :
+                        return "COLOR";
+
+                case MESH_ATTRIBUTE_SEMANTIC_UV :
+                        return "TEXCOORD";
+
+                case MESH_ATTRIBUTE_SEMANTIC_NORMAL :
+                        return "NORMAL";
+
+                default :
+                        return "TANGENT";
+        }
+}
+
+void setup_vertex_format_input(struct vertex_format *format,
+        LPCSTR *instance_attribute_names,
+        DXGI_FORMAT *instance_attribute_formats,
+        UINT instance_attribute_count, struct gpu_vert_input_info *input_info)
+{
+        LPCSTR attribute_names[D3D12_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT];
+        DXGI_FORMAT attribute_formats[
+                D3D12_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT];
+        assert(format->attribute_count + instance_attribute_count <=
+                D3D12_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT);
+
+        for (UINT i = 0; i < format->attribute_count; ++i) {
+                attribute_names[i] = get_attribute_semantic_name(
+                        format->attributes[i].semantic);
+                attribute_formats[i] = get_attribute_dxgi_format(
+                        format->attributes[i].format);
+        }
+
+        for (UINT i = 0; i < instance_attribute_count; ++i) {
+                attribute_names[format->attribute_count + i] =
+                        instance_attribute_names[i];
+                attribute_formats[format->attribute_count + i] =
+                        instance_attribute_formats[i];
+        }
+
+        input_info->attribute_count = format->attribute_count +
+                instance_attribute_count;
+        input_info->instance_attribute_count = instance_attribute_count;
+        setup_vertex_input(attribute_names, attribute_formats, input_info);
+
+        for (UINT i = 0; i < format->attribute_count; ++i) {
+                input_info->input_element_descs[i].AlignedByteOffset =
+                        format->attributes[i].offset;
         }
 }
 
@@ -839,21 +1147,38 @@ void create_root_sig(struct gpu_device_info *device_info,
                 sizeof (D3D12_ROOT_PARAMETER));
 
         for (UINT i = 0; i < num_root_params; ++i) {
-                descriptor_ranges[i].RangeType =
-                        root_param_infos[i].range_type;
-                descriptor_ranges[i].NumDescriptors =
-                        root_param_infos[i].num_descriptors;
-                descriptor_ranges[i].BaseShaderRegister = 0;
-                descriptor_ranges[i].RegisterSpace = 0;
-                descriptor_ranges[i].OffsetInDescriptorsFromTableStart = 0;
-
-                root_params[i].ParameterType =
-                        D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-                root_params[i].DescriptorTable.NumDescriptorRanges = 1;
-                root_params[i].DescriptorTable.pDescriptorRanges =
-                        &descriptor_ranges[i];
+                root_params[i].ParameterType = root_param_infos[i].param_type;
                 root_params[i].ShaderVisibility =
                         root_param_infos[i].shader_visbility;
+
+                switch (root_params[i].ParameterType)
+                {
+                        case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE :
+                                descriptor_ranges[i].RangeType =
+                                        root_param_infos[i].range_type;
+                                descriptor_ranges[i].NumDescriptors =
+                                        root_param_infos[i].num_descriptors;
+                                descriptor_ranges[i].BaseShaderRegister = 0;
+                                descriptor_ranges[i].RegisterSpace =
+                                        root_param_infos[i].register_space;
+                                descriptor_ranges[i].OffsetInDescriptorsFromTableStart = 0;
+
+                                root_params[i].DescriptorTable.NumDescriptorRanges = 1;
+                                root_params[i].DescriptorTable.pDescriptorRanges =
+                                        &descriptor_ranges[i];
+                                break;
+
+                        case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS :
+                                root_params[i].Constants.ShaderRegister = 0;
+                                root_params[i].Constants.RegisterSpace =
+                                        root_param_infos[i].register_space;
+                                root_params[i].Constants.Num32BitValues =
+                                        root_param_infos[i].num_constants;
+                                break;
+
+                        default :
+                                break;
+                }
         }
 
         D3D12_ROOT_SIGNATURE_FLAGS root_sig_flags =
@@ -904,32 +1229,209 @@ void release_root_sig(struct gpu_root_sig_info *root_sig_info)
 }
 
 
-void create_pso(struct gpu_device_info *device_info,
+void create_cmd_signature(struct gpu_device_info *device_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct gpu_cmd_signature_info *cmd_signature_info)
+{
+        struct indirect_layout_info *layout_info =
+                &cmd_signature_info->layout_info;
+
+        enum INDIRECT_LAYOUT_ERROR layout_error =
+                build_indirect_layout(layout_info);
+        assert(layout_error == INDIRECT_LAYOUT_ERROR_NONE);
+
+        D3D12_INDIRECT_ARGUMENT_DESC arg_descs[MAX_INDIRECT_ARGS];
+        BOOL is_setting_root_args = FALSE;
+
+        for (UINT i = 0; i < layout_info->arg_count; ++i) {
+                struct indirect_arg_desc *arg_desc = &layout_info->args[i];
+
+                switch (arg_desc->type) {
+                        case INDIRECT_ARG_TYPE_DRAW_INDEXED :
+                                arg_descs[i].Type =
+                                        D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+                                break;
+
+                        case INDIRECT_ARG_TYPE_ROOT_CONSTANTS :
+                                arg_descs[i].Type =
+                                        D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+                                arg_descs[i].Constant.RootParameterIndex =
+                                        arg_desc->root_param_index;
+                                arg_descs[i].Constant.DestOffsetIn32BitValues =
+                                        0;
+                                arg_descs[i].Constant.Num32BitValuesToSet =
+                                        arg_desc->num_constants;
+                                is_setting_root_args = TRUE;
+                                break;
+
+                        case INDIRECT_ARG_TYPE_VERTEX_BUFFER :
+                                arg_descs[i].Type =
+                                        D3D12_INDIRECT_ARGUMENT_TYPE_VERTEX_BUFFER_VIEW;
+                                arg_descs[i].VertexBuffer.Slot = arg_desc->slot;
+                                break;
+
+                        case INDIRECT_ARG_TYPE_INDEX_BUFFER :
+                                arg_descs[i].Type =
+                                        D3D12_INDIRECT_ARGUMENT_TYPE_INDEX_BUFFER_VIEW;
+                                break;
+
+                        default : break;
+                }
+        }
+
+        D3D12_COMMAND_SIGNATURE_DESC cmd_signature_desc;
+        cmd_signature_desc.ByteStride = layout_info->stride;
+        cmd_signature_desc.NumArgumentDescs = layout_info->arg_count;
+        cmd_signature_desc.pArgumentDescs = arg_descs;
+        cmd_signature_desc.NodeMask = 0;
+
+        assert(!is_setting_root_args || root_sig_info != NULL);
+
+        HRESULT result;
+
+        result = ID3D12Device_CreateCommandSignature(device_info->device,
+                &cmd_signature_desc, is_setting_root_args ?
+                root_sig_info->root_sig : NULL,
+                &IID_ID3D12CommandSignature,
+                &cmd_signature_info->cmd_signature);
+        show_error_if_failed(result);
+
+        result = ID3D12Object_SetName(cmd_signature_info->cmd_signature,
+                cmd_signature_info->name);
+        show_error_if_failed(result);
+}
+
+void release_cmd_signature(struct gpu_cmd_signature_info *cmd_signature_info)
+{
+        ID3D12CommandSignature_Release(cmd_signature_info->cmd_signature);
+}
+
+static void invalidate_vert_buffer_slot(struct cmd_state_info *state_info,
+        UINT slot)
+{
+        // Only the slots of rec_set_vertex_buffer_cmd and
+        // rec_set_instance_buffer_cmd have a shadow state
+        switch (slot) {
+                case 0 :
+                        invalidate_cmd_states(state_info,
+                                CMD_STATE_VERTEX_BUFFER, 1);
+                        break;
+
+                case 1 :
+                        invalidate_cmd_states(state_info,
+                                CMD_STATE_INSTANCE_BUFFER, 1);
+                        break;
+
+                default :
+                        // Records aren't expected to set other slots, forget
+                        // everything rather than guess what they disturb
+                        assert(FALSE);
+                        invalidate_cmd_state(state_info);
+                        break;
+        }
+}
+
+void rec_execute_indirect_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_cmd_signature_info *cmd_signature_info, UINT max_count,
+        struct gpu_resource_info *args_buffer, UINT64 args_offset,
+        struct gpu_resource_info *count_buffer, UINT64 count_offset)
+{
+        ID3D12GraphicsCommandList_ExecuteIndirect(cmd_list_info->cmd_list,
+                cmd_signature_info->cmd_signature, max_count,
+                args_buffer->resource, args_offset,
+                count_buffer != NULL ? count_buffer->resource : NULL,
+                count_offset);
+
+        // Whatever the records set is left bound, so forget it
+        struct indirect_layout_info *layout_info =
+                &cmd_signature_info->layout_info;
+        for (UINT i = 0; i < layout_info->arg_count; ++i) {
+                struct indirect_arg_desc *arg_desc = &layout_info->args[i];
+
+                switch (arg_desc->type) {
+                        case INDIRECT_ARG_TYPE_ROOT_CONSTANTS :
+                                if (arg_desc->root_param_index <
+                                        MAX_CMD_STATE_ROOT_PARAMS)
+                                        invalidate_cmd_states(
+                                                &cmd_list_info->state_info,
+                                                CMD_STATE_GRAPHICS_ROOT_PARAM +
+                                                arg_desc->root_param_index, 1);
+                                break;
+
+                        case INDIRECT_ARG_TYPE_VERTEX_BUFFER :
+                                invalidate_vert_buffer_slot(
+                                        &cmd_list_info->state_info,
+                                        arg_desc->slot);
+                                break;
+
+                        case INDIRECT_ARG_TYPE_INDEX_BUFFER :
+                                invalidate_cmd_states(
+                                        &cmd_list_info->state_info,
+                                        CMD_STATE_INDEX_BUFFER, 1);
+                                break;
+
+                        default : break;
+                }
+        }
+}
+
+
+static HRESULT create_named_pso(struct gpu_device_info *device_info,
         struct gpu_vert_input_info *vert_input_info,
         struct gpu_root_sig_info *root_sig_info, struct gpu_pso_info *pso_info)
 {
+        HRESULT result;
+
         switch(pso_info->type)
         {
                 case PSO_TYPE_GRAPHICS :
-                        create_graphics_pso(device_info, vert_input_info,
-                                root_sig_info, pso_info);
+                        result = create_graphics_pso(device_info,
+                                vert_input_info, root_sig_info, pso_info);
                         break;
 
                 case PSO_TYPE_COMPUTE :
-                        create_compute_pso(device_info, root_sig_info, 
-                                pso_info);
+                        result = create_compute_pso(device_info,
+                                root_sig_info, pso_info);
                         break;
 
                 default : 
+                        result = E_INVALIDARG;
                         break;
         }
 
-        HRESULT result;
+        if (FAILED(result))
+                return result;
+
         result = ID3D12Object_SetName(pso_info->pso, pso_info->name);
-        show_error_if_failed(result);
+        if (FAILED(result))
+                ID3D12PipelineState_Release(pso_info->pso);
+
+        return result;
 }
 
-static void create_graphics_pso(struct gpu_device_info *device_info,
+void create_pso(struct gpu_device_info *device_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info, struct gpu_pso_info *pso_info)
+{
+        show_error_if_failed(create_named_pso(device_info, vert_input_info,
+                root_sig_info, pso_info));
+}
+
+BOOL try_create_pso(struct gpu_device_info *device_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info, struct gpu_pso_info *pso_info)
+{
+        // Leave it to the caller to keep the old PSO or a fallback running
+        if (FAILED(create_named_pso(device_info, vert_input_info,
+                root_sig_info, pso_info))) {
+                pso_info->pso = NULL;
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static HRESULT create_graphics_pso(struct gpu_device_info *device_info,
         struct gpu_vert_input_info *vert_input_info,
         struct gpu_root_sig_info *root_sig_info, struct gpu_pso_info *pso_info)
 {
@@ -1046,11 +1548,11 @@ static void create_graphics_pso(struct gpu_device_info *device_info,
 
         result = ID3D12Device_CreateGraphicsPipelineState(device_info->device,
                 &graphics_pso_desc, &IID_ID3D12PipelineState, &pso_info->pso);
-        
-        show_error_if_failed(result);
+
+        return result;
 }
 
-static void create_compute_pso(struct gpu_device_info *device_info,
+static HRESULT create_compute_pso(struct gpu_device_info *device_info,
         struct gpu_root_sig_info *root_sig_info, struct gpu_pso_info *pso_info)
 {
         D3D12_COMPUTE_PIPELINE_STATE_DESC compute_pso_desc;
@@ -1069,7 +1571,7 @@ static void create_compute_pso(struct gpu_device_info *device_info,
         result = ID3D12Device_CreateComputePipelineState(device_info->device,
                 &compute_pso_desc, &IID_ID3D12PipelineState, &pso_info->pso);
 
-        show_error_if_failed(result);
+        return result;
 }
 
 void release_pso(struct gpu_pso_info *pso_info)
@@ -1077,6 +1579,27 @@ void release_pso(struct gpu_pso_info *pso_info)
         ID3D12PipelineState_Release(pso_info->pso);
 }
 
+void set_pso_stage_shader(struct gpu_pso_info *pso_info, UINT stage,
+        struct gpu_shader_info *shader_info)
+{
+        if (pso_info->type == PSO_TYPE_COMPUTE) {
+                pso_info->compute_pso_info.comp_shader_byte_code =
+                        shader_info->shader_byte_code;
+                pso_info->compute_pso_info.comp_shader_byte_code_len =
+                        shader_info->shader_byte_code_len;
+        } else if (stage == 0) {
+                pso_info->graphics_pso_info.vert_shader_byte_code =
+                        shader_info->shader_byte_code;
+                pso_info->graphics_pso_info.vert_shader_byte_code_len =
+                        shader_info->shader_byte_code_len;
+        } else {
+                pso_info->graphics_pso_info.pix_shader_byte_code =
+                        shader_info->shader_byte_code;
+                pso_info->graphics_pso_info.pix_shader_byte_code_len =
+                        shader_info->shader_byte_code_len;
+        }
+}
+
 
 void create_viewport(struct gpu_viewport_info *viewport_info)
 {
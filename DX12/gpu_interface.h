@@ -6,6 +6,9 @@
 #include <dxgi1_6.h>
 #include "d3d12.h" // Including modified d3d12.h since their c interface is broken
 #include <d3dcompiler.h>
+#include "cmd_state_interface.h"
+#include "indirect_args_interface.h"
+#include "vertex_format_interface.h"
 
 struct gpu_device_info {
         ID3D12Debug *debug;
@@ -41,12 +44,18 @@ struct gpu_resource_info {
         D3D12_RESOURCE_STATES current_state;
         ID3D12Resource *resource;
         D3D12_GPU_VIRTUAL_ADDRESS gpu_address;
+        // Format of index buffer views of the resource, DXGI_FORMAT_R16_UINT
+        // or DXGI_FORMAT_R32_UINT. Not used for any other kind of view.
+        DXGI_FORMAT index_format;
 };
 
 void create_resource(struct gpu_device_info *device_info,
         struct gpu_resource_info *resource_info);
 void release_resource(struct gpu_resource_info *resource_info);
 void upload_resources(struct gpu_resource_info *resource_info, void *src_data);
+// Upload heap resources can stay mapped for as long as they live
+void *map_resource(struct gpu_resource_info *resource_info);
+void unmap_resource(struct gpu_resource_info *resource_info);
 
 
 struct gpu_descriptor_info {
@@ -107,6 +116,8 @@ struct gpu_cmd_list_info {
         WCHAR name[1024];
         D3D12_COMMAND_LIST_TYPE cmd_list_type;
         ID3D12GraphicsCommandList *cmd_list;
+        // rec_set_* calls that would not change anything are dropped
+        struct cmd_state_info state_info;
 };
 
 void create_cmd_list(struct gpu_device_info *device_info,
@@ -148,21 +159,32 @@ void rec_set_graphics_root_sig_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_root_sig_info *root_sig_info);
 void rec_set_descriptor_heap_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_descriptor_info *descriptor_info);
+void rec_set_descriptor_heaps_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_descriptor_info **descriptor_info_list,
+        UINT descriptor_count);
 void rec_set_compute_root_descriptor_table_cmd(
         struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
         struct gpu_descriptor_info *descriptor_info);
 void rec_set_graphics_root_descriptor_table_cmd(
         struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
         struct gpu_descriptor_info *descriptor_info);
+void rec_set_compute_root_constants_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        UINT root_param_index, UINT num_constants, const void *constants);
+void rec_set_graphics_root_constants_cmd(
+        struct gpu_cmd_list_info *cmd_list_info, UINT root_param_index,
+        UINT num_constants, const void *constants);
 void rec_set_vertex_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_resource_info *vert_buffer, UINT stride);
+void rec_set_instance_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_resource_info *instance_buffer, UINT64 offset, UINT stride);
 void rec_set_index_buffer_cmd(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_resource_info *index_buffer);
 void rec_dispatch_cmd(struct gpu_cmd_list_info *cmd_list_info,
         UINT thread_group_coun_x, UINT thread_group_coun_y,
         UINT thread_group_coun_z);
 void rec_draw_indexed_instance_cmd(struct gpu_cmd_list_info *cmd_list_info,
-        UINT index_count, UINT instance_count);
+        UINT index_count, UINT instance_count, UINT start_index,
+        INT base_vertex, UINT start_instance);
 void transition_resources(struct gpu_cmd_list_info *cmd_list_info,
         struct gpu_resource_info **resource_info_list,
         D3D12_RESOURCE_STATES *resource_end_state_list, UINT resource_count);
@@ -191,28 +213,42 @@ struct gpu_shader_info {
         LPCWSTR shader_file;
         UINT flags;
         LPCSTR shader_target;
+        const D3D_SHADER_MACRO *defines;
         ID3DBlob *shader_blob;
         void *shader_byte_code;
         size_t shader_byte_code_len;
 };
 
 void compile_shader(struct gpu_shader_info *shader_info);
+BOOL try_compile_shader(struct gpu_shader_info *shader_info);
 void release_shader(struct gpu_shader_info *shader_info);
 
 
+// The last instance_attribute_count attributes are read once per instance
+// from the instance buffer
 struct gpu_vert_input_info {
         UINT attribute_count;
+        UINT instance_attribute_count;
         D3D12_INPUT_ELEMENT_DESC *input_element_descs;
 };
 
 void setup_vertex_input(LPCSTR *attribute_names, DXGI_FORMAT *attribute_formats,
         struct gpu_vert_input_info *input_info);
+// Input layout of a vertex format in the first slot, at its own offsets,
+// followed by the instance attributes in the second
+void setup_vertex_format_input(struct vertex_format *format,
+        LPCSTR *instance_attribute_names,
+        DXGI_FORMAT *instance_attribute_formats,
+        UINT instance_attribute_count, struct gpu_vert_input_info *input_info);
 void free_vertex_input(struct gpu_vert_input_info *input_info);
 
 
 struct gpu_root_param_info {
+        D3D12_ROOT_PARAMETER_TYPE param_type;
         D3D12_DESCRIPTOR_RANGE_TYPE range_type;
-        UINT num_descriptors;
+        UINT num_descriptors; // UINT_MAX for an unbounded range
+        UINT num_constants;
+        UINT register_space;
         D3D12_SHADER_VISIBILITY shader_visbility;
 };
 
@@ -228,6 +264,25 @@ void create_root_sig(struct gpu_device_info *device_info,
 void release_root_sig(struct gpu_root_sig_info *root_sig_info);
 
 
+struct gpu_cmd_signature_info {
+        WCHAR name[1024];
+        struct indirect_layout_info layout_info;
+        ID3D12CommandSignature *cmd_signature;
+};
+
+// The root signature is only needed when the layout sets root constants
+void create_cmd_signature(struct gpu_device_info *device_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct gpu_cmd_signature_info *cmd_signature_info);
+void release_cmd_signature(struct gpu_cmd_signature_info *cmd_signature_info);
+// Draws min(max_count, count) records, the count buffer may be NULL to
+// always draw max_count
+void rec_execute_indirect_cmd(struct gpu_cmd_list_info *cmd_list_info,
+        struct gpu_cmd_signature_info *cmd_signature_info, UINT max_count,
+        struct gpu_resource_info *args_buffer, UINT64 args_offset,
+        struct gpu_resource_info *count_buffer, UINT64 count_offset);
+
+
 enum PSO_TYPE {
         PSO_TYPE_GRAPHICS,
         PSO_TYPE_COMPUTE
@@ -268,14 +323,22 @@ void create_pso(struct gpu_device_info *device_info,
         struct gpu_vert_input_info *vert_input_info,
         struct gpu_root_sig_info *root_sig_info,
         struct gpu_pso_info *pso_info);
-static void create_graphics_pso(struct gpu_device_info *device_info,
+// Returns FALSE and leaves pso NULL instead of exiting when creation fails
+BOOL try_create_pso(struct gpu_device_info *device_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct gpu_pso_info *pso_info);
+static HRESULT create_graphics_pso(struct gpu_device_info *device_info,
         struct gpu_vert_input_info *vert_input_info,
         struct gpu_root_sig_info *root_sig_info,
         struct gpu_pso_info *pso_info);
-static void create_compute_pso(struct gpu_device_info *device_info,
+static HRESULT create_compute_pso(struct gpu_device_info *device_info,
         struct gpu_root_sig_info *root_sig_info,
         struct gpu_pso_info *pso_info);
 void release_pso(struct gpu_pso_info *pso_info);
+// Stages are numbered vertex then pixel for graphics PSOs, compute for compute
+void set_pso_stage_shader(struct gpu_pso_info *pso_info, UINT stage,
+        struct gpu_shader_info *shader_info);
 
 
 struct gpu_viewport_info {
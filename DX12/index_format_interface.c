@@ -0,0 +1,40 @@
+#include "index_format_interface.h"
+
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INDEX_FORMAT_USE_SSE
+#include <emmintrin.h>
+#endif
+
+void narrow_indices(const unsigned int *src, unsigned short *dst,
+        unsigned int count)
+{
+        unsigned int i = 0;
+
+#if defined(INDEX_FORMAT_USE_SSE)
+        // Sign extending the low halves keeps the saturating pack from
+        // clamping those over 32767. The indices are ORed together on the
+        // way, as with a limit of 65536 they are in range when none has a
+        // bit of its high half set.
+        __m128i high = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+                __m128i b = _mm_loadu_si128((const __m128i *) (src + i + 4));
+                high = _mm_or_si128(high, _mm_or_si128(a, b));
+                a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+                b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+                _mm_storeu_si128((__m128i *) (dst + i),
+                        _mm_packs_epi32(a, b));
+        }
+
+        assert(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(high, 16),
+                _mm_setzero_si128())) == 0xffff);
+#endif
+
+        for (; i < count; ++i) {
+                assert(src[i] < INDEX_16_MAX_VERTEX_COUNT);
+                dst[i] = (unsigned short) src[i];
+        }
+}
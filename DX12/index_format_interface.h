@@ -0,0 +1,12 @@
+#ifndef INDEX_FORMAT_INTERFACE_H
+#define INDEX_FORMAT_INTERFACE_H
+
+// Meshes with up to 65536 vertices get 16 bit indices, larger ones keep
+// their 32 bit ones. Kept free of D3D types so it can run headless.
+#define INDEX_16_MAX_VERTEX_COUNT 65536
+
+// Copies 32 bit indices that all fit into 16 bits
+void narrow_indices(const unsigned int *src, unsigned short *dst,
+        unsigned int count);
+
+#endif
@@ -0,0 +1,108 @@
+#include "indirect_args_interface.h"
+
+#include <string.h>
+#include <assert.h>
+
+
+unsigned int get_indirect_arg_size(const struct indirect_arg_desc *arg_desc)
+{
+        switch (arg_desc->type) {
+                case INDIRECT_ARG_TYPE_DRAW_INDEXED :
+                        return sizeof (struct indirect_draw_indexed_args);
+
+                case INDIRECT_ARG_TYPE_ROOT_CONSTANTS :
+                        return arg_desc->num_constants * sizeof (unsigned int);
+
+                case INDIRECT_ARG_TYPE_VERTEX_BUFFER :
+                case INDIRECT_ARG_TYPE_INDEX_BUFFER :
+                        return sizeof (struct indirect_buffer_view_args);
+
+                default : return 0;
+        }
+}
+
+enum INDIRECT_LAYOUT_ERROR build_indirect_layout(
+        struct indirect_layout_info *layout_info)
+{
+        if (layout_info->arg_count > MAX_INDIRECT_ARGS)
+                return INDIRECT_LAYOUT_ERROR_TOO_MANY_ARGS;
+
+        if (layout_info->arg_count == 0)
+                return INDIRECT_LAYOUT_ERROR_NO_DRAW;
+
+        if (layout_info->args[layout_info->arg_count - 1].type !=
+                INDIRECT_ARG_TYPE_DRAW_INDEXED) {
+                for (unsigned int i = 0; i < layout_info->arg_count; ++i) {
+                        if (layout_info->args[i].type ==
+                                INDIRECT_ARG_TYPE_DRAW_INDEXED)
+                                return INDIRECT_LAYOUT_ERROR_DRAW_NOT_LAST;
+                }
+
+                return INDIRECT_LAYOUT_ERROR_NO_DRAW;
+        }
+
+        unsigned int offset = 0;
+        for (unsigned int i = 0; i < layout_info->arg_count; ++i) {
+                const struct indirect_arg_desc *arg_desc =
+                        &layout_info->args[i];
+
+                // Each argument type may only be set once per record
+                for (unsigned int j = 0; j < i; ++j) {
+                        const struct indirect_arg_desc *prev_arg_desc =
+                                &layout_info->args[j];
+                        if (prev_arg_desc->type != arg_desc->type)
+                                continue;
+
+                        switch (arg_desc->type) {
+                                case INDIRECT_ARG_TYPE_DRAW_INDEXED :
+                                        return INDIRECT_LAYOUT_ERROR_DRAW_NOT_LAST;
+
+                                case INDIRECT_ARG_TYPE_ROOT_CONSTANTS :
+                                        if (prev_arg_desc->root_param_index ==
+                                                arg_desc->root_param_index)
+                                                return INDIRECT_LAYOUT_ERROR_DUPLICATE_ROOT_PARAM;
+                                        break;
+
+                                case INDIRECT_ARG_TYPE_VERTEX_BUFFER :
+                                        if (prev_arg_desc->slot ==
+                                                arg_desc->slot)
+                                                return INDIRECT_LAYOUT_ERROR_DUPLICATE_VERTEX_SLOT;
+                                        break;
+
+                                case INDIRECT_ARG_TYPE_INDEX_BUFFER :
+                                        return INDIRECT_LAYOUT_ERROR_DUPLICATE_INDEX_BUFFER;
+
+                                default : break;
+                        }
+                }
+
+                if (arg_desc->type == INDIRECT_ARG_TYPE_ROOT_CONSTANTS &&
+                        arg_desc->num_constants == 0)
+                        return INDIRECT_LAYOUT_ERROR_NO_CONSTANTS;
+
+                // Arguments are tightly packed, all of them are a multiple
+                // of 4 bytes so the stride is too
+                layout_info->offsets[i] = offset;
+                offset += get_indirect_arg_size(arg_desc);
+        }
+
+        layout_info->stride = offset;
+
+        return INDIRECT_LAYOUT_ERROR_NONE;
+}
+
+void *get_indirect_record(const struct indirect_layout_info *layout_info,
+        void *args_data, unsigned int record_index)
+{
+        return (unsigned char *) args_data +
+                (size_t) record_index * layout_info->stride;
+}
+
+void pack_indirect_arg(const struct indirect_layout_info *layout_info,
+        void *record, unsigned int arg_index, const void *value)
+{
+        assert(arg_index < layout_info->arg_count);
+
+        memcpy((unsigned char *) record + layout_info->offsets[arg_index],
+                value, get_indirect_arg_size(&layout_info->args[arg_index]));
+}
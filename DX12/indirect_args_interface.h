@@ -0,0 +1,68 @@
+#ifndef INDIRECT_ARGS_INTERFACE_H
+#define INDIRECT_ARGS_INTERFACE_H
+
+// Layout of the records in an indirect argument buffer, one argument after
+// the other in command signature order. The argument structs match the D3D12
+// ones byte for byte but are kept free of D3D types so records can be packed
+// and checked headless.
+#define MAX_INDIRECT_ARGS 8
+
+enum INDIRECT_ARG_TYPE {
+        INDIRECT_ARG_TYPE_DRAW_INDEXED,
+        INDIRECT_ARG_TYPE_ROOT_CONSTANTS,
+        INDIRECT_ARG_TYPE_VERTEX_BUFFER,
+        INDIRECT_ARG_TYPE_INDEX_BUFFER
+};
+
+enum INDIRECT_LAYOUT_ERROR {
+        INDIRECT_LAYOUT_ERROR_NONE,
+        INDIRECT_LAYOUT_ERROR_TOO_MANY_ARGS,
+        INDIRECT_LAYOUT_ERROR_NO_DRAW,
+        INDIRECT_LAYOUT_ERROR_DRAW_NOT_LAST,
+        INDIRECT_LAYOUT_ERROR_NO_CONSTANTS,
+        INDIRECT_LAYOUT_ERROR_DUPLICATE_ROOT_PARAM,
+        INDIRECT_LAYOUT_ERROR_DUPLICATE_VERTEX_SLOT,
+        INDIRECT_LAYOUT_ERROR_DUPLICATE_INDEX_BUFFER
+};
+
+struct indirect_arg_desc {
+        enum INDIRECT_ARG_TYPE type;
+        unsigned int root_param_index; // Root constants only
+        unsigned int num_constants; // Root constants only
+        unsigned int slot; // Vertex buffers only
+};
+
+// D3D12_DRAW_INDEXED_ARGUMENTS
+struct indirect_draw_indexed_args {
+        unsigned int index_count;
+        unsigned int instance_count;
+        unsigned int start_index;
+        int base_vertex;
+        unsigned int start_instance;
+};
+
+// D3D12_VERTEX_BUFFER_VIEW and D3D12_INDEX_BUFFER_VIEW, the last member
+// being the stride or the index format
+struct indirect_buffer_view_args {
+        unsigned long long address;
+        unsigned int size;
+        unsigned int stride_or_format;
+};
+
+struct indirect_layout_info {
+        unsigned int arg_count;
+        struct indirect_arg_desc args[MAX_INDIRECT_ARGS];
+        unsigned int offsets[MAX_INDIRECT_ARGS];
+        unsigned int stride;
+};
+
+unsigned int get_indirect_arg_size(const struct indirect_arg_desc *arg_desc);
+// Fills in the offsets and stride, the draw has to be the last argument
+enum INDIRECT_LAYOUT_ERROR build_indirect_layout(
+        struct indirect_layout_info *layout_info);
+void *get_indirect_record(const struct indirect_layout_info *layout_info,
+        void *args_data, unsigned int record_index);
+void pack_indirect_arg(const struct indirect_layout_info *layout_info,
+        void *record, unsigned int arg_index, const void *value);
+
+#endif
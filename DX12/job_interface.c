@@ -0,0 +1,410 @@
+#include "job_interface.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+typedef CRITICAL_SECTION job_mutex;
+typedef CONDITION_VARIABLE job_cond;
+typedef HANDLE job_thread;
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t job_mutex;
+typedef pthread_cond_t job_cond;
+typedef pthread_t job_thread;
+#endif
+
+
+struct job {
+        job_func func;
+        void *job_data;
+        struct job_counter *counter;
+};
+
+struct job_queue {
+        job_mutex mutex;
+        job_cond job_available;
+        job_cond job_finished;
+        struct job *jobs;
+        unsigned int capacity;
+        unsigned int head;
+        unsigned int count;
+        int quit;
+        job_thread *threads;
+};
+
+struct job_range {
+        job_range_func func;
+        void *job_data;
+        unsigned int first;
+        unsigned int count;
+};
+
+
+#if defined(_WIN32)
+static void init_job_mutex(job_mutex *mutex)
+{
+        InitializeCriticalSection(mutex);
+}
+
+static void destroy_job_mutex(job_mutex *mutex)
+{
+        DeleteCriticalSection(mutex);
+}
+
+static void lock_job_mutex(job_mutex *mutex)
+{
+        EnterCriticalSection(mutex);
+}
+
+static void unlock_job_mutex(job_mutex *mutex)
+{
+        LeaveCriticalSection(mutex);
+}
+
+static void init_job_cond(job_cond *cond)
+{
+        InitializeConditionVariable(cond);
+}
+
+static void destroy_job_cond(job_cond *cond)
+{
+}
+
+static void wait_job_cond(job_cond *cond, job_mutex *mutex)
+{
+        SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static void wake_job_cond(job_cond *cond)
+{
+        WakeAllConditionVariable(cond);
+}
+
+static unsigned int get_core_count()
+{
+        SYSTEM_INFO system_info;
+        GetSystemInfo(&system_info);
+
+        return system_info.dwNumberOfProcessors;
+}
+#else
+static void init_job_mutex(job_mutex *mutex)
+{
+        pthread_mutex_init(mutex, NULL);
+}
+
+static void destroy_job_mutex(job_mutex *mutex)
+{
+        pthread_mutex_destroy(mutex);
+}
+
+static void lock_job_mutex(job_mutex *mutex)
+{
+        pthread_mutex_lock(mutex);
+}
+
+static void unlock_job_mutex(job_mutex *mutex)
+{
+        pthread_mutex_unlock(mutex);
+}
+
+static void init_job_cond(job_cond *cond)
+{
+        pthread_cond_init(cond, NULL);
+}
+
+static void destroy_job_cond(job_cond *cond)
+{
+        pthread_cond_destroy(cond);
+}
+
+static void wait_job_cond(job_cond *cond, job_mutex *mutex)
+{
+        pthread_cond_wait(cond, mutex);
+}
+
+static void wake_job_cond(job_cond *cond)
+{
+        pthread_cond_broadcast(cond);
+}
+
+static unsigned int get_core_count()
+{
+        long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        return core_count > 0 ? (unsigned int) core_count : 1;
+}
+#endif
+
+static struct job pop_job(struct job_queue *queue, unsigned int index)
+{
+        // Close the hole by moving the older jobs up one, so the others
+        // still run in the order they were submitted
+        unsigned int slot = (queue->head + index) % queue->capacity;
+        struct job job = queue->jobs[slot];
+        for (unsigned int i = index; i > 0; --i) {
+                queue->jobs[(queue->head + i) % queue->capacity] =
+                        queue->jobs[(queue->head + i - 1) % queue->capacity];
+        }
+
+        queue->head = (queue->head + 1) % queue->capacity;
+        --queue->count;
+
+        return job;
+}
+
+static void finish_job(struct job_queue *queue, struct job *job)
+{
+        job->func(job->job_data);
+
+        lock_job_mutex(&queue->mutex);
+        --job->counter->pending;
+        wake_job_cond(&queue->job_finished);
+}
+
+static void run_worker(struct job_queue *queue)
+{
+        lock_job_mutex(&queue->mutex);
+
+        for (;;) {
+                while (queue->count == 0 && !queue->quit)
+                        wait_job_cond(&queue->job_available, &queue->mutex);
+
+                if (queue->count == 0)
+                        break;
+
+                struct job job = pop_job(queue, 0);
+                unlock_job_mutex(&queue->mutex);
+
+                finish_job(queue, &job);
+        }
+
+        unlock_job_mutex(&queue->mutex);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI worker_main(LPVOID queue)
+{
+        run_worker(queue);
+
+        return 0;
+}
+#else
+static void *worker_main(void *queue)
+{
+        run_worker(queue);
+
+        return NULL;
+}
+#endif
+
+
+void create_job_system(struct job_system_info *job_system)
+{
+        // Leave one core for the thread that submits the work
+        if (job_system->worker_count == 0) {
+                unsigned int core_count = get_core_count();
+                job_system->worker_count = core_count > 1 ? core_count - 1 : 1;
+        }
+
+        struct job_queue *queue = malloc(sizeof (struct job_queue));
+        init_job_mutex(&queue->mutex);
+        init_job_cond(&queue->job_available);
+        init_job_cond(&queue->job_finished);
+        queue->capacity = 256;
+        queue->jobs = malloc(queue->capacity * sizeof (struct job));
+        queue->head = 0;
+        queue->count = 0;
+        queue->quit = 0;
+        queue->threads = malloc(job_system->worker_count *
+                sizeof (job_thread));
+
+        for (unsigned int i = 0; i < job_system->worker_count; ++i) {
+                #if defined(_WIN32)
+                queue->threads[i] = CreateThread(NULL, 0, worker_main, queue,
+                        0, NULL);
+                assert(queue->threads[i] != NULL);
+                #else
+                int result = pthread_create(&queue->threads[i], NULL,
+                        worker_main, queue);
+                assert(result == 0);
+                #endif
+        }
+
+        job_system->queue = queue;
+}
+
+void release_job_system(struct job_system_info *job_system)
+{
+        struct job_queue *queue = job_system->queue;
+
+        // Workers drain whatever is still queued before they exit
+        lock_job_mutex(&queue->mutex);
+        queue->quit = 1;
+        wake_job_cond(&queue->job_available);
+        unlock_job_mutex(&queue->mutex);
+
+        for (unsigned int i = 0; i < job_system->worker_count; ++i) {
+                #if defined(_WIN32)
+                WaitForSingleObject(queue->threads[i], INFINITE);
+                CloseHandle(queue->threads[i]);
+                #else
+                pthread_join(queue->threads[i], NULL);
+                #endif
+        }
+
+        free(queue->threads);
+        free(queue->jobs);
+        destroy_job_cond(&queue->job_finished);
+        destroy_job_cond(&queue->job_available);
+        destroy_job_mutex(&queue->mutex);
+        free(queue);
+}
+
+void init_job_counter(struct job_counter *counter)
+{
+        counter->pending = 0;
+}
+
+void submit_job(struct job_system_info *job_system, job_func func,
+        void *job_data, struct job_counter *counter)
+{
+        // Without a job system the work runs right away on the caller
+        if (job_system == NULL) {
+                func(job_data);
+                return;
+        }
+
+        struct job_queue *queue = job_system->queue;
+
+        lock_job_mutex(&queue->mutex);
+
+        if (queue->count == queue->capacity) {
+                struct job *jobs = malloc(queue->capacity * 2 *
+                        sizeof (struct job));
+                for (unsigned int i = 0; i < queue->count; ++i) {
+                        jobs[i] = queue->jobs[(queue->head + i) %
+                                queue->capacity];
+                }
+
+                free(queue->jobs);
+                queue->jobs = jobs;
+                queue->head = 0;
+                queue->capacity *= 2;
+        }
+
+        unsigned int slot = (queue->head + queue->count) % queue->capacity;
+        queue->jobs[slot].func = func;
+        queue->jobs[slot].job_data = job_data;
+        queue->jobs[slot].counter = counter;
+        ++queue->count;
+        ++counter->pending;
+
+        wake_job_cond(&queue->job_available);
+        unlock_job_mutex(&queue->mutex);
+}
+
+int is_job_done(struct job_system_info *job_system,
+        struct job_counter *counter)
+{
+        if (job_system == NULL)
+                return 1;
+
+        struct job_queue *queue = job_system->queue;
+
+        lock_job_mutex(&queue->mutex);
+        int done = counter->pending == 0;
+        unlock_job_mutex(&queue->mutex);
+
+        return done;
+}
+
+void wait_for_jobs(struct job_system_info *job_system,
+        struct job_counter *counter)
+{
+        if (job_system == NULL)
+                return;
+
+        struct job_queue *queue = job_system->queue;
+
+        lock_job_mutex(&queue->mutex);
+
+        // Help out with our own jobs only, so waiting on a short parallel
+        // loop never picks up somebody's long running background job
+        while (counter->pending > 0) {
+                unsigned int index = 0;
+                while (index < queue->count && queue->jobs[(queue->head +
+                        index) % queue->capacity].counter != counter) {
+                        ++index;
+                }
+
+                if (index == queue->count) {
+                        wait_job_cond(&queue->job_finished, &queue->mutex);
+                        continue;
+                }
+
+                struct job job = pop_job(queue, index);
+                unlock_job_mutex(&queue->mutex);
+
+                finish_job(queue, &job);
+        }
+
+        unlock_job_mutex(&queue->mutex);
+}
+
+static void run_job_range(void *job_data)
+{
+        struct job_range *range = job_data;
+
+        range->func(range->job_data, range->first, range->count);
+}
+
+void parallel_for(struct job_system_info *job_system, unsigned int count,
+        unsigned int min_chunk, job_range_func func, void *job_data)
+{
+        if (count == 0)
+                return;
+
+        // A few chunks per worker keeps them busy when chunks finish unevenly
+        unsigned int chunk_count = job_system != NULL ?
+                job_system->worker_count * 4 : 1;
+        if (min_chunk == 0)
+                min_chunk = 1;
+        if (chunk_count > (count + min_chunk - 1) / min_chunk)
+                chunk_count = (count + min_chunk - 1) / min_chunk;
+
+        if (chunk_count <= 1) {
+                func(job_data, 0, count);
+                return;
+        }
+
+        struct job_range *ranges = malloc(chunk_count *
+                sizeof (struct job_range));
+
+        struct job_counter counter;
+        init_job_counter(&counter);
+
+        unsigned int first = 0;
+        for (unsigned int i = 0; i < chunk_count; ++i) {
+                unsigned int last = (unsigned int) (((unsigned long long) count *
+                        (i + 1)) / chunk_count);
+
+                ranges[i].func = func;
+                ranges[i].job_data = job_data;
+                ranges[i].first = first;
+                ranges[i].count = last - first;
+                submit_job(job_system, run_job_range, &ranges[i], &counter);
+
+                first = last;
+        }
+
+        wait_for_jobs(job_system, &counter);
+
+        free(ranges);
+}
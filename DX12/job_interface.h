@@ -0,0 +1,32 @@
+#ifndef JOB_INTERFACE_H
+#define JOB_INTERFACE_H
+
+// Worker threads for CPU side work. Kept free of D3D types so the systems
+// built on top of it can run headless.
+
+typedef void (*job_func)(void *job_data);
+typedef void (*job_range_func)(void *job_data, unsigned int first,
+        unsigned int count);
+
+struct job_counter {
+        unsigned int pending;
+};
+
+struct job_system_info {
+        unsigned int worker_count;
+        void *queue;
+};
+
+void create_job_system(struct job_system_info *job_system);
+void release_job_system(struct job_system_info *job_system);
+void init_job_counter(struct job_counter *counter);
+void submit_job(struct job_system_info *job_system, job_func func,
+        void *job_data, struct job_counter *counter);
+int is_job_done(struct job_system_info *job_system,
+        struct job_counter *counter);
+void wait_for_jobs(struct job_system_info *job_system,
+        struct job_counter *counter);
+void parallel_for(struct job_system_info *job_system, unsigned int count,
+        unsigned int min_chunk, job_range_func func, void *job_data);
+
+#endif
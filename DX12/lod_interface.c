@@ -0,0 +1,351 @@
+#include "lod_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LOD_USE_SSE
+#include <emmintrin.h>
+#endif
+
+struct lod_select_job {
+        struct lod_info *lod_info;
+        struct lod_view *view;
+        unsigned int *indices;
+        unsigned int count;
+        unsigned int chunk_count;
+        unsigned int chunk_switched_counts[MAX_LOD_CHUNKS];
+        unsigned int chunk_level_counts[MAX_LOD_CHUNKS][MAX_MESH_LODS];
+};
+
+void create_lods(struct lod_info *lod_info)
+{
+        unsigned int capacity = lod_info->capacity;
+        assert(capacity > 0);
+
+        lod_info->count = 0;
+        lod_info->x = malloc(capacity * sizeof (float));
+        lod_info->y = malloc(capacity * sizeof (float));
+        lod_info->z = malloc(capacity * sizeof (float));
+        lod_info->radius = malloc(capacity * sizeof (float));
+        lod_info->scale = malloc(capacity * sizeof (float));
+        lod_info->mesh_indices = malloc(capacity * sizeof (unsigned int));
+        lod_info->levels = malloc(capacity * sizeof (unsigned int));
+
+        lod_info->mesh_count = 0;
+        lod_info->max_level_count = 0;
+
+        memset(&lod_info->stats, 0, sizeof (struct lod_stats));
+}
+
+void release_lods(struct lod_info *lod_info)
+{
+        free(lod_info->levels);
+        free(lod_info->mesh_indices);
+        free(lod_info->scale);
+        free(lod_info->radius);
+        free(lod_info->z);
+        free(lod_info->y);
+        free(lod_info->x);
+}
+
+unsigned int add_lod_mesh(struct lod_info *lod_info, struct mesh_info *mesh)
+{
+        assert(lod_info->mesh_count < MAX_LOD_MESHES);
+        assert(mesh->lod_count > 0 && mesh->lod_count <= MAX_MESH_LODS);
+
+        unsigned int mesh_index = lod_info->mesh_count++;
+        float *errors = lod_info->mesh_errors[mesh_index];
+
+        for (unsigned int l = 0; l < MAX_MESH_LODS; ++l) {
+                if (l < mesh->lod_count) {
+                        assert(l == 0 || mesh->lods[l].error >= errors[l - 1]);
+                        errors[l] = mesh->lods[l].error;
+                } else {
+                        errors[l] = INFINITY;
+                }
+        }
+
+        lod_info->level_counts[mesh_index] = mesh->lod_count;
+        if (mesh->lod_count > lod_info->max_level_count)
+                lod_info->max_level_count = mesh->lod_count;
+
+        return mesh_index;
+}
+
+unsigned int add_lod_instance(struct lod_info *lod_info,
+        unsigned int mesh_index, vec3 centre, float radius, float scale)
+{
+        assert(lod_info->count < lod_info->capacity);
+        assert(mesh_index < lod_info->mesh_count);
+
+        unsigned int index = lod_info->count++;
+        lod_info->mesh_indices[index] = mesh_index;
+        lod_info->levels[index] = 0;
+        set_lod_instance(lod_info, index, centre, radius, scale);
+
+        return index;
+}
+
+void set_lod_instance(struct lod_info *lod_info, unsigned int index,
+        vec3 centre, float radius, float scale)
+{
+        assert(index < lod_info->count);
+        assert(scale > 0.0f);
+
+        lod_info->x[index] = centre[0];
+        lod_info->y[index] = centre[1];
+        lod_info->z[index] = centre[2];
+        lod_info->radius[index] = radius;
+        lod_info->scale[index] = scale;
+}
+
+void set_lod_view(struct lod_view *view, vec3 eye, float fov_y,
+        float viewport_height, float error_threshold, float min_distance)
+{
+        vec3_scale(view->eye, eye, 1.0f);
+        view->projection_scale = viewport_height /
+                (2.0f * tanf(fov_y * 0.5f));
+        view->is_orthographic = 0;
+        view->error_threshold = error_threshold;
+        view->min_distance = min_distance;
+}
+
+void set_lod_orthographic_view(struct lod_view *view, float view_height,
+        float viewport_height, float error_threshold)
+{
+        assert(view_height > 0.0f);
+
+        // Every instance is taken to be one unit away, so the limits below
+        // come out the same for all of them
+        memset(view->eye, 0, sizeof (vec3));
+        view->projection_scale = viewport_height / view_height;
+        view->is_orthographic = 1;
+        view->error_threshold = error_threshold;
+        view->min_distance = 1.0f;
+}
+
+// A level is fine as long as its error is at most the limit, and the coarsest
+// fine level is one less than the count of them
+static unsigned int apply_hysteresis(unsigned int level,
+        unsigned int coarse_count, unsigned int fine_count)
+{
+        unsigned int coarse_level = coarse_count > 0 ? coarse_count - 1 : 0;
+        unsigned int fine_level = fine_count > 0 ? fine_count - 1 : 0;
+
+        if (level > fine_level)
+                level = fine_level;
+        if (level < coarse_level)
+                level = coarse_level;
+
+        return level;
+}
+
+static void select_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct lod_select_job *job = job_data;
+        struct lod_info *lod_info = job->lod_info;
+        struct lod_view *view = job->view;
+        unsigned int max_level_count = lod_info->max_level_count;
+
+        // The error a level may have is the threshold over the pixels one
+        // unit of error covers, which shrink with the distance
+        float coarse_limit = view->error_threshold * (1.0f - LOD_HYSTERESIS) /
+                view->projection_scale;
+        float fine_limit = view->error_threshold * (1.0f + LOD_HYSTERESIS) /
+                view->projection_scale;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = (unsigned int)
+                        (((unsigned long long) job->count * c) /
+                        job->chunk_count);
+                unsigned int last = (unsigned int)
+                        (((unsigned long long) job->count * (c + 1)) /
+                        job->chunk_count);
+
+                unsigned int switched_count = 0;
+                unsigned int *level_counts = job->chunk_level_counts[c];
+                memset(level_counts, 0, MAX_MESH_LODS * sizeof (unsigned int));
+
+                unsigned int i = first;
+#if defined(LOD_USE_SSE)
+                __m128 eye_x = _mm_set1_ps(view->eye[0]);
+                __m128 eye_y = _mm_set1_ps(view->eye[1]);
+                __m128 eye_z = _mm_set1_ps(view->eye[2]);
+                __m128 min_distance = _mm_set1_ps(view->min_distance);
+                __m128 coarse_limit_4 = _mm_set1_ps(coarse_limit);
+                __m128 fine_limit_4 = _mm_set1_ps(fine_limit);
+
+                for (; i + 4 <= last; i += 4) {
+                        unsigned int *indices = job->indices + i;
+                        unsigned int mesh_indices[4];
+                        for (int k = 0; k < 4; ++k) {
+                                mesh_indices[k] =
+                                        lod_info->mesh_indices[indices[k]];
+                        }
+
+                        __m128 dx = _mm_sub_ps(_mm_setr_ps(
+                                lod_info->x[indices[0]],
+                                lod_info->x[indices[1]],
+                                lod_info->x[indices[2]],
+                                lod_info->x[indices[3]]), eye_x);
+                        __m128 dy = _mm_sub_ps(_mm_setr_ps(
+                                lod_info->y[indices[0]],
+                                lod_info->y[indices[1]],
+                                lod_info->y[indices[2]],
+                                lod_info->y[indices[3]]), eye_y);
+                        __m128 dz = _mm_sub_ps(_mm_setr_ps(
+                                lod_info->z[indices[0]],
+                                lod_info->z[indices[1]],
+                                lod_info->z[indices[2]],
+                                lod_info->z[indices[3]]), eye_z);
+                        __m128 radius = _mm_setr_ps(
+                                lod_info->radius[indices[0]],
+                                lod_info->radius[indices[1]],
+                                lod_info->radius[indices[2]],
+                                lod_info->radius[indices[3]]);
+                        __m128 scale = _mm_setr_ps(
+                                lod_info->scale[indices[0]],
+                                lod_info->scale[indices[1]],
+                                lod_info->scale[indices[2]],
+                                lod_info->scale[indices[3]]);
+
+                        __m128 distance = min_distance;
+                        if (!view->is_orthographic) {
+                                distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                                        _mm_mul_ps(dx, dx),
+                                        _mm_mul_ps(dy, dy)),
+                                        _mm_mul_ps(dz, dz)));
+                                distance = _mm_max_ps(_mm_sub_ps(distance,
+                                        radius), min_distance);
+                        }
+
+                        // Limits in model units, the errors are compared
+                        // before the instance scale is applied
+                        __m128 unit_distance = _mm_div_ps(distance, scale);
+                        __m128 coarse = _mm_mul_ps(unit_distance,
+                                coarse_limit_4);
+                        __m128 fine = _mm_mul_ps(unit_distance, fine_limit_4);
+
+                        // Compare masks are -1, so subtracting counts them
+                        __m128i coarse_counts = _mm_setzero_si128();
+                        __m128i fine_counts = _mm_setzero_si128();
+                        for (unsigned int l = 0; l < max_level_count; ++l) {
+                                __m128 errors = _mm_setr_ps(
+                                        lod_info->mesh_errors[
+                                        mesh_indices[0]][l],
+                                        lod_info->mesh_errors[
+                                        mesh_indices[1]][l],
+                                        lod_info->mesh_errors[
+                                        mesh_indices[2]][l],
+                                        lod_info->mesh_errors[
+                                        mesh_indices[3]][l]);
+                                coarse_counts = _mm_sub_epi32(coarse_counts,
+                                        _mm_castps_si128(
+                                        _mm_cmple_ps(errors, coarse)));
+                                fine_counts = _mm_sub_epi32(fine_counts,
+                                        _mm_castps_si128(
+                                        _mm_cmple_ps(errors, fine)));
+                        }
+
+                        unsigned int coarse_count[4];
+                        unsigned int fine_count[4];
+                        _mm_storeu_si128((__m128i *) coarse_count,
+                                coarse_counts);
+                        _mm_storeu_si128((__m128i *) fine_count, fine_counts);
+
+                        for (int k = 0; k < 4; ++k) {
+                                unsigned int *level =
+                                        &lod_info->levels[indices[k]];
+                                unsigned int new_level = apply_hysteresis(
+                                        *level, coarse_count[k],
+                                        fine_count[k]);
+                                switched_count += new_level != *level;
+                                *level = new_level;
+                                ++level_counts[new_level];
+                        }
+                }
+#endif
+                for (; i < last; ++i) {
+                        unsigned int index = job->indices[i];
+                        float dx = lod_info->x[index] - view->eye[0];
+                        float dy = lod_info->y[index] - view->eye[1];
+                        float dz = lod_info->z[index] - view->eye[2];
+                        float distance = view->min_distance;
+                        if (!view->is_orthographic) {
+                                distance = sqrtf(dx * dx + dy * dy +
+                                        dz * dz) - lod_info->radius[index];
+                                if (distance < view->min_distance)
+                                        distance = view->min_distance;
+                        }
+
+                        float unit_distance = distance /
+                                lod_info->scale[index];
+                        float coarse = unit_distance * coarse_limit;
+                        float fine = unit_distance * fine_limit;
+
+                        float *errors = lod_info->mesh_errors[
+                                lod_info->mesh_indices[index]];
+                        unsigned int coarse_count = 0;
+                        unsigned int fine_count = 0;
+                        for (unsigned int l = 0; l < max_level_count; ++l) {
+                                coarse_count += errors[l] <= coarse;
+                                fine_count += errors[l] <= fine;
+                        }
+
+                        unsigned int *level = &lod_info->levels[index];
+                        unsigned int new_level = apply_hysteresis(*level,
+                                coarse_count, fine_count);
+                        switched_count += new_level != *level;
+                        *level = new_level;
+                        ++level_counts[new_level];
+                }
+
+                job->chunk_switched_counts[c] = switched_count;
+        }
+}
+
+void select_lods(struct lod_info *lod_info, struct lod_view *view,
+        unsigned int *indices, unsigned int count)
+{
+        double start_time = get_time_in_secs();
+
+        struct job_system_info *job_system = lod_info->job_system;
+
+        struct lod_select_job job;
+        job.lod_info = lod_info;
+        job.view = view;
+        job.indices = indices;
+        job.count = count;
+        job.chunk_count = 1;
+
+        // Short lists are selected on the calling thread
+        if (job_system != NULL && count >= LOD_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_LOD_CHUNKS)
+                        job.chunk_count = MAX_LOD_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, select_chunks, &job);
+
+        memset(&lod_info->stats, 0, sizeof (struct lod_stats));
+        lod_info->stats.selected_count = count;
+        for (unsigned int c = 0; c < job.chunk_count; ++c) {
+                lod_info->stats.switched_count +=
+                        job.chunk_switched_counts[c];
+                for (unsigned int l = 0; l < MAX_MESH_LODS; ++l) {
+                        lod_info->stats.level_counts[l] +=
+                                job.chunk_level_counts[c][l];
+                }
+        }
+
+        lod_info->stats.select_time = get_time_in_secs() - start_time;
+}
@@ -0,0 +1,78 @@
+#ifndef LOD_INTERFACE_H
+#define LOD_INTERFACE_H
+
+#include "linmath.h"
+#include "mesh_interface.h"
+#include "job_interface.h"
+
+// Level of detail selection. An instance gets the coarsest level of its mesh
+// whose geometric error, projected from the near side of the instance's
+// bounding sphere, stays under a pixel threshold. Orthographic views project
+// the error the same at any distance. An instance only moves to a coarser
+// level once that one is LOD_HYSTERESIS under the threshold, and back to a
+// finer one once its own is LOD_HYSTERESIS over it, so instances near a
+// boundary don't pop between two levels. Instances are selected four at a
+// time and long lists are split across the job system. Kept free of D3D
+// types so it can run headless.
+#define MAX_LOD_MESHES 64
+#define LOD_HYSTERESIS 0.2f
+#define LOD_PARALLEL_MIN_COUNT 16384
+#define MAX_LOD_CHUNKS 64
+
+struct lod_view {
+        vec3 eye;
+        // Pixels covered by one unit one unit away from the eye, or at any
+        // distance when the view is orthographic
+        float projection_scale;
+        int is_orthographic;
+        float error_threshold;
+        // Closest the sphere is taken to be, so the eye inside it is fine
+        float min_distance;
+};
+
+struct lod_stats {
+        unsigned int selected_count;
+        unsigned int switched_count;
+        unsigned int level_counts[MAX_MESH_LODS];
+        double select_time;
+};
+
+struct lod_info {
+        struct job_system_info *job_system;
+        unsigned int capacity;
+        unsigned int count;
+        float *x;
+        float *y;
+        float *z;
+        float *radius;
+        // Largest axis scale of the instance, which scales the mesh errors
+        float *scale;
+        unsigned int *mesh_indices;
+        // Selected level of every instance, kept between selections
+        unsigned int *levels;
+        unsigned int mesh_count;
+        unsigned int max_level_count;
+        unsigned int level_counts[MAX_LOD_MESHES];
+        // Levels past the last of a mesh have an infinite error
+        float mesh_errors[MAX_LOD_MESHES][MAX_MESH_LODS];
+        struct lod_stats stats;
+};
+
+void create_lods(struct lod_info *lod_info);
+void release_lods(struct lod_info *lod_info);
+unsigned int add_lod_mesh(struct lod_info *lod_info, struct mesh_info *mesh);
+// Instances start out at level 0
+unsigned int add_lod_instance(struct lod_info *lod_info,
+        unsigned int mesh_index, vec3 centre, float radius, float scale);
+void set_lod_instance(struct lod_info *lod_info, unsigned int index,
+        vec3 centre, float radius, float scale);
+void set_lod_view(struct lod_view *view, vec3 eye, float fov_y,
+        float viewport_height, float error_threshold, float min_distance);
+// For a view volume view_height units high
+void set_lod_orthographic_view(struct lod_view *view, float view_height,
+        float viewport_height, float error_threshold);
+// Updates the levels of the listed instances, none listed twice
+void select_lods(struct lod_info *lod_info, struct lod_view *view,
+        unsigned int *indices, unsigned int count);
+
+#endif
@@ -2,8 +2,21 @@
 #include "gpu_interface.h"
 #include "swapchain_inerface.h"
 #include "mesh_interface.h"
+#include "mesh_file_interface.h"
 #include "camera_interface.h"
 #include "material_interface.h"
+#include "bindless_interface.h"
+#include "shader_permutation_interface.h"
+#include "shader_reload_interface.h"
+#include "pso_cache_interface.h"
+#include "batch_interface.h"
+#include "draw_queue_interface.h"
+#include "cull_interface.h"
+#include "occlusion_interface.h"
+#include "transform_interface.h"
+#include "bvh_interface.h"
+#include "lod_interface.h"
+#include "job_interface.h"
 #include "error.h"
 #include "misc.h"
 
@@ -20,10 +33,20 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         wnd_info.height = 600;
         create_window(&wnd_info, hInstance, nCmdShow);
 
+        // Create job system for background work
+        struct job_system_info job_system;
+        job_system.worker_count = 0;
+        create_job_system(&job_system);
+
         // Create device
         struct gpu_device_info device_info;
         create_gpu_device(&device_info);
 
+        // Devices below resource binding tier 3 can't have the unbounded
+        // descriptor ranges, so they get bounded ones with the shaders
+        // compiled to match
+        BOOL is_bindless_bounded = check_bindless_support(&device_info) != 0;
+
         // Create render queue
         struct gpu_cmd_queue_info render_queue_info;
         create_wstring(render_queue_info.name, L"Render Queue");
@@ -183,9 +206,35 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         fence_info.num_fence_value = swp_chain_info.buffer_count;
         create_fence(&device_info, &fence_info);
 
-        // Create triangle mesh
+        // Meshes are cooked into the compressed binary mesh format the first
+        // time, with 16 bit positions, and are mapped from the file and
+        // decoded after that
+        struct mesh_file_info triangle_file;
+        strcpy(triangle_file.path, "triangle.mesh");
+        triangle_file.job_system = &job_system;
+        if (!open_mesh_file(&triangle_file)) {
+                struct mesh_info cooked_mesh;
+                create_triangle(&cooked_mesh);
+                int is_written = write_mesh_file(triangle_file.path,
+                        &cooked_mesh, VERTEX_LAYOUT_SNORM16,
+                        MESH_FILE_COMPRESSION_CODEC);
+                assert(is_written);
+                release_triangle(&cooked_mesh);
+
+                int is_open = open_mesh_file(&triangle_file);
+                assert(is_open);
+        }
+
+        // Create triangle mesh, which points into the mapped file when it is
+        // stored as is with 32 bit indices and holds a decoded copy otherwise
         struct mesh_info triangle_mesh;
-        create_triangle(&triangle_mesh);
+        int is_mesh_mapped = get_mesh_file_mesh(&triangle_file,
+                &triangle_mesh);
+        if (!is_mesh_mapped) {
+                int is_mesh_layout = copy_mesh_file_mesh(&triangle_file,
+                        &triangle_mesh);
+                assert(is_mesh_layout);
+        }
 
         // Create triangle resource
         // First resource for vertices on the GPU for shader usage
@@ -193,8 +242,8 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         create_wstring(vert_gpu_resource_info.name, L"Vert GPU resource");
         vert_gpu_resource_info.type = D3D12_HEAP_TYPE_DEFAULT;
         vert_gpu_resource_info.dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        vert_gpu_resource_info.width = sizeof (struct vertex) *
-                triangle_mesh.vertex_count;
+        vert_gpu_resource_info.width =
+                triangle_file.header->vertex_data_size;
         vert_gpu_resource_info.height = 1;
         vert_gpu_resource_info.mip_levels = 1;
         vert_gpu_resource_info.format = DXGI_FORMAT_UNKNOWN;
@@ -208,8 +257,8 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         create_wstring(vert_upload_resource_info.name, L"Vert upload resource");
         vert_upload_resource_info.type = D3D12_HEAP_TYPE_UPLOAD;
         vert_upload_resource_info.dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        vert_upload_resource_info.width = sizeof (struct vertex) *
-                triangle_mesh.vertex_count;
+        vert_upload_resource_info.width =
+                triangle_file.header->vertex_data_size;
         vert_upload_resource_info.height = 1;
         vert_upload_resource_info.mip_levels = 1;
         vert_upload_resource_info.format = DXGI_FORMAT_UNKNOWN;
@@ -219,8 +268,12 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 D3D12_RESOURCE_STATE_GENERIC_READ;
         create_resource(&device_info, &vert_upload_resource_info);
 
-        // Copy triangle vertex data from cpu to upload resource
-        upload_resources(&vert_upload_resource_info, triangle_mesh.verticies);
+        // Decode triangle vertex data from the mapped file into the upload
+        // resource
+        int is_vertex_data_copied = copy_mesh_file_vertices(&triangle_file,
+                map_resource(&vert_upload_resource_info));
+        assert(is_vertex_data_copied);
+        unmap_resource(&vert_upload_resource_info);
 
         // Copy vertex data from upload resource to gpu shader resource
         rec_copy_buffer_region_cmd(&copy_cmd_list_info,
@@ -231,11 +284,14 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         create_wstring(indices_gpu_resource_info.name, L"Indices GPU resource");
         indices_gpu_resource_info.type = D3D12_HEAP_TYPE_DEFAULT;
         indices_gpu_resource_info.dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        indices_gpu_resource_info.width = sizeof (unsigned int) *
-                triangle_mesh.index_count;
+        indices_gpu_resource_info.width =
+                triangle_file.header->index_data_size;
         indices_gpu_resource_info.height = 1;
         indices_gpu_resource_info.mip_levels = 1;
         indices_gpu_resource_info.format = DXGI_FORMAT_UNKNOWN;
+        indices_gpu_resource_info.index_format =
+                triangle_file.header->index_stride == sizeof (UINT16) ?
+                DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
         indices_gpu_resource_info.layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
         indices_gpu_resource_info.flags = D3D12_RESOURCE_FLAG_NONE;
         indices_gpu_resource_info.current_state =
@@ -248,8 +304,8 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         indices_upload_resource_info.type = D3D12_HEAP_TYPE_UPLOAD;
         indices_upload_resource_info.dimension =
                 D3D12_RESOURCE_DIMENSION_BUFFER;
-        indices_upload_resource_info.width = sizeof (unsigned int) *
-                triangle_mesh.index_count;
+        indices_upload_resource_info.width =
+                triangle_file.header->index_data_size;
         indices_upload_resource_info.height = 1;
         indices_upload_resource_info.mip_levels = 1;
         indices_upload_resource_info.format = DXGI_FORMAT_UNKNOWN;
@@ -259,7 +315,10 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 D3D12_RESOURCE_STATE_GENERIC_READ;
         create_resource(&device_info, &indices_upload_resource_info);
 
-        upload_resources(&indices_upload_resource_info, triangle_mesh.indices);
+        int is_index_data_copied = copy_mesh_file_indices(&triangle_file,
+                map_resource(&indices_upload_resource_info));
+        assert(is_index_data_copied);
+        unmap_resource(&indices_upload_resource_info);
 
         rec_copy_buffer_region_cmd(&copy_cmd_list_info,
                 &indices_gpu_resource_info, &indices_upload_resource_info);
@@ -317,83 +376,157 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         create_depthstencil_view(&device_info, &dsv_descriptor_info,
                  dsv_resource_info);
 
-        // Compile vertex shader
-        struct gpu_shader_info vert_shader_info;
-        vert_shader_info.shader_file = L"shaders\\tri_vert_shader.hlsl";
-        vert_shader_info.shader_target = "vs_5_1";
-        compile_shader(&vert_shader_info);
-
-        // Compile pixel shader
-        struct gpu_shader_info pix_shader_info;
-        pix_shader_info.shader_file = L"shaders\\tri_pix_shader.hlsl";
-        pix_shader_info.shader_target = "ps_5_1";
-        compile_shader(&pix_shader_info);
-
-        // Setup vertex input layout
-        #define ATTRIBUTE_COUNT 3
-        LPCSTR attribute_names[ATTRIBUTE_COUNT] = { "POSITION", "COLOR", 
-                "TEXCOORD" };
-        DXGI_FORMAT attribute_formats[ATTRIBUTE_COUNT] = {
+        // Gather vertex shader permutations
+        struct shader_permutation_info vert_permutation_info;
+        vert_permutation_info.shader_file = L"shaders\\tri_vert_shader.hlsl";
+        vert_permutation_info.shader_target = "vs_5_1";
+        vert_permutation_info.base_defines =
+                get_bindless_shader_defines(is_bindless_bounded);
+        create_shader_permutations(&vert_permutation_info);
+
+        // Gather pixel shader permutations and compile the ones listed in
+        // its manifest up front
+        struct shader_permutation_info pix_permutation_info;
+        pix_permutation_info.shader_file = L"shaders\\tri_pix_shader.hlsl";
+        pix_permutation_info.shader_target = "ps_5_1";
+        pix_permutation_info.base_defines =
+                get_bindless_shader_defines(is_bindless_bounded);
+        create_shader_permutations(&pix_permutation_info);
+        compile_shader_permutation_manifest(&pix_permutation_info,
+                "shaders\\tri_pix_shader.permutations");
+
+        // Setup vertex input layout from the layout of the mesh file, with
+        // the per instance transform in the second stream. The positions
+        // are quantized, the matrix that undoes that goes in front of the
+        // world matrix of each instance.
+        struct vertex_format vert_format;
+        int is_known_format = get_mesh_file_format(&triangle_file,
+                &vert_format);
+        assert(is_known_format);
+        mat4x4 triangle_dequantize_mat;
+        get_vertex_format_dequantize_mat(&vert_format,
+                triangle_dequantize_mat);
+
+        #define INSTANCE_ATTRIBUTE_COUNT 4
+        LPCSTR instance_attribute_names[INSTANCE_ATTRIBUTE_COUNT] = {
+                "INSTANCE_TRANSFORM", "INSTANCE_TRANSFORM",
+                "INSTANCE_TRANSFORM", "INSTANCE_TRANSFORM" };
+        DXGI_FORMAT instance_attribute_formats[INSTANCE_ATTRIBUTE_COUNT] = {
                 DXGI_FORMAT_R32G32B32A32_FLOAT,
                 DXGI_FORMAT_R32G32B32A32_FLOAT,
-                DXGI_FORMAT_R32G32_FLOAT
+                DXGI_FORMAT_R32G32B32A32_FLOAT,
+                DXGI_FORMAT_R32G32B32A32_FLOAT
         };
 
         struct gpu_vert_input_info vert_input_info;
-        vert_input_info.attribute_count = ATTRIBUTE_COUNT;
-        setup_vertex_input(attribute_names, attribute_formats,
+        setup_vertex_format_input(&vert_format, instance_attribute_names,
+                instance_attribute_formats, INSTANCE_ATTRIBUTE_COUNT,
                 &vert_input_info);
 
-        // Create root signature
-        struct gpu_root_param_info graphics_root_param_infos[3];
+        // Create bindless root signature
+        struct gpu_root_param_info graphics_root_param_infos[5];
 
-        graphics_root_param_infos[0].range_type =
-                D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-        graphics_root_param_infos[0].num_descriptors = 1;
+        // Per draw object and material indices
+        graphics_root_param_infos[0].param_type =
+                D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+        graphics_root_param_infos[0].num_constants =
+                sizeof (struct bindless_draw_constants) / sizeof (UINT);
+        graphics_root_param_infos[0].register_space = 0;
         graphics_root_param_infos[0].shader_visbility =
-                D3D12_SHADER_VISIBILITY_VERTEX;
+                D3D12_SHADER_VISIBILITY_ALL;
 
-        graphics_root_param_infos[1].range_type =
-                D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-        graphics_root_param_infos[1].num_descriptors = 1;
-        graphics_root_param_infos[1].shader_visbility =
-                D3D12_SHADER_VISIBILITY_PIXEL;
+        // Constant buffer, texture and read/write ranges which all start at
+        // the beginning of the bindless heap, unbounded where the device
+        // allows
+        D3D12_DESCRIPTOR_RANGE_TYPE bindless_range_types[3] = {
+                D3D12_DESCRIPTOR_RANGE_TYPE_CBV,
+                D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+                D3D12_DESCRIPTOR_RANGE_TYPE_UAV
+        };
+        UINT bindless_range_spaces[3] = { BINDLESS_CBV_SPACE,
+                BINDLESS_SRV_SPACE, BINDLESS_UAV_SPACE };
+
+        for (UINT i = 0; i < 3; ++i) {
+                graphics_root_param_infos[i + 1].param_type =
+                        D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+                graphics_root_param_infos[i + 1].range_type =
+                        bindless_range_types[i];
+                graphics_root_param_infos[i + 1].num_descriptors =
+                        get_bindless_range_size(bindless_range_types[i],
+                        is_bindless_bounded);
+                graphics_root_param_infos[i + 1].register_space =
+                        bindless_range_spaces[i];
+                graphics_root_param_infos[i + 1].shader_visbility =
+                        D3D12_SHADER_VISIBILITY_ALL;
+        }
 
-        graphics_root_param_infos[2].range_type =
+        graphics_root_param_infos[4].param_type =
+                D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+        graphics_root_param_infos[4].range_type =
                 D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER;
-        graphics_root_param_infos[2].num_descriptors = 1;
-        graphics_root_param_infos[2].shader_visbility =
+        graphics_root_param_infos[4].num_descriptors = 1;
+        graphics_root_param_infos[4].register_space = 0;
+        graphics_root_param_infos[4].shader_visbility =
                 D3D12_SHADER_VISIBILITY_PIXEL;
 
         struct gpu_root_sig_info graphics_root_sig_info;
         create_wstring(graphics_root_sig_info.name, L"Graphics Root sig");
-        create_root_sig(&device_info, graphics_root_param_infos, 3,
+        create_root_sig(&device_info, graphics_root_param_infos, 5,
                 &graphics_root_sig_info);
 
-        // Create graphics pipeline state object
-        struct gpu_pso_info graphics_pso_info;
-        create_wstring(graphics_pso_info.name, L"Graphics PSO");
-        graphics_pso_info.type = PSO_TYPE_GRAPHICS;
-        graphics_pso_info.graphics_pso_info.vert_shader_byte_code =
-                vert_shader_info.shader_byte_code;
-        graphics_pso_info.graphics_pso_info.vert_shader_byte_code_len =
-                vert_shader_info.shader_byte_code_len;
-        graphics_pso_info.graphics_pso_info.pix_shader_byte_code =
-                pix_shader_info.shader_byte_code;
-        graphics_pso_info.graphics_pso_info.pix_shader_byte_code_len =
-                pix_shader_info.shader_byte_code_len;
-        graphics_pso_info.graphics_pso_info.dom_shader_byte_code = NULL;
-        graphics_pso_info.graphics_pso_info.dom_shader_byte_code_len = 0;
-        graphics_pso_info.graphics_pso_info.hull_shader_byte_code = NULL;
-        graphics_pso_info.graphics_pso_info.hull_shader_byte_code_len = 0;
-        graphics_pso_info.graphics_pso_info.geom_shader_byte_code = NULL;
-        graphics_pso_info.graphics_pso_info.geom_shader_byte_code_len = 0;
-        graphics_pso_info.graphics_pso_info.render_target_format =
+        // Gather compute shader permutations
+        struct shader_permutation_info comp_permutation_info;
+        comp_permutation_info.shader_file = L"shaders\\tri_comp_shader.hlsl";
+        comp_permutation_info.shader_target = "cs_5_1";
+        comp_permutation_info.base_defines = NULL;
+        create_shader_permutations(&comp_permutation_info);
+
+        // Watch shader sources and reload them while running
+        struct shader_reload_info shader_reload_info;
+        shader_reload_info.device_info = &device_info;
+        shader_reload_info.job_system = &job_system;
+        shader_reload_info.frame_latency = swp_chain_info.buffer_count;
+        strcpy(shader_reload_info.file_watch.directory, "shaders");
+        create_shader_reload(&shader_reload_info);
+        add_reload_shader(&shader_reload_info, &vert_permutation_info);
+        add_reload_shader(&shader_reload_info, &pix_permutation_info);
+        add_reload_shader(&shader_reload_info, &comp_permutation_info);
+
+        // Create PSO cache, PSOs are created from templates on first use and
+        // handed to shader reload once built
+        struct pso_cache_info pso_cache_info;
+        pso_cache_info.device_info = &device_info;
+        pso_cache_info.job_system = &job_system;
+        pso_cache_info.reload_info = &shader_reload_info;
+        create_pso_cache(&pso_cache_info);
+
+        // Create graphics pipeline state template
+        struct gpu_pso_info graphics_pso_template_info;
+        create_wstring(graphics_pso_template_info.name, L"Graphics PSO");
+        graphics_pso_template_info.type = PSO_TYPE_GRAPHICS;
+        graphics_pso_template_info.graphics_pso_info.dom_shader_byte_code =
+                NULL;
+        graphics_pso_template_info.graphics_pso_info.dom_shader_byte_code_len =
+                0;
+        graphics_pso_template_info.graphics_pso_info.hull_shader_byte_code =
+                NULL;
+        graphics_pso_template_info.graphics_pso_info.hull_shader_byte_code_len =
+                0;
+        graphics_pso_template_info.graphics_pso_info.geom_shader_byte_code =
+                NULL;
+        graphics_pso_template_info.graphics_pso_info.geom_shader_byte_code_len =
+                0;
+        graphics_pso_template_info.graphics_pso_info.render_target_format =
                 tmp_rtv_resource_info[swp_chain_info.current_buffer_index].format;
-        graphics_pso_info.graphics_pso_info.depth_target_format =
+        graphics_pso_template_info.graphics_pso_info.depth_target_format =
                 dsv_resource_info[swp_chain_info.current_buffer_index].format;
-        create_pso(&device_info, &vert_input_info, &graphics_root_sig_info,
-                &graphics_pso_info);
+
+        struct shader_permutation_info *graphics_stage_shaders[] = {
+                &vert_permutation_info, &pix_permutation_info };
+        UINT graphics_pso_template = add_pso_template(&pso_cache_info,
+                "tri_graphics", &graphics_pso_template_info,
+                &vert_input_info, &graphics_root_sig_info,
+                graphics_stage_shaders, 2);
 
         // Now we need to create a view port for the screen we are going to be drawing to
         struct gpu_viewport_info viewport_info;
@@ -405,50 +538,56 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         struct gpu_scissor_rect_info scissor_rect_info;
         create_scissor_rect(&scissor_rect_info);
 
-        // Calculate project view matrix
-        struct camera_info cam_info;
-        calc_pv_mat(&cam_info);
+        // The main view looks straight at the grid, which fills its view
+        // volume just as it fills clip space
+        struct camera_views_info camera_views_info;
+        camera_views_info.job_system = &job_system;
+        create_camera_views(&camera_views_info);
+
+        vec3 main_eye = { 0.0f, 0.0f, 1.0f };
+        vec3 view_target = { 0.0f, 0.0f, 0.0f };
+        vec3 view_up = { 0.0f, 1.0f, 0.0f };
+        UINT main_view = add_orthographic_view(&camera_views_info, main_eye,
+                view_target, view_up, 2.0f, 2.0f, 0.0f, 2.0f);
+        update_camera_views(&camera_views_info);
+
+        struct camera_info *cam_info =
+                &camera_views_info.views[main_view].camera_info;
 
         // Create sampler descriptor
         struct gpu_descriptor_info sampler_descriptor_info;
         create_wstring(sampler_descriptor_info.name, L"Sampler heap");
         sampler_descriptor_info.type = D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER;
         sampler_descriptor_info.num_descriptors =
-                graphics_root_param_infos[2].num_descriptors;
+                graphics_root_param_infos[4].num_descriptors;
         sampler_descriptor_info.flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
         create_descriptor(&device_info, &sampler_descriptor_info);
 
         // Create sampler
         create_sampler(&device_info, &sampler_descriptor_info);
 
-        // Create constant buffer and texture resource descriptor
-        struct gpu_descriptor_info graphics_cbv_srv_uav_descriptor_info;
-        create_wstring(graphics_cbv_srv_uav_descriptor_info.name,
-                L"Graphics CBV heap");
-        graphics_cbv_srv_uav_descriptor_info.type =
-                D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-        graphics_cbv_srv_uav_descriptor_info.num_descriptors =
-                swp_chain_info.buffer_count *
-                (graphics_root_param_infos[0].num_descriptors +
-                graphics_root_param_infos[1].num_descriptors);
-        graphics_cbv_srv_uav_descriptor_info.flags =
-                D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-        create_descriptor(&device_info, &graphics_cbv_srv_uav_descriptor_info);
+        // Create global shader visible heap for bindless resources
+        struct bindless_heap_info bindless_heap_info;
+        create_wstring(bindless_heap_info.descriptor_info.name,
+                L"Bindless heap");
+        bindless_heap_info.descriptor_info.num_descriptors = 4096;
+        bindless_heap_info.frame_latency = swp_chain_info.buffer_count;
+        bindless_heap_info.is_bounded = is_bindless_bounded;
+        create_bindless_heap(&device_info, &bindless_heap_info);
 
         // Create constant buffer resource
         struct gpu_resource_info *graphics_cbv_resource_info;
-        graphics_cbv_resource_info = malloc(
-                (swp_chain_info.buffer_count * 
-                graphics_root_param_infos[0].num_descriptors) *
+        graphics_cbv_resource_info = malloc(swp_chain_info.buffer_count *
                 sizeof (struct gpu_resource_info));
-        for (UINT i = 0; i < swp_chain_info.buffer_count *
-                graphics_root_param_infos[0].num_descriptors; ++i) {
+        UINT *object_indices = malloc(swp_chain_info.buffer_count *
+                sizeof (UINT));
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
                 create_wstring(graphics_cbv_resource_info[i].name,
                         L"Graphics CBV resource %d", i);
                 graphics_cbv_resource_info[i].type = D3D12_HEAP_TYPE_UPLOAD;
                 graphics_cbv_resource_info[i].dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
                 graphics_cbv_resource_info[i].width =
-                        align_offset(sizeof (cam_info.pv_mat), 256);
+                        align_offset(sizeof (cam_info->pv_mat), 256);
                 graphics_cbv_resource_info[i].height = 1;
                 graphics_cbv_resource_info[i].mip_levels = 1;
                 graphics_cbv_resource_info[i].format = DXGI_FORMAT_UNKNOWN;
@@ -459,15 +598,11 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 create_resource(&device_info, &graphics_cbv_resource_info[i]);
 
                 // Upload constant buffer resource
-                upload_resources(&graphics_cbv_resource_info[i], cam_info.pv_mat);
-
-                update_cpu_handle(&graphics_cbv_srv_uav_descriptor_info,
-                        swp_chain_info.buffer_count * i);
+                upload_resources(&graphics_cbv_resource_info[i], cam_info->pv_mat);
 
-                // Create constant buffer view
-                create_constant_buffer_view(&device_info,
-                        &graphics_cbv_srv_uav_descriptor_info,
-                        &graphics_cbv_resource_info[i]);
+                // Create constant buffer view at a stable bindless index
+                object_indices[i] = create_bindless_cbv(&device_info,
+                        &bindless_heap_info, &graphics_cbv_resource_info[i]);
         }
 
         // Get checker board texture material
@@ -494,13 +629,12 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         // Create texture resource
         struct gpu_resource_info *tex_resource_info;
-        tex_resource_info = malloc(
-                (swp_chain_info.buffer_count *
-                graphics_root_param_infos[1].num_descriptors) *
+        tex_resource_info = malloc(swp_chain_info.buffer_count *
                 sizeof (struct gpu_resource_info));
+        UINT *material_indices = malloc(swp_chain_info.buffer_count *
+                sizeof (UINT));
 
-        for (UINT i = 0; i < swp_chain_info.buffer_count *
-                graphics_root_param_infos[1].num_descriptors; ++i) {
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
                 create_wstring(tex_resource_info[i].name,
                         L"Tex resource %d", i);
                 tex_resource_info[i].type = D3D12_HEAP_TYPE_DEFAULT;
@@ -514,12 +648,24 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 tex_resource_info[i].current_state = D3D12_RESOURCE_STATE_COPY_DEST;
                 create_resource(&device_info, &tex_resource_info[i]);
 
-                update_cpu_handle(&graphics_cbv_srv_uav_descriptor_info,
-                        swp_chain_info.buffer_count * i + 1);
+                // Create shader resource view at a stable bindless index
+                material_indices[i] = create_bindless_srv(&device_info,
+                        &bindless_heap_info, &tex_resource_info[i]);
+        }
+
+        // Views that got no index can't be drawn with, which only happens
+        // when the heap or the bounded ranges are too small for them
+        BOOL is_bindless_full = FALSE;
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
+                is_bindless_full |=
+                        object_indices[i] == BINDLESS_INVALID_INDEX ||
+                        material_indices[i] == BINDLESS_INVALID_INDEX;
+        }
 
-                // Create shader resource view
-                create_shader_resource_view(&device_info, 
-                        &graphics_cbv_srv_uav_descriptor_info, &tex_resource_info[i]);
+        if (is_bindless_full) {
+                MessageBox(NULL, "The bindless heap has no room for the "
+                        "startup resources", "Error", MB_OK);
+                return EXIT_FAILURE;
         }
 
         // Make sure vertex and index upload is done before copy command allocator and list is reset
@@ -530,8 +676,7 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         reset_cmd_list(&copy_cmd_allocator_info, &copy_cmd_list_info,
                 swp_chain_info.current_buffer_index);
 
-        for (UINT i = 0; i < swp_chain_info.buffer_count *
-                graphics_root_param_infos[1].num_descriptors; ++i) {
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
                 rec_copy_texture_region_cmd(&copy_cmd_list_info,
                         &tex_resource_info[i], &tex_upload_resource_info);
 
@@ -541,8 +686,7 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         // Transition texture shader resource to read/write buffer
         transition_resources(&copy_cmd_list_info, transition_resource_info_list,
-                transition_resource_states_list, swp_chain_info.buffer_count *
-                graphics_root_param_infos[1].num_descriptors);
+                transition_resource_states_list, swp_chain_info.buffer_count);
 
         // Close command list for execution
         close_cmd_list(&copy_cmd_list_info);
@@ -558,24 +702,24 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         wait_for_fence(&compute_queue_info, &fence_info,
                 swp_chain_info.current_buffer_index);
 
-        // Compile compute shader
-        struct gpu_shader_info comp_shader_info;
-        comp_shader_info.shader_file = L"shaders\\tri_comp_shader.hlsl";
-        comp_shader_info.shader_target = "cs_5_1";
-        compile_shader(&comp_shader_info);
-
         // Create compute root signature
         struct gpu_root_param_info compute_root_param_infos[2];
 
+        compute_root_param_infos[0].param_type =
+                D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
         compute_root_param_infos[0].range_type =
                 D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
         compute_root_param_infos[0].num_descriptors = 1;
+        compute_root_param_infos[0].register_space = 0;
         compute_root_param_infos[0].shader_visbility =
                 D3D12_SHADER_VISIBILITY_ALL;
 
+        compute_root_param_infos[1].param_type =
+                D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
         compute_root_param_infos[1].range_type =
                 D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
         compute_root_param_infos[1].num_descriptors = 1;
+        compute_root_param_infos[1].register_space = 0;
         compute_root_param_infos[1].shader_visbility =
                 D3D12_SHADER_VISIBILITY_ALL;
 
@@ -584,16 +728,169 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         create_root_sig(&device_info, compute_root_param_infos, 2,
                 &compute_root_sig_info);
 
-        // Create compute pipeline state object
-        struct gpu_pso_info compute_pso_info;
-        create_wstring(compute_pso_info.name, L"Compute PSO");
-        compute_pso_info.type = PSO_TYPE_COMPUTE;
-        compute_pso_info.compute_pso_info.comp_shader_byte_code =
-                comp_shader_info.shader_byte_code;
-        compute_pso_info.compute_pso_info.comp_shader_byte_code_len =
-                comp_shader_info.shader_byte_code_len;
-        create_pso(&device_info, NULL, &compute_root_sig_info,
-                &compute_pso_info);
+        // Create compute pipeline state template
+        struct gpu_pso_info compute_pso_template_info;
+        create_wstring(compute_pso_template_info.name, L"Compute PSO");
+        compute_pso_template_info.type = PSO_TYPE_COMPUTE;
+
+        struct shader_permutation_info *compute_stage_shaders[] = {
+                &comp_permutation_info };
+        UINT compute_pso_template = add_pso_template(&pso_cache_info,
+                "tri_compute", &compute_pso_template_info, NULL,
+                &compute_root_sig_info, compute_stage_shaders, 1);
+
+        // Start creating the PSOs previous runs used, in order of first use
+        prewarm_pso_cache(&pso_cache_info, "pso_cache.manifest");
+
+        // Draw with the plain pixel shader while other graphics PSOs build
+        LPCSTR vert_features[] = { "USE_INSTANCING" };
+        UINT vert_instancing_key = get_shader_permutation_key(
+                &vert_permutation_info, vert_features, 1);
+        UINT graphics_fallback_keys[] = { vert_instancing_key, 0 };
+        set_pso_fallback(&pso_cache_info, graphics_pso_template,
+                graphics_fallback_keys);
+
+        // Request graphics pipeline state object for the textured and vertex
+        // coloured pixel shader, built in the background
+        LPCSTR pix_features[] = { "USE_TEXTURE", "USE_VERTEX_COLOUR" };
+        UINT graphics_stage_keys[] = { vert_instancing_key,
+                get_shader_permutation_key(&pix_permutation_info,
+                pix_features, 2) };
+        UINT graphics_pso_handle = request_pso(&pso_cache_info,
+                graphics_pso_template, graphics_stage_keys);
+
+        // Create the draw batcher, which instances draws of the same mesh,
+        // PSO and material
+        struct batch_info batch_info;
+        batch_info.job_system = &job_system;
+        batch_info.frame_count = swp_chain_info.buffer_count;
+        batch_info.max_instances = 4096;
+        create_batch(&device_info, &batch_info);
+
+        UINT triangle_batch_mesh = add_batch_mesh(&batch_info,
+                &vert_gpu_resource_info, vert_format.stride,
+                &indices_gpu_resource_info, triangle_mesh.lods[0].index_count,
+                triangle_mesh.lods[0].first_index, 0);
+        for (UINT l = 1; l < triangle_mesh.lod_count; ++l) {
+                add_batch_mesh_lod(&batch_info, triangle_batch_mesh,
+                        triangle_mesh.lods[l].index_count,
+                        triangle_mesh.lods[l].first_index);
+        }
+
+        // Transforms and bounding spheres of a grid of triangles, culled
+        // against the camera every frame before they are batched. The grid
+        // triangles are children of a root transform, grid triangle i is
+        // transform i + 1.
+        #define GRID_SIZE 8
+        struct transform_info transform_info;
+        transform_info.job_system = &job_system;
+        transform_info.capacity = GRID_SIZE * GRID_SIZE + 1;
+        create_transforms(&transform_info);
+
+        UINT grid_root = add_transform(&transform_info, TRANSFORM_NO_PARENT);
+
+        struct cull_volume_info grid_volume_info;
+        grid_volume_info.type = CULL_VOLUME_TYPE_SPHERE;
+        grid_volume_info.capacity = GRID_SIZE * GRID_SIZE;
+        create_cull_volumes(&grid_volume_info);
+
+        for (UINT y = 0; y < GRID_SIZE; ++y) {
+                for (UINT x = 0; x < GRID_SIZE; ++x) {
+                        vec3 centre = {
+                                (x + 0.5f) * 2.0f / GRID_SIZE - 1.0f,
+                                (y + 0.5f) * 2.0f / GRID_SIZE - 1.0f,
+                                0.0f
+                        };
+                        add_cull_sphere(&grid_volume_info, centre,
+                                1.4142136f / GRID_SIZE);
+
+                        vec3 scale = {
+                                1.0f / GRID_SIZE, 1.0f / GRID_SIZE, 1.0f
+                        };
+                        UINT i = add_transform(&transform_info, grid_root);
+                        set_transform_position(&transform_info, i, centre);
+                        set_transform_scale(&transform_info, i, scale);
+                }
+        }
+
+        // The cursor picks grid triangles through a BVH over the boxes
+        // around their spheres, item i is grid triangle i. The picked one
+        // is left out of the draws.
+        struct bvh_info grid_bvh_info;
+        grid_bvh_info.job_system = &job_system;
+        grid_bvh_info.max_items = grid_volume_info.count;
+        create_bvh(&grid_bvh_info);
+
+        for (UINT i = 0; i < grid_volume_info.count; ++i) {
+                float r = grid_volume_info.radius[i];
+                vec3 min = {
+                        grid_volume_info.x[i] - r, grid_volume_info.y[i] - r,
+                        grid_volume_info.z[i] - r
+                };
+                vec3 max = {
+                        grid_volume_info.x[i] + r, grid_volume_info.y[i] + r,
+                        grid_volume_info.z[i] + r
+                };
+                add_bvh_item(&grid_bvh_info, min, max);
+        }
+
+        build_bvh(&grid_bvh_info);
+
+        // Levels of detail are picked for the visible grid triangles, as
+        // seen through the main view, which is orthographic and two units
+        // high
+        struct lod_info grid_lod_info;
+        grid_lod_info.job_system = &job_system;
+        grid_lod_info.capacity = grid_volume_info.count;
+        create_lods(&grid_lod_info);
+
+        UINT triangle_lod_mesh = add_lod_mesh(&grid_lod_info, &triangle_mesh);
+        for (UINT i = 0; i < grid_volume_info.count; ++i) {
+                vec3 centre = {
+                        grid_volume_info.x[i], grid_volume_info.y[i],
+                        grid_volume_info.z[i]
+                };
+                add_lod_instance(&grid_lod_info, triangle_lod_mesh, centre,
+                        grid_volume_info.radius[i], 1.0f / GRID_SIZE);
+        }
+
+        struct lod_view grid_lod_view;
+        set_lod_orthographic_view(&grid_lod_view, 2.0f,
+                (float) wnd_info.height, 1.0f);
+
+        UINT *visible_grid_indices = malloc(grid_volume_info.capacity *
+                sizeof (UINT));
+
+        UINT *grid_view_masks = malloc(grid_volume_info.capacity *
+                sizeof (UINT));
+
+        // Create the occlusion culler, the grid triangles are drawn into its
+        // depth buffer and hide what is behind them
+        struct occlusion_info occlusion_info;
+        occlusion_info.job_system = &job_system;
+        occlusion_info.width = 256;
+        occlusion_info.height = 128;
+        occlusion_info.max_occluders = GRID_SIZE * GRID_SIZE;
+        occlusion_info.max_triangles = 4096;
+        create_occlusion(&occlusion_info);
+
+        // Create the draw queue, which orders the draws of a frame by layer,
+        // PSO, material and depth and submits each PSO's draws with a single
+        // ExecuteIndirect
+        struct draw_queue_info draw_queue_info;
+        draw_queue_info.pso_cache_info = &pso_cache_info;
+        draw_queue_info.job_system = &job_system;
+        draw_queue_info.root_sig_info = &graphics_root_sig_info;
+        draw_queue_info.draw_constants_param = 0;
+        draw_queue_info.max_packets = 4096;
+        draw_queue_info.is_indirect = TRUE;
+        draw_queue_info.frame_count = swp_chain_info.buffer_count;
+        create_draw_queue(&device_info, &draw_queue_info);
+
+        // Get compute pipeline state object
+        UINT compute_stage_keys[] = { 0 };
+        struct gpu_pso_info *compute_pso_info = get_cached_pso(
+                &pso_cache_info, compute_pso_template, compute_stage_keys);
 
         // Create constant buffer descriptor for compute
         struct gpu_descriptor_info compute_cbv_srv_uav_descriptor_info;
@@ -689,7 +986,7 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
                 // Set pipeline state
                 rec_set_pipeline_state_cmd(&compute_cmd_list_info,
-                        &compute_pso_info);
+                        compute_pso_info);
 
                 // Set root signature
                 rec_set_compute_root_sig_cmd(&compute_cmd_list_info,
@@ -767,10 +1064,6 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 rec_clear_dsv_cmd(&render_cmd_list_info,
                         &dsv_descriptor_info);
 
-                // Set pipeline state
-                rec_set_pipeline_state_cmd(&render_cmd_list_info,
-                        &graphics_pso_info);
-
                 // Set viewport
                 rec_set_viewport_cmd(&render_cmd_list_info, &viewport_info);
 
@@ -786,48 +1079,115 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                 rec_set_graphics_root_sig_cmd(&render_cmd_list_info,
                         &graphics_root_sig_info);
 
-                // Set descriptor heap for constant buffer and texture resource
-                rec_set_descriptor_heap_cmd(&render_cmd_list_info,
-                        &graphics_cbv_srv_uav_descriptor_info);
-
-                update_gpu_handle(&graphics_cbv_srv_uav_descriptor_info,
-                        swp_chain_info.buffer_count *
-                        swp_chain_info.current_buffer_index);
-
-                // Set constant buffer table
-                rec_set_graphics_root_descriptor_table_cmd(
-                        &render_cmd_list_info, 0,
-                        &graphics_cbv_srv_uav_descriptor_info);
+                // Set bindless and sampler descriptor heaps
+                struct gpu_descriptor_info *descriptor_info_list[2];
+                descriptor_info_list[0] = &bindless_heap_info.descriptor_info;
+                descriptor_info_list[1] = &sampler_descriptor_info;
 
-                update_gpu_handle(&graphics_cbv_srv_uav_descriptor_info,
-                        (swp_chain_info.buffer_count *
-                        swp_chain_info.current_buffer_index) + 1);
+                rec_set_descriptor_heaps_cmd(&render_cmd_list_info,
+                        descriptor_info_list, 2);
 
-                // Set shader resource table
-                rec_set_graphics_root_descriptor_table_cmd(
-                        &render_cmd_list_info, 1,
-                        &graphics_cbv_srv_uav_descriptor_info);
+                // Set unbounded constant buffer, texture and read/write tables
+                update_gpu_handle(&bindless_heap_info.descriptor_info, 0);
 
-                // Set descriptor heap for sampler
-                rec_set_descriptor_heap_cmd(&render_cmd_list_info,
-                        &sampler_descriptor_info);
+                for (UINT i = 1; i <= 3; ++i) {
+                        rec_set_graphics_root_descriptor_table_cmd(
+                                &render_cmd_list_info, i,
+                                &bindless_heap_info.descriptor_info);
+                }
 
                 // Set sampler table
                 rec_set_graphics_root_descriptor_table_cmd(
-                        &render_cmd_list_info, 2,
+                        &render_cmd_list_info, 4,
                         &sampler_descriptor_info);
 
-                // Set vertex buffer
-                rec_set_vertex_buffer_cmd(&render_cmd_list_info,
-                        &vert_gpu_resource_info, sizeof (struct vertex));
-
-                // Set index buffer
-                rec_set_index_buffer_cmd(&render_cmd_list_info,
-                        &indices_gpu_resource_info);
+                // Draw the visible part of the grid of triangles, which the
+                // batcher turns into a single instanced draw
+                update_transforms(&transform_info);
+                mat4x4 *grid_transforms = transform_info.world_mats +
+                        grid_root + 1;
+
+                cull_camera_views(&camera_views_info, &grid_volume_info,
+                        grid_view_masks);
+                UINT visible_grid_count = get_view_visible_indices(
+                        grid_view_masks, grid_volume_info.count, main_view,
+                        visible_grid_indices);
+
+                // Cast the cursor from the near to the far plane of the main
+                // view
+                UINT picked_grid_index = BVH_NO_ITEM;
+                POINT cursor;
+                if (GetCursorPos(&cursor) &&
+                        ScreenToClient(wnd_info.hwnd, &cursor)) {
+                        vec4 ndc_near = {
+                                cursor.x * 2.0f / wnd_info.width - 1.0f,
+                                1.0f - cursor.y * 2.0f / wnd_info.height,
+                                0.0f, 1.0f
+                        };
+                        vec4 ndc_far = {
+                                ndc_near[0], ndc_near[1], 1.0f, 1.0f
+                        };
+
+                        mat4x4 inv_pv_mat;
+                        mat4x4_invert(inv_pv_mat, cam_info->pv_mat);
+                        vec4 ray_near, ray_far;
+                        mat4x4_mul_vec4(ray_near, inv_pv_mat, ndc_near);
+                        mat4x4_mul_vec4(ray_far, inv_pv_mat, ndc_far);
+
+                        vec3 ray_origin, ray_dir;
+                        for (int k = 0; k < 3; ++k) {
+                                ray_origin[k] = ray_near[k] / ray_near[3];
+                                ray_dir[k] = ray_far[k] / ray_far[3] -
+                                        ray_origin[k];
+                        }
+
+                        float hit_t;
+                        picked_grid_index = query_bvh_ray(&grid_bvh_info,
+                                ray_origin, ray_dir, 1.0f, &hit_t);
+                }
+
+                begin_occlusion(&occlusion_info, cam_info->pv_mat);
+                for (UINT i = 0; i < visible_grid_count; ++i) {
+                        add_occluder(&occlusion_info, &triangle_mesh, 0,
+                                grid_transforms[visible_grid_indices[i]]);
+                }
+                rasterize_occluders(&occlusion_info);
+
+                visible_grid_count = cull_occluded_volumes(&occlusion_info,
+                        &grid_volume_info, visible_grid_indices,
+                        visible_grid_count, visible_grid_indices);
+
+                select_lods(&grid_lod_info, &grid_lod_view,
+                        visible_grid_indices, visible_grid_count);
+
+                begin_batch(&batch_info, swp_chain_info.current_buffer_index);
+
+                for (UINT i = 0; i < visible_grid_count; ++i) {
+                        if (visible_grid_indices[i] == picked_grid_index)
+                                continue;
+
+                        mat4x4 draw_mat;
+                        mat4x4_mul(draw_mat,
+                                grid_transforms[visible_grid_indices[i]],
+                                triangle_dequantize_mat);
+                        add_batch_draw(&batch_info, triangle_batch_mesh,
+                                grid_lod_info.levels[visible_grid_indices[i]],
+                                graphics_pso_handle, material_indices[
+                                swp_chain_info.current_buffer_index],
+                                draw_mat);
+                }
+
+                build_batch(&batch_info);
+
+                reset_draw_queue(&draw_queue_info,
+                        swp_chain_info.current_buffer_index);
+                queue_batch_draws(&batch_info, &draw_queue_info, 0, 0.0f,
+                        object_indices[swp_chain_info.current_buffer_index]);
 
-                // Draw indexed instanced
-                rec_draw_indexed_instance_cmd(&render_cmd_list_info,
-                        triangle_mesh.index_count, 1);
+                // Sort the draws, then set their pipelines, buffers and per
+                // draw object and material indices and draw them
+                sort_draw_queue(&draw_queue_info);
+                rec_draw_queue_cmds(&render_cmd_list_info, &draw_queue_info);
 
                 transition_resource_info_list[0] =
                         &tex_resource_info[swp_chain_info.current_buffer_index];
@@ -929,6 +1289,15 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
                         &present_cmd_list_info,
                         swp_chain_info.current_buffer_index);
 
+                // Recycle bindless indices no frame in flight can reference
+                advance_bindless_frame(&bindless_heap_info);
+
+                // Swap in reloaded shaders between frames
+                update_shader_reload(&shader_reload_info);
+
+                // Pick up PSOs finished in the background
+                update_pso_cache(&pso_cache_info);
+
         } while (queued_window_msg != WM_QUIT);
 
         // Wait for GPU to finish up be starting the cleaning
@@ -937,6 +1306,11 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         wait_for_gpu(&fence_info, swp_chain_info.current_buffer_index);
 
+        // Release shader reload and anything it retired, once no PSO is
+        // being built from those shaders
+        wait_for_pso_cache(&pso_cache_info);
+        release_shader_reload(&shader_reload_info);
+
         for (UINT i = 0; i < swp_chain_info.buffer_count *
                 compute_root_param_infos[0].num_descriptors; ++i) {
                 release_resource(&compute_cbv_resource_info[i]);
@@ -946,49 +1320,65 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
         release_descriptor(&compute_cbv_srv_uav_descriptor_info);
 
-        // Release compute pipline state object
-        release_pso(&compute_pso_info);
 
         release_root_sig(&compute_root_sig_info);
 
-        // Release compute shader
-        release_shader(&comp_shader_info);
+        // Release compute shader permutations
+        release_shader_permutations(&comp_permutation_info);
 
-        for (UINT i = 0; i < swp_chain_info.buffer_count *
-            graphics_root_param_infos[1].num_descriptors; ++i) {
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
             release_resource(&tex_resource_info[i]);
         }
 
+        free(material_indices);
+
         free(tex_resource_info);
 
         release_resource(&tex_upload_resource_info);
 
         release_material(&checkerboard_mat_info);
 
-        for (UINT i = 0; i < swp_chain_info.buffer_count *
-            graphics_root_param_infos[0].num_descriptors; ++i) {
+        for (UINT i = 0; i < swp_chain_info.buffer_count; ++i) {
             release_resource(&graphics_cbv_resource_info[i]);
         }
 
+        free(object_indices);
+
         free(graphics_cbv_resource_info);
 
-        release_descriptor(&graphics_cbv_srv_uav_descriptor_info);
+        release_bindless_heap(&bindless_heap_info);
 
         release_descriptor(&sampler_descriptor_info);
 
-        // Release grahics pipeline state object
-        release_pso(&graphics_pso_info);
+        release_draw_queue(&draw_queue_info);
+
+        release_occlusion(&occlusion_info);
+
+        free(visible_grid_indices);
+        release_lods(&grid_lod_info);
+        release_bvh(&grid_bvh_info);
+        free(grid_view_masks);
+        release_cull_volumes(&grid_volume_info);
+        release_transforms(&transform_info);
+
+        release_batch(&batch_info);
+
+        // Remember which PSOs were used for the next run and release them.
+        // Without a manifest the next run builds them on first use, as it
+        // does when none was found.
+        save_pso_manifest(&pso_cache_info, "pso_cache.manifest");
+        release_pso_cache(&pso_cache_info);
 
         // Release root signature
         release_root_sig(&graphics_root_sig_info);
 
         free_vertex_input(&vert_input_info);
 
-        // Release pixel shader
-        release_shader(&pix_shader_info);
+        // Release pixel shader permutations
+        release_shader_permutations(&pix_permutation_info);
 
-        // Release vertex shader
-        release_shader(&vert_shader_info);
+        // Release vertex shader permutations
+        release_shader_permutations(&vert_permutation_info);
 
         // Release depth stencil buffer resource
         for (UINT i = 0; i < dsv_descriptor_info.num_descriptors; ++i) {
@@ -1012,8 +1402,10 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         // Release vertex buffer resource
         release_resource(&vert_gpu_resource_info);
 
-        // Release triangle data 
-        release_triangle(&triangle_mesh);
+        // Release triangle data, unmapping its file
+        if (!is_mesh_mapped)
+                release_mesh_file_mesh(&triangle_mesh);
+        close_mesh_file(&triangle_file);
 
         // Release render fence
         release_fence(&fence_info);
@@ -1070,6 +1462,8 @@ int CALLBACK WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
  
         release_gpu_device(&device_info);
 
+        release_job_system(&job_system);
+
         destroy_window(&wnd_info, hInstance);
 
         return 0;
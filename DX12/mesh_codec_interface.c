@@ -0,0 +1,758 @@
+#include "mesh_codec_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_CODEC_USE_SSE
+#include <emmintrin.h>
+#endif
+
+// A triangle takes a code byte, a byte of vertex codes and three five byte
+// variable length deltas at most. Streams end in that many zero bytes so
+// the decoder only has to check it has them before each triangle.
+#define INDEX_TAIL_SIZE 17
+#define NO_EDGE 15
+#define NEXT_VERTEX 0
+#define EXPLICIT_VERTEX 15
+#define MAX_VARINT_SIZE 5
+#define VERTEX_GROUP_SIZE 16
+#define MESH_CODEC_PARALLEL_MIN_SIZE (1 << 20)
+
+// Both sides keep the same state and update it the same way, so a code only
+// has to say which entry it takes
+struct index_codec_state {
+        unsigned int edges[MESH_CODEC_FIFO_SIZE][2];
+        unsigned int vertices[MESH_CODEC_FIFO_SIZE];
+        unsigned int edge_offset;
+        unsigned int vertex_offset;
+        // One past the largest vertex so far, the likeliest new one
+        unsigned int next;
+        // The last vertex that had to be coded in full
+        unsigned int last;
+};
+
+struct vertex_decode_job {
+        unsigned char *dst;
+        const unsigned char *src;
+        unsigned long long *block_offsets;
+        unsigned int vertex_count;
+        unsigned int vertex_stride;
+        unsigned int block_count;
+        unsigned int chunk_count;
+        int is_chunk_valid[MAX_MESH_CODEC_CHUNKS];
+};
+
+static const unsigned int group_sizes[4] = { 0, 4, 8, 16 };
+
+static void init_index_codec_state(struct index_codec_state *state)
+{
+        memset(state->edges, 0xff, sizeof (state->edges));
+        memset(state->vertices, 0xff, sizeof (state->vertices));
+        state->edge_offset = 0;
+        state->vertex_offset = 0;
+        state->next = 0;
+        state->last = 0;
+}
+
+// Entry 0 is the newest
+static unsigned int get_fifo_slot(unsigned int offset, unsigned int entry)
+{
+        return (offset - 1 - entry) & (MESH_CODEC_FIFO_SIZE - 1);
+}
+
+static void push_edge(struct index_codec_state *state, unsigned int a,
+        unsigned int b)
+{
+        unsigned int slot = state->edge_offset++ & (MESH_CODEC_FIFO_SIZE - 1);
+        state->edges[slot][0] = a;
+        state->edges[slot][1] = b;
+}
+
+static void push_vertex(struct index_codec_state *state, unsigned int v)
+{
+        unsigned int slot = state->vertex_offset++ &
+                (MESH_CODEC_FIFO_SIZE - 1);
+        state->vertices[slot] = v;
+}
+
+static int find_edge(struct index_codec_state *state, unsigned int a,
+        unsigned int b)
+{
+        for (unsigned int e = 0; e < NO_EDGE; ++e) {
+                unsigned int slot = get_fifo_slot(state->edge_offset, e);
+                if (state->edges[slot][0] == a && state->edges[slot][1] == b)
+                        return e;
+        }
+
+        return -1;
+}
+
+static int find_vertex(struct index_codec_state *state, unsigned int v)
+{
+        for (unsigned int e = 0; e < EXPLICIT_VERTEX - 1; ++e) {
+                if (state->vertices[get_fifo_slot(state->vertex_offset, e)] ==
+                        v)
+                        return e;
+        }
+
+        return -1;
+}
+
+static unsigned char *write_varint(unsigned char *dst, unsigned int value)
+{
+        while (value >= 0x80) {
+                *dst++ = (unsigned char) (value | 0x80);
+                value >>= 7;
+        }
+        *dst++ = (unsigned char) value;
+
+        return dst;
+}
+
+static int read_varint(const unsigned char **src, unsigned int *value)
+{
+        const unsigned char *p = *src;
+        *value = 0;
+        for (unsigned int i = 0; i < MAX_VARINT_SIZE; ++i) {
+                *value |= (unsigned int) (p[i] & 0x7f) << (i * 7);
+                if (p[i] < 0x80) {
+                        *src = p + i + 1;
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+// Vertices that are new or coded in full go into the vertex FIFO, those
+// taken from it are already there
+static void update_vertex_state(struct index_codec_state *state,
+        unsigned int code, unsigned int v)
+{
+        if (code == NEXT_VERTEX || code == EXPLICIT_VERTEX)
+                push_vertex(state, v);
+        state->next = v >= state->next ? v + 1 : state->next;
+}
+
+static unsigned int encode_vertex(struct index_codec_state *state,
+        unsigned int v, unsigned char **dst)
+{
+        unsigned int code = NEXT_VERTEX;
+        int entry = find_vertex(state, v);
+
+        if (v != state->next && entry >= 0) {
+                code = entry + 1;
+        } else if (v != state->next) {
+                unsigned int delta = v - state->last;
+                code = EXPLICIT_VERTEX;
+                *dst = write_varint(*dst, delta << 1 ^
+                        (0 - (delta >> 31)));
+                state->last = v;
+        }
+
+        update_vertex_state(state, code, v);
+
+        return code;
+}
+
+static int decode_vertex(struct index_codec_state *state, unsigned int code,
+        const unsigned char **src, unsigned int *v)
+{
+        if (code == NEXT_VERTEX) {
+                *v = state->next;
+        } else if (code < EXPLICIT_VERTEX) {
+                *v = state->vertices[get_fifo_slot(state->vertex_offset,
+                        code - 1)];
+        } else {
+                unsigned int zigzag;
+                if (!read_varint(src, &zigzag))
+                        return 0;
+                *v = state->last + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+                state->last = *v;
+        }
+
+        update_vertex_state(state, code, *v);
+
+        return 1;
+}
+
+unsigned long long get_index_encode_bound(unsigned int index_count)
+{
+        return 1 + (unsigned long long) (index_count / 3) *
+                INDEX_TAIL_SIZE + INDEX_TAIL_SIZE;
+}
+
+unsigned long long encode_index_buffer(unsigned char *dst,
+        const unsigned int *indices, unsigned int index_count)
+{
+        assert(index_count % 3 == 0);
+
+        struct index_codec_state state;
+        init_index_codec_state(&state);
+
+        unsigned char *p = dst;
+        *p++ = MESH_CODEC_INDEX_VERSION;
+
+        for (unsigned int i = 0; i < index_count; i += 3) {
+                const unsigned int *corners = indices + i;
+
+                // Any corner can lead, as long as the winding is kept
+                int edge = -1;
+                unsigned int r = 0;
+                for (; r < 3 && edge < 0; ++r)
+                        edge = find_edge(&state, corners[r],
+                                corners[(r + 1) % 3]);
+                r = edge >= 0 ? r - 1 : 0;
+
+                if (edge < 0) {
+                        // Leading with a new vertex makes it likelier the
+                        // next two are new as well
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                if (corners[k] == state.next) {
+                                        r = k;
+                                        break;
+                                }
+                        }
+                }
+
+                unsigned int a = corners[r];
+                unsigned int b = corners[(r + 1) % 3];
+                unsigned int c = corners[(r + 2) % 3];
+
+                unsigned char *code = p++;
+                if (edge >= 0) {
+                        *code = (unsigned char) (edge << 4 |
+                                encode_vertex(&state, c, &p));
+                        push_edge(&state, c, b);
+                        push_edge(&state, a, c);
+                } else {
+                        unsigned char *vertex_codes = p++;
+                        *code = (unsigned char) (NO_EDGE << 4 |
+                                encode_vertex(&state, a, &p));
+                        unsigned int code_b = encode_vertex(&state, b, &p);
+                        unsigned int code_c = encode_vertex(&state, c, &p);
+                        *vertex_codes = (unsigned char) (code_b << 4 | code_c);
+                        push_edge(&state, b, a);
+                        push_edge(&state, c, b);
+                        push_edge(&state, a, c);
+                }
+        }
+
+        memset(p, 0, INDEX_TAIL_SIZE);
+        p += INDEX_TAIL_SIZE;
+
+        return (unsigned long long) (p - dst);
+}
+
+int decode_index_buffer(void *dst, unsigned int index_stride,
+        unsigned int index_count, unsigned int vertex_count,
+        const unsigned char *src, unsigned long long size)
+{
+        assert(index_stride == 2 || index_stride == 4);
+
+        if (index_count % 3 != 0 || size < 1 + INDEX_TAIL_SIZE ||
+                src[0] != MESH_CODEC_INDEX_VERSION)
+                return 0;
+
+        struct index_codec_state state;
+        init_index_codec_state(&state);
+
+        const unsigned char *p = src + 1;
+        const unsigned char *end = src + size;
+        unsigned char *out = dst;
+
+        for (unsigned int i = 0; i < index_count; i += 3) {
+                if (end - p < INDEX_TAIL_SIZE)
+                        return 0;
+
+                unsigned int code = *p++;
+                unsigned int edge = code >> 4;
+                unsigned int a, b, c;
+
+                if (edge != NO_EDGE) {
+                        unsigned int slot = get_fifo_slot(state.edge_offset,
+                                edge);
+                        a = state.edges[slot][0];
+                        b = state.edges[slot][1];
+                        if (!decode_vertex(&state, code & 15, &p, &c))
+                                return 0;
+                        push_edge(&state, c, b);
+                        push_edge(&state, a, c);
+                } else {
+                        unsigned int vertex_codes = *p++;
+                        if (!decode_vertex(&state, code & 15, &p, &a) ||
+                                !decode_vertex(&state, vertex_codes >> 4, &p,
+                                &b) || !decode_vertex(&state,
+                                vertex_codes & 15, &p, &c))
+                                return 0;
+                        push_edge(&state, b, a);
+                        push_edge(&state, c, b);
+                        push_edge(&state, a, c);
+                }
+
+                if (a >= vertex_count || b >= vertex_count ||
+                        c >= vertex_count)
+                        return 0;
+
+                if (index_stride == sizeof (unsigned int)) {
+                        unsigned int triangle[3] = { a, b, c };
+                        memcpy(out, triangle, sizeof (triangle));
+                        out += sizeof (triangle);
+                } else {
+                        if ((a | b | c) > 0xffff)
+                                return 0;
+                        unsigned short triangle[3] = { (unsigned short) a,
+                                (unsigned short) b, (unsigned short) c };
+                        memcpy(out, triangle, sizeof (triangle));
+                        out += sizeof (triangle);
+                }
+        }
+
+        return end - p == INDEX_TAIL_SIZE;
+}
+
+static unsigned int get_vertex_block_count(unsigned int vertex_count)
+{
+        return (vertex_count + MESH_CODEC_VERTEX_BLOCK_SIZE - 1) /
+                MESH_CODEC_VERTEX_BLOCK_SIZE;
+}
+
+// Each group of a plane has two bits in the plane header for its size
+static unsigned int get_plane_header_size(unsigned int group_count)
+{
+        return (group_count + 3) / 4;
+}
+
+static unsigned int get_group_code(const unsigned char *header,
+        unsigned int group)
+{
+        return header[group / 4] >> (group % 4 * 2) & 3;
+}
+
+unsigned long long get_vertex_encode_bound(unsigned int vertex_count,
+        unsigned int vertex_stride)
+{
+        unsigned long long block_count = get_vertex_block_count(vertex_count);
+        unsigned int group_count = MESH_CODEC_VERTEX_BLOCK_SIZE /
+                VERTEX_GROUP_SIZE;
+
+        return 1 + block_count * sizeof (unsigned int) + block_count *
+                vertex_stride * (get_plane_header_size(group_count) +
+                MESH_CODEC_VERTEX_BLOCK_SIZE);
+}
+
+// Byte j of a two bit group holds values j, 4 + j, 8 + j and 12 + j from
+// the low bits up, and byte j of a four bit group values j and 8 + j, which
+// is the order SSE2 can unpack them in with whole register shifts
+static unsigned char *encode_vertex_plane(unsigned char *dst,
+        const unsigned char *src, unsigned int count, unsigned int stride)
+{
+        unsigned char zigzags[MESH_CODEC_VERTEX_BLOCK_SIZE];
+        unsigned int group_count = (count + VERTEX_GROUP_SIZE - 1) /
+                VERTEX_GROUP_SIZE;
+        unsigned char previous = 0;
+
+        for (unsigned int i = 0; i < count; ++i) {
+                unsigned char delta = (unsigned char) (src[(size_t) i *
+                        stride] - previous);
+                previous = src[(size_t) i * stride];
+                zigzags[i] = (unsigned char) (delta << 1 ^
+                        (0 - (delta >> 7)));
+        }
+        memset(zigzags + count, 0, group_count * VERTEX_GROUP_SIZE - count);
+
+        unsigned char *header = dst;
+        unsigned int header_size = get_plane_header_size(group_count);
+        memset(header, 0, header_size);
+        dst += header_size;
+
+        for (unsigned int g = 0; g < group_count; ++g) {
+                const unsigned char *z = zigzags + g * VERTEX_GROUP_SIZE;
+                unsigned char bits = 0;
+                for (unsigned int j = 0; j < VERTEX_GROUP_SIZE; ++j)
+                        bits |= z[j];
+
+                unsigned int code = bits == 0 ? 0 : bits < 4 ? 1 :
+                        bits < 16 ? 2 : 3;
+                header[g / 4] |= (unsigned char) (code << (g % 4 * 2));
+
+                if (code == 1) {
+                        for (unsigned int j = 0; j < 4; ++j) {
+                                dst[j] = (unsigned char) (z[j] | z[4 + j] << 2 |
+                                        z[8 + j] << 4 | z[12 + j] << 6);
+                        }
+                } else if (code == 2) {
+                        for (unsigned int j = 0; j < 8; ++j)
+                                dst[j] = (unsigned char) (z[j] | z[8 + j] << 4);
+                } else if (code == 3) {
+                        memcpy(dst, z, VERTEX_GROUP_SIZE);
+                }
+                dst += group_sizes[code];
+        }
+
+        return dst;
+}
+
+unsigned long long encode_vertex_buffer(unsigned char *dst,
+        const void *vertices, unsigned int vertex_count,
+        unsigned int vertex_stride)
+{
+        assert(vertex_stride > 0 &&
+                vertex_stride <= MAX_MESH_CODEC_VERTEX_STRIDE);
+
+        const unsigned char *src = vertices;
+        unsigned int block_count = get_vertex_block_count(vertex_count);
+        unsigned char *p = dst;
+        *p++ = MESH_CODEC_VERTEX_VERSION;
+
+        // Block sizes go first so blocks can be found without decoding
+        unsigned char *block_sizes = p;
+        p += (size_t) block_count * sizeof (unsigned int);
+
+        for (unsigned int b = 0; b < block_count; ++b) {
+                unsigned int first = b * MESH_CODEC_VERTEX_BLOCK_SIZE;
+                unsigned int count = vertex_count - first;
+                count = count < MESH_CODEC_VERTEX_BLOCK_SIZE ? count :
+                        MESH_CODEC_VERTEX_BLOCK_SIZE;
+
+                unsigned char *block = p;
+                for (unsigned int k = 0; k < vertex_stride; ++k) {
+                        p = encode_vertex_plane(p, src + (size_t) first *
+                                vertex_stride + k, count, vertex_stride);
+                }
+
+                unsigned int block_size = (unsigned int) (p - block);
+                memcpy(block_sizes + b * sizeof (unsigned int), &block_size,
+                        sizeof (unsigned int));
+        }
+
+        return (unsigned long long) (p - dst);
+}
+
+// Finds where each plane of a block starts, returns 0 when they don't add
+// up to the size of the block
+static int get_vertex_planes(const unsigned char *src,
+        unsigned long long size, unsigned int group_count,
+        unsigned int stride, const unsigned char **planes)
+{
+        unsigned int header_size = get_plane_header_size(group_count);
+        unsigned long long offset = 0;
+
+        for (unsigned int k = 0; k < stride; ++k) {
+                if (size - offset < header_size)
+                        return 0;
+
+                planes[k] = src + offset;
+                offset += header_size;
+                for (unsigned int g = 0; g < group_count; ++g)
+                        offset += group_sizes[get_group_code(planes[k], g)];
+                if (offset > size)
+                        return 0;
+        }
+
+        return offset == size;
+}
+
+#if !defined(MESH_CODEC_USE_SSE)
+static const unsigned char *unpack_group(const unsigned char *data,
+        unsigned int code, unsigned char *z)
+{
+        for (unsigned int j = 0; j < VERTEX_GROUP_SIZE; ++j) {
+                if (code == 0)
+                        z[j] = 0;
+                else if (code == 1)
+                        z[j] = data[j % 4] >> (j / 4 * 2) & 3;
+                else if (code == 2)
+                        z[j] = data[j % 8] >> (j / 8 * 4) & 15;
+                else
+                        z[j] = data[j];
+        }
+
+        return data + group_sizes[code];
+}
+
+static void decode_vertex_block(unsigned char *scratch,
+        const unsigned char **planes, unsigned int count,
+        unsigned int group_count, unsigned int stride)
+{
+        unsigned int header_size = get_plane_header_size(group_count);
+
+        for (unsigned int k = 0; k < stride; ++k) {
+                const unsigned char *data = planes[k] + header_size;
+                unsigned char previous = 0;
+
+                for (unsigned int g = 0; g < group_count; ++g) {
+                        unsigned char z[VERTEX_GROUP_SIZE];
+                        data = unpack_group(data,
+                                get_group_code(planes[k], g), z);
+
+                        unsigned int first = g * VERTEX_GROUP_SIZE;
+                        unsigned int last = count - first;
+                        last = last < VERTEX_GROUP_SIZE ? last :
+                                VERTEX_GROUP_SIZE;
+                        for (unsigned int j = 0; j < last; ++j) {
+                                previous += (unsigned char) ((z[j] >> 1) ^
+                                        (0 - (z[j] & 1)));
+                                scratch[(size_t) (first + j) * stride + k] =
+                                        previous;
+                        }
+                }
+        }
+}
+
+#else
+static __m128i unpack_group_sse(const unsigned char **data,
+        unsigned int code)
+{
+        const unsigned char *p = *data;
+        *data = p + group_sizes[code];
+
+        switch (code)
+        {
+                case 0 :
+                        return _mm_setzero_si128();
+
+                case 1 : {
+                        // Every dword of the broadcast bytes takes its own
+                        // pair of bits
+                        int bits;
+                        memcpy(&bits, p, sizeof (int));
+                        __m128i x = _mm_shuffle_epi32(
+                                _mm_cvtsi32_si128(bits), 0);
+                        __m128i mask = _mm_set1_epi8(3);
+                        __m128i even = _mm_setr_epi32(-1, 0, -1, 0);
+                        __m128i shifted = _mm_or_si128(_mm_and_si128(x, even),
+                                _mm_andnot_si128(even, _mm_srli_epi32(x, 2)));
+                        __m128i high = _mm_setr_epi32(0, 0, -1, -1);
+                        shifted = _mm_or_si128(_mm_andnot_si128(high, shifted),
+                                _mm_and_si128(high, _mm_srli_epi32(shifted,
+                                4)));
+                        return _mm_and_si128(shifted, mask);
+                }
+
+                case 2 : {
+                        __m128i x = _mm_loadl_epi64((const __m128i *) p);
+                        x = _mm_unpacklo_epi64(x, _mm_srli_epi16(x, 4));
+                        return _mm_and_si128(x, _mm_set1_epi8(15));
+                }
+
+                default :
+                        return _mm_loadu_si128((const __m128i *) p);
+        }
+}
+
+// Four perfect shuffles of the rows rotate the bits of each byte's row and
+// column number by one each, which after four is a transpose
+static void shuffle_rows(const __m128i *rows, __m128i *shuffled)
+{
+        shuffled[0] = _mm_unpacklo_epi8(rows[0], rows[8]);
+        shuffled[1] = _mm_unpackhi_epi8(rows[0], rows[8]);
+        shuffled[2] = _mm_unpacklo_epi8(rows[1], rows[9]);
+        shuffled[3] = _mm_unpackhi_epi8(rows[1], rows[9]);
+        shuffled[4] = _mm_unpacklo_epi8(rows[2], rows[10]);
+        shuffled[5] = _mm_unpackhi_epi8(rows[2], rows[10]);
+        shuffled[6] = _mm_unpacklo_epi8(rows[3], rows[11]);
+        shuffled[7] = _mm_unpackhi_epi8(rows[3], rows[11]);
+        shuffled[8] = _mm_unpacklo_epi8(rows[4], rows[12]);
+        shuffled[9] = _mm_unpackhi_epi8(rows[4], rows[12]);
+        shuffled[10] = _mm_unpacklo_epi8(rows[5], rows[13]);
+        shuffled[11] = _mm_unpackhi_epi8(rows[5], rows[13]);
+        shuffled[12] = _mm_unpacklo_epi8(rows[6], rows[14]);
+        shuffled[13] = _mm_unpackhi_epi8(rows[6], rows[14]);
+        shuffled[14] = _mm_unpacklo_epi8(rows[7], rows[15]);
+        shuffled[15] = _mm_unpackhi_epi8(rows[7], rows[15]);
+}
+
+static void transpose_16x16(const __m128i *rows, __m128i *columns)
+{
+        __m128i shuffled[16];
+        shuffle_rows(rows, shuffled);
+        shuffle_rows(shuffled, columns);
+        shuffle_rows(columns, shuffled);
+        shuffle_rows(shuffled, columns);
+}
+
+static __m128i add_deltas(__m128i previous, __m128i zigzags,
+        unsigned char *dst)
+{
+        __m128i delta = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(zigzags,
+                1), _mm_set1_epi8(0x7f)), _mm_sub_epi8(_mm_setzero_si128(),
+                _mm_and_si128(zigzags, _mm_set1_epi8(1))));
+        previous = _mm_add_epi8(previous, delta);
+        _mm_storeu_si128((__m128i *) dst, previous);
+
+        return previous;
+}
+
+// Sixteen planes at a time are unpacked as rows and transposed into a
+// vertex a row, so the deltas add up a whole row at a time. Rows are stored
+// 16 bytes wide even when fewer planes are left, running into the next
+// vertex, so the planes go from the last to the first for the later stores
+// to write over those that ran on.
+static void decode_vertex_block_sse(unsigned char *scratch,
+        const unsigned char **planes, unsigned int group_count,
+        unsigned int stride)
+{
+        unsigned int header_size = get_plane_header_size(group_count);
+
+        for (unsigned int tile = (stride - 1) & ~15u; ; tile -= 16) {
+                const unsigned char *data[16];
+                unsigned int plane_count = stride - tile;
+                plane_count = plane_count < 16 ? plane_count : 16;
+                for (unsigned int k = 0; k < plane_count; ++k)
+                        data[k] = planes[tile + k] + header_size;
+
+                // Rows past the last plane stay zero
+                __m128i rows[16];
+                for (unsigned int k = plane_count; k < 16; ++k)
+                        rows[k] = _mm_setzero_si128();
+
+                __m128i previous = _mm_setzero_si128();
+                for (unsigned int g = 0; g < group_count; ++g) {
+                        for (unsigned int k = 0; k < plane_count; ++k) {
+                                rows[k] = unpack_group_sse(&data[k],
+                                        get_group_code(planes[tile + k], g));
+                        }
+
+                        __m128i columns[16];
+                        transpose_16x16(rows, columns);
+
+                        // Unrolled by hand, the loop is too long for the
+                        // compiler to do it unasked
+                        unsigned char *dst = scratch + (size_t) g *
+                                VERTEX_GROUP_SIZE * stride + tile;
+                        for (unsigned int j = 0; j < 16; j += 4) {
+                                previous = add_deltas(previous, columns[j],
+                                        dst);
+                                previous = add_deltas(previous,
+                                        columns[j + 1], dst + stride);
+                                previous = add_deltas(previous,
+                                        columns[j + 2], dst + stride * 2);
+                                previous = add_deltas(previous,
+                                        columns[j + 3], dst + stride * 3);
+                                dst += stride * 4;
+                        }
+                }
+
+                if (tile == 0)
+                        break;
+        }
+}
+#endif
+
+// Blocks are decoded into scratch that stays in cache and copied out whole,
+// so memory that is slow to write piecemeal, like upload heaps, is only
+// ever written front to back
+static void decode_vertex_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct vertex_decode_job *job = job_data;
+        unsigned int stride = job->vertex_stride;
+        const unsigned char *planes[MAX_MESH_CODEC_VERTEX_STRIDE];
+
+        // Stores run up to 16 bytes past the last vertex
+        unsigned char *scratch = malloc((size_t) MESH_CODEC_VERTEX_BLOCK_SIZE *
+                stride + 16);
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = (unsigned int) ((unsigned long long)
+                        job->block_count * c / job->chunk_count);
+                unsigned int last = (unsigned int) ((unsigned long long)
+                        job->block_count * (c + 1) / job->chunk_count);
+                int is_valid = 1;
+
+                for (unsigned int b = first; b < last && is_valid; ++b) {
+                        unsigned int first_vertex = b *
+                                MESH_CODEC_VERTEX_BLOCK_SIZE;
+                        unsigned int count = job->vertex_count - first_vertex;
+                        count = count < MESH_CODEC_VERTEX_BLOCK_SIZE ? count :
+                                MESH_CODEC_VERTEX_BLOCK_SIZE;
+                        unsigned int group_count = (count +
+                                VERTEX_GROUP_SIZE - 1) / VERTEX_GROUP_SIZE;
+
+                        is_valid = get_vertex_planes(job->src +
+                                job->block_offsets[b], job->block_offsets[b +
+                                1] - job->block_offsets[b], group_count,
+                                stride, planes);
+                        if (!is_valid)
+                                break;
+
+#if defined(MESH_CODEC_USE_SSE)
+                        decode_vertex_block_sse(scratch, planes, group_count,
+                                stride);
+#else
+                        decode_vertex_block(scratch, planes, count,
+                                group_count, stride);
+#endif
+                        memcpy(job->dst + (size_t) first_vertex * stride,
+                                scratch, (size_t) count * stride);
+                }
+
+                job->is_chunk_valid[c] = is_valid;
+        }
+
+        free(scratch);
+}
+
+int decode_vertex_buffer(struct job_system_info *job_system, void *dst,
+        unsigned int vertex_count, unsigned int vertex_stride,
+        const unsigned char *src, unsigned long long size)
+{
+        if (vertex_stride == 0 ||
+                vertex_stride > MAX_MESH_CODEC_VERTEX_STRIDE ||
+                size < 1 || src[0] != MESH_CODEC_VERTEX_VERSION)
+                return 0;
+
+        struct vertex_decode_job job;
+        job.dst = dst;
+        job.src = src;
+        job.vertex_count = vertex_count;
+        job.vertex_stride = vertex_stride;
+        job.block_count = get_vertex_block_count(vertex_count);
+
+        unsigned long long table_size = (unsigned long long) job.block_count *
+                sizeof (unsigned int);
+        if (size - 1 < table_size)
+                return 0;
+
+        job.block_offsets = malloc((job.block_count + 1) *
+                sizeof (unsigned long long));
+        job.block_offsets[0] = 1 + table_size;
+        for (unsigned int b = 0; b < job.block_count; ++b) {
+                unsigned int block_size;
+                memcpy(&block_size, src + 1 + b * sizeof (unsigned int),
+                        sizeof (unsigned int));
+                job.block_offsets[b + 1] = job.block_offsets[b] + block_size;
+        }
+
+        if (job.block_offsets[job.block_count] != size) {
+                free(job.block_offsets);
+                return 0;
+        }
+
+        job.chunk_count = 1;
+        if (job_system != NULL && (unsigned long long) vertex_count *
+                vertex_stride >= MESH_CODEC_PARALLEL_MIN_SIZE) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_MESH_CODEC_CHUNKS)
+                        job.chunk_count = MAX_MESH_CODEC_CHUNKS;
+                if (job.chunk_count > job.block_count)
+                        job.chunk_count = job.block_count;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, decode_vertex_chunks, &job);
+
+        int is_valid = 1;
+        for (unsigned int c = 0; c < job.chunk_count; ++c)
+                is_valid &= job.is_chunk_valid[c];
+
+        free(job.block_offsets);
+
+        return is_valid;
+}
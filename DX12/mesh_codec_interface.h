@@ -0,0 +1,48 @@
+#ifndef MESH_CODEC_INTERFACE_H
+#define MESH_CODEC_INTERFACE_H
+
+#include "job_interface.h"
+
+// Lossless codecs for index and vertex buffers as they are stored on disk.
+// Indices are coded a triangle at a time against a FIFO of recent edges and
+// a FIFO of recent vertices, so most triangles take a byte, and the rest
+// fall back to variable length deltas. Vertices are cut into blocks, each
+// coded on its own so they decode in parallel on the job system. Within a
+// block every byte of the vertex is a plane of deltas from the vertex
+// before, packed in groups of 16 at the fewest bits of 0, 2, 4 or 8 that
+// hold the whole group. Decoding is SSE2 where it is available and writes
+// each buffer front to back exactly once, so it can go straight into
+// mapped upload memory. Kept free of D3D types so it can run headless.
+#define MESH_CODEC_INDEX_VERSION 0xe1
+#define MESH_CODEC_VERTEX_VERSION 0xa1
+#define MESH_CODEC_FIFO_SIZE 16
+#define MESH_CODEC_VERTEX_BLOCK_SIZE 256
+#define MAX_MESH_CODEC_VERTEX_STRIDE 256
+#define MAX_MESH_CODEC_CHUNKS 64
+
+unsigned long long get_index_encode_bound(unsigned int index_count);
+// Returns the encoded size, with dst holding at least the bound. Triangles
+// keep their order and winding but may start from another of their corners.
+unsigned long long encode_index_buffer(unsigned char *dst,
+        const unsigned int *indices, unsigned int index_count);
+// Writes index_count indices of index_stride bytes, 2 or 4. Returns 0 when
+// the data is malformed or holds an index of vertex_count or above, when
+// dst may have been partly written.
+int decode_index_buffer(void *dst, unsigned int index_stride,
+        unsigned int index_count, unsigned int vertex_count,
+        const unsigned char *src, unsigned long long size);
+
+unsigned long long get_vertex_encode_bound(unsigned int vertex_count,
+        unsigned int vertex_stride);
+// Returns the encoded size, with dst holding at least the bound. The stride
+// is at most MAX_MESH_CODEC_VERTEX_STRIDE.
+unsigned long long encode_vertex_buffer(unsigned char *dst,
+        const void *vertices, unsigned int vertex_count,
+        unsigned int vertex_stride);
+// Returns 0 when the data is malformed, when dst may have been partly
+// written. The job system may be NULL.
+int decode_vertex_buffer(struct job_system_info *job_system, void *dst,
+        unsigned int vertex_count, unsigned int vertex_stride,
+        const unsigned char *src, unsigned long long size);
+
+#endif
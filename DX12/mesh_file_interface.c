@@ -0,0 +1,605 @@
+#include "mesh_file_interface.h"
+#include "index_format_interface.h"
+#include "mesh_codec_interface.h"
+#include "timer_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <assert.h>
+
+struct mesh_copy_job {
+        unsigned char *dst;
+        const unsigned char *src;
+        unsigned long long size;
+        unsigned int chunk_count;
+};
+
+static unsigned long long align_size(unsigned long long size)
+{
+        return (size + MESH_FILE_ALIGNMENT - 1) &
+                ~(unsigned long long) (MESH_FILE_ALIGNMENT - 1);
+}
+
+static void set_attributes(struct mesh_file_header *header,
+        struct vertex_format *format)
+{
+        header->attribute_count = format->attribute_count;
+        for (unsigned int a = 0; a < format->attribute_count; ++a) {
+                struct mesh_file_attribute *attribute =
+                        &header->attributes[a];
+                attribute->semantic = format->attributes[a].semantic;
+                attribute->format = format->attributes[a].format;
+                attribute->offset = format->attributes[a].offset;
+        }
+
+        header->vertex_stride = format->stride;
+        for (int k = 0; k < 3; ++k) {
+                header->position_scale[k] = format->position_scale[k];
+                header->position_bias[k] = format->position_bias[k];
+        }
+        header->position_scale[3] = 1.0f;
+        header->position_bias[3] = 0.0f;
+}
+
+static void calc_mesh_bounds(struct mesh_info *mi,
+        struct mesh_file_header *header)
+{
+        memset(header->bounds_min, 0, sizeof (header->bounds_min));
+        memset(header->bounds_max, 0, sizeof (header->bounds_max));
+        memset(header->bounding_sphere, 0, sizeof (header->bounding_sphere));
+        if (mi->vertex_count == 0)
+                return;
+
+        for (int k = 0; k < 3; ++k) {
+                header->bounds_min[k] = mi->verticies[0].position[k];
+                header->bounds_max[k] = mi->verticies[0].position[k];
+        }
+
+        for (unsigned int i = 1; i < mi->vertex_count; ++i) {
+                float *position = mi->verticies[i].position;
+                for (int k = 0; k < 3; ++k) {
+                        header->bounds_min[k] =
+                                position[k] < header->bounds_min[k] ?
+                                position[k] : header->bounds_min[k];
+                        header->bounds_max[k] =
+                                position[k] > header->bounds_max[k] ?
+                                position[k] : header->bounds_max[k];
+                }
+        }
+
+        // The sphere is centred on the box, which is close enough for
+        // culling and needs a single pass
+        float *centre = header->bounding_sphere;
+        for (int k = 0; k < 3; ++k) {
+                centre[k] = (header->bounds_min[k] + header->bounds_max[k]) *
+                        0.5f;
+        }
+
+        float max_dist_sq = 0.0f;
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                vec3 offset;
+                vec3_sub(offset, mi->verticies[i].position, centre);
+                float dist_sq = vec3_mul_inner(offset, offset);
+                max_dist_sq = dist_sq > max_dist_sq ? dist_sq : max_dist_sq;
+        }
+
+        header->bounding_sphere[3] = sqrtf(max_dist_sq);
+}
+
+static int write_padding(FILE *file, unsigned long long size)
+{
+        static const unsigned char zeros[MESH_FILE_ALIGNMENT];
+
+        return fwrite(zeros, 1, align_size(size) - size, file) ==
+                align_size(size) - size;
+}
+
+static int write_indices(FILE *file, struct mesh_info *mi,
+        unsigned int index_stride)
+{
+        if (index_stride == sizeof (unsigned int))
+                return fwrite(mi->indices, sizeof (unsigned int),
+                        mi->index_count, file) == mi->index_count;
+
+        unsigned short block[MESH_FILE_INDEX_BLOCK_SIZE];
+        for (unsigned int i = 0; i < mi->index_count;
+                i += MESH_FILE_INDEX_BLOCK_SIZE) {
+                unsigned int count = mi->index_count - i;
+                count = count < MESH_FILE_INDEX_BLOCK_SIZE ? count :
+                        MESH_FILE_INDEX_BLOCK_SIZE;
+                narrow_indices(mi->indices + i, block, count);
+                if (fwrite(block, sizeof (unsigned short), count, file) !=
+                        count)
+                        return 0;
+        }
+
+        return 1;
+}
+
+// Compressed files hold the encoded data in place of the raw data
+static void encode_mesh_data(struct mesh_info *mi, const void *vertices,
+        struct mesh_file_header *header, unsigned char **vertex_data,
+        unsigned char **index_data)
+{
+        *vertex_data = malloc((size_t) get_vertex_encode_bound(
+                mi->vertex_count, header->vertex_stride) + 1);
+        header->vertex_stored_size = encode_vertex_buffer(*vertex_data,
+                vertices, mi->vertex_count, header->vertex_stride);
+
+        *index_data = malloc((size_t) get_index_encode_bound(
+                mi->index_count) + 1);
+        header->index_stored_size = encode_index_buffer(*index_data,
+                mi->indices, mi->index_count);
+}
+
+int write_mesh_file(const char *path, struct mesh_info *mi,
+        unsigned int layout, unsigned int compression)
+{
+        struct mesh_file_header header;
+        memset(&header, 0, sizeof (struct mesh_file_header));
+        header.magic = MESH_FILE_MAGIC;
+        header.version = MESH_FILE_VERSION;
+        header.header_size = sizeof (struct mesh_file_header);
+
+        // The float layout is struct vertex, so it is written as is
+        assert(layout <= VERTEX_LAYOUT_HALF);
+        struct vertex_encode_info encode_info;
+        memset(&encode_info, 0, sizeof (struct vertex_encode_info));
+        const void *vertices = mi->verticies;
+        if (layout == VERTEX_LAYOUT_FLOAT) {
+                get_vertex_format(layout, 0, &encode_info.format);
+        } else {
+                encode_info.layout = layout;
+                encode_vertices(&encode_info, mi);
+                vertices = encode_info.data;
+        }
+
+        set_attributes(&header, &encode_info.format);
+        header.vertex_count = mi->vertex_count;
+        header.index_stride = mi->vertex_count <= INDEX_16_MAX_VERTEX_COUNT ?
+                sizeof (unsigned short) : sizeof (unsigned int);
+        header.index_count = mi->index_count;
+        header.vertex_data_offset = align_size(
+                sizeof (struct mesh_file_header));
+        header.vertex_data_size = (unsigned long long) mi->vertex_count *
+                header.vertex_stride;
+        header.index_data_offset = header.vertex_data_offset +
+                align_size(header.vertex_data_size);
+        header.index_data_size = (unsigned long long) mi->index_count *
+                header.index_stride;
+
+        assert(compression <= MESH_FILE_COMPRESSION_CODEC);
+        header.compression = compression;
+        header.vertex_stored_size = header.vertex_data_size;
+        header.index_stored_size = header.index_data_size;
+
+        unsigned char *vertex_data = NULL;
+        unsigned char *index_data = NULL;
+        if (compression == MESH_FILE_COMPRESSION_CODEC) {
+                encode_mesh_data(mi, vertices, &header, &vertex_data,
+                        &index_data);
+
+                // Meshes too small to gain from compression are stored as is
+                if (header.vertex_stored_size + header.index_stored_size >=
+                        header.vertex_data_size + header.index_data_size) {
+                        free(index_data);
+                        free(vertex_data);
+                        release_encoded_vertices(&encode_info);
+                        return write_mesh_file(path, mi, layout,
+                                MESH_FILE_COMPRESSION_NONE);
+                }
+
+                header.index_data_offset = header.vertex_data_offset +
+                        align_size(header.vertex_stored_size);
+        }
+
+        calc_mesh_bounds(mi, &header);
+
+        assert(mi->lod_count <= MAX_MESH_LODS);
+        header.lod_count = mi->lod_count;
+        for (unsigned int l = 0; l < mi->lod_count; ++l) {
+                header.lods[l].first_index = mi->lods[l].first_index;
+                header.lods[l].index_count = mi->lods[l].index_count;
+                header.lods[l].error = mi->lods[l].error;
+        }
+
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+                free(index_data);
+                free(vertex_data);
+                release_encoded_vertices(&encode_info);
+                return 0;
+        }
+
+        int is_written = fwrite(&header, sizeof (struct mesh_file_header), 1,
+                file) == 1 && write_padding(file,
+                sizeof (struct mesh_file_header));
+        if (compression == MESH_FILE_COMPRESSION_CODEC) {
+                is_written = is_written && fwrite(vertex_data, 1,
+                        header.vertex_stored_size, file) ==
+                        header.vertex_stored_size &&
+                        write_padding(file, header.vertex_stored_size) &&
+                        fwrite(index_data, 1, header.index_stored_size,
+                        file) == header.index_stored_size;
+        } else {
+                is_written = is_written && fwrite(vertices, 1,
+                        header.vertex_data_size, file) ==
+                        header.vertex_data_size &&
+                        write_padding(file, header.vertex_data_size) &&
+                        write_indices(file, mi, header.index_stride);
+        }
+
+        free(index_data);
+        free(vertex_data);
+        release_encoded_vertices(&encode_info);
+
+        return fclose(file) == 0 && is_written;
+}
+
+static int is_range_in_file(unsigned long long offset,
+        unsigned long long size, unsigned long long file_size)
+{
+        return offset % MESH_FILE_ALIGNMENT == 0 && offset <= file_size &&
+                size <= file_size - offset;
+}
+
+static int is_header_valid(const struct mesh_file_header *header,
+        unsigned long long file_size)
+{
+        if (header->magic != MESH_FILE_MAGIC ||
+                header->version != MESH_FILE_VERSION ||
+                header->header_size != sizeof (struct mesh_file_header) ||
+                header->attribute_count > MAX_MESH_FILE_ATTRIBUTES ||
+                header->lod_count > MAX_MESH_LODS ||
+                header->compression > MESH_FILE_COMPRESSION_CODEC ||
+                (header->index_stride != 2 && header->index_stride != 4))
+                return 0;
+
+        for (unsigned int a = 0; a < header->attribute_count; ++a) {
+                unsigned int size = get_vertex_attribute_size(
+                        header->attributes[a].format);
+                if (size == 0 || header->attributes[a].offset + size >
+                        header->vertex_stride)
+                        return 0;
+        }
+
+        if (header->vertex_data_size != (unsigned long long)
+                header->vertex_count * header->vertex_stride ||
+                header->index_data_size != (unsigned long long)
+                header->index_count * header->index_stride)
+                return 0;
+
+        // Compressed data is checked as it is decoded
+        if (header->compression == MESH_FILE_COMPRESSION_NONE &&
+                (header->vertex_stored_size != header->vertex_data_size ||
+                header->index_stored_size != header->index_data_size))
+                return 0;
+
+        if (!is_range_in_file(header->vertex_data_offset,
+                header->vertex_stored_size, file_size) ||
+                !is_range_in_file(header->index_data_offset,
+                header->index_stored_size, file_size))
+                return 0;
+
+        for (unsigned int l = 0; l < header->lod_count; ++l) {
+                if ((unsigned long long) header->lods[l].first_index +
+                        header->lods[l].index_count > header->index_count)
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int are_indices_valid(const struct mesh_file_header *header,
+        const void *index_data)
+{
+        // Compressed indices are checked as they are decoded
+        if (header->compression != MESH_FILE_COMPRESSION_NONE)
+                return 1;
+
+        unsigned int max_index = 0;
+        if (header->index_stride == sizeof (unsigned int)) {
+                const unsigned int *indices = index_data;
+                for (unsigned int i = 0; i < header->index_count; ++i) {
+                        if (indices[i] > max_index)
+                                max_index = indices[i];
+                }
+        } else {
+                const unsigned short *indices = index_data;
+                for (unsigned int i = 0; i < header->index_count; ++i) {
+                        if (indices[i] > max_index)
+                                max_index = indices[i];
+                }
+        }
+
+        return header->index_count == 0 || max_index < header->vertex_count;
+}
+
+int open_mesh_file(struct mesh_file_info *file_info)
+{
+        double start_time = get_time_in_secs();
+
+        memset(&file_info->stats, 0, sizeof (struct mesh_file_stats));
+        file_info->header = NULL;
+        file_info->vertex_data = NULL;
+        file_info->index_data = NULL;
+
+        struct file_map_info *file_map = &file_info->file_map;
+        if (!map_file(file_info->path, file_map))
+                return 0;
+
+        const unsigned char *data = file_map->data;
+        const struct mesh_file_header *header =
+                (const struct mesh_file_header *) data;
+        // Indices past the vertices would have the GPU and the CPU side
+        // users of the mesh read outside of it
+        if (file_map->size < sizeof (struct mesh_file_header) ||
+                !is_header_valid(header, file_map->size) ||
+                !are_indices_valid(header, data +
+                header->index_data_offset)) {
+                unmap_file(file_map);
+                return 0;
+        }
+
+        file_info->header = header;
+        file_info->vertex_data = data + header->vertex_data_offset;
+        file_info->index_data = data + header->index_data_offset;
+        file_info->stats.open_time = get_time_in_secs() - start_time;
+
+        return 1;
+}
+
+void close_mesh_file(struct mesh_file_info *file_info)
+{
+        unmap_file(&file_info->file_map);
+
+        file_info->header = NULL;
+        file_info->vertex_data = NULL;
+        file_info->index_data = NULL;
+}
+
+static int is_same_format(const struct mesh_file_header *header,
+        struct vertex_format *format)
+{
+        if (header->vertex_stride != format->stride ||
+                header->attribute_count != format->attribute_count)
+                return 0;
+
+        for (unsigned int a = 0; a < format->attribute_count; ++a) {
+                if (header->attributes[a].semantic !=
+                        format->attributes[a].semantic ||
+                        header->attributes[a].format !=
+                        format->attributes[a].format ||
+                        header->attributes[a].offset !=
+                        format->attributes[a].offset)
+                        return 0;
+        }
+
+        return 1;
+}
+
+int get_mesh_file_format(struct mesh_file_info *file_info,
+        struct vertex_format *format)
+{
+        const struct mesh_file_header *header = file_info->header;
+        for (unsigned int layout = VERTEX_LAYOUT_FLOAT;
+                layout <= VERTEX_LAYOUT_HALF; ++layout) {
+                for (int has_normals = 0; has_normals < 2; ++has_normals) {
+                        get_vertex_format(layout, has_normals, format);
+                        if (!is_same_format(header, format))
+                                continue;
+
+                        for (int k = 0; k < 3; ++k) {
+                                format->position_scale[k] =
+                                        header->position_scale[k];
+                                format->position_bias[k] =
+                                        header->position_bias[k];
+                        }
+
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+// The layout of struct vertex, which can be used without decoding
+static int is_vertex_layout(struct mesh_file_info *file_info)
+{
+        struct vertex_format format;
+        return get_mesh_file_format(file_info, &format) &&
+                format.layout == VERTEX_LAYOUT_FLOAT &&
+                format.stride == sizeof (struct vertex);
+}
+
+static void set_mesh_lods(const struct mesh_file_header *header,
+        struct mesh_info *mi)
+{
+        mi->lod_count = header->lod_count;
+        for (unsigned int l = 0; l < header->lod_count; ++l) {
+                mi->lods[l].first_index = header->lods[l].first_index;
+                mi->lods[l].index_count = header->lods[l].index_count;
+                mi->lods[l].error = header->lods[l].error;
+        }
+}
+
+int get_mesh_file_mesh(struct mesh_file_info *file_info,
+        struct mesh_info *mi)
+{
+        const struct mesh_file_header *header = file_info->header;
+        if (!is_vertex_layout(file_info) ||
+                header->index_stride != sizeof (unsigned int) ||
+                header->compression != MESH_FILE_COMPRESSION_NONE)
+                return 0;
+
+        // The mapping is read only, the mesh must not be written through
+        mi->vertex_count = header->vertex_count;
+        mi->verticies = (struct vertex *) file_info->vertex_data;
+        mi->index_count = header->index_count;
+        mi->indices = (unsigned int *) file_info->index_data;
+        set_mesh_lods(header, mi);
+
+        return 1;
+}
+
+int copy_mesh_file_mesh(struct mesh_file_info *file_info,
+        struct mesh_info *mi)
+{
+        const struct mesh_file_header *header = file_info->header;
+        struct vertex_format format;
+        if (!get_mesh_file_format(file_info, &format))
+                return 0;
+
+        mi->vertex_count = header->vertex_count;
+        mi->verticies = malloc((header->vertex_count + 1) *
+                sizeof (struct vertex));
+        mi->index_count = header->index_count;
+        mi->indices = malloc((header->index_count + 1) *
+                sizeof (unsigned int));
+        set_mesh_lods(header, mi);
+
+        int is_copied = 1;
+        if (is_vertex_layout(file_info)) {
+                is_copied = copy_mesh_file_vertices(file_info, mi->verticies);
+        } else if (header->compression == MESH_FILE_COMPRESSION_CODEC) {
+                void *vertex_data = malloc(
+                        (size_t) header->vertex_data_size + 1);
+                is_copied = copy_mesh_file_vertices(file_info, vertex_data);
+                if (is_copied)
+                        decode_vertices(&format, vertex_data,
+                                header->vertex_count, mi->verticies);
+                free(vertex_data);
+        } else {
+                decode_vertices(&format, file_info->vertex_data,
+                        header->vertex_count, mi->verticies);
+        }
+
+        if (header->compression == MESH_FILE_COMPRESSION_CODEC) {
+                is_copied = is_copied && decode_index_buffer(mi->indices,
+                        sizeof (unsigned int), header->index_count,
+                        header->vertex_count, file_info->index_data,
+                        header->index_stored_size);
+        } else if (header->index_stride == sizeof (unsigned int)) {
+                memcpy(mi->indices, file_info->index_data,
+                        (size_t) header->index_data_size);
+        } else {
+                const unsigned short *indices = file_info->index_data;
+                for (unsigned int i = 0; i < header->index_count; ++i)
+                        mi->indices[i] = indices[i];
+        }
+
+        if (!is_copied)
+                release_mesh_file_mesh(mi);
+
+        return is_copied;
+}
+
+void release_mesh_file_mesh(struct mesh_info *mi)
+{
+        free(mi->indices);
+        free(mi->verticies);
+        mi->indices = NULL;
+        mi->verticies = NULL;
+}
+
+static unsigned long long get_chunk_offset(struct mesh_copy_job *job,
+        unsigned int chunk)
+{
+        if (chunk == job->chunk_count)
+                return job->size;
+
+        // Chunks start on cache lines so no two threads write the same one
+        return job->size * chunk / job->chunk_count &
+                ~(unsigned long long) (MESH_FILE_ALIGNMENT - 1);
+}
+
+static void copy_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct mesh_copy_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned long long first = get_chunk_offset(job, c);
+                unsigned long long last = get_chunk_offset(job, c + 1);
+                memcpy(job->dst + first, job->src + first, last - first);
+        }
+}
+
+static void add_copy_stats(struct mesh_file_info *file_info,
+        double start_time, unsigned long long copied_size,
+        unsigned long long read_size)
+{
+        file_info->stats.copy_time += get_time_in_secs() - start_time;
+        file_info->stats.copied_size += copied_size;
+        file_info->stats.read_size += read_size;
+}
+
+static void copy_mesh_data(struct mesh_file_info *file_info, void *dst,
+        const void *src, unsigned long long size)
+{
+        double start_time = get_time_in_secs();
+
+        struct mesh_copy_job job;
+        job.dst = dst;
+        job.src = src;
+        job.size = size;
+        job.chunk_count = 1;
+
+        // Pages of the file are read in as they are first touched, so
+        // splitting large copies also spreads the page faults over the
+        // workers
+        struct job_system_info *job_system = file_info->job_system;
+        if (job_system != NULL && size >= MESH_FILE_PARALLEL_MIN_SIZE) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_MESH_FILE_CHUNKS)
+                        job.chunk_count = MAX_MESH_FILE_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, copy_chunks, &job);
+
+        add_copy_stats(file_info, start_time, size, size);
+}
+
+int copy_mesh_file_vertices(struct mesh_file_info *file_info, void *dst)
+{
+        const struct mesh_file_header *header = file_info->header;
+        if (header->compression == MESH_FILE_COMPRESSION_NONE) {
+                copy_mesh_data(file_info, dst, file_info->vertex_data,
+                        header->vertex_data_size);
+                return 1;
+        }
+
+        double start_time = get_time_in_secs();
+        int is_decoded = decode_vertex_buffer(file_info->job_system, dst,
+                header->vertex_count, header->vertex_stride,
+                file_info->vertex_data, header->vertex_stored_size);
+        add_copy_stats(file_info, start_time, header->vertex_data_size,
+                header->vertex_stored_size);
+
+        return is_decoded;
+}
+
+int copy_mesh_file_indices(struct mesh_file_info *file_info, void *dst)
+{
+        const struct mesh_file_header *header = file_info->header;
+        if (header->compression == MESH_FILE_COMPRESSION_NONE) {
+                copy_mesh_data(file_info, dst, file_info->index_data,
+                        header->index_data_size);
+                return 1;
+        }
+
+        double start_time = get_time_in_secs();
+        int is_decoded = decode_index_buffer(dst, header->index_stride,
+                header->index_count, header->vertex_count,
+                file_info->index_data, header->index_stored_size);
+        add_copy_stats(file_info, start_time, header->index_data_size,
+                header->index_stored_size);
+
+        return is_decoded;
+}
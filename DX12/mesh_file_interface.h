@@ -0,0 +1,128 @@
+#ifndef MESH_FILE_INTERFACE_H
+#define MESH_FILE_INTERFACE_H
+
+#include "mesh_interface.h"
+#include "job_interface.h"
+#include "file_map_interface.h"
+#include "vertex_format_interface.h"
+
+// Versioned binary mesh container. A fixed header describes the vertex
+// layout, the bounds and the levels of detail, followed by the vertex and
+// index data, each aligned so it can be copied as is. Files are mapped into
+// memory rather than read and parsed, and their data goes straight from the
+// mapping into upload memory, or is decoded straight into it when the file
+// is compressed. Files are little endian. Kept free of D3D types so it can
+// run headless.
+#define MESH_FILE_MAGIC 0x4853454d // "MESH"
+#define MESH_FILE_VERSION 3
+#define MESH_FILE_ALIGNMENT 64
+#define MAX_MESH_FILE_ATTRIBUTES 8
+#define MAX_MESH_FILE_PATH 260
+#define MESH_FILE_PARALLEL_MIN_SIZE (4 << 20)
+#define MAX_MESH_FILE_CHUNKS 64
+#define MESH_FILE_INDEX_BLOCK_SIZE 4096
+
+enum MESH_FILE_COMPRESSION {
+        MESH_FILE_COMPRESSION_NONE,
+        // The codecs of mesh_codec_interface.h
+        MESH_FILE_COMPRESSION_CODEC
+};
+
+// Offset in bytes from the start of the vertex
+struct mesh_file_attribute {
+        unsigned int semantic;
+        unsigned int format;
+        unsigned int offset;
+};
+
+struct mesh_file_lod {
+        unsigned int first_index;
+        unsigned int index_count;
+        float error;
+};
+
+// Laid out without implicit padding so it reads the same for every compiler.
+// Data offsets are from the start of the file. Data sizes are those of the
+// decoded data, and stored sizes what it takes in the file, which are the
+// same when it is not compressed.
+struct mesh_file_header {
+        unsigned int magic;
+        unsigned int version;
+        unsigned int header_size;
+        unsigned int attribute_count;
+        struct mesh_file_attribute attributes[MAX_MESH_FILE_ATTRIBUTES];
+        unsigned int vertex_stride;
+        unsigned int vertex_count;
+        unsigned int index_stride;
+        unsigned int index_count;
+        unsigned long long vertex_data_offset;
+        unsigned long long vertex_data_size;
+        unsigned long long index_data_offset;
+        unsigned long long index_data_size;
+        float bounds_min[4];
+        float bounds_max[4];
+        // Centre and radius
+        float bounding_sphere[4];
+        // Quantized positions are stored as (position - bias) / scale, see
+        // struct vertex_format
+        float position_scale[4];
+        float position_bias[4];
+        unsigned int lod_count;
+        unsigned int compression;
+        struct mesh_file_lod lods[MAX_MESH_LODS];
+        unsigned long long vertex_stored_size;
+        unsigned long long index_stored_size;
+};
+
+struct mesh_file_stats {
+        double open_time;
+        double copy_time;
+        unsigned long long copied_size;
+        // Less than the copied size when the file is compressed
+        unsigned long long read_size;
+};
+
+struct mesh_file_info {
+        char path[MAX_MESH_FILE_PATH];
+        struct job_system_info *job_system;
+        struct file_map_info file_map;
+        const struct mesh_file_header *header;
+        const void *vertex_data;
+        const void *index_data;
+        struct mesh_file_stats stats;
+};
+
+// Writes a mesh in one of VERTEX_LAYOUT, with 16 bit indices when it has
+// no more than INDEX_16_MAX_VERTEX_COUNT vertices and 32 bit ones
+// otherwise, compressed as one of MESH_FILE_COMPRESSION. Returns 0 when the
+// file could not be written.
+int write_mesh_file(const char *path, struct mesh_info *mi,
+        unsigned int layout, unsigned int compression);
+// Maps the file at path, returns 0 when it is missing or not a valid mesh
+// file of this version. Uncompressed indices are read through once to check
+// that they are all below the vertex count, compressed ones as they are
+// decoded.
+int open_mesh_file(struct mesh_file_info *file_info);
+void close_mesh_file(struct mesh_file_info *file_info);
+// Fills in the vertex format of the file, with the scale and bias of its
+// positions. Returns 0 when its attributes are not one of VERTEX_LAYOUT.
+int get_mesh_file_format(struct mesh_file_info *file_info,
+        struct vertex_format *format);
+// Points the mesh at the data in the mapping, valid until the file is
+// closed. Returns 0 when the layout is not that of struct vertex with 32 bit
+// indices, or when the file is compressed.
+int get_mesh_file_mesh(struct mesh_file_info *file_info,
+        struct mesh_info *mi);
+// Fills in the mesh with its own copy of the data, with the indices widened
+// to 32 bits, for files it can't point into. Quantized vertices are decoded
+// back into struct vertex. Returns 0 when the layout is not one of
+// VERTEX_LAYOUT or the compressed data is malformed.
+int copy_mesh_file_mesh(struct mesh_file_info *file_info,
+        struct mesh_info *mi);
+void release_mesh_file_mesh(struct mesh_info *mi);
+// dst must hold vertex_data_size or index_data_size bytes, such as a mapped
+// upload resource. Returns 0 when the compressed data is malformed.
+int copy_mesh_file_vertices(struct mesh_file_info *file_info, void *dst);
+int copy_mesh_file_indices(struct mesh_file_info *file_info, void *dst);
+
+#endif
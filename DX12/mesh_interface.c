@@ -50,6 +50,12 @@ void create_triangle(struct mesh_info *mi)
         mi->indices[0] = 0;
         mi->indices[1] = 1;
         mi->indices[2] = 2;
+
+        // There is nothing to take away from a single triangle
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+        mi->lods[0].error = 0.0f;
 }
 
 void release_triangle(struct mesh_info *mi)
@@ -3,6 +3,7 @@
 
 #include "linmath.h"
 
+#define MAX_MESH_LODS 8
 
 struct vertex {
         vec4 position;
@@ -10,11 +11,22 @@ struct vertex {
         vec2 uv;
 };
 
+// A level of detail is a range of the index buffer, with the geometric error
+// of the level in model units. Level 0 is the full mesh and the error grows
+// with every level after it.
+struct mesh_lod {
+        unsigned int first_index;
+        unsigned int index_count;
+        float error;
+};
+
 struct mesh_info {
         unsigned int vertex_count;
         struct vertex *verticies;
         unsigned int index_count;
         unsigned int *indices;
+        unsigned int lod_count;
+        struct mesh_lod lods[MAX_MESH_LODS];
 };
 
 void create_triangle(struct mesh_info *mi);
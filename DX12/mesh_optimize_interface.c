@@ -0,0 +1,565 @@
+#include "mesh_optimize_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define NO_VERTEX 0xffffffff
+#define MOVED_VERTEX 0xfffffffe
+
+struct cluster_key {
+        float key;
+        unsigned int cluster;
+};
+
+// Scratch space for reordering one range of the index buffer, sized for the
+// whole mesh so every level of detail can share it
+struct tipsify_state {
+        unsigned int cache_size;
+        unsigned int vertex_count;
+        unsigned int *offsets;
+        unsigned int *adjacency;
+        unsigned int *live_counts;
+        unsigned int *stamps;
+        unsigned int *dead_ends;
+        unsigned char *is_emitted;
+        unsigned int *output;
+        unsigned int *cluster_starts;
+        unsigned int *split_starts;
+        struct cluster_key *cluster_keys;
+        vec3 *cluster_normals;
+};
+
+void get_vertex_cache_metrics(const unsigned int *indices,
+        unsigned int index_count, unsigned int vertex_count,
+        unsigned int cache_size, struct vertex_cache_metrics *metrics)
+{
+        // A vertex is cached while fewer than cache_size others have been
+        // added after it, and a stamp of 0 means it was never used
+        unsigned int *stamps = calloc(vertex_count + 1,
+                sizeof (unsigned int));
+        unsigned int time = cache_size + 1;
+        unsigned int used_count = 0;
+
+        metrics->miss_count = 0;
+        for (unsigned int i = 0; i < index_count; ++i) {
+                unsigned int v = indices[i];
+                assert(v < vertex_count);
+
+                if (time - stamps[v] > cache_size) {
+                        used_count += stamps[v] == 0;
+                        stamps[v] = time++;
+                        ++metrics->miss_count;
+                }
+        }
+
+        metrics->acmr = index_count > 0 ? (float) metrics->miss_count /
+                (index_count / 3) : 0.0f;
+        metrics->atvr = used_count > 0 ? (float) metrics->miss_count /
+                used_count : 0.0f;
+
+        free(stamps);
+}
+
+// Adjacency from every vertex to the triangles using it
+static void build_adjacency(struct tipsify_state *state,
+        const unsigned int *indices, unsigned int triangle_count)
+{
+        memset(state->live_counts, 0, state->vertex_count *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < triangle_count * 3; ++i) {
+                assert(indices[i] < state->vertex_count);
+                ++state->live_counts[indices[i]];
+        }
+
+        unsigned int offset = 0;
+        for (unsigned int v = 0; v < state->vertex_count; ++v) {
+                state->offsets[v] = offset;
+                offset += state->live_counts[v];
+        }
+        state->offsets[state->vertex_count] = offset;
+
+        // offsets[v] is moved past each triangle added, then back
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                for (unsigned int k = 0; k < 3; ++k) {
+                        unsigned int v = indices[t * 3 + k];
+                        state->adjacency[state->offsets[v]++] = t;
+                }
+        }
+
+        for (unsigned int v = 0; v < state->vertex_count; ++v)
+                state->offsets[v] -= state->live_counts[v];
+}
+
+// Of the vertices the last fan added, picks the one that will still be in
+// the cache once its remaining triangles are emitted and has been there
+// longest
+static unsigned int get_next_vertex(struct tipsify_state *state,
+        unsigned int first_candidate, unsigned int candidate_end,
+        unsigned int time)
+{
+        unsigned int best = NO_VERTEX;
+        unsigned int best_priority = 0;
+
+        for (unsigned int i = first_candidate; i < candidate_end; ++i) {
+                unsigned int v = state->dead_ends[i];
+                unsigned int live_count = state->live_counts[v];
+                if (live_count == 0)
+                        continue;
+
+                unsigned int age = time - state->stamps[v];
+                unsigned int priority = age + 2 * live_count <=
+                        state->cache_size ? age + 1 : 1;
+                if (priority > best_priority) {
+                        best_priority = priority;
+                        best = v;
+                }
+        }
+
+        return best;
+}
+
+// The most recently used vertex with triangles left, or else the next one
+// in index order
+static unsigned int skip_dead_end(struct tipsify_state *state,
+        unsigned int *dead_end_count, unsigned int *cursor)
+{
+        while (*dead_end_count > 0) {
+                unsigned int v = state->dead_ends[--*dead_end_count];
+                if (state->live_counts[v] > 0)
+                        return v;
+        }
+
+        while (*cursor < state->vertex_count) {
+                if (state->live_counts[*cursor] > 0)
+                        return *cursor;
+                ++*cursor;
+        }
+
+        return NO_VERTEX;
+}
+
+// Writes the reordered triangles to output and returns the number of
+// clusters, each starting where a dead end was skipped
+static unsigned int tipsify(struct tipsify_state *state,
+        const unsigned int *indices, unsigned int triangle_count)
+{
+        build_adjacency(state, indices, triangle_count);
+        memset(state->stamps, 0, state->vertex_count * sizeof (unsigned int));
+        memset(state->is_emitted, 0, triangle_count);
+
+        unsigned int time = state->cache_size + 1;
+        unsigned int dead_end_count = 0;
+        unsigned int cursor = 0;
+        unsigned int emitted_count = 0;
+        unsigned int cluster_count = 0;
+        unsigned int fan = skip_dead_end(state, &dead_end_count, &cursor);
+
+        if (fan != NO_VERTEX)
+                state->cluster_starts[cluster_count++] = 0;
+
+        while (fan != NO_VERTEX) {
+                unsigned int first_candidate = dead_end_count;
+                for (unsigned int a = state->offsets[fan];
+                        a < state->offsets[fan + 1]; ++a) {
+                        unsigned int t = state->adjacency[a];
+                        if (state->is_emitted[t])
+                                continue;
+
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                unsigned int v = indices[t * 3 + k];
+                                state->output[emitted_count * 3 + k] = v;
+                                state->dead_ends[dead_end_count++] = v;
+                                --state->live_counts[v];
+                                if (time - state->stamps[v] >
+                                        state->cache_size)
+                                        state->stamps[v] = time++;
+                        }
+
+                        state->is_emitted[t] = 1;
+                        ++emitted_count;
+                }
+
+                fan = get_next_vertex(state, first_candidate, dead_end_count,
+                        time);
+                if (fan == NO_VERTEX) {
+                        fan = skip_dead_end(state, &dead_end_count, &cursor);
+                        if (fan != NO_VERTEX)
+                                state->cluster_starts[cluster_count++] =
+                                        emitted_count;
+                }
+        }
+
+        assert(emitted_count == triangle_count);
+
+        return cluster_count;
+}
+
+// Splits the clusters further where the triangles from the start of a
+// cluster already use the cache nearly as well as the whole cluster does,
+// restarting the cache at every split the way a new cluster would
+static unsigned int split_clusters(struct tipsify_state *state,
+        unsigned int triangle_count, unsigned int cluster_count,
+        float threshold)
+{
+        unsigned int *output = state->output;
+        unsigned int *split_starts = state->split_starts;
+        unsigned int cache_size = state->cache_size;
+        unsigned int time = 0;
+        unsigned int split_count = 0;
+
+        memset(state->stamps, 0, state->vertex_count * sizeof (unsigned int));
+        for (unsigned int c = 0; c < cluster_count; ++c) {
+                unsigned int start = state->cluster_starts[c];
+                unsigned int end = c + 1 < cluster_count ?
+                        state->cluster_starts[c + 1] : triangle_count;
+
+                // Moving time on by more than the cache size empties it
+                time += cache_size + 1;
+                unsigned int miss_count = 0;
+                for (unsigned int i = start * 3; i < end * 3; ++i) {
+                        if (time - state->stamps[output[i]] > cache_size) {
+                                state->stamps[output[i]] = time++;
+                                ++miss_count;
+                        }
+                }
+
+                float max_acmr = (float) miss_count / (end - start) *
+                        threshold;
+                time += cache_size + 1;
+                miss_count = 0;
+                split_starts[split_count++] = start;
+                for (unsigned int t = start; t < end; ++t) {
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                unsigned int v = output[t * 3 + k];
+                                if (time - state->stamps[v] > cache_size) {
+                                        state->stamps[v] = time++;
+                                        ++miss_count;
+                                }
+                        }
+
+                        unsigned int split_triangle_count = t + 1 -
+                                split_starts[split_count - 1];
+                        if (t + 1 < end && miss_count <= max_acmr *
+                                split_triangle_count) {
+                                split_starts[split_count++] = t + 1;
+                                time += cache_size + 1;
+                                miss_count = 0;
+                        }
+                }
+        }
+
+        return split_count;
+}
+
+static int compare_cluster_keys(const void *a, const void *b)
+{
+        const struct cluster_key *key_a = a;
+        const struct cluster_key *key_b = b;
+
+        // Largest first, then in cluster order
+        if (key_a->key != key_b->key)
+                return key_a->key < key_b->key ? 1 : -1;
+
+        return key_a->cluster < key_b->cluster ? -1 :
+                key_a->cluster > key_b->cluster;
+}
+
+// Sorts the clusters by how far their area weighted centre lies out from
+// the centre of the range along their average normal, then writes them to
+// dst in that order
+static void sort_clusters(struct tipsify_state *state,
+        struct vertex *vertices, unsigned int triangle_count,
+        unsigned int cluster_count, unsigned int *cluster_starts,
+        unsigned int *dst)
+{
+        unsigned int *output = state->output;
+        vec3 mesh_centre = { 0.0f, 0.0f, 0.0f };
+        float mesh_area = 0.0f;
+
+        for (unsigned int c = 0; c < cluster_count; ++c) {
+                unsigned int start = cluster_starts[c];
+                unsigned int end = c + 1 < cluster_count ?
+                        cluster_starts[c + 1] : triangle_count;
+                vec3 centre = { 0.0f, 0.0f, 0.0f };
+                float *normal = state->cluster_normals[c];
+                float area = 0.0f;
+                normal[0] = 0.0f;
+                normal[1] = 0.0f;
+                normal[2] = 0.0f;
+
+                for (unsigned int t = start; t < end; ++t) {
+                        float *p0 = vertices[output[t * 3]].position;
+                        float *p1 = vertices[output[t * 3 + 1]].position;
+                        float *p2 = vertices[output[t * 3 + 2]].position;
+                        vec3 e1;
+                        vec3 e2;
+                        vec3 n;
+                        vec3_sub(e1, p1, p0);
+                        vec3_sub(e2, p2, p0);
+                        // Front faces are clockwise, seen from a right
+                        // handed view looking down -z, so this faces out
+                        vec3_mul_cross(n, e2, e1);
+
+                        // The length of the cross product is twice the area
+                        float triangle_area = vec3_len(n);
+                        for (int k = 0; k < 3; ++k) {
+                                centre[k] += (p0[k] + p1[k] + p2[k]) *
+                                        triangle_area;
+                                normal[k] += n[k];
+                        }
+                        area += triangle_area;
+                }
+
+                vec3_add(mesh_centre, mesh_centre, centre);
+                mesh_area += area;
+
+                float normal_length = vec3_len(normal);
+                vec3_scale(centre, centre, area > 0.0f ? 1.0f /
+                        (area * 3.0f) : 0.0f);
+                vec3_scale(normal, normal, normal_length > 0.0f ? 1.0f /
+                        normal_length : 0.0f);
+                state->cluster_keys[c].key = vec3_mul_inner(centre, normal);
+                state->cluster_keys[c].cluster = c;
+        }
+
+        vec3_scale(mesh_centre, mesh_centre, mesh_area > 0.0f ? 1.0f /
+                (mesh_area * 3.0f) : 0.0f);
+        for (unsigned int c = 0; c < cluster_count; ++c) {
+                state->cluster_keys[c].key -= vec3_mul_inner(mesh_centre,
+                        state->cluster_normals[c]);
+        }
+
+        qsort(state->cluster_keys, cluster_count, sizeof (struct cluster_key),
+                compare_cluster_keys);
+
+        for (unsigned int i = 0; i < cluster_count; ++i) {
+                unsigned int c = state->cluster_keys[i].cluster;
+                unsigned int start = cluster_starts[c];
+                unsigned int end = c + 1 < cluster_count ?
+                        cluster_starts[c + 1] : triangle_count;
+                unsigned int count = (end - start) * 3;
+
+                memcpy(dst, &output[start * 3], count * sizeof (unsigned int));
+                dst += count;
+        }
+}
+
+// Levels of detail that overlap one already reordered are left alone
+static int is_range_reordered(struct mesh_info *mi, unsigned int lod)
+{
+        struct mesh_lod *range = &mi->lods[lod];
+
+        for (unsigned int l = 0; l < lod; ++l) {
+                struct mesh_lod *other = &mi->lods[l];
+                if (range->first_index < other->first_index +
+                        other->index_count && other->first_index <
+                        range->first_index + range->index_count)
+                        return 1;
+        }
+
+        return 0;
+}
+
+void optimize_mesh_indices(struct mesh_optimize_info *optimize_info,
+        struct mesh_info *mi)
+{
+        struct mesh_optimize_stats *stats = &optimize_info->stats;
+        unsigned int cache_size = optimize_info->cache_size != 0 ?
+                optimize_info->cache_size : MESH_OPTIMIZE_CACHE_SIZE;
+        unsigned int index_count = mi->index_count;
+        unsigned int triangle_count = index_count / 3;
+
+        assert(index_count % 3 == 0);
+
+        stats->triangle_count = triangle_count;
+        stats->cluster_count = 0;
+        stats->cache_time = 0.0;
+        stats->overdraw_time = 0.0;
+        get_vertex_cache_metrics(mi->indices, index_count, mi->vertex_count,
+                cache_size, &stats->before);
+
+        struct tipsify_state state;
+        state.cache_size = cache_size;
+        state.vertex_count = mi->vertex_count;
+        state.offsets = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        state.adjacency = malloc((index_count + 1) * sizeof (unsigned int));
+        state.live_counts = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        state.stamps = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        state.dead_ends = malloc((index_count + 1) * sizeof (unsigned int));
+        state.is_emitted = malloc(triangle_count + 1);
+        state.output = malloc((index_count + 1) * sizeof (unsigned int));
+        state.cluster_starts = malloc((triangle_count + 1) *
+                sizeof (unsigned int));
+        state.split_starts = malloc((triangle_count + 1) *
+                sizeof (unsigned int));
+        state.cluster_keys = malloc((triangle_count + 1) *
+                sizeof (struct cluster_key));
+        state.cluster_normals = malloc((triangle_count + 1) *
+                sizeof (vec3));
+
+        // A mesh without levels is one range
+        struct mesh_lod whole_mesh = { 0, index_count, 0.0f };
+        unsigned int range_count = mi->lod_count > 0 ? mi->lod_count : 1;
+        struct mesh_lod *ranges = mi->lod_count > 0 ? mi->lods : &whole_mesh;
+
+        for (unsigned int r = 0; r < range_count; ++r) {
+                if (mi->lod_count > 0 && is_range_reordered(mi, r))
+                        continue;
+
+                unsigned int range_triangle_count = ranges[r].index_count /
+                        3;
+                assert(ranges[r].first_index + ranges[r].index_count <=
+                        index_count);
+                if (range_triangle_count == 0)
+                        continue;
+
+                unsigned int *indices = mi->indices + ranges[r].first_index;
+
+                double start_time = get_time_in_secs();
+                unsigned int cluster_count = tipsify(&state, indices,
+                        range_triangle_count);
+                double tipsify_time = get_time_in_secs();
+                stats->cache_time += tipsify_time - start_time;
+
+                if (optimize_info->overdraw_threshold <= 0.0f) {
+                        memcpy(indices, state.output, range_triangle_count *
+                                3 * sizeof (unsigned int));
+                        stats->cluster_count += cluster_count;
+                        continue;
+                }
+
+                cluster_count = split_clusters(&state, range_triangle_count,
+                        cluster_count, optimize_info->overdraw_threshold);
+                sort_clusters(&state, mi->verticies, range_triangle_count,
+                        cluster_count, state.split_starts, indices);
+                stats->cluster_count += cluster_count;
+                stats->overdraw_time += get_time_in_secs() - tipsify_time;
+        }
+
+        free(state.cluster_normals);
+        free(state.cluster_keys);
+        free(state.split_starts);
+        free(state.cluster_starts);
+        free(state.output);
+        free(state.is_emitted);
+        free(state.dead_ends);
+        free(state.stamps);
+        free(state.live_counts);
+        free(state.adjacency);
+        free(state.offsets);
+
+        get_vertex_cache_metrics(mi->indices, index_count, mi->vertex_count,
+                cache_size, &stats->after);
+}
+
+void get_vertex_fetch_metrics(const unsigned int *indices,
+        unsigned int index_count, unsigned int vertex_count,
+        unsigned int vertex_size, unsigned int cache_line_size,
+        struct vertex_fetch_metrics *metrics)
+{
+        unsigned long long line_count = ((unsigned long long) vertex_count *
+                vertex_size + cache_line_size - 1) / cache_line_size;
+        unsigned int cache_size = MESH_OPTIMIZE_FETCH_CACHE_SIZE /
+                cache_line_size;
+        unsigned int *stamps = calloc(line_count + 1, sizeof (unsigned int));
+        unsigned char *is_used = calloc(vertex_count + 1, 1);
+        unsigned int time = cache_size + 1;
+        unsigned int used_count = 0;
+
+        assert(cache_line_size > 0 && cache_size > 0);
+
+        metrics->fetched_size = 0;
+        for (unsigned int i = 0; i < index_count; ++i) {
+                unsigned int v = indices[i];
+                assert(v < vertex_count);
+
+                used_count += !is_used[v];
+                is_used[v] = 1;
+
+                // A vertex can straddle lines
+                unsigned long long start = (unsigned long long) v *
+                        vertex_size;
+                unsigned long long first_line = start / cache_line_size;
+                unsigned long long last_line = (start + vertex_size - 1) /
+                        cache_line_size;
+                for (unsigned long long l = first_line; l <= last_line; ++l) {
+                        if (time - stamps[l] > cache_size) {
+                                stamps[l] = time++;
+                                metrics->fetched_size += cache_line_size;
+                        }
+                }
+        }
+
+        metrics->overfetch = used_count > 0 ? (float) ((double)
+                metrics->fetched_size / ((double) used_count *
+                vertex_size)) : 0.0f;
+
+        free(is_used);
+        free(stamps);
+}
+
+void optimize_vertex_fetch(struct mesh_optimize_info *optimize_info,
+        struct mesh_info *mi)
+{
+        struct mesh_optimize_stats *stats = &optimize_info->stats;
+        unsigned int cache_line_size = optimize_info->cache_line_size != 0 ?
+                optimize_info->cache_line_size :
+                MESH_OPTIMIZE_CACHE_LINE_SIZE;
+
+        get_vertex_fetch_metrics(mi->indices, mi->index_count,
+                mi->vertex_count, sizeof (struct vertex), cache_line_size,
+                &stats->fetch_before);
+
+        double start_time = get_time_in_secs();
+
+        // New number of every vertex, NO_VERTEX for the unused ones
+        unsigned int *remap = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        memset(remap, 0xff, mi->vertex_count * sizeof (unsigned int));
+
+        unsigned int used_count = 0;
+        for (unsigned int i = 0; i < mi->index_count; ++i) {
+                unsigned int v = mi->indices[i];
+                assert(v < mi->vertex_count);
+
+                if (remap[v] == NO_VERTEX)
+                        remap[v] = used_count++;
+                mi->indices[i] = remap[v];
+        }
+
+        // Each vertex is carried along the chain of places it moves to,
+        // which ends back where it started or at an unused vertex
+        for (unsigned int v = 0; v < mi->vertex_count; ++v) {
+                unsigned int next = remap[v];
+                if (next == NO_VERTEX || next == MOVED_VERTEX)
+                        continue;
+
+                remap[v] = MOVED_VERTEX;
+                struct vertex carried = mi->verticies[v];
+                while (next != NO_VERTEX && next != MOVED_VERTEX) {
+                        struct vertex displaced = mi->verticies[next];
+                        mi->verticies[next] = carried;
+                        carried = displaced;
+
+                        unsigned int after = remap[next];
+                        remap[next] = MOVED_VERTEX;
+                        next = after;
+                }
+        }
+
+        free(remap);
+
+        stats->stripped_vertex_count = mi->vertex_count - used_count;
+        mi->vertex_count = used_count;
+        stats->fetch_time = get_time_in_secs() - start_time;
+
+        get_vertex_fetch_metrics(mi->indices, mi->index_count,
+                mi->vertex_count, sizeof (struct vertex), cache_line_size,
+                &stats->fetch_after);
+}
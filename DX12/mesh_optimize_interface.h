@@ -0,0 +1,80 @@
+#ifndef MESH_OPTIMIZE_INTERFACE_H
+#define MESH_OPTIMIZE_INTERFACE_H
+
+#include "mesh_interface.h"
+
+// Load time index and vertex buffer optimization. Triangles are reordered with
+// Tipsify, which fans around recently used vertices so they are still in
+// the post-transform cache, in linear time. Its output falls into clusters
+// where it had to jump to a new part of the mesh, which are split further
+// wherever that costs little cache efficiency and then sorted so clusters
+// facing away from the middle of the mesh come first. Those are the ones
+// most likely to be in front from any direction, which cuts overdraw
+// without knowing the view. Every level of detail is reordered on its own
+// and triangles keep their winding. Vertices are then renumbered in the
+// order the indices first use them, so fetches walk the vertex buffer
+// forward a cache line at a time, and unused ones are dropped. Kept free of
+// D3D types so it can run headless.
+#define MESH_OPTIMIZE_CACHE_SIZE 16
+#define MESH_OPTIMIZE_OVERDRAW_THRESHOLD 1.05f
+#define MESH_OPTIMIZE_CACHE_LINE_SIZE 64
+#define MESH_OPTIMIZE_FETCH_CACHE_SIZE (16 << 10)
+
+// Average cache miss ratio is misses per triangle, from 0.5 at best to 3,
+// and average transform to vertex ratio is misses per vertex used, from 1
+struct vertex_cache_metrics {
+        unsigned int miss_count;
+        float acmr;
+        float atvr;
+};
+
+// Overfetch is the size of the cache lines read over that of the vertices
+// used, from 1 at best
+struct vertex_fetch_metrics {
+        unsigned long long fetched_size;
+        float overfetch;
+};
+
+struct mesh_optimize_stats {
+        unsigned int triangle_count;
+        unsigned int cluster_count;
+        struct vertex_cache_metrics before;
+        struct vertex_cache_metrics after;
+        double cache_time;
+        double overdraw_time;
+        unsigned int stripped_vertex_count;
+        struct vertex_fetch_metrics fetch_before;
+        struct vertex_fetch_metrics fetch_after;
+        double fetch_time;
+};
+
+struct mesh_optimize_info {
+        // Size of the simulated FIFO cache, MESH_OPTIMIZE_CACHE_SIZE when 0
+        unsigned int cache_size;
+        // How far over the miss ratio of its whole cluster the start of one
+        // may be and still be split off for sorting. At 1 only the clusters
+        // Tipsify made are sorted, at 0 there is no overdraw pass.
+        float overdraw_threshold;
+        // Of the simulated memory cache, MESH_OPTIMIZE_CACHE_LINE_SIZE when 0
+        unsigned int cache_line_size;
+        struct mesh_optimize_stats stats;
+};
+
+// Simulates a FIFO post-transform cache of cache_size entries
+void get_vertex_cache_metrics(const unsigned int *indices,
+        unsigned int index_count, unsigned int vertex_count,
+        unsigned int cache_size, struct vertex_cache_metrics *metrics);
+void optimize_mesh_indices(struct mesh_optimize_info *optimize_info,
+        struct mesh_info *mi);
+// Simulates a FIFO cache of MESH_OPTIMIZE_FETCH_CACHE_SIZE bytes in lines of
+// cache_line_size, over vertices vertex_size bytes apart
+void get_vertex_fetch_metrics(const unsigned int *indices,
+        unsigned int index_count, unsigned int vertex_count,
+        unsigned int vertex_size, unsigned int cache_line_size,
+        struct vertex_fetch_metrics *metrics);
+// Renumbers the vertices in place in the order of first use and drops the
+// unused ones. Per vertex data kept outside the mesh is not moved.
+void optimize_vertex_fetch(struct mesh_optimize_info *optimize_info,
+        struct mesh_info *mi);
+
+#endif
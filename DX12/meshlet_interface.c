@@ -0,0 +1,581 @@
+#include "meshlet_interface.h"
+#include "radix_sort_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#define NO_TRIANGLE 0xffffffff
+#define NO_LOCAL_VERTEX 0xff
+#define MORTON_BITS 10
+// Triangle indices go below the Morton code in the sort keys
+#define MORTON_KEY_SHIFT 32
+
+struct meshlet_job {
+        struct mesh_info *meshes;
+        struct meshlet_mesh_info *meshlet_meshes;
+        unsigned int max_vertices;
+        unsigned int max_triangles;
+        float cone_weight;
+};
+
+// Scratch space for splitting one range of the index buffer, sized for the
+// whole mesh so every level of detail can share it
+struct meshlet_state {
+        struct mesh_info *mi;
+        struct meshlet_mesh_info *meshlet_mesh;
+        unsigned int max_vertices;
+        unsigned int max_triangles;
+        float cone_weight;
+        const unsigned int *indices;
+        unsigned int *offsets;
+        unsigned int *adjacency;
+        unsigned int *live_counts;
+        unsigned char *local_vertices;
+        unsigned char *is_emitted;
+        vec3 *centres;
+        vec3 *normals;
+        unsigned long long *keys;
+        unsigned long long *scratch;
+        // The meshlet being grown
+        unsigned int triangles[MAX_MESHLET_TRIANGLES];
+        unsigned int triangle_count;
+        unsigned int vertex_count;
+        vec3 centre_sum;
+        vec3 normal_sum;
+};
+
+// Adjacency from every vertex to the triangles using it. Only the first
+// live_counts[v] triangles of a vertex are still to be emitted.
+static void build_adjacency(struct meshlet_state *state,
+        unsigned int triangle_count)
+{
+        unsigned int vertex_count = state->mi->vertex_count;
+
+        memset(state->live_counts, 0, vertex_count * sizeof (unsigned int));
+        for (unsigned int i = 0; i < triangle_count * 3; ++i) {
+                assert(state->indices[i] < vertex_count);
+                ++state->live_counts[state->indices[i]];
+        }
+
+        unsigned int offset = 0;
+        for (unsigned int v = 0; v < vertex_count; ++v) {
+                state->offsets[v] = offset;
+                offset += state->live_counts[v];
+        }
+        state->offsets[vertex_count] = offset;
+
+        memset(state->live_counts, 0, vertex_count * sizeof (unsigned int));
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                for (unsigned int k = 0; k < 3; ++k) {
+                        unsigned int v = state->indices[t * 3 + k];
+                        // A triangle using a vertex twice is listed once
+                        if ((k > 0 && v == state->indices[t * 3]) ||
+                                (k > 1 && v == state->indices[t * 3 + 1]))
+                                continue;
+                        state->adjacency[state->offsets[v] +
+                                state->live_counts[v]++] = t;
+                }
+        }
+}
+
+static void remove_adjacency(struct meshlet_state *state, unsigned int v,
+        unsigned int t)
+{
+        unsigned int *triangles = state->adjacency + state->offsets[v];
+        unsigned int count = state->live_counts[v];
+
+        for (unsigned int a = 0; a < count; ++a) {
+                if (triangles[a] == t) {
+                        triangles[a] = triangles[count - 1];
+                        --state->live_counts[v];
+                        return;
+                }
+        }
+}
+
+// Puts two zero bits after each of the low MORTON_BITS bits
+static unsigned long long spread_bits(unsigned long long x)
+{
+        x &= (1 << MORTON_BITS) - 1;
+        x = (x | x << 16) & 0x30000ffull;
+        x = (x | x << 8) & 0x300f00full;
+        x = (x | x << 4) & 0x30c30c3ull;
+        x = (x | x << 2) & 0x9249249ull;
+
+        return x;
+}
+
+// Centres and normals of the triangles, and their seed order along a
+// Morton curve through the bounds of the centres
+static void prepare_triangles(struct meshlet_state *state,
+        unsigned int triangle_count)
+{
+        vec3 bounds_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+        vec3 bounds_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                const unsigned int *triangle = state->indices + t * 3;
+                float *p0 = state->mi->verticies[triangle[0]].position;
+                float *p1 = state->mi->verticies[triangle[1]].position;
+                float *p2 = state->mi->verticies[triangle[2]].position;
+
+                vec3 e1, e2;
+                vec3_sub(e1, p1, p0);
+                vec3_sub(e2, p2, p0);
+                // Front faces are clockwise in a right handed space
+                vec3_mul_cross(state->normals[t], e2, e1);
+                float length = vec3_len(state->normals[t]);
+                vec3_scale(state->normals[t], state->normals[t],
+                        length > 0.0f ? 1.0f / length : 0.0f);
+
+                for (int k = 0; k < 3; ++k) {
+                        float centre = (p0[k] + p1[k] + p2[k]) / 3.0f;
+                        state->centres[t][k] = centre;
+                        bounds_min[k] = centre < bounds_min[k] ?
+                                centre : bounds_min[k];
+                        bounds_max[k] = centre > bounds_max[k] ?
+                                centre : bounds_max[k];
+                }
+        }
+
+        float scale[3];
+        for (int k = 0; k < 3; ++k) {
+                float extent = bounds_max[k] - bounds_min[k];
+                scale[k] = extent > 0.0f ?
+                        ((1 << MORTON_BITS) - 1) / extent : 0.0f;
+        }
+
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                unsigned long long key = 0;
+                for (int k = 0; k < 3; ++k) {
+                        unsigned long long cell = (unsigned long long)
+                                ((state->centres[t][k] - bounds_min[k]) *
+                                scale[k]);
+                        key |= spread_bits(cell) << k;
+                }
+
+                state->keys[t] = key << MORTON_KEY_SHIFT | t;
+        }
+
+        // Meshes are already split in parallel
+        radix_sort_keys(NULL, state->keys, state->scratch, triangle_count,
+                MORTON_KEY_SHIFT);
+}
+
+static unsigned int get_new_vertex_count(struct meshlet_state *state,
+        unsigned int t)
+{
+        const unsigned int *triangle = state->indices + t * 3;
+        unsigned int new_count = 0;
+
+        for (unsigned int k = 0; k < 3; ++k) {
+                unsigned int v = triangle[k];
+                new_count += state->local_vertices[v] == NO_LOCAL_VERTEX &&
+                        (k < 1 || v != triangle[0]) &&
+                        (k < 2 || v != triangle[1]);
+        }
+
+        return new_count;
+}
+
+// Of the live triangles around the vertices of the meshlet, the one with
+// the fewest new vertices, then the lowest cost
+static unsigned int get_next_triangle(struct meshlet_state *state,
+        const unsigned int *vertices)
+{
+        unsigned int best = NO_TRIANGLE;
+        unsigned int best_new_count = 4;
+        float best_cost = FLT_MAX;
+
+        vec3 centre, axis;
+        vec3_scale(centre, state->centre_sum,
+                1.0f / state->triangle_count);
+        vec3_scale(axis, state->normal_sum, 1.0f);
+        float axis_length = vec3_len(axis);
+        vec3_scale(axis, axis, axis_length > 0.0f ? 1.0f / axis_length :
+                0.0f);
+
+        for (unsigned int i = 0; i < state->vertex_count; ++i) {
+                unsigned int v = vertices[i];
+                const unsigned int *triangles = state->adjacency +
+                        state->offsets[v];
+
+                for (unsigned int a = 0; a < state->live_counts[v]; ++a) {
+                        unsigned int t = triangles[a];
+                        unsigned int new_count = get_new_vertex_count(state,
+                                t);
+                        if (new_count > best_new_count ||
+                                state->vertex_count + new_count >
+                                state->max_vertices)
+                                continue;
+
+                        vec3 offset;
+                        vec3_sub(offset, state->centres[t], centre);
+                        float cost = vec3_mul_inner(offset, offset) *
+                                (1.0f + state->cone_weight * (1.0f -
+                                vec3_mul_inner(state->normals[t], axis)));
+                        if (new_count < best_new_count || cost < best_cost) {
+                                best = t;
+                                best_new_count = new_count;
+                                best_cost = cost;
+                        }
+                }
+        }
+
+        return best;
+}
+
+static void add_triangle(struct meshlet_state *state, unsigned int t)
+{
+        struct meshlet_mesh_info *meshlet_mesh = state->meshlet_mesh;
+        struct meshlet *m = &meshlet_mesh->meshlets[
+                meshlet_mesh->meshlet_count];
+        const unsigned int *triangle = state->indices + t * 3;
+
+        for (unsigned int k = 0; k < 3; ++k) {
+                unsigned int v = triangle[k];
+                if (state->local_vertices[v] == NO_LOCAL_VERTEX) {
+                        state->local_vertices[v] =
+                                (unsigned char) state->vertex_count;
+                        meshlet_mesh->vertices[m->first_vertex +
+                                state->vertex_count++] = v;
+                }
+
+                if ((k < 1 || v != triangle[0]) &&
+                        (k < 2 || v != triangle[1]))
+                        remove_adjacency(state, v, t);
+        }
+
+        vec3_add(state->centre_sum, state->centre_sum, state->centres[t]);
+        vec3_add(state->normal_sum, state->normal_sum, state->normals[t]);
+        state->triangles[state->triangle_count++] = t;
+        state->is_emitted[t] = 1;
+}
+
+// The cone takes in the normal of every triangle that has one. When they
+// spread over more than a hemisphere, or cancel out, it can never be
+// culled.
+static void calc_meshlet_cone(struct meshlet_state *state, struct meshlet *m)
+{
+        vec3 axis;
+        float axis_length = vec3_len(state->normal_sum);
+        vec3_scale(axis, state->normal_sum, axis_length > 0.0f ?
+                1.0f / axis_length : 0.0f);
+
+        float min_dot = 1.0f;
+        for (unsigned int i = 0; i < state->triangle_count; ++i) {
+                float *normal = state->normals[state->triangles[i]];
+                if (vec3_mul_inner(normal, normal) == 0.0f)
+                        continue;
+
+                float dot = vec3_mul_inner(normal, axis);
+                min_dot = dot < min_dot ? dot : min_dot;
+        }
+
+        for (int k = 0; k < 3; ++k)
+                m->cone_axis[k] = axis[k];
+        m->cone_cutoff = axis_length > 0.0f && min_dot > 0.0f ?
+                sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+}
+
+// The sphere is centred on the box, like that of a whole mesh file
+static void calc_meshlet_bounds(struct meshlet_state *state,
+        struct meshlet *m)
+{
+        const unsigned int *vertices = state->meshlet_mesh->vertices +
+                m->first_vertex;
+
+        for (int k = 0; k < 3; ++k) {
+                m->bounds_min[k] = FLT_MAX;
+                m->bounds_max[k] = -FLT_MAX;
+        }
+
+        for (unsigned int i = 0; i < m->vertex_count; ++i) {
+                float *position = state->mi->verticies[vertices[i]].position;
+                for (int k = 0; k < 3; ++k) {
+                        m->bounds_min[k] = position[k] < m->bounds_min[k] ?
+                                position[k] : m->bounds_min[k];
+                        m->bounds_max[k] = position[k] > m->bounds_max[k] ?
+                                position[k] : m->bounds_max[k];
+                }
+        }
+
+        float *centre = m->bounding_sphere;
+        for (int k = 0; k < 3; ++k)
+                centre[k] = (m->bounds_min[k] + m->bounds_max[k]) * 0.5f;
+
+        float max_dist_sq = 0.0f;
+        for (unsigned int i = 0; i < m->vertex_count; ++i) {
+                vec3 offset;
+                vec3_sub(offset, state->mi->verticies[vertices[i]].position,
+                        centre);
+                float dist_sq = vec3_mul_inner(offset, offset);
+                max_dist_sq = dist_sq > max_dist_sq ? dist_sq : max_dist_sq;
+        }
+
+        m->bounding_sphere[3] = sqrtf(max_dist_sq);
+}
+
+static void finish_meshlet(struct meshlet_state *state)
+{
+        struct meshlet_mesh_info *meshlet_mesh = state->meshlet_mesh;
+        struct meshlet *m = &meshlet_mesh->meshlets[
+                meshlet_mesh->meshlet_count++];
+        unsigned char *triangles = meshlet_mesh->triangles +
+                meshlet_mesh->triangle_size;
+
+        m->vertex_count = state->vertex_count;
+        m->first_triangle = meshlet_mesh->triangle_size;
+        m->triangle_count = state->triangle_count;
+
+        for (unsigned int i = 0; i < state->triangle_count; ++i) {
+                const unsigned int *triangle = state->indices +
+                        state->triangles[i] * 3;
+                for (unsigned int k = 0; k < 3; ++k) {
+                        triangles[i * 3 + k] =
+                                state->local_vertices[triangle[k]];
+                }
+        }
+
+        unsigned int size = state->triangle_count * 3;
+        memset(triangles + size, 0, (4 - size % 4) % 4);
+        meshlet_mesh->triangle_size += (size + 3) & ~3u;
+
+        calc_meshlet_bounds(state, m);
+        calc_meshlet_cone(state, m);
+
+        const unsigned int *vertices = meshlet_mesh->vertices +
+                m->first_vertex;
+        for (unsigned int i = 0; i < m->vertex_count; ++i)
+                state->local_vertices[vertices[i]] = NO_LOCAL_VERTEX;
+        meshlet_mesh->vertex_count += m->vertex_count;
+}
+
+static void start_meshlet(struct meshlet_state *state)
+{
+        struct meshlet_mesh_info *meshlet_mesh = state->meshlet_mesh;
+        struct meshlet *m = &meshlet_mesh->meshlets[
+                meshlet_mesh->meshlet_count];
+
+        m->first_vertex = meshlet_mesh->vertex_count;
+        state->triangle_count = 0;
+        state->vertex_count = 0;
+        memset(state->centre_sum, 0, sizeof (vec3));
+        memset(state->normal_sum, 0, sizeof (vec3));
+}
+
+static void split_range(struct meshlet_state *state,
+        unsigned int triangle_count)
+{
+        struct meshlet_mesh_info *meshlet_mesh = state->meshlet_mesh;
+
+        build_adjacency(state, triangle_count);
+        prepare_triangles(state, triangle_count);
+        memset(state->is_emitted, 0, triangle_count);
+
+        // Seeds are taken in Morton order, as are triangles to go on with
+        // when there are no neighbours left, since they are likely close
+        unsigned int cursor = 0;
+        unsigned int emitted_count = 0;
+        start_meshlet(state);
+
+        while (emitted_count < triangle_count) {
+                const unsigned int *vertices = meshlet_mesh->vertices +
+                        meshlet_mesh->meshlets[
+                        meshlet_mesh->meshlet_count].first_vertex;
+                unsigned int t = state->triangle_count > 0 ?
+                        get_next_triangle(state, vertices) : NO_TRIANGLE;
+
+                if (t == NO_TRIANGLE) {
+                        while (state->is_emitted[(unsigned int)
+                                state->keys[cursor]])
+                                ++cursor;
+                        t = (unsigned int) state->keys[cursor];
+                }
+
+                if (state->vertex_count + get_new_vertex_count(state, t) >
+                        state->max_vertices) {
+                        finish_meshlet(state);
+                        start_meshlet(state);
+                }
+
+                add_triangle(state, t);
+                ++emitted_count;
+
+                if (state->triangle_count == state->max_triangles) {
+                        finish_meshlet(state);
+                        start_meshlet(state);
+                }
+        }
+
+        if (state->triangle_count > 0)
+                finish_meshlet(state);
+}
+
+static void build_mesh_meshlets(struct meshlet_job *job, struct mesh_info *mi,
+        struct meshlet_mesh_info *meshlet_mesh)
+{
+        unsigned int index_count = mi->index_count;
+        unsigned int triangle_count = index_count / 3;
+
+        assert(index_count % 3 == 0);
+
+        // A mesh without levels is one range
+        struct mesh_lod whole_mesh = { 0, index_count, 0.0f };
+        unsigned int range_count = mi->lod_count > 0 ? mi->lod_count : 1;
+        struct mesh_lod *ranges = mi->lod_count > 0 ? mi->lods : &whole_mesh;
+
+        // Every meshlet holds at least a triangle, and pads its triangles by
+        // up to 3 bytes
+        unsigned int range_triangle_count = 0;
+        for (unsigned int r = 0; r < range_count; ++r) {
+                assert(ranges[r].first_index + ranges[r].index_count <=
+                        index_count);
+                range_triangle_count += ranges[r].index_count / 3;
+        }
+
+        meshlet_mesh->meshlet_count = 0;
+        meshlet_mesh->meshlets = malloc((range_triangle_count + 1) *
+                sizeof (struct meshlet));
+        meshlet_mesh->vertex_count = 0;
+        meshlet_mesh->vertices = malloc((range_triangle_count * 3 + 1) *
+                sizeof (unsigned int));
+        meshlet_mesh->triangle_size = 0;
+        meshlet_mesh->triangles = malloc(range_triangle_count * 6 + 1);
+        meshlet_mesh->lod_count = mi->lod_count;
+
+        struct meshlet_state state;
+        state.mi = mi;
+        state.meshlet_mesh = meshlet_mesh;
+        state.max_vertices = job->max_vertices;
+        state.max_triangles = job->max_triangles;
+        state.cone_weight = job->cone_weight;
+        state.offsets = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        state.adjacency = malloc((index_count + 1) * sizeof (unsigned int));
+        state.live_counts = malloc((mi->vertex_count + 1) *
+                sizeof (unsigned int));
+        state.local_vertices = malloc(mi->vertex_count + 1);
+        state.is_emitted = malloc(triangle_count + 1);
+        state.centres = malloc((triangle_count + 1) * sizeof (vec3));
+        state.normals = malloc((triangle_count + 1) * sizeof (vec3));
+        state.keys = malloc((triangle_count + 1) *
+                sizeof (unsigned long long));
+        state.scratch = malloc((triangle_count + 1) *
+                sizeof (unsigned long long));
+
+        memset(state.local_vertices, NO_LOCAL_VERTEX, mi->vertex_count);
+
+        for (unsigned int r = 0; r < range_count; ++r) {
+                unsigned int first_meshlet = meshlet_mesh->meshlet_count;
+                state.indices = mi->indices + ranges[r].first_index;
+                split_range(&state, ranges[r].index_count / 3);
+
+                if (mi->lod_count > 0) {
+                        meshlet_mesh->lods[r].first_meshlet = first_meshlet;
+                        meshlet_mesh->lods[r].meshlet_count =
+                                meshlet_mesh->meshlet_count - first_meshlet;
+                }
+        }
+
+        free(state.scratch);
+        free(state.keys);
+        free(state.normals);
+        free(state.centres);
+        free(state.is_emitted);
+        free(state.local_vertices);
+        free(state.live_counts);
+        free(state.adjacency);
+        free(state.offsets);
+
+        meshlet_mesh->meshlets = realloc(meshlet_mesh->meshlets,
+                (meshlet_mesh->meshlet_count + 1) * sizeof (struct meshlet));
+        meshlet_mesh->vertices = realloc(meshlet_mesh->vertices,
+                (meshlet_mesh->vertex_count + 1) * sizeof (unsigned int));
+        meshlet_mesh->triangles = realloc(meshlet_mesh->triangles,
+                meshlet_mesh->triangle_size + 1);
+}
+
+static void build_meshlet_range(void *job_data, unsigned int first,
+        unsigned int count)
+{
+        struct meshlet_job *job = job_data;
+
+        for (unsigned int i = first; i < first + count; ++i) {
+                build_mesh_meshlets(job, &job->meshes[i],
+                        &job->meshlet_meshes[i]);
+        }
+}
+
+void build_meshlets(struct meshlet_build_info *build_info,
+        struct mesh_info *meshes, unsigned int mesh_count,
+        struct meshlet_mesh_info *meshlet_meshes)
+{
+        double start_time = get_time_in_secs();
+
+        struct meshlet_job job;
+        job.meshes = meshes;
+        job.meshlet_meshes = meshlet_meshes;
+        job.max_vertices = build_info->max_vertices != 0 &&
+                build_info->max_vertices < MAX_MESHLET_VERTICES ?
+                build_info->max_vertices : MAX_MESHLET_VERTICES;
+        job.max_triangles = build_info->max_triangles != 0 &&
+                build_info->max_triangles < MAX_MESHLET_TRIANGLES ?
+                build_info->max_triangles : MAX_MESHLET_TRIANGLES;
+        job.cone_weight = build_info->cone_weight >= 0.0f ?
+                build_info->cone_weight : MESHLET_CONE_WEIGHT;
+
+        // A triangle may bring in three new vertices
+        assert(job.max_vertices >= 3);
+
+        parallel_for(mesh_count > 1 ? build_info->job_system : NULL,
+                mesh_count, 1, build_meshlet_range, &job);
+
+        struct meshlet_stats *stats = &build_info->stats;
+        stats->mesh_count = mesh_count;
+        stats->meshlet_count = 0;
+        stats->triangle_count = 0;
+        stats->vertex_count = 0;
+        for (unsigned int i = 0; i < mesh_count; ++i) {
+                struct meshlet_mesh_info *meshlet_mesh = &meshlet_meshes[i];
+                stats->meshlet_count += meshlet_mesh->meshlet_count;
+                stats->vertex_count += meshlet_mesh->vertex_count;
+                for (unsigned int m = 0; m < meshlet_mesh->meshlet_count; ++m) {
+                        stats->triangle_count +=
+                                meshlet_mesh->meshlets[m].triangle_count;
+                }
+        }
+
+        double meshlet_count = stats->meshlet_count > 0 ?
+                stats->meshlet_count : 1.0;
+        stats->vertex_fill = (float) (stats->vertex_count /
+                (meshlet_count * job.max_vertices));
+        stats->triangle_fill = (float) (stats->triangle_count /
+                (meshlet_count * job.max_triangles));
+        stats->build_time = get_time_in_secs() - start_time;
+        stats->meshlets_per_sec = stats->build_time > 0.0 ?
+                stats->meshlet_count / stats->build_time : 0.0;
+}
+
+void release_meshlets(struct meshlet_mesh_info *meshlet_mesh)
+{
+        free(meshlet_mesh->triangles);
+        free(meshlet_mesh->vertices);
+        free(meshlet_mesh->meshlets);
+        meshlet_mesh->triangles = NULL;
+        meshlet_mesh->vertices = NULL;
+        meshlet_mesh->meshlets = NULL;
+}
+
+int is_meshlet_backfacing(const struct meshlet *m, vec3 eye)
+{
+        vec3 offset;
+        vec3_sub(offset, m->bounding_sphere, eye);
+
+        return vec3_mul_inner(offset, m->cone_axis) >=
+                m->cone_cutoff * vec3_len(offset) + m->bounding_sphere[3];
+}
@@ -0,0 +1,90 @@
+#ifndef MESHLET_INTERFACE_H
+#define MESHLET_INTERFACE_H
+
+#include "linmath.h"
+#include "mesh_interface.h"
+#include "job_interface.h"
+
+// Splits meshes into meshlets, small clusters of triangles that can be
+// culled on their own. Meshlets are grown a triangle at a time from seeds
+// taken in Morton order of the triangle centres, always adding the
+// neighbouring triangle that brings in the fewest new vertices, and of
+// those the one closest to the meshlet that faces most like it. That keeps
+// them compact, which tightens their bounds, and their normals close,
+// which tightens their cones. Each level of detail is split on its own and
+// meshes are split in parallel on the job system. Kept free of D3D types
+// so it can run headless.
+#define MAX_MESHLET_VERTICES 64
+#define MAX_MESHLET_TRIANGLES 124
+#define MESHLET_CONE_WEIGHT 0.5f
+
+// A meshlet faces away from a camera at eye when
+// dot(centre - eye, cone_axis) >= cone_cutoff * |centre - eye| + radius,
+// and a cutoff of 1 never does
+struct meshlet {
+        // Into the vertices of the meshlet mesh
+        unsigned int first_vertex;
+        unsigned int vertex_count;
+        // Into the triangles of the meshlet mesh, in bytes
+        unsigned int first_triangle;
+        unsigned int triangle_count;
+        // Centre and radius
+        float bounding_sphere[4];
+        float bounds_min[3];
+        float bounds_max[3];
+        float cone_axis[3];
+        float cone_cutoff;
+};
+
+struct meshlet_lod {
+        unsigned int first_meshlet;
+        unsigned int meshlet_count;
+};
+
+struct meshlet_mesh_info {
+        unsigned int meshlet_count;
+        struct meshlet *meshlets;
+        // The mesh vertex behind each meshlet vertex
+        unsigned int vertex_count;
+        unsigned int *vertices;
+        // Three meshlet vertex numbers a triangle, with the triangles of
+        // every meshlet starting on a four byte boundary
+        unsigned int triangle_size;
+        unsigned char *triangles;
+        // One per level of the mesh, none when it has no levels
+        unsigned int lod_count;
+        struct meshlet_lod lods[MAX_MESH_LODS];
+};
+
+// Fill is how full the meshlets are on average against the limits
+struct meshlet_stats {
+        unsigned int mesh_count;
+        unsigned int meshlet_count;
+        unsigned int triangle_count;
+        unsigned long long vertex_count;
+        float vertex_fill;
+        float triangle_fill;
+        double build_time;
+        double meshlets_per_sec;
+};
+
+struct meshlet_build_info {
+        struct job_system_info *job_system;
+        // Up to MAX_MESHLET_VERTICES and MAX_MESHLET_TRIANGLES, which are
+        // used when 0
+        unsigned int max_vertices;
+        unsigned int max_triangles;
+        // How much a triangle facing away from the meshlet counts against
+        // it, from 0, MESHLET_CONE_WEIGHT when negative
+        float cone_weight;
+        struct meshlet_stats stats;
+};
+
+// Fills in a meshlet mesh for each of the mesh_count meshes
+void build_meshlets(struct meshlet_build_info *build_info,
+        struct mesh_info *meshes, unsigned int mesh_count,
+        struct meshlet_mesh_info *meshlet_meshes);
+void release_meshlets(struct meshlet_mesh_info *meshlet_mesh);
+int is_meshlet_backfacing(const struct meshlet *m, vec3 eye);
+
+#endif
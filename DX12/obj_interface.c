@@ -0,0 +1,934 @@
+#include "obj_interface.h"
+#include "timer_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJ_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#define OBJ_PREFETCH_DISTANCE 16
+#define OBJ_NO_INDEX -1
+#define OBJ_EMPTY_ENTRY 0xffffffff
+
+// Attribute indices of a face corner, 0 based, OBJ_NO_INDEX when missing
+struct obj_corner {
+        int position;
+        int uv;
+        int normal;
+};
+
+// The first chunk to use a corner, and its vertex within that chunk
+struct obj_table_entry {
+        struct obj_corner key;
+        unsigned int chunk;
+        unsigned int vertex;
+};
+
+struct obj_table {
+        unsigned int mask;
+        unsigned int count;
+        struct obj_table_entry *entries;
+};
+
+struct obj_chunk {
+        const char *first;
+        const char *last;
+        unsigned int position_count;
+        unsigned int uv_count;
+        unsigned int normal_count;
+        unsigned int position_base;
+        unsigned int uv_base;
+        unsigned int normal_base;
+        unsigned int corner_count;
+        unsigned int corner_capacity;
+        unsigned int corner_base;
+        struct obj_corner *corners;
+        int has_bad_index;
+        // Distinct corners of the chunk, and which one each corner is
+        unsigned int vertex_count;
+        struct obj_corner *vertices;
+        unsigned int *vertex_indices;
+        // Distinct corners sorted by the partition they are merged in
+        unsigned int partition_offsets[MAX_OBJ_CHUNKS + 1];
+        unsigned int *partition_order;
+        // First chunk to use every distinct corner, and its vertex there
+        unsigned char *owner_chunks;
+        unsigned int *owner_vertices;
+        unsigned int first_use_count;
+        unsigned int first_use_base;
+        // Mesh vertex of every distinct corner of the chunk
+        unsigned int *mesh_vertices;
+};
+
+struct obj_job {
+        unsigned int chunk_count;
+        struct obj_chunk chunks[MAX_OBJ_CHUNKS];
+        unsigned int position_count;
+        unsigned int uv_count;
+        unsigned int normal_count;
+        float (*positions)[3];
+        float (*colours)[3];
+        float (*uvs)[2];
+        float (*normals)[3];
+        unsigned int vertex_count;
+        struct obj_corner *vertices;
+        struct mesh_info *mi;
+        float (*mesh_normals)[3];
+};
+
+static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static char *read_obj_file(const char *path, unsigned long long *size)
+{
+        FILE *file = fopen(path, "rb");
+        if (file == NULL)
+                return NULL;
+
+        fseek(file, 0, SEEK_END);
+        long file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        // The terminator stops the parsers at the end of the last line
+        char *text = malloc(file_size + 1);
+        size_t read_size = fread(text, 1, file_size, file);
+        text[read_size] = '\0';
+        *size = read_size;
+
+        fclose(file);
+
+        return text;
+}
+
+static int is_digit(char c)
+{
+        return (unsigned int) (c - '0') < 10;
+}
+
+static const char *skip_spaces(const char *c)
+{
+        while (*c == ' ' || *c == '\t' || *c == '\r')
+                ++c;
+
+        return c;
+}
+
+static const char *find_line_end(const char *c, const char *last)
+{
+        const char *line_end = memchr(c, '\n', last - c);
+
+        return line_end != NULL ? line_end : last;
+}
+
+static const char *parse_int(const char *c, int *value)
+{
+        int is_negative = *c == '-';
+        if (*c == '-' || *c == '+')
+                ++c;
+
+        if (!is_digit(*c))
+                return NULL;
+
+        long long number = 0;
+        while (is_digit(*c)) {
+                number = number < 0x7fffffff ? number * 10 + (*c - '0') :
+                        number;
+                ++c;
+        }
+
+        number = number > 0x7fffffff ? 0x7fffffff : number;
+        *value = (int) (is_negative ? -number : number);
+
+        return c;
+}
+
+// Digits go into a 64 bit integer which is scaled by an exact power of ten,
+// so the float is rounded from a double at most an ulp off. Anything else,
+// such as inf or nan, goes to strtod.
+static const char *parse_float(const char *c, float *value)
+{
+        const char *start = c;
+        int is_negative = *c == '-';
+        if (*c == '-' || *c == '+')
+                ++c;
+
+        if (!is_digit(*c) && !(*c == '.' && is_digit(c[1]))) {
+                char *end;
+                *value = (float) strtod(start, &end);
+
+                return end != start ? end : NULL;
+        }
+
+        unsigned long long mantissa = 0;
+        int exponent = 0;
+        for (; is_digit(*c); ++c) {
+                if (mantissa < 100000000000000000ull)
+                        mantissa = mantissa * 10 + (*c - '0');
+                else
+                        ++exponent;
+        }
+
+        if (*c == '.') {
+                for (++c; is_digit(*c); ++c) {
+                        if (mantissa < 100000000000000000ull) {
+                                mantissa = mantissa * 10 + (*c - '0');
+                                --exponent;
+                        }
+                }
+        }
+
+        if ((*c == 'e' || *c == 'E') && (is_digit(c[1]) ||
+                ((c[1] == '-' || c[1] == '+') && is_digit(c[2])))) {
+                int exponent_value;
+                c = parse_int(c + 1, &exponent_value);
+                exponent_value = exponent_value > 1000 ? 1000 :
+                        exponent_value;
+                exponent_value = exponent_value < -1000 ? -1000 :
+                        exponent_value;
+                exponent += exponent_value;
+        }
+
+        double number = (double) mantissa;
+        for (; exponent > 22; exponent -= 22)
+                number *= powers_of_ten[22];
+        for (; exponent < -22; exponent += 22)
+                number /= powers_of_ten[22];
+
+        number = exponent < 0 ? number / powers_of_ten[-exponent] :
+                number * powers_of_ten[exponent];
+        *value = (float) (is_negative ? -number : number);
+
+        return c;
+}
+
+static const char *parse_floats(const char *c, float *values,
+        unsigned int max_count, unsigned int *count)
+{
+        *count = 0;
+        for (c = skip_spaces(c); *count < max_count && *c != '\n' &&
+                *c != '\0' && *c != '#'; c = skip_spaces(c)) {
+                const char *next = parse_float(c, &values[*count]);
+                if (next == NULL)
+                        break;
+
+                c = next;
+                ++*count;
+        }
+
+        return c;
+}
+
+static unsigned long long get_chunk_offset(unsigned long long size,
+        unsigned int chunk_count, unsigned int chunk)
+{
+        return size * chunk / chunk_count;
+}
+
+static void split_chunks(struct obj_job *job, const char *text,
+        unsigned long long size)
+{
+        const char *last = text + size;
+
+        // Every chunk is moved on to the start of the line its offset is in
+        // or after, so a line always belongs to the chunk it starts in
+        const char *first = text;
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                unsigned long long offset = get_chunk_offset(size,
+                        job->chunk_count, c);
+                const char *line_start = offset > 0 ? find_line_end(
+                        text + offset - 1, last) + 1 : text;
+                first = line_start > first ? line_start : first;
+                first = first < last ? first : last;
+
+                memset(&job->chunks[c], 0, sizeof (struct obj_chunk));
+                job->chunks[c].first = first;
+                if (c > 0)
+                        job->chunks[c - 1].last = first;
+        }
+
+        job->chunks[job->chunk_count - 1].last = last;
+}
+
+static int is_space(char c)
+{
+        return c == ' ' || c == '\t';
+}
+
+static void count_chunk_attributes(struct obj_chunk *chunk)
+{
+        for (const char *c = chunk->first; c < chunk->last;
+                c = find_line_end(c, chunk->last) + 1) {
+                if (c[0] != 'v')
+                        continue;
+
+                chunk->position_count += is_space(c[1]);
+                chunk->uv_count += c[1] == 't' && is_space(c[2]);
+                chunk->normal_count += c[1] == 'n' && is_space(c[2]);
+        }
+}
+
+static void count_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c)
+                count_chunk_attributes(&job->chunks[c]);
+}
+
+// Positive indices count from the start of the file and negative ones back
+// from the last attribute before the face
+static int resolve_index(int index, unsigned int count_before,
+        unsigned int total_count, int *has_bad_index)
+{
+        long long resolved = index > 0 ? (long long) index - 1 :
+                (long long) count_before + index;
+        if (index == 0 || resolved < 0 || resolved >= total_count) {
+                *has_bad_index = 1;
+                return 0;
+        }
+
+        return (int) resolved;
+}
+
+static const char *parse_corner(struct obj_job *job, struct obj_chunk *chunk,
+        const char *c, unsigned int *counts_before, struct obj_corner *corner)
+{
+        int position;
+        c = parse_int(c, &position);
+        if (c == NULL)
+                return NULL;
+
+        corner->position = resolve_index(position, counts_before[0],
+                job->position_count, &chunk->has_bad_index);
+        corner->uv = OBJ_NO_INDEX;
+        corner->normal = OBJ_NO_INDEX;
+
+        if (*c != '/')
+                return c;
+
+        int uv;
+        const char *next = parse_int(c + 1, &uv);
+        if (next != NULL) {
+                corner->uv = resolve_index(uv, counts_before[1],
+                        job->uv_count, &chunk->has_bad_index);
+                c = next;
+        } else {
+                ++c;
+        }
+
+        if (*c != '/')
+                return c;
+
+        int normal;
+        next = parse_int(c + 1, &normal);
+        if (next == NULL)
+                return c + 1;
+
+        corner->normal = resolve_index(normal, counts_before[2],
+                job->normal_count, &chunk->has_bad_index);
+
+        return next;
+}
+
+static void add_corner(struct obj_chunk *chunk, struct obj_corner *corner)
+{
+        if (chunk->corner_count == chunk->corner_capacity) {
+                chunk->corner_capacity = chunk->corner_capacity * 2 + 64;
+                chunk->corners = realloc(chunk->corners,
+                        chunk->corner_capacity * sizeof (struct obj_corner));
+        }
+
+        chunk->corners[chunk->corner_count++] = *corner;
+}
+
+static void parse_face(struct obj_job *job, struct obj_chunk *chunk,
+        const char *c, unsigned int *counts_before)
+{
+        struct obj_corner first;
+        struct obj_corner previous;
+        unsigned int corner_count = 0;
+
+        for (c = skip_spaces(c); *c != '\n' && *c != '\0' && *c != '#';
+                c = skip_spaces(c)) {
+                struct obj_corner corner;
+                c = parse_corner(job, chunk, c, counts_before, &corner);
+                if (c == NULL)
+                        break;
+
+                if (corner_count >= 2) {
+                        add_corner(chunk, &first);
+                        add_corner(chunk, &previous);
+                        add_corner(chunk, &corner);
+                }
+
+                first = corner_count == 0 ? corner : first;
+                previous = corner;
+                ++corner_count;
+        }
+}
+
+static void parse_chunk(struct obj_job *job, struct obj_chunk *chunk)
+{
+        unsigned int counts[3] = { 0, 0, 0 };
+        float values[6];
+        unsigned int value_count;
+
+        // Roughly a face line for every 32 bytes
+        chunk->corner_capacity = (unsigned int) ((chunk->last -
+                chunk->first) / 32 * 3 + 64);
+        chunk->corners = malloc(chunk->corner_capacity *
+                sizeof (struct obj_corner));
+
+        for (const char *c = chunk->first; c < chunk->last;
+                c = find_line_end(c, chunk->last) + 1) {
+                if (c[0] == 'v' && is_space(c[1])) {
+                        // A position may be followed by w or by a colour
+                        memset(values, 0, sizeof (values));
+                        parse_floats(c + 1, values, 6, &value_count);
+
+                        unsigned int i = chunk->position_base + counts[0]++;
+                        memcpy(job->positions[i], values, sizeof (float) * 3);
+                        if (value_count == 6) {
+                                memcpy(job->colours[i], &values[3],
+                                        sizeof (float) * 3);
+                        } else {
+                                job->colours[i][0] = 1.0f;
+                                job->colours[i][1] = 1.0f;
+                                job->colours[i][2] = 1.0f;
+                        }
+                } else if (c[0] == 'v' && c[1] == 't' && is_space(c[2])) {
+                        memset(values, 0, sizeof (values));
+                        parse_floats(c + 2, values, 2, &value_count);
+
+                        unsigned int i = chunk->uv_base + counts[1]++;
+                        memcpy(job->uvs[i], values, sizeof (float) * 2);
+                } else if (c[0] == 'v' && c[1] == 'n' && is_space(c[2])) {
+                        memset(values, 0, sizeof (values));
+                        parse_floats(c + 2, values, 3, &value_count);
+
+                        unsigned int i = chunk->normal_base + counts[2]++;
+                        memcpy(job->normals[i], values, sizeof (float) * 3);
+                } else if (c[0] == 'f' && is_space(c[1])) {
+                        unsigned int counts_before[3] = {
+                                chunk->position_base + counts[0],
+                                chunk->uv_base + counts[1],
+                                chunk->normal_base + counts[2]
+                        };
+                        parse_face(job, chunk, c + 1, counts_before);
+                }
+        }
+}
+
+static void parse_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c)
+                parse_chunk(job, &job->chunks[c]);
+}
+
+static unsigned int hash_corner(const struct obj_corner *corner)
+{
+        unsigned int hash = (unsigned int) corner->position * 0x9e3779b1u ^
+                (unsigned int) corner->uv * 0x85ebca77u ^
+                (unsigned int) corner->normal * 0xc2b2ae3du;
+        hash ^= hash >> 15;
+        hash *= 0x2c1b3c6du;
+        hash ^= hash >> 13;
+
+        return hash;
+}
+
+static void create_table(struct obj_table *table, unsigned int count)
+{
+        // At most half full, so probe sequences stay short
+        unsigned int size = 16;
+        while (size < count * 2ull)
+                size *= 2;
+
+        table->mask = size - 1;
+        table->count = 0;
+        table->entries = malloc(size * sizeof (struct obj_table_entry));
+        for (unsigned int i = 0; i < size; ++i)
+                table->entries[i].vertex = OBJ_EMPTY_ENTRY;
+}
+
+// Returns the entry of the corner, whose vertex is OBJ_EMPTY_ENTRY when the
+// corner is new
+static struct obj_table_entry *find_entry(struct obj_table *table,
+        const struct obj_corner *corner)
+{
+        for (unsigned int slot = hash_corner(corner) & table->mask;;
+                slot = (slot + 1) & table->mask) {
+                struct obj_table_entry *entry = &table->entries[slot];
+                if (entry->vertex == OBJ_EMPTY_ENTRY ||
+                        (entry->key.position == corner->position &&
+                        entry->key.uv == corner->uv &&
+                        entry->key.normal == corner->normal))
+                        return entry;
+        }
+}
+
+static void grow_table(struct obj_table *table)
+{
+        unsigned int old_size = table->mask + 1;
+        struct obj_table_entry *old_entries = table->entries;
+
+        create_table(table, old_size);
+        for (unsigned int i = 0; i < old_size; ++i) {
+                if (old_entries[i].vertex != OBJ_EMPTY_ENTRY)
+                        *find_entry(table, &old_entries[i].key) =
+                                old_entries[i];
+        }
+
+        table->count = old_size / 2;
+        free(old_entries);
+}
+
+static unsigned int get_partition(const struct obj_corner *corner,
+        unsigned int partition_count)
+{
+        // Slots are picked by the low bits of the hash and partitions by
+        // the high ones
+        return (hash_corner(corner) >> 16) * partition_count >> 16;
+}
+
+static void sort_chunk_partitions(struct obj_chunk *chunk,
+        unsigned int partition_count)
+{
+        unsigned char *partitions = malloc(chunk->vertex_count + 1);
+        unsigned int *offsets = chunk->partition_offsets;
+        memset(offsets, 0, sizeof (chunk->partition_offsets));
+
+        for (unsigned int i = 0; i < chunk->vertex_count; ++i) {
+                partitions[i] = (unsigned char) get_partition(
+                        &chunk->vertices[i], partition_count);
+                ++offsets[partitions[i] + 1];
+        }
+
+        for (unsigned int p = 0; p < partition_count; ++p)
+                offsets[p + 1] += offsets[p];
+
+        // Stable, so each partition keeps the order of first use
+        unsigned int next[MAX_OBJ_CHUNKS];
+        memcpy(next, offsets, partition_count * sizeof (unsigned int));
+        chunk->partition_order = malloc((chunk->vertex_count + 1) *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < chunk->vertex_count; ++i)
+                chunk->partition_order[next[partitions[i]]++] = i;
+
+        free(partitions);
+}
+
+static void dedupe_chunk(struct obj_job *job, struct obj_chunk *chunk)
+{
+        // Corners are mostly shared, so the table starts with room for half
+        // of them and grows in the rare case more are distinct
+        struct obj_table table;
+        create_table(&table, chunk->corner_count / 2);
+
+        chunk->vertices = malloc((chunk->corner_count + 1) *
+                sizeof (struct obj_corner));
+        chunk->vertex_indices = malloc((chunk->corner_count + 1) *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < chunk->corner_count; ++i) {
+                if ((table.count + 1) * 2ull > table.mask + 1ull)
+                        grow_table(&table);
+
+#if defined(OBJ_USE_SSE)
+                // Slots are all over a table much larger than the cache, so
+                // the ones a few corners ahead are fetched early
+                if (i + OBJ_PREFETCH_DISTANCE < chunk->corner_count) {
+                        _mm_prefetch((const char *) &table.entries[hash_corner(
+                                &chunk->corners[i + OBJ_PREFETCH_DISTANCE]) &
+                                table.mask], _MM_HINT_T0);
+                }
+#endif
+
+                struct obj_corner *corner = &chunk->corners[i];
+                struct obj_table_entry *entry = find_entry(&table, corner);
+                if (entry->vertex == OBJ_EMPTY_ENTRY) {
+                        entry->key = *corner;
+                        entry->vertex = chunk->vertex_count++;
+                        chunk->vertices[entry->vertex] = *corner;
+                        ++table.count;
+                }
+
+                chunk->vertex_indices[i] = entry->vertex;
+        }
+
+        free(table.entries);
+        free(chunk->corners);
+        chunk->corners = NULL;
+
+        if (job->chunk_count > 1)
+                sort_chunk_partitions(chunk, job->chunk_count);
+}
+
+static void dedupe_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c)
+                dedupe_chunk(job, &job->chunks[c]);
+}
+
+// Finds the first chunk to use every distinct corner of a partition, going
+// through the chunks in file order
+static void merge_partition(struct obj_job *job, unsigned int partition)
+{
+        unsigned int count = 0;
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                unsigned int *offsets = job->chunks[c].partition_offsets;
+                count += offsets[partition + 1] - offsets[partition];
+        }
+
+        struct obj_table table;
+        create_table(&table, count);
+
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                unsigned int *offsets = chunk->partition_offsets;
+                for (unsigned int k = offsets[partition];
+                        k < offsets[partition + 1]; ++k) {
+                        unsigned int i = chunk->partition_order[k];
+                        struct obj_table_entry *entry = find_entry(&table,
+                                &chunk->vertices[i]);
+                        if (entry->vertex == OBJ_EMPTY_ENTRY) {
+                                entry->key = chunk->vertices[i];
+                                entry->chunk = c;
+                                entry->vertex = i;
+                        }
+
+                        chunk->owner_chunks[i] = (unsigned char) entry->chunk;
+                        chunk->owner_vertices[i] = entry->vertex;
+                }
+        }
+
+        free(table.entries);
+}
+
+static void merge_partitions(void *job_data, unsigned int first_partition,
+        unsigned int partition_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int p = first_partition;
+                p < first_partition + partition_count; ++p)
+                merge_partition(job, p);
+}
+
+static void count_first_uses(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                for (unsigned int i = 0; i < chunk->vertex_count; ++i)
+                        chunk->first_use_count += chunk->owner_chunks[i] == c;
+        }
+}
+
+// Vertices are numbered in the order they are first used in the file
+static void number_first_uses(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                unsigned int vertex = chunk->first_use_base;
+                for (unsigned int i = 0; i < chunk->vertex_count; ++i) {
+                        if (chunk->owner_chunks[i] != c)
+                                continue;
+
+                        job->vertices[vertex] = chunk->vertices[i];
+                        chunk->mesh_vertices[i] = vertex++;
+                }
+        }
+}
+
+static void number_later_uses(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                for (unsigned int i = 0; i < chunk->vertex_count; ++i) {
+                        unsigned int owner = chunk->owner_chunks[i];
+                        if (owner != c) {
+                                chunk->mesh_vertices[i] =
+                                        job->chunks[owner].mesh_vertices[
+                                        chunk->owner_vertices[i]];
+                        }
+                }
+        }
+}
+
+// Corners shared between chunks are found by splitting the distinct corners
+// of every chunk into partitions by hash, each merged on its own
+static void merge_chunk_vertices(struct obj_job *job,
+        struct job_system_info *job_system)
+{
+        unsigned int chunk_vertex_count = 0;
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                chunk_vertex_count += chunk->vertex_count;
+                chunk->mesh_vertices = malloc((chunk->vertex_count + 1) *
+                        sizeof (unsigned int));
+                chunk->owner_chunks = malloc(chunk->vertex_count + 1);
+                chunk->owner_vertices = malloc((chunk->vertex_count + 1) *
+                        sizeof (unsigned int));
+        }
+
+        parallel_for(job_system, job->chunk_count, 1, merge_partitions, job);
+        parallel_for(job_system, job->chunk_count, 1, count_first_uses, job);
+
+        job->vertex_count = 0;
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                job->chunks[c].first_use_base = job->vertex_count;
+                job->vertex_count += job->chunks[c].first_use_count;
+        }
+
+        job->vertices = malloc((job->vertex_count + 1) *
+                sizeof (struct obj_corner));
+
+        parallel_for(job_system, job->chunk_count, 1, number_first_uses,
+                job);
+        parallel_for(job_system, job->chunk_count, 1, number_later_uses,
+                job);
+}
+
+static void write_chunk_indices(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                unsigned int *indices = job->mi->indices + chunk->corner_base;
+                for (unsigned int i = 0; i < chunk->corner_count; ++i) {
+                        indices[i] = chunk->mesh_vertices[
+                                chunk->vertex_indices[i]];
+                }
+        }
+}
+
+static void write_vertex(struct obj_job *job, unsigned int v)
+{
+        struct obj_corner *corner = &job->vertices[v];
+        struct vertex *vertex = &job->mi->verticies[v];
+
+        memcpy(vertex->position, job->positions[corner->position],
+                sizeof (float) * 3);
+        vertex->position[3] = 1.0f;
+        memcpy(vertex->colour, job->colours[corner->position],
+                sizeof (float) * 3);
+        vertex->colour[3] = 1.0f;
+        if (corner->uv != OBJ_NO_INDEX) {
+                vertex->uv[0] = job->uvs[corner->uv][0];
+                vertex->uv[1] = job->uvs[corner->uv][1];
+        } else {
+                vertex->uv[0] = 0.0f;
+                vertex->uv[1] = 0.0f;
+        }
+
+        if (job->mesh_normals == NULL)
+                return;
+
+        if (corner->normal != OBJ_NO_INDEX) {
+                memcpy(job->mesh_normals[v], job->normals[corner->normal],
+                        sizeof (float) * 3);
+        } else {
+                memset(job->mesh_normals[v], 0, sizeof (float) * 3);
+        }
+}
+
+static void write_chunk_vertices(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct obj_job *job = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = (unsigned int) get_chunk_offset(
+                        job->vertex_count, job->chunk_count, c);
+                unsigned int last = (unsigned int) get_chunk_offset(
+                        job->vertex_count, job->chunk_count, c + 1);
+                for (unsigned int v = first; v < last; ++v)
+                        write_vertex(job, v);
+        }
+}
+
+static void free_chunks(struct obj_job *job)
+{
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                free(job->chunks[c].corners);
+                free(job->chunks[c].vertices);
+                free(job->chunks[c].vertex_indices);
+                free(job->chunks[c].partition_order);
+                free(job->chunks[c].owner_chunks);
+                free(job->chunks[c].owner_vertices);
+                free(job->chunks[c].mesh_vertices);
+        }
+}
+
+static void free_attributes(struct obj_job *job)
+{
+        free(job->positions);
+        free(job->colours);
+        free(job->uvs);
+        free(job->normals);
+}
+
+int load_obj(struct obj_info *obj_info, struct mesh_info *mi)
+{
+        double start_time = get_time_in_secs();
+
+        memset(&obj_info->stats, 0, sizeof (struct obj_stats));
+        obj_info->normals = NULL;
+
+        unsigned long long size;
+        char *text = read_obj_file(obj_info->path, &size);
+        if (text == NULL)
+                return 0;
+
+        double read_end_time = get_time_in_secs();
+
+        struct obj_job *job = malloc(sizeof (struct obj_job));
+        memset(job, 0, sizeof (struct obj_job));
+        job->mi = mi;
+        job->chunk_count = 1;
+
+        struct job_system_info *job_system = obj_info->job_system;
+        if (job_system != NULL && size >= OBJ_PARALLEL_MIN_SIZE) {
+                job->chunk_count = job_system->worker_count * 4;
+                if (job->chunk_count < 1)
+                        job->chunk_count = 1;
+                if (job->chunk_count > MAX_OBJ_CHUNKS)
+                        job->chunk_count = MAX_OBJ_CHUNKS;
+        }
+
+        job_system = job->chunk_count > 1 ? job_system : NULL;
+        split_chunks(job, text, size);
+
+        parallel_for(job_system, job->chunk_count, 1, count_chunks, job);
+
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                struct obj_chunk *chunk = &job->chunks[c];
+                chunk->position_base = job->position_count;
+                chunk->uv_base = job->uv_count;
+                chunk->normal_base = job->normal_count;
+                job->position_count += chunk->position_count;
+                job->uv_count += chunk->uv_count;
+                job->normal_count += chunk->normal_count;
+        }
+
+        job->positions = malloc((job->position_count + 1) * sizeof (float) *
+                3);
+        job->colours = malloc((job->position_count + 1) * sizeof (float) * 3);
+        job->uvs = malloc((job->uv_count + 1) * sizeof (float) * 2);
+        job->normals = malloc((job->normal_count + 1) * sizeof (float) * 3);
+
+        parallel_for(job_system, job->chunk_count, 1, parse_chunks, job);
+        free(text);
+
+        int has_bad_index = 0;
+        unsigned int corner_count = 0;
+        for (unsigned int c = 0; c < job->chunk_count; ++c) {
+                job->chunks[c].corner_base = corner_count;
+                corner_count += job->chunks[c].corner_count;
+                has_bad_index |= job->chunks[c].has_bad_index;
+        }
+
+        if (has_bad_index) {
+                free_chunks(job);
+                free_attributes(job);
+                free(job);
+                return 0;
+        }
+
+        double parse_end_time = get_time_in_secs();
+
+        parallel_for(job_system, job->chunk_count, 1, dedupe_chunks, job);
+
+        // A single chunk has nothing to merge with
+        if (job->chunk_count > 1) {
+                merge_chunk_vertices(job, job_system);
+        } else {
+                struct obj_chunk *chunk = &job->chunks[0];
+                job->vertex_count = chunk->vertex_count;
+                job->vertices = chunk->vertices;
+                chunk->vertices = NULL;
+                chunk->mesh_vertices = malloc((chunk->vertex_count + 1) *
+                        sizeof (unsigned int));
+                for (unsigned int i = 0; i < chunk->vertex_count; ++i)
+                        chunk->mesh_vertices[i] = i;
+        }
+
+        mi->vertex_count = job->vertex_count;
+        mi->verticies = malloc((job->vertex_count + 1) *
+                sizeof (struct vertex));
+        mi->index_count = corner_count;
+        mi->indices = malloc((corner_count + 1) * sizeof (unsigned int));
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = corner_count;
+        mi->lods[0].error = 0.0f;
+
+        if (job->normal_count > 0) {
+                job->mesh_normals = malloc((job->vertex_count + 1) *
+                        sizeof (float) * 3);
+        }
+
+        parallel_for(job_system, job->chunk_count, 1, write_chunk_indices,
+                job);
+        parallel_for(job_system, job->chunk_count, 1, write_chunk_vertices,
+                job);
+
+        obj_info->normals = job->mesh_normals;
+
+        struct obj_stats *stats = &obj_info->stats;
+        stats->file_size = size;
+        stats->chunk_count = job->chunk_count;
+        stats->position_count = job->position_count;
+        stats->uv_count = job->uv_count;
+        stats->normal_count = job->normal_count;
+        stats->triangle_count = corner_count / 3;
+        stats->vertex_count = job->vertex_count;
+
+        free(job->vertices);
+        free_chunks(job);
+        free_attributes(job);
+        free(job);
+
+        double end_time = get_time_in_secs();
+        stats->read_time = read_end_time - start_time;
+        stats->parse_time = parse_end_time - read_end_time;
+        stats->dedupe_time = end_time - parse_end_time;
+        stats->total_time = end_time - start_time;
+        stats->mb_per_sec = stats->total_time > 0.0 ?
+                size / (1024.0 * 1024.0) / stats->total_time : 0.0;
+
+        return 1;
+}
+
+void release_obj(struct obj_info *obj_info, struct mesh_info *mi)
+{
+        free(mi->verticies);
+        free(mi->indices);
+        free(obj_info->normals);
+        obj_info->normals = NULL;
+}
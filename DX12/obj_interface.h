@@ -0,0 +1,49 @@
+#ifndef OBJ_INTERFACE_H
+#define OBJ_INTERFACE_H
+
+#include "mesh_interface.h"
+#include "job_interface.h"
+
+// Wavefront OBJ importer. The file is split into chunks that start and end
+// on line breaks, which are parsed in parallel: a first pass counts the
+// vertex attributes of every chunk so the second can write them straight to
+// their final place and resolve relative indices. Faces are triangulated as
+// fans. Every distinct position/uv/normal corner becomes one vertex, found
+// with an open addressing hash first within each chunk and then across
+// them, keeping the order in which vertices are first used. Kept free of D3D
+// types so it can run headless.
+#define MAX_OBJ_PATH 260
+#define OBJ_PARALLEL_MIN_SIZE (1 << 20)
+#define MAX_OBJ_CHUNKS 64
+
+struct obj_stats {
+        unsigned long long file_size;
+        unsigned int chunk_count;
+        unsigned int position_count;
+        unsigned int uv_count;
+        unsigned int normal_count;
+        unsigned int triangle_count;
+        unsigned int vertex_count;
+        double read_time;
+        double parse_time;
+        double dedupe_time;
+        double total_time;
+        // File size over total time
+        double mb_per_sec;
+};
+
+struct obj_info {
+        char path[MAX_OBJ_PATH];
+        struct job_system_info *job_system;
+        // A normal per mesh vertex, since struct vertex has none. NULL when
+        // the file has no normals.
+        float (*normals)[3];
+        struct obj_stats stats;
+};
+
+// Fills the mesh with a single level of detail, returns 0 when the file is
+// missing or a face refers to a vertex attribute that does not exist
+int load_obj(struct obj_info *obj_info, struct mesh_info *mi);
+void release_obj(struct obj_info *obj_info, struct mesh_info *mi);
+
+#endif
@@ -0,0 +1,769 @@
+#include "occlusion_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+// Rows are rasterized four pixels at a time
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+// Triangles and boxes reaching this close to the eye plane are not drawn or
+// counted as occluded, which saves clipping them
+#define OCCLUSION_MIN_W 1e-5f
+
+struct occlusion_test_job {
+        struct occlusion_info *occlusion_info;
+        struct cull_volume_info *volume_info;
+        const unsigned int *indices;
+        unsigned int index_count;
+        unsigned int *visible_indices;
+        unsigned int chunk_count;
+        unsigned int chunk_visible_counts[MAX_OCCLUSION_CHUNKS];
+};
+
+static unsigned int get_chunk_first(unsigned int count, unsigned int chunk,
+        unsigned int chunk_count)
+{
+        return (unsigned int) (((unsigned long long) count * chunk) /
+                chunk_count);
+}
+
+static unsigned int get_tile_count(struct occlusion_info *occlusion_info)
+{
+        return occlusion_info->tile_count_x * occlusion_info->tile_count_y;
+}
+
+static void clear_depth_levels(struct occlusion_info *occlusion_info)
+{
+        for (unsigned int l = 0; l < occlusion_info->level_count; ++l) {
+                unsigned int texel_count = occlusion_info->level_widths[l] *
+                        occlusion_info->level_heights[l];
+                for (unsigned int i = 0; i < texel_count; ++i) {
+                        occlusion_info->min_depths[l][i] = 1.0f;
+                        occlusion_info->max_depths[l][i] = 1.0f;
+                }
+        }
+}
+
+void create_occlusion(struct occlusion_info *occlusion_info)
+{
+        assert(occlusion_info->width > 0 && occlusion_info->height > 0);
+        assert(occlusion_info->width % OCCLUSION_TILE_SIZE == 0);
+        assert(occlusion_info->height % OCCLUSION_TILE_SIZE == 0);
+
+        occlusion_info->tile_count_x = occlusion_info->width /
+                OCCLUSION_TILE_SIZE;
+        occlusion_info->tile_count_y = occlusion_info->height /
+                OCCLUSION_TILE_SIZE;
+
+        // Halve the levels down to a single texel, rounding up so every
+        // pixel has a texel above it
+        unsigned int level_width = occlusion_info->width;
+        unsigned int level_height = occlusion_info->height;
+        occlusion_info->level_count = 0;
+        for (;;) {
+                unsigned int l = occlusion_info->level_count++;
+                assert(l < MAX_OCCLUSION_LEVELS);
+
+                occlusion_info->level_widths[l] = level_width;
+                occlusion_info->level_heights[l] = level_height;
+
+                size_t size = level_width * level_height * sizeof (float);
+                occlusion_info->max_depths[l] = malloc(size);
+                occlusion_info->min_depths[l] = l == 0 ?
+                        occlusion_info->max_depths[l] : malloc(size);
+
+                if (level_width == 1 && level_height == 1)
+                        break;
+
+                level_width = (level_width + 1) / 2;
+                level_height = (level_height + 1) / 2;
+        }
+
+        clear_depth_levels(occlusion_info);
+
+        occlusion_info->occluders = malloc(occlusion_info->max_occluders *
+                sizeof (struct occluder));
+        occlusion_info->triangles = malloc(occlusion_info->max_triangles *
+                sizeof (struct occlusion_triangle));
+
+        occlusion_info->chunk_count = 1;
+        occlusion_info->chunk_bin_offsets = malloc(MAX_OCCLUSION_CHUNKS *
+                get_tile_count(occlusion_info) * sizeof (unsigned int));
+        occlusion_info->tile_bin_offsets = malloc((get_tile_count(
+                occlusion_info) + 1) * sizeof (unsigned int));
+
+        // Grows when the triangles of a frame cover more tiles than this
+        occlusion_info->bin_capacity = occlusion_info->max_triangles;
+        occlusion_info->bins = malloc(occlusion_info->bin_capacity *
+                sizeof (unsigned int));
+
+        mat4x4_identity(occlusion_info->pv_mat);
+        occlusion_info->occluder_count = 0;
+        occlusion_info->triangle_count = 0;
+
+        memset(&occlusion_info->stats, 0, sizeof (struct occlusion_stats));
+}
+
+void release_occlusion(struct occlusion_info *occlusion_info)
+{
+        free(occlusion_info->bins);
+        free(occlusion_info->tile_bin_offsets);
+        free(occlusion_info->chunk_bin_offsets);
+        free(occlusion_info->triangles);
+        free(occlusion_info->occluders);
+
+        for (unsigned int l = 0; l < occlusion_info->level_count; ++l) {
+                if (l > 0)
+                        free(occlusion_info->min_depths[l]);
+                free(occlusion_info->max_depths[l]);
+        }
+}
+
+void begin_occlusion(struct occlusion_info *occlusion_info, mat4x4 pv_mat)
+{
+        mat4x4_dup(occlusion_info->pv_mat, pv_mat);
+        occlusion_info->occluder_count = 0;
+        occlusion_info->triangle_count = 0;
+
+        memset(&occlusion_info->stats, 0, sizeof (struct occlusion_stats));
+}
+
+void add_occluder(struct occlusion_info *occlusion_info,
+        struct mesh_info *mesh_info, unsigned int lod, mat4x4 world_mat)
+{
+        assert(lod < mesh_info->lod_count);
+
+        struct mesh_lod *mesh_lod = &mesh_info->lods[lod];
+        unsigned int triangle_count = mesh_lod->index_count / 3;
+
+        if (occlusion_info->occluder_count >= occlusion_info->max_occluders ||
+                occlusion_info->triangle_count + triangle_count >
+                occlusion_info->max_triangles) {
+                ++occlusion_info->stats.dropped_occluder_count;
+                return;
+        }
+
+        struct occluder *occluder =
+                &occlusion_info->occluders[occlusion_info->occluder_count++];
+        occluder->mesh_info = mesh_info;
+        occluder->indices = mesh_info->indices + mesh_lod->first_index;
+        mat4x4_mul(occluder->mvp_mat, occlusion_info->pv_mat, world_mat);
+        occluder->first_triangle = occlusion_info->triangle_count;
+
+        occlusion_info->triangle_count += triangle_count;
+
+        ++occlusion_info->stats.occluder_count;
+        occlusion_info->stats.triangle_count += triangle_count;
+}
+
+static unsigned int find_occluder(struct occlusion_info *occlusion_info,
+        unsigned int triangle)
+{
+        // Last occluder starting at or before the triangle
+        unsigned int first = 0;
+        unsigned int last = occlusion_info->occluder_count;
+        while (last - first > 1) {
+                unsigned int middle = (first + last) / 2;
+                if (occlusion_info->occluders[middle].first_triangle <=
+                        triangle)
+                        first = middle;
+                else
+                        last = middle;
+        }
+
+        return first;
+}
+
+static void setup_triangle(struct occlusion_info *occlusion_info,
+        struct occluder *occluder, unsigned int triangle)
+{
+        struct occlusion_triangle *tri = &occlusion_info->triangles[triangle];
+        tri->min_x = 1;
+        tri->max_x = 0;
+
+        unsigned int *indices = occluder->indices +
+                (triangle - occluder->first_triangle) * 3;
+
+        for (int k = 0; k < 3; ++k) {
+                vec4 clip;
+                mat4x4_mul_vec4(clip, occluder->mvp_mat,
+                        occluder->mesh_info->verticies[indices[k]].position);
+
+                // Parts in front of the near plane are clipped on the GPU,
+                // so they can not hide anything
+                if (clip[3] <= OCCLUSION_MIN_W || clip[2] < 0.0f)
+                        return;
+
+                float inv_w = 1.0f / clip[3];
+                tri->x[k] = (clip[0] * inv_w * 0.5f + 0.5f) *
+                        occlusion_info->width;
+                tri->y[k] = (0.5f - clip[1] * inv_w * 0.5f) *
+                        occlusion_info->height;
+                tri->z[k] = clip[2] * inv_w;
+        }
+
+        float area = (tri->x[1] - tri->x[0]) * (tri->y[2] - tri->y[0]) -
+                (tri->x[2] - tri->x[0]) * (tri->y[1] - tri->y[0]);
+        if (area == 0.0f)
+                return;
+
+        if (tri->z[0] > 1.0f && tri->z[1] > 1.0f && tri->z[2] > 1.0f)
+                return;
+
+        // Pixels whose centres fall inside the bounds
+        float min_x = fminf(tri->x[0], fminf(tri->x[1], tri->x[2]));
+        float max_x = fmaxf(tri->x[0], fmaxf(tri->x[1], tri->x[2]));
+        float min_y = fminf(tri->y[0], fminf(tri->y[1], tri->y[2]));
+        float max_y = fmaxf(tri->y[0], fmaxf(tri->y[1], tri->y[2]));
+
+        float max_px = (float) (occlusion_info->width - 1);
+        float max_py = (float) (occlusion_info->height - 1);
+        min_x = fmaxf(ceilf(min_x - 0.5f), 0.0f);
+        min_y = fmaxf(ceilf(min_y - 0.5f), 0.0f);
+        max_x = fminf(floorf(max_x - 0.5f), max_px);
+        max_y = fminf(floorf(max_y - 0.5f), max_py);
+
+        if (min_x > max_x || min_y > max_y)
+                return;
+
+        tri->min_x = (int) min_x;
+        tri->min_y = (int) min_y;
+        tri->max_x = (int) max_x;
+        tri->max_y = (int) max_y;
+}
+
+static void setup_triangles(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct occlusion_info *occlusion_info = job_data;
+        unsigned int tile_count = get_tile_count(occlusion_info);
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int *tile_counts =
+                        &occlusion_info->chunk_bin_offsets[c * tile_count];
+                memset(tile_counts, 0, tile_count * sizeof (unsigned int));
+
+                unsigned int first = get_chunk_first(
+                        occlusion_info->triangle_count, c,
+                        occlusion_info->chunk_count);
+                unsigned int last = get_chunk_first(
+                        occlusion_info->triangle_count, c + 1,
+                        occlusion_info->chunk_count);
+                if (first == last)
+                        continue;
+
+                unsigned int o = find_occluder(occlusion_info, first);
+                for (unsigned int i = first; i < last; ++i) {
+                        while (o + 1 < occlusion_info->occluder_count &&
+                                occlusion_info->occluders[o + 1].first_triangle
+                                <= i)
+                                ++o;
+
+                        setup_triangle(occlusion_info,
+                                &occlusion_info->occluders[o], i);
+
+                        struct occlusion_triangle *tri =
+                                &occlusion_info->triangles[i];
+                        if (tri->min_x > tri->max_x)
+                                continue;
+
+                        for (int ty = tri->min_y / OCCLUSION_TILE_SIZE;
+                                ty <= tri->max_y / OCCLUSION_TILE_SIZE; ++ty) {
+                                for (int tx = tri->min_x / OCCLUSION_TILE_SIZE;
+                                        tx <= tri->max_x / OCCLUSION_TILE_SIZE;
+                                        ++tx) {
+                                        ++tile_counts[ty *
+                                                occlusion_info->tile_count_x +
+                                                tx];
+                                }
+                        }
+                }
+        }
+}
+
+static void bin_triangles(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct occlusion_info *occlusion_info = job_data;
+        unsigned int tile_count = get_tile_count(occlusion_info);
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int *offsets =
+                        &occlusion_info->chunk_bin_offsets[c * tile_count];
+
+                unsigned int last = get_chunk_first(
+                        occlusion_info->triangle_count, c + 1,
+                        occlusion_info->chunk_count);
+                for (unsigned int i = get_chunk_first(
+                        occlusion_info->triangle_count, c,
+                        occlusion_info->chunk_count); i < last; ++i) {
+                        struct occlusion_triangle *tri =
+                                &occlusion_info->triangles[i];
+                        if (tri->min_x > tri->max_x)
+                                continue;
+
+                        for (int ty = tri->min_y / OCCLUSION_TILE_SIZE;
+                                ty <= tri->max_y / OCCLUSION_TILE_SIZE; ++ty) {
+                                for (int tx = tri->min_x / OCCLUSION_TILE_SIZE;
+                                        tx <= tri->max_x / OCCLUSION_TILE_SIZE;
+                                        ++tx) {
+                                        occlusion_info->bins[offsets[ty *
+                                                occlusion_info->tile_count_x +
+                                                tx]++] = i;
+                                }
+                        }
+                }
+        }
+}
+
+static void rasterize_triangle(struct occlusion_info *occlusion_info,
+        struct occlusion_triangle *tri, int tile_min_x, int tile_min_y)
+{
+        int min_x = tri->min_x > tile_min_x ? tri->min_x : tile_min_x;
+        int min_y = tri->min_y > tile_min_y ? tri->min_y : tile_min_y;
+        int max_x = tile_min_x + OCCLUSION_TILE_SIZE - 1;
+        int max_y = tile_min_y + OCCLUSION_TILE_SIZE - 1;
+        if (tri->max_x < max_x)
+                max_x = tri->max_x;
+        if (tri->max_y < max_y)
+                max_y = tri->max_y;
+
+        // Wind the corners counter clockwise so the inside of every edge is
+        // where its edge function is positive
+        int i1 = 1;
+        int i2 = 2;
+        float area = (tri->x[1] - tri->x[0]) * (tri->y[2] - tri->y[0]) -
+                (tri->x[2] - tri->x[0]) * (tri->y[1] - tri->y[0]);
+        if (area < 0.0f) {
+                i1 = 2;
+                i2 = 1;
+                area = -area;
+        }
+
+        float x[3] = { tri->x[0], tri->x[i1], tri->x[i2] };
+        float y[3] = { tri->y[0], tri->y[i1], tri->y[i2] };
+        float z[3] = { tri->z[0], tri->z[i1], tri->z[i2] };
+
+        float edge_a[3];
+        float edge_b[3];
+        float edge_c[3];
+        for (int k = 0; k < 3; ++k) {
+                int n = (k + 1) % 3;
+                edge_a[k] = y[k] - y[n];
+                edge_b[k] = x[n] - x[k];
+                edge_c[k] = -(edge_a[k] * x[k] + edge_b[k] * y[k]);
+        }
+
+        // Depth over the screen is a plane through the corners
+        float inv_area = 1.0f / area;
+        float dzdx = ((z[1] - z[0]) * (y[2] - y[0]) -
+                (z[2] - z[0]) * (y[1] - y[0])) * inv_area;
+        float dzdy = ((z[2] - z[0]) * (x[1] - x[0]) -
+                (z[1] - z[0]) * (x[2] - x[0])) * inv_area;
+        float dzc = z[0] - dzdx * x[0] - dzdy * y[0];
+
+        float *depths = occlusion_info->max_depths[0];
+
+        for (int py = min_y; py <= max_y; ++py) {
+                float fy = py + 0.5f;
+                float *row = depths + py * occlusion_info->width;
+
+#if defined(OCCLUSION_USE_SSE)
+                // Groups of four start on a multiple of four, which keeps
+                // them inside the tile
+                int px = min_x & ~3;
+                __m128 xs = _mm_add_ps(_mm_set1_ps(px + 0.5f),
+                        _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+
+                __m128 e[3];
+                __m128 e_step[3];
+                for (int k = 0; k < 3; ++k) {
+                        e[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[k]),
+                                xs), _mm_set1_ps(edge_b[k] * fy + edge_c[k]));
+                        e_step[k] = _mm_set1_ps(edge_a[k] * 4.0f);
+                }
+
+                __m128 zs = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), xs),
+                        _mm_set1_ps(dzdy * fy + dzc));
+                __m128 z_step = _mm_set1_ps(dzdx * 4.0f);
+                __m128 zero = _mm_setzero_ps();
+
+                for (; px <= max_x; px += 4) {
+                        __m128 inside = _mm_and_ps(_mm_and_ps(
+                                _mm_cmpge_ps(e[0], zero),
+                                _mm_cmpge_ps(e[1], zero)),
+                                _mm_cmpge_ps(e[2], zero));
+
+                        __m128 old_depth = _mm_loadu_ps(row + px);
+                        __m128 new_depth = _mm_min_ps(old_depth, zs);
+                        _mm_storeu_ps(row + px, _mm_or_ps(
+                                _mm_and_ps(inside, new_depth),
+                                _mm_andnot_ps(inside, old_depth)));
+
+                        for (int k = 0; k < 3; ++k)
+                                e[k] = _mm_add_ps(e[k], e_step[k]);
+                        zs = _mm_add_ps(zs, z_step);
+                }
+#else
+                for (int px = min_x; px <= max_x; ++px) {
+                        float fx = px + 0.5f;
+                        int is_inside = 1;
+                        for (int k = 0; k < 3; ++k) {
+                                if (edge_a[k] * fx + edge_b[k] * fy +
+                                        edge_c[k] < 0.0f)
+                                        is_inside = 0;
+                        }
+
+                        float depth = dzdx * fx + dzdy * fy + dzc;
+                        if (is_inside && depth < row[px])
+                                row[px] = depth;
+                }
+#endif
+        }
+}
+
+static void reduce_texel(struct occlusion_info *occlusion_info,
+        unsigned int level, unsigned int x, unsigned int y)
+{
+        unsigned int src_width = occlusion_info->level_widths[level - 1];
+        unsigned int src_height = occlusion_info->level_heights[level - 1];
+        float *src_min = occlusion_info->min_depths[level - 1];
+        float *src_max = occlusion_info->max_depths[level - 1];
+
+        unsigned int x0 = x * 2;
+        unsigned int y0 = y * 2;
+        unsigned int x1 = x0 + 1 < src_width ? x0 + 1 : x0;
+        unsigned int y1 = y0 + 1 < src_height ? y0 + 1 : y0;
+
+        unsigned int i00 = y0 * src_width + x0;
+        unsigned int i01 = y0 * src_width + x1;
+        unsigned int i10 = y1 * src_width + x0;
+        unsigned int i11 = y1 * src_width + x1;
+
+        float min_depth = fminf(fminf(src_min[i00], src_min[i01]),
+                fminf(src_min[i10], src_min[i11]));
+        float max_depth = fmaxf(fmaxf(src_max[i00], src_max[i01]),
+                fmaxf(src_max[i10], src_max[i11]));
+
+        unsigned int i = y * occlusion_info->level_widths[level] + x;
+        occlusion_info->min_depths[level][i] = min_depth;
+        occlusion_info->max_depths[level][i] = max_depth;
+}
+
+static void rasterize_tiles(void *job_data, unsigned int first_tile,
+        unsigned int tile_count)
+{
+        struct occlusion_info *occlusion_info = job_data;
+
+        for (unsigned int t = first_tile; t < first_tile + tile_count; ++t) {
+                unsigned int tile_x = t % occlusion_info->tile_count_x;
+                unsigned int tile_y = t / occlusion_info->tile_count_x;
+                int tile_min_x = tile_x * OCCLUSION_TILE_SIZE;
+                int tile_min_y = tile_y * OCCLUSION_TILE_SIZE;
+
+                float *depths = occlusion_info->max_depths[0];
+                for (int y = 0; y < OCCLUSION_TILE_SIZE; ++y) {
+                        float *row = depths + (tile_min_y + y) *
+                                occlusion_info->width + tile_min_x;
+                        for (int x = 0; x < OCCLUSION_TILE_SIZE; ++x)
+                                row[x] = 1.0f;
+                }
+
+                for (unsigned int b = occlusion_info->tile_bin_offsets[t];
+                        b < occlusion_info->tile_bin_offsets[t + 1]; ++b) {
+                        rasterize_triangle(occlusion_info,
+                                &occlusion_info->triangles[
+                                occlusion_info->bins[b]],
+                                tile_min_x, tile_min_y);
+                }
+
+                // The pyramid levels below the tile size only read this tile
+                for (unsigned int l = 1; l <= OCCLUSION_TILE_LEVELS; ++l) {
+                        unsigned int size = OCCLUSION_TILE_SIZE >> l;
+                        for (unsigned int y = tile_y * size;
+                                y < (tile_y + 1) * size; ++y) {
+                                for (unsigned int x = tile_x * size;
+                                        x < (tile_x + 1) * size; ++x)
+                                        reduce_texel(occlusion_info, l, x, y);
+                        }
+                }
+        }
+}
+
+void rasterize_occluders(struct occlusion_info *occlusion_info)
+{
+        double start_time = get_time_in_secs();
+
+        struct job_system_info *job_system = occlusion_info->job_system;
+        unsigned int tile_count = get_tile_count(occlusion_info);
+
+        // Small occluder sets are set up and binned on the calling thread
+        occlusion_info->chunk_count = 1;
+        if (job_system != NULL && occlusion_info->triangle_count >=
+                OCCLUSION_PARALLEL_MIN_COUNT) {
+                occlusion_info->chunk_count = job_system->worker_count * 4;
+                if (occlusion_info->chunk_count < 1)
+                        occlusion_info->chunk_count = 1;
+                if (occlusion_info->chunk_count > MAX_OCCLUSION_CHUNKS)
+                        occlusion_info->chunk_count = MAX_OCCLUSION_CHUNKS;
+        }
+
+        struct job_system_info *chunk_job_system =
+                occlusion_info->chunk_count > 1 ? job_system : NULL;
+
+        parallel_for(chunk_job_system, occlusion_info->chunk_count, 1,
+                setup_triangles, occlusion_info);
+
+        // Tile by tile, each chunk bins after the chunks before it, which
+        // keeps triangles in submission order within a tile
+        unsigned int offset = 0;
+        for (unsigned int t = 0; t < tile_count; ++t) {
+                occlusion_info->tile_bin_offsets[t] = offset;
+                for (unsigned int c = 0; c < occlusion_info->chunk_count; ++c) {
+                        unsigned int *bin_offset =
+                                &occlusion_info->chunk_bin_offsets[c *
+                                tile_count + t];
+                        unsigned int bin_count = *bin_offset;
+                        *bin_offset = offset;
+                        offset += bin_count;
+                }
+        }
+        occlusion_info->tile_bin_offsets[tile_count] = offset;
+
+        if (offset > occlusion_info->bin_capacity) {
+                free(occlusion_info->bins);
+                occlusion_info->bin_capacity = offset;
+                occlusion_info->bins = malloc(occlusion_info->bin_capacity *
+                        sizeof (unsigned int));
+        }
+
+        parallel_for(chunk_job_system, occlusion_info->chunk_count, 1,
+                bin_triangles, occlusion_info);
+
+        parallel_for(job_system, tile_count, 1, rasterize_tiles,
+                occlusion_info);
+
+        // Levels coarser than a tile are small enough to reduce here
+        for (unsigned int l = OCCLUSION_TILE_LEVELS + 1;
+                l < occlusion_info->level_count; ++l) {
+                for (unsigned int y = 0; y < occlusion_info->level_heights[l];
+                        ++y) {
+                        for (unsigned int x = 0;
+                                x < occlusion_info->level_widths[l]; ++x)
+                                reduce_texel(occlusion_info, l, x, y);
+                }
+        }
+
+        occlusion_info->stats.binned_triangle_count = offset;
+        occlusion_info->stats.raster_time = get_time_in_secs() - start_time;
+}
+
+// Occluded when every texel over the rectangle of pixels holds depths in
+// front of min_z, texels that are neither fully in front nor fully behind
+// are looked at one level finer
+static int is_region_occluded(struct occlusion_info *occlusion_info,
+        unsigned int level, const int *rect, float min_z)
+{
+        unsigned int level_width = occlusion_info->level_widths[level];
+        float *min_depths = occlusion_info->min_depths[level];
+        float *max_depths = occlusion_info->max_depths[level];
+
+        for (int ty = rect[1] >> level; ty <= rect[3] >> level; ++ty) {
+                for (int tx = rect[0] >> level; tx <= rect[2] >> level; ++tx) {
+                        unsigned int i = ty * level_width + tx;
+                        if (min_z > max_depths[i])
+                                continue;
+
+                        if (level == 0 || min_z <= min_depths[i])
+                                return 0;
+
+                        // The part of the rectangle under this texel
+                        int sub_rect[4] = {
+                                tx << level,
+                                ty << level,
+                                ((tx + 1) << level) - 1,
+                                ((ty + 1) << level) - 1
+                        };
+                        for (int k = 0; k < 2; ++k) {
+                                if (rect[k] > sub_rect[k])
+                                        sub_rect[k] = rect[k];
+                                if (rect[k + 2] < sub_rect[k + 2])
+                                        sub_rect[k + 2] = rect[k + 2];
+                        }
+
+                        if (!is_region_occluded(occlusion_info, level - 1,
+                                sub_rect, min_z))
+                                return 0;
+                }
+        }
+
+        return 1;
+}
+
+int is_aabb_occluded(struct occlusion_info *occlusion_info, vec3 centre,
+        vec3 extents)
+{
+        // Corners in clip space are the centre plus or minus the matrix
+        // columns scaled by the extents
+        vec4 centre_pos = { centre[0], centre[1], centre[2], 1.0f };
+        vec4 clip_centre;
+        mat4x4_mul_vec4(clip_centre, occlusion_info->pv_mat, centre_pos);
+
+        vec4 clip_axes[3];
+        for (int k = 0; k < 3; ++k)
+                vec4_scale(clip_axes[k], occlusion_info->pv_mat[k], extents[k]);
+
+        float min_x = INFINITY;
+        float min_y = INFINITY;
+        float max_x = -INFINITY;
+        float max_y = -INFINITY;
+        float min_z = INFINITY;
+
+        for (int corner = 0; corner < 8; ++corner) {
+                vec4 clip;
+                vec4_scale(clip, clip_centre, 1.0f);
+                for (int k = 0; k < 3; ++k) {
+                        if (corner & (1 << k))
+                                vec4_add(clip, clip, clip_axes[k]);
+                        else
+                                vec4_sub(clip, clip, clip_axes[k]);
+                }
+
+                if (clip[3] <= OCCLUSION_MIN_W)
+                        return 0;
+
+                float inv_w = 1.0f / clip[3];
+                float x = (clip[0] * inv_w * 0.5f + 0.5f) *
+                        occlusion_info->width;
+                float y = (0.5f - clip[1] * inv_w * 0.5f) *
+                        occlusion_info->height;
+                float z = clip[2] * inv_w;
+
+                min_x = fminf(min_x, x);
+                min_y = fminf(min_y, y);
+                max_x = fmaxf(max_x, x);
+                max_y = fmaxf(max_y, y);
+                min_z = fminf(min_z, z);
+        }
+
+        if (min_z < 0.0f)
+                return 0;
+
+        // Boxes off the screen are left to frustum culling
+        if (max_x < 0.0f || max_y < 0.0f ||
+                min_x >= (float) occlusion_info->width ||
+                min_y >= (float) occlusion_info->height)
+                return 0;
+
+        int rect[4] = {
+                min_x > 0.0f ? (int) min_x : 0,
+                min_y > 0.0f ? (int) min_y : 0,
+                max_x < occlusion_info->width - 1 ?
+                        (int) max_x : (int) occlusion_info->width - 1,
+                max_y < occlusion_info->height - 1 ?
+                        (int) max_y : (int) occlusion_info->height - 1
+        };
+
+        // Start from the level where the rectangle spans about two texels
+        int span = rect[2] - rect[0] > rect[3] - rect[1] ?
+                rect[2] - rect[0] : rect[3] - rect[1];
+        unsigned int level = 0;
+        while ((span >> level) > 1 && level + 1 < occlusion_info->level_count)
+                ++level;
+
+        return is_region_occluded(occlusion_info, level, rect, min_z);
+}
+
+static void test_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct occlusion_test_job *job = job_data;
+        struct cull_volume_info *volume_info = job->volume_info;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = get_chunk_first(job->index_count, c,
+                        job->chunk_count);
+                unsigned int last = get_chunk_first(job->index_count, c + 1,
+                        job->chunk_count);
+
+                // Each chunk compacts into its own part of the output, never
+                // past the index it is reading
+                unsigned int visible_count = 0;
+                for (unsigned int i = first; i < last; ++i) {
+                        unsigned int index = job->indices[i];
+
+                        vec3 centre = {
+                                volume_info->x[index],
+                                volume_info->y[index],
+                                volume_info->z[index]
+                        };
+                        vec3 extents;
+                        if (volume_info->type == CULL_VOLUME_TYPE_SPHERE) {
+                                extents[0] = volume_info->radius[index];
+                                extents[1] = volume_info->radius[index];
+                                extents[2] = volume_info->radius[index];
+                        } else {
+                                extents[0] = volume_info->extent_x[index];
+                                extents[1] = volume_info->extent_y[index];
+                                extents[2] = volume_info->extent_z[index];
+                        }
+
+                        if (!is_aabb_occluded(job->occlusion_info, centre,
+                                extents))
+                                job->visible_indices[first +
+                                        visible_count++] = index;
+                }
+
+                job->chunk_visible_counts[c] = visible_count;
+        }
+}
+
+unsigned int cull_occluded_volumes(struct occlusion_info *occlusion_info,
+        struct cull_volume_info *volume_info, const unsigned int *indices,
+        unsigned int index_count, unsigned int *visible_indices)
+{
+        if (index_count == 0)
+                return 0;
+
+        struct occlusion_test_job job;
+        job.occlusion_info = occlusion_info;
+        job.volume_info = volume_info;
+        job.indices = indices;
+        job.index_count = index_count;
+        job.visible_indices = visible_indices;
+        job.chunk_count = 1;
+
+        struct job_system_info *job_system = occlusion_info->job_system;
+        if (job_system != NULL && index_count >=
+                OCCLUSION_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_OCCLUSION_CHUNKS)
+                        job.chunk_count = MAX_OCCLUSION_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, test_chunks, &job);
+
+        unsigned int visible_count = job.chunk_visible_counts[0];
+        for (unsigned int c = 1; c < job.chunk_count; ++c) {
+                memmove(visible_indices + visible_count,
+                        visible_indices + get_chunk_first(index_count, c,
+                        job.chunk_count),
+                        job.chunk_visible_counts[c] * sizeof (unsigned int));
+                visible_count += job.chunk_visible_counts[c];
+        }
+
+        occlusion_info->stats.tested_count += index_count;
+        occlusion_info->stats.occluded_count += index_count - visible_count;
+
+        return visible_count;
+}
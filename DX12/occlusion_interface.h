@@ -0,0 +1,98 @@
+#ifndef OCCLUSION_INTERFACE_H
+#define OCCLUSION_INTERFACE_H
+
+#include "linmath.h"
+#include "mesh_interface.h"
+#include "cull_interface.h"
+#include "job_interface.h"
+
+// Software occlusion culling. Occluder meshes are binned into screen tiles
+// and rasterized into a low resolution depth buffer, a tile per job, and
+// each tile reduces itself into the levels of a min/max depth pyramid.
+// Bounding boxes are then tested against the pyramid, from the coarsest
+// level that covers them down to where the depths decide. Kept free of D3D
+// types so it can run headless.
+//
+// Depths follow D3D, 0 is near and 1 is far.
+#define OCCLUSION_TILE_SIZE 32
+#define OCCLUSION_TILE_LEVELS 5
+#define MAX_OCCLUSION_LEVELS 16
+#define MAX_OCCLUSION_CHUNKS 64
+#define OCCLUSION_PARALLEL_MIN_COUNT 1024
+
+struct occluder {
+        struct mesh_info *mesh_info;
+        unsigned int *indices;
+        mat4x4 mvp_mat;
+        unsigned int first_triangle;
+};
+
+// Screen space corners, min_x is past max_x for triangles that are not
+// drawn
+struct occlusion_triangle {
+        float x[3];
+        float y[3];
+        float z[3];
+        int min_x;
+        int min_y;
+        int max_x;
+        int max_y;
+};
+
+struct occlusion_stats {
+        unsigned int occluder_count;
+        unsigned int dropped_occluder_count;
+        unsigned int triangle_count;
+        unsigned int binned_triangle_count;
+        unsigned int tested_count;
+        unsigned int occluded_count;
+        double raster_time;
+};
+
+struct occlusion_info {
+        struct job_system_info *job_system;
+        unsigned int width; // Multiple of OCCLUSION_TILE_SIZE
+        unsigned int height; // Multiple of OCCLUSION_TILE_SIZE
+        unsigned int max_occluders;
+        unsigned int max_triangles;
+        unsigned int tile_count_x;
+        unsigned int tile_count_y;
+        // Level 0 is the depth buffer and is both the min and max level
+        unsigned int level_count;
+        unsigned int level_widths[MAX_OCCLUSION_LEVELS];
+        unsigned int level_heights[MAX_OCCLUSION_LEVELS];
+        float *min_depths[MAX_OCCLUSION_LEVELS];
+        float *max_depths[MAX_OCCLUSION_LEVELS];
+        mat4x4 pv_mat;
+        unsigned int occluder_count;
+        struct occluder *occluders;
+        unsigned int triangle_count;
+        struct occlusion_triangle *triangles;
+        // Triangle counts per chunk and tile, turned into bin offsets
+        unsigned int chunk_count;
+        unsigned int *chunk_bin_offsets;
+        unsigned int *tile_bin_offsets;
+        unsigned int bin_capacity;
+        unsigned int *bins;
+        struct occlusion_stats stats;
+};
+
+void create_occlusion(struct occlusion_info *occlusion_info);
+void release_occlusion(struct occlusion_info *occlusion_info);
+void begin_occlusion(struct occlusion_info *occlusion_info, mat4x4 pv_mat);
+// Only the given level of the mesh is rasterized. Coarser levels are
+// cheaper but may cover pixels the full mesh does not, hiding objects that
+// are in view. The mesh has to stay alive until the occluders are
+// rasterized.
+void add_occluder(struct occlusion_info *occlusion_info,
+        struct mesh_info *mesh_info, unsigned int lod, mat4x4 world_mat);
+void rasterize_occluders(struct occlusion_info *occlusion_info);
+int is_aabb_occluded(struct occlusion_info *occlusion_info, vec3 centre,
+        vec3 extents);
+// Keeps the indices of the volumes that are not occluded, in order. Spheres
+// are tested as the boxes around them. visible_indices may be indices.
+unsigned int cull_occluded_volumes(struct occlusion_info *occlusion_info,
+        struct cull_volume_info *volume_info, const unsigned int *indices,
+        unsigned int index_count, unsigned int *visible_indices);
+
+#endif
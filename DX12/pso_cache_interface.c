@@ -0,0 +1,687 @@
+#include "pso_cache_interface.h"
+#include "timer_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+struct pso_manifest_record {
+        UINT template_index;
+        UINT stage_keys[MAX_PSO_STAGES];
+        double first_use_time;
+};
+
+static int compare_manifest_records(const void *a, const void *b)
+{
+        const struct pso_manifest_record *record_a = a;
+        const struct pso_manifest_record *record_b = b;
+
+        if (record_a->first_use_time < record_b->first_use_time)
+                return -1;
+
+        return record_a->first_use_time > record_b->first_use_time;
+}
+
+static UINT64 get_reload_generation(struct pso_cache_info *cache_info)
+{
+        if (cache_info->reload_info == NULL)
+                return 0;
+
+        return cache_info->reload_info->generation;
+}
+
+static struct pso_cache_entry *find_pso_entry(
+        struct pso_cache_info *cache_info, UINT template_index,
+        UINT *stage_keys)
+{
+        UINT stage_count = cache_info->templates[template_index].stage_count;
+
+        for (UINT i = 0; i < cache_info->entry_count; ++i) {
+                struct pso_cache_entry *entry = cache_info->entries[i];
+                if (entry->template_index != template_index)
+                        continue;
+
+                if (memcmp(entry->stage_keys, stage_keys,
+                        stage_count * sizeof (UINT)) == 0)
+                        return entry;
+        }
+
+        return NULL;
+}
+
+static struct pso_cache_entry *add_pso_entry(
+        struct pso_cache_info *cache_info, UINT template_index,
+        UINT *stage_keys)
+{
+        if (cache_info->entry_count == cache_info->entry_capacity) {
+                cache_info->entry_capacity *= 2;
+                cache_info->entries = realloc(cache_info->entries,
+                        cache_info->entry_capacity *
+                        sizeof (struct pso_cache_entry *));
+        }
+
+        struct pso_template_info *template_info =
+                &cache_info->templates[template_index];
+
+        // Entries are allocated one by one so PSO infos handed out stay put
+        struct pso_cache_entry *entry = malloc(sizeof (struct pso_cache_entry));
+        entry->cache_info = cache_info;
+        entry->entry_index = cache_info->entry_count;
+        entry->template_index = template_index;
+        entry->pso_info = template_info->pso_info;
+        entry->pso_info.pso = NULL;
+        entry->state = PSO_CACHE_STATE_PENDING;
+        entry->is_build_failed = FALSE;
+        entry->is_used = FALSE;
+        entry->first_use_time = -1.0;
+        entry->request_time = get_time_in_secs();
+        entry->ready_time = entry->request_time;
+        entry->reload_generation = 0;
+        init_job_counter(&entry->counter);
+
+        for (UINT i = 0; i < MAX_PSO_STAGES; ++i) {
+                entry->stage_keys[i] = i < template_info->stage_count ?
+                        stage_keys[i] : 0;
+                entry->stage_shader_infos[i] = NULL;
+                entry->stage_compiles[i] = NULL;
+        }
+
+        cache_info->entries[cache_info->entry_count++] = entry;
+
+        return entry;
+}
+
+static void set_pso_entry_ready(struct pso_cache_info *cache_info,
+        struct pso_cache_entry *entry)
+{
+        entry->state = PSO_CACHE_STATE_READY;
+
+        double time_to_ready = entry->ready_time - entry->request_time;
+        struct pso_cache_stats *stats = &cache_info->stats;
+        ++stats->ready_count;
+        stats->total_time_to_ready += time_to_ready;
+        if (time_to_ready > stats->max_time_to_ready)
+                stats->max_time_to_ready = time_to_ready;
+
+        // Only ready PSOs are handed to hot reload. Pending ones are built
+        // from the shaders of when they were submitted, and built again if
+        // a reload was applied before they finished.
+        if (cache_info->reload_info != NULL) {
+                struct pso_template_info *template_info =
+                        &cache_info->templates[entry->template_index];
+                add_reload_pso(cache_info->reload_info, &entry->pso_info,
+                        template_info->vert_input_info,
+                        template_info->root_sig_info,
+                        template_info->stage_shaders, entry->stage_keys,
+                        template_info->stage_count);
+        }
+}
+
+static void mark_pso_used(struct pso_cache_info *cache_info,
+        struct pso_cache_entry *entry)
+{
+        if (entry->is_used)
+                return;
+
+        entry->is_used = TRUE;
+        entry->first_use_time = get_time_in_secs() - cache_info->start_time;
+}
+
+static void build_pso_entry(struct pso_cache_info *cache_info,
+        struct pso_cache_entry *entry)
+{
+        struct pso_template_info *template_info =
+                &cache_info->templates[entry->template_index];
+
+        for (UINT i = 0; i < template_info->stage_count; ++i) {
+                set_pso_stage_shader(&entry->pso_info, i,
+                        get_shader_permutation(template_info->stage_shaders[i],
+                                entry->stage_keys[i]));
+        }
+
+        create_pso(cache_info->device_info, template_info->vert_input_info,
+                template_info->root_sig_info, &entry->pso_info);
+        entry->ready_time = get_time_in_secs();
+
+        set_pso_entry_ready(cache_info, entry);
+}
+
+static void compile_pso_shader_job(void *job_data)
+{
+        struct pso_cache_shader *compile = job_data;
+
+        compile->compiled = try_compile_shader_permutation(compile->perm_info,
+                compile->key, compile->shader_info);
+}
+
+static void create_cached_pso_job(void *job_data)
+{
+        struct pso_cache_entry *entry = job_data;
+        struct pso_cache_info *cache_info = entry->cache_info;
+        struct pso_template_info *template_info =
+                &cache_info->templates[entry->template_index];
+
+        for (UINT i = 0; i < template_info->stage_count; ++i) {
+                struct gpu_shader_info *shader_info =
+                        entry->stage_shader_infos[i];
+
+                // Compiles shared with other entries run on whichever worker
+                // gets to them first
+                struct pso_cache_shader *compile = entry->stage_compiles[i];
+                if (compile != NULL) {
+                        wait_for_jobs(cache_info->job_system,
+                                &compile->counter);
+                        if (!compile->compiled) {
+                                entry->is_build_failed = TRUE;
+                                return;
+                        }
+
+                        shader_info = compile->shader_info;
+                }
+
+                set_pso_stage_shader(&entry->pso_info, i, shader_info);
+        }
+
+        if (!try_create_pso(cache_info->device_info,
+                template_info->vert_input_info, template_info->root_sig_info,
+                &entry->pso_info)) {
+                entry->is_build_failed = TRUE;
+                return;
+        }
+
+        entry->ready_time = get_time_in_secs();
+}
+
+static struct pso_cache_shader *request_pso_shader(
+        struct pso_cache_info *cache_info,
+        struct shader_permutation_info *perm_info, UINT key)
+{
+        // Compiles from before a reload read the old sources
+        UINT64 reload_generation = get_reload_generation(cache_info);
+        for (UINT i = 0; i < cache_info->compile_count; ++i) {
+                struct pso_cache_shader *compile = cache_info->compiles[i];
+                if (compile->perm_info == perm_info && compile->key == key &&
+                        compile->reload_generation == reload_generation)
+                        return compile;
+        }
+
+        if (cache_info->compile_count == cache_info->compile_capacity) {
+                cache_info->compile_capacity *= 2;
+                cache_info->compiles = realloc(cache_info->compiles,
+                        cache_info->compile_capacity *
+                        sizeof (struct pso_cache_shader *));
+        }
+
+        struct pso_cache_shader *compile =
+                malloc(sizeof (struct pso_cache_shader));
+        compile->perm_info = perm_info;
+        compile->key = key;
+        compile->shader_info = malloc(sizeof (struct gpu_shader_info));
+        compile->shader_info->shader_blob = NULL;
+        compile->compiled = FALSE;
+        compile->is_owned_by_set = FALSE;
+        compile->reload_generation = reload_generation;
+        init_job_counter(&compile->counter);
+        cache_info->compiles[cache_info->compile_count++] = compile;
+
+        submit_job(cache_info->job_system, compile_pso_shader_job, compile,
+                &compile->counter);
+
+        return compile;
+}
+
+static void submit_pso_entry(struct pso_cache_info *cache_info,
+        struct pso_cache_entry *entry)
+{
+        struct pso_template_info *template_info =
+                &cache_info->templates[entry->template_index];
+
+        // Workers never touch the permutation sets, missing permutations
+        // get compiled into shaders of our own
+        for (UINT i = 0; i < template_info->stage_count; ++i) {
+                struct shader_permutation_info *perm_info =
+                        template_info->stage_shaders[i];
+                UINT key = entry->stage_keys[i];
+                assert(key < perm_info->permutation_count);
+
+                entry->stage_shader_infos[i] = perm_info->permutations[key];
+                entry->stage_compiles[i] = NULL;
+                if (perm_info->permutations[key] == NULL) {
+                        entry->stage_compiles[i] = request_pso_shader(
+                                cache_info, perm_info, key);
+                }
+        }
+
+        // Hot reload must not free the shaders the worker builds from
+        ++cache_info->stats.pending_count;
+        if (cache_info->reload_info != NULL)
+                hold_shader_retirement(cache_info->reload_info);
+
+        entry->is_build_failed = FALSE;
+        entry->reload_generation = get_reload_generation(cache_info);
+        submit_job(cache_info->job_system, create_cached_pso_job, entry,
+                &entry->counter);
+}
+
+static void finish_pso_entry(struct pso_cache_info *cache_info,
+        struct pso_cache_entry *entry)
+{
+        struct pso_template_info *template_info =
+                &cache_info->templates[entry->template_index];
+
+        --cache_info->stats.pending_count;
+        if (cache_info->reload_info != NULL)
+                resume_shader_retirement(cache_info->reload_info);
+
+        // A reload applied while the worker was building leaves a PSO of
+        // the old shaders, and compiles of the old sources that must not
+        // reach the sets, so the PSO is built again from the new ones
+        if (entry->reload_generation != get_reload_generation(cache_info)) {
+                if (entry->pso_info.pso != NULL) {
+                        release_pso(&entry->pso_info);
+                        entry->pso_info.pso = NULL;
+                }
+
+                submit_pso_entry(cache_info, entry);
+                return;
+        }
+
+        // Hand compiled permutations to their sets unless one got compiled
+        // on demand in the meantime, in which case the copy stays with us
+        for (UINT i = 0; i < template_info->stage_count; ++i) {
+                struct pso_cache_shader *compile = entry->stage_compiles[i];
+                if (compile == NULL || !compile->compiled ||
+                        compile->is_owned_by_set)
+                        continue;
+
+                struct shader_permutation_info *perm_info =
+                        compile->perm_info;
+                if (perm_info->permutations[compile->key] == NULL) {
+                        perm_info->permutations[compile->key] =
+                                compile->shader_info;
+                        ++perm_info->compiled_count;
+                        compile->is_owned_by_set = TRUE;
+                }
+        }
+
+        // A failed background build stays failed, draws keep getting the
+        // fallback of the template rather than retrying every frame
+        if (entry->is_build_failed) {
+                entry->state = PSO_CACHE_STATE_FAILED;
+                ++cache_info->stats.failed_count;
+                return;
+        }
+
+        for (UINT i = 0; i < template_info->stage_count; ++i) {
+                set_pso_stage_shader(&entry->pso_info, i,
+                        get_shader_permutation(template_info->stage_shaders[i],
+                                entry->stage_keys[i]));
+        }
+
+        set_pso_entry_ready(cache_info, entry);
+}
+
+static struct pso_cache_entry *get_ready_pso_entry(
+        struct pso_cache_info *cache_info, UINT template_index,
+        UINT *stage_keys)
+{
+        struct pso_cache_entry *entry = find_pso_entry(cache_info,
+                template_index, stage_keys);
+
+        if (entry == NULL) {
+                entry = add_pso_entry(cache_info, template_index, stage_keys);
+                build_pso_entry(cache_info, entry);
+        } else {
+                // Still being pre-warmed, help finish it rather than build a
+                // second copy. A build a reload made stale is queued again.
+                while (entry->state == PSO_CACHE_STATE_PENDING) {
+                        wait_for_jobs(cache_info->job_system,
+                                &entry->counter);
+                        finish_pso_entry(cache_info, entry);
+                }
+        }
+
+        return entry;
+}
+
+
+void create_pso_cache(struct pso_cache_info *cache_info)
+{
+        cache_info->start_time = get_time_in_secs();
+        cache_info->template_count = 0;
+
+        cache_info->entry_count = 0;
+        cache_info->entry_capacity = 16;
+        cache_info->entries = malloc(cache_info->entry_capacity *
+                sizeof (struct pso_cache_entry *));
+
+        cache_info->compile_count = 0;
+        cache_info->compile_capacity = 16;
+        cache_info->compiles = malloc(cache_info->compile_capacity *
+                sizeof (struct pso_cache_shader *));
+
+        memset(&cache_info->stats, 0, sizeof (struct pso_cache_stats));
+}
+
+void release_pso_cache(struct pso_cache_info *cache_info)
+{
+        for (UINT i = 0; i < cache_info->entry_count; ++i) {
+                struct pso_cache_entry *entry = cache_info->entries[i];
+                wait_for_jobs(cache_info->job_system, &entry->counter);
+
+                if (entry->pso_info.pso != NULL)
+                        release_pso(&entry->pso_info);
+
+                free(entry);
+        }
+
+        free(cache_info->entries);
+
+        for (UINT i = 0; i < cache_info->compile_count; ++i) {
+                struct pso_cache_shader *compile = cache_info->compiles[i];
+                wait_for_jobs(cache_info->job_system, &compile->counter);
+
+                if (!compile->is_owned_by_set) {
+                        if (compile->shader_info->shader_blob != NULL)
+                                release_shader(compile->shader_info);
+
+                        free(compile->shader_info);
+                }
+
+                free(compile);
+        }
+
+        free(cache_info->compiles);
+}
+
+UINT add_pso_template(struct pso_cache_info *cache_info, LPCSTR name,
+        struct gpu_pso_info *pso_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct shader_permutation_info **stage_shaders, UINT stage_count)
+{
+        assert(cache_info->template_count < MAX_PSO_TEMPLATES);
+        assert(stage_count <= MAX_PSO_STAGES);
+        assert(strlen(name) < MAX_PSO_TEMPLATE_NAME);
+
+        UINT template_index = cache_info->template_count++;
+        struct pso_template_info *template_info =
+                &cache_info->templates[template_index];
+        strcpy(template_info->name, name);
+        template_info->pso_info = *pso_info;
+        template_info->vert_input_info = vert_input_info;
+        template_info->root_sig_info = root_sig_info;
+        template_info->stage_count = stage_count;
+        template_info->fallback_policy = PSO_FALLBACK_POLICY_SKIP;
+        template_info->fallback_entry = NULL;
+
+        for (UINT i = 0; i < stage_count; ++i)
+                template_info->stage_shaders[i] = stage_shaders[i];
+
+        return template_index;
+}
+
+void set_pso_fallback(struct pso_cache_info *cache_info, UINT template_index,
+        UINT *fallback_keys)
+{
+        assert(template_index < cache_info->template_count);
+
+        // The fallback has to be usable right away, but only counts as used
+        // once a draw needs it
+        struct pso_cache_entry *entry = get_ready_pso_entry(cache_info,
+                template_index, fallback_keys);
+
+        // A fallback that cannot be built has nothing to fall back on
+        if (entry->state != PSO_CACHE_STATE_READY)
+                build_pso_entry(cache_info, entry);
+
+        struct pso_template_info *template_info =
+                &cache_info->templates[template_index];
+        template_info->fallback_policy = PSO_FALLBACK_POLICY_PIPELINE;
+        template_info->fallback_entry = entry;
+}
+
+struct gpu_pso_info *get_cached_pso(struct pso_cache_info *cache_info,
+        UINT template_index, UINT *stage_keys)
+{
+        assert(template_index < cache_info->template_count);
+
+        struct pso_cache_entry *entry = get_ready_pso_entry(cache_info,
+                template_index, stage_keys);
+
+        // Callers are about to use the PSO, so serve the fallback when the
+        // pre-warm failed to build it and report the error without one
+        if (entry->state == PSO_CACHE_STATE_FAILED) {
+                struct pso_template_info *template_info =
+                        &cache_info->templates[template_index];
+                if (template_info->fallback_entry == NULL)
+                        build_pso_entry(cache_info, entry);
+                else
+                        entry = template_info->fallback_entry;
+        }
+
+        mark_pso_used(cache_info, entry);
+
+        return &entry->pso_info;
+}
+
+UINT request_pso(struct pso_cache_info *cache_info, UINT template_index,
+        UINT *stage_keys)
+{
+        assert(template_index < cache_info->template_count);
+
+        struct pso_cache_entry *entry = find_pso_entry(cache_info,
+                template_index, stage_keys);
+
+        if (entry == NULL) {
+                entry = add_pso_entry(cache_info, template_index, stage_keys);
+                submit_pso_entry(cache_info, entry);
+        }
+
+        return entry->entry_index;
+}
+
+struct gpu_pso_info *get_pso_for_draw(struct pso_cache_info *cache_info,
+        UINT pso_handle)
+{
+        assert(pso_handle < cache_info->entry_count);
+
+        struct pso_cache_entry *entry = cache_info->entries[pso_handle];
+
+        // The manifest orders PSOs by when draws first need them, whether
+        // or not they are ready by then
+        mark_pso_used(cache_info, entry);
+
+        if (entry->state == PSO_CACHE_STATE_PENDING &&
+                is_job_done(cache_info->job_system, &entry->counter))
+                finish_pso_entry(cache_info, entry);
+
+        if (entry->state == PSO_CACHE_STATE_READY)
+                return &entry->pso_info;
+
+        struct pso_template_info *template_info =
+                &cache_info->templates[entry->template_index];
+
+        switch (template_info->fallback_policy) {
+                case PSO_FALLBACK_POLICY_PIPELINE :
+                        ++cache_info->stats.fallback_draw_count;
+                        mark_pso_used(cache_info,
+                                template_info->fallback_entry);
+                        return &template_info->fallback_entry->pso_info;
+
+                case PSO_FALLBACK_POLICY_SKIP :
+                        ++cache_info->stats.skipped_draw_count;
+                        return NULL;
+
+                default :
+                        return NULL;
+        }
+}
+
+void update_pso_cache(struct pso_cache_info *cache_info)
+{
+        for (UINT i = 0; i < cache_info->entry_count; ++i) {
+                struct pso_cache_entry *entry = cache_info->entries[i];
+                if (entry->state != PSO_CACHE_STATE_PENDING ||
+                        !is_job_done(cache_info->job_system, &entry->counter))
+                        continue;
+
+                finish_pso_entry(cache_info, entry);
+        }
+}
+
+void wait_for_pso_cache(struct pso_cache_info *cache_info)
+{
+        for (UINT i = 0; i < cache_info->entry_count; ++i) {
+                struct pso_cache_entry *entry = cache_info->entries[i];
+                while (entry->state == PSO_CACHE_STATE_PENDING) {
+                        wait_for_jobs(cache_info->job_system,
+                                &entry->counter);
+                        finish_pso_entry(cache_info, entry);
+                }
+        }
+}
+
+void prewarm_pso_cache(struct pso_cache_info *cache_info,
+        const char *manifest_file)
+{
+        // Without a manifest PSOs are simply created on first use
+        FILE *manifest = fopen(manifest_file, "r");
+        if (manifest == NULL)
+                return;
+
+        UINT record_count = 0;
+        UINT record_capacity = 64;
+        struct pso_manifest_record *records = malloc(record_capacity *
+                sizeof (struct pso_manifest_record));
+
+        // Each line holds a template name, the first use time and the
+        // permutation key of every stage
+        char line[1024];
+        while (fgets(line, sizeof (line), manifest) != NULL) {
+                if (line[0] == '#')
+                        continue;
+
+                char name[MAX_PSO_TEMPLATE_NAME];
+                double first_use_time;
+                UINT stage_keys[MAX_PSO_STAGES] = { 0 };
+                int field_count = sscanf(line, "%63s %lf %u %u", name,
+                        &first_use_time, &stage_keys[0], &stage_keys[1]);
+                if (field_count < 3)
+                        continue;
+
+                UINT template_index = 0;
+                while (template_index < cache_info->template_count &&
+                        strcmp(cache_info->templates[template_index].name,
+                                name) != 0) {
+                        ++template_index;
+                }
+
+                // Skip PSOs whose template is gone or whose keys no longer
+                // fit its shaders. Keys are only checked against the
+                // permutation count, so a changed feature list still
+                // prewarms whatever permutations the old keys now name.
+                if (template_index == cache_info->template_count)
+                        continue;
+
+                struct pso_template_info *template_info =
+                        &cache_info->templates[template_index];
+                if (field_count - 2 != (int) template_info->stage_count)
+                        continue;
+
+                BOOL is_valid = TRUE;
+                for (UINT i = 0; i < template_info->stage_count; ++i) {
+                        if (stage_keys[i] >= template_info->stage_shaders[i]->
+                                permutation_count)
+                                is_valid = FALSE;
+                }
+
+                if (!is_valid)
+                        continue;
+
+                if (record_count == record_capacity) {
+                        record_capacity *= 2;
+                        records = realloc(records, record_capacity *
+                                sizeof (struct pso_manifest_record));
+                }
+
+                records[record_count].template_index = template_index;
+                records[record_count].stage_keys[0] = stage_keys[0];
+                records[record_count].stage_keys[1] = stage_keys[1];
+                records[record_count].first_use_time = first_use_time;
+                ++record_count;
+        }
+
+        fclose(manifest);
+
+        // Workers take jobs in about the order they were queued, so queueing
+        // by first use gets the PSOs of the first frames done first
+        qsort(records, record_count, sizeof (struct pso_manifest_record),
+                compare_manifest_records);
+
+        for (UINT i = 0; i < record_count; ++i) {
+                struct pso_manifest_record *record = &records[i];
+                if (find_pso_entry(cache_info, record->template_index,
+                        record->stage_keys) != NULL)
+                        continue;
+
+                struct pso_cache_entry *entry = add_pso_entry(cache_info,
+                        record->template_index, record->stage_keys);
+                entry->first_use_time = record->first_use_time;
+
+                submit_pso_entry(cache_info, entry);
+        }
+
+        free(records);
+}
+
+BOOL save_pso_manifest(struct pso_cache_info *cache_info,
+        const char *manifest_file)
+{
+        FILE *manifest = fopen(manifest_file, "w");
+        if (manifest == NULL)
+                return FALSE;
+
+        // Keep PSOs from the manifest that weren't needed this run, another
+        // level may still want them
+        UINT record_count = 0;
+        struct pso_manifest_record *records = malloc(cache_info->entry_count *
+                sizeof (struct pso_manifest_record));
+
+        for (UINT i = 0; i < cache_info->entry_count; ++i) {
+                struct pso_cache_entry *entry = cache_info->entries[i];
+                if (entry->first_use_time < 0.0)
+                        continue;
+
+                records[record_count].template_index = entry->template_index;
+                records[record_count].stage_keys[0] = entry->stage_keys[0];
+                records[record_count].stage_keys[1] = entry->stage_keys[1];
+                records[record_count].first_use_time = entry->first_use_time;
+                ++record_count;
+        }
+
+        qsort(records, record_count, sizeof (struct pso_manifest_record),
+                compare_manifest_records);
+
+        fprintf(manifest, "# template first_use_secs stage_keys...\n");
+
+        for (UINT i = 0; i < record_count; ++i) {
+                struct pso_template_info *template_info =
+                        &cache_info->templates[records[i].template_index];
+
+                fprintf(manifest, "%s %.4f", template_info->name,
+                        records[i].first_use_time);
+                for (UINT stage = 0; stage < template_info->stage_count;
+                        ++stage)
+                        fprintf(manifest, " %u", records[i].stage_keys[stage]);
+                fprintf(manifest, "\n");
+        }
+
+        free(records);
+
+        BOOL is_written = !ferror(manifest);
+
+        return fclose(manifest) == 0 && is_written;
+}
@@ -0,0 +1,134 @@
+#ifndef PSO_CACHE_INTERFACE_H
+#define PSO_CACHE_INTERFACE_H
+
+#include "gpu_interface.h"
+#include "shader_permutation_interface.h"
+#include "shader_reload_interface.h"
+#include "job_interface.h"
+
+
+// PSOs are created from templates, which fix everything but the shader
+// permutation of each stage. The cache records when each template and key
+// combination is first used so a manifest of them can be saved and used to
+// create the PSOs ahead of time on the next run, first used first.
+//
+// PSOs can also be requested without waiting. Until one is ready, draws
+// either use the fallback PSO of its template or are skipped, and so do
+// draws of a PSO whose background build failed.
+#define MAX_PSO_TEMPLATES 16
+#define MAX_PSO_TEMPLATE_NAME 64
+#define MAX_PSO_STAGES 2
+
+enum PSO_CACHE_STATE {
+        PSO_CACHE_STATE_PENDING,
+        PSO_CACHE_STATE_READY,
+        PSO_CACHE_STATE_FAILED
+};
+
+enum PSO_FALLBACK_POLICY {
+        PSO_FALLBACK_POLICY_SKIP,
+        PSO_FALLBACK_POLICY_PIPELINE
+};
+
+struct pso_template_info {
+        char name[MAX_PSO_TEMPLATE_NAME];
+        struct gpu_pso_info pso_info;
+        struct gpu_vert_input_info *vert_input_info;
+        struct gpu_root_sig_info *root_sig_info;
+        UINT stage_count;
+        struct shader_permutation_info *stage_shaders[MAX_PSO_STAGES];
+        enum PSO_FALLBACK_POLICY fallback_policy;
+        struct pso_cache_entry *fallback_entry;
+};
+
+// A permutation that was missing when a pre-warm started, compiled on a
+// worker and handed to its permutation set once done
+struct pso_cache_shader {
+        struct shader_permutation_info *perm_info;
+        UINT key;
+        struct gpu_shader_info *shader_info;
+        BOOL compiled;
+        BOOL is_owned_by_set;
+        UINT64 reload_generation;
+        struct job_counter counter;
+};
+
+struct pso_cache_entry {
+        struct pso_cache_info *cache_info;
+        UINT entry_index;
+        UINT template_index;
+        UINT stage_keys[MAX_PSO_STAGES];
+        struct gpu_pso_info pso_info;
+        struct gpu_shader_info *stage_shader_infos[MAX_PSO_STAGES];
+        struct pso_cache_shader *stage_compiles[MAX_PSO_STAGES];
+        enum PSO_CACHE_STATE state;
+        BOOL is_build_failed;
+        BOOL is_used;
+        double first_use_time; // seconds since the cache was created
+        double request_time;
+        double ready_time;
+        // Generation of hot reload when the background build started
+        UINT64 reload_generation;
+        struct job_counter counter;
+};
+
+struct pso_cache_stats {
+        UINT pending_count;
+        UINT ready_count;
+        UINT failed_count;
+        UINT fallback_draw_count;
+        UINT skipped_draw_count;
+        double total_time_to_ready;
+        double max_time_to_ready;
+};
+
+struct pso_cache_info {
+        struct gpu_device_info *device_info;
+        struct job_system_info *job_system;
+        struct shader_reload_info *reload_info; // NULL to not reload PSOs
+        double start_time;
+        UINT template_count;
+        struct pso_template_info templates[MAX_PSO_TEMPLATES];
+        UINT entry_count;
+        UINT entry_capacity;
+        struct pso_cache_entry **entries;
+        UINT compile_count;
+        UINT compile_capacity;
+        struct pso_cache_shader **compiles;
+        struct pso_cache_stats stats;
+};
+
+void create_pso_cache(struct pso_cache_info *cache_info);
+void release_pso_cache(struct pso_cache_info *cache_info);
+// Shader byte code of the template PSO info is filled in per entry
+UINT add_pso_template(struct pso_cache_info *cache_info, LPCSTR name,
+        struct gpu_pso_info *pso_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct shader_permutation_info **stage_shaders, UINT stage_count);
+// Draws against a template that has no fallback are skipped while a PSO
+// is pending
+void set_pso_fallback(struct pso_cache_info *cache_info, UINT template_index,
+        UINT *fallback_keys);
+struct gpu_pso_info *get_cached_pso(struct pso_cache_info *cache_info,
+        UINT template_index, UINT *stage_keys);
+// Returns a handle right away and builds the PSO on a worker
+UINT request_pso(struct pso_cache_info *cache_info, UINT template_index,
+        UINT *stage_keys);
+// The requested PSO once ready, otherwise the fallback or NULL to skip.
+// Call when recording the draw, which is what counts as first use.
+struct gpu_pso_info *get_pso_for_draw(struct pso_cache_info *cache_info,
+        UINT pso_handle);
+// Hands finished background work over to the permutation sets, call once
+// per frame from the thread that records
+void update_pso_cache(struct pso_cache_info *cache_info);
+// Finishes every pending PSO, so hot reload can be released after it
+void wait_for_pso_cache(struct pso_cache_info *cache_info);
+void prewarm_pso_cache(struct pso_cache_info *cache_info,
+        const char *manifest_file);
+// FALSE when the manifest couldn't be written, which only costs the
+// prewarm on the next run
+BOOL save_pso_manifest(struct pso_cache_info *cache_info,
+        const char *manifest_file);
+
+#endif
@@ -0,0 +1,189 @@
+#include "radix_sort_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MAX_DIGITS ((64 + RADIX_BITS - 1) / RADIX_BITS)
+
+struct radix_sort_pass {
+        const unsigned long long *src;
+        unsigned long long *dst;
+        unsigned int count;
+        unsigned int chunk_count;
+        unsigned int first_shift;
+        unsigned int digit_count;
+        unsigned int shift;
+        // Key counts per chunk, turned into scatter offsets before scattering
+        unsigned int (*chunk_buckets)[RADIX_BUCKETS];
+        // Counts of every digit of the keys per chunk, filled by the first
+        // pass
+        unsigned int (*chunk_digit_buckets)[RADIX_MAX_DIGITS][RADIX_BUCKETS];
+};
+
+static unsigned int get_chunk_first(struct radix_sort_pass *pass,
+        unsigned int chunk)
+{
+        return (unsigned int) (((unsigned long long) pass->count * chunk) /
+                pass->chunk_count);
+}
+
+static void count_all_digits(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct radix_sort_pass *pass = job_data;
+        unsigned int digit_count = pass->digit_count;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int (*buckets)[RADIX_BUCKETS] =
+                        pass->chunk_digit_buckets[c];
+                memset(buckets, 0, digit_count * RADIX_BUCKETS *
+                        sizeof (unsigned int));
+
+                unsigned int last = get_chunk_first(pass, c + 1);
+                for (unsigned int i = get_chunk_first(pass, c); i < last;
+                        ++i) {
+                        unsigned long long key = pass->src[i] >>
+                                pass->first_shift;
+                        for (unsigned int d = 0; d < digit_count; ++d) {
+                                ++buckets[d][key & (RADIX_BUCKETS - 1)];
+                                key >>= RADIX_BITS;
+                        }
+                }
+        }
+}
+
+static void count_digit(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct radix_sort_pass *pass = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int *buckets = pass->chunk_buckets[c];
+                memset(buckets, 0, RADIX_BUCKETS * sizeof (unsigned int));
+
+                unsigned int last = get_chunk_first(pass, c + 1);
+                for (unsigned int i = get_chunk_first(pass, c); i < last;
+                        ++i) {
+                        ++buckets[(pass->src[i] >> pass->shift) &
+                                (RADIX_BUCKETS - 1)];
+                }
+        }
+}
+
+static void scatter_digit(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct radix_sort_pass *pass = job_data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int *offsets = pass->chunk_buckets[c];
+
+                unsigned int last = get_chunk_first(pass, c + 1);
+                for (unsigned int i = get_chunk_first(pass, c); i < last;
+                        ++i) {
+                        unsigned long long key = pass->src[i];
+                        pass->dst[offsets[(key >> pass->shift) &
+                                (RADIX_BUCKETS - 1)]++] = key;
+                }
+        }
+}
+
+void radix_sort_keys(struct job_system_info *job_system,
+        unsigned long long *keys, unsigned long long *scratch,
+        unsigned int count, unsigned int payload_bits)
+{
+        assert(payload_bits < 64);
+        if (count < 2)
+                return;
+
+        struct radix_sort_pass pass;
+        pass.count = count;
+        pass.chunk_count = 1;
+        pass.first_shift = payload_bits;
+        pass.digit_count = (64 - payload_bits + RADIX_BITS - 1) / RADIX_BITS;
+
+        // Small counts are sorted on the calling thread
+        if (job_system != NULL && count >= RADIX_SORT_PARALLEL_MIN_COUNT) {
+                pass.chunk_count = job_system->worker_count * 2;
+                if (pass.chunk_count < 1)
+                        pass.chunk_count = 1;
+                if (pass.chunk_count > RADIX_SORT_MAX_CHUNKS)
+                        pass.chunk_count = RADIX_SORT_MAX_CHUNKS;
+        }
+
+        struct job_system_info *pass_job_system = pass.chunk_count > 1 ?
+                job_system : NULL;
+
+        pass.chunk_buckets = malloc(pass.chunk_count *
+                sizeof (unsigned int [RADIX_BUCKETS]));
+        pass.chunk_digit_buckets = malloc(pass.chunk_count *
+                sizeof (unsigned int [RADIX_MAX_DIGITS][RADIX_BUCKETS]));
+
+        // Count every digit up front to find the passes that would not move
+        // anything
+        pass.src = keys;
+        parallel_for(pass_job_system, pass.chunk_count, 1, count_all_digits,
+                &pass);
+
+        int is_first_pass = 1;
+        for (unsigned int d = 0; d < pass.digit_count; ++d) {
+                unsigned int max_bucket_count = 0;
+                for (unsigned int b = 0; b < RADIX_BUCKETS; ++b) {
+                        unsigned int bucket_count = 0;
+                        for (unsigned int c = 0; c < pass.chunk_count; ++c)
+                                bucket_count +=
+                                        pass.chunk_digit_buckets[c][d][b];
+
+                        if (bucket_count > max_bucket_count)
+                                max_bucket_count = bucket_count;
+                }
+
+                if (max_bucket_count == count)
+                        continue;
+
+                pass.dst = pass.src == keys ? scratch : keys;
+                pass.shift = pass.first_shift + d * RADIX_BITS;
+
+                // Chunks no longer hold the keys they were counted with once
+                // a pass has moved them
+                if (is_first_pass) {
+                        for (unsigned int c = 0; c < pass.chunk_count; ++c) {
+                                memcpy(pass.chunk_buckets[c],
+                                        pass.chunk_digit_buckets[c][d],
+                                        sizeof (unsigned int [RADIX_BUCKETS]));
+                        }
+                } else {
+                        parallel_for(pass_job_system, pass.chunk_count, 1,
+                                count_digit, &pass);
+                }
+
+                is_first_pass = 0;
+
+                // Bucket by bucket, each chunk scatters after the chunks
+                // before it, which keeps the sort stable
+                unsigned int offset = 0;
+                for (unsigned int b = 0; b < RADIX_BUCKETS; ++b) {
+                        for (unsigned int c = 0; c < pass.chunk_count; ++c) {
+                                unsigned int bucket_count =
+                                        pass.chunk_buckets[c][b];
+                                pass.chunk_buckets[c][b] = offset;
+                                offset += bucket_count;
+                        }
+                }
+
+                parallel_for(pass_job_system, pass.chunk_count, 1,
+                        scatter_digit, &pass);
+
+                pass.src = pass.dst;
+        }
+
+        if (pass.src != keys)
+                memcpy(keys, pass.src, count * sizeof (unsigned long long));
+
+        free(pass.chunk_digit_buckets);
+        free(pass.chunk_buckets);
+}
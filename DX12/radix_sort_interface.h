@@ -0,0 +1,21 @@
+#ifndef RADIX_SORT_INTERFACE_H
+#define RADIX_SORT_INTERFACE_H
+
+#include "job_interface.h"
+
+// Stable LSD radix sort of 64-bit keys, 11 bits a pass. The low bits of a
+// key can carry a payload, such as the index of what it sorts, which moves
+// with the key but is not sorted on. That keeps an entry at 8 bytes rather
+// than a key and index pair padded to 16. Passes over digits that are the
+// same in every key are skipped, and large counts are split into chunks
+// that are counted and scattered on the job system.
+#define RADIX_SORT_PARALLEL_MIN_COUNT 65536
+#define RADIX_SORT_MAX_CHUNKS 64
+
+// scratch has to hold count keys, the sorted keys end up in keys. The low
+// payload_bits bits of the keys are left out of the order.
+void radix_sort_keys(struct job_system_info *job_system,
+        unsigned long long *keys, unsigned long long *scratch,
+        unsigned int count, unsigned int payload_bits);
+
+#endif
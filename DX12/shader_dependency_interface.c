@@ -0,0 +1,312 @@
+#include "shader_dependency_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+static unsigned int add_shader_file(struct shader_dependency_info *dep_info,
+        const char *normalised_path, int *is_new)
+{
+        unsigned int file_index = find_shader_file(dep_info, normalised_path);
+        *is_new = file_index == SHADER_FILE_NONE;
+        if (!*is_new)
+                return file_index;
+
+        if (dep_info->file_count == dep_info->file_capacity) {
+                dep_info->file_capacity *= 2;
+                dep_info->file_paths = realloc(dep_info->file_paths,
+                        dep_info->file_capacity * MAX_SHADER_PATH);
+                dep_info->is_root = realloc(dep_info->is_root,
+                        dep_info->file_capacity);
+        }
+
+        file_index = dep_info->file_count++;
+        strcpy(dep_info->file_paths[file_index], normalised_path);
+        dep_info->is_root[file_index] = 0;
+
+        return file_index;
+}
+
+static void add_shader_include(struct shader_dependency_info *dep_info,
+        unsigned int includer, unsigned int included)
+{
+        for (unsigned int i = 0; i < dep_info->include_count; ++i) {
+                if (dep_info->includers[i] == includer &&
+                        dep_info->included[i] == included)
+                        return;
+        }
+
+        if (dep_info->include_count == dep_info->include_capacity) {
+                dep_info->include_capacity *= 2;
+                dep_info->includers = realloc(dep_info->includers,
+                        dep_info->include_capacity * sizeof (unsigned int));
+                dep_info->included = realloc(dep_info->included,
+                        dep_info->include_capacity * sizeof (unsigned int));
+        }
+
+        dep_info->includers[dep_info->include_count] = includer;
+        dep_info->included[dep_info->include_count] = included;
+        ++dep_info->include_count;
+}
+
+static char *read_shader_source(const char *path)
+{
+        FILE *file = fopen(path, "rb");
+        if (file == NULL)
+                return NULL;
+
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char *source = malloc(size + 1);
+        size_t read_size = fread(source, 1, size, file);
+        source[read_size] = '\0';
+
+        fclose(file);
+
+        return source;
+}
+
+
+void create_shader_dependencies(struct shader_dependency_info *dep_info)
+{
+        dep_info->file_count = 0;
+        dep_info->file_capacity = 16;
+        dep_info->file_paths = malloc(dep_info->file_capacity *
+                MAX_SHADER_PATH);
+        dep_info->is_root = malloc(dep_info->file_capacity);
+
+        dep_info->include_count = 0;
+        dep_info->include_capacity = 16;
+        dep_info->includers = malloc(dep_info->include_capacity *
+                sizeof (unsigned int));
+        dep_info->included = malloc(dep_info->include_capacity *
+                sizeof (unsigned int));
+}
+
+void release_shader_dependencies(struct shader_dependency_info *dep_info)
+{
+        free(dep_info->included);
+        free(dep_info->includers);
+        free(dep_info->is_root);
+        free(dep_info->file_paths);
+}
+
+void normalise_shader_path(char out_path[MAX_SHADER_PATH], const char *path)
+{
+        // Split into components, dropping "." and folding ".." into its parent
+        int is_absolute = *path == '/' || *path == '\\';
+        char components[MAX_SHADER_PATH];
+        unsigned int starts[MAX_SHADER_PATH / 2];
+        unsigned int depth = 0;
+        unsigned int length = 0;
+
+        const char *c = path;
+        while (*c != '\0') {
+                while (*c == '/' || *c == '\\')
+                        ++c;
+
+                const char *end = c;
+                while (*end != '\0' && *end != '/' && *end != '\\')
+                        ++end;
+
+                unsigned int size = (unsigned int) (end - c);
+                int parent_dir = size == 2 && c[0] == '.' && c[1] == '.';
+                int can_fold = depth > 0 &&
+                        strcmp(&components[starts[depth - 1]], "..") != 0;
+
+                if (size == 0 || (size == 1 && c[0] == '.')) {
+                        // Nothing to keep
+                } else if (parent_dir && can_fold) {
+                        length = starts[--depth];
+                } else {
+                        assert(length + size + 1 <= MAX_SHADER_PATH);
+                        starts[depth++] = length;
+                        memcpy(&components[length], c, size);
+                        components[length + size] = '\0';
+                        length += size + 1;
+                }
+
+                c = end;
+        }
+
+        // An absolute path keeps its leading slash so it can still be opened
+        strcpy(out_path, is_absolute ? "/" : "");
+        for (unsigned int i = 0; i < depth; ++i) {
+                if (i > 0)
+                        strcat(out_path, "/");
+                strcat(out_path, &components[starts[i]]);
+        }
+}
+
+unsigned int find_shader_file(struct shader_dependency_info *dep_info,
+        const char *path)
+{
+        for (unsigned int i = 0; i < dep_info->file_count; ++i) {
+                if (strcmp(dep_info->file_paths[i], path) == 0)
+                        return i;
+        }
+
+        return SHADER_FILE_NONE;
+}
+
+unsigned int add_shader_root(struct shader_dependency_info *dep_info,
+        const char *path)
+{
+        char normalised_path[MAX_SHADER_PATH];
+        normalise_shader_path(normalised_path, path);
+
+        int is_new;
+        unsigned int file_index = add_shader_file(dep_info, normalised_path,
+                &is_new);
+        dep_info->is_root[file_index] = 1;
+
+        rescan_shader_file(dep_info, file_index);
+
+        return file_index;
+}
+
+void scan_shader_includes(struct shader_dependency_info *dep_info,
+        unsigned int file_index, const char *source)
+{
+        // Includes resolve relative to the directory of the including file
+        char directory[MAX_SHADER_PATH];
+        strcpy(directory, dep_info->file_paths[file_index]);
+        char *last_slash = strrchr(directory, '/');
+        if (last_slash != NULL)
+                *(last_slash + 1) = '\0';
+        else
+                directory[0] = '\0';
+
+        const char *line = source;
+        while (*line != '\0') {
+                const char *c = line;
+                while (*c == ' ' || *c == '\t')
+                        ++c;
+
+                const char *next_line = strchr(c, '\n');
+                if (next_line == NULL)
+                        next_line = c + strlen(c);
+
+                if (*c == '#') {
+                        ++c;
+                        while (*c == ' ' || *c == '\t')
+                                ++c;
+
+                        if (strncmp(c, "include", 7) == 0) {
+                                c += 7;
+                                while (*c == ' ' || *c == '\t')
+                                        ++c;
+
+                                char close = *c == '<' ? '>' : '"';
+                                const char *name = c + 1;
+                                const char *name_end = name;
+                                while (name_end < next_line &&
+                                        *name_end != close)
+                                        ++name_end;
+
+                                if ((*c == '"' || *c == '<') &&
+                                        name_end < next_line) {
+                                        char include_path[MAX_SHADER_PATH];
+                                        int size = snprintf(include_path,
+                                                MAX_SHADER_PATH, "%s%.*s",
+                                                directory,
+                                                (int) (name_end - name), name);
+                                        assert(size < MAX_SHADER_PATH);
+
+                                        char normalised_path[MAX_SHADER_PATH];
+                                        normalise_shader_path(normalised_path,
+                                                include_path);
+
+                                        int is_new;
+                                        unsigned int included = add_shader_file(
+                                                dep_info, normalised_path,
+                                                &is_new);
+                                        add_shader_include(dep_info,
+                                                file_index, included);
+
+                                        // Pick up nested includes the first
+                                        // time a file shows up
+                                        if (is_new)
+                                                rescan_shader_file(dep_info,
+                                                        included);
+                                }
+                        }
+                }
+
+                line = *next_line == '\n' ? next_line + 1 : next_line;
+        }
+}
+
+void rescan_shader_file(struct shader_dependency_info *dep_info,
+        unsigned int file_index)
+{
+        // Forget what the file used to include, its includes may have changed
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < dep_info->include_count; ++i) {
+                if (dep_info->includers[i] == file_index)
+                        continue;
+
+                dep_info->includers[kept] = dep_info->includers[i];
+                dep_info->included[kept] = dep_info->included[i];
+                ++kept;
+        }
+
+        dep_info->include_count = kept;
+
+        // A file that can't be read right now simply has no includes
+        char *source = read_shader_source(dep_info->file_paths[file_index]);
+        if (source == NULL)
+                return;
+
+        scan_shader_includes(dep_info, file_index, source);
+
+        free(source);
+}
+
+unsigned int collect_affected_shaders(struct shader_dependency_info *dep_info,
+        const char *changed_path, unsigned int *root_indices,
+        unsigned int max_roots)
+{
+        char normalised_path[MAX_SHADER_PATH];
+        normalise_shader_path(normalised_path, changed_path);
+
+        unsigned int file_index = find_shader_file(dep_info, normalised_path);
+        if (file_index == SHADER_FILE_NONE)
+                return 0;
+
+        // Walk from the changed file up through everything including it
+        unsigned char *visited = calloc(dep_info->file_count, 1);
+        unsigned int *stack = malloc(dep_info->file_count *
+                sizeof (unsigned int));
+        unsigned int stack_size = 0;
+        unsigned int root_count = 0;
+
+        visited[file_index] = 1;
+        stack[stack_size++] = file_index;
+
+        while (stack_size > 0) {
+                unsigned int current = stack[--stack_size];
+
+                if (dep_info->is_root[current] && root_count < max_roots)
+                        root_indices[root_count++] = current;
+
+                for (unsigned int i = 0; i < dep_info->include_count; ++i) {
+                        unsigned int includer = dep_info->includers[i];
+                        if (dep_info->included[i] != current ||
+                                visited[includer])
+                                continue;
+
+                        visited[includer] = 1;
+                        stack[stack_size++] = includer;
+                }
+        }
+
+        free(stack);
+        free(visited);
+
+        return root_count;
+}
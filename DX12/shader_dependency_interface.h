@@ -0,0 +1,37 @@
+#ifndef SHADER_DEPENDENCY_INTERFACE_H
+#define SHADER_DEPENDENCY_INTERFACE_H
+
+// Include graph of the shader sources, used to work out which shaders have
+// to be recompiled when a file changes. Paths are kept with forward slashes
+// so the graph behaves the same on every platform.
+
+#define MAX_SHADER_PATH 260
+#define SHADER_FILE_NONE 0xffffffff
+
+struct shader_dependency_info {
+        unsigned int file_count;
+        unsigned int file_capacity;
+        char (*file_paths)[MAX_SHADER_PATH];
+        unsigned char *is_root;
+        unsigned int include_count;
+        unsigned int include_capacity;
+        unsigned int *includers;
+        unsigned int *included;
+};
+
+void create_shader_dependencies(struct shader_dependency_info *dep_info);
+void release_shader_dependencies(struct shader_dependency_info *dep_info);
+void normalise_shader_path(char out_path[MAX_SHADER_PATH], const char *path);
+unsigned int find_shader_file(struct shader_dependency_info *dep_info,
+        const char *path);
+unsigned int add_shader_root(struct shader_dependency_info *dep_info,
+        const char *path);
+void scan_shader_includes(struct shader_dependency_info *dep_info,
+        unsigned int file_index, const char *source);
+void rescan_shader_file(struct shader_dependency_info *dep_info,
+        unsigned int file_index);
+unsigned int collect_affected_shaders(struct shader_dependency_info *dep_info,
+        const char *changed_path, unsigned int *root_indices,
+        unsigned int max_roots);
+
+#endif
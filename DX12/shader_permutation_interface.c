@@ -0,0 +1,200 @@
+#include "shader_permutation_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+static void build_permutation_defines(struct shader_permutation_info *perm_info,
+        UINT key, D3D_SHADER_MACRO defines[MAX_SHADER_FEATURES +
+                MAX_SHADER_BASE_DEFINES + 1])
+{
+        // Every feature enabled in the key becomes a define set to 1
+        UINT define_count = 0;
+        for (UINT i = 0; i < perm_info->feature_count; ++i) {
+                if ((key & (1 << i)) == 0)
+                        continue;
+
+                defines[define_count].Name = perm_info->feature_names[i];
+                defines[define_count].Definition = "1";
+                ++define_count;
+        }
+
+        for (const D3D_SHADER_MACRO *base = perm_info->base_defines;
+                base != NULL && base->Name != NULL; ++base) {
+                assert(define_count < MAX_SHADER_FEATURES +
+                        MAX_SHADER_BASE_DEFINES);
+                defines[define_count++] = *base;
+        }
+
+        defines[define_count].Name = NULL;
+        defines[define_count].Definition = NULL;
+}
+
+static void compile_shader_permutation(
+        struct shader_permutation_info *perm_info, UINT key)
+{
+        D3D_SHADER_MACRO defines[MAX_SHADER_FEATURES +
+                MAX_SHADER_BASE_DEFINES + 1];
+        build_permutation_defines(perm_info, key, defines);
+
+        struct gpu_shader_info *shader_info =
+                malloc(sizeof (struct gpu_shader_info));
+        shader_info->shader_file = perm_info->shader_file;
+        shader_info->shader_target = perm_info->shader_target;
+        shader_info->defines = defines;
+        compile_shader(shader_info);
+
+        // Defines only live for the duration of the compile
+        shader_info->defines = NULL;
+
+        perm_info->permutations[key] = shader_info;
+        ++perm_info->compiled_count;
+}
+
+void create_shader_permutations(struct shader_permutation_info *perm_info)
+{
+        perm_info->feature_count = 0;
+
+        // Collect the feature switches the shader declares
+        FILE *shader_file = _wfopen(perm_info->shader_file, L"r");
+        assert(shader_file != NULL);
+
+        char line[1024];
+        while (fgets(line, sizeof (line), shader_file) != NULL) {
+                char feature_name[MAX_SHADER_FEATURE_NAME];
+                if (sscanf(line, " // @feature %63s", feature_name) != 1)
+                        continue;
+
+                assert(perm_info->feature_count < MAX_SHADER_FEATURES);
+                strcpy(perm_info->feature_names[perm_info->feature_count],
+                        feature_name);
+                ++perm_info->feature_count;
+        }
+
+        fclose(shader_file);
+
+        // Nothing is compiled until a permutation is requested
+        perm_info->permutation_count = 1 << perm_info->feature_count;
+        perm_info->permutations = calloc(perm_info->permutation_count,
+                sizeof (struct gpu_shader_info *));
+        perm_info->compiled_count = 0;
+}
+
+void release_shader_permutations(struct shader_permutation_info *perm_info)
+{
+        for (UINT i = 0; i < perm_info->permutation_count; ++i) {
+                if (perm_info->permutations[i] == NULL)
+                        continue;
+
+                release_shader(perm_info->permutations[i]);
+                free(perm_info->permutations[i]);
+        }
+
+        free(perm_info->permutations);
+}
+
+// The feature count when the shader doesn't declare the feature
+static UINT find_shader_feature(struct shader_permutation_info *perm_info,
+        LPCSTR feature_name)
+{
+        UINT feature = 0;
+        while (feature < perm_info->feature_count &&
+                strcmp(perm_info->feature_names[feature],
+                        feature_name) != 0) {
+                ++feature;
+        }
+
+        return feature;
+}
+
+UINT get_shader_permutation_key(struct shader_permutation_info *perm_info,
+        LPCSTR *feature_names, UINT feature_count)
+{
+        UINT key = 0;
+        for (UINT i = 0; i < feature_count; ++i) {
+                UINT feature = find_shader_feature(perm_info,
+                        feature_names[i]);
+                assert(feature < perm_info->feature_count);
+                key |= 1 << feature;
+        }
+
+        return key;
+}
+
+struct gpu_shader_info *get_shader_permutation(
+        struct shader_permutation_info *perm_info, UINT key)
+{
+        assert(key < perm_info->permutation_count);
+
+        if (perm_info->permutations[key] == NULL)
+                compile_shader_permutation(perm_info, key);
+
+        return perm_info->permutations[key];
+}
+
+void compile_shader_permutation_manifest(
+        struct shader_permutation_info *perm_info, const char *manifest_file)
+{
+        // Without a manifest every permutation is simply compiled on demand
+        FILE *manifest = fopen(manifest_file, "r");
+        if (manifest == NULL)
+                return;
+
+        // Each line lists the features of one permutation, "-" being the
+        // permutation without any features enabled
+        char line[1024];
+        while (fgets(line, sizeof (line), manifest) != NULL) {
+                if (line[0] == '#')
+                        continue;
+
+                LPCSTR feature_names[MAX_SHADER_FEATURES];
+                UINT feature_count = 0;
+                BOOL has_permutation = FALSE;
+                BOOL is_valid = TRUE;
+
+                // Skip lines naming features the shader no longer declares,
+                // as the PSO manifest skips PSOs it can no longer build
+                char *token = strtok(line, " \t\r\n");
+                while (token != NULL) {
+                        if (strcmp(token, "-") != 0) {
+                                if (feature_count == MAX_SHADER_FEATURES ||
+                                        find_shader_feature(perm_info, token) ==
+                                        perm_info->feature_count)
+                                        is_valid = FALSE;
+                                else
+                                        feature_names[feature_count++] = token;
+                        }
+
+                        has_permutation = TRUE;
+                        token = strtok(NULL, " \t\r\n");
+                }
+
+                if (has_permutation == FALSE || is_valid == FALSE)
+                        continue;
+
+                get_shader_permutation(perm_info, get_shader_permutation_key(
+                        perm_info, feature_names, feature_count));
+        }
+
+        fclose(manifest);
+}
+
+BOOL try_compile_shader_permutation(struct shader_permutation_info *perm_info,
+        UINT key, struct gpu_shader_info *shader_info)
+{
+        assert(key < perm_info->permutation_count);
+
+        D3D_SHADER_MACRO defines[MAX_SHADER_FEATURES +
+                MAX_SHADER_BASE_DEFINES + 1];
+        build_permutation_defines(perm_info, key, defines);
+
+        shader_info->shader_file = perm_info->shader_file;
+        shader_info->shader_target = perm_info->shader_target;
+        shader_info->defines = defines;
+        BOOL compiled = try_compile_shader(shader_info);
+        shader_info->defines = NULL;
+
+        return compiled;
+}
@@ -0,0 +1,42 @@
+#ifndef SHADER_PERMUTATION_INTERFACE_H
+#define SHADER_PERMUTATION_INTERFACE_H
+
+#include "gpu_interface.h"
+
+
+// Shaders declare their feature switches with lines of the form
+//         // @feature FEATURE_NAME
+// and the n-th declared feature is bit n of a permutation key
+#define MAX_SHADER_FEATURES 16
+#define MAX_SHADER_FEATURE_NAME 64
+#define MAX_SHADER_BASE_DEFINES 8
+
+struct shader_permutation_info {
+        LPCWSTR shader_file;
+        LPCSTR shader_target;
+        // Defines every permutation is compiled with, NULL terminated, or
+        // NULL for none
+        const D3D_SHADER_MACRO *base_defines;
+        UINT feature_count;
+        char feature_names[MAX_SHADER_FEATURES][MAX_SHADER_FEATURE_NAME];
+        UINT permutation_count;
+        struct gpu_shader_info **permutations;
+        UINT compiled_count;
+};
+
+void create_shader_permutations(struct shader_permutation_info *perm_info);
+void release_shader_permutations(struct shader_permutation_info *perm_info);
+UINT get_shader_permutation_key(struct shader_permutation_info *perm_info,
+        LPCSTR *feature_names, UINT feature_count);
+struct gpu_shader_info *get_shader_permutation(
+        struct shader_permutation_info *perm_info, UINT key);
+// Manifests list one permutation per line by its feature names, with "-"
+// standing for the permutation that has no features enabled
+void compile_shader_permutation_manifest(
+        struct shader_permutation_info *perm_info, const char *manifest_file);
+// Compiles a permutation into the caller's shader info without touching the
+// table and without failing hard, so it is safe to call from a worker thread
+BOOL try_compile_shader_permutation(struct shader_permutation_info *perm_info,
+        UINT key, struct gpu_shader_info *shader_info);
+
+#endif
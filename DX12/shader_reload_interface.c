@@ -0,0 +1,404 @@
+#include "shader_reload_interface.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+static struct gpu_shader_info *get_reload_shader(
+        struct shader_reload_info *reload_info, UINT shader, UINT key)
+{
+        // Shaders that are being reloaded are swapped for their new version
+        if (reload_info->pending_shaders[shader] != NULL)
+                return reload_info->pending_shaders[shader][key];
+
+        return reload_info->shaders[shader]->permutations[key];
+}
+
+static BOOL is_pso_reloading(struct shader_reload_info *reload_info,
+        struct shader_reload_pso_info *reload_pso_info)
+{
+        for (UINT i = 0; i < reload_pso_info->stage_count; ++i) {
+                if (reload_info->pending_shaders[
+                        reload_pso_info->stage_shaders[i]] != NULL)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+static void reload_shaders_job(void *job_data)
+{
+        struct shader_reload_info *reload_info = job_data;
+
+        reload_info->reload_succeeded = TRUE;
+
+        // Recompile every permutation the running program has asked for
+        for (UINT i = 0; i < reload_info->shader_count; ++i) {
+                struct gpu_shader_info **pending_shaders =
+                        reload_info->pending_shaders[i];
+                if (pending_shaders == NULL)
+                        continue;
+
+                for (UINT key = 0; key < reload_info->shaders[i]->
+                        permutation_count; ++key) {
+                        if (pending_shaders[key] == NULL)
+                                continue;
+
+                        if (!try_compile_shader_permutation(
+                                reload_info->shaders[i], key,
+                                pending_shaders[key])) {
+                                reload_info->reload_succeeded = FALSE;
+                                return;
+                        }
+                }
+        }
+
+        // Build the replacement PSOs, the live ones stay untouched until the
+        // swap. PSOs added after the reload started are left alone.
+        for (UINT i = 0; i < reload_info->reload_pso_count; ++i) {
+                struct shader_reload_pso_info *reload_pso_info =
+                        &reload_info->psos[i];
+                if (!is_pso_reloading(reload_info, reload_pso_info))
+                        continue;
+
+                struct gpu_pso_info pending_pso_info =
+                        *reload_pso_info->pso_info;
+                for (UINT stage = 0; stage < reload_pso_info->stage_count;
+                        ++stage) {
+                        set_pso_stage_shader(&pending_pso_info, stage,
+                                get_reload_shader(reload_info,
+                                        reload_pso_info->stage_shaders[stage],
+                                        reload_pso_info->stage_keys[stage]));
+                }
+
+                // A shader the PSO rejects keeps the old shaders running too
+                if (!try_create_pso(reload_info->device_info,
+                        reload_pso_info->vert_input_info,
+                        reload_pso_info->root_sig_info, &pending_pso_info)) {
+                        reload_info->reload_succeeded = FALSE;
+                        return;
+                }
+
+                reload_pso_info->pending_pso = pending_pso_info.pso;
+        }
+}
+
+static void retire_shader(struct shader_reload_info *reload_info,
+        struct gpu_shader_info *shader_info)
+{
+        assert(reload_info->retired_shader_count < MAX_RETIRED_RELOADS);
+
+        UINT retired = reload_info->retired_shader_count++;
+        reload_info->retired_shaders[retired] = shader_info;
+        reload_info->retired_shader_frames[retired] = reload_info->frame;
+}
+
+static void retire_pso(struct shader_reload_info *reload_info,
+        ID3D12PipelineState *pso)
+{
+        assert(reload_info->retired_pso_count < MAX_RETIRED_RELOADS);
+
+        UINT retired = reload_info->retired_pso_count++;
+        reload_info->retired_psos[retired] = pso;
+        reload_info->retired_pso_frames[retired] = reload_info->frame;
+}
+
+static void release_retired_reloads(struct shader_reload_info *reload_info,
+        BOOL release_all)
+{
+        // Frames still in flight may reference anything retired within the
+        // last frame_latency frames, and held shaders may still be read
+        BOOL is_held = reload_info->retirement_hold_count > 0;
+        UINT kept = 0;
+        for (UINT i = 0; i < reload_info->retired_shader_count; ++i) {
+                if (!release_all && (is_held || reload_info->frame -
+                        reload_info->retired_shader_frames[i] <
+                        reload_info->frame_latency)) {
+                        reload_info->retired_shaders[kept] =
+                                reload_info->retired_shaders[i];
+                        reload_info->retired_shader_frames[kept] =
+                                reload_info->retired_shader_frames[i];
+                        ++kept;
+                        continue;
+                }
+
+                release_shader(reload_info->retired_shaders[i]);
+                free(reload_info->retired_shaders[i]);
+        }
+
+        reload_info->retired_shader_count = kept;
+
+        kept = 0;
+        for (UINT i = 0; i < reload_info->retired_pso_count; ++i) {
+                if (!release_all && reload_info->frame -
+                        reload_info->retired_pso_frames[i] <
+                        reload_info->frame_latency) {
+                        reload_info->retired_psos[kept] =
+                                reload_info->retired_psos[i];
+                        reload_info->retired_pso_frames[kept] =
+                                reload_info->retired_pso_frames[i];
+                        ++kept;
+                        continue;
+                }
+
+                ID3D12PipelineState_Release(reload_info->retired_psos[i]);
+        }
+
+        reload_info->retired_pso_count = kept;
+}
+
+static void start_reload(struct shader_reload_info *reload_info)
+{
+        BOOL has_dirty_shader = FALSE;
+
+        // Snapshot the permutations compiled so far
+        for (UINT i = 0; i < reload_info->shader_count; ++i) {
+                if (!reload_info->is_shader_dirty[i])
+                        continue;
+
+                struct shader_permutation_info *perm_info =
+                        reload_info->shaders[i];
+                struct gpu_shader_info **pending_shaders = calloc(
+                        perm_info->permutation_count,
+                        sizeof (struct gpu_shader_info *));
+                for (UINT key = 0; key < perm_info->permutation_count; ++key) {
+                        if (perm_info->permutations[key] == NULL)
+                                continue;
+
+                        pending_shaders[key] =
+                                malloc(sizeof (struct gpu_shader_info));
+                        pending_shaders[key]->shader_blob = NULL;
+                }
+
+                reload_info->pending_shaders[i] = pending_shaders;
+                reload_info->is_shader_dirty[i] = FALSE;
+                has_dirty_shader = TRUE;
+        }
+
+        if (!has_dirty_shader)
+                return;
+
+        for (UINT i = 0; i < reload_info->pso_count; ++i)
+                reload_info->psos[i].pending_pso = NULL;
+
+        reload_info->reload_pso_count = reload_info->pso_count;
+
+        reload_info->is_reloading = TRUE;
+        init_job_counter(&reload_info->reload_counter);
+        submit_job(reload_info->job_system, reload_shaders_job, reload_info,
+                &reload_info->reload_counter);
+}
+
+static void finish_reload(struct shader_reload_info *reload_info,
+        BOOL apply)
+{
+        apply = apply && reload_info->reload_succeeded;
+
+        // Point the PSOs at their new shaders before the old ones retire
+        for (UINT i = 0; i < reload_info->pso_count; ++i) {
+                struct shader_reload_pso_info *reload_pso_info =
+                        &reload_info->psos[i];
+                if (reload_pso_info->pending_pso == NULL)
+                        continue;
+
+                if (!apply) {
+                        ID3D12PipelineState_Release(
+                                reload_pso_info->pending_pso);
+                        reload_pso_info->pending_pso = NULL;
+                        continue;
+                }
+
+                for (UINT stage = 0; stage < reload_pso_info->stage_count;
+                        ++stage) {
+                        set_pso_stage_shader(reload_pso_info->pso_info,
+                                stage, get_reload_shader(reload_info,
+                                        reload_pso_info->stage_shaders[stage],
+                                        reload_pso_info->stage_keys[stage]));
+                }
+
+                retire_pso(reload_info, reload_pso_info->pso_info->pso);
+                reload_pso_info->pso_info->pso = reload_pso_info->pending_pso;
+                reload_pso_info->pending_pso = NULL;
+        }
+
+        for (UINT i = 0; i < reload_info->shader_count; ++i) {
+                struct gpu_shader_info **pending_shaders =
+                        reload_info->pending_shaders[i];
+                if (pending_shaders == NULL)
+                        continue;
+
+                struct shader_permutation_info *perm_info =
+                        reload_info->shaders[i];
+                for (UINT key = 0; key < perm_info->permutation_count; ++key) {
+                        if (pending_shaders[key] == NULL)
+                                continue;
+
+                        if (apply) {
+                                retire_shader(reload_info,
+                                        perm_info->permutations[key]);
+                                perm_info->permutations[key] =
+                                        pending_shaders[key];
+                                continue;
+                        }
+
+                        if (pending_shaders[key]->shader_blob != NULL)
+                                release_shader(pending_shaders[key]);
+                        free(pending_shaders[key]);
+                }
+
+                free(pending_shaders);
+                reload_info->pending_shaders[i] = NULL;
+        }
+
+        if (apply)
+                ++reload_info->generation;
+
+        reload_info->is_reloading = FALSE;
+}
+
+
+void create_shader_reload(struct shader_reload_info *reload_info)
+{
+        create_file_watch(&reload_info->file_watch);
+        create_shader_dependencies(&reload_info->dependency_info);
+
+        reload_info->shader_count = 0;
+        reload_info->pso_count = 0;
+        reload_info->reload_pso_count = 0;
+        reload_info->is_reloading = FALSE;
+        reload_info->reload_succeeded = FALSE;
+        reload_info->frame = 0;
+        reload_info->generation = 0;
+        reload_info->retirement_hold_count = 0;
+        reload_info->retired_shader_count = 0;
+        reload_info->retired_pso_count = 0;
+}
+
+void release_shader_reload(struct shader_reload_info *reload_info)
+{
+        assert(reload_info->retirement_hold_count == 0);
+
+        // Throw away a reload still in progress, the GPU has to be idle
+        // before this is called
+        if (reload_info->is_reloading) {
+                wait_for_jobs(reload_info->job_system,
+                        &reload_info->reload_counter);
+                finish_reload(reload_info, FALSE);
+        }
+
+        release_retired_reloads(reload_info, TRUE);
+
+        release_shader_dependencies(&reload_info->dependency_info);
+        release_file_watch(&reload_info->file_watch);
+}
+
+void add_reload_shader(struct shader_reload_info *reload_info,
+        struct shader_permutation_info *perm_info)
+{
+        assert(reload_info->shader_count < MAX_RELOAD_SHADERS);
+
+        char shader_file[MAX_SHADER_PATH];
+        size_t size = wcstombs(shader_file, perm_info->shader_file,
+                MAX_SHADER_PATH);
+        assert(size < MAX_SHADER_PATH);
+
+        UINT shader = reload_info->shader_count++;
+        reload_info->shaders[shader] = perm_info;
+        reload_info->shader_files[shader] = add_shader_root(
+                &reload_info->dependency_info, shader_file);
+        reload_info->is_shader_dirty[shader] = FALSE;
+        reload_info->pending_shaders[shader] = NULL;
+}
+
+void add_reload_pso(struct shader_reload_info *reload_info,
+        struct gpu_pso_info *pso_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct shader_permutation_info **stage_shaders, UINT *stage_keys,
+        UINT stage_count)
+{
+        assert(reload_info->pso_count < MAX_RELOAD_PSOS);
+        assert(stage_count <= MAX_RELOAD_STAGES);
+
+        struct shader_reload_pso_info *reload_pso_info =
+                &reload_info->psos[reload_info->pso_count++];
+        reload_pso_info->pso_info = pso_info;
+        reload_pso_info->vert_input_info = vert_input_info;
+        reload_pso_info->root_sig_info = root_sig_info;
+        reload_pso_info->stage_count = stage_count;
+        reload_pso_info->pending_pso = NULL;
+
+        for (UINT i = 0; i < stage_count; ++i) {
+                UINT shader = 0;
+                while (shader < reload_info->shader_count &&
+                        reload_info->shaders[shader] != stage_shaders[i]) {
+                        ++shader;
+                }
+
+                // Stages have to be registered with add_reload_shader first
+                assert(shader < reload_info->shader_count);
+                reload_pso_info->stage_shaders[i] = shader;
+                reload_pso_info->stage_keys[i] = stage_keys[i];
+        }
+}
+
+void update_shader_reload(struct shader_reload_info *reload_info)
+{
+        ++reload_info->frame;
+
+        // Swap in whatever finished compiling since the last frame
+        if (reload_info->is_reloading && is_job_done(reload_info->job_system,
+                &reload_info->reload_counter)) {
+                finish_reload(reload_info, TRUE);
+        }
+
+        release_retired_reloads(reload_info, FALSE);
+
+        // Mark every shader that depends on a changed file
+        char changed_paths[MAX_RELOAD_SHADERS][MAX_WATCH_PATH];
+        UINT change_count = poll_file_watch(&reload_info->file_watch,
+                changed_paths, MAX_RELOAD_SHADERS);
+
+        for (UINT i = 0; i < change_count; ++i) {
+                char changed_path[MAX_SHADER_PATH];
+                normalise_shader_path(changed_path, changed_paths[i]);
+
+                UINT file = find_shader_file(&reload_info->dependency_info,
+                        changed_path);
+                if (file == SHADER_FILE_NONE)
+                        continue;
+
+                rescan_shader_file(&reload_info->dependency_info, file);
+
+                UINT root_files[MAX_RELOAD_SHADERS];
+                UINT root_count = collect_affected_shaders(
+                        &reload_info->dependency_info, changed_path,
+                        root_files, MAX_RELOAD_SHADERS);
+
+                for (UINT root = 0; root < root_count; ++root) {
+                        for (UINT shader = 0; shader <
+                                reload_info->shader_count; ++shader) {
+                                if (reload_info->shader_files[shader] ==
+                                        root_files[root])
+                                        reload_info->is_shader_dirty[shader] =
+                                                TRUE;
+                        }
+                }
+        }
+
+        // Changes made during a reload wait for the next one
+        if (!reload_info->is_reloading)
+                start_reload(reload_info);
+}
+
+void hold_shader_retirement(struct shader_reload_info *reload_info)
+{
+        ++reload_info->retirement_hold_count;
+}
+
+void resume_shader_retirement(struct shader_reload_info *reload_info)
+{
+        assert(reload_info->retirement_hold_count > 0);
+
+        --reload_info->retirement_hold_count;
+}
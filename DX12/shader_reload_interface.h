@@ -0,0 +1,78 @@
+#ifndef SHADER_RELOAD_INTERFACE_H
+#define SHADER_RELOAD_INTERFACE_H
+
+#include "gpu_interface.h"
+#include "shader_permutation_interface.h"
+#include "shader_dependency_interface.h"
+#include "file_watch_interface.h"
+#include "job_interface.h"
+
+
+// Watches the shader sources, recompiles every permutation that has been
+// compiled so far on a worker when a file it depends on changes and swaps
+// the new shaders and PSOs in at the next frame boundary. A failed compile
+// keeps the old shaders running.
+#define MAX_RELOAD_SHADERS 32
+#define MAX_RELOAD_PSOS 64
+#define MAX_RELOAD_STAGES 2
+#define MAX_RETIRED_RELOADS 256
+
+struct shader_reload_pso_info {
+        struct gpu_pso_info *pso_info;
+        struct gpu_vert_input_info *vert_input_info;
+        struct gpu_root_sig_info *root_sig_info;
+        // Vertex then pixel shader for graphics, compute shader for compute
+        UINT stage_count;
+        UINT stage_shaders[MAX_RELOAD_STAGES];
+        UINT stage_keys[MAX_RELOAD_STAGES];
+        ID3D12PipelineState *pending_pso;
+};
+
+struct shader_reload_info {
+        struct gpu_device_info *device_info;
+        struct job_system_info *job_system;
+        UINT frame_latency;
+        struct file_watch_info file_watch;
+        struct shader_dependency_info dependency_info;
+        UINT shader_count;
+        struct shader_permutation_info *shaders[MAX_RELOAD_SHADERS];
+        UINT shader_files[MAX_RELOAD_SHADERS];
+        BOOL is_shader_dirty[MAX_RELOAD_SHADERS];
+        struct gpu_shader_info **pending_shaders[MAX_RELOAD_SHADERS];
+        UINT pso_count;
+        UINT reload_pso_count;
+        struct shader_reload_pso_info psos[MAX_RELOAD_PSOS];
+        BOOL is_reloading;
+        BOOL reload_succeeded;
+        struct job_counter reload_counter;
+        UINT64 frame;
+        // Counts the reloads applied, so work started from the shaders
+        // before one can tell it is out of date
+        UINT64 generation;
+        UINT retirement_hold_count;
+        UINT retired_shader_count;
+        struct gpu_shader_info *retired_shaders[MAX_RETIRED_RELOADS];
+        UINT64 retired_shader_frames[MAX_RETIRED_RELOADS];
+        UINT retired_pso_count;
+        ID3D12PipelineState *retired_psos[MAX_RETIRED_RELOADS];
+        UINT64 retired_pso_frames[MAX_RETIRED_RELOADS];
+};
+
+void create_shader_reload(struct shader_reload_info *reload_info);
+void release_shader_reload(struct shader_reload_info *reload_info);
+void add_reload_shader(struct shader_reload_info *reload_info,
+        struct shader_permutation_info *perm_info);
+void add_reload_pso(struct shader_reload_info *reload_info,
+        struct gpu_pso_info *pso_info,
+        struct gpu_vert_input_info *vert_input_info,
+        struct gpu_root_sig_info *root_sig_info,
+        struct shader_permutation_info **stage_shaders, UINT *stage_keys,
+        UINT stage_count);
+// Call once per frame, after the command lists of the frame have been reset
+void update_shader_reload(struct shader_reload_info *reload_info);
+// Shaders replaced by a reload stay alive while any hold is taken, for
+// workers that read them outside of the frames in flight
+void hold_shader_retirement(struct shader_reload_info *reload_info);
+void resume_shader_retirement(struct shader_reload_info *reload_info);
+
+#endif
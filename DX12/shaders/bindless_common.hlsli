@@ -0,0 +1,24 @@
+#ifndef BINDLESS_COMMON_HLSLI
+#define BINDLESS_COMMON_HLSLI
+
+// The arrays over the bindless heap are unbounded, unless the device needs
+// bounded ranges and these are defined to their sizes
+#ifndef BINDLESS_CBV_COUNT
+#define BINDLESS_CBV_COUNT
+#endif
+#ifndef BINDLESS_SRV_COUNT
+#define BINDLESS_SRV_COUNT
+#endif
+#ifndef BINDLESS_UAV_COUNT
+#define BINDLESS_UAV_COUNT
+#endif
+
+struct draw_constants
+{
+        uint object_index;
+        uint material_index;
+};
+
+ConstantBuffer<draw_constants> draw_consts : register(b0, space0);
+
+#endif
@@ -1,4 +1,9 @@
-Texture2D colour_texture    : register(t0);
+// @feature USE_TEXTURE
+// @feature USE_VERTEX_COLOUR
+
+#include "bindless_common.hlsli"
+
+Texture2D textures[BINDLESS_SRV_COUNT] : register(t0, space2);
 SamplerState border_sampler : register(s0);
 
 struct pixel_shader_input
@@ -9,5 +14,16 @@ struct pixel_shader_input
 
 float4 main(pixel_shader_input pi) : SV_TARGET
 {
-        return pi.colour * colour_texture.Sample(border_sampler, pi.uv);
-}
\ No newline at end of file
+        float4 colour = float4(1.0f, 1.0f, 1.0f, 1.0f);
+
+#ifdef USE_VERTEX_COLOUR
+        colour *= pi.colour;
+#endif
+
+#ifdef USE_TEXTURE
+        colour *= textures[draw_consts.material_index].Sample(border_sampler,
+                pi.uv);
+#endif
+
+        return colour;
+}
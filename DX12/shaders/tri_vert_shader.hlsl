@@ -1,13 +1,26 @@
-cbuffer per_frame_const_buffers : register(b0)
+// @feature USE_INSTANCING
+
+#include "bindless_common.hlsli"
+
+struct object_constants
 {
-        matrix mvp : packoffset(c0);
-}
+        matrix mvp;
+};
+
+ConstantBuffer<object_constants> object_buffers[BINDLESS_CBV_COUNT] :
+        register(b0, space1);
 
 struct vertex_input
 {
         float4 position : POSITION;
         float4 colour   : COLOR;
         float2 uv       : TEXCOORD;
+#ifdef USE_INSTANCING
+        float4 world_0  : INSTANCE_TRANSFORM0;
+        float4 world_1  : INSTANCE_TRANSFORM1;
+        float4 world_2  : INSTANCE_TRANSFORM2;
+        float4 world_3  : INSTANCE_TRANSFORM3;
+#endif
 };
 
 struct vertex_output
@@ -22,7 +35,18 @@ vertex_output main(vertex_input vi)
         vertex_output vo;
         vo.colour = vi.colour;
         vo.uv = vi.uv;
-        vo.position = mul(mvp, vi.position);
+        float4 position = vi.position;
+
+#ifdef USE_INSTANCING
+        // The instance stream holds the columns of the world matrix, with
+        // the scale and bias of the quantized positions folded in
+        float4x4 world = float4x4(vi.world_0, vi.world_1, vi.world_2,
+                vi.world_3);
+        position = mul(position, world);
+#endif
+
+        vo.position = mul(object_buffers[draw_consts.object_index].mvp,
+                position);
 
         return vo;
-}
\ No newline at end of file
+}
@@ -0,0 +1,849 @@
+#include "simplify_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define NO_VERTEX 0xffffffff
+
+enum VERTEX_KIND {
+        VERTEX_KIND_MANIFOLD,
+        // On an open edge, may only collapse along it
+        VERTEX_KIND_BORDER,
+        VERTEX_KIND_LOCKED
+};
+
+// Symmetric 4x4 matrix of the sum of weighted plane equations, and the
+// area of the triangles behind them
+struct quadric {
+        double a00, a01, a02, a03;
+        double a11, a12, a13;
+        double a22, a23;
+        double a33;
+        double weight;
+};
+
+struct collapse {
+        float cost;
+        float error;
+        unsigned int vertex;
+        unsigned int target;
+        unsigned int version;
+};
+
+struct simplify_job {
+        struct simplify_info *simplify_info;
+        struct mesh_info *meshes;
+        struct mesh_info *lod_meshes;
+        unsigned int *collapse_counts;
+};
+
+struct simplify_state {
+        struct simplify_info *simplify_info;
+        struct mesh_info *mi;
+        unsigned int triangle_count;
+        unsigned int live_triangle_count;
+        unsigned int *triangles;
+        unsigned char *is_live;
+        // Every vertex collapsed into another hands it its triangles, which
+        // are found by walking its chain of members
+        unsigned int *offsets;
+        unsigned int *adjacency;
+        unsigned int *next_members;
+        unsigned int *last_members;
+        unsigned char *kinds;
+        unsigned char *is_collapsed;
+        unsigned int *versions;
+        struct quadric *quadrics;
+        unsigned int *stamps;
+        unsigned int stamp;
+        unsigned int *edge_counts;
+        unsigned int *neighbours;
+        unsigned int *updates;
+        unsigned int *best_targets;
+        float *best_costs;
+        struct collapse *candidates;
+        struct collapse *heap;
+        unsigned int heap_count;
+        unsigned int heap_capacity;
+        unsigned int collapse_count;
+        unsigned int rebuild_collapse_count;
+};
+
+static void add_plane(struct quadric *q, vec3 n, float d, double weight)
+{
+        q->a00 += weight * n[0] * n[0];
+        q->a01 += weight * n[0] * n[1];
+        q->a02 += weight * n[0] * n[2];
+        q->a03 += weight * n[0] * d;
+        q->a11 += weight * n[1] * n[1];
+        q->a12 += weight * n[1] * n[2];
+        q->a13 += weight * n[1] * d;
+        q->a22 += weight * n[2] * n[2];
+        q->a23 += weight * n[2] * d;
+        q->a33 += weight * d * d;
+}
+
+static void add_quadric(struct quadric *q, const struct quadric *other)
+{
+        q->a00 += other->a00;
+        q->a01 += other->a01;
+        q->a02 += other->a02;
+        q->a03 += other->a03;
+        q->a11 += other->a11;
+        q->a12 += other->a12;
+        q->a13 += other->a13;
+        q->a22 += other->a22;
+        q->a23 += other->a23;
+        q->a33 += other->a33;
+        q->weight += other->weight;
+}
+
+static double get_quadric_error(const struct quadric *q, const float *p)
+{
+        double x = p[0];
+        double y = p[1];
+        double z = p[2];
+        double error = q->a00 * x * x + 2.0 * q->a01 * x * y +
+                2.0 * q->a02 * x * z + 2.0 * q->a03 * x + q->a11 * y * y +
+                2.0 * q->a12 * y * z + 2.0 * q->a13 * y + q->a22 * z * z +
+                2.0 * q->a23 * z + q->a33;
+
+        return error > 0.0 ? error : 0.0;
+}
+
+static void push_collapse(struct simplify_state *state,
+        struct collapse *collapse)
+{
+        if (state->heap_count == state->heap_capacity) {
+                state->heap_capacity *= 2;
+                state->heap = realloc(state->heap, state->heap_capacity *
+                        sizeof (struct collapse));
+        }
+
+        unsigned int i = state->heap_count++;
+        while (i > 0) {
+                unsigned int parent = (i - 1) / 2;
+                if (state->heap[parent].cost <= collapse->cost)
+                        break;
+                state->heap[i] = state->heap[parent];
+                i = parent;
+        }
+        state->heap[i] = *collapse;
+}
+
+static void pop_collapse(struct simplify_state *state,
+        struct collapse *collapse)
+{
+        *collapse = state->heap[0];
+        struct collapse last = state->heap[--state->heap_count];
+
+        unsigned int i = 0;
+        for (;;) {
+                unsigned int child = i * 2 + 1;
+                if (child >= state->heap_count)
+                        break;
+                if (child + 1 < state->heap_count &&
+                        state->heap[child + 1].cost < state->heap[child].cost)
+                        ++child;
+                if (last.cost <= state->heap[child].cost)
+                        break;
+                state->heap[i] = state->heap[child];
+                i = child;
+        }
+
+        if (state->heap_count > 0)
+                state->heap[i] = last;
+}
+
+static int has_vertex(const unsigned int *triangle, unsigned int v)
+{
+        return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+}
+
+static void get_triangle_normal(struct simplify_state *state,
+        const unsigned int *triangle, unsigned int v, const float *position,
+        vec3 normal)
+{
+        const float *p[3];
+        for (unsigned int k = 0; k < 3; ++k) {
+                p[k] = triangle[k] == v ? position :
+                        state->mi->verticies[triangle[k]].position;
+        }
+
+        vec3 e1, e2;
+        vec3_sub(e1, p[1], p[0]);
+        vec3_sub(e2, p[2], p[0]);
+        vec3_mul_cross(normal, e2, e1);
+}
+
+// Collects the vertices sharing a live triangle with v into list, with the
+// number of triangles each shares in edge_counts
+static unsigned int get_neighbours(struct simplify_state *state,
+        unsigned int v, unsigned int *list)
+{
+        unsigned int count = 0;
+        ++state->stamp;
+
+        for (unsigned int m = v; m != NO_VERTEX; m = state->next_members[m]) {
+                for (unsigned int a = state->offsets[m];
+                        a < state->offsets[m + 1]; ++a) {
+                        unsigned int t = state->adjacency[a];
+                        if (!state->is_live[t])
+                                continue;
+
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                unsigned int w = state->triangles[t * 3 + k];
+                                if (w == v)
+                                        continue;
+                                if (state->stamps[w] != state->stamp) {
+                                        state->stamps[w] = state->stamp;
+                                        state->edge_counts[w] = 0;
+                                        list[count++] = w;
+                                }
+                                ++state->edge_counts[w];
+                        }
+                }
+        }
+
+        return count;
+}
+
+// Whether every vertex of the triangle is on a border or seam once v is
+// replaced with target
+static int is_on_edge(struct simplify_state *state,
+        const unsigned int *triangle, unsigned int v, unsigned int target)
+{
+        for (unsigned int k = 0; k < 3; ++k) {
+                unsigned int w = triangle[k] == v ? target : triangle[k];
+                if (state->kinds[w] == VERTEX_KIND_MANIFOLD)
+                        return 0;
+        }
+
+        return 1;
+}
+
+// Stamps the vertices sharing a live triangle with v
+static void mark_neighbours(struct simplify_state *state, unsigned int v)
+{
+        ++state->stamp;
+
+        for (unsigned int m = v; m != NO_VERTEX; m = state->next_members[m]) {
+                for (unsigned int a = state->offsets[m];
+                        a < state->offsets[m + 1]; ++a) {
+                        unsigned int t = state->adjacency[a];
+                        if (!state->is_live[t])
+                                continue;
+
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                state->stamps[state->triangles[t * 3 + k]] =
+                                        state->stamp;
+                        }
+                }
+        }
+}
+
+// Refuses collapses onto a vertex that is no longer a neighbour, of a
+// border vertex off its border, that turn a triangle over or flatten it,
+// that lay one along a border, or that pinch the surface, where the two
+// vertices share neighbours other than those across the triangles on their
+// edge
+static int is_collapse_valid(struct simplify_state *state, unsigned int v,
+        unsigned int target)
+{
+        const float *position = state->mi->verticies[target].position;
+        unsigned int shared_count = 0;
+        unsigned int common_count = 0;
+
+        mark_neighbours(state, target);
+        unsigned int mark = state->stamp++;
+
+        for (unsigned int m = v; m != NO_VERTEX; m = state->next_members[m]) {
+                for (unsigned int a = state->offsets[m];
+                        a < state->offsets[m + 1]; ++a) {
+                        unsigned int t = state->adjacency[a];
+                        const unsigned int *triangle = state->triangles + t * 3;
+                        if (!state->is_live[t])
+                                continue;
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                unsigned int w = triangle[k];
+                                if (w != v && w != target &&
+                                        state->stamps[w] == mark) {
+                                        state->stamps[w] = state->stamp;
+                                        ++common_count;
+                                }
+                        }
+
+                        if (has_vertex(triangle, target)) {
+                                ++shared_count;
+                                continue;
+                        }
+
+                        // A triangle lying along a border or seam would
+                        // fold over the other side of it
+                        if (is_on_edge(state, triangle, v, target))
+                                return 0;
+
+                        vec3 before, after;
+                        get_triangle_normal(state, triangle, v,
+                                state->mi->verticies[v].position, before);
+                        get_triangle_normal(state, triangle, v, position,
+                                after);
+
+                        float before_length = vec3_len(before);
+                        if (before_length > 0.0f &&
+                                vec3_mul_inner(before, after) <=
+                                SIMPLIFY_MIN_NORMAL_DOT * before_length *
+                                vec3_len(after))
+                                return 0;
+                }
+        }
+
+        return shared_count > 0 && common_count == shared_count &&
+                (state->kinds[v] != VERTEX_KIND_BORDER || shared_count == 1);
+}
+
+static float get_attribute_error(struct simplify_state *state,
+        unsigned int v, unsigned int target)
+{
+        struct vertex *a = &state->mi->verticies[v];
+        struct vertex *b = &state->mi->verticies[target];
+        float colour_weight = state->simplify_info->colour_weight;
+        float uv_weight = state->simplify_info->uv_weight;
+
+        vec4 colour;
+        vec2 uv;
+        vec4_sub(colour, a->colour, b->colour);
+        vec2_sub(uv, a->uv, b->uv);
+
+        return colour_weight * colour_weight *
+                vec4_mul_inner(colour, colour) + uv_weight * uv_weight *
+                vec2_mul_inner(uv, uv);
+}
+
+static void get_collapse_cost(struct simplify_state *state, unsigned int v,
+        unsigned int target, struct collapse *collapse)
+{
+        struct quadric *q = &state->quadrics[v];
+        double error = get_quadric_error(q,
+                state->mi->verticies[target].position);
+
+        collapse->cost = (float) (error + q->weight *
+                get_attribute_error(state, v, target));
+        collapse->error = (float) sqrt(q->weight > 0.0 ?
+                error / q->weight : error);
+        collapse->vertex = v;
+        collapse->target = target;
+}
+
+// Queues the cheapest valid collapse of v onto one of its neighbours. Costs
+// are found first so only the cheapest collapses need checking for flips.
+static void queue_collapse(struct simplify_state *state, unsigned int v)
+{
+        ++state->versions[v];
+        state->best_targets[v] = NO_VERTEX;
+        if (state->kinds[v] == VERTEX_KIND_LOCKED || state->is_collapsed[v])
+                return;
+
+        unsigned int neighbour_count = get_neighbours(state, v,
+                state->neighbours);
+        unsigned int candidate_count = 0;
+
+        for (unsigned int i = 0; i < neighbour_count; ++i) {
+                unsigned int w = state->neighbours[i];
+                if (state->kinds[v] == VERTEX_KIND_BORDER &&
+                        state->edge_counts[w] != 1)
+                        continue;
+
+                get_collapse_cost(state, v, w,
+                        &state->candidates[candidate_count++]);
+        }
+
+        while (candidate_count > 0) {
+                unsigned int best = 0;
+                for (unsigned int i = 1; i < candidate_count; ++i) {
+                        if (state->candidates[i].cost <
+                                state->candidates[best].cost)
+                                best = i;
+                }
+
+                struct collapse collapse = state->candidates[best];
+                if (is_collapse_valid(state, v, collapse.target)) {
+                        collapse.version = state->versions[v];
+                        state->best_targets[v] = collapse.target;
+                        state->best_costs[v] = collapse.cost;
+                        push_collapse(state, &collapse);
+                        return;
+                }
+
+                state->candidates[best] =
+                        state->candidates[--candidate_count];
+        }
+}
+
+static void apply_collapse(struct simplify_state *state, unsigned int v,
+        unsigned int target)
+{
+        for (unsigned int m = v; m != NO_VERTEX; m = state->next_members[m]) {
+                for (unsigned int a = state->offsets[m];
+                        a < state->offsets[m + 1]; ++a) {
+                        unsigned int t = state->adjacency[a];
+                        unsigned int *triangle = state->triangles + t * 3;
+                        if (!state->is_live[t])
+                                continue;
+
+                        if (has_vertex(triangle, target)) {
+                                state->is_live[t] = 0;
+                                --state->live_triangle_count;
+                                continue;
+                        }
+
+                        for (unsigned int k = 0; k < 3; ++k) {
+                                if (triangle[k] == v)
+                                        triangle[k] = target;
+                        }
+                }
+        }
+
+        state->next_members[state->last_members[target]] = v;
+        state->last_members[target] = state->last_members[v];
+        add_quadric(&state->quadrics[target], &state->quadrics[v]);
+        state->is_collapsed[v] = 1;
+        ++state->collapse_count;
+
+        // The neighbours of the target keep their queued collapse unless it
+        // was onto v or one onto the target is now cheaper, and are checked
+        // again when it is popped
+        unsigned int neighbour_count = get_neighbours(state, target,
+                state->neighbours);
+        unsigned int update_count = 0;
+        for (unsigned int i = 0; i < neighbour_count; ++i) {
+                unsigned int w = state->neighbours[i];
+                if (state->kinds[w] == VERTEX_KIND_LOCKED)
+                        continue;
+
+                struct collapse collapse;
+                get_collapse_cost(state, w, target, &collapse);
+                if (state->best_targets[w] == NO_VERTEX ||
+                        state->best_targets[w] == v ||
+                        collapse.cost < state->best_costs[w])
+                        state->updates[update_count++] = w;
+        }
+
+        queue_collapse(state, target);
+        for (unsigned int i = 0; i < update_count; ++i)
+                queue_collapse(state, state->updates[i]);
+}
+
+// Adjacency from every vertex to its live triangles, which also clears the
+// chains of members and the dead triangles left in them
+static void build_adjacency(struct simplify_state *state)
+{
+        unsigned int vertex_count = state->mi->vertex_count;
+
+        memset(state->offsets, 0, (vertex_count + 1) * sizeof (unsigned int));
+        for (unsigned int t = 0; t < state->triangle_count; ++t) {
+                for (unsigned int k = 0; k < 3 && state->is_live[t]; ++k)
+                        ++state->offsets[state->triangles[t * 3 + k] + 1];
+        }
+
+        for (unsigned int v = 0; v < vertex_count; ++v) {
+                state->offsets[v + 1] += state->offsets[v];
+                state->next_members[v] = NO_VERTEX;
+                state->last_members[v] = v;
+        }
+
+        // offsets[v] is moved past each triangle added, then back
+        for (unsigned int t = 0; t < state->triangle_count; ++t) {
+                for (unsigned int k = 0; k < 3 && state->is_live[t]; ++k) {
+                        unsigned int v = state->triangles[t * 3 + k];
+                        state->adjacency[state->offsets[v]++] = t;
+                }
+        }
+
+        for (unsigned int v = vertex_count; v > 0; --v)
+                state->offsets[v] = state->offsets[v - 1];
+        state->offsets[0] = 0;
+        state->rebuild_collapse_count = state->collapse_count;
+}
+
+static unsigned int hash_position(const float *position)
+{
+        unsigned int bits[3];
+        memcpy(bits, position, sizeof (bits));
+
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^
+                (bits[2] * 83492791u);
+}
+
+// Vertices sharing a position with another are on a seam
+static void lock_seams(struct simplify_state *state)
+{
+        struct mesh_info *mi = state->mi;
+        unsigned int table_size = 1;
+        while (table_size < mi->vertex_count * 2)
+                table_size *= 2;
+
+        unsigned int *table = malloc(table_size * sizeof (unsigned int));
+        memset(table, 0xff, table_size * sizeof (unsigned int));
+
+        for (unsigned int v = 0; v < mi->vertex_count; ++v) {
+                if (state->offsets[v] == state->offsets[v + 1])
+                        continue;
+
+                float *position = mi->verticies[v].position;
+                unsigned int slot = hash_position(position) & (table_size - 1);
+                while (table[slot] != NO_VERTEX) {
+                        unsigned int other = table[slot];
+                        if (memcmp(mi->verticies[other].position, position,
+                                sizeof (float) * 3) == 0) {
+                                state->kinds[other] = VERTEX_KIND_LOCKED;
+                                state->kinds[v] = VERTEX_KIND_LOCKED;
+                                break;
+                        }
+                        slot = (slot + 1) & (table_size - 1);
+                }
+
+                if (table[slot] == NO_VERTEX)
+                        table[slot] = v;
+        }
+
+        free(table);
+}
+
+// Adds the planes of the triangles, and for open edges a plane through the
+// edge at right angles to its triangle that keeps the border in place
+static void init_quadrics(struct simplify_state *state)
+{
+        struct mesh_info *mi = state->mi;
+        memset(state->quadrics, 0, mi->vertex_count * sizeof (struct quadric));
+
+        for (unsigned int t = 0; t < state->triangle_count; ++t) {
+                const unsigned int *triangle = state->triangles + t * 3;
+                if (!state->is_live[t])
+                        continue;
+
+                vec3 normal;
+                get_triangle_normal(state, triangle, NO_VERTEX, NULL, normal);
+                float length = vec3_len(normal);
+                if (length == 0.0f)
+                        continue;
+
+                vec3_scale(normal, normal, 1.0f / length);
+                float d = -vec3_mul_inner(normal,
+                        mi->verticies[triangle[0]].position);
+                for (unsigned int k = 0; k < 3; ++k) {
+                        struct quadric *q = &state->quadrics[triangle[k]];
+                        add_plane(q, normal, d, length * 0.5f);
+                        q->weight += length * 0.5f;
+                }
+        }
+
+        for (unsigned int v = 0; v < mi->vertex_count; ++v) {
+                if (state->offsets[v] == state->offsets[v + 1])
+                        continue;
+
+                unsigned int neighbour_count = get_neighbours(state, v,
+                        state->neighbours);
+                float *p = mi->verticies[v].position;
+
+                for (unsigned int i = 0; i < neighbour_count; ++i) {
+                        unsigned int w = state->neighbours[i];
+                        if (state->edge_counts[w] > 2)
+                                state->kinds[v] = VERTEX_KIND_LOCKED;
+                        if (state->edge_counts[w] != 1)
+                                continue;
+
+                        if (state->kinds[v] == VERTEX_KIND_MANIFOLD) {
+                                state->kinds[v] =
+                                        state->simplify_info->is_border_locked ?
+                                        VERTEX_KIND_LOCKED : VERTEX_KIND_BORDER;
+                        }
+
+                        // The one live triangle on the edge
+                        for (unsigned int a = state->offsets[v];
+                                a < state->offsets[v + 1]; ++a) {
+                                unsigned int t = state->adjacency[a];
+                                const unsigned int *triangle =
+                                        state->triangles + t * 3;
+                                if (!state->is_live[t] ||
+                                        !has_vertex(triangle, w))
+                                        continue;
+
+                                vec3 edge, normal, plane;
+                                vec3_sub(edge, mi->verticies[w].position, p);
+                                get_triangle_normal(state, triangle,
+                                        NO_VERTEX, NULL, normal);
+                                vec3_mul_cross(plane, edge, normal);
+                                float length = vec3_len(plane);
+                                if (length == 0.0f)
+                                        break;
+
+                                vec3_scale(plane, plane, 1.0f / length);
+                                add_plane(&state->quadrics[v], plane,
+                                        -vec3_mul_inner(plane, p),
+                                        vec3_mul_inner(edge, edge) *
+                                        SIMPLIFY_BORDER_WEIGHT);
+                                break;
+                        }
+                }
+        }
+}
+
+static void init_state(struct simplify_state *state, struct mesh_info *mi,
+        const unsigned int *indices, unsigned int triangle_count)
+{
+        unsigned int vertex_count = mi->vertex_count;
+
+        state->mi = mi;
+        state->triangle_count = triangle_count;
+        state->live_triangle_count = 0;
+        state->triangles = malloc((triangle_count * 3 + 1) *
+                sizeof (unsigned int));
+        state->is_live = malloc(triangle_count + 1);
+        state->offsets = malloc((vertex_count + 1) * sizeof (unsigned int));
+        state->adjacency = malloc((triangle_count * 3 + 1) *
+                sizeof (unsigned int));
+        state->next_members = malloc((vertex_count + 1) *
+                sizeof (unsigned int));
+        state->last_members = malloc((vertex_count + 1) *
+                sizeof (unsigned int));
+        state->kinds = calloc(vertex_count + 1, 1);
+        state->is_collapsed = calloc(vertex_count + 1, 1);
+        state->versions = calloc(vertex_count + 1, sizeof (unsigned int));
+        state->quadrics = malloc((vertex_count + 1) * sizeof (struct quadric));
+        state->stamps = calloc(vertex_count + 1, sizeof (unsigned int));
+        state->stamp = 0;
+        state->edge_counts = malloc((vertex_count + 1) *
+                sizeof (unsigned int));
+        state->neighbours = malloc((vertex_count + 1) *
+                sizeof (unsigned int));
+        state->updates = malloc((vertex_count + 1) * sizeof (unsigned int));
+        state->best_targets = malloc((vertex_count + 1) *
+                sizeof (unsigned int));
+        state->best_costs = malloc((vertex_count + 1) * sizeof (float));
+        state->candidates = malloc((vertex_count + 1) *
+                sizeof (struct collapse));
+        state->heap_capacity = vertex_count + 1;
+        state->heap = malloc(state->heap_capacity * sizeof (struct collapse));
+        state->heap_count = 0;
+        state->collapse_count = 0;
+
+        // Triangles that use a vertex twice draw nothing and start dead
+        memcpy(state->triangles, indices, triangle_count * 3 *
+                sizeof (unsigned int));
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                const unsigned int *triangle = state->triangles + t * 3;
+                assert(triangle[0] < vertex_count &&
+                        triangle[1] < vertex_count &&
+                        triangle[2] < vertex_count);
+                state->is_live[t] = triangle[0] != triangle[1] &&
+                        triangle[1] != triangle[2] &&
+                        triangle[0] != triangle[2];
+                state->live_triangle_count += state->is_live[t];
+        }
+
+        build_adjacency(state);
+        lock_seams(state);
+        init_quadrics(state);
+
+        for (unsigned int v = 0; v < vertex_count; ++v)
+                queue_collapse(state, v);
+}
+
+static void release_state(struct simplify_state *state)
+{
+        free(state->heap);
+        free(state->candidates);
+        free(state->best_costs);
+        free(state->best_targets);
+        free(state->updates);
+        free(state->neighbours);
+        free(state->edge_counts);
+        free(state->stamps);
+        free(state->quadrics);
+        free(state->versions);
+        free(state->is_collapsed);
+        free(state->kinds);
+        free(state->last_members);
+        free(state->next_members);
+        free(state->adjacency);
+        free(state->offsets);
+        free(state->is_live);
+        free(state->triangles);
+}
+
+// Collapses until at most target_count triangles are left, returns 0 once
+// nothing more can collapse within the error limit
+static int simplify(struct simplify_state *state, unsigned int target_count,
+        float *error)
+{
+        float max_error = state->simplify_info->max_error;
+
+        while (state->live_triangle_count > target_count) {
+                if (state->heap_count == 0)
+                        return 0;
+
+                struct collapse collapse;
+                pop_collapse(state, &collapse);
+                if (state->is_collapsed[collapse.vertex] ||
+                        state->versions[collapse.vertex] != collapse.version)
+                        continue;
+
+                if (!is_collapse_valid(state, collapse.vertex,
+                        collapse.target)) {
+                        queue_collapse(state, collapse.vertex);
+                        continue;
+                }
+
+                if (max_error > 0.0f && collapse.error > max_error)
+                        return 0;
+
+                *error = collapse.error > *error ? collapse.error : *error;
+                apply_collapse(state, collapse.vertex, collapse.target);
+
+                // Chains grow with every collapse and keep the triangles
+                // that died, so they are cleared now and then
+                if (state->collapse_count - state->rebuild_collapse_count >
+                        state->live_triangle_count / 4)
+                        build_adjacency(state);
+        }
+
+        return 1;
+}
+
+static void add_level(struct mesh_info *lod_mesh, unsigned int *capacity,
+        const unsigned int *indices, unsigned int index_count, float error)
+{
+        if (lod_mesh->index_count + index_count > *capacity) {
+                while (lod_mesh->index_count + index_count > *capacity)
+                        *capacity *= 2;
+                lod_mesh->indices = realloc(lod_mesh->indices, *capacity *
+                        sizeof (unsigned int));
+        }
+
+        struct mesh_lod *lod = &lod_mesh->lods[lod_mesh->lod_count++];
+        lod->first_index = lod_mesh->index_count;
+        lod->index_count = index_count;
+        lod->error = error;
+
+        memcpy(lod_mesh->indices + lod_mesh->index_count, indices,
+                index_count * sizeof (unsigned int));
+        lod_mesh->index_count += index_count;
+}
+
+static unsigned int build_lod_chain(struct simplify_info *simplify_info,
+        struct mesh_info *mi, struct mesh_info *lod_mesh)
+{
+        struct mesh_lod first_lod = { 0, mi->index_count, 0.0f };
+        if (mi->lod_count > 0)
+                first_lod = mi->lods[0];
+        assert(first_lod.index_count % 3 == 0);
+        assert(first_lod.first_index + first_lod.index_count <=
+                mi->index_count);
+
+        unsigned int capacity = first_lod.index_count * 2 + 3;
+        lod_mesh->vertex_count = mi->vertex_count;
+        lod_mesh->verticies = mi->verticies;
+        lod_mesh->index_count = 0;
+        lod_mesh->indices = malloc(capacity * sizeof (unsigned int));
+        lod_mesh->lod_count = 0;
+        add_level(lod_mesh, &capacity, mi->indices + first_lod.first_index,
+                first_lod.index_count, first_lod.error);
+
+        struct simplify_state state;
+        unsigned int triangle_count = first_lod.index_count / 3;
+        state.simplify_info = simplify_info;
+        init_state(&state, mi, mi->indices + first_lod.first_index,
+                triangle_count);
+
+        unsigned int *indices = malloc((triangle_count * 3 + 1) *
+                sizeof (unsigned int));
+        unsigned int last_count = state.live_triangle_count;
+        float error = first_lod.error;
+
+        assert(simplify_info->ratio_count < MAX_MESH_LODS);
+        for (unsigned int r = 0; r < simplify_info->ratio_count; ++r) {
+                unsigned int target_count = (unsigned int)
+                        (triangle_count * simplify_info->ratios[r]);
+                int is_done = !simplify(&state, target_count, &error);
+                if (state.live_triangle_count == last_count)
+                        break;
+
+                // Live triangles keep the order of the first level
+                unsigned int index_count = 0;
+                for (unsigned int t = 0; t < triangle_count; ++t) {
+                        if (!state.is_live[t])
+                                continue;
+                        memcpy(indices + index_count, state.triangles + t * 3,
+                                3 * sizeof (unsigned int));
+                        index_count += 3;
+                }
+
+                add_level(lod_mesh, &capacity, indices, index_count, error);
+                last_count = state.live_triangle_count;
+                if (is_done)
+                        break;
+        }
+
+        unsigned int collapse_count = state.collapse_count;
+        free(indices);
+        release_state(&state);
+
+        return collapse_count;
+}
+
+static void build_lod_chain_range(void *job_data, unsigned int first,
+        unsigned int count)
+{
+        struct simplify_job *job = job_data;
+
+        for (unsigned int i = first; i < first + count; ++i) {
+                job->collapse_counts[i] = build_lod_chain(job->simplify_info,
+                        &job->meshes[i], &job->lod_meshes[i]);
+        }
+}
+
+void build_lod_chains(struct simplify_info *simplify_info,
+        struct mesh_info *meshes, unsigned int mesh_count,
+        struct mesh_info *lod_meshes)
+{
+        double start_time = get_time_in_secs();
+
+        struct simplify_job job;
+        job.simplify_info = simplify_info;
+        job.meshes = meshes;
+        job.lod_meshes = lod_meshes;
+        job.collapse_counts = malloc((mesh_count + 1) *
+                sizeof (unsigned int));
+
+        parallel_for(mesh_count > 1 ? simplify_info->job_system : NULL,
+                mesh_count, 1, build_lod_chain_range, &job);
+
+        struct simplify_stats *stats = &simplify_info->stats;
+        stats->mesh_count = mesh_count;
+        stats->triangle_count = 0;
+        stats->lod_triangle_count = 0;
+        stats->collapse_count = 0;
+        for (unsigned int i = 0; i < mesh_count; ++i) {
+                struct mesh_info *lod_mesh = &lod_meshes[i];
+                stats->triangle_count += lod_mesh->lods[0].index_count / 3;
+                stats->lod_triangle_count += (lod_mesh->index_count -
+                        lod_mesh->lods[0].index_count) / 3;
+                stats->collapse_count += job.collapse_counts[i];
+        }
+
+        free(job.collapse_counts);
+
+        stats->build_time = get_time_in_secs() - start_time;
+        stats->triangles_per_sec = stats->build_time > 0.0 ?
+                stats->triangle_count / stats->build_time : 0.0;
+}
+
+void release_lod_chain(struct mesh_info *lod_mesh)
+{
+        free(lod_mesh->indices);
+        lod_mesh->indices = NULL;
+}
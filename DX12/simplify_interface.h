@@ -0,0 +1,59 @@
+#ifndef SIMPLIFY_INTERFACE_H
+#define SIMPLIFY_INTERFACE_H
+
+#include "mesh_interface.h"
+#include "job_interface.h"
+
+// Builds levels of detail by collapsing edges in the order of their
+// quadric error, where each vertex sums the squared distances to the
+// planes of the triangles it has taken in. Vertices only ever collapse onto
+// one of their neighbours, so every level shares the vertex buffer of the
+// mesh. Collapses that would flip a triangle are refused, and so are
+// collapses of vertices on a seam, where a position is shared by vertices
+// with other attributes, so levels never open cracks. The queue is a binary
+// heap whose entries are checked against a version of their vertex when
+// popped rather than updated in place. Meshes are simplified in parallel
+// on the job system. Kept free of D3D types so it can run headless.
+#define SIMPLIFY_BORDER_WEIGHT 10.0f
+#define SIMPLIFY_MIN_NORMAL_DOT 0.25f
+
+struct simplify_stats {
+        unsigned int mesh_count;
+        unsigned int triangle_count;
+        // Over every level after the first
+        unsigned int lod_triangle_count;
+        unsigned int collapse_count;
+        double build_time;
+        double triangles_per_sec;
+};
+
+struct simplify_info {
+        struct job_system_info *job_system;
+        // Of the triangles of the first level, for each level after it, in
+        // decreasing order
+        unsigned int ratio_count;
+        float ratios[MAX_MESH_LODS - 1];
+        // Model units a unit of colour or uv difference counts as when
+        // picking collapses, 0 to go by position alone
+        float colour_weight;
+        float uv_weight;
+        // Keeps vertices on the open edges of a mesh where they are, rather
+        // than letting them slide along those edges
+        int is_border_locked;
+        // Stops simplifying once the error of a level would pass this, in
+        // model units, none when 0
+        float max_error;
+        struct simplify_stats stats;
+};
+
+// Fills in a mesh for each of the mesh_count meshes, with the same
+// vertices and a new index buffer holding the first level of the mesh
+// followed by the new ones. The errors of the levels are the largest root
+// mean square distance a collapsed vertex moved from the surface it stood
+// for. Levels that could not be simplified any further are left out.
+void build_lod_chains(struct simplify_info *simplify_info,
+        struct mesh_info *meshes, unsigned int mesh_count,
+        struct mesh_info *lod_meshes);
+void release_lod_chain(struct mesh_info *lod_mesh);
+
+#endif
@@ -0,0 +1,287 @@
+#include "bvh_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Times building a BVH over a million unit boxes, refitting it after moving
+// a share of them, and the three kinds of query. Timings depend on the
+// machine and are only reported; the run fails when a sample of queries
+// finds other items than testing every box does.
+#define BENCH_ITEM_COUNT 1000000
+#define BENCH_BUILD_RUN_COUNT 3
+#define BENCH_RUN_COUNT 5
+#define BENCH_QUERY_COUNT 10000
+#define CHECK_QUERY_COUNT 64
+#define WORLD_SIZE 1000.0f
+#define QUERY_SIZE 10.0f
+
+static const double move_ratios[] = { 0.01, 0.1, 1.0 };
+
+struct box_set {
+        vec3 *mins;
+        vec3 *maxs;
+};
+
+static void move_items(unsigned long long *state, struct bvh_info *bvh,
+        struct box_set *boxes, unsigned int move_count)
+{
+        for (unsigned int m = 0; m < move_count; ++m) {
+                unsigned int i = (unsigned int) (test_random(state) %
+                        BENCH_ITEM_COUNT);
+                for (int k = 0; k < 3; ++k) {
+                        float offset = test_random_float(state, -1.0f, 1.0f);
+                        boxes->mins[i][k] += offset;
+                        boxes->maxs[i][k] += offset;
+                }
+                update_bvh_item(bvh, i, boxes->mins[i], boxes->maxs[i]);
+        }
+}
+
+static void get_random_query_box(unsigned long long *state, vec3 min,
+        vec3 max)
+{
+        for (int k = 0; k < 3; ++k) {
+                min[k] = test_random_float(state, -WORLD_SIZE, WORLD_SIZE);
+                max[k] = min[k] + QUERY_SIZE;
+        }
+}
+
+static void get_random_ray(unsigned long long *state, vec3 origin, vec3 dir)
+{
+        for (int k = 0; k < 3; ++k) {
+                origin[k] = test_random_float(state, -WORLD_SIZE,
+                        WORLD_SIZE);
+                dir[k] = test_random_float(state, -1.0f, 1.0f);
+        }
+}
+
+static int is_box_in_frustum(struct frustum_planes *planes, vec3 min,
+        vec3 max)
+{
+        for (int p = 0; p < 6; ++p) {
+                float dist = planes->a[p] * (planes->a[p] >= 0.0f ?
+                        max[0] : min[0]) + planes->b[p] * (planes->b[p] >=
+                        0.0f ? max[1] : min[1]) + planes->c[p] *
+                        (planes->c[p] >= 0.0f ? max[2] : min[2]) +
+                        planes->d[p];
+                if (dist <= 0.0f)
+                        return 0;
+        }
+
+        return 1;
+}
+
+// Entry distance of the ray into the box, when it enters before max_t
+static int get_ray_box_t(vec3 min, vec3 max, vec3 origin, vec3 inv_dir,
+        float max_t, float *t)
+{
+        float t_near = 0.0f;
+        float t_far = max_t;
+        for (int k = 0; k < 3; ++k) {
+                float t0 = (min[k] - origin[k]) * inv_dir[k];
+                float t1 = (max[k] - origin[k]) * inv_dir[k];
+                t_near = fmaxf(t_near, fminf(t0, t1));
+                t_far = fminf(t_far, fmaxf(t0, t1));
+        }
+
+        *t = t_near;
+
+        return t_near <= t_far;
+}
+
+// Query counts against testing every box, and ray hits by distance, since
+// boxes entered at the same t may be found in any order
+static unsigned int count_bad_queries(unsigned long long *state,
+        struct bvh_info *bvh, struct box_set *boxes,
+        struct frustum_planes *planes, unsigned int *items)
+{
+        unsigned int expected_count = 0;
+        for (unsigned int i = 0; i < BENCH_ITEM_COUNT; ++i)
+                expected_count += is_box_in_frustum(planes, boxes->mins[i],
+                        boxes->maxs[i]);
+        unsigned int bad_count = query_bvh_frustum(bvh, planes, items,
+                BENCH_ITEM_COUNT) != expected_count;
+
+        for (unsigned int q = 0; q < CHECK_QUERY_COUNT; ++q) {
+                vec3 min;
+                vec3 max;
+                get_random_query_box(state, min, max);
+                expected_count = 0;
+                for (unsigned int i = 0; i < BENCH_ITEM_COUNT; ++i)
+                        expected_count += boxes->mins[i][0] <= max[0] &&
+                                boxes->maxs[i][0] >= min[0] &&
+                                boxes->mins[i][1] <= max[1] &&
+                                boxes->maxs[i][1] >= min[1] &&
+                                boxes->mins[i][2] <= max[2] &&
+                                boxes->maxs[i][2] >= min[2];
+                bad_count += query_bvh_aabb(bvh, min, max, items,
+                        BENCH_ITEM_COUNT) != expected_count;
+
+                vec3 origin;
+                vec3 dir;
+                get_random_ray(state, origin, dir);
+                vec3 inv_dir = { 1.0f / dir[0], 1.0f / dir[1],
+                        1.0f / dir[2] };
+                float max_t = 2.0f * WORLD_SIZE;
+                float expected_t = max_t;
+                int is_expected_hit = 0;
+                for (unsigned int i = 0; i < BENCH_ITEM_COUNT; ++i) {
+                        float t;
+                        if (get_ray_box_t(boxes->mins[i], boxes->maxs[i],
+                                origin, inv_dir, max_t, &t) &&
+                                (t < expected_t || !is_expected_hit)) {
+                                expected_t = t;
+                                is_expected_hit = 1;
+                        }
+                }
+
+                float t = -1.0f;
+                unsigned int item = query_bvh_ray(bvh, origin, dir, max_t,
+                        &t);
+                bad_count += (item != BVH_NO_ITEM) != is_expected_hit;
+                if (item != BVH_NO_ITEM && is_expected_hit)
+                        bad_count += t != expected_t;
+        }
+
+        return bad_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        struct bvh_info bvh;
+        memset(&bvh, 0, sizeof (struct bvh_info));
+        bvh.job_system = &job_system;
+        bvh.max_items = BENCH_ITEM_COUNT;
+        create_bvh(&bvh);
+
+        unsigned long long state = 0x9e3779b97f4a7c15ull;
+        struct box_set boxes;
+        boxes.mins = malloc(BENCH_ITEM_COUNT * sizeof (vec3));
+        boxes.maxs = malloc(BENCH_ITEM_COUNT * sizeof (vec3));
+        for (unsigned int i = 0; i < BENCH_ITEM_COUNT; ++i) {
+                for (int k = 0; k < 3; ++k) {
+                        boxes.mins[i][k] = test_random_float(&state,
+                                -WORLD_SIZE, WORLD_SIZE);
+                        boxes.maxs[i][k] = boxes.mins[i][k] + 1.0f;
+                }
+                add_bvh_item(&bvh, boxes.mins[i], boxes.maxs[i]);
+        }
+
+        double build_time = 1e30;
+        for (unsigned int r = 0; r < BENCH_BUILD_RUN_COUNT; ++r) {
+                build_bvh(&bvh);
+                if (bvh.stats.build_time < build_time)
+                        build_time = bvh.stats.build_time;
+        }
+
+        unsigned int ratio_count = sizeof (move_ratios) /
+                sizeof (move_ratios[0]);
+        double refit_ms[sizeof (move_ratios) / sizeof (move_ratios[0])];
+        for (unsigned int m = 0; m < ratio_count; ++m) {
+                double best_time = 1e30;
+                for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                        move_items(&state, &bvh, &boxes, (unsigned int)
+                                (move_ratios[m] * BENCH_ITEM_COUNT));
+
+                        double start_time = get_time_in_secs();
+                        refit_bvh(&bvh);
+                        double refit_time = get_time_in_secs() - start_time;
+
+                        if (refit_time < best_time)
+                                best_time = refit_time;
+                }
+
+                refit_ms[m] = best_time * 1000.0;
+        }
+
+        // Queries run on a fresh tree, the refits above leave it looser
+        build_bvh(&bvh);
+
+        // From the middle of the world, seeing to its edge
+        vec3 eye = { 0.0f, 0.0f, 0.0f };
+        vec3 center = { 0.0f, 0.0f, -1.0f };
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4 pv_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        mat4x4_perspective(projection_mat, 1.0f, 16.0f / 9.0f, 0.1f,
+                WORLD_SIZE);
+        mat4x4_mul(pv_mat, projection_mat, view_mat);
+        struct frustum_planes planes;
+        extract_frustum_planes(pv_mat, &planes);
+
+        unsigned int *items = malloc(BENCH_ITEM_COUNT *
+                sizeof (unsigned int));
+        double frustum_time = 1e30;
+        unsigned int visible_count = 0;
+        for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                double start_time = get_time_in_secs();
+                visible_count = query_bvh_frustum(&bvh, &planes, items,
+                        BENCH_ITEM_COUNT);
+                double query_time = get_time_in_secs() - start_time;
+
+                if (query_time < frustum_time)
+                        frustum_time = query_time;
+        }
+
+        unsigned int hit_count = 0;
+        double start_time = get_time_in_secs();
+        for (unsigned int q = 0; q < BENCH_QUERY_COUNT; ++q) {
+                vec3 min;
+                vec3 max;
+                get_random_query_box(&state, min, max);
+                hit_count += query_bvh_aabb(&bvh, min, max, items,
+                        BENCH_ITEM_COUNT);
+        }
+        double aabb_time = get_time_in_secs() - start_time;
+
+        unsigned int ray_hit_count = 0;
+        start_time = get_time_in_secs();
+        for (unsigned int q = 0; q < BENCH_QUERY_COUNT; ++q) {
+                vec3 origin;
+                vec3 dir;
+                get_random_ray(&state, origin, dir);
+                float t;
+                ray_hit_count += query_bvh_ray(&bvh, origin, dir,
+                        2.0f * WORLD_SIZE, &t) != BVH_NO_ITEM;
+        }
+        double ray_time = get_time_in_secs() - start_time;
+
+        unsigned int bad_count = count_bad_queries(&state, &bvh, &boxes,
+                &planes, items);
+
+        printf("bvh_bench: %u boxes, %u workers, build %.1f ms, "
+                "%u nodes\n", BENCH_ITEM_COUNT, job_system.worker_count,
+                build_time * 1000.0, bvh.stats.node_count);
+        printf("bvh_bench: refit");
+        for (unsigned int m = 0; m < ratio_count; ++m)
+                printf(" %.2f ms with %.0f%% moved%s", refit_ms[m],
+                        move_ratios[m] * 100.0, m + 1 < ratio_count ?
+                        "," : "\n");
+        printf("bvh_bench: frustum %.2f ms for %u visible, aabb %.2f us "
+                "(%.1f found), ray %.2f us (%u of %u hit)\n",
+                frustum_time * 1000.0, visible_count,
+                aabb_time * 1e6 / BENCH_QUERY_COUNT,
+                (double) hit_count / BENCH_QUERY_COUNT,
+                ray_time * 1e6 / BENCH_QUERY_COUNT, ray_hit_count,
+                BENCH_QUERY_COUNT);
+
+        free(items);
+        free(boxes.maxs);
+        free(boxes.mins);
+        release_bvh(&bvh);
+        release_job_system(&job_system);
+
+        if (bad_count > 0)
+                printf("bvh_bench: %u queries off\n", bad_count);
+
+        return bad_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+#include "bvh_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Checks the BVH queries against testing every item, once after the build
+// and again after items move and the tree is refitted. The item tests are
+// the ones the BVH uses, so the results have to match exactly.
+#define ITEM_COUNT 100000
+#define QUERY_COUNT 64
+#define WORLD_SIZE 1000.0f
+#define MAX_ITEM_SIZE 8.0f
+
+struct box_set {
+        unsigned int count;
+        vec3 *mins;
+        vec3 *maxs;
+};
+
+static void set_random_box(unsigned long long *state, vec3 min, vec3 max)
+{
+        for (int k = 0; k < 3; ++k) {
+                min[k] = test_random_float(state, -WORLD_SIZE, WORLD_SIZE);
+                max[k] = min[k] + test_random_float(state, 0.0f,
+                        MAX_ITEM_SIZE);
+        }
+}
+
+static int is_box_in_frustum(struct frustum_planes *planes, vec3 min,
+        vec3 max)
+{
+        for (int p = 0; p < 6; ++p) {
+                float dist = planes->a[p] * (planes->a[p] >= 0.0f ?
+                        max[0] : min[0]) + planes->b[p] * (planes->b[p] >=
+                        0.0f ? max[1] : min[1]) + planes->c[p] *
+                        (planes->c[p] >= 0.0f ? max[2] : min[2]) +
+                        planes->d[p];
+                if (dist <= 0.0f)
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int is_box_overlapping(vec3 min, vec3 max, vec3 other_min,
+        vec3 other_max)
+{
+        return min[0] <= other_max[0] && max[0] >= other_min[0] &&
+                min[1] <= other_max[1] && max[1] >= other_min[1] &&
+                min[2] <= other_max[2] && max[2] >= other_min[2];
+}
+
+static int get_ray_box_t(vec3 min, vec3 max, vec3 origin, vec3 inv_dir,
+        float max_t, float *t)
+{
+        float t_near = 0.0f;
+        float t_far = max_t;
+        for (int k = 0; k < 3; ++k) {
+                float t0 = (min[k] - origin[k]) * inv_dir[k];
+                float t1 = (max[k] - origin[k]) * inv_dir[k];
+                t_near = fmaxf(t_near, fminf(t0, t1));
+                t_far = fminf(t_far, fmaxf(t0, t1));
+        }
+
+        *t = t_near;
+
+        return t_near <= t_far;
+}
+
+static int compare_items(const void *a, const void *b)
+{
+        unsigned int x = *(const unsigned int *) a;
+        unsigned int y = *(const unsigned int *) b;
+
+        return (x > y) - (x < y);
+}
+
+// Sorts the query result, as the BVH writes items in tree order
+static void check_same_items(unsigned int *items, unsigned int count,
+        unsigned int *expected, unsigned int expected_count)
+{
+        CHECK(count == expected_count);
+        if (count != expected_count)
+                return;
+
+        qsort(items, count, sizeof (unsigned int), compare_items);
+        CHECK(memcmp(items, expected, count * sizeof (unsigned int)) == 0);
+}
+
+static void make_random_planes(unsigned long long *state,
+        struct frustum_planes *planes)
+{
+        vec3 eye;
+        vec3 center;
+        for (int k = 0; k < 3; ++k) {
+                eye[k] = test_random_float(state, -WORLD_SIZE, WORLD_SIZE);
+                center[k] = test_random_float(state, -WORLD_SIZE,
+                        WORLD_SIZE);
+        }
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4 pv_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        mat4x4_perspective(projection_mat, test_random_float(state, 0.2f,
+                1.5f), 16.0f / 9.0f, 0.1f, test_random_float(state, 100.0f,
+                2.0f * WORLD_SIZE));
+        mat4x4_mul(pv_mat, projection_mat, view_mat);
+        extract_frustum_planes(pv_mat, planes);
+}
+
+static void check_queries(unsigned long long *state, struct bvh_info *bvh,
+        struct box_set *boxes, unsigned int *items, unsigned int *expected)
+{
+        for (int q = 0; q < QUERY_COUNT; ++q) {
+                struct frustum_planes planes;
+                make_random_planes(state, &planes);
+
+                unsigned int expected_count = 0;
+                for (unsigned int i = 0; i < boxes->count; ++i)
+                        if (is_box_in_frustum(&planes, boxes->mins[i],
+                                boxes->maxs[i]))
+                                expected[expected_count++] = i;
+
+                unsigned int count = query_bvh_frustum(bvh, &planes, items,
+                        boxes->count);
+                check_same_items(items, count, expected, expected_count);
+        }
+
+        for (int q = 0; q < QUERY_COUNT; ++q) {
+                // Query boxes from empty to a good part of the world
+                vec3 min;
+                vec3 max;
+                float size = test_random_float(state, 0.0f, WORLD_SIZE *
+                        (q % 4 == 0 ? 0.5f : 0.05f));
+                for (int k = 0; k < 3; ++k) {
+                        min[k] = test_random_float(state, -WORLD_SIZE,
+                                WORLD_SIZE);
+                        max[k] = min[k] + size;
+                }
+
+                unsigned int expected_count = 0;
+                for (unsigned int i = 0; i < boxes->count; ++i)
+                        if (is_box_overlapping(boxes->mins[i],
+                                boxes->maxs[i], min, max))
+                                expected[expected_count++] = i;
+
+                unsigned int count = query_bvh_aabb(bvh, min, max, items,
+                        boxes->count);
+                check_same_items(items, count, expected, expected_count);
+        }
+
+        for (int q = 0; q < QUERY_COUNT; ++q) {
+                vec3 origin;
+                vec3 dir;
+                for (int k = 0; k < 3; ++k) {
+                        origin[k] = test_random_float(state, -WORLD_SIZE,
+                                WORLD_SIZE);
+                        dir[k] = test_random_float(state, -1.0f, 1.0f);
+                }
+                vec3 inv_dir = { 1.0f / dir[0], 1.0f / dir[1],
+                        1.0f / dir[2] };
+                float max_t = q % 2 == 0 ? 2.0f * WORLD_SIZE : 50.0f;
+
+                unsigned int expected_item = BVH_NO_ITEM;
+                float expected_t = max_t;
+                for (unsigned int i = 0; i < boxes->count; ++i) {
+                        float t;
+                        if (get_ray_box_t(boxes->mins[i], boxes->maxs[i],
+                                origin, inv_dir, max_t, &t) &&
+                                (t < expected_t ||
+                                expected_item == BVH_NO_ITEM)) {
+                                expected_t = t;
+                                expected_item = i;
+                        }
+                }
+
+                // Boxes entered at the same t may be found in any order
+                float t = -1.0f;
+                unsigned int item = query_bvh_ray(bvh, origin, dir, max_t,
+                        &t);
+                CHECK((item == BVH_NO_ITEM) ==
+                        (expected_item == BVH_NO_ITEM));
+                if (item != BVH_NO_ITEM && expected_item != BVH_NO_ITEM)
+                        CHECK(t == expected_t);
+        }
+}
+
+static void move_items(unsigned long long *state, struct bvh_info *bvh,
+        struct box_set *boxes, unsigned int move_count, float distance)
+{
+        for (unsigned int m = 0; m < move_count; ++m) {
+                unsigned int i = test_random(state) % boxes->count;
+                for (int k = 0; k < 3; ++k) {
+                        float offset = test_random_float(state, -distance,
+                                distance);
+                        boxes->mins[i][k] += offset;
+                        boxes->maxs[i][k] += offset;
+                }
+                update_bvh_item(bvh, i, boxes->mins[i], boxes->maxs[i]);
+        }
+}
+
+static void test_bvh(struct job_system_info *job_system, unsigned int count)
+{
+        unsigned long long state = 0x9e3779b97f4a7c15ull ^ count;
+
+        struct box_set boxes;
+        boxes.count = count;
+        boxes.mins = malloc(count * sizeof (vec3));
+        boxes.maxs = malloc(count * sizeof (vec3));
+        unsigned int *items = malloc(count * sizeof (unsigned int));
+        unsigned int *expected = malloc(count * sizeof (unsigned int));
+
+        struct bvh_info bvh;
+        memset(&bvh, 0, sizeof (struct bvh_info));
+        bvh.job_system = job_system;
+        bvh.max_items = count;
+        create_bvh(&bvh);
+
+        for (unsigned int i = 0; i < count; ++i) {
+                set_random_box(&state, boxes.mins[i], boxes.maxs[i]);
+                CHECK(add_bvh_item(&bvh, boxes.mins[i], boxes.maxs[i]) == i);
+        }
+
+        build_bvh(&bvh);
+        check_queries(&state, &bvh, &boxes, items, expected);
+
+        // Small moves only refit, large ones grow subtrees far enough to
+        // be rebuilt
+        move_items(&state, &bvh, &boxes, count / 10 + 1, MAX_ITEM_SIZE);
+        refit_bvh(&bvh);
+        check_queries(&state, &bvh, &boxes, items, expected);
+
+        for (int r = 0; r < 4; ++r) {
+                move_items(&state, &bvh, &boxes, count / 4 + 1, WORLD_SIZE);
+                refit_bvh(&bvh);
+        }
+        if (count >= 1000)
+                CHECK(bvh.stats.rebuild_count > 0);
+        check_queries(&state, &bvh, &boxes, items, expected);
+
+        build_bvh(&bvh);
+        check_queries(&state, &bvh, &boxes, items, expected);
+
+        release_bvh(&bvh);
+        free(expected);
+        free(items);
+        free(boxes.maxs);
+        free(boxes.mins);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        static const unsigned int counts[] = { 1, 2, 5, 17, 1000, ITEM_COUNT };
+        for (unsigned int c = 0; c < sizeof (counts) / sizeof (counts[0]);
+                ++c) {
+                test_bvh(NULL, counts[c]);
+                test_bvh(&job_system, counts[c]);
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("bvh_test");
+}
@@ -0,0 +1,236 @@
+#include "cmd_state_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+// Checks the filtering on the sequences the rec_* calls produce, then
+// against a plain model of what a command list has bound over long random
+// runs of sets, root signature and heap changes, and invalidations. Values
+// come from a small pool so the same one is often set again.
+#define RUN_LENGTH 200000
+#define VALUE_POOL_SIZE 4
+
+struct bound_state {
+        int is_known;
+        unsigned int size;
+        unsigned char value[MAX_CMD_STATE_SIZE * 2];
+};
+
+struct state_model {
+        struct bound_state states[CMD_STATE_COUNT];
+        struct cmd_state_stats stats;
+};
+
+static void forget_states(struct state_model *model, unsigned int first_state,
+        unsigned int state_count)
+{
+        for (unsigned int s = first_state; s < first_state + state_count; ++s)
+                model->states[s].is_known = 0;
+}
+
+// Only what fits the shadow copy is remembered. A new root signature drops
+// the root arguments it goes with, and new heaps drop both kinds.
+static int set_model_state(struct state_model *model, unsigned int state,
+        const unsigned char *value, unsigned int size)
+{
+        struct bound_state *bound = &model->states[state];
+        if (bound->is_known && bound->size == size &&
+                memcmp(bound->value, value, size) == 0) {
+                ++model->stats.elided_count;
+                return 0;
+        }
+
+        bound->is_known = size <= MAX_CMD_STATE_SIZE;
+        bound->size = size;
+        memcpy(bound->value, value, size);
+
+        if (state == CMD_STATE_COMPUTE_ROOT_SIG)
+                forget_states(model, CMD_STATE_COMPUTE_ROOT_PARAM,
+                        MAX_CMD_STATE_ROOT_PARAMS);
+        else if (state == CMD_STATE_GRAPHICS_ROOT_SIG)
+                forget_states(model, CMD_STATE_GRAPHICS_ROOT_PARAM,
+                        MAX_CMD_STATE_ROOT_PARAMS);
+        else if (state == CMD_STATE_DESCRIPTOR_HEAPS)
+                forget_states(model, CMD_STATE_COMPUTE_ROOT_PARAM,
+                        2 * MAX_CMD_STATE_ROOT_PARAMS);
+
+        ++model->stats.issued_count;
+
+        return 1;
+}
+
+static void test_rec_sequences(void)
+{
+        struct cmd_state_info state_info;
+        init_cmd_state(&state_info);
+
+        // A frame sets the same pipeline, viewport and buffers every time
+        unsigned long long pipeline = 0x1234;
+        float viewport[6] = { 0.0f, 0.0f, 1280.0f, 720.0f, 0.0f, 1.0f };
+        for (int frame = 0; frame < 3; ++frame) {
+                CHECK(filter_cmd_state(&state_info, CMD_STATE_PIPELINE,
+                        &pipeline, sizeof (pipeline)) == (frame == 0));
+                CHECK(filter_cmd_state(&state_info, CMD_STATE_VIEWPORT,
+                        viewport, sizeof (viewport)) == (frame == 0));
+        }
+        CHECK(state_info.stats.issued_count == 2);
+        CHECK(state_info.stats.elided_count == 4);
+
+        // The same bytes under another state are a different set
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_SCISSOR_RECT,
+                viewport, sizeof (viewport)) == 1);
+        // A shorter value with the same start is not the same
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_VIEWPORT, viewport,
+                sizeof (viewport) - sizeof (float)) == 1);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_VIEWPORT, viewport,
+                sizeof (viewport)) == 1);
+
+        // Root arguments are set again after a new root signature, but only
+        // those of the same kind
+        unsigned long long root_sig = 1;
+        unsigned int constant = 7;
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_GRAPHICS_ROOT_SIG,
+                &root_sig, sizeof (root_sig)) == 1);
+        CHECK(filter_root_param_state(&state_info, 0, 2, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_root_param_state(&state_info, 1, 2, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_root_param_state(&state_info, 0, 2, &constant,
+                sizeof (constant)) == 0);
+        CHECK(filter_root_param_state(&state_info, 0, 3, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_GRAPHICS_ROOT_SIG,
+                &root_sig, sizeof (root_sig)) == 0);
+        root_sig = 2;
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_GRAPHICS_ROOT_SIG,
+                &root_sig, sizeof (root_sig)) == 1);
+        CHECK(filter_root_param_state(&state_info, 0, 2, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_root_param_state(&state_info, 1, 2, &constant,
+                sizeof (constant)) == 0);
+
+        // New heaps do the same for both kinds, and leave the rest
+        unsigned long long heaps[2] = { 10, 11 };
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_DESCRIPTOR_HEAPS,
+                heaps, sizeof (heaps)) == 1);
+        CHECK(filter_root_param_state(&state_info, 0, 2, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_root_param_state(&state_info, 1, 2, &constant,
+                sizeof (constant)) == 1);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_PIPELINE,
+                &pipeline, sizeof (pipeline)) == 0);
+
+        // Root parameters past the shadowed ones and values too big to
+        // shadow are always issued, and counted
+        unsigned int issued_count = state_info.stats.issued_count;
+        unsigned char big[MAX_CMD_STATE_SIZE + 1] = { 0 };
+        for (int i = 0; i < 2; ++i) {
+                CHECK(filter_root_param_state(&state_info, 0,
+                        MAX_CMD_STATE_ROOT_PARAMS, &constant,
+                        sizeof (constant)) == 1);
+                CHECK(filter_cmd_state(&state_info, CMD_STATE_RENDER_TARGET,
+                        big, sizeof (big)) == 1);
+        }
+        CHECK(state_info.stats.issued_count == issued_count + 4);
+
+        // A reset list has nothing bound, and init clears the counters too
+        invalidate_cmd_state(&state_info);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_PIPELINE,
+                &pipeline, sizeof (pipeline)) == 1);
+        invalidate_cmd_states(&state_info, CMD_STATE_VIEWPORT, 1);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_PIPELINE,
+                &pipeline, sizeof (pipeline)) == 0);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_VIEWPORT,
+                viewport, sizeof (viewport)) == 1);
+
+        init_cmd_state(&state_info);
+        CHECK(state_info.stats.issued_count == 0);
+        CHECK(state_info.stats.elided_count == 0);
+        CHECK(filter_cmd_state(&state_info, CMD_STATE_PIPELINE,
+                &pipeline, sizeof (pipeline)) == 1);
+}
+
+static void test_random_run(unsigned long long seed)
+{
+        unsigned long long state = seed;
+        struct cmd_state_info state_info;
+        init_cmd_state(&state_info);
+        struct state_model *model = calloc(1, sizeof (struct state_model));
+
+        // A few values of a few sizes, up to past what can be shadowed
+        static const unsigned int sizes[] = {
+                4, 8, 16, MAX_CMD_STATE_SIZE, MAX_CMD_STATE_SIZE + 4
+        };
+        unsigned int size_count = sizeof (sizes) / sizeof (sizes[0]);
+        unsigned char pool[VALUE_POOL_SIZE][MAX_CMD_STATE_SIZE * 2];
+        for (unsigned int v = 0; v < VALUE_POOL_SIZE; ++v) {
+                for (unsigned int i = 0; i < sizeof (pool[v]); ++i)
+                        pool[v][i] = (unsigned char) test_random(&state);
+        }
+
+        unsigned int bad_count = 0;
+        for (unsigned int n = 0; n < RUN_LENGTH; ++n) {
+                unsigned int op = test_random(&state) % 100;
+                const unsigned char *value =
+                        pool[test_random(&state) % VALUE_POOL_SIZE];
+                // Each state mostly keeps to one size
+                unsigned int size_index = test_random(&state) % 8 == 0 ?
+                        (unsigned int) test_random(&state) : 0;
+
+                if (op < 1) {
+                        invalidate_cmd_state(&state_info);
+                        forget_states(model, 0, CMD_STATE_COUNT);
+                } else if (op < 3) {
+                        unsigned int first = test_random(&state) %
+                                CMD_STATE_COUNT;
+                        unsigned int count = test_random(&state) %
+                                (CMD_STATE_COUNT - first + 1);
+                        invalidate_cmd_states(&state_info, first, count);
+                        forget_states(model, first, count);
+                } else if (op < 50) {
+                        // Root arguments, some past the shadowed ones
+                        int is_compute = test_random(&state) % 2;
+                        unsigned int index = test_random(&state) %
+                                (MAX_CMD_STATE_ROOT_PARAMS + 2);
+                        unsigned int size = sizes[(size_index + index) %
+                                size_count];
+                        int expected = 1;
+                        if (index < MAX_CMD_STATE_ROOT_PARAMS)
+                                expected = set_model_state(model,
+                                        (is_compute ?
+                                        CMD_STATE_COMPUTE_ROOT_PARAM :
+                                        CMD_STATE_GRAPHICS_ROOT_PARAM) +
+                                        index, value, size);
+                        else
+                                ++model->stats.issued_count;
+                        bad_count += filter_root_param_state(&state_info,
+                                is_compute, index, value, size) != expected;
+                } else {
+                        unsigned int s = test_random(&state) %
+                                CMD_STATE_COMPUTE_ROOT_PARAM;
+                        unsigned int size = sizes[(size_index + s) %
+                                size_count];
+                        int expected = set_model_state(model, s, value, size);
+                        bad_count += filter_cmd_state(&state_info, s, value,
+                                size) != expected;
+                }
+        }
+
+        CHECK(bad_count == 0);
+        CHECK(state_info.stats.issued_count == model->stats.issued_count);
+        CHECK(state_info.stats.elided_count == model->stats.elided_count);
+        // Enough sets repeat for both paths to be well covered
+        CHECK(model->stats.elided_count > RUN_LENGTH / 20);
+        CHECK(model->stats.issued_count > RUN_LENGTH / 2);
+
+        free(model);
+}
+
+int main(void)
+{
+        test_rec_sequences();
+        test_random_run(0x9e3779b97f4a7c15ull);
+        test_random_run(0xc2b2ae3d27d4eb4full);
+
+        return finish_test("cmd_state_test");
+}
@@ -0,0 +1,200 @@
+#include "cull_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Times culling random spheres against one camera, a set that stays in
+// cache and one that has to come from memory, on one thread against a
+// plain scalar loop and split across the job system. Build with -mavx2 in
+// CFLAGS to time the AVX path rather than the SSE one. Timings depend on
+// the machine and are only reported; the run fails when the batches and the
+// scalar loop disagree on a sphere clearly inside or outside the frustum.
+#define BENCH_SMALL_COUNT 200000
+#define BENCH_LARGE_COUNT 4000000
+#define BENCH_RUN_COUNT 9
+#define WORLD_SIZE 1000.0f
+#define MAX_RADIUS 20.0f
+#define BOUNDARY_EPSILON 0.01
+
+#if defined(__AVX2__)
+#define BENCH_PATH "avx2"
+#elif defined(__SSE2__)
+#define BENCH_PATH "sse"
+#else
+#define BENCH_PATH "scalar"
+#endif
+
+static unsigned int cull_scalar(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int *visible_indices)
+{
+        unsigned int visible_count = 0;
+        for (unsigned int i = 0; i < volume_info->count; ++i) {
+                int is_visible = 1;
+                for (int p = 0; p < 6 && is_visible; ++p) {
+                        float dist = planes->a[p] * volume_info->x[i] +
+                                planes->b[p] * volume_info->y[i] +
+                                planes->c[p] * volume_info->z[i] +
+                                planes->d[p];
+                        is_visible = dist > -volume_info->radius[i];
+                }
+
+                if (is_visible)
+                        visible_indices[visible_count++] = i;
+        }
+
+        return visible_count;
+}
+
+static double get_sphere_margin(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        double margin = INFINITY;
+        for (int p = 0; p < 6; ++p) {
+                double dist = (double) planes->a[p] * volume_info->x[i] +
+                        (double) planes->b[p] * volume_info->y[i] +
+                        (double) planes->c[p] * volume_info->z[i] +
+                        planes->d[p] + volume_info->radius[i];
+                if (dist < margin)
+                        margin = dist;
+        }
+
+        return margin;
+}
+
+// Spheres listed by only one of the two have to be on a plane
+static unsigned int count_mismatches(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info,
+        const unsigned int *visible_indices, unsigned int visible_count,
+        const unsigned int *scalar_indices, unsigned int scalar_count)
+{
+        unsigned int mismatch_count = 0;
+        unsigned int a = 0;
+        unsigned int b = 0;
+        while (a < visible_count || b < scalar_count) {
+                unsigned int index;
+                if (b == scalar_count || (a < visible_count &&
+                        visible_indices[a] < scalar_indices[b])) {
+                        index = visible_indices[a++];
+                } else if (a == visible_count ||
+                        scalar_indices[b] < visible_indices[a]) {
+                        index = scalar_indices[b++];
+                } else {
+                        ++a;
+                        ++b;
+                        continue;
+                }
+
+                mismatch_count += fabs(get_sphere_margin(planes, volume_info,
+                        index)) > BOUNDARY_EPSILON;
+        }
+
+        return mismatch_count;
+}
+
+static unsigned int bench_count(struct job_system_info *job_system,
+        struct frustum_planes *planes, unsigned int count)
+{
+        struct cull_volume_info volume_info;
+        memset(&volume_info, 0, sizeof (struct cull_volume_info));
+        volume_info.type = CULL_VOLUME_TYPE_SPHERE;
+        volume_info.capacity = count;
+        create_cull_volumes(&volume_info);
+
+        unsigned long long state = 0x2545f4914f6cdd1dull ^ count;
+        for (unsigned int i = 0; i < count; ++i) {
+                vec3 centre;
+                for (int k = 0; k < 3; ++k)
+                        centre[k] = test_random_float(&state, -WORLD_SIZE,
+                                WORLD_SIZE);
+                add_cull_sphere(&volume_info, centre, test_random_float(
+                        &state, 0.0f, MAX_RADIUS));
+        }
+
+        unsigned int *visible_indices = malloc(count *
+                sizeof (unsigned int));
+        unsigned int *scalar_indices = malloc(count * sizeof (unsigned int));
+
+        double best_times[3] = { 1e30, 1e30, 1e30 };
+        unsigned int visible_count = 0;
+        unsigned int parallel_count = 0;
+        unsigned int scalar_count = 0;
+        for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                double start_time = get_time_in_secs();
+                scalar_count = cull_scalar(planes, &volume_info,
+                        scalar_indices);
+                double scalar_time = get_time_in_secs();
+                visible_count = cull_volumes(NULL, planes, &volume_info,
+                        visible_indices);
+                double batch_time = get_time_in_secs();
+                parallel_count = cull_volumes(job_system, planes,
+                        &volume_info, visible_indices);
+                double parallel_time = get_time_in_secs();
+
+                double times[3] = {
+                        scalar_time - start_time, batch_time - scalar_time,
+                        parallel_time - batch_time
+                };
+                for (int t = 0; t < 3; ++t) {
+                        if (times[t] < best_times[t])
+                                best_times[t] = times[t];
+                }
+        }
+
+        unsigned int mismatch_count = parallel_count != visible_count;
+        mismatch_count += count_mismatches(planes, &volume_info,
+                visible_indices, parallel_count, scalar_indices,
+                scalar_count);
+
+        double scalar_ms = best_times[0] * 1000.0;
+        double batch_ms = best_times[1] * 1000.0;
+        double parallel_ms = best_times[2] * 1000.0;
+        printf("cull_bench: %u spheres, %u visible, %s %.3f ms "
+                "(%.2fM per ms, %.1fx scalar %.3f ms), %u workers %.3f ms\n",
+                count, visible_count, BENCH_PATH, batch_ms,
+                count / batch_ms / 1e6, scalar_ms / batch_ms, scalar_ms,
+                job_system->worker_count, parallel_ms);
+
+        free(scalar_indices);
+        free(visible_indices);
+        release_cull_volumes(&volume_info);
+
+        return mismatch_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        // Looking across the middle of the world, so a good part of the
+        // spheres is in view
+        vec3 eye = { 0.0f, 0.0f, -WORLD_SIZE };
+        vec3 center = { 0.0f, 0.0f, 0.0f };
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4 pv_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        mat4x4_perspective(projection_mat, 1.0f, 16.0f / 9.0f, 0.1f,
+                2.0f * WORLD_SIZE);
+        mat4x4_mul(pv_mat, projection_mat, view_mat);
+        struct frustum_planes planes;
+        extract_frustum_planes(pv_mat, &planes);
+
+        unsigned int mismatch_count = bench_count(&job_system, &planes,
+                BENCH_SMALL_COUNT);
+        mismatch_count += bench_count(&job_system, &planes,
+                BENCH_LARGE_COUNT);
+
+        release_job_system(&job_system);
+
+        if (mismatch_count > 0)
+                printf("cull_bench: %u spheres culled differently\n",
+                        mismatch_count);
+
+        return mismatch_count == 0 ? 0 : 1;
+}
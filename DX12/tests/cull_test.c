@@ -0,0 +1,184 @@
+#include "cull_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Checks the batched culling against a scalar reference in double precision,
+// and the multi view culling against culling each view on its own. The
+// batches add the plane terms in another order than the scalar tail, so
+// volumes within BOUNDARY_EPSILON of a plane may go either way. Build with
+// -mavx2 in CFLAGS to check the AVX path rather than the SSE one.
+#define VOLUME_COUNT 100000
+#define VIEW_COUNT 5
+#define WORLD_SIZE 1000.0f
+#define MAX_VOLUME_SIZE 20.0f
+#define BOUNDARY_EPSILON 0.01
+
+// Smallest distance of the volume inside any of the planes, above zero
+// when it is visible
+static double get_volume_margin(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int i)
+{
+        double margin = INFINITY;
+        for (int p = 0; p < 6; ++p) {
+                double dist = (double) planes->a[p] * volume_info->x[i] +
+                        (double) planes->b[p] * volume_info->y[i] +
+                        (double) planes->c[p] * volume_info->z[i] +
+                        planes->d[p];
+                if (volume_info->type == CULL_VOLUME_TYPE_SPHERE) {
+                        dist += volume_info->radius[i];
+                } else {
+                        dist += fabs(planes->a[p]) * volume_info->extent_x[i] +
+                                fabs(planes->b[p]) * volume_info->extent_y[i] +
+                                fabs(planes->c[p]) * volume_info->extent_z[i];
+                }
+
+                if (dist < margin)
+                        margin = dist;
+        }
+
+        return margin;
+}
+
+static void make_random_planes(unsigned long long *state,
+        struct frustum_planes *planes)
+{
+        vec3 eye;
+        vec3 center;
+        for (int k = 0; k < 3; ++k) {
+                eye[k] = test_random_float(state, -WORLD_SIZE, WORLD_SIZE);
+                center[k] = test_random_float(state, -WORLD_SIZE,
+                        WORLD_SIZE);
+        }
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4 pv_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        mat4x4_perspective(projection_mat, test_random_float(state, 0.2f,
+                1.5f), 16.0f / 9.0f, 0.1f, test_random_float(state, 100.0f,
+                2.0f * WORLD_SIZE));
+        mat4x4_mul(pv_mat, projection_mat, view_mat);
+        extract_frustum_planes(pv_mat, planes);
+}
+
+static void fill_volumes(unsigned long long *state,
+        struct cull_volume_info *volume_info, unsigned int count)
+{
+        for (unsigned int i = 0; i < count; ++i) {
+                vec3 centre;
+                vec3 extents;
+                for (int k = 0; k < 3; ++k) {
+                        centre[k] = test_random_float(state, -WORLD_SIZE,
+                                WORLD_SIZE);
+                        extents[k] = test_random_float(state, 0.0f,
+                                MAX_VOLUME_SIZE);
+                }
+
+                if (volume_info->type == CULL_VOLUME_TYPE_SPHERE)
+                        add_cull_sphere(volume_info, centre, extents[0]);
+                else
+                        add_cull_aabb(volume_info, centre, extents);
+        }
+}
+
+// The indices have to increase, and hold every volume clearly inside and
+// none clearly outside
+static void check_visible_indices(struct frustum_planes *planes,
+        struct cull_volume_info *volume_info, unsigned int *visible_indices,
+        unsigned int visible_count)
+{
+        CHECK(visible_count <= volume_info->count);
+
+        unsigned int next = 0;
+        for (unsigned int i = 0; i < volume_info->count; ++i) {
+                int is_listed = next < visible_count &&
+                        visible_indices[next] == i;
+                if (is_listed)
+                        ++next;
+
+                double margin = get_volume_margin(planes, volume_info, i);
+                if (margin > BOUNDARY_EPSILON)
+                        CHECK(is_listed);
+                else if (margin <= -BOUNDARY_EPSILON)
+                        CHECK(!is_listed);
+        }
+
+        CHECK(next == visible_count);
+}
+
+static void test_cull(struct job_system_info *job_system,
+        enum CULL_VOLUME_TYPE type, unsigned int count)
+{
+        unsigned long long state = 0x2545f4914f6cdd1dull ^ count ^
+                ((unsigned long long) type << 32);
+
+        struct cull_volume_info volume_info;
+        memset(&volume_info, 0, sizeof (struct cull_volume_info));
+        volume_info.type = type;
+        volume_info.capacity = count > 0 ? count : 1;
+        create_cull_volumes(&volume_info);
+        fill_volumes(&state, &volume_info, count);
+
+        unsigned int *visible_indices = malloc(volume_info.capacity *
+                sizeof (unsigned int));
+        unsigned int *view_indices = malloc(volume_info.capacity *
+                sizeof (unsigned int));
+        unsigned int *view_masks = malloc(volume_info.capacity *
+                sizeof (unsigned int));
+
+        struct frustum_planes planes[VIEW_COUNT];
+        unsigned int visible_counts[VIEW_COUNT];
+        for (int v = 0; v < VIEW_COUNT; ++v) {
+                make_random_planes(&state, &planes[v]);
+                visible_counts[v] = cull_volumes(job_system, &planes[v],
+                        &volume_info, visible_indices);
+                check_visible_indices(&planes[v], &volume_info,
+                        visible_indices, visible_counts[v]);
+        }
+
+        // Every view uses the same batches and tail as culling it alone
+        cull_volumes_multi_view(job_system, planes, VIEW_COUNT, &volume_info,
+                view_masks);
+        for (int v = 0; v < VIEW_COUNT; ++v) {
+                unsigned int visible_count = cull_volumes(job_system,
+                        &planes[v], &volume_info, visible_indices);
+                unsigned int view_count = get_view_visible_indices(
+                        view_masks, count, v, view_indices);
+                CHECK(view_count == visible_count);
+                if (view_count == visible_count)
+                        CHECK(memcmp(view_indices, visible_indices,
+                                view_count * sizeof (unsigned int)) == 0);
+        }
+        for (unsigned int i = 0; i < count; ++i)
+                CHECK(view_masks[i] >> VIEW_COUNT == 0);
+
+        free(view_masks);
+        free(view_indices);
+        free(visible_indices);
+        release_cull_volumes(&volume_info);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        // Counts below, at and past a batch, and past the size that is
+        // split across the job system
+        static const unsigned int counts[] = { 0, 1, 7, 8, 9, 1000, 1003,
+                VOLUME_COUNT, VOLUME_COUNT + 5 };
+        for (unsigned int c = 0; c < sizeof (counts) / sizeof (counts[0]);
+                ++c) {
+                test_cull(NULL, CULL_VOLUME_TYPE_SPHERE, counts[c]);
+                test_cull(&job_system, CULL_VOLUME_TYPE_SPHERE, counts[c]);
+                test_cull(NULL, CULL_VOLUME_TYPE_AABB, counts[c]);
+                test_cull(&job_system, CULL_VOLUME_TYPE_AABB, counts[c]);
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("cull_test");
+}
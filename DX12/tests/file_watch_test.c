@@ -0,0 +1,175 @@
+#include "file_watch_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Watches a temporary directory and checks that saves show up once each,
+// in subdirectories that were there from the start or created later, when
+// written in place or renamed into place, and that a directory removed and
+// created again is still watched. Paths too long to hand back are dropped
+// rather than cut short.
+#define MAX_TEST_CHANGES 16
+#define LONG_NAME_SIZE 250
+
+static char directory[] = "/tmp/file_watch_XXXXXX";
+
+static void get_path(char *path, const char *name)
+{
+        snprintf(path, MAX_WATCH_PATH * 2, "%s/%s", directory, name);
+}
+
+static void write_file(const char *name)
+{
+        char path[MAX_WATCH_PATH * 2];
+        get_path(path, name);
+        FILE *file = fopen(path, "wb");
+        CHECK(file != NULL);
+        if (file == NULL)
+                return;
+
+        fputs("float4 main() : SV_TARGET { return 0; }\n", file);
+        fclose(file);
+}
+
+static void remove_file(const char *name)
+{
+        char path[MAX_WATCH_PATH * 2];
+        get_path(path, name);
+        CHECK(unlink(path) == 0);
+}
+
+static void make_directory(const char *name)
+{
+        char path[MAX_WATCH_PATH * 2];
+        get_path(path, name);
+        CHECK(mkdir(path, 0700) == 0);
+}
+
+static void remove_directory(const char *name)
+{
+        char path[MAX_WATCH_PATH * 2];
+        get_path(path, name);
+        CHECK(rmdir(path) == 0);
+}
+
+static int has_change(char (*changed_paths)[MAX_WATCH_PATH],
+        unsigned int change_count, const char *name)
+{
+        char path[MAX_WATCH_PATH * 2];
+        get_path(path, name);
+        for (unsigned int i = 0; i < change_count; ++i) {
+                if (strcmp(changed_paths[i], path) == 0)
+                        return 1;
+        }
+
+        return 0;
+}
+
+int main(void)
+{
+        CHECK(mkdtemp(directory) != NULL);
+        make_directory("lighting");
+
+        struct file_watch_info watch_info;
+        memset(&watch_info, 0, sizeof (struct file_watch_info));
+        strcpy(watch_info.directory, directory);
+        create_file_watch(&watch_info);
+
+        char changed_paths[MAX_TEST_CHANGES][MAX_WATCH_PATH];
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+
+        // Editors write a file several times per save, it is reported once.
+        // inotify already merges writes in a row, so another comes between.
+        write_file("mesh.hlsl");
+        write_file("common.hlsli");
+        write_file("mesh.hlsl");
+        unsigned int change_count = poll_file_watch(&watch_info,
+                changed_paths, MAX_TEST_CHANGES);
+        CHECK(change_count == 2);
+        CHECK(has_change(changed_paths, change_count, "mesh.hlsl"));
+        CHECK(has_change(changed_paths, change_count, "common.hlsli"));
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+
+        write_file("lighting/brdf.hlsli");
+        change_count = poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES);
+        CHECK(change_count == 1);
+        CHECK(has_change(changed_paths, change_count,
+                "lighting/brdf.hlsli"));
+
+        // A directory made after the watch started is watched from the
+        // next poll on
+        make_directory("post");
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+        write_file("post/blur.hlsl");
+        change_count = poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES);
+        CHECK(change_count == 1);
+        CHECK(has_change(changed_paths, change_count, "post/blur.hlsl"));
+
+        // Saving to a temporary file and renaming it over the old one
+        write_file("lighting/.light.tmp");
+        char from_path[MAX_WATCH_PATH * 2];
+        char to_path[MAX_WATCH_PATH * 2];
+        get_path(from_path, "lighting/.light.tmp");
+        get_path(to_path, "lighting/light.hlsli");
+        CHECK(rename(from_path, to_path) == 0);
+        change_count = poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES);
+        CHECK(has_change(changed_paths, change_count,
+                "lighting/light.hlsli"));
+
+        // No more than max_changes are handed back
+        static const char *names[] = {
+                "a.hlsl", "b.hlsl", "c.hlsl", "d.hlsl", "e.hlsl"
+        };
+        for (unsigned int i = 0; i < 5; ++i)
+                write_file(names[i]);
+        change_count = poll_file_watch(&watch_info, changed_paths, 2);
+        CHECK(change_count == 2);
+        CHECK(has_change(changed_paths, change_count, names[0]));
+        CHECK(has_change(changed_paths, change_count, names[1]));
+
+        // Too long to fit with the directory in front
+        char long_name[LONG_NAME_SIZE + 1];
+        memset(long_name, 'x', LONG_NAME_SIZE);
+        long_name[LONG_NAME_SIZE] = '\0';
+        write_file(long_name);
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+
+        // A directory removed and made again
+        remove_file("post/blur.hlsl");
+        remove_directory("post");
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+        make_directory("post");
+        CHECK(poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES) == 0);
+        write_file("post/tonemap.hlsl");
+        change_count = poll_file_watch(&watch_info, changed_paths,
+                MAX_TEST_CHANGES);
+        CHECK(change_count == 1);
+        CHECK(has_change(changed_paths, change_count, "post/tonemap.hlsl"));
+
+        release_file_watch(&watch_info);
+
+        remove_file("post/tonemap.hlsl");
+        remove_directory("post");
+        remove_file("lighting/brdf.hlsli");
+        remove_file("lighting/light.hlsli");
+        remove_directory("lighting");
+        remove_file("mesh.hlsl");
+        remove_file("common.hlsli");
+        for (unsigned int i = 0; i < 5; ++i)
+                remove_file(names[i]);
+        remove_file(long_name);
+        CHECK(rmdir(directory) == 0);
+
+        return finish_test("file_watch_test");
+}
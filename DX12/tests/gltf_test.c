@@ -0,0 +1,458 @@
+#include "gltf_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// Writes a small scene as a .glb with its buffer embedded and as a .gltf
+// with the buffer next to it, and checks the vertices, indices, materials
+// and node hierarchy that come back. Positions and uvs share a buffer view
+// with a byteStride, 16 bit indices are widened and 32 bit ones used in
+// place. A scene with many nodes checks the hierarchy at size, and damaged
+// files have to be refused.
+#define SCENE_VERTEX_COUNT 4
+#define SCENE_INDEX_COUNT 6
+#define VERTEX_STRIDE 20
+#define BIG_NODE_COUNT 20000
+#define MAX_JSON_SIZE 4096
+
+// The buffer views: positions and uvs interleaved, 16 bit indices, 32 bit
+// indices and byte colours
+#define INDEX_16_OFFSET (SCENE_VERTEX_COUNT * VERTEX_STRIDE)
+#define INDEX_32_OFFSET (INDEX_16_OFFSET + SCENE_INDEX_COUNT * 2)
+#define COLOUR_OFFSET (INDEX_32_OFFSET + SCENE_INDEX_COUNT * 4)
+#define BUFFER_SIZE (COLOUR_OFFSET + SCENE_VERTEX_COUNT * 4)
+
+static const float positions[SCENE_VERTEX_COUNT][3] = {
+        { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f },
+        { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.5f }
+};
+static const float uvs[SCENE_VERTEX_COUNT][2] = {
+        { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f }
+};
+static const unsigned char colours[SCENE_VERTEX_COUNT][4] = {
+        { 255, 0, 0, 255 }, { 0, 255, 0, 255 },
+        { 0, 0, 255, 255 }, { 51, 102, 153, 0 }
+};
+static const unsigned int indices[SCENE_INDEX_COUNT] = { 0, 1, 2, 0, 2, 3 };
+
+static char directory[] = "/tmp/gltf_XXXXXX";
+
+static void get_path(char *path, const char *name)
+{
+        snprintf(path, MAX_GLTF_PATH, "%s/%s", directory, name);
+}
+
+static void fill_buffer(unsigned char *buffer)
+{
+        for (unsigned int v = 0; v < SCENE_VERTEX_COUNT; ++v) {
+                memcpy(buffer + v * VERTEX_STRIDE, positions[v],
+                        sizeof (positions[v]));
+                memcpy(buffer + v * VERTEX_STRIDE + 12, uvs[v],
+                        sizeof (uvs[v]));
+                memcpy(buffer + COLOUR_OFFSET + v * 4, colours[v], 4);
+        }
+
+        for (unsigned int i = 0; i < SCENE_INDEX_COUNT; ++i) {
+                unsigned short index_16 = (unsigned short) indices[i];
+                memcpy(buffer + INDEX_16_OFFSET + i * 2, &index_16, 2);
+                memcpy(buffer + INDEX_32_OFFSET + i * 4, &indices[i], 4);
+        }
+}
+
+// Node 0 is the root of the scene with nodes 1 and 2 under it, and node 3
+// under node 2. Node 4 has a mesh but is not in the scene.
+static unsigned int write_scene_json(char *json, const char *buffer_uri)
+{
+        char uri[MAX_GLTF_PATH];
+        uri[0] = '\0';
+        if (buffer_uri != NULL)
+                snprintf(uri, sizeof (uri), "\"uri\": \"%s\", ", buffer_uri);
+
+        return (unsigned int) snprintf(json, MAX_JSON_SIZE,
+                "{\"asset\": {\"version\": \"2.0\"},\n"
+                " \"scene\": 0, \"scenes\": [{\"nodes\": [0]}],\n"
+                " \"nodes\": [\n"
+                "  {\"children\": [1, 2], \"translation\": [1, 2, 3]},\n"
+                "  {\"mesh\": 0, \"scale\": [2, 2, 2]},\n"
+                "  {\"children\": [3],\n"
+                "   \"rotation\": [0, 0, 0.70710678, 0.70710678]},\n"
+                "  {\"mesh\": 1, \"matrix\": [3, 0, 0, 0, 0, 1, 0, 0,\n"
+                "   0, 0, 1, 0, 4, 5, 6, 1]},\n"
+                "  {\"mesh\": 0}],\n"
+                " \"meshes\": [\n"
+                "  {\"primitives\": [{\"attributes\": {\"POSITION\": 0,\n"
+                "   \"TEXCOORD_0\": 1, \"COLOR_0\": 4}, \"indices\": 2,\n"
+                "   \"material\": 0}]},\n"
+                "  {\"primitives\": [{\"attributes\": {\"POSITION\": 0},\n"
+                "   \"indices\": 3}, {\"attributes\": {\"POSITION\": 0},\n"
+                "   \"mode\": 0}]}],\n"
+                " \"materials\": [{\"pbrMetallicRoughness\": {\n"
+                "  \"baseColorFactor\": [0.5, 0.25, 1, 1],\n"
+                "  \"metallicFactor\": 0, \"roughnessFactor\": 0.5},\n"
+                "  \"doubleSided\": true}],\n"
+                " \"accessors\": [\n"
+                "  {\"bufferView\": 0, \"componentType\": 5126,\n"
+                "   \"count\": %u, \"type\": \"VEC3\"},\n"
+                "  {\"bufferView\": 0, \"byteOffset\": 12,\n"
+                "   \"componentType\": 5126, \"count\": %u,\n"
+                "   \"type\": \"VEC2\"},\n"
+                "  {\"bufferView\": 1, \"componentType\": 5123,\n"
+                "   \"count\": %u, \"type\": \"SCALAR\"},\n"
+                "  {\"bufferView\": 2, \"componentType\": 5125,\n"
+                "   \"count\": %u, \"type\": \"SCALAR\"},\n"
+                "  {\"bufferView\": 3, \"componentType\": 5121,\n"
+                "   \"normalized\": true, \"count\": %u,\n"
+                "   \"type\": \"VEC4\"}],\n"
+                " \"bufferViews\": [\n"
+                "  {\"buffer\": 0, \"byteLength\": %u,\n"
+                "   \"byteStride\": %u},\n"
+                "  {\"buffer\": 0, \"byteOffset\": %u, \"byteLength\": %u},\n"
+                "  {\"buffer\": 0, \"byteOffset\": %u, \"byteLength\": %u},\n"
+                "  {\"buffer\": 0, \"byteOffset\": %u, \"byteLength\": %u}],\n"
+                " \"buffers\": [{%s\"byteLength\": %u}]}\n",
+                SCENE_VERTEX_COUNT, SCENE_VERTEX_COUNT, SCENE_INDEX_COUNT,
+                SCENE_INDEX_COUNT, SCENE_VERTEX_COUNT,
+                INDEX_16_OFFSET, VERTEX_STRIDE, INDEX_16_OFFSET,
+                SCENE_INDEX_COUNT * 2, INDEX_32_OFFSET, SCENE_INDEX_COUNT * 4,
+                COLOUR_OFFSET, SCENE_VERTEX_COUNT * 4, uri, BUFFER_SIZE);
+}
+
+static void write_u32(FILE *file, unsigned int value)
+{
+        unsigned char bytes[4] = {
+                value & 0xff, value >> 8 & 0xff, value >> 16 & 0xff,
+                value >> 24
+        };
+        fwrite(bytes, 1, 4, file);
+}
+
+// The JSON chunk is padded with spaces and the binary one with zeros, as
+// the format asks. A length past the end of the file makes it damaged.
+static void write_glb(const char *path, const char *json,
+        unsigned int json_size, const unsigned char *bin,
+        unsigned int bin_size, unsigned int extra_length)
+{
+        unsigned int json_chunk_size = (json_size + 3) & ~3u;
+        unsigned int bin_chunk_size = (bin_size + 3) & ~3u;
+        FILE *file = fopen(path, "wb");
+        CHECK(file != NULL);
+        if (file == NULL)
+                return;
+
+        write_u32(file, 0x46546c67);
+        write_u32(file, 2);
+        write_u32(file, 12 + 8 + json_chunk_size + 8 + bin_chunk_size +
+                extra_length);
+        write_u32(file, json_chunk_size);
+        write_u32(file, 0x4e4f534a);
+        fwrite(json, 1, json_size, file);
+        for (unsigned int i = json_size; i < json_chunk_size; ++i)
+                fputc(' ', file);
+        write_u32(file, bin_chunk_size);
+        write_u32(file, 0x004e4942);
+        fwrite(bin, 1, bin_size, file);
+        for (unsigned int i = bin_size; i < bin_chunk_size; ++i)
+                fputc(0, file);
+        fclose(file);
+}
+
+static void write_file(const char *path, const void *data, unsigned int size)
+{
+        FILE *file = fopen(path, "wb");
+        CHECK(file != NULL);
+        if (file == NULL)
+                return;
+
+        fwrite(data, 1, size, file);
+        fclose(file);
+}
+
+static int is_near(float a, float b)
+{
+        return a - b < 1e-5f && b - a < 1e-5f;
+}
+
+static void check_vertices(struct mesh_info *mi, int has_attributes)
+{
+        CHECK(mi->vertex_count == SCENE_VERTEX_COUNT);
+        if (mi->vertex_count != SCENE_VERTEX_COUNT)
+                return;
+
+        unsigned int bad_count = 0;
+        for (unsigned int v = 0; v < SCENE_VERTEX_COUNT; ++v) {
+                struct vertex *vertex = &mi->verticies[v];
+                for (int k = 0; k < 3; ++k)
+                        bad_count += vertex->position[k] != positions[v][k];
+                bad_count += vertex->position[3] != 1.0f;
+
+                // Without the attributes colours are white and uvs zero
+                for (int k = 0; k < 2; ++k)
+                        bad_count += vertex->uv[k] != (has_attributes ?
+                                uvs[v][k] : 0.0f);
+                for (int k = 0; k < 4; ++k)
+                        bad_count += !is_near(vertex->colour[k],
+                                has_attributes ? colours[v][k] / 255.0f :
+                                1.0f);
+        }
+
+        CHECK(bad_count == 0);
+}
+
+static void check_indices(struct mesh_info *mi)
+{
+        CHECK(mi->index_count == SCENE_INDEX_COUNT);
+        CHECK(mi->lod_count == 1);
+        CHECK(mi->lods[0].index_count == mi->index_count);
+        if (mi->index_count == SCENE_INDEX_COUNT)
+                CHECK(memcmp(mi->indices, indices, sizeof (indices)) == 0);
+}
+
+static void check_vec(const float *v, float x, float y, float z)
+{
+        CHECK(is_near(v[0], x) && is_near(v[1], y) && is_near(v[2], z));
+}
+
+static void check_scene(struct gltf_info *gltf_info,
+        struct transform_info *transform_info)
+{
+        CHECK(gltf_info->mesh_count == 2);
+        CHECK(gltf_info->primitive_count == 2);
+        CHECK(gltf_info->stats.skipped_primitive_count == 1);
+        if (gltf_info->mesh_count != 2 || gltf_info->primitive_count != 2)
+                return;
+
+        CHECK(gltf_info->meshes[0].first_primitive == 0);
+        CHECK(gltf_info->meshes[0].primitive_count == 1);
+        CHECK(gltf_info->meshes[1].first_primitive == 1);
+        CHECK(gltf_info->meshes[1].primitive_count == 1);
+
+        // The 16 bit indices are widened, the 32 bit ones used in place
+        struct gltf_primitive *primitive = &gltf_info->primitives[0];
+        check_vertices(&primitive->mesh, 1);
+        check_indices(&primitive->mesh);
+        CHECK(primitive->owns_indices);
+        CHECK(primitive->material == 0);
+        primitive = &gltf_info->primitives[1];
+        check_vertices(&primitive->mesh, 0);
+        check_indices(&primitive->mesh);
+        CHECK(!primitive->owns_indices);
+        CHECK(primitive->material == GLTF_NONE);
+        CHECK(gltf_info->stats.in_place_accessor_count == 1);
+
+        CHECK(gltf_info->material_count == 1);
+        if (gltf_info->material_count == 1) {
+                struct gltf_material *material = &gltf_info->materials[0];
+                CHECK(material->base_colour[0] == 0.5f);
+                CHECK(material->base_colour[1] == 0.25f);
+                CHECK(material->metallic == 0.0f);
+                CHECK(material->roughness == 0.5f);
+                CHECK(material->is_double_sided);
+                CHECK(material->base_colour_image == GLTF_NONE);
+        }
+
+        CHECK(gltf_info->node_count == 5);
+        CHECK(gltf_info->instance_count == 2);
+        CHECK(transform_info->count == 4);
+        if (gltf_info->node_count != 5 || transform_info->count != 4)
+                return;
+
+        unsigned int *node_transforms = gltf_info->node_transforms;
+        CHECK(node_transforms[4] == GLTF_NONE);
+        for (unsigned int n = 0; n < 4; ++n)
+                CHECK(node_transforms[n] < transform_info->count);
+        if (node_transforms[0] >= transform_info->count ||
+                node_transforms[1] >= transform_info->count ||
+                node_transforms[2] >= transform_info->count ||
+                node_transforms[3] >= transform_info->count)
+                return;
+
+        unsigned int *parents = transform_info->parents;
+        CHECK(parents[node_transforms[0]] == TRANSFORM_NO_PARENT);
+        CHECK(parents[node_transforms[1]] == node_transforms[0]);
+        CHECK(parents[node_transforms[2]] == node_transforms[0]);
+        CHECK(parents[node_transforms[3]] == node_transforms[2]);
+
+        check_vec(transform_info->positions[node_transforms[0]],
+                1.0f, 2.0f, 3.0f);
+        check_vec(transform_info->scales[node_transforms[1]],
+                2.0f, 2.0f, 2.0f);
+        CHECK(is_near(transform_info->rotations[node_transforms[2]][2],
+                0.70710678f));
+        // The matrix is split into translation, rotation and scale
+        check_vec(transform_info->positions[node_transforms[3]],
+                4.0f, 5.0f, 6.0f);
+        check_vec(transform_info->scales[node_transforms[3]],
+                3.0f, 1.0f, 1.0f);
+        CHECK(is_near(transform_info->rotations[node_transforms[3]][3],
+                1.0f));
+
+        // Each placed mesh once, with the transform of its node
+        unsigned int found = 0;
+        for (unsigned int i = 0; i < gltf_info->instance_count; ++i) {
+                struct gltf_instance *instance = &gltf_info->instances[i];
+                if (instance->mesh == 0 &&
+                        instance->transform == node_transforms[1])
+                        found |= 1;
+                if (instance->mesh == 1 &&
+                        instance->transform == node_transforms[3])
+                        found |= 2;
+        }
+        CHECK(found == 3);
+}
+
+static int load_scene(const char *path, struct job_system_info *job_system,
+        struct transform_info *transform_info, struct gltf_info *gltf_info)
+{
+        memset(gltf_info, 0, sizeof (struct gltf_info));
+        strcpy(gltf_info->path, path);
+        gltf_info->job_system = job_system;
+        gltf_info->transform_info = transform_info;
+        transform_info->count = 0;
+
+        return load_gltf(gltf_info);
+}
+
+static void test_scene(struct job_system_info *job_system)
+{
+        unsigned char buffer[BUFFER_SIZE];
+        fill_buffer(buffer);
+
+        struct transform_info transform_info;
+        memset(&transform_info, 0, sizeof (struct transform_info));
+        transform_info.capacity = 16;
+        create_transforms(&transform_info);
+
+        // The .glb, from the job system and without it
+        char json[MAX_JSON_SIZE];
+        char glb_path[MAX_GLTF_PATH];
+        get_path(glb_path, "scene.glb");
+        unsigned int json_size = write_scene_json(json, NULL);
+        write_glb(glb_path, json, json_size, buffer, BUFFER_SIZE, 0);
+
+        struct gltf_info gltf_info;
+        CHECK(load_scene(glb_path, job_system, &transform_info, &gltf_info));
+        check_scene(&gltf_info, &transform_info);
+        release_gltf(&gltf_info);
+        CHECK(load_scene(glb_path, NULL, &transform_info, &gltf_info));
+        check_scene(&gltf_info, &transform_info);
+        release_gltf(&gltf_info);
+
+        // The .gltf, with its buffer in a file of its own
+        char gltf_path[MAX_GLTF_PATH];
+        char bin_path[MAX_GLTF_PATH];
+        get_path(gltf_path, "scene.gltf");
+        get_path(bin_path, "scene.bin");
+        json_size = write_scene_json(json, "scene.bin");
+        write_file(gltf_path, json, json_size);
+        write_file(bin_path, buffer, BUFFER_SIZE);
+        CHECK(load_scene(gltf_path, job_system, &transform_info,
+                &gltf_info));
+        check_scene(&gltf_info, &transform_info);
+        release_gltf(&gltf_info);
+
+        // An index past the vertices, a GLB longer than its file, a buffer
+        // missing and JSON cut short are all refused
+        buffer[INDEX_16_OFFSET] = SCENE_VERTEX_COUNT;
+        json_size = write_scene_json(json, NULL);
+        write_glb(glb_path, json, json_size, buffer, BUFFER_SIZE, 0);
+        CHECK(!load_scene(glb_path, job_system, &transform_info,
+                &gltf_info));
+        buffer[INDEX_16_OFFSET] = 0;
+        write_glb(glb_path, json, json_size, buffer, BUFFER_SIZE, 4);
+        CHECK(!load_scene(glb_path, job_system, &transform_info,
+                &gltf_info));
+        CHECK(unlink(bin_path) == 0);
+        CHECK(!load_scene(gltf_path, job_system, &transform_info,
+                &gltf_info));
+        json_size = write_scene_json(json, "scene.bin");
+        write_file(bin_path, buffer, BUFFER_SIZE);
+        write_file(gltf_path, json, json_size / 2);
+        CHECK(!load_scene(gltf_path, job_system, &transform_info,
+                &gltf_info));
+
+        CHECK(unlink(glb_path) == 0);
+        CHECK(unlink(gltf_path) == 0);
+        CHECK(unlink(bin_path) == 0);
+        release_transforms(&transform_info);
+}
+
+// A binary tree of nodes listed in reverse, so children come before their
+// parents in the file, each moved along x by its index
+static void test_big_scene(void)
+{
+        unsigned int json_capacity = BIG_NODE_COUNT * 64 + 256;
+        char *json = malloc(json_capacity);
+        unsigned int size = (unsigned int) snprintf(json, json_capacity,
+                "{\"asset\": {\"version\": \"2.0\"}, \"scenes\": "
+                "[{\"nodes\": [%u]}], \"nodes\": [", BIG_NODE_COUNT - 1);
+        for (unsigned int i = 0; i < BIG_NODE_COUNT; ++i) {
+                unsigned int n = BIG_NODE_COUNT - 1 - i;
+                size += (unsigned int) snprintf(json + size,
+                        json_capacity - size, "%s{\"translation\": [%u, 0, "
+                        "0], \"children\": [", i == 0 ? "" : ",", n);
+                for (unsigned int c = 2 * n + 1; c <= 2 * n + 2 &&
+                        c < BIG_NODE_COUNT; ++c)
+                        size += (unsigned int) snprintf(json + size,
+                                json_capacity - size, "%s%u",
+                                c == 2 * n + 1 ? "" : ", ",
+                                BIG_NODE_COUNT - 1 - c);
+                size += (unsigned int) snprintf(json + size,
+                        json_capacity - size, "]}");
+        }
+        size += (unsigned int) snprintf(json + size, json_capacity - size,
+                "]}");
+
+        char path[MAX_GLTF_PATH];
+        get_path(path, "big.gltf");
+        write_file(path, json, size);
+        free(json);
+
+        struct transform_info transform_info;
+        memset(&transform_info, 0, sizeof (struct transform_info));
+        transform_info.capacity = BIG_NODE_COUNT;
+        create_transforms(&transform_info);
+
+        struct gltf_info gltf_info;
+        CHECK(load_scene(path, NULL, &transform_info, &gltf_info));
+        CHECK(gltf_info.node_count == BIG_NODE_COUNT);
+        CHECK(transform_info.count == BIG_NODE_COUNT);
+
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < gltf_info.node_count &&
+                transform_info.count == BIG_NODE_COUNT; ++i) {
+                unsigned int n = BIG_NODE_COUNT - 1 - i;
+                unsigned int transform = gltf_info.node_transforms[i];
+                unsigned int parent = n == 0 ? TRANSFORM_NO_PARENT :
+                        gltf_info.node_transforms[BIG_NODE_COUNT - 1 -
+                        (n - 1) / 2];
+                if (transform >= transform_info.count) {
+                        ++bad_count;
+                        continue;
+                }
+
+                bad_count += transform_info.parents[transform] != parent ||
+                        transform_info.positions[transform][0] != (float) n;
+        }
+        CHECK(bad_count == 0);
+
+        release_gltf(&gltf_info);
+        release_transforms(&transform_info);
+        CHECK(unlink(path) == 0);
+}
+
+int main(void)
+{
+        CHECK(mkdtemp(directory) != NULL);
+
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        test_scene(&job_system);
+        test_big_scene();
+
+        release_job_system(&job_system);
+        CHECK(rmdir(directory) == 0);
+
+        return finish_test("gltf_test");
+}
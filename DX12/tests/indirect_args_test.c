@@ -0,0 +1,260 @@
+#include "indirect_args_interface.h"
+#include "test_util.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+// Checks the argument structs against the sizes of the D3D12 ones, the
+// layout of a record like the draw queue's, and random layouts against the
+// rules a command signature has to follow. Every valid layout is packed into
+// a buffer of records and read back at offsets summed up here.
+#define LAYOUT_COUNT 20000
+#define RECORD_COUNT 257
+#define SENTINEL 0xa5
+
+static void test_arg_structs(void)
+{
+        // D3D12_DRAW_INDEXED_ARGUMENTS is five 32 bit values, the buffer
+        // views a GPU address then two 32 bit values
+        CHECK(sizeof (struct indirect_draw_indexed_args) == 20);
+        CHECK(offsetof(struct indirect_draw_indexed_args, base_vertex) == 12);
+        CHECK(offsetof(struct indirect_draw_indexed_args, start_instance) ==
+                16);
+        CHECK(sizeof (struct indirect_buffer_view_args) == 16);
+        CHECK(offsetof(struct indirect_buffer_view_args, size) == 8);
+        CHECK(offsetof(struct indirect_buffer_view_args, stride_or_format) ==
+                12);
+
+        struct indirect_arg_desc arg_desc;
+        memset(&arg_desc, 0, sizeof (struct indirect_arg_desc));
+        arg_desc.type = INDIRECT_ARG_TYPE_DRAW_INDEXED;
+        CHECK(get_indirect_arg_size(&arg_desc) == 20);
+        arg_desc.type = INDIRECT_ARG_TYPE_VERTEX_BUFFER;
+        CHECK(get_indirect_arg_size(&arg_desc) == 16);
+        arg_desc.type = INDIRECT_ARG_TYPE_INDEX_BUFFER;
+        CHECK(get_indirect_arg_size(&arg_desc) == 16);
+        arg_desc.type = INDIRECT_ARG_TYPE_ROOT_CONSTANTS;
+        arg_desc.num_constants = 5;
+        CHECK(get_indirect_arg_size(&arg_desc) == 20);
+}
+
+// Root constants, vertex and instance buffers, the index buffer and the
+// draw, as the draw queue records them
+static void test_draw_queue_layout(void)
+{
+        struct indirect_layout_info layout_info;
+        memset(&layout_info, 0, sizeof (struct indirect_layout_info));
+        layout_info.arg_count = 5;
+        layout_info.args[0].type = INDIRECT_ARG_TYPE_ROOT_CONSTANTS;
+        layout_info.args[0].root_param_index = 1;
+        layout_info.args[0].num_constants = 4;
+        layout_info.args[1].type = INDIRECT_ARG_TYPE_VERTEX_BUFFER;
+        layout_info.args[1].slot = 0;
+        layout_info.args[2].type = INDIRECT_ARG_TYPE_VERTEX_BUFFER;
+        layout_info.args[2].slot = 1;
+        layout_info.args[3].type = INDIRECT_ARG_TYPE_INDEX_BUFFER;
+        layout_info.args[4].type = INDIRECT_ARG_TYPE_DRAW_INDEXED;
+
+        CHECK(build_indirect_layout(&layout_info) ==
+                INDIRECT_LAYOUT_ERROR_NONE);
+        CHECK(layout_info.offsets[0] == 0);
+        CHECK(layout_info.offsets[1] == 16);
+        CHECK(layout_info.offsets[2] == 32);
+        CHECK(layout_info.offsets[3] == 48);
+        CHECK(layout_info.offsets[4] == 64);
+        CHECK(layout_info.stride == 84);
+
+        // Too many arguments is refused before any of them is looked at
+        layout_info.arg_count = MAX_INDIRECT_ARGS + 1;
+        CHECK(build_indirect_layout(&layout_info) ==
+                INDIRECT_LAYOUT_ERROR_TOO_MANY_ARGS);
+        layout_info.arg_count = 0;
+        CHECK(build_indirect_layout(&layout_info) ==
+                INDIRECT_LAYOUT_ERROR_NO_DRAW);
+}
+
+// Sizes of the D3D12 arguments, worked out here rather than taken from
+// get_indirect_arg_size
+static unsigned int get_expected_arg_size(
+        const struct indirect_arg_desc *arg_desc)
+{
+        if (arg_desc->type == INDIRECT_ARG_TYPE_DRAW_INDEXED)
+                return 5 * 4;
+        if (arg_desc->type == INDIRECT_ARG_TYPE_ROOT_CONSTANTS)
+                return arg_desc->num_constants * 4;
+
+        return 8 + 2 * 4;
+}
+
+static void random_layout(unsigned long long *state,
+        struct indirect_layout_info *layout_info)
+{
+        memset(layout_info, 0, sizeof (struct indirect_layout_info));
+        layout_info->arg_count = 1 + test_random(state) % MAX_INDIRECT_ARGS;
+
+        // Few root parameters and slots, so they are often repeated
+        for (unsigned int i = 0; i < layout_info->arg_count; ++i) {
+                struct indirect_arg_desc *arg_desc = &layout_info->args[i];
+                arg_desc->type = (enum INDIRECT_ARG_TYPE)
+                        (1 + test_random(state) % 3);
+                arg_desc->root_param_index = test_random(state) % 4;
+                arg_desc->num_constants = test_random(state) % 9 == 0 ? 0 :
+                        1 + test_random(state) % 8;
+                arg_desc->slot = test_random(state) % 4;
+        }
+
+        // The draw mostly where it belongs, sometimes twice, elsewhere or
+        // left out
+        unsigned int draw_roll = test_random(state) % 10;
+        if (draw_roll < 8)
+                layout_info->args[layout_info->arg_count - 1].type =
+                        INDIRECT_ARG_TYPE_DRAW_INDEXED;
+        if (draw_roll == 7 || draw_roll == 8)
+                layout_info->args[test_random(state) %
+                        layout_info->arg_count].type =
+                        INDIRECT_ARG_TYPE_DRAW_INDEXED;
+}
+
+// Every rule the layout breaks, one bit per error
+static unsigned int get_layout_violations(
+        const struct indirect_layout_info *layout_info)
+{
+        unsigned int violations = 0;
+        unsigned int count = layout_info->arg_count;
+        unsigned int draw_count = 0;
+        unsigned int index_buffer_count = 0;
+
+        for (unsigned int i = 0; i < count; ++i) {
+                const struct indirect_arg_desc *a = &layout_info->args[i];
+                draw_count += a->type == INDIRECT_ARG_TYPE_DRAW_INDEXED;
+                index_buffer_count += a->type ==
+                        INDIRECT_ARG_TYPE_INDEX_BUFFER;
+                if (a->type == INDIRECT_ARG_TYPE_ROOT_CONSTANTS &&
+                        a->num_constants == 0)
+                        violations |= 1u << INDIRECT_LAYOUT_ERROR_NO_CONSTANTS;
+
+                for (unsigned int j = i + 1; j < count; ++j) {
+                        const struct indirect_arg_desc *b =
+                                &layout_info->args[j];
+                        int is_root = a->type ==
+                                INDIRECT_ARG_TYPE_ROOT_CONSTANTS;
+                        enum INDIRECT_LAYOUT_ERROR error = is_root ?
+                                INDIRECT_LAYOUT_ERROR_DUPLICATE_ROOT_PARAM :
+                                INDIRECT_LAYOUT_ERROR_DUPLICATE_VERTEX_SLOT;
+                        if (a->type == b->type && ((is_root &&
+                                a->root_param_index == b->root_param_index) ||
+                                (a->type == INDIRECT_ARG_TYPE_VERTEX_BUFFER &&
+                                a->slot == b->slot)))
+                                violations |= 1u << error;
+                }
+        }
+
+        if (draw_count == 0)
+                violations |= 1u << INDIRECT_LAYOUT_ERROR_NO_DRAW;
+        else if (draw_count > 1 || layout_info->args[count - 1].type !=
+                INDIRECT_ARG_TYPE_DRAW_INDEXED)
+                violations |= 1u << INDIRECT_LAYOUT_ERROR_DRAW_NOT_LAST;
+        if (index_buffer_count > 1)
+                violations |= 1u <<
+                        INDIRECT_LAYOUT_ERROR_DUPLICATE_INDEX_BUFFER;
+
+        return violations;
+}
+
+// Fills RECORD_COUNT records through pack_indirect_arg and reads them back,
+// with the bytes after the last record left alone
+static unsigned int check_packing(unsigned long long *state,
+        const struct indirect_layout_info *layout_info)
+{
+        unsigned int size = RECORD_COUNT * layout_info->stride;
+        unsigned char *args_data = malloc(size + 64);
+        unsigned char *expected = malloc(size + 64);
+        memset(args_data, SENTINEL, size + 64);
+        memset(expected, SENTINEL, size + 64);
+
+        for (unsigned int r = 0; r < RECORD_COUNT; ++r) {
+                void *record = get_indirect_record(layout_info, args_data, r);
+                unsigned int offset = r * layout_info->stride;
+                for (unsigned int i = 0; i < layout_info->arg_count; ++i) {
+                        unsigned int value[16];
+                        for (unsigned int k = 0; k < 16; ++k)
+                                value[k] = (unsigned int) test_random(state);
+
+                        unsigned int arg_size = get_expected_arg_size(
+                                &layout_info->args[i]);
+                        pack_indirect_arg(layout_info, record, i, value);
+                        memcpy(expected + offset, value, arg_size);
+                        offset += arg_size;
+                }
+        }
+
+        unsigned int bad_count = memcmp(args_data, expected, size + 64) != 0;
+
+        free(expected);
+        free(args_data);
+
+        return bad_count;
+}
+
+static void test_random_layouts(void)
+{
+        unsigned long long state = 0x5851f42d4c957f2dull;
+        unsigned int valid_count = 0;
+        unsigned int bad_count = 0;
+        unsigned int violation_seen = 0;
+
+        for (unsigned int n = 0; n < LAYOUT_COUNT; ++n) {
+                struct indirect_layout_info layout_info;
+                random_layout(&state, &layout_info);
+
+                unsigned int violations = get_layout_violations(&layout_info);
+                enum INDIRECT_LAYOUT_ERROR error =
+                        build_indirect_layout(&layout_info);
+                violation_seen |= violations;
+
+                // Any of the broken rules may be the one reported
+                if (violations != 0) {
+                        bad_count += error == INDIRECT_LAYOUT_ERROR_NONE ||
+                                !(violations & 1u << error);
+                        continue;
+                }
+
+                ++valid_count;
+                if (error != INDIRECT_LAYOUT_ERROR_NONE) {
+                        ++bad_count;
+                        continue;
+                }
+
+                // Tightly packed in order, every argument 4 byte aligned
+                unsigned int offset = 0;
+                for (unsigned int i = 0; i < layout_info.arg_count; ++i) {
+                        bad_count += layout_info.offsets[i] != offset ||
+                                offset % 4 != 0;
+                        offset += get_expected_arg_size(&layout_info.args[i]);
+                }
+                bad_count += layout_info.stride != offset ||
+                        offset % 4 != 0;
+
+                if (n % 16 == 0)
+                        bad_count += check_packing(&state, &layout_info);
+        }
+
+        CHECK(bad_count == 0);
+        // Both kinds of layout, and every rule broken, turn up often
+        CHECK(valid_count > LAYOUT_COUNT / 20);
+        CHECK(violation_seen == ((1u << INDIRECT_LAYOUT_ERROR_NO_DRAW) |
+                (1u << INDIRECT_LAYOUT_ERROR_DRAW_NOT_LAST) |
+                (1u << INDIRECT_LAYOUT_ERROR_NO_CONSTANTS) |
+                (1u << INDIRECT_LAYOUT_ERROR_DUPLICATE_ROOT_PARAM) |
+                (1u << INDIRECT_LAYOUT_ERROR_DUPLICATE_VERTEX_SLOT) |
+                (1u << INDIRECT_LAYOUT_ERROR_DUPLICATE_INDEX_BUFFER)));
+}
+
+int main(void)
+{
+        test_arg_structs();
+        test_draw_queue_layout();
+        test_random_layouts();
+
+        return finish_test("indirect_args_test");
+}
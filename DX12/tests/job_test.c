@@ -0,0 +1,89 @@
+#include "job_interface.h"
+#include "test_util.h"
+
+// Checks that waiting on one counter runs only its own jobs, and that jobs
+// taken from the middle of the queue that way leave the others in the order
+// they were submitted. A single worker is kept busy while the queue is
+// filled, so the order it runs them in is the queue order.
+#define MAX_TEST_JOBS 8
+
+struct order_info {
+        unsigned int count;
+        unsigned int ids[MAX_TEST_JOBS];
+};
+
+struct order_job {
+        struct order_info *order_info;
+        unsigned int id;
+};
+
+static int is_blocker_started;
+static int is_blocker_released;
+
+static void block_job(void *job_data)
+{
+        __atomic_store_n(&is_blocker_started, 1, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&is_blocker_released, __ATOMIC_ACQUIRE))
+                ;
+}
+
+static void record_job(void *job_data)
+{
+        struct order_job *job = job_data;
+        struct order_info *order_info = job->order_info;
+
+        order_info->ids[order_info->count++] = job->id;
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        job_system.worker_count = 1;
+        create_job_system(&job_system);
+
+        struct job_counter blocker_counter;
+        init_job_counter(&blocker_counter);
+        submit_job(&job_system, block_job, NULL, &blocker_counter);
+        while (!__atomic_load_n(&is_blocker_started, __ATOMIC_ACQUIRE))
+                ;
+
+        // Queued as B0 B1 A0 B2 A1 B3, the waits take the A jobs out from
+        // between the B jobs
+        static const unsigned int is_waited[] = { 0, 0, 1, 0, 1, 0 };
+        struct order_info order_infos[2];
+        memset(order_infos, 0, sizeof (order_infos));
+        struct order_job jobs[6];
+        struct job_counter counters[2];
+        init_job_counter(&counters[0]);
+        init_job_counter(&counters[1]);
+        unsigned int next_ids[2] = { 0, 0 };
+        for (unsigned int j = 0; j < 6; ++j) {
+                unsigned int list = is_waited[j];
+                jobs[j].order_info = &order_infos[list];
+                jobs[j].id = next_ids[list]++;
+                submit_job(&job_system, record_job, &jobs[j],
+                        &counters[list]);
+        }
+
+        // The worker is busy, so the waiting thread runs its own jobs
+        wait_for_jobs(&job_system, &counters[1]);
+        CHECK(order_infos[1].count == 2);
+        CHECK(order_infos[1].ids[0] == 0 && order_infos[1].ids[1] == 1);
+        CHECK(order_infos[0].count == 0);
+        CHECK(!is_job_done(&job_system, &counters[0]));
+
+        // Polled rather than waited on, which would have this thread take
+        // jobs off the queue alongside the worker
+        __atomic_store_n(&is_blocker_released, 1, __ATOMIC_RELEASE);
+        while (!is_job_done(&job_system, &counters[0]))
+                ;
+        CHECK(is_job_done(&job_system, &blocker_counter));
+        CHECK(order_infos[0].count == 4);
+        for (unsigned int i = 0; i < order_infos[0].count; ++i)
+                CHECK(order_infos[0].ids[i] == i);
+
+        release_job_system(&job_system);
+
+        return finish_test("job_test");
+}
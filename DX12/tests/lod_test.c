@@ -0,0 +1,262 @@
+#include "lod_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Checks the level picked against the distance and scale at which each
+// level's error reaches the pixel threshold, that instances near a boundary
+// keep their level, and that perspective and orthographic views select
+// from their own eye and extent. With a 90 degree view 1000 pixels high a
+// unit covers 500 pixels one unit away, so for a 1 pixel threshold a fresh
+// instance takes the coarsest level whose error is at most 0.0016 times its
+// distance, and keeps a level until the error is over 0.0024 times it.
+#define RANDOM_INSTANCE_COUNT (LOD_PARALLEL_MIN_COUNT + 3)
+#define VIEWPORT_HEIGHT 1000.0f
+
+static struct mesh_info lod_mesh;
+
+static void create_lod_mesh(void)
+{
+        static const float errors[] = { 0.0f, 0.01f, 0.1f, 1.0f };
+
+        memset(&lod_mesh, 0, sizeof (struct mesh_info));
+        lod_mesh.lod_count = sizeof (errors) / sizeof (errors[0]);
+        for (unsigned int l = 0; l < lod_mesh.lod_count; ++l)
+                lod_mesh.lods[l].error = errors[l];
+}
+
+static void create_test_lods(struct lod_info *lod_info,
+        struct job_system_info *job_system, unsigned int capacity)
+{
+        memset(lod_info, 0, sizeof (struct lod_info));
+        lod_info->job_system = job_system;
+        lod_info->capacity = capacity;
+        create_lods(lod_info);
+        add_lod_mesh(lod_info, &lod_mesh);
+}
+
+static void set_perspective_view(struct lod_view *view, vec3 eye)
+{
+        set_lod_view(view, eye, 1.5707963f, VIEWPORT_HEIGHT, 1.0f, 0.01f);
+}
+
+static void select_all(struct lod_info *lod_info, struct lod_view *view)
+{
+        unsigned int *indices = malloc(lod_info->count *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < lod_info->count; ++i)
+                indices[i] = i;
+
+        select_lods(lod_info, view, indices, lod_info->count);
+        free(indices);
+}
+
+// Instances along -z, placed by the distance of the near side of their
+// sphere. Five of them, so the four wide path and the tail both run.
+static void check_thresholds(void)
+{
+        static const float distances[] = { 5.0f, 10.0f, 100.0f, 1000.0f,
+                10.0f };
+        static const float scales[] = { 1.0f, 1.0f, 1.0f, 1.0f, 4.0f };
+        static const unsigned int levels[] = { 0, 1, 2, 3, 0 };
+
+        struct lod_info lod_info;
+        create_test_lods(&lod_info, NULL, 5);
+        for (unsigned int i = 0; i < 5; ++i) {
+                vec3 centre = { 0.0f, 0.0f, -distances[i] - 0.5f };
+                add_lod_instance(&lod_info, 0, centre, 0.5f, scales[i]);
+        }
+
+        struct lod_view view;
+        vec3 eye = { 0.0f, 0.0f, 0.0f };
+        set_perspective_view(&view, eye);
+        select_all(&lod_info, &view);
+
+        for (unsigned int i = 0; i < 5; ++i)
+                CHECK(lod_info.levels[i] == levels[i]);
+        CHECK(lod_info.stats.selected_count == 5);
+        CHECK(lod_info.stats.switched_count == 3);
+        CHECK(lod_info.stats.level_counts[0] == 2);
+        CHECK(lod_info.stats.level_counts[3] == 1);
+
+        // The eye inside the sphere counts as min_distance away
+        vec3 centre = { 0.0f, 0.0f, 0.0f };
+        set_lod_instance(&lod_info, 3, centre, 2.0f, 1.0f);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[3] == 0);
+
+        release_lods(&lod_info);
+}
+
+// Level 2 has an error of 0.1, which is under the coarse limit from 62.5
+// units and over the fine one under 41.7
+static void check_hysteresis(void)
+{
+        struct lod_info lod_info;
+        create_test_lods(&lod_info, NULL, 2);
+        vec3 near_centre = { 0.0f, 0.0f, -70.0f };
+        vec3 middle_centre = { 0.0f, 0.0f, -50.0f };
+        vec3 far_centre = { 0.0f, 0.0f, -30.0f };
+        add_lod_instance(&lod_info, 0, near_centre, 0.0f, 1.0f);
+        add_lod_instance(&lod_info, 0, middle_centre, 0.0f, 1.0f);
+
+        struct lod_view view;
+        vec3 eye = { 0.0f, 0.0f, 0.0f };
+        set_perspective_view(&view, eye);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[0] == 2);
+        CHECK(lod_info.levels[1] == 1);
+
+        // Between the limits both keep what they have
+        set_lod_instance(&lod_info, 0, middle_centre, 0.0f, 1.0f);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[0] == 2);
+        CHECK(lod_info.levels[1] == 1);
+        CHECK(lod_info.stats.switched_count == 0);
+
+        // Past the fine limit the level drops, and coming back to the
+        // middle doesn't raise it again
+        set_lod_instance(&lod_info, 0, far_centre, 0.0f, 1.0f);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[0] == 1);
+        CHECK(lod_info.stats.switched_count == 1);
+
+        set_lod_instance(&lod_info, 0, middle_centre, 0.0f, 1.0f);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[0] == 1);
+
+        set_lod_instance(&lod_info, 0, near_centre, 0.0f, 1.0f);
+        select_all(&lod_info, &view);
+        CHECK(lod_info.levels[0] == 2);
+
+        release_lods(&lod_info);
+}
+
+// Only the listed instances change, each view measures from its own eye,
+// and an orthographic view picks by its extent whatever the distance
+static void check_views(void)
+{
+        struct lod_info lod_info;
+        create_test_lods(&lod_info, NULL, 5);
+        for (unsigned int i = 0; i < 5; ++i) {
+                vec3 centre = { 0.0f, 0.0f, -10.0f - 200.0f * i };
+                add_lod_instance(&lod_info, 0, centre, 0.0f, 1.0f);
+        }
+
+        struct lod_view near_view;
+        vec3 near_eye = { 0.0f, 0.0f, 0.0f };
+        set_perspective_view(&near_view, near_eye);
+        unsigned int near_indices[] = { 0, 2 };
+        select_lods(&lod_info, &near_view, near_indices, 2);
+        CHECK(lod_info.levels[0] == 1);
+        CHECK(lod_info.levels[1] == 0);
+        CHECK(lod_info.levels[2] == 2);
+        CHECK(lod_info.levels[3] == 0);
+
+        // From behind the last instance the first one is the far one
+        struct lod_view far_view;
+        vec3 far_eye = { 0.0f, 0.0f, -1000.0f };
+        set_perspective_view(&far_view, far_eye);
+        unsigned int far_indices[] = { 0, 4 };
+        select_lods(&lod_info, &far_view, far_indices, 2);
+        CHECK(lod_info.levels[0] == 3);
+        CHECK(lod_info.levels[4] == 2);
+        CHECK(lod_info.levels[2] == 2);
+
+        // Two units high over 1000 pixels, a unit covers 500 pixels at any
+        // distance, so at a scale of 0.01 an error of 0.16 is fine
+        struct lod_view ortho_view;
+        set_lod_orthographic_view(&ortho_view, 2.0f, VIEWPORT_HEIGHT, 1.0f);
+        for (unsigned int i = 0; i < 5; ++i) {
+                vec3 centre = { 0.0f, 0.0f, -10.0f - 200.0f * i };
+                set_lod_instance(&lod_info, i, centre, 0.0f, 0.01f);
+                lod_info.levels[i] = 0;
+        }
+        select_all(&lod_info, &ortho_view);
+        for (unsigned int i = 0; i < 5; ++i)
+                CHECK(lod_info.levels[i] == 2);
+
+        // Ten times the extent makes an error of 1.6 fine
+        set_lod_orthographic_view(&ortho_view, 20.0f, VIEWPORT_HEIGHT, 1.0f);
+        select_all(&lod_info, &ortho_view);
+        for (unsigned int i = 0; i < 5; ++i)
+                CHECK(lod_info.levels[i] == 3);
+
+        release_lods(&lod_info);
+}
+
+// Enough instances to be split across the job system, against picking the
+// level of each one by hand from fresh
+static void check_random_instances(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        struct lod_info lod_info;
+        create_test_lods(&lod_info, &job_system, RANDOM_INSTANCE_COUNT);
+
+        unsigned long long state = 0x9e3779b97f4a7c15ull;
+        for (unsigned int i = 0; i < RANDOM_INSTANCE_COUNT; ++i) {
+                vec3 centre;
+                for (int k = 0; k < 3; ++k)
+                        centre[k] = test_random_float(&state, -1000.0f,
+                                1000.0f);
+                add_lod_instance(&lod_info, 0, centre,
+                        test_random_float(&state, 0.0f, 10.0f),
+                        test_random_float(&state, 0.5f, 2.0f));
+        }
+
+        struct lod_view view;
+        vec3 eye = { 10.0f, -20.0f, 30.0f };
+        set_perspective_view(&view, eye);
+        select_all(&lod_info, &view);
+
+        float coarse_limit = view.error_threshold * (1.0f - LOD_HYSTERESIS) /
+                view.projection_scale;
+        unsigned int bad_count = 0;
+        unsigned int level_counts[MAX_MESH_LODS] = { 0 };
+        for (unsigned int i = 0; i < RANDOM_INSTANCE_COUNT; ++i) {
+                float dx = lod_info.x[i] - eye[0];
+                float dy = lod_info.y[i] - eye[1];
+                float dz = lod_info.z[i] - eye[2];
+                float distance = fmaxf(sqrtf(dx * dx + dy * dy + dz * dz) -
+                        lod_info.radius[i], view.min_distance);
+                float limit = distance / lod_info.scale[i] * coarse_limit;
+
+                // Right on a boundary rounding may go either way
+                unsigned int level = 0;
+                int is_near_boundary = 0;
+                for (unsigned int l = 1; l < lod_mesh.lod_count; ++l) {
+                        float error = lod_mesh.lods[l].error;
+                        if (error <= limit)
+                                level = l;
+                        is_near_boundary |= fabsf(error - limit) <=
+                                1e-4f * error;
+                }
+
+                bad_count += !is_near_boundary &&
+                        lod_info.levels[i] != level;
+                ++level_counts[lod_info.levels[i]];
+        }
+        CHECK(bad_count == 0);
+
+        for (unsigned int l = 0; l < MAX_MESH_LODS; ++l)
+                CHECK(lod_info.stats.level_counts[l] == level_counts[l]);
+        CHECK(lod_info.stats.selected_count == RANDOM_INSTANCE_COUNT);
+
+        release_lods(&lod_info);
+        release_job_system(&job_system);
+}
+
+int main(void)
+{
+        create_lod_mesh();
+
+        check_thresholds();
+        check_hysteresis();
+        check_views();
+        check_random_instances();
+
+        return finish_test("lod_test");
+}
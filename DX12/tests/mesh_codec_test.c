@@ -0,0 +1,136 @@
+#include "mesh_codec_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+// Round trips index and vertex buffers through the codecs, then feeds the
+// decoders truncated and corrupted data, which they have to reject or
+// decode without reading or writing out of bounds.
+
+static void check_indices(const unsigned int *indices,
+        unsigned int index_count, unsigned int vertex_count,
+        unsigned int index_stride)
+{
+        unsigned long long bound = get_index_encode_bound(index_count);
+        unsigned char *encoded = malloc(bound);
+        unsigned long long size = encode_index_buffer(encoded, indices,
+                index_count);
+        CHECK(size <= bound);
+
+        void *decoded = malloc(index_count * sizeof (unsigned int) + 1);
+        CHECK(decode_index_buffer(decoded, index_stride, index_count,
+                vertex_count, encoded, size));
+
+        unsigned int mismatch_count = 0;
+        for (unsigned int i = 0; i < index_count; i += 3) {
+                unsigned int triangle[3];
+                for (int k = 0; k < 3; ++k) {
+                        triangle[k] = index_stride == sizeof (unsigned int) ?
+                                ((unsigned int *) decoded)[i + k] :
+                                ((unsigned short *) decoded)[i + k];
+                }
+
+                mismatch_count += !is_same_triangle(indices + i, triangle);
+        }
+
+        CHECK(mismatch_count == 0);
+
+        // Indices past the vertices are rejected
+        if (index_count > 0) {
+                CHECK(!decode_index_buffer(decoded, index_stride,
+                        index_count, vertex_count - 1, encoded, size));
+        }
+
+        for (unsigned long long s = 0; s < size; s += size / 50 + 1) {
+                CHECK(!decode_index_buffer(decoded, index_stride,
+                        index_count, vertex_count, encoded, s));
+        }
+
+        unsigned long long state = size;
+        for (int t = 0; t < 200; ++t) {
+                unsigned long long p = test_random(&state) % size;
+                unsigned char byte = encoded[p];
+                encoded[p] ^= 1 << (test_random(&state) % 8);
+                decode_index_buffer(decoded, index_stride, index_count,
+                        vertex_count, encoded, size);
+                encoded[p] = byte;
+        }
+
+        free(decoded);
+        free(encoded);
+}
+
+static void check_vertices(struct job_system_info *job_system,
+        const void *vertices, unsigned int vertex_count,
+        unsigned int vertex_stride)
+{
+        unsigned long long bound = get_vertex_encode_bound(vertex_count,
+                vertex_stride);
+        unsigned char *encoded = malloc(bound);
+        unsigned long long size = encode_vertex_buffer(encoded, vertices,
+                vertex_count, vertex_stride);
+        CHECK(size <= bound);
+
+        size_t data_size = (size_t) vertex_count * vertex_stride;
+        unsigned char *decoded = malloc(data_size + 1);
+        CHECK(decode_vertex_buffer(job_system, decoded, vertex_count,
+                vertex_stride, encoded, size));
+        CHECK(memcmp(decoded, vertices, data_size) == 0);
+
+        for (unsigned long long s = 0; s < size; s += size / 30 + 1) {
+                CHECK(!decode_vertex_buffer(job_system, decoded,
+                        vertex_count, vertex_stride, encoded, s));
+        }
+
+        unsigned long long state = size;
+        for (int t = 0; t < 100; ++t) {
+                unsigned long long p = test_random(&state) % size;
+                unsigned char byte = encoded[p];
+                encoded[p] ^= 1 << (test_random(&state) % 8);
+                decode_vertex_buffer(job_system, decoded, vertex_count,
+                        vertex_stride, encoded, size);
+                encoded[p] = byte;
+        }
+
+        free(decoded);
+        free(encoded);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        struct mesh_info mi;
+        create_test_torus(&mi, 160, 80);
+
+        check_indices(mi.indices, mi.index_count, mi.vertex_count,
+                sizeof (unsigned short));
+        check_indices(mi.indices, mi.index_count, mi.vertex_count,
+                sizeof (unsigned int));
+
+        // Odd strides and counts leave partial groups and blocks
+        static const unsigned int strides[] = { 4, 12, 17, 40 };
+        for (unsigned int s = 0; s < sizeof (strides) / sizeof (strides[0]);
+                ++s) {
+                for (unsigned int count = 1; count <= mi.vertex_count;
+                        count = count * 7 + 3) {
+                        check_vertices(NULL, mi.verticies, count, strides[s]);
+                        check_vertices(&job_system, mi.verticies, count,
+                                strides[s]);
+                }
+        }
+
+        // Noise doesn't compress, but has to survive the trip all the same
+        unsigned long long state = 1;
+        unsigned int noise_count = 5000;
+        unsigned char *noise = malloc(noise_count * 16);
+        for (unsigned int i = 0; i < noise_count * 16; ++i)
+                noise[i] = (unsigned char) test_random(&state);
+        check_vertices(&job_system, noise, noise_count, 16);
+        free(noise);
+
+        release_test_mesh(&mi);
+        release_job_system(&job_system);
+
+        return finish_test("mesh_codec_test");
+}
@@ -0,0 +1,149 @@
+#include "mesh_file_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Times loading BENCH_FILE_COUNT uncompressed mesh files of about 52 MB
+// each, opening them and copying their data into memory standing in for
+// upload resources, on the job system. The files are loaded once after
+// asking the kernel to drop them from the page cache, and again with them
+// cached. Timings depend on the machine and the disk and are only reported;
+// the run fails when a file can't be written or loaded or its data comes
+// back different.
+#define BENCH_FILE_COUNT 48
+#define BENCH_SEGMENT_COUNT 900
+#define BENCH_RING_COUNT 900
+
+static char directory[] = "/tmp/mesh_file_bench_XXXXXX";
+
+static void get_path(char *path, unsigned int file)
+{
+        snprintf(path, MAX_MESH_FILE_PATH, "%s/mesh_%u.mesh", directory,
+                file);
+}
+
+// Written back and dropped, so the next read comes from the disk. Only
+// clean pages are dropped, which is why the file is synced first.
+static void drop_cached_file(const char *path)
+{
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return;
+
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+}
+
+static unsigned int load_files(struct job_system_info *job_system,
+        struct mesh_info *mi, void *vertices, void *indices,
+        double *load_time, unsigned long long *load_size)
+{
+        unsigned int bad_count = 0;
+        *load_time = 0.0;
+        *load_size = 0;
+        for (unsigned int f = 0; f < BENCH_FILE_COUNT; ++f) {
+                struct mesh_file_info file_info;
+                memset(&file_info, 0, sizeof (struct mesh_file_info));
+                get_path(file_info.path, f);
+                file_info.job_system = job_system;
+
+                double start_time = get_time_in_secs();
+                int is_loaded = open_mesh_file(&file_info) &&
+                        copy_mesh_file_vertices(&file_info, vertices) &&
+                        copy_mesh_file_indices(&file_info, indices);
+                *load_time += get_time_in_secs() - start_time;
+
+                if (!is_loaded) {
+                        ++bad_count;
+                        close_mesh_file(&file_info);
+                        continue;
+                }
+
+                const struct mesh_file_header *header = file_info.header;
+                *load_size += header->vertex_data_size +
+                        header->index_data_size;
+                bad_count += memcmp(vertices, mi->verticies,
+                        (size_t) header->vertex_data_size) != 0;
+                bad_count += memcmp(indices, mi->indices,
+                        (size_t) header->index_data_size) != 0;
+
+                close_mesh_file(&file_info);
+        }
+
+        return bad_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        unsigned int bad_count = mkdtemp(directory) == NULL;
+
+        // Over 65535 vertices, so the indices are stored as 32 bits and
+        // come back as they went in
+        struct mesh_info mi;
+        create_test_torus(&mi, BENCH_SEGMENT_COUNT, BENCH_RING_COUNT);
+        for (unsigned int f = 0; f < BENCH_FILE_COUNT && bad_count == 0;
+                ++f) {
+                char path[MAX_MESH_FILE_PATH];
+                get_path(path, f);
+                bad_count += !write_mesh_file(path, &mi, VERTEX_LAYOUT_FLOAT,
+                        MESH_FILE_COMPRESSION_NONE);
+        }
+
+        // Touched up front, as mapped upload memory would be
+        size_t vertex_size = mi.vertex_count * sizeof (struct vertex);
+        size_t index_size = mi.index_count * sizeof (unsigned int);
+        void *vertices = malloc(vertex_size);
+        void *indices = malloc(index_size);
+        memset(vertices, 0, vertex_size);
+        memset(indices, 0, index_size);
+
+        if (bad_count == 0) {
+                for (unsigned int f = 0; f < BENCH_FILE_COUNT; ++f) {
+                        char path[MAX_MESH_FILE_PATH];
+                        get_path(path, f);
+                        drop_cached_file(path);
+                }
+
+                double cold_time;
+                double warm_time;
+                unsigned long long cold_size;
+                unsigned long long warm_size;
+                bad_count += load_files(&job_system, &mi, vertices, indices,
+                        &cold_time, &cold_size);
+                bad_count += load_files(&job_system, &mi, vertices, indices,
+                        &warm_time, &warm_size);
+
+                printf("mesh_file_bench: %u files, %.2f GB, %u workers, "
+                        "cold %.2f GB/s, warm %.2f GB/s\n", BENCH_FILE_COUNT,
+                        warm_size / 1e9, job_system.worker_count,
+                        cold_size / 1e9 / cold_time,
+                        warm_size / 1e9 / warm_time);
+        }
+
+        free(indices);
+        free(vertices);
+        release_test_mesh(&mi);
+        release_job_system(&job_system);
+
+        for (unsigned int f = 0; f < BENCH_FILE_COUNT; ++f) {
+                char path[MAX_MESH_FILE_PATH];
+                get_path(path, f);
+                unlink(path);
+        }
+        rmdir(directory);
+
+        if (bad_count > 0)
+                printf("mesh_file_bench: %u files failed\n", bad_count);
+
+        return bad_count == 0 ? 0 : 1;
+}
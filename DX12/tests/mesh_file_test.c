@@ -0,0 +1,391 @@
+#include "mesh_file_interface.h"
+#include "index_format_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+
+// Writes meshes as mesh files, stored as is and compressed, with 16 and 32
+// bit indices and in each vertex layout, and reads them back through every
+// path. Then damages the files, which have to be refused on open or on
+// copy.
+
+// A few levels of detail over the index buffer, as the writer keeps them
+static void set_test_lods(struct mesh_info *mi)
+{
+        unsigned int triangle_count = mi->index_count / 3;
+
+        mi->lod_count = 3;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+        mi->lods[0].error = 0.0f;
+        mi->lods[1].first_index = 0;
+        mi->lods[1].index_count = triangle_count / 2 * 3;
+        mi->lods[1].error = 0.25f;
+        mi->lods[2].first_index = triangle_count / 2 * 3;
+        mi->lods[2].index_count = (triangle_count - triangle_count / 2) * 3;
+        mi->lods[2].error = 1.5f;
+}
+
+static void check_same_mesh(struct mesh_info *mi, struct mesh_info *file_mi,
+        int is_compressed)
+{
+        CHECK(file_mi->vertex_count == mi->vertex_count);
+        CHECK(file_mi->index_count == mi->index_count);
+        CHECK(file_mi->lod_count == mi->lod_count);
+        if (file_mi->vertex_count != mi->vertex_count ||
+                file_mi->index_count != mi->index_count)
+                return;
+
+        CHECK(memcmp(file_mi->verticies, mi->verticies,
+                mi->vertex_count * sizeof (struct vertex)) == 0);
+        if (is_compressed) {
+                unsigned int bad_triangle_count = 0;
+                for (unsigned int i = 0; i < mi->index_count; i += 3)
+                        bad_triangle_count += !is_same_triangle(
+                                &mi->indices[i], &file_mi->indices[i]);
+                CHECK(bad_triangle_count == 0);
+        } else {
+                CHECK(memcmp(file_mi->indices, mi->indices,
+                        mi->index_count * sizeof (unsigned int)) == 0);
+        }
+
+        for (unsigned int l = 0; l < mi->lod_count &&
+                l < file_mi->lod_count; ++l) {
+                CHECK(file_mi->lods[l].first_index ==
+                        mi->lods[l].first_index);
+                CHECK(file_mi->lods[l].index_count ==
+                        mi->lods[l].index_count);
+                CHECK(file_mi->lods[l].error == mi->lods[l].error);
+        }
+}
+
+static void check_header(const struct mesh_file_header *header,
+        struct mesh_info *mi)
+{
+        CHECK(header->vertex_count == mi->vertex_count);
+        CHECK(header->index_count == mi->index_count);
+        CHECK(header->index_stride == (mi->vertex_count <=
+                INDEX_16_MAX_VERTEX_COUNT ? 2u : 4u));
+        CHECK(header->vertex_data_offset % MESH_FILE_ALIGNMENT == 0);
+        CHECK(header->index_data_offset % MESH_FILE_ALIGNMENT == 0);
+
+        // Every position is inside the box and the sphere
+        unsigned int outside_count = 0;
+        const float *sphere = header->bounding_sphere;
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                const float *position = mi->verticies[i].position;
+                float dist_sq = 0.0f;
+                for (int k = 0; k < 3; ++k) {
+                        outside_count += position[k] <
+                                header->bounds_min[k] ||
+                                position[k] > header->bounds_max[k];
+                        dist_sq += (position[k] - sphere[k]) *
+                                (position[k] - sphere[k]);
+                }
+                outside_count += sqrtf(dist_sq) > sphere[3] * 1.0001f;
+        }
+        CHECK(outside_count == 0);
+}
+
+// Reads the file back through the upload copies, which keep the stride of
+// the file
+static void check_upload_copies(struct mesh_file_info *file_info,
+        struct mesh_info *mi, int is_compressed)
+{
+        const struct mesh_file_header *header = file_info->header;
+
+        void *vertices = malloc((size_t) header->vertex_data_size + 1);
+        CHECK(copy_mesh_file_vertices(file_info, vertices));
+        CHECK(memcmp(vertices, mi->verticies,
+                (size_t) header->vertex_data_size) == 0);
+        free(vertices);
+
+        void *indices = malloc((size_t) header->index_data_size + 1);
+        unsigned int *wide_indices = malloc((mi->index_count + 1) *
+                sizeof (unsigned int));
+        CHECK(copy_mesh_file_indices(file_info, indices));
+        for (unsigned int i = 0; i < mi->index_count; ++i)
+                wide_indices[i] = header->index_stride == 2 ?
+                        ((unsigned short *) indices)[i] :
+                        ((unsigned int *) indices)[i];
+
+        unsigned int bad_triangle_count = 0;
+        for (unsigned int i = 0; i < mi->index_count; i += 3)
+                bad_triangle_count += is_compressed ?
+                        !is_same_triangle(&mi->indices[i],
+                        &wide_indices[i]) :
+                        memcmp(&mi->indices[i], &wide_indices[i],
+                        3 * sizeof (unsigned int)) != 0;
+        CHECK(bad_triangle_count == 0);
+
+        free(wide_indices);
+        free(indices);
+}
+
+static void test_round_trip(struct job_system_info *job_system,
+        const char *path, struct mesh_info *mi, unsigned int compression)
+{
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT, compression));
+
+        struct mesh_file_info file_info;
+        memset(&file_info, 0, sizeof (struct mesh_file_info));
+        snprintf(file_info.path, MAX_MESH_FILE_PATH, "%s", path);
+        file_info.job_system = job_system;
+        CHECK(open_mesh_file(&file_info));
+        if (file_info.header == NULL)
+                return;
+
+        const struct mesh_file_header *header = file_info.header;
+        // Small meshes are stored as is even when compression is asked for
+        int is_compressed = header->compression ==
+                MESH_FILE_COMPRESSION_CODEC;
+        check_header(header, mi);
+
+        struct mesh_info file_mi;
+        memset(&file_mi, 0, sizeof (struct mesh_info));
+        CHECK(copy_mesh_file_mesh(&file_info, &file_mi));
+        check_same_mesh(mi, &file_mi, is_compressed);
+        release_mesh_file_mesh(&file_mi);
+
+        // Only stored 32 bit indices can be pointed at in the mapping
+        int can_point = !is_compressed && header->index_stride == 4;
+        memset(&file_mi, 0, sizeof (struct mesh_info));
+        CHECK(get_mesh_file_mesh(&file_info, &file_mi) == can_point);
+        if (can_point)
+                check_same_mesh(mi, &file_mi, 0);
+
+        check_upload_copies(&file_info, mi, is_compressed);
+        CHECK(file_info.stats.copied_size > 0);
+        if (is_compressed)
+                CHECK(file_info.stats.read_size <
+                        file_info.stats.copied_size);
+
+        close_mesh_file(&file_info);
+}
+
+// Compact layouts come back decoded, the same as decoding what the encoder
+// gave, and the upload copy is the encoded vertices
+static void test_quantized_round_trip(struct job_system_info *job_system,
+        const char *path, struct mesh_info *mi, unsigned int layout,
+        unsigned int compression)
+{
+        CHECK(write_mesh_file(path, mi, layout, compression));
+
+        struct vertex_encode_info encode_info;
+        memset(&encode_info, 0, sizeof (struct vertex_encode_info));
+        encode_info.layout = layout;
+        encode_vertices(&encode_info, mi);
+        struct vertex *vertices = malloc((mi->vertex_count + 1) *
+                sizeof (struct vertex));
+        decode_vertices(&encode_info.format, encode_info.data,
+                mi->vertex_count, vertices);
+
+        struct mesh_file_info file_info;
+        memset(&file_info, 0, sizeof (struct mesh_file_info));
+        snprintf(file_info.path, MAX_MESH_FILE_PATH, "%s", path);
+        file_info.job_system = job_system;
+        CHECK(open_mesh_file(&file_info));
+        if (file_info.header == NULL) {
+                free(vertices);
+                release_encoded_vertices(&encode_info);
+                return;
+        }
+
+        const struct mesh_file_header *header = file_info.header;
+        CHECK(header->vertex_stride == encode_info.format.stride);
+        struct vertex_format format;
+        CHECK(get_mesh_file_format(&file_info, &format));
+        CHECK(format.layout == layout);
+        CHECK(memcmp(format.position_scale,
+                encode_info.format.position_scale, sizeof (vec3)) == 0);
+        CHECK(memcmp(format.position_bias,
+                encode_info.format.position_bias, sizeof (vec3)) == 0);
+
+        struct mesh_info file_mi;
+        memset(&file_mi, 0, sizeof (struct mesh_info));
+        CHECK(get_mesh_file_mesh(&file_info, &file_mi) == 0);
+        CHECK(copy_mesh_file_mesh(&file_info, &file_mi));
+        if (file_mi.verticies != NULL) {
+                CHECK(memcmp(file_mi.verticies, vertices,
+                        mi->vertex_count * sizeof (struct vertex)) == 0);
+                release_mesh_file_mesh(&file_mi);
+        }
+
+        void *data = malloc((size_t) header->vertex_data_size + 1);
+        CHECK(copy_mesh_file_vertices(&file_info, data));
+        CHECK(memcmp(data, encode_info.data,
+                (size_t) header->vertex_data_size) == 0);
+        free(data);
+
+        close_mesh_file(&file_info);
+        free(vertices);
+        release_encoded_vertices(&encode_info);
+}
+
+static int open_test_file(const char *path)
+{
+        struct mesh_file_info file_info;
+        memset(&file_info, 0, sizeof (struct mesh_file_info));
+        snprintf(file_info.path, MAX_MESH_FILE_PATH, "%s", path);
+        if (!open_mesh_file(&file_info))
+                return 0;
+
+        close_mesh_file(&file_info);
+
+        return 1;
+}
+
+static void patch_file(const char *path, unsigned long long offset,
+        const void *data, size_t size)
+{
+        FILE *file = fopen(path, "r+b");
+        fseek(file, (long) offset, SEEK_SET);
+        fwrite(data, 1, size, file);
+        fclose(file);
+}
+
+static void test_damaged_files(const char *path, struct mesh_info *mi)
+{
+        // An index past the vertices
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        struct mesh_file_header header;
+        FILE *file = fopen(path, "rb");
+        CHECK(fread(&header, sizeof (header), 1, file) == 1);
+        fclose(file);
+
+        unsigned int vertex_count = mi->vertex_count;
+        unsigned long long index_offset = header.index_data_offset +
+                (unsigned long long) (mi->index_count / 2) *
+                header.index_stride;
+        patch_file(path, index_offset, &vertex_count, header.index_stride);
+        CHECK(!open_test_file(path));
+
+        // The last index is checked as well as the others
+        index_offset = header.index_data_offset + (unsigned long long)
+                (mi->index_count - 1) * header.index_stride;
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        patch_file(path, index_offset, &vertex_count, header.index_stride);
+        CHECK(!open_test_file(path));
+
+        // Another magic and version
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        CHECK(open_test_file(path));
+        unsigned int value = 0;
+        patch_file(path, offsetof(struct mesh_file_header, magic),
+                &value, sizeof (value));
+        CHECK(!open_test_file(path));
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        value = MESH_FILE_VERSION + 1;
+        patch_file(path, offsetof(struct mesh_file_header, version),
+                &value, sizeof (value));
+        CHECK(!open_test_file(path));
+
+        // A level of detail past the indices
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        value = mi->index_count + 1;
+        patch_file(path, offsetof(struct mesh_file_header, lods[0]) +
+                offsetof(struct mesh_file_lod, index_count), &value,
+                sizeof (value));
+        CHECK(!open_test_file(path));
+
+        // Cut short
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_NONE));
+        CHECK(truncate(path, (off_t) (header.index_data_offset +
+                header.index_data_size - 1)) == 0);
+        CHECK(!open_test_file(path));
+        CHECK(truncate(path, sizeof (struct mesh_file_header) - 1) == 0);
+        CHECK(!open_test_file(path));
+
+        unlink(path);
+        CHECK(!open_test_file(path));
+}
+
+// A compressed file claiming fewer vertices than its indices use opens, and
+// its indices are refused as they are decoded
+static void test_damaged_compressed_file(const char *path,
+        struct mesh_info *mi)
+{
+        struct mesh_file_header header;
+        CHECK(write_mesh_file(path, mi, VERTEX_LAYOUT_FLOAT,
+                MESH_FILE_COMPRESSION_CODEC));
+        FILE *file = fopen(path, "rb");
+        CHECK(fread(&header, sizeof (header), 1, file) == 1);
+        fclose(file);
+        CHECK(header.compression == MESH_FILE_COMPRESSION_CODEC);
+        header.vertex_count -= 1;
+        header.vertex_data_size -= header.vertex_stride;
+        patch_file(path, 0, &header, sizeof (header));
+
+        struct mesh_file_info file_info;
+        memset(&file_info, 0, sizeof (struct mesh_file_info));
+        snprintf(file_info.path, MAX_MESH_FILE_PATH, "%s", path);
+        CHECK(open_mesh_file(&file_info));
+        if (file_info.header != NULL) {
+                void *indices = malloc((size_t)
+                        file_info.header->index_data_size + 1);
+                CHECK(!copy_mesh_file_indices(&file_info, indices));
+                free(indices);
+
+                struct mesh_info file_mi;
+                memset(&file_mi, 0, sizeof (struct mesh_info));
+                CHECK(!copy_mesh_file_mesh(&file_info, &file_mi));
+                close_mesh_file(&file_info);
+        }
+
+        unlink(path);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        char path[] = "/tmp/mesh_file_test_XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0)
+                return finish_test("mesh_file_test");
+        close(fd);
+
+        // Too small to compress, 16 bit indices, and 32 bit indices with
+        // more data than is copied on the calling thread
+        static const unsigned int sizes[][2] = {
+                { 3, 3 }, { 64, 48 }, { 400, 300 }
+        };
+        for (unsigned int s = 0; s < sizeof (sizes) / sizeof (sizes[0]);
+                ++s) {
+                struct mesh_info mi;
+                create_test_torus(&mi, sizes[s][0], sizes[s][1]);
+                set_test_lods(&mi);
+
+                for (unsigned int compression = MESH_FILE_COMPRESSION_NONE;
+                        compression <= MESH_FILE_COMPRESSION_CODEC;
+                        ++compression) {
+                        test_round_trip(NULL, path, &mi, compression);
+                        test_round_trip(&job_system, path, &mi, compression);
+                        test_quantized_round_trip(&job_system, path, &mi,
+                                VERTEX_LAYOUT_SNORM16, compression);
+                        test_quantized_round_trip(NULL, path, &mi,
+                                VERTEX_LAYOUT_HALF, compression);
+                }
+
+                test_damaged_files(path, &mi);
+                // The smallest mesh is too small to be stored compressed
+                if (s > 0)
+                        test_damaged_compressed_file(path, &mi);
+                release_test_mesh(&mi);
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("mesh_file_test");
+}
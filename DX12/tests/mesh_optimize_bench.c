@@ -0,0 +1,312 @@
+#include "mesh_optimize_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Reorders a shuffled bumpy sphere and reports the simulated vertex cache
+// misses before and after, and the overdraw from the six axis views with
+// back faces culled, after Tipsify alone and with the overdraw pass. A mesh
+// of about four million triangles is then reordered to time both passes.
+// Timings depend on the machine and are only reported; the run fails when
+// the reordered meshes hold other triangles or miss the cache more.
+#define SMALL_SEGMENT_COUNT 300
+#define SMALL_RING_COUNT 150
+#define LARGE_SEGMENT_COUNT 2000
+#define LARGE_RING_COUNT 1000
+#define BUMP_COUNT 8
+#define BUMP_HEIGHT 0.3f
+#define VIEW_SIZE 256
+
+// Rings from pole to pole, the radius moved in and out so parts of the
+// surface hide others from every side
+static void create_bumpy_sphere(struct mesh_info *mi,
+        unsigned int segment_count, unsigned int ring_count)
+{
+        memset(mi, 0, sizeof (struct mesh_info));
+        mi->vertex_count = segment_count * (ring_count + 1);
+        mi->verticies = calloc(mi->vertex_count, sizeof (struct vertex));
+
+        for (unsigned int r = 0; r <= ring_count; ++r) {
+                for (unsigned int s = 0; s < segment_count; ++s) {
+                        float a = 6.2831853f * s / segment_count;
+                        float b = 3.1415927f * r / ring_count;
+                        float radius = 1.0f + BUMP_HEIGHT *
+                                sinf(BUMP_COUNT * a) * sinf(BUMP_COUNT * b);
+
+                        struct vertex *v =
+                                &mi->verticies[r * segment_count + s];
+                        v->position[0] = radius * sinf(b) * cosf(a);
+                        v->position[1] = radius * cosf(b);
+                        v->position[2] = radius * sinf(b) * sinf(a);
+                        v->position[3] = 1.0f;
+                }
+        }
+
+        mi->index_count = segment_count * ring_count * 6;
+        mi->indices = malloc(mi->index_count * sizeof (unsigned int));
+
+        // Front faces are clockwise seen from outside, as D3D draws them
+        unsigned int *index = mi->indices;
+        for (unsigned int r = 0; r < ring_count; ++r) {
+                for (unsigned int s = 0; s < segment_count; ++s) {
+                        unsigned int next_s = (s + 1) % segment_count;
+                        unsigned int a = r * segment_count + s;
+                        unsigned int b = r * segment_count + next_s;
+                        unsigned int c = (r + 1) * segment_count + s;
+                        unsigned int d = (r + 1) * segment_count + next_s;
+
+                        *index++ = a;
+                        *index++ = c;
+                        *index++ = b;
+                        *index++ = b;
+                        *index++ = c;
+                        *index++ = d;
+                }
+        }
+
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+}
+
+static void shuffle_triangles(unsigned long long *state, struct mesh_info *mi)
+{
+        unsigned int triangle_count = mi->index_count / 3;
+        for (unsigned int t = triangle_count; t > 1; --t) {
+                unsigned int other = test_random(state) % t;
+                for (int k = 0; k < 3; ++k) {
+                        unsigned int index = mi->indices[(t - 1) * 3 + k];
+                        mi->indices[(t - 1) * 3 + k] =
+                                mi->indices[other * 3 + k];
+                        mi->indices[other * 3 + k] = index;
+                }
+        }
+}
+
+static void copy_mesh(struct mesh_info *mi, struct mesh_info *copy)
+{
+        *copy = *mi;
+        copy->indices = malloc(mi->index_count * sizeof (unsigned int));
+        memcpy(copy->indices, mi->indices,
+                mi->index_count * sizeof (unsigned int));
+}
+
+static int compare_triangles(const void *a, const void *b)
+{
+        const unsigned int *x = a;
+        const unsigned int *y = b;
+        for (int k = 0; k < 3; ++k) {
+                if (x[k] != y[k])
+                        return (x[k] > y[k]) - (x[k] < y[k]);
+        }
+
+        return 0;
+}
+
+// Each triangle rotated to start at its smallest index, which keeps the
+// winding, and sorted
+static unsigned int *get_sorted_triangles(const unsigned int *indices,
+        unsigned int index_count)
+{
+        unsigned int *triangles = malloc(index_count * sizeof (unsigned int));
+        for (unsigned int i = 0; i < index_count; i += 3) {
+                int first = indices[i + 1] < indices[i] ? 1 : 0;
+                first = indices[i + 2] < indices[i + first] ? 2 : first;
+                for (int k = 0; k < 3; ++k)
+                        triangles[i + k] = indices[i + (first + k) % 3];
+        }
+        qsort(triangles, index_count / 3, 3 * sizeof (unsigned int),
+                compare_triangles);
+
+        return triangles;
+}
+
+static int is_same_triangles(const unsigned int *sorted_triangles,
+        const unsigned int *indices, unsigned int index_count)
+{
+        unsigned int *triangles = get_sorted_triangles(indices, index_count);
+        int is_same = memcmp(triangles, sorted_triangles,
+                index_count * sizeof (unsigned int)) == 0;
+        free(triangles);
+
+        return is_same;
+}
+
+// Looking along axis, towards +axis when sign is 1. Every pixel a front
+// face covers and passes the depth test at is shaded, in index order.
+static void draw_view(struct mesh_info *mi, int axis, float sign,
+        float *depths, unsigned long long *shaded_count,
+        unsigned long long *covered_count)
+{
+        int u_axis = (axis + 1) % 3;
+        int v_axis = (axis + 2) % 3;
+        float scale = VIEW_SIZE / (2.0f * (1.0f + BUMP_HEIGHT));
+
+        for (unsigned int p = 0; p < VIEW_SIZE * VIEW_SIZE; ++p)
+                depths[p] = INFINITY;
+
+        for (unsigned int i = 0; i < mi->index_count; i += 3) {
+                float *p0 = mi->verticies[mi->indices[i]].position;
+                float *p1 = mi->verticies[mi->indices[i + 1]].position;
+                float *p2 = mi->verticies[mi->indices[i + 2]].position;
+
+                vec3 e0 = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+                vec3 e1 = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+                // Faces out for clockwise front faces
+                vec3 normal;
+                vec3_mul_cross(normal, e1, e0);
+                if (normal[axis] * sign >= 0.0f)
+                        continue;
+
+                float x[3];
+                float y[3];
+                float z[3];
+                float *corners[3] = { p0, p1, p2 };
+                for (int c = 0; c < 3; ++c) {
+                        x[c] = (corners[c][u_axis] + 1.0f + BUMP_HEIGHT) *
+                                scale;
+                        y[c] = (corners[c][v_axis] + 1.0f + BUMP_HEIGHT) *
+                                scale;
+                        z[c] = corners[c][axis] * sign;
+                }
+
+                float area = (x[1] - x[0]) * (y[2] - y[0]) -
+                        (x[2] - x[0]) * (y[1] - y[0]);
+                if (area == 0.0f)
+                        continue;
+
+                int min_x = (int) floorf(fminf(x[0], fminf(x[1], x[2])));
+                int max_x = (int) ceilf(fmaxf(x[0], fmaxf(x[1], x[2])));
+                int min_y = (int) floorf(fminf(y[0], fminf(y[1], y[2])));
+                int max_y = (int) ceilf(fmaxf(y[0], fmaxf(y[1], y[2])));
+                min_x = min_x < 0 ? 0 : min_x;
+                min_y = min_y < 0 ? 0 : min_y;
+                max_x = max_x > VIEW_SIZE ? VIEW_SIZE : max_x;
+                max_y = max_y > VIEW_SIZE ? VIEW_SIZE : max_y;
+
+                for (int py = min_y; py < max_y; ++py) {
+                        for (int px = min_x; px < max_x; ++px) {
+                                float sx = px + 0.5f;
+                                float sy = py + 0.5f;
+                                float w0 = ((x[2] - x[1]) * (sy - y[1]) -
+                                        (sx - x[1]) * (y[2] - y[1])) / area;
+                                float w1 = ((x[0] - x[2]) * (sy - y[2]) -
+                                        (sx - x[2]) * (y[0] - y[2])) / area;
+                                float w2 = 1.0f - w0 - w1;
+                                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                                        continue;
+
+                                float depth = w0 * z[0] + w1 * z[1] +
+                                        w2 * z[2];
+                                float *pixel = &depths[py * VIEW_SIZE + px];
+                                if (depth < *pixel) {
+                                        *pixel = depth;
+                                        ++*shaded_count;
+                                }
+                        }
+                }
+        }
+
+        for (unsigned int p = 0; p < VIEW_SIZE * VIEW_SIZE; ++p)
+                *covered_count += depths[p] != INFINITY;
+}
+
+// Shaded over covered pixels, over all six views
+static float get_overdraw(struct mesh_info *mi)
+{
+        float *depths = malloc(VIEW_SIZE * VIEW_SIZE * sizeof (float));
+        unsigned long long shaded_count = 0;
+        unsigned long long covered_count = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+                draw_view(mi, axis, 1.0f, depths, &shaded_count,
+                        &covered_count);
+                draw_view(mi, axis, -1.0f, depths, &shaded_count,
+                        &covered_count);
+        }
+        free(depths);
+
+        return (float) shaded_count / covered_count;
+}
+
+static unsigned int bench_small_mesh(unsigned long long *state)
+{
+        struct mesh_info mi;
+        create_bumpy_sphere(&mi, SMALL_SEGMENT_COUNT, SMALL_RING_COUNT);
+        shuffle_triangles(state, &mi);
+        unsigned int *sorted_triangles = get_sorted_triangles(mi.indices,
+                mi.index_count);
+
+        // Tipsify alone, then with the overdraw pass
+        struct mesh_info tipsify_mi;
+        copy_mesh(&mi, &tipsify_mi);
+        struct mesh_optimize_info optimize_info;
+        memset(&optimize_info, 0, sizeof (struct mesh_optimize_info));
+        optimize_info.overdraw_threshold = 1.0f;
+        optimize_mesh_indices(&optimize_info, &tipsify_mi);
+
+        struct mesh_info sorted_mi;
+        copy_mesh(&mi, &sorted_mi);
+        memset(&optimize_info, 0, sizeof (struct mesh_optimize_info));
+        optimize_info.overdraw_threshold = MESH_OPTIMIZE_OVERDRAW_THRESHOLD;
+        optimize_mesh_indices(&optimize_info, &sorted_mi);
+
+        struct mesh_optimize_stats *stats = &optimize_info.stats;
+        printf("mesh_optimize_bench: %u triangles, cache of %u, acmr %.2f "
+                "to %.2f, atvr %.2f to %.2f\n", stats->triangle_count,
+                MESH_OPTIMIZE_CACHE_SIZE, stats->before.acmr,
+                stats->after.acmr, stats->before.atvr, stats->after.atvr);
+        printf("mesh_optimize_bench: overdraw of six views %.3f shuffled, "
+                "%.3f after tipsify, %.3f after the overdraw pass\n",
+                get_overdraw(&mi), get_overdraw(&tipsify_mi),
+                get_overdraw(&sorted_mi));
+
+        unsigned int bad_count = stats->after.acmr >= stats->before.acmr;
+        bad_count += !is_same_triangles(sorted_triangles, tipsify_mi.indices,
+                mi.index_count);
+        bad_count += !is_same_triangles(sorted_triangles, sorted_mi.indices,
+                mi.index_count);
+
+        free(sorted_mi.indices);
+        free(tipsify_mi.indices);
+        free(sorted_triangles);
+        release_test_mesh(&mi);
+
+        return bad_count;
+}
+
+static unsigned int bench_large_mesh(unsigned long long *state)
+{
+        struct mesh_info mi;
+        create_bumpy_sphere(&mi, LARGE_SEGMENT_COUNT, LARGE_RING_COUNT);
+        shuffle_triangles(state, &mi);
+
+        struct mesh_optimize_info optimize_info;
+        memset(&optimize_info, 0, sizeof (struct mesh_optimize_info));
+        optimize_info.overdraw_threshold = MESH_OPTIMIZE_OVERDRAW_THRESHOLD;
+        optimize_mesh_indices(&optimize_info, &mi);
+
+        struct mesh_optimize_stats *stats = &optimize_info.stats;
+        printf("mesh_optimize_bench: %u triangles, cache pass %.2f s, "
+                "overdraw pass %.2f s, acmr %.2f to %.2f\n",
+                stats->triangle_count, stats->cache_time,
+                stats->overdraw_time, stats->before.acmr, stats->after.acmr);
+
+        unsigned int bad_count = stats->after.acmr >= stats->before.acmr;
+        release_test_mesh(&mi);
+
+        return bad_count;
+}
+
+int main(void)
+{
+        unsigned long long state = 0xbf58476d1ce4e5b9ull;
+        unsigned int bad_count = bench_small_mesh(&state);
+        bad_count += bench_large_mesh(&state);
+
+        if (bad_count > 0)
+                printf("mesh_optimize_bench: %u bad reorders\n", bad_count);
+
+        return bad_count == 0 ? 0 : 1;
+}
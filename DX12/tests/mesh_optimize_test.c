@@ -0,0 +1,271 @@
+#include "mesh_optimize_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <stdlib.h>
+
+// Shuffles meshes so their index and vertex order is poor, optimizes them
+// and checks that every level of detail still holds the same triangles with
+// the same winding, that the vertices each corner reads are unchanged, and
+// that the simulated caches do better. The metrics are also checked on
+// small index lists worked out by hand.
+
+static void shuffle_mesh(unsigned long long *state, struct mesh_info *mi,
+        unsigned int unused_count)
+{
+        unsigned int triangle_count = mi->index_count / 3;
+        for (unsigned int t = triangle_count; t > 1; --t) {
+                unsigned int other = test_random(state) % t;
+                for (int k = 0; k < 3; ++k) {
+                        unsigned int index = mi->indices[(t - 1) * 3 + k];
+                        mi->indices[(t - 1) * 3 + k] =
+                                mi->indices[other * 3 + k];
+                        mi->indices[other * 3 + k] = index;
+                }
+        }
+
+        // Renumber the vertices at random, with some left unused in between
+        unsigned int vertex_count = mi->vertex_count + unused_count;
+        unsigned int *remap = malloc(vertex_count * sizeof (unsigned int));
+        for (unsigned int v = 0; v < vertex_count; ++v)
+                remap[v] = v;
+        for (unsigned int v = vertex_count; v > 1; --v) {
+                unsigned int other = test_random(state) % v;
+                unsigned int index = remap[v - 1];
+                remap[v - 1] = remap[other];
+                remap[other] = index;
+        }
+
+        struct vertex *vertices = calloc(vertex_count, sizeof (struct vertex));
+        for (unsigned int v = 0; v < mi->vertex_count; ++v)
+                vertices[remap[v]] = mi->verticies[v];
+        for (unsigned int v = mi->vertex_count; v < vertex_count; ++v)
+                vertices[remap[v]].position[0] = 1000.0f + v;
+        for (unsigned int i = 0; i < mi->index_count; ++i)
+                mi->indices[i] = remap[mi->indices[i]];
+
+        free(mi->verticies);
+        free(remap);
+        mi->verticies = vertices;
+        mi->vertex_count = vertex_count;
+}
+
+// Rotates each triangle to start at its smallest index, which keeps the
+// winding, and sorts them, so two ranges holding the same triangles compare
+// equal
+static int compare_triangles(const void *a, const void *b)
+{
+        const unsigned int *x = a;
+        const unsigned int *y = b;
+        for (int k = 0; k < 3; ++k) {
+                if (x[k] != y[k])
+                        return (x[k] > y[k]) - (x[k] < y[k]);
+        }
+
+        return 0;
+}
+
+static unsigned int *get_sorted_triangles(const unsigned int *indices,
+        unsigned int index_count)
+{
+        unsigned int *triangles = malloc((index_count + 1) *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < index_count; i += 3) {
+                int first = indices[i + 1] < indices[i] ? 1 : 0;
+                first = indices[i + 2] < indices[i + first] ? 2 : first;
+                for (int k = 0; k < 3; ++k)
+                        triangles[i + k] = indices[i + (first + k) % 3];
+        }
+        qsort(triangles, index_count / 3, 3 * sizeof (unsigned int),
+                compare_triangles);
+
+        return triangles;
+}
+
+static void check_same_triangles(const unsigned int *indices,
+        const unsigned int *other_indices, unsigned int index_count)
+{
+        unsigned int *triangles = get_sorted_triangles(indices, index_count);
+        unsigned int *other_triangles = get_sorted_triangles(other_indices,
+                index_count);
+        CHECK(memcmp(triangles, other_triangles,
+                index_count * sizeof (unsigned int)) == 0);
+        free(other_triangles);
+        free(triangles);
+}
+
+static void test_metrics(void)
+{
+        struct vertex_cache_metrics cache_metrics;
+        static const unsigned int triangle[] = { 0, 1, 2, 0, 1, 2 };
+        get_vertex_cache_metrics(triangle, 3, 3, 16, &cache_metrics);
+        CHECK(cache_metrics.miss_count == 3);
+        CHECK(cache_metrics.acmr == 3.0f);
+        CHECK(cache_metrics.atvr == 1.0f);
+        get_vertex_cache_metrics(triangle, 6, 3, 16, &cache_metrics);
+        CHECK(cache_metrics.miss_count == 3);
+        CHECK(cache_metrics.acmr == 1.5f);
+
+        // A FIFO of three has lost the first triangle by the time it comes
+        // back, one of six has not
+        static const unsigned int fifo[] = { 0, 1, 2, 3, 4, 5, 0, 1, 2 };
+        get_vertex_cache_metrics(fifo, 9, 6, 3, &cache_metrics);
+        CHECK(cache_metrics.miss_count == 9);
+        CHECK(cache_metrics.atvr == 1.5f);
+        get_vertex_cache_metrics(fifo, 9, 6, 6, &cache_metrics);
+        CHECK(cache_metrics.miss_count == 6);
+
+        get_vertex_cache_metrics(NULL, 0, 0, 16, &cache_metrics);
+        CHECK(cache_metrics.miss_count == 0);
+
+        // 40 byte vertices in 64 byte lines: vertex 0 takes a line, vertex
+        // 1 straddles two, the second of which vertex 2 shares
+        struct vertex_fetch_metrics fetch_metrics;
+        static const unsigned int fetches[] = { 0, 0, 1, 2 };
+        get_vertex_fetch_metrics(fetches, 1, 3, 40, 64, &fetch_metrics);
+        CHECK(fetch_metrics.fetched_size == 64);
+        CHECK(fetch_metrics.overfetch == 1.6f);
+        get_vertex_fetch_metrics(fetches, 4, 3, 40, 64, &fetch_metrics);
+        CHECK(fetch_metrics.fetched_size == 128);
+        CHECK(fetch_metrics.overfetch == 128.0f / 120.0f);
+}
+
+static void test_optimize(unsigned int segment_count, unsigned int ring_count,
+        float overdraw_threshold)
+{
+        unsigned long long state = 0xbf58476d1ce4e5b9ull ^ (segment_count *
+                1000ull + ring_count);
+
+        // The full mesh and a coarser level after it, here the same
+        // triangles again, and a third level overlapping the first which
+        // is left as the first leaves it
+        struct mesh_info mi;
+        create_test_torus(&mi, segment_count, ring_count);
+        shuffle_mesh(&state, &mi, segment_count);
+
+        unsigned int full_count = mi.index_count;
+        mi.indices = realloc(mi.indices, full_count * 2 *
+                sizeof (unsigned int));
+        memcpy(mi.indices + full_count, mi.indices,
+                full_count * sizeof (unsigned int));
+        mi.index_count = full_count * 2;
+        mi.lod_count = 3;
+        mi.lods[0].first_index = 0;
+        mi.lods[0].index_count = full_count;
+        mi.lods[1].first_index = full_count;
+        mi.lods[1].index_count = full_count;
+        mi.lods[2].first_index = full_count / 6 * 3;
+        mi.lods[2].index_count = full_count / 6 * 3;
+
+        unsigned int *original_indices = malloc(mi.index_count *
+                sizeof (unsigned int));
+        memcpy(original_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int));
+
+        struct mesh_optimize_info optimize_info;
+        memset(&optimize_info, 0, sizeof (struct mesh_optimize_info));
+        optimize_info.overdraw_threshold = overdraw_threshold;
+
+        // Without the overlapping level the result is the same
+        mi.lod_count = 2;
+        optimize_mesh_indices(&optimize_info, &mi);
+        unsigned int *skipped_indices = malloc(mi.index_count *
+                sizeof (unsigned int));
+        memcpy(skipped_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int));
+        memcpy(mi.indices, original_indices,
+                mi.index_count * sizeof (unsigned int));
+        mi.lod_count = 3;
+        optimize_mesh_indices(&optimize_info, &mi);
+        CHECK(memcmp(skipped_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int)) == 0);
+        free(skipped_indices);
+
+        struct mesh_optimize_stats *stats = &optimize_info.stats;
+        for (unsigned int l = 0; l < 2; ++l)
+                check_same_triangles(mi.indices + mi.lods[l].first_index,
+                        original_indices + mi.lods[l].first_index,
+                        mi.lods[l].index_count);
+        CHECK(stats->triangle_count == mi.index_count / 3);
+        CHECK(stats->cluster_count > 0);
+
+        struct vertex_cache_metrics metrics;
+        get_vertex_cache_metrics(mi.indices, mi.index_count, mi.vertex_count,
+                MESH_OPTIMIZE_CACHE_SIZE, &metrics);
+        CHECK(metrics.miss_count == stats->after.miss_count);
+        // The smallest torus fits in the cache whatever the order
+        CHECK(stats->after.acmr <= stats->before.acmr);
+        if (mi.vertex_count > MESH_OPTIMIZE_CACHE_SIZE * 2) {
+                CHECK(stats->after.acmr < stats->before.acmr);
+                // A torus is a regular grid, which Tipsify gets well under
+                // one miss per triangle on
+                CHECK(stats->after.acmr < 0.9f);
+        }
+
+        // The vertex read for every corner stays the same
+        struct vertex *original_vertices = malloc(mi.vertex_count *
+                sizeof (struct vertex));
+        memcpy(original_vertices, mi.verticies,
+                mi.vertex_count * sizeof (struct vertex));
+        memcpy(original_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int));
+        unsigned int original_vertex_count = mi.vertex_count;
+
+        optimize_vertex_fetch(&optimize_info, &mi);
+        CHECK(stats->stripped_vertex_count == segment_count);
+        CHECK(mi.vertex_count == original_vertex_count - segment_count);
+        CHECK(stats->fetch_after.overfetch < stats->fetch_before.overfetch);
+
+        unsigned int bad_count = 0;
+        unsigned int next_vertex = 0;
+        for (unsigned int i = 0; i < mi.index_count; ++i) {
+                unsigned int v = mi.indices[i];
+                bad_count += v >= mi.vertex_count || memcmp(
+                        &mi.verticies[v], &original_vertices[
+                        original_indices[i]], sizeof (struct vertex)) != 0;
+                // Numbered in the order the indices first use them
+                bad_count += v > next_vertex;
+                next_vertex += v == next_vertex;
+        }
+        CHECK(bad_count == 0);
+        CHECK(next_vertex == mi.vertex_count);
+
+        // Running it again changes nothing
+        memcpy(original_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int));
+        optimize_vertex_fetch(&optimize_info, &mi);
+        CHECK(stats->stripped_vertex_count == 0);
+        CHECK(memcmp(original_indices, mi.indices,
+                mi.index_count * sizeof (unsigned int)) == 0);
+
+        free(original_vertices);
+        free(original_indices);
+        release_test_mesh(&mi);
+}
+
+int main(void)
+{
+        test_metrics();
+
+        static const unsigned int sizes[][2] = {
+                { 3, 3 }, { 8, 5 }, { 64, 48 }, { 300, 200 }
+        };
+        for (unsigned int s = 0; s < sizeof (sizes) / sizeof (sizes[0]);
+                ++s) {
+                test_optimize(sizes[s][0], sizes[s][1], 0.0f);
+                test_optimize(sizes[s][0], sizes[s][1], 1.0f);
+                test_optimize(sizes[s][0], sizes[s][1],
+                        MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+        }
+
+        // A mesh without triangles
+        struct mesh_info mi;
+        memset(&mi, 0, sizeof (struct mesh_info));
+        struct mesh_optimize_info optimize_info;
+        memset(&optimize_info, 0, sizeof (struct mesh_optimize_info));
+        optimize_mesh_indices(&optimize_info, &mi);
+        optimize_vertex_fetch(&optimize_info, &mi);
+        CHECK(mi.vertex_count == 0);
+
+        return finish_test("mesh_optimize_test");
+}
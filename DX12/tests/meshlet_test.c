@@ -0,0 +1,407 @@
+#include "meshlet_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// Splits tori, a flat grid, a mesh with overlapping levels of detail and
+// degenerate triangles, and an empty mesh into meshlets under several
+// limits, with and without the job system, and checks that every level is
+// covered by its own meshlets holding each of its triangles once, within
+// the limits, inside their bounds. Cones are checked against random eyes:
+// a meshlet may only be called backfacing when every triangle in it faces
+// away, to within CONE_EPSILON of the distance to the eye.
+#define EYE_COUNT 64
+#define BOUNDS_EPSILON 1e-4f
+#define CONE_EPSILON 1e-3
+
+static int compare_triangles(const void *a, const void *b)
+{
+        const unsigned int *x = a;
+        const unsigned int *y = b;
+        for (int k = 0; k < 3; ++k) {
+                if (x[k] != y[k])
+                        return (x[k] > y[k]) - (x[k] < y[k]);
+        }
+
+        return 0;
+}
+
+static void check_same_triangles(unsigned int *triangles,
+        unsigned int *other_triangles, unsigned int index_count)
+{
+        qsort(triangles, index_count / 3, 3 * sizeof (unsigned int),
+                compare_triangles);
+        qsort(other_triangles, index_count / 3, 3 * sizeof (unsigned int),
+                compare_triangles);
+        CHECK(memcmp(triangles, other_triangles,
+                index_count * sizeof (unsigned int)) == 0);
+}
+
+// Every triangle with an area faces away from the eye. Front faces are
+// clockwise in a right handed space, as the builder takes them.
+static int is_backfacing_reference(struct mesh_info *mi,
+        const unsigned int *triangles, unsigned int triangle_count,
+        const float *eye)
+{
+        for (unsigned int t = 0; t < triangle_count; ++t) {
+                const float *p[3];
+                for (int k = 0; k < 3; ++k)
+                        p[k] = mi->verticies[triangles[t * 3 + k]].position;
+
+                double e1[3], e2[3], to_eye[3];
+                for (int k = 0; k < 3; ++k) {
+                        e1[k] = (double) p[1][k] - p[0][k];
+                        e2[k] = (double) p[2][k] - p[0][k];
+                        to_eye[k] = (double) eye[k] - p[0][k];
+                }
+
+                double normal[3] = {
+                        e2[1] * e1[2] - e2[2] * e1[1],
+                        e2[2] * e1[0] - e2[0] * e1[2],
+                        e2[0] * e1[1] - e2[1] * e1[0]
+                };
+                double length = sqrt(normal[0] * normal[0] +
+                        normal[1] * normal[1] + normal[2] * normal[2]);
+                if (length == 0.0)
+                        continue;
+
+                double distance = sqrt(to_eye[0] * to_eye[0] +
+                        to_eye[1] * to_eye[1] + to_eye[2] * to_eye[2]);
+                if ((normal[0] * to_eye[0] + normal[1] * to_eye[1] +
+                        normal[2] * to_eye[2]) / length >
+                        CONE_EPSILON * distance)
+                        return 0;
+        }
+
+        return 1;
+}
+
+static unsigned int check_meshlet(unsigned long long *state,
+        struct mesh_info *mi, struct meshlet_mesh_info *meshlet_mesh,
+        unsigned int index, unsigned int max_vertices,
+        unsigned int max_triangles, unsigned int *triangles,
+        unsigned int *stamps)
+{
+        struct meshlet *m = &meshlet_mesh->meshlets[index];
+        CHECK(m->triangle_count > 0 && m->triangle_count <= max_triangles);
+        CHECK(m->vertex_count > 0 && m->vertex_count <= max_vertices);
+        CHECK(m->first_triangle % 4 == 0);
+        CHECK(m->first_vertex + m->vertex_count <=
+                meshlet_mesh->vertex_count);
+        CHECK(m->first_triangle + m->triangle_count * 3 <=
+                meshlet_mesh->triangle_size);
+
+        // Each vertex once, and each used by a triangle
+        const unsigned int *vertices = meshlet_mesh->vertices +
+                m->first_vertex;
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < m->vertex_count; ++i) {
+                bad_count += vertices[i] >= mi->vertex_count ||
+                        stamps[vertices[i]] == index + 1;
+                stamps[vertices[i]] = index + 1;
+
+                const float *position = mi->verticies[vertices[i]].position;
+                double dist_sq = 0.0;
+                for (int k = 0; k < 3; ++k) {
+                        bad_count += position[k] < m->bounds_min[k] ||
+                                position[k] > m->bounds_max[k];
+                        double offset = (double) position[k] -
+                                m->bounding_sphere[k];
+                        dist_sq += offset * offset;
+                }
+                bad_count += sqrt(dist_sq) > m->bounding_sphere[3] *
+                        (1.0f + BOUNDS_EPSILON) + BOUNDS_EPSILON;
+        }
+
+        const unsigned char *local = meshlet_mesh->triangles +
+                m->first_triangle;
+        unsigned char is_used[MAX_MESHLET_VERTICES] = { 0 };
+        for (unsigned int i = 0; i < m->triangle_count * 3; ++i) {
+                bad_count += local[i] >= m->vertex_count;
+                if (local[i] < m->vertex_count) {
+                        is_used[local[i]] = 1;
+                        triangles[i] = vertices[local[i]];
+                }
+        }
+        for (unsigned int i = 0; i < m->vertex_count; ++i)
+                bad_count += !is_used[i];
+        CHECK(bad_count == 0);
+
+        // Eyes around the mesh and far off it
+        unsigned int culled_count = 0;
+        bad_count = 0;
+        for (unsigned int e = 0; e < EYE_COUNT; ++e) {
+                float range = e % 2 == 0 ? 6.0f : 100.0f;
+                vec3 eye;
+                for (int k = 0; k < 3; ++k)
+                        eye[k] = test_random_float(state, -range, range);
+
+                if (!is_meshlet_backfacing(m, eye))
+                        continue;
+
+                ++culled_count;
+                bad_count += !is_backfacing_reference(mi, triangles,
+                        m->triangle_count, eye);
+        }
+        CHECK(bad_count == 0);
+
+        return culled_count;
+}
+
+static void check_meshlet_mesh(unsigned long long *state,
+        struct mesh_info *mi, struct meshlet_mesh_info *meshlet_mesh,
+        unsigned int max_vertices, unsigned int max_triangles,
+        unsigned int *culled_count)
+{
+        struct mesh_lod whole_mesh = { 0, mi->index_count, 0.0f };
+        struct meshlet_lod all_meshlets = { 0, meshlet_mesh->meshlet_count };
+        unsigned int range_count = mi->lod_count > 0 ? mi->lod_count : 1;
+        struct mesh_lod *ranges = mi->lod_count > 0 ? mi->lods : &whole_mesh;
+        struct meshlet_lod *meshlet_ranges = mi->lod_count > 0 ?
+                meshlet_mesh->lods : &all_meshlets;
+        CHECK(meshlet_mesh->lod_count == mi->lod_count);
+
+        unsigned int *stamps = calloc(mi->vertex_count + 1,
+                sizeof (unsigned int));
+        unsigned int next_meshlet = 0;
+        unsigned int next_vertex = 0;
+        unsigned int next_triangle = 0;
+
+        for (unsigned int r = 0; r < range_count; ++r) {
+                // Levels follow each other in the meshlet mesh
+                struct meshlet_lod *meshlet_range = &meshlet_ranges[r];
+                CHECK(meshlet_range->first_meshlet == next_meshlet);
+                next_meshlet += meshlet_range->meshlet_count;
+
+                unsigned int index_count = ranges[r].index_count;
+                unsigned int *triangles = malloc((index_count + 1) *
+                        sizeof (unsigned int));
+                unsigned int *expected = malloc((index_count + 1) *
+                        sizeof (unsigned int));
+                if (index_count > 0)
+                        memcpy(expected, mi->indices + ranges[r].first_index,
+                                index_count * sizeof (unsigned int));
+
+                unsigned int triangle_count = 0;
+                for (unsigned int i = 0; i < meshlet_range->meshlet_count;
+                        ++i) {
+                        unsigned int index = meshlet_range->first_meshlet +
+                                i;
+                        struct meshlet *m = &meshlet_mesh->meshlets[index];
+                        CHECK(m->first_vertex == next_vertex);
+                        CHECK(m->first_triangle == next_triangle);
+                        next_vertex += m->vertex_count;
+                        next_triangle += (m->triangle_count * 3 + 3) & ~3u;
+                        if (triangle_count + m->triangle_count >
+                                index_count / 3) {
+                                CHECK(!"more triangles than the level");
+                                break;
+                        }
+
+                        *culled_count += check_meshlet(state, mi,
+                                meshlet_mesh, index, max_vertices,
+                                max_triangles, triangles +
+                                triangle_count * 3, stamps);
+                        triangle_count += m->triangle_count;
+                }
+
+                CHECK(triangle_count == index_count / 3);
+                if (triangle_count == index_count / 3)
+                        check_same_triangles(triangles, expected,
+                                index_count);
+
+                free(expected);
+                free(triangles);
+        }
+
+        CHECK(next_meshlet == meshlet_mesh->meshlet_count);
+        CHECK(next_vertex == meshlet_mesh->vertex_count);
+        CHECK(next_triangle == meshlet_mesh->triangle_size);
+
+        free(stamps);
+}
+
+// A square grid facing up in y, whose meshlets all share one cone
+static void create_test_grid(struct mesh_info *mi, unsigned int size)
+{
+        create_test_torus(mi, size, size);
+        for (unsigned int y = 0; y < size; ++y) {
+                for (unsigned int x = 0; x < size; ++x) {
+                        float *position = mi->verticies[y * size + x].position;
+                        position[0] = (float) x;
+                        position[1] = 0.0f;
+                        position[2] = (float) y;
+                }
+        }
+
+        // Drop the quads that wrap around
+        unsigned int *index = mi->indices;
+        for (unsigned int y = 0; y + 1 < size; ++y) {
+                for (unsigned int x = 0; x + 1 < size; ++x) {
+                        unsigned int a = y * size + x;
+                        *index++ = a;
+                        *index++ = a + size;
+                        *index++ = a + 1;
+                        *index++ = a + 1;
+                        *index++ = a + size;
+                        *index++ = a + size + 1;
+                }
+        }
+
+        mi->index_count = (unsigned int) (index - mi->indices);
+        mi->lods[0].index_count = mi->index_count;
+}
+
+// Levels of a torus where the second overlaps the first and the first has
+// triangles using a vertex twice or with no area at the end
+static void create_test_lod_mesh(struct mesh_info *mi)
+{
+        create_test_torus(mi, 24, 16);
+        unsigned int full_count = mi->index_count;
+        static const unsigned int degenerate[] = {
+                5, 5, 6, 7, 8, 7, 9, 9, 9, 0, 24, 48
+        };
+        unsigned int degenerate_count = sizeof (degenerate) /
+                sizeof (degenerate[0]);
+
+        mi->indices = realloc(mi->indices, (full_count + degenerate_count) *
+                sizeof (unsigned int));
+        memcpy(mi->indices + full_count, degenerate, sizeof (degenerate));
+        // Three vertices in a line
+        for (unsigned int r = 0; r < 3; ++r) {
+                float *position = mi->verticies[r * 24].position;
+                position[0] = 1.0f + r;
+                position[1] = 0.0f;
+                position[2] = 0.0f;
+        }
+
+        mi->index_count = full_count + degenerate_count;
+        mi->lod_count = 3;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+        mi->lods[1].first_index = full_count / 6 * 3;
+        mi->lods[1].index_count = full_count / 2;
+        mi->lods[2].first_index = 0;
+        mi->lods[2].index_count = 0;
+}
+
+static void test_meshlets(struct job_system_info *job_system,
+        unsigned int max_vertices, unsigned int max_triangles)
+{
+        static const unsigned int sizes[][2] = {
+                { 3, 3 }, { 8, 5 }, { 64, 48 }, { 300, 200 }
+        };
+        enum { TORUS_COUNT = sizeof (sizes) / sizeof (sizes[0]) };
+        enum { GRID = TORUS_COUNT, LOD_MESH, EMPTY_MESH, MESH_COUNT };
+
+        struct mesh_info meshes[MESH_COUNT];
+        for (unsigned int i = 0; i < TORUS_COUNT; ++i)
+                create_test_torus(&meshes[i], sizes[i][0], sizes[i][1]);
+        create_test_grid(&meshes[GRID], 40);
+        create_test_lod_mesh(&meshes[LOD_MESH]);
+        memset(&meshes[EMPTY_MESH], 0, sizeof (struct mesh_info));
+
+        struct meshlet_build_info build_info;
+        memset(&build_info, 0, sizeof (struct meshlet_build_info));
+        build_info.max_vertices = max_vertices;
+        build_info.max_triangles = max_triangles;
+        build_info.cone_weight = -1.0f;
+
+        // Serially and on the job system, which must agree exactly
+        struct meshlet_mesh_info meshlet_meshes[MESH_COUNT];
+        struct meshlet_mesh_info parallel_meshes[MESH_COUNT];
+        build_meshlets(&build_info, meshes, MESH_COUNT, meshlet_meshes);
+        build_info.job_system = job_system;
+        build_meshlets(&build_info, meshes, MESH_COUNT, parallel_meshes);
+
+        unsigned int limit_vertices = max_vertices != 0 &&
+                max_vertices < MAX_MESHLET_VERTICES ?
+                max_vertices : MAX_MESHLET_VERTICES;
+        unsigned int limit_triangles = max_triangles != 0 &&
+                max_triangles < MAX_MESHLET_TRIANGLES ?
+                max_triangles : MAX_MESHLET_TRIANGLES;
+        unsigned long long state = 0x94d049bb133111ebull ^
+                (max_vertices * 1000ull + max_triangles);
+        unsigned int triangle_count = 0;
+        unsigned int meshlet_count = 0;
+
+        for (unsigned int i = 0; i < MESH_COUNT; ++i) {
+                struct meshlet_mesh_info *meshlet_mesh = &meshlet_meshes[i];
+                struct meshlet_mesh_info *parallel_mesh = &parallel_meshes[i];
+                unsigned int culled_count = 0;
+                check_meshlet_mesh(&state, &meshes[i], meshlet_mesh,
+                        limit_vertices, limit_triangles, &culled_count);
+
+                CHECK(parallel_mesh->meshlet_count ==
+                        meshlet_mesh->meshlet_count);
+                CHECK(parallel_mesh->vertex_count ==
+                        meshlet_mesh->vertex_count);
+                CHECK(parallel_mesh->triangle_size ==
+                        meshlet_mesh->triangle_size);
+                CHECK(memcmp(parallel_mesh->meshlets, meshlet_mesh->meshlets,
+                        meshlet_mesh->meshlet_count *
+                        sizeof (struct meshlet)) == 0);
+                CHECK(memcmp(parallel_mesh->vertices, meshlet_mesh->vertices,
+                        meshlet_mesh->vertex_count *
+                        sizeof (unsigned int)) == 0);
+                CHECK(memcmp(parallel_mesh->triangles,
+                        meshlet_mesh->triangles,
+                        meshlet_mesh->triangle_size) == 0);
+
+                // Every large torus has meshlets seen only from behind for
+                // some eyes, and their triangles in as few meshlets as the
+                // limits allow within a few times over
+                if (i >= 2 && i < TORUS_COUNT) {
+                        CHECK(culled_count > 0);
+                        CHECK(meshlet_mesh->meshlet_count * limit_triangles <
+                                meshes[i].index_count / 3 * 4);
+                }
+
+                for (unsigned int m = 0; m < meshlet_mesh->meshlet_count; ++m)
+                        triangle_count +=
+                                meshlet_mesh->meshlets[m].triangle_count;
+                meshlet_count += meshlet_mesh->meshlet_count;
+        }
+
+        CHECK(build_info.stats.mesh_count == MESH_COUNT);
+        CHECK(build_info.stats.meshlet_count == meshlet_count);
+        CHECK(build_info.stats.triangle_count == triangle_count);
+
+        // The grid is flat, so its cones are as tight as they get and every
+        // meshlet is culled from far enough below it
+        struct meshlet_mesh_info *grid = &meshlet_meshes[GRID];
+        unsigned int bad_count = 0;
+        for (unsigned int m = 0; m < grid->meshlet_count; ++m) {
+                struct meshlet *meshlet = &grid->meshlets[m];
+                vec3 eye = { 20.0f, -1000.0f * meshlet->cone_axis[1], 20.0f };
+                bad_count += meshlet->cone_cutoff > 1e-3f ||
+                        fabsf(meshlet->cone_axis[1]) < 0.999f ||
+                        !is_meshlet_backfacing(meshlet, eye);
+        }
+        CHECK(bad_count == 0);
+
+        for (unsigned int i = 0; i < MESH_COUNT; ++i) {
+                release_meshlets(&parallel_meshes[i]);
+                release_meshlets(&meshlet_meshes[i]);
+                release_test_mesh(&meshes[i]);
+        }
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        // The default limits, smaller ones, one triangle each, and limits
+        // past the largest allowed, which fall back to it
+        test_meshlets(&job_system, 0, 0);
+        test_meshlets(&job_system, 16, 8);
+        test_meshlets(&job_system, 3, 1);
+        test_meshlets(&job_system, 200, 64);
+
+        release_job_system(&job_system);
+
+        return finish_test("meshlet_test");
+}
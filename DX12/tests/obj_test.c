@@ -0,0 +1,355 @@
+#include "obj_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// Writes OBJ files with a known mesh and checks what the importer reads
+// back, on a single chunk and split across the job system. Values are
+// multiples of 1/64 printed in full, so they parse exactly. Faces mix the
+// corner forms, polygon sizes and relative indices, and attributes keep
+// being added between them.
+#define BLOCK_COUNT 2000
+#define MAX_POLYGON_SIZE 6
+#define NO_INDEX 0xffffffff
+
+struct test_corner {
+        unsigned int position;
+        unsigned int uv;
+        unsigned int normal;
+};
+
+struct test_obj {
+        unsigned int position_count;
+        unsigned int uv_count;
+        unsigned int normal_count;
+        unsigned int corner_count;
+        float (*positions)[3];
+        float (*colours)[3];
+        float (*uvs)[2];
+        float (*normals)[3];
+        // Three per triangle, in the order the faces are written
+        struct test_corner *corners;
+};
+
+static float random_value(unsigned long long *state)
+{
+        return (float) ((int) (test_random(state) % 128001) - 64000) / 64.0f;
+}
+
+static void write_attributes(unsigned long long *state, FILE *file,
+        struct test_obj *obj, const char *line_end)
+{
+        unsigned int position_count = 3 + test_random(state) % 8;
+        for (unsigned int i = 0; i < position_count; ++i) {
+                float *p = obj->positions[obj->position_count];
+                float *c = obj->colours[obj->position_count++];
+                for (int k = 0; k < 3; ++k) {
+                        p[k] = random_value(state);
+                        c[k] = 1.0f;
+                }
+
+                // Some positions carry a colour, some a w
+                switch (test_random(state) % 3) {
+                case 0:
+                        for (int k = 0; k < 3; ++k)
+                                c[k] = (float) (test_random(state) % 65) /
+                                        64.0f;
+                        fprintf(file, "v %.6f %.6f %.6f %.6f %.6f %.6f%s",
+                                p[0], p[1], p[2], c[0], c[1], c[2], line_end);
+                        break;
+                case 1:
+                        fprintf(file, "v  %.6f\t%.6f %.6f 1.0%s", p[0], p[1],
+                                p[2], line_end);
+                        break;
+                default:
+                        fprintf(file, "v %.6f %.6f %.6f%s", p[0], p[1], p[2],
+                                line_end);
+                        break;
+                }
+        }
+
+        unsigned int uv_count = test_random(state) % 4;
+        for (unsigned int i = 0; i < uv_count; ++i) {
+                float *uv = obj->uvs[obj->uv_count++];
+                uv[0] = random_value(state);
+                uv[1] = random_value(state);
+                fprintf(file, "vt %.6f %.6f%s", uv[0], uv[1], line_end);
+        }
+
+        unsigned int normal_count = test_random(state) % 4;
+        for (unsigned int i = 0; i < normal_count; ++i) {
+                float *n = obj->normals[obj->normal_count++];
+                for (int k = 0; k < 3; ++k)
+                        n[k] = random_value(state);
+                fprintf(file, "vn %.6f %.6f %.6f%s", n[0], n[1], n[2],
+                        line_end);
+        }
+}
+
+// Positive indices count from one, negative ones back from the last
+// attribute written
+static void write_index(unsigned long long *state, FILE *file,
+        unsigned int index, unsigned int count)
+{
+        if (test_random(state) % 2 == 0)
+                fprintf(file, "%u", index + 1);
+        else
+                fprintf(file, "-%u", count - index);
+}
+
+static void write_face(unsigned long long *state, FILE *file,
+        struct test_obj *obj, const char *line_end)
+{
+        // Indices are picked from the last few attributes, so corners and
+        // vertices repeat
+        unsigned int size = 3 + test_random(state) % (MAX_POLYGON_SIZE - 2);
+        int has_uv = obj->uv_count > 0 && test_random(state) % 4 != 0;
+        int has_normal = obj->normal_count > 0 && test_random(state) % 4 != 0;
+
+        struct test_corner polygon[MAX_POLYGON_SIZE];
+        fputc('f', file);
+        for (unsigned int i = 0; i < size; ++i) {
+                struct test_corner *corner = &polygon[i];
+                unsigned int span;
+
+                span = obj->position_count < 12 ? obj->position_count : 12;
+                corner->position = obj->position_count - 1 -
+                        test_random(state) % span;
+                span = obj->uv_count < 4 ? obj->uv_count : 4;
+                corner->uv = has_uv ? obj->uv_count - 1 -
+                        test_random(state) % span : NO_INDEX;
+                span = obj->normal_count < 4 ? obj->normal_count : 4;
+                corner->normal = has_normal ? obj->normal_count - 1 -
+                        test_random(state) % span : NO_INDEX;
+
+                fputc(' ', file);
+                write_index(state, file, corner->position,
+                        obj->position_count);
+                if (has_uv || has_normal)
+                        fputc('/', file);
+                if (has_uv)
+                        write_index(state, file, corner->uv, obj->uv_count);
+                if (has_normal) {
+                        fputc('/', file);
+                        write_index(state, file, corner->normal,
+                                obj->normal_count);
+                }
+        }
+        fprintf(file, "%s", line_end);
+
+        // Triangulated as a fan from the first corner
+        for (unsigned int i = 2; i < size; ++i) {
+                obj->corners[obj->corner_count++] = polygon[0];
+                obj->corners[obj->corner_count++] = polygon[i - 1];
+                obj->corners[obj->corner_count++] = polygon[i];
+        }
+}
+
+static void write_test_obj(const char *path, struct test_obj *obj,
+        unsigned int block_count, int has_crlf)
+{
+        unsigned long long state = 0x853c49e6748fea9bull ^ block_count;
+        const char *line_end = has_crlf ? "\r\n" : "\n";
+
+        memset(obj, 0, sizeof (struct test_obj));
+        obj->positions = malloc(block_count * 10 * sizeof (float) * 3);
+        obj->colours = malloc(block_count * 10 * sizeof (float) * 3);
+        obj->uvs = malloc((block_count * 3 + 1) * sizeof (float) * 2);
+        obj->normals = malloc((block_count * 3 + 1) * sizeof (float) * 3);
+        obj->corners = malloc(block_count * 8 * (MAX_POLYGON_SIZE - 2) * 3 *
+                sizeof (struct test_corner));
+
+        FILE *file = fopen(path, "wb");
+        fprintf(file, "# Test mesh%smtllib test.mtl%so test%s", line_end,
+                line_end, line_end);
+        for (unsigned int b = 0; b < block_count; ++b) {
+                write_attributes(&state, file, obj, line_end);
+                if (b % 16 == 0)
+                        fprintf(file, "usemtl m%u%ss off%s%s", b, line_end,
+                                line_end, line_end);
+
+                unsigned int face_count = 1 + test_random(&state) % 8;
+                for (unsigned int f = 0; f < face_count; ++f)
+                        write_face(&state, file, obj, line_end);
+        }
+        fclose(file);
+}
+
+static void release_test_obj(struct test_obj *obj)
+{
+        free(obj->corners);
+        free(obj->normals);
+        free(obj->uvs);
+        free(obj->colours);
+        free(obj->positions);
+}
+
+static int is_same_corner(struct test_corner *a, struct test_corner *b)
+{
+        return a->position == b->position && a->uv == b->uv &&
+                a->normal == b->normal;
+}
+
+// Vertices are the distinct corners in the order they are first used,
+// found here with a linear probe over every corner
+static void check_mesh(struct test_obj *obj, struct obj_info *obj_info,
+        struct mesh_info *mi)
+{
+        CHECK(mi->lod_count == 1);
+        CHECK(mi->index_count == obj->corner_count);
+        CHECK(mi->lods[0].first_index == 0);
+        CHECK(mi->lods[0].index_count == obj->corner_count);
+        CHECK((obj_info->normals != NULL) == (obj->normal_count > 0));
+        if (mi->index_count != obj->corner_count)
+                return;
+
+        unsigned int table_size = 1;
+        while (table_size < obj->corner_count * 2)
+                table_size *= 2;
+        unsigned int *table = malloc(table_size * sizeof (unsigned int));
+        memset(table, 0xff, table_size * sizeof (unsigned int));
+        struct test_corner *vertices = malloc(obj->corner_count *
+                sizeof (struct test_corner));
+        unsigned int vertex_count = 0;
+
+        unsigned int bad_index_count = 0;
+        for (unsigned int i = 0; i < obj->corner_count; ++i) {
+                struct test_corner *corner = &obj->corners[i];
+                unsigned int slot = (corner->position * 73856093u ^
+                        corner->uv * 19349663u ^ corner->normal * 83492791u) &
+                        (table_size - 1);
+                while (table[slot] != NO_INDEX &&
+                        !is_same_corner(&vertices[table[slot]], corner))
+                        slot = (slot + 1) & (table_size - 1);
+
+                if (table[slot] == NO_INDEX) {
+                        table[slot] = vertex_count;
+                        vertices[vertex_count++] = *corner;
+                }
+
+                bad_index_count += mi->indices[i] != table[slot];
+        }
+        CHECK(bad_index_count == 0);
+        CHECK(mi->vertex_count == vertex_count);
+        CHECK(obj_info->stats.triangle_count == obj->corner_count / 3);
+        CHECK(obj_info->stats.position_count == obj->position_count);
+        CHECK(obj_info->stats.uv_count == obj->uv_count);
+        CHECK(obj_info->stats.normal_count == obj->normal_count);
+
+        unsigned int bad_vertex_count = 0;
+        for (unsigned int v = 0; v < vertex_count &&
+                v < mi->vertex_count; ++v) {
+                struct test_corner *corner = &vertices[v];
+                struct vertex *vertex = &mi->verticies[v];
+                float uv[2] = { 0.0f, 0.0f };
+                float normal[3] = { 0.0f, 0.0f, 0.0f };
+                if (corner->uv != NO_INDEX)
+                        memcpy(uv, obj->uvs[corner->uv], sizeof (uv));
+                if (corner->normal != NO_INDEX)
+                        memcpy(normal, obj->normals[corner->normal],
+                                sizeof (normal));
+
+                int is_same = memcmp(vertex->position,
+                        obj->positions[corner->position],
+                        sizeof (float) * 3) == 0 &&
+                        vertex->position[3] == 1.0f &&
+                        memcmp(vertex->colour, obj->colours[corner->position],
+                        sizeof (float) * 3) == 0 &&
+                        vertex->colour[3] == 1.0f &&
+                        memcmp(vertex->uv, uv, sizeof (uv)) == 0;
+                if (obj_info->normals != NULL)
+                        is_same &= memcmp(obj_info->normals[v], normal,
+                                sizeof (normal)) == 0;
+                bad_vertex_count += !is_same;
+        }
+        CHECK(bad_vertex_count == 0);
+
+        free(vertices);
+        free(table);
+}
+
+static void test_load(struct job_system_info *job_system, const char *path,
+        unsigned int block_count, int has_crlf)
+{
+        struct test_obj obj;
+        write_test_obj(path, &obj, block_count, has_crlf);
+
+        struct obj_info obj_info;
+        memset(&obj_info, 0, sizeof (struct obj_info));
+        snprintf(obj_info.path, MAX_OBJ_PATH, "%s", path);
+        obj_info.job_system = job_system;
+
+        struct mesh_info mi;
+        memset(&mi, 0, sizeof (struct mesh_info));
+        CHECK(load_obj(&obj_info, &mi));
+        if (obj_info.stats.file_size >= OBJ_PARALLEL_MIN_SIZE &&
+                job_system != NULL)
+                CHECK(obj_info.stats.chunk_count > 1);
+        check_mesh(&obj, &obj_info, &mi);
+
+        release_obj(&obj_info, &mi);
+        release_test_obj(&obj);
+}
+
+// Files that refer to attributes that are not there are refused
+static void test_bad_index(const char *path, const char *text)
+{
+        FILE *file = fopen(path, "wb");
+        fputs(text, file);
+        fclose(file);
+
+        struct obj_info obj_info;
+        memset(&obj_info, 0, sizeof (struct obj_info));
+        snprintf(obj_info.path, MAX_OBJ_PATH, "%s", path);
+
+        struct mesh_info mi;
+        memset(&mi, 0, sizeof (struct mesh_info));
+        CHECK(!load_obj(&obj_info, &mi));
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        char path[] = "/tmp/obj_test_XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0)
+                return finish_test("obj_test");
+        close(fd);
+
+        // The large files are past the size that is split into chunks
+        static const unsigned int block_counts[] = { 1, 10, 300,
+                BLOCK_COUNT * 8 };
+        for (unsigned int b = 0; b < sizeof (block_counts) /
+                sizeof (block_counts[0]); ++b) {
+                for (int has_crlf = 0; has_crlf < 2; ++has_crlf) {
+                        test_load(NULL, path, block_counts[b], has_crlf);
+                        test_load(&job_system, path, block_counts[b],
+                                has_crlf);
+                }
+        }
+
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n");
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n");
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -4 -2 -1\n");
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\n"
+                "f 1/1 2/2 3/1\n");
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\n"
+                "f 1//1 2//1 3//2\n");
+        // Relative indices only see what comes before the face
+        test_bad_index(path, "v 0 0 0\nv 1 0 0\nf -1 -2 -3\nv 0 1 0\n");
+        unlink(path);
+
+        struct obj_info missing_info;
+        memset(&missing_info, 0, sizeof (struct obj_info));
+        snprintf(missing_info.path, MAX_OBJ_PATH, "%s", path);
+        struct mesh_info mi;
+        CHECK(!load_obj(&missing_info, &mi));
+
+        release_job_system(&job_system);
+
+        return finish_test("obj_test");
+}
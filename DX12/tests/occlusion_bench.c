@@ -0,0 +1,241 @@
+#include "occlusion_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Times rasterizing random occluder triangles into a depth buffer the size
+// main.c uses, and testing random boxes against the pyramid they leave, on
+// the job system. Timings depend on the machine and are only reported; the
+// run fails when the boxes the job system keeps are not the ones a single
+// thread keeps, or not the ones testing each box on its own keeps.
+#define WIDTH 256
+#define HEIGHT 128
+#define BENCH_TRIANGLE_COUNT 200000
+#define BENCH_BOX_COUNT 1000000
+#define BENCH_RUN_COUNT 5
+#define MAX_TRIANGLE_SIZE 0.4f
+#define MAX_BOX_SIZE 2.0f
+
+// D3D style, looking down -z with clip space z from 0 to w
+static void calc_bench_projection(mat4x4 m, float fov_y, float aspect,
+        float near_z, float far_z)
+{
+        float f = 1.0f / tanf(fov_y * 0.5f);
+
+        memset(m, 0, sizeof (mat4x4));
+        m[0][0] = f / aspect;
+        m[1][1] = f;
+        m[2][2] = far_z / (near_z - far_z);
+        m[2][3] = -1.0f;
+        m[3][2] = near_z * far_z / (near_z - far_z);
+}
+
+// A point in front of the camera, spread over about what it sees
+static void get_random_point(unsigned long long *state, vec3 point)
+{
+        point[2] = test_random_float(state, -100.0f, -5.0f);
+        point[0] = test_random_float(state, -1.0f, 1.0f) * -point[2];
+        point[1] = test_random_float(state, -0.5f, 0.5f) * -point[2];
+}
+
+// Every triangle in one mesh, so it is a single occluder
+static void create_random_triangles(unsigned long long *state,
+        struct mesh_info *mi)
+{
+        memset(mi, 0, sizeof (struct mesh_info));
+        mi->vertex_count = BENCH_TRIANGLE_COUNT * 3;
+        mi->verticies = malloc(mi->vertex_count * sizeof (struct vertex));
+        mi->index_count = BENCH_TRIANGLE_COUNT * 3;
+        mi->indices = malloc(mi->index_count * sizeof (unsigned int));
+
+        for (unsigned int t = 0; t < BENCH_TRIANGLE_COUNT; ++t) {
+                vec3 centre;
+                get_random_point(state, centre);
+                for (int c = 0; c < 3; ++c) {
+                        struct vertex *v = &mi->verticies[t * 3 + c];
+                        memset(v, 0, sizeof (struct vertex));
+                        for (int k = 0; k < 3; ++k)
+                                v->position[k] = centre[k] +
+                                        test_random_float(state,
+                                        -MAX_TRIANGLE_SIZE,
+                                        MAX_TRIANGLE_SIZE);
+                        v->position[3] = 1.0f;
+                        mi->indices[t * 3 + c] = t * 3 + c;
+                }
+        }
+
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+}
+
+static double time_rasterize(struct occlusion_info *occlusion_info,
+        struct mesh_info *mi, mat4x4 pv_mat)
+{
+        mat4x4 world_mat;
+        mat4x4_identity(world_mat);
+
+        double best_time = 1e30;
+        for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                begin_occlusion(occlusion_info, pv_mat);
+                add_occluder(occlusion_info, mi, 0, world_mat);
+
+                double start_time = get_time_in_secs();
+                rasterize_occluders(occlusion_info);
+                double raster_time = get_time_in_secs() - start_time;
+
+                if (raster_time < best_time)
+                        best_time = raster_time;
+        }
+
+        return best_time * 1000.0;
+}
+
+static double time_boxes(struct occlusion_info *occlusion_info,
+        struct cull_volume_info *volume_info, const unsigned int *indices,
+        unsigned int *visible_indices, unsigned int *visible_count)
+{
+        double best_time = 1e30;
+        for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                double start_time = get_time_in_secs();
+                *visible_count = cull_occluded_volumes(occlusion_info,
+                        volume_info, indices, volume_info->count,
+                        visible_indices);
+                double test_time = get_time_in_secs() - start_time;
+
+                if (test_time < best_time)
+                        best_time = test_time;
+        }
+
+        return best_time * 1000.0;
+}
+
+// Boxes kept by one list and not the other, and kept boxes that a test of
+// their own finds occluded or the other way round, every 97th box
+static unsigned int count_mismatches(struct occlusion_info *occlusion_info,
+        struct cull_volume_info *volume_info,
+        const unsigned int *visible_indices, unsigned int visible_count,
+        const unsigned int *single_indices, unsigned int single_count)
+{
+        unsigned int mismatch_count = visible_count != single_count;
+        if (mismatch_count == 0)
+                mismatch_count += memcmp(visible_indices, single_indices,
+                        visible_count * sizeof (unsigned int)) != 0;
+
+        unsigned int next = 0;
+        for (unsigned int i = 0; i < volume_info->count; ++i) {
+                int is_listed = next < visible_count &&
+                        visible_indices[next] == i;
+                next += is_listed;
+                if (i % 97 != 0)
+                        continue;
+
+                vec3 centre = {
+                        volume_info->x[i], volume_info->y[i],
+                        volume_info->z[i]
+                };
+                vec3 extents = {
+                        volume_info->extent_x[i], volume_info->extent_y[i],
+                        volume_info->extent_z[i]
+                };
+                mismatch_count += is_listed == is_aabb_occluded(
+                        occlusion_info, centre, extents);
+        }
+
+        return mismatch_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        vec3 eye = { 0.0f, 0.0f, 0.0f };
+        vec3 center = { 0.0f, 0.0f, -1.0f };
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4 pv_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        calc_bench_projection(projection_mat, 1.0f, (float) WIDTH / HEIGHT,
+                0.5f, 200.0f);
+        mat4x4_mul(pv_mat, projection_mat, view_mat);
+
+        unsigned long long state = 0x5851f42d4c957f2dull;
+        struct mesh_info mi;
+        create_random_triangles(&state, &mi);
+
+        struct occlusion_info occlusion_info;
+        memset(&occlusion_info, 0, sizeof (struct occlusion_info));
+        occlusion_info.job_system = &job_system;
+        occlusion_info.width = WIDTH;
+        occlusion_info.height = HEIGHT;
+        occlusion_info.max_occluders = 1;
+        occlusion_info.max_triangles = BENCH_TRIANGLE_COUNT;
+        create_occlusion(&occlusion_info);
+
+        double raster_ms = time_rasterize(&occlusion_info, &mi, pv_mat);
+
+        struct cull_volume_info volume_info;
+        memset(&volume_info, 0, sizeof (struct cull_volume_info));
+        volume_info.type = CULL_VOLUME_TYPE_AABB;
+        volume_info.capacity = BENCH_BOX_COUNT;
+        create_cull_volumes(&volume_info);
+        unsigned int *indices = malloc(BENCH_BOX_COUNT *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < BENCH_BOX_COUNT; ++i) {
+                vec3 centre;
+                vec3 extents;
+                get_random_point(&state, centre);
+                for (int k = 0; k < 3; ++k)
+                        extents[k] = test_random_float(&state, 0.0f,
+                                MAX_BOX_SIZE);
+                add_cull_aabb(&volume_info, centre, extents);
+                indices[i] = i;
+        }
+
+        unsigned int *visible_indices = malloc(BENCH_BOX_COUNT *
+                sizeof (unsigned int));
+        unsigned int *single_indices = malloc(BENCH_BOX_COUNT *
+                sizeof (unsigned int));
+        unsigned int visible_count;
+        double box_ms = time_boxes(&occlusion_info, &volume_info, indices,
+                visible_indices, &visible_count);
+
+        occlusion_info.job_system = NULL;
+        unsigned int single_count;
+        double single_box_ms = time_boxes(&occlusion_info, &volume_info,
+                indices, single_indices, &single_count);
+
+        unsigned int mismatch_count = count_mismatches(&occlusion_info,
+                &volume_info, visible_indices, visible_count, single_indices,
+                single_count);
+
+        printf("occlusion_bench: %ux%u, %u workers, %u triangles %.2f ms "
+                "(%.2fM per second)\n", WIDTH, HEIGHT,
+                job_system.worker_count, BENCH_TRIANGLE_COUNT, raster_ms,
+                BENCH_TRIANGLE_COUNT / raster_ms / 1000.0);
+        printf("occlusion_bench: %u boxes %.2f ms (%.2fM per second), "
+                "one thread %.2f ms, %.1f%% occluded\n", BENCH_BOX_COUNT,
+                box_ms, BENCH_BOX_COUNT / box_ms / 1000.0, single_box_ms,
+                100.0 * (BENCH_BOX_COUNT - visible_count) / BENCH_BOX_COUNT);
+
+        free(single_indices);
+        free(visible_indices);
+        free(indices);
+        release_cull_volumes(&volume_info);
+        release_occlusion(&occlusion_info);
+        release_test_mesh(&mi);
+        release_job_system(&job_system);
+
+        if (mismatch_count > 0)
+                printf("occlusion_bench: %u boxes tested differently\n",
+                        mismatch_count);
+
+        return mismatch_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+#include "occlusion_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Rasterizes a scene of tori and walls and checks the depth buffer against
+// a scalar reference in double precision, the pyramid against the depth
+// buffer, and the box tests against looking at every pixel under the box.
+// Pixel centres within EDGE_EPSILON of a triangle edge may go either way,
+// as the rows are stepped rather than evaluated at every pixel.
+#define WIDTH 256
+#define HEIGHT 128
+#define TORUS_COUNT 12
+#define WALL_COUNT 4
+#define BOX_COUNT 4000
+#define EDGE_EPSILON 1e-3
+#define DEPTH_EPSILON 1e-4
+// Kept equal to the one of occlusion_interface.c
+#define MIN_W 1e-5f
+
+struct test_scene {
+        struct mesh_info torus;
+        struct mesh_info wall;
+        mat4x4 pv_mat;
+        mat4x4 torus_mats[TORUS_COUNT];
+        mat4x4 wall_mats[WALL_COUNT];
+};
+
+// D3D style, looking down -z with clip space z from 0 to w
+static void calc_test_projection(mat4x4 m, float fov_y, float aspect,
+        float near_z, float far_z)
+{
+        float f = 1.0f / tanf(fov_y * 0.5f);
+
+        memset(m, 0, sizeof (mat4x4));
+        m[0][0] = f / aspect;
+        m[1][1] = f;
+        m[2][2] = far_z / (near_z - far_z);
+        m[2][3] = -1.0f;
+        m[3][2] = near_z * far_z / (near_z - far_z);
+}
+
+// A square in the xy plane, with a second level of detail covering only
+// its lower half
+static void create_test_wall(struct mesh_info *mi)
+{
+        static const float corners[6][2] = {
+                { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f },
+                { -1.0f, 1.0f }, { -1.0f, 0.0f }, { 1.0f, 0.0f }
+        };
+        static const unsigned int indices[18] = {
+                0, 1, 2, 0, 2, 3,
+                0, 1, 5, 0, 5, 4
+        };
+
+        memset(mi, 0, sizeof (struct mesh_info));
+        mi->vertex_count = 6;
+        mi->verticies = malloc(6 * sizeof (struct vertex));
+        for (int i = 0; i < 6; ++i) {
+                struct vertex *v = &mi->verticies[i];
+                memset(v, 0, sizeof (struct vertex));
+                v->position[0] = corners[i][0];
+                v->position[1] = corners[i][1];
+                v->position[3] = 1.0f;
+        }
+
+        mi->index_count = 18;
+        mi->indices = malloc(18 * sizeof (unsigned int));
+        memcpy(mi->indices, indices, sizeof (indices));
+        mi->lod_count = 2;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = 6;
+        mi->lods[1].first_index = 6;
+        mi->lods[1].index_count = 6;
+}
+
+static void create_test_scene(unsigned long long *state,
+        struct test_scene *scene)
+{
+        create_test_torus(&scene->torus, 12, 10);
+        create_test_wall(&scene->wall);
+
+        vec3 eye = { 0.0f, 0.0f, 0.0f };
+        vec3 center = { 0.0f, 0.0f, -1.0f };
+        vec3 up = { 0.0f, 1.0f, 0.0f };
+        mat4x4 view_mat;
+        mat4x4 projection_mat;
+        mat4x4_look_at(view_mat, eye, center, up);
+        calc_test_projection(projection_mat, 1.0f, (float) WIDTH / HEIGHT,
+                0.5f, 200.0f);
+        mat4x4_mul(scene->pv_mat, projection_mat, view_mat);
+
+        // Some occluders reach behind the eye and past the far plane
+        for (int i = 0; i < TORUS_COUNT; ++i) {
+                mat4x4 rotation;
+                mat4x4_identity(rotation);
+                mat4x4_rotate_X(rotation, rotation,
+                        test_random_float(state, 0.0f, 6.3f));
+                mat4x4_identity(scene->torus_mats[i]);
+                mat4x4_translate(scene->torus_mats[i],
+                        test_random_float(state, -20.0f, 20.0f),
+                        test_random_float(state, -10.0f, 10.0f),
+                        test_random_float(state, -30.0f, 2.0f));
+                mat4x4_mul(scene->torus_mats[i], scene->torus_mats[i],
+                        rotation);
+        }
+
+        for (int i = 0; i < WALL_COUNT; ++i) {
+                mat4x4 scale;
+                mat4x4_identity(scale);
+                mat4x4_scale_aniso(scale, scale, test_random_float(state,
+                        2.0f, 15.0f), test_random_float(state, 2.0f, 8.0f),
+                        1.0f);
+                mat4x4_identity(scene->wall_mats[i]);
+                mat4x4_translate(scene->wall_mats[i],
+                        test_random_float(state, -15.0f, 15.0f),
+                        test_random_float(state, -6.0f, 6.0f),
+                        test_random_float(state, -220.0f, -5.0f));
+                mat4x4_mul(scene->wall_mats[i], scene->wall_mats[i], scale);
+        }
+}
+
+static void release_test_scene(struct test_scene *scene)
+{
+        release_test_mesh(&scene->wall);
+        release_test_mesh(&scene->torus);
+}
+
+// Draws a level of a mesh the way the occlusion culler does, marking the
+// pixels whose centres are too close to an edge to decide
+static void draw_reference_lod(double *depths, unsigned char *is_unsure,
+        struct mesh_info *mi, unsigned int lod, mat4x4 pv_mat,
+        mat4x4 world_mat)
+{
+        mat4x4 mvp_mat;
+        mat4x4_mul(mvp_mat, pv_mat, world_mat);
+
+        struct mesh_lod *mesh_lod = &mi->lods[lod];
+        for (unsigned int i = 0; i < mesh_lod->index_count; i += 3) {
+                unsigned int *indices = &mi->indices[mesh_lod->first_index +
+                        i];
+                double x[3];
+                double y[3];
+                double z[3];
+                int is_drawn = 1;
+                for (int k = 0; k < 3; ++k) {
+                        vec4 clip;
+                        mat4x4_mul_vec4(clip, mvp_mat,
+                                mi->verticies[indices[k]].position);
+                        if (clip[3] <= MIN_W || clip[2] < 0.0f)
+                                is_drawn = 0;
+
+                        x[k] = (clip[0] / clip[3] * 0.5 + 0.5) * WIDTH;
+                        y[k] = (0.5 - clip[1] / clip[3] * 0.5) * HEIGHT;
+                        z[k] = clip[2] / clip[3];
+                }
+
+                double area = (x[1] - x[0]) * (y[2] - y[0]) -
+                        (x[2] - x[0]) * (y[1] - y[0]);
+                if (!is_drawn || area == 0.0)
+                        continue;
+
+                // Pixels a little past the bounds only to mark the ones
+                // near the edges
+                double sign = area > 0.0 ? 1.0 : -1.0;
+                double bounds[4] = {
+                        floor(fmin(x[0], fmin(x[1], x[2]))) - 1.0,
+                        floor(fmin(y[0], fmin(y[1], y[2]))) - 1.0,
+                        ceil(fmax(x[0], fmax(x[1], x[2]))) + 1.0,
+                        ceil(fmax(y[0], fmax(y[1], y[2]))) + 1.0
+                };
+                int first_x = (int) fmin(fmax(bounds[0], 0.0), WIDTH);
+                int first_y = (int) fmin(fmax(bounds[1], 0.0), HEIGHT);
+                int last_x = (int) fmax(fmin(bounds[2], WIDTH - 1.0), -1.0);
+                int last_y = (int) fmax(fmin(bounds[3], HEIGHT - 1.0), -1.0);
+                for (int py = first_y; py <= last_y; ++py) {
+                        for (int px = first_x; px <= last_x; ++px) {
+                                double fx = px + 0.5;
+                                double fy = py + 0.5;
+                                int is_inside = 1;
+                                int is_near_edge = 0;
+                                for (int k = 0; k < 3; ++k) {
+                                        int n = (k + 1) % 3;
+                                        double ex = x[n] - x[k];
+                                        double ey = y[n] - y[k];
+                                        double e = sign * (ex * (fy - y[k]) -
+                                                ey * (fx - x[k])) /
+                                                sqrt(ex * ex + ey * ey);
+                                        is_inside &= e >= 0.0;
+                                        is_near_edge |= fabs(e) <
+                                                EDGE_EPSILON;
+                                }
+
+                                unsigned int p = py * WIDTH + px;
+                                is_unsure[p] |= is_near_edge;
+                                if (!is_inside)
+                                        continue;
+
+                                double b1 = ((x[2] - x[0]) * (fy - y[0]) -
+                                        (y[2] - y[0]) * (fx - x[0])) /
+                                        -area;
+                                double b2 = ((x[1] - x[0]) * (fy - y[0]) -
+                                        (y[1] - y[0]) * (fx - x[0])) / area;
+                                double depth = z[0] + b1 * (z[1] - z[0]) +
+                                        b2 * (z[2] - z[0]);
+                                if (depth < depths[p])
+                                        depths[p] = depth;
+                        }
+                }
+        }
+}
+
+static void add_scene_occluders(struct occlusion_info *occlusion_info,
+        struct test_scene *scene, unsigned int wall_lod)
+{
+        begin_occlusion(occlusion_info, scene->pv_mat);
+        for (int i = 0; i < TORUS_COUNT; ++i)
+                add_occluder(occlusion_info, &scene->torus, 0,
+                        scene->torus_mats[i]);
+        for (int i = 0; i < WALL_COUNT; ++i)
+                add_occluder(occlusion_info, &scene->wall, wall_lod,
+                        scene->wall_mats[i]);
+        rasterize_occluders(occlusion_info);
+}
+
+static void check_depths(struct occlusion_info *occlusion_info,
+        struct test_scene *scene, unsigned int wall_lod)
+{
+        double *depths = malloc(WIDTH * HEIGHT * sizeof (double));
+        unsigned char *is_unsure = calloc(WIDTH * HEIGHT, 1);
+        for (int p = 0; p < WIDTH * HEIGHT; ++p)
+                depths[p] = 1.0;
+
+        for (int i = 0; i < TORUS_COUNT; ++i)
+                draw_reference_lod(depths, is_unsure, &scene->torus, 0,
+                        scene->pv_mat, scene->torus_mats[i]);
+        for (int i = 0; i < WALL_COUNT; ++i)
+                draw_reference_lod(depths, is_unsure, &scene->wall, wall_lod,
+                        scene->pv_mat, scene->wall_mats[i]);
+
+        unsigned int bad_count = 0;
+        unsigned int covered_count = 0;
+        float *buffer = occlusion_info->max_depths[0];
+        for (int p = 0; p < WIDTH * HEIGHT; ++p) {
+                covered_count += depths[p] < 1.0;
+                if (!is_unsure[p])
+                        bad_count += fabs(buffer[p] - depths[p]) >
+                                DEPTH_EPSILON;
+        }
+        CHECK(bad_count == 0);
+        // The scene has to cover a good part of the screen, but not all of
+        // it, for the box tests to mean anything
+        CHECK(covered_count > WIDTH * HEIGHT / 16);
+        CHECK(covered_count < WIDTH * HEIGHT);
+
+        free(is_unsure);
+        free(depths);
+}
+
+// Every texel holds the nearest and furthest depth of the texels under it
+static void check_pyramid(struct occlusion_info *occlusion_info)
+{
+        unsigned int bad_count = 0;
+        for (unsigned int l = 1; l < occlusion_info->level_count; ++l) {
+                unsigned int width = occlusion_info->level_widths[l];
+                unsigned int src_width = occlusion_info->level_widths[l - 1];
+                unsigned int src_height =
+                        occlusion_info->level_heights[l - 1];
+                for (unsigned int y = 0; y < occlusion_info->level_heights[l];
+                        ++y) {
+                        for (unsigned int x = 0; x < width; ++x) {
+                                float min_depth = INFINITY;
+                                float max_depth = -INFINITY;
+                                for (unsigned int sy = y * 2; sy < y * 2 + 2 &&
+                                        sy < src_height; ++sy) {
+                                        for (unsigned int sx = x * 2;
+                                                sx < x * 2 + 2 &&
+                                                sx < src_width; ++sx) {
+                                                unsigned int s = sy *
+                                                        src_width + sx;
+                                                min_depth = fminf(min_depth,
+                                                        occlusion_info->
+                                                        min_depths[l - 1][s]);
+                                                max_depth = fmaxf(max_depth,
+                                                        occlusion_info->
+                                                        max_depths[l - 1][s]);
+                                        }
+                                }
+
+                                unsigned int i = y * width + x;
+                                bad_count += occlusion_info->
+                                        min_depths[l][i] != min_depth ||
+                                        occlusion_info->max_depths[l][i] !=
+                                        max_depth;
+                        }
+                }
+        }
+        CHECK(bad_count == 0);
+        CHECK(occlusion_info->level_widths[occlusion_info->level_count - 1] ==
+                1);
+        CHECK(occlusion_info->level_heights[occlusion_info->level_count - 1] ==
+                1);
+}
+
+// The screen rectangle and nearest depth of the box as is_aabb_occluded
+// works them out, with the box occluded when every pixel in the rectangle
+// is in front of it
+static int is_box_occluded_per_pixel(struct occlusion_info *occlusion_info,
+        vec3 centre, vec3 extents)
+{
+        vec4 centre_pos = { centre[0], centre[1], centre[2], 1.0f };
+        vec4 clip_centre;
+        mat4x4_mul_vec4(clip_centre, occlusion_info->pv_mat, centre_pos);
+
+        vec4 clip_axes[3];
+        for (int k = 0; k < 3; ++k)
+                vec4_scale(clip_axes[k], occlusion_info->pv_mat[k],
+                        extents[k]);
+
+        float min_x = INFINITY;
+        float min_y = INFINITY;
+        float max_x = -INFINITY;
+        float max_y = -INFINITY;
+        float min_z = INFINITY;
+        for (int corner = 0; corner < 8; ++corner) {
+                vec4 clip;
+                vec4_scale(clip, clip_centre, 1.0f);
+                for (int k = 0; k < 3; ++k) {
+                        if (corner & (1 << k))
+                                vec4_add(clip, clip, clip_axes[k]);
+                        else
+                                vec4_sub(clip, clip, clip_axes[k]);
+                }
+
+                if (clip[3] <= MIN_W)
+                        return 0;
+
+                float inv_w = 1.0f / clip[3];
+                float x = (clip[0] * inv_w * 0.5f + 0.5f) * WIDTH;
+                float y = (0.5f - clip[1] * inv_w * 0.5f) * HEIGHT;
+                min_x = fminf(min_x, x);
+                min_y = fminf(min_y, y);
+                max_x = fmaxf(max_x, x);
+                max_y = fmaxf(max_y, y);
+                min_z = fminf(min_z, clip[2] * inv_w);
+        }
+
+        if (min_z < 0.0f || max_x < 0.0f || max_y < 0.0f ||
+                min_x >= (float) WIDTH || min_y >= (float) HEIGHT)
+                return 0;
+
+        int first_x = min_x > 0.0f ? (int) min_x : 0;
+        int first_y = min_y > 0.0f ? (int) min_y : 0;
+        int last_x = max_x < WIDTH - 1 ? (int) max_x : WIDTH - 1;
+        int last_y = max_y < HEIGHT - 1 ? (int) max_y : HEIGHT - 1;
+
+        float *depths = occlusion_info->max_depths[0];
+        for (int y = first_y; y <= last_y; ++y) {
+                for (int x = first_x; x <= last_x; ++x) {
+                        if (min_z <= depths[y * WIDTH + x])
+                                return 0;
+                }
+        }
+
+        return 1;
+}
+
+static void check_boxes(unsigned long long *state,
+        struct occlusion_info *occlusion_info)
+{
+        struct cull_volume_info volume_info;
+        memset(&volume_info, 0, sizeof (struct cull_volume_info));
+        volume_info.type = CULL_VOLUME_TYPE_AABB;
+        volume_info.capacity = BOX_COUNT;
+        create_cull_volumes(&volume_info);
+
+        unsigned int *indices = malloc(BOX_COUNT * sizeof (unsigned int));
+        unsigned int *expected = malloc(BOX_COUNT * sizeof (unsigned int));
+        unsigned int expected_count = 0;
+        unsigned int occluded_count = 0;
+
+        for (unsigned int i = 0; i < BOX_COUNT; ++i) {
+                vec3 centre = {
+                        test_random_float(state, -30.0f, 30.0f),
+                        test_random_float(state, -15.0f, 15.0f),
+                        test_random_float(state, -150.0f, 5.0f)
+                };
+                vec3 extents;
+                for (int k = 0; k < 3; ++k)
+                        extents[k] = test_random_float(state, 0.05f,
+                                i % 8 == 0 ? 10.0f : 1.0f);
+                add_cull_aabb(&volume_info, centre, extents);
+                indices[i] = i;
+
+                int is_occluded = is_aabb_occluded(occlusion_info, centre,
+                        extents);
+                CHECK(is_occluded == is_box_occluded_per_pixel(
+                        occlusion_info, centre, extents));
+                occluded_count += is_occluded;
+                if (!is_occluded)
+                        expected[expected_count++] = i;
+        }
+        CHECK(occluded_count > BOX_COUNT / 20);
+        CHECK(expected_count > BOX_COUNT / 20);
+
+        // Culled in place, which the chunks have to allow
+        unsigned int visible_count = cull_occluded_volumes(occlusion_info,
+                &volume_info, indices, BOX_COUNT, indices);
+        CHECK(visible_count == expected_count);
+        if (visible_count == expected_count)
+                CHECK(memcmp(indices, expected, visible_count *
+                        sizeof (unsigned int)) == 0);
+
+        free(expected);
+        free(indices);
+        release_cull_volumes(&volume_info);
+}
+
+static void test_occlusion(struct job_system_info *job_system,
+        struct test_scene *scene, unsigned long long seed)
+{
+        struct occlusion_info occlusion_info;
+        memset(&occlusion_info, 0, sizeof (struct occlusion_info));
+        occlusion_info.job_system = job_system;
+        occlusion_info.width = WIDTH;
+        occlusion_info.height = HEIGHT;
+        occlusion_info.max_occluders = TORUS_COUNT + WALL_COUNT;
+        occlusion_info.max_triangles = 4096;
+        create_occlusion(&occlusion_info);
+
+        // The full walls, then their coarse level covering half of them
+        for (unsigned int wall_lod = 0; wall_lod < 2; ++wall_lod) {
+                unsigned long long state = seed;
+                add_scene_occluders(&occlusion_info, scene, wall_lod);
+                CHECK(occlusion_info.stats.occluder_count ==
+                        TORUS_COUNT + WALL_COUNT);
+                CHECK(occlusion_info.stats.dropped_occluder_count == 0);
+                CHECK(occlusion_info.stats.triangle_count ==
+                        TORUS_COUNT * scene->torus.index_count / 3 +
+                        WALL_COUNT * 2);
+
+                check_depths(&occlusion_info, scene, wall_lod);
+                check_pyramid(&occlusion_info);
+                check_boxes(&state, &occlusion_info);
+        }
+
+        // Occluders past the triangle budget are dropped whole
+        begin_occlusion(&occlusion_info, scene->pv_mat);
+        for (unsigned int i = 0; i < 30; ++i)
+                add_occluder(&occlusion_info, &scene->torus, 0,
+                        scene->torus_mats[i % TORUS_COUNT]);
+        CHECK(occlusion_info.stats.occluder_count < 30);
+        CHECK(occlusion_info.stats.triangle_count <=
+                occlusion_info.max_triangles);
+        CHECK(occlusion_info.stats.dropped_occluder_count ==
+                30 - occlusion_info.stats.occluder_count);
+
+        // Nothing drawn hides nothing
+        begin_occlusion(&occlusion_info, scene->pv_mat);
+        rasterize_occluders(&occlusion_info);
+        vec3 centre = { 0.0f, 0.0f, -100.0f };
+        vec3 extents = { 1.0f, 1.0f, 1.0f };
+        CHECK(!is_aabb_occluded(&occlusion_info, centre, extents));
+
+        release_occlusion(&occlusion_info);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        for (unsigned long long seed = 1; seed <= 4; ++seed) {
+                unsigned long long state = 0x5851f42d4c957f2dull * seed;
+                struct test_scene scene;
+                create_test_scene(&state, &scene);
+
+                test_occlusion(NULL, &scene, state);
+                test_occlusion(&job_system, &scene, state);
+
+                release_test_scene(&scene);
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("occlusion_test");
+}
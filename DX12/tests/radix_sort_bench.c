@@ -0,0 +1,103 @@
+#include "radix_sort_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+// Times sorting a frame's worth of draw keys against a 60 Hz frame. Keys
+// carry their index in the low BENCH_INDEX_BITS bits, like the packets of
+// the draw queue. Whether the best of several runs fits the frame depends
+// on the machine and how many workers it has, so it is reported, and only
+// keys out of order fail the run.
+#define BENCH_KEY_COUNT (1 << 20)
+#define BENCH_INDEX_BITS 20
+#define BENCH_RUN_COUNT 9
+#define FRAME_BUDGET_MS 16.6
+
+static double time_sort(struct job_system_info *job_system,
+        unsigned long long *keys, unsigned long long *scratch,
+        const unsigned long long *unsorted)
+{
+        double best_time = 1e30;
+        for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                memcpy(keys, unsorted, BENCH_KEY_COUNT *
+                        sizeof (unsigned long long));
+
+                double start_time = get_time_in_secs();
+                radix_sort_keys(job_system, keys, scratch, BENCH_KEY_COUNT,
+                        BENCH_INDEX_BITS);
+                double sort_time = get_time_in_secs() - start_time;
+
+                if (sort_time < best_time)
+                        best_time = sort_time;
+        }
+
+        return best_time * 1000.0;
+}
+
+// Indices are below the keys, so a stable sort leaves every value in order
+static unsigned int count_unsorted(const unsigned long long *keys)
+{
+        unsigned int unsorted_count = 0;
+        for (unsigned int i = 1; i < BENCH_KEY_COUNT; ++i)
+                unsorted_count += keys[i - 1] > keys[i];
+
+        return unsorted_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        unsigned long long *keys = malloc(BENCH_KEY_COUNT *
+                sizeof (unsigned long long));
+        unsigned long long *scratch = malloc(BENCH_KEY_COUNT *
+                sizeof (unsigned long long));
+        unsigned long long *unsorted = malloc(BENCH_KEY_COUNT *
+                sizeof (unsigned long long));
+
+        // Random keys use every bit above the index. Draw keys are laid out
+        // like those of the draw queue, with few layers, PSOs and materials.
+        unsigned long long state = 0x2545f4914f6cdd1dull;
+        for (unsigned int i = 0; i < BENCH_KEY_COUNT; ++i)
+                unsorted[i] = test_random(&state) << BENCH_INDEX_BITS | i;
+
+        double random_ms = time_sort(&job_system, keys, scratch, unsorted);
+        unsigned int unsorted_count = count_unsorted(keys);
+
+        for (unsigned int i = 0; i < BENCH_KEY_COUNT; ++i) {
+                unsigned long long r = test_random(&state);
+                unsigned long long layer = r & 3;
+                unsigned long long pso = (r >> 8) & 31;
+                unsigned long long material = (r >> 16) & 1023;
+                unsigned long long depth = (r >> 32) & 0xfff;
+                unsigned long long key = layer << 40 | pso << 28 |
+                        material << 12 | depth;
+                unsorted[i] = key << BENCH_INDEX_BITS | i;
+        }
+
+        double draw_ms = time_sort(&job_system, keys, scratch, unsorted);
+        unsorted_count += count_unsorted(keys);
+
+        int is_in_budget = random_ms <= FRAME_BUDGET_MS &&
+                draw_ms <= FRAME_BUDGET_MS;
+
+        printf("radix_sort_bench: %u keys, %u workers, random %.2f ms, "
+                "draw %.2f ms, budget %.1f ms: %s\n", BENCH_KEY_COUNT,
+                job_system.worker_count, random_ms, draw_ms, FRAME_BUDGET_MS,
+                is_in_budget ? "within" : "over");
+
+        free(unsorted);
+        free(scratch);
+        free(keys);
+        release_job_system(&job_system);
+
+        if (unsorted_count > 0)
+                printf("radix_sort_bench: %u keys out of order\n",
+                        unsorted_count);
+
+        return unsorted_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "radix_sort_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+
+// Checks the radix sort against qsort. Payloads are random, so they are
+// only left in order by a stable sort that ignores them, which is what
+// ordering by the key bits and then the index gives.
+struct indexed_key {
+        unsigned long long key;
+        unsigned int payload_bits;
+        unsigned int index;
+};
+
+static int compare_keys(const void *a, const void *b)
+{
+        const struct indexed_key *key_a = a;
+        const struct indexed_key *key_b = b;
+        unsigned long long sorted_a = key_a->key >> key_a->payload_bits;
+        unsigned long long sorted_b = key_b->key >> key_b->payload_bits;
+
+        if (sorted_a != sorted_b)
+                return sorted_a < sorted_b ? -1 : 1;
+
+        return (key_a->index > key_b->index) - (key_a->index < key_b->index);
+}
+
+enum KEY_PATTERN {
+        KEY_PATTERN_RANDOM,
+        // Many repeats, to check stability
+        KEY_PATTERN_FEW_DISTINCT,
+        // Only some digits vary, so passes get skipped
+        KEY_PATTERN_DRAW,
+        KEY_PATTERN_COUNT
+};
+
+static void check_sort(struct job_system_info *job_system,
+        unsigned int count, enum KEY_PATTERN pattern,
+        unsigned int payload_bits)
+{
+        unsigned long long *keys = malloc((count + 1) *
+                sizeof (unsigned long long));
+        unsigned long long *scratch = malloc((count + 1) *
+                sizeof (unsigned long long));
+        struct indexed_key *expected = malloc((count + 1) *
+                sizeof (struct indexed_key));
+
+        unsigned long long state = 0x9e3779b97f4a7c15ull + count + pattern +
+                payload_bits;
+        for (unsigned int i = 0; i < count; ++i) {
+                unsigned long long key = test_random(&state);
+                if (pattern == KEY_PATTERN_FEW_DISTINCT)
+                        key = key % 7 << payload_bits |
+                                (key >> 32 & ((1ull << payload_bits) - 1));
+                else if (pattern == KEY_PATTERN_DRAW)
+                        key &= 0x0f0000ff00ffff00ull |
+                                ((1ull << payload_bits) - 1);
+
+                keys[i] = key;
+                expected[i].key = key;
+                expected[i].payload_bits = payload_bits;
+                expected[i].index = i;
+        }
+
+        qsort(expected, count, sizeof (struct indexed_key), compare_keys);
+
+        radix_sort_keys(job_system, keys, scratch, count, payload_bits);
+
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < count; ++i)
+                bad_count += keys[i] != expected[i].key;
+        CHECK(bad_count == 0);
+
+        free(expected);
+        free(scratch);
+        free(keys);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        static const unsigned int counts[] = {
+                0, 1, 2, 3, 100, 4097, RADIX_SORT_PARALLEL_MIN_COUNT - 1,
+                RADIX_SORT_PARALLEL_MIN_COUNT + 7, 300000
+        };
+        // No payload, payloads that leave a short top digit and whole
+        // digits, and a single sorted bit
+        static const unsigned int payload_bits[] = { 0, 16, 20, 63 };
+
+        for (unsigned int c = 0; c < sizeof (counts) / sizeof (counts[0]);
+                ++c) {
+                for (unsigned int p = 0; p < KEY_PATTERN_COUNT; ++p) {
+                        for (unsigned int b = 0; b < sizeof (payload_bits) /
+                                sizeof (payload_bits[0]); ++b) {
+                                check_sort(NULL, counts[c], p,
+                                        payload_bits[b]);
+                                check_sort(&job_system, counts[c], p,
+                                        payload_bits[b]);
+                        }
+                }
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("radix_sort_test");
+}
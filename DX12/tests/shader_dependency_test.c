@@ -0,0 +1,316 @@
+#include "shader_dependency_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Checks path normalisation on hand picked paths, a small tree of shader
+// files on disk as they are edited, and random include graphs with cycles
+// and lines that only look like includes, scanned from memory. The shaders
+// affected by a change are compared with a walk up the graph done here.
+#define GRAPH_FILE_COUNT 60
+#define GRAPH_ROOT_COUNT 8
+#define GRAPH_INCLUDE_COUNT 3
+
+static void check_normalised(const char *path, const char *expected)
+{
+        char normalised_path[MAX_SHADER_PATH];
+        normalise_shader_path(normalised_path, path);
+        CHECK(strcmp(normalised_path, expected) == 0);
+}
+
+static void test_normalise(void)
+{
+        check_normalised("shaders/mesh.hlsl", "shaders/mesh.hlsl");
+        check_normalised("shaders\\lighting\\brdf.hlsli",
+                "shaders/lighting/brdf.hlsli");
+        check_normalised("./shaders//lighting/./../common.hlsli",
+                "shaders/common.hlsli");
+        check_normalised("shaders/", "shaders");
+        check_normalised("a/b/../../c", "c");
+        // Parents past the start are kept, and not folded into each other
+        check_normalised("../shaders/../../x", "../../x");
+        check_normalised("a/../../b", "../b");
+        check_normalised("/tmp/shaders/../mesh.hlsl", "/tmp/mesh.hlsl");
+        check_normalised("\\shaders\\mesh.hlsl", "/shaders/mesh.hlsl");
+        check_normalised(".", "");
+        check_normalised("", "");
+}
+
+static void sort_indices(unsigned int *indices, unsigned int count)
+{
+        for (unsigned int i = 1; i < count; ++i) {
+                unsigned int index = indices[i];
+                unsigned int j = i;
+                for (; j > 0 && indices[j - 1] > index; --j)
+                        indices[j] = indices[j - 1];
+                indices[j] = index;
+        }
+}
+
+// The roots affected by path, sorted, against those expected
+static void check_affected(struct shader_dependency_info *dep_info,
+        const char *path, const unsigned int *expected,
+        unsigned int expected_count)
+{
+        unsigned int roots[GRAPH_FILE_COUNT + 1];
+        unsigned int root_count = collect_affected_shaders(dep_info, path,
+                roots, GRAPH_FILE_COUNT + 1);
+        sort_indices(roots, root_count);
+
+        unsigned int sorted[GRAPH_FILE_COUNT + 1];
+        for (unsigned int i = 0; i < expected_count; ++i)
+                sorted[i] = expected[i];
+        sort_indices(sorted, expected_count);
+
+        CHECK(root_count == expected_count);
+        if (root_count == expected_count)
+                CHECK(memcmp(roots, sorted,
+                        root_count * sizeof (unsigned int)) == 0);
+}
+
+static void write_file(const char *directory, const char *name,
+        const char *contents)
+{
+        char path[MAX_SHADER_PATH];
+        snprintf(path, MAX_SHADER_PATH, "%s/%s", directory, name);
+        FILE *file = fopen(path, "wb");
+        CHECK(file != NULL);
+        if (file == NULL)
+                return;
+
+        fputs(contents, file);
+        fclose(file);
+}
+
+static unsigned int find_file(struct shader_dependency_info *dep_info,
+        const char *directory, const char *name)
+{
+        char path[MAX_SHADER_PATH];
+        snprintf(path, MAX_SHADER_PATH, "%s/%s", directory, name);
+        char normalised_path[MAX_SHADER_PATH];
+        normalise_shader_path(normalised_path, path);
+
+        return find_shader_file(dep_info, normalised_path);
+}
+
+// Two shaders sharing a header, one reaching it through a lighting
+// directory whose two headers include each other
+static void test_files(void)
+{
+        char directory[] = "/tmp/shader_dependency_XXXXXX";
+        CHECK(mkdtemp(directory) != NULL);
+        char lighting[MAX_SHADER_PATH];
+        snprintf(lighting, MAX_SHADER_PATH, "%s/lighting", directory);
+        CHECK(mkdir(lighting, 0700) == 0);
+
+        write_file(directory, "mesh.hlsl",
+                "#include \"common.hlsli\"\n"
+                "#include <lighting/light.hlsli>\n"
+                "float4 main() : SV_TARGET { return 0; }\n");
+        write_file(directory, "sky.hlsl",
+                "\t#  include \"lighting/../common.hlsli\"\r\n"
+                "// #include \"lighting/brdf.hlsli\"\r\n"
+                "#include \"unterminated.hlsli\r\n");
+        write_file(directory, "post.hlsl", "float4 main() { return 1; }");
+        write_file(directory, "common.hlsli", "#define PI 3.14159\n");
+        write_file(directory, "lighting/light.hlsli",
+                "#include \"../common.hlsli\"\n#include \"brdf.hlsli\"\n");
+        write_file(directory, "lighting/brdf.hlsli",
+                "#include \"light.hlsli\"\n#include \"missing.hlsli\"\n");
+
+        struct shader_dependency_info dep_info;
+        create_shader_dependencies(&dep_info);
+
+        char path[MAX_SHADER_PATH];
+        snprintf(path, MAX_SHADER_PATH, "%s/mesh.hlsl", directory);
+        unsigned int mesh = add_shader_root(&dep_info, path);
+        snprintf(path, MAX_SHADER_PATH, "%s\\.\\sky.hlsl", directory);
+        unsigned int sky = add_shader_root(&dep_info, path);
+        snprintf(path, MAX_SHADER_PATH, "%s/post.hlsl", directory);
+        unsigned int post = add_shader_root(&dep_info, path);
+        // Adding a root again finds the same file
+        snprintf(path, MAX_SHADER_PATH, "%s/lighting/../mesh.hlsl",
+                directory);
+        CHECK(add_shader_root(&dep_info, path) == mesh);
+
+        CHECK(find_file(&dep_info, directory, "sky.hlsl") == sky);
+        CHECK(find_file(&dep_info, directory, "lighting/brdf.hlsli") !=
+                SHADER_FILE_NONE);
+        // Neither the comment nor the unterminated include count
+        CHECK(find_file(&dep_info, directory, "unterminated.hlsli") ==
+                SHADER_FILE_NONE);
+
+        unsigned int both[] = { mesh, sky };
+        snprintf(path, MAX_SHADER_PATH, "%s/common.hlsli", directory);
+        check_affected(&dep_info, path, both, 2);
+        snprintf(path, MAX_SHADER_PATH, "%s/lighting/brdf.hlsli", directory);
+        check_affected(&dep_info, path, &mesh, 1);
+        // A header that does not exist yet is still tracked, so creating it
+        // rebuilds what includes it
+        snprintf(path, MAX_SHADER_PATH, "%s/lighting/./missing.hlsli",
+                directory);
+        check_affected(&dep_info, path, &mesh, 1);
+        snprintf(path, MAX_SHADER_PATH, "%s/post.hlsl", directory);
+        check_affected(&dep_info, path, &post, 1);
+        snprintf(path, MAX_SHADER_PATH, "%s/other.hlsli", directory);
+        check_affected(&dep_info, path, NULL, 0);
+
+        // At most max_roots are handed back
+        unsigned int roots[2];
+        snprintf(path, MAX_SHADER_PATH, "%s/common.hlsli", directory);
+        CHECK(collect_affected_shaders(&dep_info, path, roots, 1) == 1);
+
+        // Editing the sky shader moves it off the common header onto one of
+        // its own
+        write_file(directory, "sky.hlsl", "#include \"sky.hlsli\"\n");
+        rescan_shader_file(&dep_info, sky);
+        check_affected(&dep_info, path, &mesh, 1);
+        snprintf(path, MAX_SHADER_PATH, "%s/sky.hlsli", directory);
+        check_affected(&dep_info, path, &sky, 1);
+
+        release_shader_dependencies(&dep_info);
+
+        static const char *names[] = {
+                "mesh.hlsl", "sky.hlsl", "post.hlsl", "common.hlsli",
+                "lighting/light.hlsli", "lighting/brdf.hlsli"
+        };
+        for (unsigned int i = 0; i < sizeof (names) / sizeof (names[0]);
+                ++i) {
+                snprintf(path, MAX_SHADER_PATH, "%s/%s", directory, names[i]);
+                CHECK(unlink(path) == 0);
+        }
+        CHECK(rmdir(lighting) == 0);
+        CHECK(rmdir(directory) == 0);
+}
+
+// Files in two directories, as paths relative to the first
+static void get_graph_path(char *path, unsigned int file, int from_other)
+{
+        const char *prefix = file % 2 == 0 ? "" : "../other/";
+        if (from_other)
+                prefix = file % 2 == 0 ? "../graph/" : "./";
+        snprintf(path, MAX_SHADER_PATH, "%sf%u.hlsli", prefix, file);
+}
+
+static void get_graph_file(char *path, unsigned int file)
+{
+        snprintf(path, MAX_SHADER_PATH, "graph_missing/%s/f%u.hlsli",
+                file % 2 == 0 ? "graph" : "other", file);
+}
+
+static void test_random_graph(unsigned long long seed)
+{
+        unsigned long long state = seed;
+        struct shader_dependency_info dep_info;
+        create_shader_dependencies(&dep_info);
+
+        // None of the files exist, so only the scanned sources count. A
+        // root including everything puts every file in the graph.
+        char path[MAX_SHADER_PATH];
+        unsigned int roots[GRAPH_ROOT_COUNT + 1];
+        snprintf(path, MAX_SHADER_PATH, "graph_missing/graph/index.hlsl");
+        roots[GRAPH_ROOT_COUNT] = add_shader_root(&dep_info, path);
+        char *source = malloc(GRAPH_FILE_COUNT * 64 * 4);
+        source[0] = '\0';
+        for (unsigned int f = 0; f < GRAPH_FILE_COUNT; ++f) {
+                get_graph_path(path, f, 0);
+                sprintf(source + strlen(source), "#include \"%s\"\n", path);
+        }
+        scan_shader_includes(&dep_info, roots[GRAPH_ROOT_COUNT], source);
+
+        unsigned int files[GRAPH_FILE_COUNT];
+        for (unsigned int f = 0; f < GRAPH_FILE_COUNT; ++f) {
+                get_graph_file(path, f);
+                files[f] = find_shader_file(&dep_info, path);
+                CHECK(files[f] != SHADER_FILE_NONE);
+                if (files[f] == SHADER_FILE_NONE)
+                        goto release;
+        }
+
+        // The first few files are also roots, and any file may include any
+        // other, itself included
+        for (unsigned int r = 0; r < GRAPH_ROOT_COUNT; ++r) {
+                get_graph_file(path, r);
+                roots[r] = add_shader_root(&dep_info, path);
+                CHECK(roots[r] == files[r]);
+        }
+
+        unsigned char includes[GRAPH_FILE_COUNT][GRAPH_FILE_COUNT] = { 0 };
+        for (unsigned int f = 0; f < GRAPH_FILE_COUNT; ++f) {
+                source[0] = '\0';
+                for (unsigned int i = 0; i < GRAPH_INCLUDE_COUNT * 2; ++i) {
+                        unsigned int other = test_random(&state) %
+                                GRAPH_FILE_COUNT;
+                        get_graph_path(path, other, f % 2);
+                        char *line = source + strlen(source);
+                        switch (test_random(&state) % 6) {
+                        case 0:
+                                sprintf(line, "// #include \"%s\"\n", path);
+                                break;
+                        case 1:
+                                sprintf(line, "#include \"%s\n", path);
+                                break;
+                        case 2:
+                                sprintf(line, "  #\tinclude <%s>\r\n", path);
+                                includes[f][other] = 1;
+                                break;
+                        default:
+                                sprintf(line, "#include \"%s\"\n", path);
+                                includes[f][other] = 1;
+                                break;
+                        }
+                }
+                scan_shader_includes(&dep_info, files[f], source);
+        }
+
+        // Walk up from every file to the roots above it
+        unsigned int bad_count = 0;
+        for (unsigned int f = 0; f < GRAPH_FILE_COUNT; ++f) {
+                unsigned char is_reached[GRAPH_FILE_COUNT] = { 0 };
+                is_reached[f] = 1;
+                for (int is_growing = 1; is_growing;) {
+                        is_growing = 0;
+                        for (unsigned int a = 0; a < GRAPH_FILE_COUNT; ++a) {
+                                for (unsigned int b = 0;
+                                        b < GRAPH_FILE_COUNT; ++b) {
+                                        if (!is_reached[a] &&
+                                                includes[a][b] &&
+                                                is_reached[b]) {
+                                                is_reached[a] = 1;
+                                                is_growing = 1;
+                                        }
+                                }
+                        }
+                }
+
+                unsigned int expected[GRAPH_ROOT_COUNT + 1];
+                unsigned int expected_count = 0;
+                expected[expected_count++] = roots[GRAPH_ROOT_COUNT];
+                for (unsigned int r = 0; r < GRAPH_ROOT_COUNT; ++r) {
+                        if (is_reached[r])
+                                expected[expected_count++] = roots[r];
+                }
+
+                unsigned int failure_count = test_failure_count;
+                get_graph_file(path, f);
+                check_affected(&dep_info, path, expected, expected_count);
+                bad_count += test_failure_count != failure_count;
+        }
+        CHECK(bad_count == 0);
+
+release:
+        free(source);
+        release_shader_dependencies(&dep_info);
+}
+
+int main(void)
+{
+        test_normalise();
+        test_files();
+        test_random_graph(0x2545f4914f6cdd1dull);
+        test_random_graph(0x9fb21c651e98df25ull);
+
+        return finish_test("shader_dependency_test");
+}
@@ -0,0 +1,336 @@
+#include "simplify_interface.h"
+#include "test_util.h"
+#include "test_mesh.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// Builds LOD chains of a torus, a flat grid and a bumpy grid, alone and
+// together on the job system, and checks that every level stays within its
+// triangle target, references only live vertices of the mesh, keeps the
+// winding of the first level, and that the errors grow level by level and
+// stop at max_error. On the grids the signed area seen from above must stay
+// that of the square, which it only does while the border holds, and with
+// the border locked every border vertex must stay in every level.
+#define TORUS_SEGMENT_COUNT 64
+#define TORUS_RING_COUNT 32
+#define GRID_SIZE 33
+#define AREA_EPSILON 1e-3
+#define FLAT_ERROR_EPSILON 1e-4f
+
+static const float ratios[] = { 0.5f, 0.25f, 0.1f, 0.02f };
+
+// A square grid of size by size vertices from 0 to 1 in x and z, facing up
+// in y, raised by bump_height times a few bumps
+static void create_bumpy_grid(struct mesh_info *mi, unsigned int size,
+        float bump_height)
+{
+        create_test_torus(mi, size, size);
+        for (unsigned int z = 0; z < size; ++z) {
+                for (unsigned int x = 0; x < size; ++x) {
+                        float *position = mi->verticies[z * size + x].position;
+                        position[0] = (float) x / (size - 1);
+                        position[2] = (float) z / (size - 1);
+                        position[1] = bump_height *
+                                sinf(9.4247780f * position[0]) *
+                                sinf(9.4247780f * position[2]);
+                }
+        }
+
+        unsigned int *index = mi->indices;
+        for (unsigned int z = 0; z + 1 < size; ++z) {
+                for (unsigned int x = 0; x + 1 < size; ++x) {
+                        unsigned int a = z * size + x;
+                        *index++ = a;
+                        *index++ = a + size;
+                        *index++ = a + 1;
+                        *index++ = a + 1;
+                        *index++ = a + size;
+                        *index++ = a + size + 1;
+                }
+        }
+
+        mi->index_count = (unsigned int) (index - mi->indices);
+        mi->lods[0].index_count = mi->index_count;
+}
+
+static int is_grid_border(struct mesh_info *mi, unsigned int v)
+{
+        const float *position = mi->verticies[v].position;
+
+        return position[0] == 0.0f || position[0] == 1.0f ||
+                position[2] == 0.0f || position[2] == 1.0f;
+}
+
+static void get_triangle_cross(struct mesh_info *mi,
+        const unsigned int *triangle, double *cross)
+{
+        const float *p[3];
+        for (int k = 0; k < 3; ++k)
+                p[k] = mi->verticies[triangle[k]].position;
+
+        double e1[3], e2[3];
+        for (int k = 0; k < 3; ++k) {
+                e1[k] = (double) p[1][k] - p[0][k];
+                e2[k] = (double) p[2][k] - p[0][k];
+        }
+
+        cross[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        cross[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        cross[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Away from the ring through the middle of the tube
+static void get_torus_outward(const float *position, double *outward)
+{
+        double ring = sqrt((double) position[0] * position[0] +
+                (double) position[2] * position[2]);
+        outward[0] = position[0] - 2.0 * position[0] / ring;
+        outward[1] = position[1];
+        outward[2] = position[2] - 2.0 * position[2] / ring;
+}
+
+// Sign of the winding the triangle has against the surface where its
+// corners are, which they all still lie on, 0 without area
+static int get_torus_facing(struct mesh_info *mi,
+        const unsigned int *triangle)
+{
+        double cross[3];
+        get_triangle_cross(mi, triangle, cross);
+
+        double d = 0.0;
+        for (int k = 0; k < 3; ++k) {
+                double outward[3];
+                get_torus_outward(mi->verticies[triangle[k]].position,
+                        outward);
+                d += cross[0] * outward[0] + cross[1] * outward[1] +
+                        cross[2] * outward[2];
+        }
+
+        return (d > 0.0) - (d < 0.0);
+}
+
+// Levels are back to back after the first, which is the mesh as it was,
+// and only have triangles with three vertices of the mesh
+static void check_levels(struct mesh_info *mi, struct mesh_info *lod_mesh,
+        const struct simplify_info *simplify_info)
+{
+        CHECK(lod_mesh->vertex_count == mi->vertex_count);
+        CHECK(lod_mesh->verticies == mi->verticies);
+        CHECK(lod_mesh->lod_count >= 1);
+        CHECK(lod_mesh->lod_count <= simplify_info->ratio_count + 1);
+        CHECK(lod_mesh->lods[0].first_index == 0);
+        CHECK(lod_mesh->lods[0].index_count == mi->index_count);
+        CHECK(lod_mesh->lods[0].error == 0.0f);
+        CHECK(memcmp(lod_mesh->indices, mi->indices,
+                mi->index_count * sizeof (unsigned int)) == 0);
+
+        unsigned int triangle_count = mi->index_count / 3;
+        unsigned int next_index = 0;
+        unsigned int last_count = triangle_count;
+        for (unsigned int l = 0; l < lod_mesh->lod_count; ++l) {
+                struct mesh_lod *lod = &lod_mesh->lods[l];
+                CHECK(lod->first_index == next_index);
+                CHECK(lod->index_count % 3 == 0);
+                next_index = lod->first_index + lod->index_count;
+
+                if (l == 0)
+                        continue;
+
+                // Each level is under its target and under the one before,
+                // but for a last one where simplifying stopped short
+                unsigned int count = lod->index_count / 3;
+                unsigned int target = (unsigned int) (triangle_count *
+                        simplify_info->ratios[l - 1]);
+                CHECK(count <= target || l + 1 == lod_mesh->lod_count);
+                CHECK(count < last_count);
+                CHECK(lod->error >= lod_mesh->lods[l - 1].error);
+                if (simplify_info->max_error > 0.0f)
+                        CHECK(lod->error <= simplify_info->max_error);
+                last_count = count;
+
+                unsigned int bad_count = 0;
+                const unsigned int *indices = lod_mesh->indices +
+                        lod->first_index;
+                for (unsigned int t = 0; t < count; ++t) {
+                        const unsigned int *triangle = indices + t * 3;
+                        bad_count += triangle[0] >= mi->vertex_count ||
+                                triangle[1] >= mi->vertex_count ||
+                                triangle[2] >= mi->vertex_count;
+                        bad_count += triangle[0] == triangle[1] ||
+                                triangle[1] == triangle[2] ||
+                                triangle[0] == triangle[2];
+                }
+                CHECK(bad_count == 0);
+        }
+        CHECK(next_index == lod_mesh->index_count);
+}
+
+// The levels stop where the first one would have reached its target
+static void check_targets_reached(struct mesh_info *mi,
+        struct mesh_info *lod_mesh, const struct simplify_info *simplify_info)
+{
+        CHECK(lod_mesh->lod_count == simplify_info->ratio_count + 1);
+
+        unsigned int triangle_count = mi->index_count / 3;
+        for (unsigned int l = 1; l < lod_mesh->lod_count; ++l) {
+                unsigned int target = (unsigned int) (triangle_count *
+                        simplify_info->ratios[l - 1]);
+                // A collapse takes out a handful of triangles at once
+                CHECK(lod_mesh->lods[l].index_count / 3 + 8 >= target);
+        }
+}
+
+// Levels under a tenth of the triangles have ones spanning so much of the
+// tube that the surface under their corners no longer tells their facing
+static void check_torus(struct mesh_info *mi, struct mesh_info *lod_mesh)
+{
+        unsigned int flipped_count = 0;
+        for (unsigned int l = 0; l < lod_mesh->lod_count; ++l) {
+                struct mesh_lod *lod = &lod_mesh->lods[l];
+                if (lod->index_count * 10 < mi->index_count)
+                        continue;
+
+                for (unsigned int i = 0; i < lod->index_count; i += 3)
+                        flipped_count += get_torus_facing(mi,
+                                lod_mesh->indices + lod->first_index + i) <= 0;
+        }
+        CHECK(flipped_count == 0);
+}
+
+// Signed area from above, which the border keeps at that of the square as
+// long as no triangle is flipped or pulled in from the edge. Triangles left
+// standing on the border have no area from above and count as facing up.
+static void check_grid(struct mesh_info *mi, struct mesh_info *lod_mesh,
+        int is_border_locked)
+{
+        unsigned int border_count = 0;
+        for (unsigned int v = 0; v < mi->vertex_count; ++v)
+                border_count += is_grid_border(mi, v);
+
+        unsigned char *is_used = malloc(mi->vertex_count);
+        for (unsigned int l = 0; l < lod_mesh->lod_count; ++l) {
+                struct mesh_lod *lod = &lod_mesh->lods[l];
+                const unsigned int *indices = lod_mesh->indices +
+                        lod->first_index;
+                memset(is_used, 0, mi->vertex_count);
+
+                double area = 0.0;
+                unsigned int flipped_count = 0;
+                for (unsigned int i = 0; i < lod->index_count; i += 3) {
+                        double cross[3];
+                        get_triangle_cross(mi, indices + i, cross);
+                        area += 0.5 * cross[1];
+                        flipped_count += cross[1] < 0.0;
+                        for (int k = 0; k < 3; ++k)
+                                is_used[indices[i + k]] = 1;
+                }
+                CHECK(flipped_count == 0);
+                CHECK(fabs(area - 1.0) <= AREA_EPSILON);
+
+                unsigned int used_border_count = 0;
+                for (unsigned int v = 0; v < mi->vertex_count; ++v)
+                        used_border_count += is_used[v] &&
+                                is_grid_border(mi, v);
+                if (is_border_locked)
+                        CHECK(used_border_count == border_count);
+                else if (l + 1 == lod_mesh->lod_count)
+                        CHECK(used_border_count < border_count);
+        }
+
+        free(is_used);
+}
+
+static void init_simplify_info(struct simplify_info *simplify_info,
+        struct job_system_info *job_system)
+{
+        memset(simplify_info, 0, sizeof (struct simplify_info));
+        simplify_info->job_system = job_system;
+        simplify_info->ratio_count = sizeof (ratios) / sizeof (ratios[0]);
+        memcpy(simplify_info->ratios, ratios, sizeof (ratios));
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        enum { TORUS, FLAT_GRID, BUMPY_GRID, MESH_COUNT };
+        struct mesh_info meshes[MESH_COUNT];
+        create_test_torus(&meshes[TORUS], TORUS_SEGMENT_COUNT,
+                TORUS_RING_COUNT);
+        create_bumpy_grid(&meshes[FLAT_GRID], GRID_SIZE, 0.0f);
+        create_bumpy_grid(&meshes[BUMPY_GRID], GRID_SIZE, 0.05f);
+
+        // Every mesh alone first, then all of them across the workers,
+        // which must come out the same
+        struct simplify_info simplify_info;
+        init_simplify_info(&simplify_info, NULL);
+        struct mesh_info lod_meshes[MESH_COUNT];
+        for (unsigned int i = 0; i < MESH_COUNT; ++i) {
+                build_lod_chains(&simplify_info, &meshes[i], 1,
+                        &lod_meshes[i]);
+                check_levels(&meshes[i], &lod_meshes[i], &simplify_info);
+                check_targets_reached(&meshes[i], &lod_meshes[i],
+                        &simplify_info);
+        }
+        CHECK(simplify_info.stats.mesh_count == 1);
+        CHECK(simplify_info.stats.collapse_count > 0);
+
+        check_torus(&meshes[TORUS], &lod_meshes[TORUS]);
+        check_grid(&meshes[FLAT_GRID], &lod_meshes[FLAT_GRID], 0);
+        check_grid(&meshes[BUMPY_GRID], &lod_meshes[BUMPY_GRID], 0);
+
+        // Collapses on a plane move nothing off it
+        struct mesh_info *flat = &lod_meshes[FLAT_GRID];
+        CHECK(flat->lods[flat->lod_count - 1].error <= FLAT_ERROR_EPSILON);
+        struct mesh_info *torus = &lod_meshes[TORUS];
+        CHECK(torus->lods[torus->lod_count - 1].error > FLAT_ERROR_EPSILON);
+
+        init_simplify_info(&simplify_info, &job_system);
+        struct mesh_info parallel_meshes[MESH_COUNT];
+        build_lod_chains(&simplify_info, meshes, MESH_COUNT,
+                parallel_meshes);
+        CHECK(simplify_info.stats.mesh_count == MESH_COUNT);
+        for (unsigned int i = 0; i < MESH_COUNT; ++i) {
+                CHECK(parallel_meshes[i].lod_count == lod_meshes[i].lod_count);
+                CHECK(parallel_meshes[i].index_count ==
+                        lod_meshes[i].index_count);
+                CHECK(memcmp(parallel_meshes[i].indices, lod_meshes[i].indices,
+                        lod_meshes[i].index_count * sizeof (unsigned int)) ==
+                        0);
+                release_lod_chain(&parallel_meshes[i]);
+        }
+
+        // A bound under the error of the coarse levels leaves them out
+        float max_error = torus->lods[2].error;
+        init_simplify_info(&simplify_info, &job_system);
+        simplify_info.max_error = max_error;
+        struct mesh_info bounded_torus;
+        build_lod_chains(&simplify_info, &meshes[TORUS], 1, &bounded_torus);
+        check_levels(&meshes[TORUS], &bounded_torus, &simplify_info);
+        CHECK(bounded_torus.lod_count < torus->lod_count);
+        CHECK(bounded_torus.lod_count >= 3);
+        check_torus(&meshes[TORUS], &bounded_torus);
+        release_lod_chain(&bounded_torus);
+
+        // Locked borders keep every border vertex, on the bumpy grid where
+        // sliding along them would otherwise be cheap
+        init_simplify_info(&simplify_info, NULL);
+        simplify_info.is_border_locked = 1;
+        struct mesh_info locked_grid;
+        build_lod_chains(&simplify_info, &meshes[BUMPY_GRID], 1,
+                &locked_grid);
+        check_levels(&meshes[BUMPY_GRID], &locked_grid, &simplify_info);
+        check_grid(&meshes[BUMPY_GRID], &locked_grid, 1);
+        CHECK(locked_grid.lod_count >= 3);
+        release_lod_chain(&locked_grid);
+
+        for (unsigned int i = 0; i < MESH_COUNT; ++i) {
+                release_lod_chain(&lod_meshes[i]);
+                release_test_mesh(&meshes[i]);
+        }
+        release_job_system(&job_system);
+
+        return finish_test("simplify_test");
+}
@@ -0,0 +1,86 @@
+#ifndef TEST_MESH_H
+#define TEST_MESH_H
+
+#include "mesh_interface.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// A closed torus of ring_count rings of segment_count vertices, the kind of
+// smooth, well connected mesh the mesh tools are written for. One level of
+// detail covers all of it.
+static inline void create_test_torus(struct mesh_info *mi,
+        unsigned int segment_count, unsigned int ring_count)
+{
+        mi->vertex_count = segment_count * ring_count;
+        mi->verticies = malloc(mi->vertex_count * sizeof (struct vertex));
+
+        for (unsigned int r = 0; r < ring_count; ++r) {
+                for (unsigned int s = 0; s < segment_count; ++s) {
+                        float a = 6.2831853f * s / segment_count;
+                        float b = 6.2831853f * r / ring_count;
+                        float radius = 2.0f + 0.7f * cosf(b);
+
+                        struct vertex *v =
+                                &mi->verticies[r * segment_count + s];
+                        v->position[0] = radius * cosf(a);
+                        v->position[1] = 0.7f * sinf(b);
+                        v->position[2] = radius * sinf(a);
+                        v->position[3] = 1.0f;
+                        v->colour[0] = 1.0f;
+                        v->colour[1] = 0.5f;
+                        v->colour[2] = 0.25f;
+                        v->colour[3] = 1.0f;
+                        v->uv[0] = (float) s / segment_count;
+                        v->uv[1] = (float) r / ring_count;
+                }
+        }
+
+        mi->index_count = segment_count * ring_count * 6;
+        mi->indices = malloc(mi->index_count * sizeof (unsigned int));
+
+        unsigned int *index = mi->indices;
+        for (unsigned int r = 0; r < ring_count; ++r) {
+                for (unsigned int s = 0; s < segment_count; ++s) {
+                        unsigned int next_s = (s + 1) % segment_count;
+                        unsigned int next_r = (r + 1) % ring_count;
+                        unsigned int a = r * segment_count + s;
+                        unsigned int b = r * segment_count + next_s;
+                        unsigned int c = next_r * segment_count + s;
+                        unsigned int d = next_r * segment_count + next_s;
+
+                        *index++ = a;
+                        *index++ = c;
+                        *index++ = b;
+                        *index++ = b;
+                        *index++ = c;
+                        *index++ = d;
+                }
+        }
+
+        mi->lod_count = 1;
+        mi->lods[0].first_index = 0;
+        mi->lods[0].index_count = mi->index_count;
+        mi->lods[0].error = 0.0f;
+}
+
+// The codec may start a triangle from another of its corners
+static inline int is_same_triangle(const unsigned int *a,
+        const unsigned int *b)
+{
+        for (int r = 0; r < 3; ++r) {
+                if (a[0] == b[r] && a[1] == b[(r + 1) % 3] &&
+                        a[2] == b[(r + 2) % 3])
+                        return 1;
+        }
+
+        return 0;
+}
+
+static inline void release_test_mesh(struct mesh_info *mi)
+{
+        free(mi->indices);
+        free(mi->verticies);
+}
+
+#endif
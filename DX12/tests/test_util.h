@@ -0,0 +1,59 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include "job_interface.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Helpers of the headless test programs. A failed check is reported where
+// it happens, and the program exits with a failure once it is done.
+static unsigned int test_failure_count;
+
+#define CHECK(cond) \
+        do { \
+                if (!(cond)) { \
+                        fprintf(stderr, "%s:%d: check failed: %s\n", \
+                                __FILE__, __LINE__, #cond); \
+                        ++test_failure_count; \
+                } \
+        } while (0)
+
+static inline unsigned long long test_random(unsigned long long *state)
+{
+        // xorshift64, the same sequence on every platform
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+
+        return *state;
+}
+
+static inline float test_random_float(unsigned long long *state, float min,
+        float max)
+{
+        return min + (max - min) * (float) (test_random(state) >> 40) /
+                (float) (1 << 24);
+}
+
+// Several workers even on a single core, so the parallel paths run
+static inline void create_test_job_system(struct job_system_info *job_system)
+{
+        memset(job_system, 0, sizeof (struct job_system_info));
+        job_system->worker_count = 3;
+        create_job_system(job_system);
+}
+
+static inline int finish_test(const char *name)
+{
+        if (test_failure_count > 0) {
+                printf("%s: %u checks failed\n", name, test_failure_count);
+                return 1;
+        }
+
+        printf("%s: ok\n", name);
+
+        return 0;
+}
+
+#endif
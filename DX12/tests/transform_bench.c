@@ -0,0 +1,180 @@
+#include "transform_interface.h"
+#include "timer_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Times updating a million node hierarchy of BENCH_LEVEL_COUNT levels, each
+// BENCH_FANOUT times wider than the one above, with a share of the nodes
+// changed before each update. Timings depend on the machine and are only
+// reported; the run fails when an update without changes recomputes
+// anything, or a sample of world matrices is off from the product of the
+// local matrices above them.
+#define BENCH_NODE_COUNT 1000000
+#define BENCH_LEVEL_COUNT 6
+#define BENCH_FANOUT 10
+#define BENCH_RUN_COUNT 5
+#define MAT_EPSILON 1e-4f
+
+static const double dirty_ratios[] = { 0.0, 0.001, 0.01, 0.1, 0.5, 1.0 };
+
+static void set_random_position(unsigned long long *state,
+        struct transform_info *transform_info, unsigned int index)
+{
+        vec3 position;
+        for (int k = 0; k < 3; ++k)
+                position[k] = test_random_float(state, -10.0f, 10.0f);
+        set_transform_position(transform_info, index, position);
+}
+
+// Parents are picked at random from the level above, the last level takes
+// what is left of the nodes
+static void add_nodes(unsigned long long *state,
+        struct transform_info *transform_info)
+{
+        unsigned int level_first = 0;
+        unsigned int level_count = 0;
+        unsigned int level_size = BENCH_FANOUT;
+        for (unsigned int l = 0; l < BENCH_LEVEL_COUNT; ++l) {
+                if (l == BENCH_LEVEL_COUNT - 1)
+                        level_size = BENCH_NODE_COUNT - transform_info->count;
+
+                unsigned int first = transform_info->count;
+                for (unsigned int n = 0; n < level_size; ++n) {
+                        unsigned int parent = l == 0 ? TRANSFORM_NO_PARENT :
+                                level_first + (unsigned int)
+                                (test_random(state) % level_count);
+                        unsigned int index = add_transform(transform_info,
+                                parent);
+
+                        quat rotation;
+                        for (int k = 0; k < 4; ++k)
+                                rotation[k] = test_random_float(state,
+                                        -1.0f, 1.0f);
+                        quat_norm(rotation, rotation);
+                        set_random_position(state, transform_info, index);
+                        set_transform_rotation(transform_info, index,
+                                rotation);
+                }
+
+                level_first = first;
+                level_count = level_size;
+                level_size *= BENCH_FANOUT;
+        }
+}
+
+static void calc_local_mat(struct transform_info *transform_info,
+        unsigned int i, mat4x4 local_mat)
+{
+        mat4x4 rotation_mat;
+        mat4x4 scale_mat;
+        mat4x4_from_quat(rotation_mat, transform_info->rotations[i]);
+        mat4x4_identity(scale_mat);
+        for (int k = 0; k < 3; ++k)
+                scale_mat[k][k] = transform_info->scales[i][k];
+
+        mat4x4_identity(local_mat);
+        mat4x4_translate(local_mat, transform_info->positions[i][0],
+                transform_info->positions[i][1],
+                transform_info->positions[i][2]);
+        mat4x4_mul(local_mat, local_mat, rotation_mat);
+        mat4x4_mul(local_mat, local_mat, scale_mat);
+}
+
+static unsigned int count_bad_world_mats(
+        struct transform_info *transform_info)
+{
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < transform_info->count; i += 997) {
+                mat4x4 world_mat;
+                calc_local_mat(transform_info, i, world_mat);
+                for (unsigned int parent = transform_info->parents[i];
+                        parent != TRANSFORM_NO_PARENT;
+                        parent = transform_info->parents[parent]) {
+                        mat4x4 parent_mat;
+                        calc_local_mat(transform_info, parent, parent_mat);
+                        mat4x4_mul(world_mat, parent_mat, world_mat);
+                }
+
+                int is_bad = 0;
+                for (int c = 0; c < 4; ++c) {
+                        for (int r = 0; r < 4; ++r)
+                                is_bad |= !(fabsf(world_mat[c][r] -
+                                        transform_info->world_mats[i][c][r]) <=
+                                        MAT_EPSILON * (1.0f +
+                                        fabsf(world_mat[c][r])));
+                }
+                bad_count += is_bad;
+        }
+
+        return bad_count;
+}
+
+int main(void)
+{
+        // As many workers as the machine has cores to spare
+        struct job_system_info job_system;
+        memset(&job_system, 0, sizeof (struct job_system_info));
+        create_job_system(&job_system);
+
+        struct transform_info transform_info;
+        memset(&transform_info, 0, sizeof (struct transform_info));
+        transform_info.job_system = &job_system;
+        transform_info.capacity = BENCH_NODE_COUNT;
+        create_transforms(&transform_info);
+
+        unsigned long long state = 0x9e3779b97f4a7c15ull;
+        add_nodes(&state, &transform_info);
+        update_transforms(&transform_info);
+
+        unsigned int bad_count = 0;
+        unsigned int ratio_count = sizeof (dirty_ratios) /
+                sizeof (dirty_ratios[0]);
+        double update_ms[sizeof (dirty_ratios) / sizeof (dirty_ratios[0])];
+        for (unsigned int d = 0; d < ratio_count; ++d) {
+                unsigned int change_count = (unsigned int)
+                        (dirty_ratios[d] * BENCH_NODE_COUNT);
+                double best_time = 1e30;
+                for (unsigned int r = 0; r < BENCH_RUN_COUNT; ++r) {
+                        for (unsigned int n = 0; n < change_count; ++n)
+                                set_random_position(&state, &transform_info,
+                                        (unsigned int) (test_random(&state) %
+                                        BENCH_NODE_COUNT));
+
+                        double start_time = get_time_in_secs();
+                        update_transforms(&transform_info);
+                        double update_time = get_time_in_secs() - start_time;
+
+                        if (update_time < best_time)
+                                best_time = update_time;
+                        if (change_count == 0)
+                                bad_count += transform_info.stats.
+                                        updated_count != 0;
+                }
+
+                update_ms[d] = best_time * 1000.0;
+        }
+
+        bad_count += transform_info.stats.level_count != BENCH_LEVEL_COUNT;
+        bad_count += count_bad_world_mats(&transform_info);
+
+        printf("transform_bench: %u nodes over %u levels, %u workers\n",
+                BENCH_NODE_COUNT, transform_info.stats.level_count,
+                job_system.worker_count);
+        printf("transform_bench: dirty ratio");
+        for (unsigned int d = 0; d < ratio_count; ++d)
+                printf(" %7.1f%%", dirty_ratios[d] * 100.0);
+        printf("\ntransform_bench: update ms  ");
+        for (unsigned int d = 0; d < ratio_count; ++d)
+                printf(" %8.2f", update_ms[d]);
+        printf("\n");
+
+        release_transforms(&transform_info);
+        release_job_system(&job_system);
+
+        if (bad_count > 0)
+                printf("transform_bench: %u bad updates\n", bad_count);
+
+        return bad_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+#include "transform_interface.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Builds random forests of transforms and checks the world matrices against
+// walking up to the root for every node, after the first update, after
+// changing some of the nodes, after changing none and after adding more.
+// The matrices may be multiplied in another order than linmath's, so they
+// are compared to within MAT_EPSILON of their size.
+#define NODE_COUNT 40000
+#define ROOT_EVERY 50
+#define MAT_EPSILON 1e-4f
+
+static void random_local(unsigned long long *state, vec3 position,
+        quat rotation, vec3 scale)
+{
+        for (int k = 0; k < 3; ++k) {
+                position[k] = test_random_float(state, -10.0f, 10.0f);
+                scale[k] = test_random_float(state, 0.5f, 1.5f);
+        }
+
+        for (int k = 0; k < 4; ++k)
+                rotation[k] = test_random_float(state, -1.0f, 1.0f);
+        quat_norm(rotation, rotation);
+}
+
+static void calc_reference_local(struct transform_info *transform_info,
+        unsigned int i, mat4x4 local_mat)
+{
+        mat4x4 rotation_mat;
+        mat4x4 scale_mat;
+        mat4x4_from_quat(rotation_mat, transform_info->rotations[i]);
+        mat4x4_identity(scale_mat);
+        for (int k = 0; k < 3; ++k)
+                scale_mat[k][k] = transform_info->scales[i][k];
+
+        mat4x4_identity(local_mat);
+        mat4x4_translate(local_mat, transform_info->positions[i][0],
+                transform_info->positions[i][1],
+                transform_info->positions[i][2]);
+        mat4x4_mul(local_mat, local_mat, rotation_mat);
+        mat4x4_mul(local_mat, local_mat, scale_mat);
+}
+
+static void calc_reference_world(struct transform_info *transform_info,
+        unsigned int i, mat4x4 world_mat)
+{
+        calc_reference_local(transform_info, i, world_mat);
+
+        for (unsigned int parent = transform_info->parents[i];
+                parent != TRANSFORM_NO_PARENT;
+                parent = transform_info->parents[parent]) {
+                mat4x4 parent_local_mat;
+                calc_reference_local(transform_info, parent,
+                        parent_local_mat);
+                mat4x4_mul(world_mat, parent_local_mat, world_mat);
+        }
+}
+
+static void check_world_mats(struct transform_info *transform_info)
+{
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < transform_info->count; ++i) {
+                mat4x4 world_mat;
+                calc_reference_world(transform_info, i, world_mat);
+
+                for (int c = 0; c < 4; ++c) {
+                        for (int r = 0; r < 4; ++r) {
+                                float expected = world_mat[c][r];
+                                float value =
+                                        transform_info->world_mats[i][c][r];
+                                bad_count += !(fabsf(value - expected) <=
+                                        MAT_EPSILON * (1.0f +
+                                        fabsf(expected)));
+                        }
+                }
+        }
+        CHECK(bad_count == 0);
+}
+
+static void add_nodes(unsigned long long *state,
+        struct transform_info *transform_info, unsigned int count)
+{
+        for (unsigned int n = 0; n < count; ++n) {
+                unsigned int index = transform_info->count;
+                // Parents from anywhere before, which gives a few wide
+                // levels and a long thin tail
+                unsigned int parent = index == 0 ||
+                        test_random(state) % ROOT_EVERY == 0 ?
+                        TRANSFORM_NO_PARENT :
+                        (unsigned int) (test_random(state) % index);
+                CHECK(add_transform(transform_info, parent) == index);
+
+                vec3 position;
+                quat rotation;
+                vec3 scale;
+                random_local(state, position, rotation, scale);
+                set_transform_position(transform_info, index, position);
+                set_transform_rotation(transform_info, index, rotation);
+                set_transform_scale(transform_info, index, scale);
+        }
+}
+
+// Nodes that changed or sit under one that did, which are the ones an
+// update has to recompute
+static unsigned int change_nodes(unsigned long long *state,
+        struct transform_info *transform_info, unsigned int change_count)
+{
+        unsigned char *is_changed = calloc(transform_info->count, 1);
+
+        for (unsigned int n = 0; n < change_count; ++n) {
+                unsigned int i = test_random(state) % transform_info->count;
+                vec3 position;
+                quat rotation;
+                vec3 scale;
+                random_local(state, position, rotation, scale);
+                switch (n % 3) {
+                case 0:
+                        set_transform_position(transform_info, i, position);
+                        break;
+                case 1:
+                        set_transform_rotation(transform_info, i, rotation);
+                        break;
+                default:
+                        set_transform_scale(transform_info, i, scale);
+                        break;
+                }
+                is_changed[i] = 1;
+        }
+
+        // Parents come before their children
+        unsigned int dirty_count = 0;
+        for (unsigned int i = 0; i < transform_info->count; ++i) {
+                unsigned int parent = transform_info->parents[i];
+                if (parent != TRANSFORM_NO_PARENT)
+                        is_changed[i] |= is_changed[parent];
+                dirty_count += is_changed[i];
+        }
+
+        free(is_changed);
+
+        return dirty_count;
+}
+
+static unsigned int get_max_depth(struct transform_info *transform_info)
+{
+        unsigned int max_depth = 0;
+        for (unsigned int i = 0; i < transform_info->count; ++i) {
+                unsigned int depth = 0;
+                for (unsigned int parent = transform_info->parents[i];
+                        parent != TRANSFORM_NO_PARENT;
+                        parent = transform_info->parents[parent])
+                        ++depth;
+                max_depth = depth > max_depth ? depth : max_depth;
+        }
+
+        return max_depth;
+}
+
+static void test_transforms(struct job_system_info *job_system,
+        unsigned int count, mat4x4 **world_mats)
+{
+        unsigned long long state = 0xd1b54a32d192ed03ull ^ count;
+
+        struct transform_info transform_info;
+        memset(&transform_info, 0, sizeof (struct transform_info));
+        transform_info.job_system = job_system;
+        transform_info.capacity = count * 2;
+        create_transforms(&transform_info);
+
+        add_nodes(&state, &transform_info, count);
+        update_transforms(&transform_info);
+        CHECK(transform_info.stats.updated_count == count);
+        CHECK(transform_info.stats.level_count ==
+                get_max_depth(&transform_info) + 1);
+        check_world_mats(&transform_info);
+
+        unsigned int dirty_count = change_nodes(&state, &transform_info,
+                count / 100 + 1);
+        update_transforms(&transform_info);
+        CHECK(transform_info.stats.updated_count == dirty_count);
+        check_world_mats(&transform_info);
+
+        // Nothing changed, nothing is recomputed
+        mat4x4 *previous_mats = malloc(count * sizeof (mat4x4));
+        memcpy(previous_mats, transform_info.world_mats,
+                count * sizeof (mat4x4));
+        update_transforms(&transform_info);
+        CHECK(transform_info.stats.updated_count == 0);
+        CHECK(memcmp(previous_mats, transform_info.world_mats,
+                count * sizeof (mat4x4)) == 0);
+        free(previous_mats);
+
+        // Nodes added under the existing ones need the levels rebuilt, and
+        // only they are recomputed
+        add_nodes(&state, &transform_info, count);
+        update_transforms(&transform_info);
+        CHECK(transform_info.stats.updated_count == count);
+        CHECK(transform_info.stats.level_count ==
+                get_max_depth(&transform_info) + 1);
+        check_world_mats(&transform_info);
+
+        dirty_count = change_nodes(&state, &transform_info, count / 10 + 1);
+        update_transforms(&transform_info);
+        CHECK(transform_info.stats.updated_count == dirty_count);
+        check_world_mats(&transform_info);
+
+        // Kept so the serial and parallel runs can be compared
+        *world_mats = malloc(transform_info.count * sizeof (mat4x4));
+        memcpy(*world_mats, transform_info.world_mats,
+                transform_info.count * sizeof (mat4x4));
+
+        release_transforms(&transform_info);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        // The largest forest has levels past the size that is split across
+        // the job system
+        static const unsigned int counts[] = { 1, 2, 30, 1000, NODE_COUNT };
+        for (unsigned int c = 0; c < sizeof (counts) / sizeof (counts[0]);
+                ++c) {
+                mat4x4 *serial_mats;
+                mat4x4 *parallel_mats;
+                test_transforms(NULL, counts[c], &serial_mats);
+                test_transforms(&job_system, counts[c], &parallel_mats);
+
+                // Every node is computed the same way on any thread
+                CHECK(memcmp(serial_mats, parallel_mats, counts[c] * 2 *
+                        sizeof (mat4x4)) == 0);
+
+                free(parallel_mats);
+                free(serial_mats);
+        }
+
+        release_job_system(&job_system);
+
+        return finish_test("transform_test");
+}
@@ -0,0 +1,300 @@
+#include "vertex_format_interface.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// Encodes random meshes in every layout, with and without normals, and
+// checks each decoded vertex against what the formats can hold. The four
+// at a time path is checked byte for byte against the one vertex path, with
+// uvs at the edges of what a half holds, and the split across the job
+// system against a single thread.
+#define TEST_VERTEX_COUNT 70001
+
+static const float special_uvs[] = {
+        0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65519.0f, 65520.0f, 70000.0f,
+        -1e9f, 6.1e-5f, 6.0e-5f, 1.0e-6f, -3.0e-8f, 1.0e-9f,
+        1.00048828125f, 1.00146484375f, 2047.5f, 0.333333f
+};
+
+static void create_test_vertices(struct mesh_info *mi,
+        unsigned int vertex_count, unsigned long long *state)
+{
+        memset(mi, 0, sizeof (struct mesh_info));
+        mi->vertex_count = vertex_count;
+        mi->verticies = malloc((vertex_count + 1) * sizeof (struct vertex));
+
+        // Off centre and much longer along x, so the scale and bias matter
+        unsigned int special_count = sizeof (special_uvs) /
+                sizeof (special_uvs[0]);
+        for (unsigned int i = 0; i < vertex_count; ++i) {
+                struct vertex *v = &mi->verticies[i];
+                v->position[0] = test_random_float(state, -40.0f, 160.0f);
+                v->position[1] = test_random_float(state, 2.0f, 3.0f);
+                v->position[2] = test_random_float(state, -0.5f, 0.25f);
+                v->position[3] = 1.0f;
+                for (int k = 0; k < 4; ++k)
+                        v->colour[k] = test_random_float(state, 0.0f, 1.0f);
+                v->uv[0] = test_random_float(state, -4.0f, 4.0f);
+                v->uv[1] = test_random(state) % 4 == 0 ?
+                        special_uvs[test_random(state) % special_count] :
+                        test_random_float(state, 0.0f, 1.0f);
+        }
+
+        // The first two are the corners of the bounds
+        static const float corners[2][3] = {
+                { -40.0f, 2.0f, -0.5f }, { 160.0f, 3.0f, 0.25f }
+        };
+        for (int c = 0; c < 2; ++c)
+                memcpy(mi->verticies[c].position, corners[c],
+                        sizeof (corners[c]));
+}
+
+static float (*create_test_normals(unsigned int vertex_count,
+        unsigned long long *state))[3]
+{
+        float (*normals)[3] = malloc((vertex_count + 1) * sizeof (vec3));
+        for (unsigned int i = 0; i < vertex_count; ++i) {
+                for (int k = 0; k < 3; ++k)
+                        normals[i][k] = test_random_float(state, -1.0f, 1.0f);
+                if (vec3_len(normals[i]) < 0.01f)
+                        normals[i][2] = 1.0f;
+                vec3_norm(normals[i], normals[i]);
+        }
+
+        // Along the axes, where the octahedral fold meets itself
+        static const float axes[6][3] = {
+                { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+                { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+                { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }
+        };
+        for (int a = 0; a < 6; ++a)
+                memcpy(normals[a], axes[a], sizeof (axes[a]));
+
+        return normals;
+}
+
+// Halves have 11 bits of precision down to 2^-14 and a fixed step of 2^-24
+// below that, and round to nearest
+static float get_half_bound(float value)
+{
+        return fabsf(value) * (1.0f / 2048.0f) + 1.0f / (1 << 24) +
+                fabsf(value) * 1e-6f;
+}
+
+static float get_position_bound(unsigned int layout, float value,
+        float scale, float bias)
+{
+        float rounding = fabsf(value) * 1e-6f + fabsf(bias) * 1e-6f;
+        if (layout == VERTEX_LAYOUT_FLOAT)
+                return 0.0f;
+        if (layout == VERTEX_LAYOUT_SNORM16)
+                return scale * (0.5f / 32767.0f) * 1.001f + rounding;
+
+        return scale * get_half_bound((value - bias) / scale) + rounding;
+}
+
+static float get_uv_bound(unsigned int layout, float value)
+{
+        if (layout == VERTEX_LAYOUT_FLOAT)
+                return 0.0f;
+        // Past the largest half is infinity
+        if (fabsf(value) >= 65520.0f)
+                return INFINITY;
+
+        return get_half_bound(value);
+}
+
+static void test_error_bounds(struct mesh_info *mi, float (*normals)[3],
+        unsigned int layout)
+{
+        struct vertex_encode_info encode_info;
+        memset(&encode_info, 0, sizeof (struct vertex_encode_info));
+        encode_info.layout = layout;
+        encode_info.normals = normals;
+        encode_vertices(&encode_info, mi);
+
+        struct vertex_format *format = &encode_info.format;
+        unsigned int expected_stride = layout == VERTEX_LAYOUT_FLOAT ?
+                sizeof (struct vertex) : 16;
+        if (normals != NULL)
+                expected_stride += layout == VERTEX_LAYOUT_FLOAT ? 12 : 4;
+        CHECK(format->stride == expected_stride);
+        CHECK(encode_info.size == (unsigned long long) mi->vertex_count *
+                format->stride);
+
+        struct vertex *decoded = malloc((mi->vertex_count + 1) *
+                sizeof (struct vertex));
+        decode_vertices(format, encode_info.data, mi->vertex_count, decoded);
+
+        unsigned int bad_count = 0;
+        struct vertex_format_errors errors;
+        memset(&errors, 0, sizeof (struct vertex_format_errors));
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                struct vertex *v = &mi->verticies[i];
+                struct vertex *d = &decoded[i];
+                for (int k = 0; k < 3; ++k) {
+                        float error = fabsf(d->position[k] - v->position[k]);
+                        bad_count += !(error <= get_position_bound(layout,
+                                v->position[k], format->position_scale[k],
+                                format->position_bias[k]));
+                        if (error > errors.position_error)
+                                errors.position_error = error;
+                }
+                bad_count += d->position[3] != 1.0f;
+
+                for (int k = 0; k < 4; ++k) {
+                        float error = fabsf(d->colour[k] - v->colour[k]);
+                        bad_count += !(error <= (layout == VERTEX_LAYOUT_FLOAT ?
+                                0.0f : 0.5f / 255.0f + 1e-6f));
+                        if (error > errors.colour_error)
+                                errors.colour_error = error;
+                }
+
+                for (int k = 0; k < 2; ++k) {
+                        float error = fabsf(d->uv[k] - v->uv[k]);
+                        bad_count += !(error <= get_uv_bound(layout,
+                                v->uv[k]));
+                        // Signs survive, zeros included
+                        bad_count += signbit(d->uv[k]) != signbit(v->uv[k]);
+                        if (error > errors.uv_error)
+                                errors.uv_error = error;
+                }
+        }
+        CHECK(bad_count == 0);
+
+        // The errors the module reports are the ones found here. Uvs past
+        // the largest half have no finite error to compare.
+        struct vertex_format_errors module_errors;
+        get_vertex_format_errors(&encode_info, mi, &module_errors);
+        CHECK(module_errors.position_error == errors.position_error);
+        CHECK(module_errors.colour_error == errors.colour_error);
+        if (layout == VERTEX_LAYOUT_FLOAT)
+                CHECK(module_errors.uv_error == 0.0f);
+        if (layout == VERTEX_LAYOUT_SNORM16)
+                CHECK(errors.position_error > 0.0f);
+        // Single precision acos can't tell angles under about 0.04 degrees
+        // apart, which is more than the octahedral rounding
+        if (normals != NULL)
+                CHECK(module_errors.normal_error < 0.06f);
+
+        // The dequantize matrix takes the stored positions back to model
+        // space, the same as decoding does
+        mat4x4 dequantize_mat;
+        get_vertex_format_dequantize_mat(format, dequantize_mat);
+        struct vertex_format raw_format = *format;
+        for (int k = 0; k < 3; ++k) {
+                raw_format.position_scale[k] = 1.0f;
+                raw_format.position_bias[k] = 0.0f;
+        }
+        struct vertex raw;
+        bad_count = 0;
+        for (unsigned int i = 0; i < mi->vertex_count; i += 97) {
+                decode_vertices(&raw_format, (const unsigned char *)
+                        encode_info.data + (size_t) i * format->stride, 1,
+                        &raw);
+                vec4 position;
+                mat4x4_mul_vec4(position, dequantize_mat, raw.position);
+                for (int k = 0; k < 4; ++k)
+                        bad_count += fabsf(position[k] -
+                                decoded[i].position[k]) > 1e-4f;
+        }
+        CHECK(bad_count == 0);
+
+        free(decoded);
+        release_encoded_vertices(&encode_info);
+}
+
+// Three vertices are encoded one at a time. With the corners of the bounds
+// first they have the same scale and bias as the whole mesh, so every vertex
+// can be encoded alone and compared with the four at a time encoding.
+static void test_sse_matches_scalar(struct mesh_info *mi,
+        unsigned int layout)
+{
+        struct vertex_encode_info encode_info;
+        memset(&encode_info, 0, sizeof (struct vertex_encode_info));
+        encode_info.layout = layout;
+        encode_vertices(&encode_info, mi);
+        unsigned int stride = encode_info.format.stride;
+
+        struct mesh_info small_mi;
+        memset(&small_mi, 0, sizeof (struct mesh_info));
+        small_mi.vertex_count = 3;
+        struct vertex vertices[3];
+        small_mi.verticies = vertices;
+        vertices[0] = mi->verticies[0];
+        vertices[1] = mi->verticies[1];
+
+        unsigned int bad_count = 0;
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                vertices[2] = mi->verticies[i];
+                struct vertex_encode_info small_info;
+                memset(&small_info, 0, sizeof (struct vertex_encode_info));
+                small_info.layout = layout;
+                encode_vertices(&small_info, &small_mi);
+
+                bad_count += memcmp((const unsigned char *) small_info.data +
+                        2 * stride, (const unsigned char *) encode_info.data +
+                        (size_t) i * stride, stride) != 0;
+                release_encoded_vertices(&small_info);
+        }
+        CHECK(bad_count == 0);
+
+        release_encoded_vertices(&encode_info);
+}
+
+// Large meshes are split across the workers, into the same bytes
+static void test_parallel_encode(struct job_system_info *job_system,
+        struct mesh_info *mi, float (*normals)[3], unsigned int layout)
+{
+        struct vertex_encode_info encode_info;
+        memset(&encode_info, 0, sizeof (struct vertex_encode_info));
+        encode_info.layout = layout;
+        encode_info.normals = normals;
+        encode_vertices(&encode_info, mi);
+
+        struct vertex_encode_info parallel_info;
+        memset(&parallel_info, 0, sizeof (struct vertex_encode_info));
+        parallel_info.job_system = job_system;
+        parallel_info.layout = layout;
+        parallel_info.normals = normals;
+        encode_vertices(&parallel_info, mi);
+
+        CHECK(parallel_info.stats.chunk_count > 1);
+        CHECK(parallel_info.size == encode_info.size);
+        CHECK(memcmp(parallel_info.data, encode_info.data,
+                (size_t) encode_info.size) == 0);
+
+        release_encoded_vertices(&parallel_info);
+        release_encoded_vertices(&encode_info);
+}
+
+int main(void)
+{
+        struct job_system_info job_system;
+        create_test_job_system(&job_system);
+
+        unsigned long long state = 0x2545f4914f6cdd1dull;
+        struct mesh_info mi;
+        create_test_vertices(&mi, TEST_VERTEX_COUNT, &state);
+        float (*normals)[3] = create_test_normals(TEST_VERTEX_COUNT, &state);
+
+        // A small mesh for the one vertex at a time comparison, with a
+        // count that leaves a tail after the groups of four
+        struct mesh_info small_mi = mi;
+        small_mi.vertex_count = 4099;
+
+        for (unsigned int layout = VERTEX_LAYOUT_FLOAT;
+                layout <= VERTEX_LAYOUT_HALF; ++layout) {
+                test_error_bounds(&mi, NULL, layout);
+                test_error_bounds(&mi, normals, layout);
+                test_sse_matches_scalar(&small_mi, layout);
+                test_parallel_encode(&job_system, &mi, normals, layout);
+        }
+
+        free(normals);
+        free(mi.verticies);
+        release_job_system(&job_system);
+
+        return finish_test("vertex_format_test");
+}
@@ -0,0 +1,30 @@
+#include "timer_interface.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+
+#if defined(_WIN32)
+double get_time_in_secs()
+{
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+
+        return (double) counter.QuadPart / (double) frequency.QuadPart;
+}
+#else
+double get_time_in_secs()
+{
+        struct timespec time_spec;
+        clock_gettime(CLOCK_MONOTONIC, &time_spec);
+
+        return (double) time_spec.tv_sec + (double) time_spec.tv_nsec * 1e-9;
+}
+#endif
@@ -0,0 +1,8 @@
+#ifndef TIMER_INTERFACE_H
+#define TIMER_INTERFACE_H
+
+// Monotonic high resolution clock, kept free of Windows types so portable
+// modules can time themselves.
+double get_time_in_secs();
+
+#endif
@@ -0,0 +1,289 @@
+#include "transform_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_USE_SSE
+#include <emmintrin.h>
+#endif
+
+struct transform_level_job {
+        struct transform_info *transform_info;
+        unsigned int first;
+        unsigned int count;
+        unsigned int chunk_count;
+        unsigned int chunk_updated_counts[MAX_TRANSFORM_CHUNKS];
+};
+
+void create_transforms(struct transform_info *transform_info)
+{
+        unsigned int capacity = transform_info->capacity;
+        assert(capacity > 0);
+
+        transform_info->count = 0;
+        transform_info->parents = malloc(capacity * sizeof (unsigned int));
+        transform_info->positions = malloc(capacity * sizeof (vec3));
+        transform_info->rotations = malloc(capacity * sizeof (quat));
+        transform_info->scales = malloc(capacity * sizeof (vec3));
+        transform_info->local_mats = malloc(capacity * sizeof (mat4x4));
+        transform_info->world_mats = malloc(capacity * sizeof (mat4x4));
+        transform_info->local_dirty = malloc(capacity);
+        transform_info->world_dirty = malloc(capacity);
+
+        transform_info->is_order_dirty = 0;
+        transform_info->depths = malloc(capacity * sizeof (unsigned int));
+        transform_info->level_count = 0;
+        transform_info->level_offsets = malloc((capacity + 1) *
+                sizeof (unsigned int));
+        transform_info->level_order = malloc(capacity * sizeof (unsigned int));
+        transform_info->update_list = malloc(capacity * sizeof (unsigned int));
+
+        memset(&transform_info->stats, 0, sizeof (struct transform_stats));
+}
+
+void release_transforms(struct transform_info *transform_info)
+{
+        free(transform_info->update_list);
+        free(transform_info->level_order);
+        free(transform_info->level_offsets);
+        free(transform_info->depths);
+        free(transform_info->world_dirty);
+        free(transform_info->local_dirty);
+        free(transform_info->world_mats);
+        free(transform_info->local_mats);
+        free(transform_info->scales);
+        free(transform_info->rotations);
+        free(transform_info->positions);
+        free(transform_info->parents);
+}
+
+unsigned int add_transform(struct transform_info *transform_info,
+        unsigned int parent)
+{
+        assert(transform_info->count < transform_info->capacity);
+        assert(parent == TRANSFORM_NO_PARENT || parent < transform_info->count);
+
+        unsigned int index = transform_info->count++;
+        transform_info->parents[index] = parent;
+        vec3 zero = { 0.0f, 0.0f, 0.0f };
+        vec3 one = { 1.0f, 1.0f, 1.0f };
+        vec3_scale(transform_info->positions[index], zero, 1.0f);
+        quat_identity(transform_info->rotations[index]);
+        vec3_scale(transform_info->scales[index], one, 1.0f);
+        transform_info->local_dirty[index] = 1;
+
+        transform_info->depths[index] = parent == TRANSFORM_NO_PARENT ? 0 :
+                transform_info->depths[parent] + 1;
+        transform_info->is_order_dirty = 1;
+
+        return index;
+}
+
+void set_transform_position(struct transform_info *transform_info,
+        unsigned int index, vec3 position)
+{
+        assert(index < transform_info->count);
+
+        vec3_scale(transform_info->positions[index], position, 1.0f);
+        transform_info->local_dirty[index] = 1;
+}
+
+void set_transform_rotation(struct transform_info *transform_info,
+        unsigned int index, quat rotation)
+{
+        assert(index < transform_info->count);
+
+        vec4_scale(transform_info->rotations[index], rotation, 1.0f);
+        transform_info->local_dirty[index] = 1;
+}
+
+void set_transform_scale(struct transform_info *transform_info,
+        unsigned int index, vec3 scale)
+{
+        assert(index < transform_info->count);
+
+        vec3_scale(transform_info->scales[index], scale, 1.0f);
+        transform_info->local_dirty[index] = 1;
+}
+
+static void build_transform_levels(struct transform_info *transform_info)
+{
+        unsigned int *level_offsets = transform_info->level_offsets;
+
+        transform_info->level_count = 0;
+        for (unsigned int i = 0; i < transform_info->count; ++i) {
+                if (transform_info->depths[i] >= transform_info->level_count)
+                        transform_info->level_count =
+                                transform_info->depths[i] + 1;
+        }
+
+        // Counting sort by depth, nodes of a level stay in index order
+        memset(level_offsets, 0, (transform_info->level_count + 1) *
+                sizeof (unsigned int));
+        for (unsigned int i = 0; i < transform_info->count; ++i)
+                ++level_offsets[transform_info->depths[i] + 1];
+
+        for (unsigned int l = 0; l < transform_info->level_count; ++l)
+                level_offsets[l + 1] += level_offsets[l];
+
+        for (unsigned int i = 0; i < transform_info->count; ++i) {
+                unsigned int depth = transform_info->depths[i];
+                transform_info->level_order[level_offsets[depth]++] = i;
+        }
+
+        // The fill moved every offset onto the start of the next level
+        for (unsigned int l = transform_info->level_count; l > 0; --l)
+                level_offsets[l] = level_offsets[l - 1];
+        level_offsets[0] = 0;
+
+        transform_info->is_order_dirty = 0;
+}
+
+static void compose_local_mat(mat4x4 local_mat, vec3 position, quat rotation,
+        vec3 scale)
+{
+        mat4x4_from_quat(local_mat, rotation);
+
+        for (int k = 0; k < 3; ++k) {
+                local_mat[0][k] *= scale[0];
+                local_mat[1][k] *= scale[1];
+                local_mat[2][k] *= scale[2];
+        }
+
+        local_mat[3][0] = position[0];
+        local_mat[3][1] = position[1];
+        local_mat[3][2] = position[2];
+}
+
+// Column c of the world matrix is the parent columns weighted by column c of
+// the local matrix
+static void mul_world_mat(mat4x4 world_mat, mat4x4 parent_mat,
+        mat4x4 local_mat)
+{
+#if defined(TRANSFORM_USE_SSE)
+        __m128 p0 = _mm_loadu_ps(parent_mat[0]);
+        __m128 p1 = _mm_loadu_ps(parent_mat[1]);
+        __m128 p2 = _mm_loadu_ps(parent_mat[2]);
+        __m128 p3 = _mm_loadu_ps(parent_mat[3]);
+
+        for (int c = 0; c < 4; ++c) {
+                __m128 col = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(p0, _mm_set1_ps(local_mat[c][0])),
+                        _mm_mul_ps(p1, _mm_set1_ps(local_mat[c][1]))),
+                        _mm_add_ps(
+                        _mm_mul_ps(p2, _mm_set1_ps(local_mat[c][2])),
+                        _mm_mul_ps(p3, _mm_set1_ps(local_mat[c][3]))));
+                _mm_storeu_ps(world_mat[c], col);
+        }
+#else
+        mat4x4_mul(world_mat, parent_mat, local_mat);
+#endif
+}
+
+static void update_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct transform_level_job *job = job_data;
+        struct transform_info *transform_info = job->transform_info;
+        unsigned int *parents = transform_info->parents;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = job->first + (unsigned int)
+                        (((unsigned long long) job->count * c) /
+                        job->chunk_count);
+                unsigned int last = job->first + (unsigned int)
+                        (((unsigned long long) job->count * (c + 1)) /
+                        job->chunk_count);
+
+                // A node is dirty when it or its parent changed, the parents
+                // are a level up and final already. The dirty ones are
+                // gathered into the chunk's part of the update list.
+                unsigned int *update_list = transform_info->update_list +
+                        first;
+                unsigned int update_count = 0;
+                for (unsigned int j = first; j < last; ++j) {
+                        unsigned int i = transform_info->level_order[j];
+                        unsigned int parent = parents[i];
+                        unsigned char is_dirty =
+                                transform_info->local_dirty[i] |
+                                (parent != TRANSFORM_NO_PARENT ?
+                                transform_info->world_dirty[parent] : 0);
+
+                        transform_info->world_dirty[i] = is_dirty;
+                        update_list[update_count] = i;
+                        update_count += is_dirty;
+                }
+
+                for (unsigned int k = 0; k < update_count; ++k) {
+                        unsigned int i = update_list[k];
+                        if (!transform_info->local_dirty[i])
+                                continue;
+
+                        compose_local_mat(transform_info->local_mats[i],
+                                transform_info->positions[i],
+                                transform_info->rotations[i],
+                                transform_info->scales[i]);
+                        transform_info->local_dirty[i] = 0;
+                }
+
+                for (unsigned int k = 0; k < update_count; ++k) {
+                        unsigned int i = update_list[k];
+                        unsigned int parent = parents[i];
+                        if (parent == TRANSFORM_NO_PARENT) {
+                                mat4x4_dup(transform_info->world_mats[i],
+                                        transform_info->local_mats[i]);
+                        } else {
+                                mul_world_mat(transform_info->world_mats[i],
+                                        transform_info->world_mats[parent],
+                                        transform_info->local_mats[i]);
+                        }
+                }
+
+                job->chunk_updated_counts[c] = update_count;
+        }
+}
+
+void update_transforms(struct transform_info *transform_info)
+{
+        double start_time = get_time_in_secs();
+
+        if (transform_info->is_order_dirty)
+                build_transform_levels(transform_info);
+
+        struct job_system_info *job_system = transform_info->job_system;
+
+        transform_info->stats.level_count = transform_info->level_count;
+        transform_info->stats.updated_count = 0;
+
+        for (unsigned int l = 0; l < transform_info->level_count; ++l) {
+                struct transform_level_job job;
+                job.transform_info = transform_info;
+                job.first = transform_info->level_offsets[l];
+                job.count = transform_info->level_offsets[l + 1] - job.first;
+                job.chunk_count = 1;
+
+                // Small levels are updated on the calling thread
+                if (job_system != NULL && job.count >=
+                        TRANSFORM_PARALLEL_MIN_COUNT) {
+                        job.chunk_count = job_system->worker_count * 4;
+                        if (job.chunk_count < 1)
+                                job.chunk_count = 1;
+                        if (job.chunk_count > MAX_TRANSFORM_CHUNKS)
+                                job.chunk_count = MAX_TRANSFORM_CHUNKS;
+                }
+
+                parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                        job.chunk_count, 1, update_chunks, &job);
+
+                for (unsigned int c = 0; c < job.chunk_count; ++c) {
+                        transform_info->stats.updated_count +=
+                                job.chunk_updated_counts[c];
+                }
+        }
+
+        transform_info->stats.update_time = get_time_in_secs() - start_time;
+}
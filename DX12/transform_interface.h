@@ -0,0 +1,59 @@
+#ifndef TRANSFORM_INTERFACE_H
+#define TRANSFORM_INTERFACE_H
+
+#include "linmath.h"
+#include "job_interface.h"
+
+// Transform hierarchy. Local translation, rotation and scale are kept in
+// separate arrays, and a parent always comes before its children, so world
+// matrices can be worked out one depth level at a time with each level
+// split across the job system. Only nodes whose local transform changed,
+// or that sit under one that did, are recomputed. Kept free of D3D types so
+// it can run headless.
+#define TRANSFORM_NO_PARENT 0xffffffff
+#define TRANSFORM_PARALLEL_MIN_COUNT 4096
+#define MAX_TRANSFORM_CHUNKS 64
+
+struct transform_stats {
+        unsigned int level_count;
+        unsigned int updated_count;
+        double update_time;
+};
+
+struct transform_info {
+        struct job_system_info *job_system;
+        unsigned int capacity;
+        unsigned int count;
+        unsigned int *parents;
+        vec3 *positions;
+        quat *rotations;
+        vec3 *scales;
+        mat4x4 *local_mats;
+        mat4x4 *world_mats;
+        unsigned char *local_dirty;
+        unsigned char *world_dirty;
+        // Nodes ordered by depth, rebuilt after nodes are added
+        int is_order_dirty;
+        unsigned int *depths;
+        unsigned int level_count;
+        unsigned int *level_offsets;
+        unsigned int *level_order;
+        unsigned int *update_list;
+        struct transform_stats stats;
+};
+
+void create_transforms(struct transform_info *transform_info);
+void release_transforms(struct transform_info *transform_info);
+// Starts out as the identity, parent has to be added already or be
+// TRANSFORM_NO_PARENT
+unsigned int add_transform(struct transform_info *transform_info,
+        unsigned int parent);
+void set_transform_position(struct transform_info *transform_info,
+        unsigned int index, vec3 position);
+void set_transform_rotation(struct transform_info *transform_info,
+        unsigned int index, quat rotation);
+void set_transform_scale(struct transform_info *transform_info,
+        unsigned int index, vec3 scale);
+void update_transforms(struct transform_info *transform_info);
+
+#endif
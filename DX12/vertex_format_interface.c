@@ -0,0 +1,640 @@
+#include "vertex_format_interface.h"
+#include "timer_interface.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_FORMAT_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#define RADIANS_TO_DEGREES 57.29578f
+
+struct vertex_encode_job {
+        struct vertex_encode_info *encode_info;
+        struct mesh_info *mi;
+        vec3 inverse_scale;
+        unsigned int chunk_count;
+};
+
+unsigned int get_vertex_attribute_size(unsigned int format)
+{
+        switch (format)
+        {
+                case MESH_ATTRIBUTE_FORMAT_FLOAT2 :
+                        return 2 * sizeof (float);
+
+                case MESH_ATTRIBUTE_FORMAT_FLOAT3 :
+                        return 3 * sizeof (float);
+
+                case MESH_ATTRIBUTE_FORMAT_FLOAT4 :
+                        return 4 * sizeof (float);
+
+                case MESH_ATTRIBUTE_FORMAT_SNORM16X2 :
+                case MESH_ATTRIBUTE_FORMAT_HALF2 :
+                case MESH_ATTRIBUTE_FORMAT_UNORM8X4 :
+                        return 4;
+
+                case MESH_ATTRIBUTE_FORMAT_SNORM16X4 :
+                case MESH_ATTRIBUTE_FORMAT_HALF4 :
+                        return 8;
+
+                default :
+                        return 0;
+        }
+}
+
+static void add_attribute(struct vertex_format *format,
+        unsigned int semantic, unsigned int attribute_format)
+{
+        assert(format->attribute_count < MAX_VERTEX_ATTRIBUTES);
+
+        struct vertex_attribute *attribute =
+                &format->attributes[format->attribute_count++];
+        attribute->semantic = semantic;
+        attribute->format = attribute_format;
+        attribute->offset = format->stride;
+        format->stride += get_vertex_attribute_size(attribute_format);
+}
+
+void get_vertex_format(unsigned int layout, int has_normals,
+        struct vertex_format *format)
+{
+        int is_float = layout == VERTEX_LAYOUT_FLOAT;
+
+        format->layout = layout;
+        format->attribute_count = 0;
+        format->stride = 0;
+        add_attribute(format, MESH_ATTRIBUTE_SEMANTIC_POSITION, is_float ?
+                MESH_ATTRIBUTE_FORMAT_FLOAT4 : layout ==
+                VERTEX_LAYOUT_SNORM16 ? MESH_ATTRIBUTE_FORMAT_SNORM16X4 :
+                MESH_ATTRIBUTE_FORMAT_HALF4);
+        add_attribute(format, MESH_ATTRIBUTE_SEMANTIC_COLOUR, is_float ?
+                MESH_ATTRIBUTE_FORMAT_FLOAT4 :
+                MESH_ATTRIBUTE_FORMAT_UNORM8X4);
+        add_attribute(format, MESH_ATTRIBUTE_SEMANTIC_UV, is_float ?
+                MESH_ATTRIBUTE_FORMAT_FLOAT2 : MESH_ATTRIBUTE_FORMAT_HALF2);
+        if (has_normals) {
+                add_attribute(format, MESH_ATTRIBUTE_SEMANTIC_NORMAL,
+                        is_float ? MESH_ATTRIBUTE_FORMAT_FLOAT3 :
+                        MESH_ATTRIBUTE_FORMAT_SNORM16X2);
+        }
+
+        for (int k = 0; k < 3; ++k) {
+                format->position_scale[k] = 1.0f;
+                format->position_bias[k] = 0.0f;
+        }
+}
+
+void get_vertex_format_dequantize_mat(struct vertex_format *format,
+        mat4x4 m)
+{
+        mat4x4_identity(m);
+        for (int k = 0; k < 3; ++k) {
+                m[k][k] = format->position_scale[k];
+                m[3][k] = format->position_bias[k];
+        }
+}
+
+// Rounds to nearest even like the SSE path, with overflow going to infinity
+static unsigned short float_to_half(float value)
+{
+        unsigned int f;
+        memcpy(&f, &value, sizeof (f));
+
+        unsigned int sign = (f >> 16) & 0x8000;
+        f &= 0x7fffffff;
+
+        unsigned int h;
+        if (f >= 0x47800000) {
+                h = f > 0x7f800000 ? 0x7e00 : 0x7c00;
+        } else if (f < 0x38800000) {
+                // Adding 0.5 lines the subnormal bits up with the mantissa
+                float magic;
+                memcpy(&magic, &f, sizeof (magic));
+                magic += 0.5f;
+                memcpy(&h, &magic, sizeof (h));
+                h -= 0x3f000000;
+        } else {
+                unsigned int is_odd = (f >> 13) & 1;
+                f += 0xc8000fff + is_odd;
+                h = f >> 13;
+        }
+
+        return (unsigned short) (h | sign);
+}
+
+static float half_to_float(unsigned short h)
+{
+        unsigned int sign = (unsigned int) (h & 0x8000) << 16;
+        unsigned int exponent = (h >> 10) & 0x1f;
+        unsigned int mantissa = h & 0x3ff;
+        float value;
+
+        if (exponent == 0) {
+                value = mantissa * (1.0f / 16777216.0f);
+        } else if (exponent == 31) {
+                value = mantissa != 0 ? NAN : INFINITY;
+        } else {
+                unsigned int f = (exponent + 112) << 23 | mantissa << 13;
+                memcpy(&value, &f, sizeof (value));
+        }
+
+        unsigned int bits;
+        memcpy(&bits, &value, sizeof (bits));
+        bits |= sign;
+        memcpy(&value, &bits, sizeof (value));
+
+        return value;
+}
+
+static short float_to_snorm16(float value)
+{
+        value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+        return (short) lrintf(value * 32767.0f);
+}
+
+static unsigned char float_to_unorm8(float value)
+{
+        value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+        return (unsigned char) lrintf(value * 255.0f);
+}
+
+static void encode_octahedral(const float *normal, short *encoded)
+{
+        float x = normal[0];
+        float y = normal[1];
+        float z = normal[2];
+        float length = fabsf(x) + fabsf(y) + fabsf(z);
+        if (length == 0.0f) {
+                encoded[0] = 0;
+                encoded[1] = 0;
+                return;
+        }
+
+        x /= length;
+        y /= length;
+
+        // The lower half folds out over the corners
+        if (z < 0.0f) {
+                float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = folded_x;
+        }
+
+        encoded[0] = float_to_snorm16(x);
+        encoded[1] = float_to_snorm16(y);
+}
+
+static void decode_octahedral(const short *encoded, vec3 normal)
+{
+        float x = encoded[0] / 32767.0f;
+        float y = encoded[1] / 32767.0f;
+        float z = 1.0f - fabsf(x) - fabsf(y);
+
+        if (z < 0.0f) {
+                float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = folded_x;
+        }
+
+        normal[0] = x;
+        normal[1] = y;
+        normal[2] = z;
+        vec3_norm(normal, normal);
+}
+
+static void encode_vertex(struct vertex_encode_job *job, unsigned int i,
+        unsigned char *dst)
+{
+        struct vertex_format *format = &job->encode_info->format;
+        struct vertex *v = &job->mi->verticies[i];
+        float position[4];
+
+        for (int k = 0; k < 3; ++k) {
+                position[k] = (v->position[k] - format->position_bias[k]) *
+                        job->inverse_scale[k];
+        }
+        position[3] = v->position[3];
+
+        for (int k = 0; k < 4; ++k) {
+                if (format->layout == VERTEX_LAYOUT_SNORM16) {
+                        short snorm = float_to_snorm16(position[k]);
+                        memcpy(dst + k * 2, &snorm, sizeof (snorm));
+                } else {
+                        unsigned short half = float_to_half(position[k]);
+                        memcpy(dst + k * 2, &half, sizeof (half));
+                }
+
+                dst[8 + k] = float_to_unorm8(v->colour[k]);
+        }
+
+        for (int k = 0; k < 2; ++k) {
+                unsigned short half = float_to_half(v->uv[k]);
+                memcpy(dst + 12 + k * 2, &half, sizeof (half));
+        }
+}
+
+#if defined(VERTEX_FORMAT_USE_SSE)
+// Four halves, one in the low bits of each lane
+static __m128i float_to_half_sse(__m128 value)
+{
+        __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+        __m128 sign = _mm_and_ps(value, sign_mask);
+        __m128 abs_value = _mm_xor_ps(value, sign);
+        __m128i abs_bits = _mm_castps_si128(abs_value);
+
+        __m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(abs_value,
+                abs_value));
+        __m128i is_finite = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000),
+                abs_bits);
+        __m128i is_subnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000),
+                abs_bits);
+        __m128i infinity = _mm_or_si128(_mm_set1_epi32(0x7c00),
+                _mm_and_si128(is_nan, _mm_set1_epi32(0x200)));
+
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(
+                abs_value, _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3f000000));
+
+        __m128i is_odd = _mm_and_si128(_mm_srli_epi32(abs_bits, 13),
+                _mm_set1_epi32(1));
+        __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(abs_bits,
+                _mm_set1_epi32((int) 0xc8000fff)), is_odd), 13);
+
+        __m128i finite = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal),
+                _mm_andnot_si128(is_subnormal, normal));
+        __m128i half = _mm_or_si128(_mm_and_si128(is_finite, finite),
+                _mm_andnot_si128(is_finite, infinity));
+
+        return _mm_or_si128(half, _mm_srli_epi32(_mm_castps_si128(sign),
+                16));
+}
+
+// Packs the low halves of two registers into eight 16 bit lanes, sign
+// extending first so the saturating pack leaves them alone
+static __m128i pack_halves(__m128i a, __m128i b)
+{
+        return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+static __m128i encode_positions_sse(struct vertex_encode_job *job,
+        struct vertex *v, __m128 bias, __m128 inverse_scale)
+{
+        __m128 p0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v[0].position), bias),
+                inverse_scale);
+        __m128 p1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v[1].position), bias),
+                inverse_scale);
+
+        if (job->encode_info->format.layout == VERTEX_LAYOUT_HALF)
+                return pack_halves(float_to_half_sse(p0),
+                        float_to_half_sse(p1));
+
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 minus_one = _mm_set1_ps(-1.0f);
+        __m128 snorm_max = _mm_set1_ps(32767.0f);
+        p0 = _mm_mul_ps(_mm_min_ps(_mm_max_ps(p0, minus_one), one), snorm_max);
+        p1 = _mm_mul_ps(_mm_min_ps(_mm_max_ps(p1, minus_one), one), snorm_max);
+
+        return _mm_packs_epi32(_mm_cvtps_epi32(p0), _mm_cvtps_epi32(p1));
+}
+
+static __m128i encode_colour_sse(struct vertex *v)
+{
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 unorm_max = _mm_set1_ps(255.0f);
+
+        return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+                _mm_loadu_ps(v->colour), zero), one), unorm_max));
+}
+
+// Four vertices at once, the position pairs interleaved with the colours
+// and uvs 64 bits at a time
+static void encode_vertices_sse(struct vertex_encode_job *job,
+        unsigned int i, unsigned char *dst)
+{
+        struct vertex_format *format = &job->encode_info->format;
+        struct vertex *v = &job->mi->verticies[i];
+        unsigned int stride = format->stride;
+        __m128 bias = _mm_setr_ps(format->position_bias[0],
+                format->position_bias[1], format->position_bias[2], 0.0f);
+        __m128 inverse_scale = _mm_setr_ps(job->inverse_scale[0],
+                job->inverse_scale[1], job->inverse_scale[2], 1.0f);
+
+        __m128i p01 = encode_positions_sse(job, v, bias, inverse_scale);
+        __m128i p23 = encode_positions_sse(job, v + 2, bias, inverse_scale);
+
+        __m128i colours = _mm_packus_epi16(_mm_packs_epi32(
+                encode_colour_sse(v), encode_colour_sse(v + 1)),
+                _mm_packs_epi32(encode_colour_sse(v + 2),
+                encode_colour_sse(v + 3)));
+
+        __m128 uv01 = _mm_castsi128_ps(_mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i *) v[0].uv),
+                _mm_loadl_epi64((const __m128i *) v[1].uv)));
+        __m128 uv23 = _mm_castsi128_ps(_mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i *) v[2].uv),
+                _mm_loadl_epi64((const __m128i *) v[3].uv)));
+        __m128i uvs = pack_halves(float_to_half_sse(uv01),
+                float_to_half_sse(uv23));
+
+        __m128i colour_uv01 = _mm_unpacklo_epi32(colours, uvs);
+        __m128i colour_uv23 = _mm_unpackhi_epi32(colours, uvs);
+
+        _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi64(p01,
+                colour_uv01));
+        _mm_storeu_si128((__m128i *) (dst + stride), _mm_unpackhi_epi64(p01,
+                colour_uv01));
+        _mm_storeu_si128((__m128i *) (dst + stride * 2),
+                _mm_unpacklo_epi64(p23, colour_uv23));
+        _mm_storeu_si128((__m128i *) (dst + stride * 3),
+                _mm_unpackhi_epi64(p23, colour_uv23));
+}
+#endif
+
+static void encode_chunks(void *job_data, unsigned int first_chunk,
+        unsigned int chunk_count)
+{
+        struct vertex_encode_job *job = job_data;
+        struct vertex_encode_info *encode_info = job->encode_info;
+        struct vertex_format *format = &encode_info->format;
+        unsigned int vertex_count = job->mi->vertex_count;
+        unsigned char *data = encode_info->data;
+
+        for (unsigned int c = first_chunk; c < first_chunk + chunk_count; ++c) {
+                unsigned int first = (unsigned int) ((unsigned long long)
+                        vertex_count * c / job->chunk_count);
+                unsigned int last = (unsigned int) ((unsigned long long)
+                        vertex_count * (c + 1) / job->chunk_count);
+
+                if (format->layout == VERTEX_LAYOUT_FLOAT) {
+                        for (unsigned int i = first; i < last; ++i) {
+                                memcpy(data + (size_t) i * format->stride,
+                                        &job->mi->verticies[i],
+                                        sizeof (struct vertex));
+                        }
+                } else {
+                        unsigned int i = first;
+#if defined(VERTEX_FORMAT_USE_SSE)
+                        for (; i + 4 <= last; i += 4) {
+                                encode_vertices_sse(job, i, data +
+                                        (size_t) i * format->stride);
+                        }
+#endif
+                        for (; i < last; ++i) {
+                                encode_vertex(job, i, data +
+                                        (size_t) i * format->stride);
+                        }
+                }
+
+                if (encode_info->normals == NULL)
+                        continue;
+
+                // Normals go last in every layout
+                unsigned int offset = format->attributes[
+                        format->attribute_count - 1].offset;
+                for (unsigned int i = first; i < last; ++i) {
+                        unsigned char *dst = data + (size_t) i *
+                                format->stride + offset;
+                        if (format->layout == VERTEX_LAYOUT_FLOAT) {
+                                memcpy(dst, encode_info->normals[i],
+                                        sizeof (float) * 3);
+                        } else {
+                                short encoded[2];
+                                encode_octahedral(encode_info->normals[i],
+                                        encoded);
+                                memcpy(dst, encoded, sizeof (encoded));
+                        }
+                }
+        }
+}
+
+// Bias and scale map the bounds of the mesh onto -1 to 1
+static void set_position_range(struct vertex_format *format,
+        struct mesh_info *mi)
+{
+        vec3 min = { 0.0f, 0.0f, 0.0f };
+        vec3 max = { 0.0f, 0.0f, 0.0f };
+
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                float *position = mi->verticies[i].position;
+                for (int k = 0; k < 3; ++k) {
+                        if (i == 0 || position[k] < min[k])
+                                min[k] = position[k];
+                        if (i == 0 || position[k] > max[k])
+                                max[k] = position[k];
+                }
+        }
+
+        for (int k = 0; k < 3; ++k) {
+                format->position_bias[k] = (min[k] + max[k]) * 0.5f;
+                format->position_scale[k] = (max[k] - min[k]) * 0.5f;
+                if (format->position_scale[k] <= 0.0f)
+                        format->position_scale[k] = 1.0f;
+        }
+}
+
+void encode_vertices(struct vertex_encode_info *encode_info,
+        struct mesh_info *mi)
+{
+        struct job_system_info *job_system = encode_info->job_system;
+        struct vertex_format *format = &encode_info->format;
+        double start_time = get_time_in_secs();
+
+        get_vertex_format(encode_info->layout, encode_info->normals != NULL,
+                format);
+        if (encode_info->layout != VERTEX_LAYOUT_FLOAT)
+                set_position_range(format, mi);
+
+        encode_info->size = (unsigned long long) mi->vertex_count *
+                format->stride;
+        encode_info->data = malloc((size_t) encode_info->size + 1);
+
+        struct vertex_encode_job job;
+        job.encode_info = encode_info;
+        job.mi = mi;
+        for (int k = 0; k < 3; ++k)
+                job.inverse_scale[k] = 1.0f / format->position_scale[k];
+
+        job.chunk_count = 1;
+        if (job_system != NULL && mi->vertex_count >=
+                VERTEX_FORMAT_PARALLEL_MIN_COUNT) {
+                job.chunk_count = job_system->worker_count * 4;
+                if (job.chunk_count < 1)
+                        job.chunk_count = 1;
+                if (job.chunk_count > MAX_VERTEX_FORMAT_CHUNKS)
+                        job.chunk_count = MAX_VERTEX_FORMAT_CHUNKS;
+        }
+
+        parallel_for(job.chunk_count > 1 ? job_system : NULL,
+                job.chunk_count, 1, encode_chunks, &job);
+
+        encode_info->stats.vertex_count = mi->vertex_count;
+        encode_info->stats.chunk_count = job.chunk_count;
+        encode_info->stats.encoded_size = encode_info->size;
+        encode_info->stats.encode_time = get_time_in_secs() - start_time;
+}
+
+void release_encoded_vertices(struct vertex_encode_info *encode_info)
+{
+        free(encode_info->data);
+        encode_info->data = NULL;
+        encode_info->size = 0;
+}
+
+// Unused components are left as they are
+static void read_attribute(unsigned int format, const unsigned char *src,
+        float *values)
+{
+        switch (format)
+        {
+                case MESH_ATTRIBUTE_FORMAT_FLOAT2 :
+                case MESH_ATTRIBUTE_FORMAT_FLOAT3 :
+                case MESH_ATTRIBUTE_FORMAT_FLOAT4 :
+                        memcpy(values, src, get_vertex_attribute_size(format));
+                        break;
+
+                case MESH_ATTRIBUTE_FORMAT_SNORM16X4 :
+                        for (int k = 0; k < 4; ++k) {
+                                short snorm;
+                                memcpy(&snorm, src + k * 2, sizeof (snorm));
+                                values[k] = snorm / 32767.0f;
+                        }
+                        break;
+
+                case MESH_ATTRIBUTE_FORMAT_HALF2 :
+                case MESH_ATTRIBUTE_FORMAT_HALF4 : {
+                        int count = format == MESH_ATTRIBUTE_FORMAT_HALF2 ?
+                                2 : 4;
+                        for (int k = 0; k < count; ++k) {
+                                unsigned short half;
+                                memcpy(&half, src + k * 2, sizeof (half));
+                                values[k] = half_to_float(half);
+                        }
+                        break;
+                }
+
+                case MESH_ATTRIBUTE_FORMAT_UNORM8X4 :
+                        for (int k = 0; k < 4; ++k)
+                                values[k] = src[k] / 255.0f;
+                        break;
+
+                default :
+                        break;
+        }
+}
+
+static float get_max_difference(const float *a, const float *b, int count,
+        float error)
+{
+        for (int k = 0; k < count; ++k) {
+                float difference = fabsf(a[k] - b[k]);
+                error = difference > error ? difference : error;
+        }
+
+        return error;
+}
+
+static void decode_vertex(struct vertex_format *format,
+        const unsigned char *src, struct vertex *v, vec3 normal)
+{
+        for (unsigned int a = 0; a < format->attribute_count; ++a) {
+                struct vertex_attribute *attribute = &format->attributes[a];
+                const unsigned char *attribute_src = src + attribute->offset;
+
+                switch (attribute->semantic)
+                {
+                        case MESH_ATTRIBUTE_SEMANTIC_POSITION :
+                                read_attribute(attribute->format,
+                                        attribute_src, v->position);
+                                for (int k = 0; k < 3; ++k) {
+                                        v->position[k] = v->position[k] *
+                                                format->position_scale[k] +
+                                                format->position_bias[k];
+                                }
+                                break;
+
+                        case MESH_ATTRIBUTE_SEMANTIC_COLOUR :
+                                read_attribute(attribute->format,
+                                        attribute_src, v->colour);
+                                break;
+
+                        case MESH_ATTRIBUTE_SEMANTIC_UV :
+                                read_attribute(attribute->format,
+                                        attribute_src, v->uv);
+                                break;
+
+                        case MESH_ATTRIBUTE_SEMANTIC_NORMAL :
+                                if (attribute->format ==
+                                        MESH_ATTRIBUTE_FORMAT_FLOAT3) {
+                                        read_attribute(attribute->format,
+                                                attribute_src, normal);
+                                } else {
+                                        short encoded[2];
+                                        memcpy(encoded, attribute_src,
+                                                sizeof (encoded));
+                                        decode_octahedral(encoded, normal);
+                                }
+                                break;
+
+                        default :
+                                break;
+                }
+        }
+}
+
+void decode_vertices(struct vertex_format *format, const void *data,
+        unsigned int vertex_count, struct vertex *vertices)
+{
+        const unsigned char *src = data;
+
+        for (unsigned int i = 0; i < vertex_count; ++i) {
+                vec3 normal;
+                decode_vertex(format, src + (size_t) i * format->stride,
+                        &vertices[i], normal);
+        }
+}
+
+void get_vertex_format_errors(struct vertex_encode_info *encode_info,
+        struct mesh_info *mi, struct vertex_format_errors *errors)
+{
+        struct vertex_format *format = &encode_info->format;
+        const unsigned char *data = encode_info->data;
+
+        memset(errors, 0, sizeof (struct vertex_format_errors));
+        for (unsigned int i = 0; i < mi->vertex_count; ++i) {
+                struct vertex *v = &mi->verticies[i];
+                struct vertex decoded;
+                vec3 normal;
+                decode_vertex(format, data + (size_t) i * format->stride,
+                        &decoded, normal);
+
+                errors->position_error = get_max_difference(
+                        decoded.position, v->position, 3,
+                        errors->position_error);
+                errors->colour_error = get_max_difference(decoded.colour,
+                        v->colour, 4, errors->colour_error);
+                errors->uv_error = get_max_difference(decoded.uv, v->uv, 2,
+                        errors->uv_error);
+
+                if (encode_info->normals == NULL ||
+                        vec3_len(encode_info->normals[i]) == 0.0f)
+                        continue;
+
+                vec3 expected;
+                vec3_norm(expected, encode_info->normals[i]);
+                float cosine = vec3_mul_inner(normal, expected);
+                cosine = cosine > 1.0f ? 1.0f : cosine < -1.0f ? -1.0f :
+                        cosine;
+
+                float angle = acosf(cosine) * RADIANS_TO_DEGREES;
+                if (angle > errors->normal_error)
+                        errors->normal_error = angle;
+        }
+}
@@ -0,0 +1,110 @@
+#ifndef VERTEX_FORMAT_INTERFACE_H
+#define VERTEX_FORMAT_INTERFACE_H
+
+#include "linmath.h"
+#include "mesh_interface.h"
+#include "job_interface.h"
+
+// Compact vertex layouts. Positions are stored as 16 bit snorm or half
+// floats relative to the bounds of the mesh, with the scale and bias that
+// undo that folded into the world matrix, colours as 8 bit unorm and uvs as
+// half floats, with normals, when there are any, as 16 bit snorm
+// octahedral coordinates. That is 16 bytes a vertex, or 20 with normals,
+// against the 40 of struct vertex. Vertices are encoded four at a time with
+// SSE2, and large meshes are split across the job system. Kept free of D3D
+// types so it can run headless.
+#define MAX_VERTEX_ATTRIBUTES 8
+#define VERTEX_FORMAT_PARALLEL_MIN_COUNT 65536
+#define MAX_VERTEX_FORMAT_CHUNKS 64
+
+enum MESH_ATTRIBUTE_SEMANTIC {
+        MESH_ATTRIBUTE_SEMANTIC_POSITION,
+        MESH_ATTRIBUTE_SEMANTIC_COLOUR,
+        MESH_ATTRIBUTE_SEMANTIC_UV,
+        MESH_ATTRIBUTE_SEMANTIC_NORMAL,
+        MESH_ATTRIBUTE_SEMANTIC_TANGENT
+};
+
+enum MESH_ATTRIBUTE_FORMAT {
+        MESH_ATTRIBUTE_FORMAT_FLOAT2,
+        MESH_ATTRIBUTE_FORMAT_FLOAT3,
+        MESH_ATTRIBUTE_FORMAT_FLOAT4,
+        MESH_ATTRIBUTE_FORMAT_SNORM16X2,
+        MESH_ATTRIBUTE_FORMAT_SNORM16X4,
+        MESH_ATTRIBUTE_FORMAT_HALF2,
+        MESH_ATTRIBUTE_FORMAT_HALF4,
+        MESH_ATTRIBUTE_FORMAT_UNORM8X4
+};
+
+enum VERTEX_LAYOUT {
+        // The layout of struct vertex
+        VERTEX_LAYOUT_FLOAT,
+        VERTEX_LAYOUT_SNORM16,
+        VERTEX_LAYOUT_HALF
+};
+
+// Offset in bytes from the start of the vertex
+struct vertex_attribute {
+        unsigned int semantic;
+        unsigned int format;
+        unsigned int offset;
+};
+
+struct vertex_format {
+        unsigned int layout;
+        unsigned int attribute_count;
+        struct vertex_attribute attributes[MAX_VERTEX_ATTRIBUTES];
+        unsigned int stride;
+        // Positions are stored as (position - bias) / scale
+        vec3 position_scale;
+        vec3 position_bias;
+};
+
+// Largest difference between a vertex and its decoded encoding, in model
+// units for positions and degrees for normals
+struct vertex_format_errors {
+        float position_error;
+        float colour_error;
+        float uv_error;
+        float normal_error;
+};
+
+struct vertex_format_stats {
+        unsigned int vertex_count;
+        unsigned int chunk_count;
+        unsigned long long encoded_size;
+        double encode_time;
+};
+
+struct vertex_encode_info {
+        struct job_system_info *job_system;
+        unsigned int layout;
+        // A normal per vertex, since struct vertex has none. May be NULL.
+        float (*normals)[3];
+        struct vertex_format format;
+        void *data;
+        unsigned long long size;
+        struct vertex_format_stats stats;
+};
+
+// Returns 0 for a format that isn't one of MESH_ATTRIBUTE_FORMAT
+unsigned int get_vertex_attribute_size(unsigned int format);
+// Fills in the attributes and stride of a layout, with no scale or bias
+void get_vertex_format(unsigned int layout, int has_normals,
+        struct vertex_format *format);
+// Maps the encoded positions back to model space, to be applied before the
+// world matrix. Normals must not go through it.
+void get_vertex_format_dequantize_mat(struct vertex_format *format,
+        mat4x4 m);
+void encode_vertices(struct vertex_encode_info *encode_info,
+        struct mesh_info *mi);
+void release_encoded_vertices(struct vertex_encode_info *encode_info);
+// Decodes vertices of the format back into struct vertex, with positions
+// in model space. Normals are dropped, since struct vertex has none.
+void decode_vertices(struct vertex_format *format, const void *data,
+        unsigned int vertex_count, struct vertex *vertices);
+// Decodes every vertex and compares it with the one it was encoded from
+void get_vertex_format_errors(struct vertex_encode_info *encode_info,
+        struct mesh_info *mi, struct vertex_format_errors *errors);
+
+#endif